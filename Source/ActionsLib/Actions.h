@@ -42,6 +42,12 @@ template <typename ElemType>
 void DoWriteWordAndClassInfo(const ConfigParameters& config);
 template <typename ElemType>
 void DoTopologyPlot(const ConfigParameters& config);
+template <typename ElemType>
+void DoConvertToChunkedBinary(const ConfigParameters& config);
+template <typename ElemType>
+void DoConvertToImagePack(const ConfigParameters& config);
+template <typename ElemType>
+void DoConvertToMappableModel(const ConfigParameters& config);
 
 // special purpose (SpecialPurposeActions.cpp)
 template <typename ElemType>
@@ -16,6 +16,7 @@
 #include "DataWriter.h"
 #include "Config.h"
 #include "SimpleEvaluator.h"
+#include "MultiModelEvaluator.h"
 #include "SimpleOutputWriter.h"
 #include "BestGpu.h"
 #include "ScriptableObjects.h"
@@ -122,6 +123,11 @@ void DoCrossValidate(const ConfigParameters& config)
         evalNodeNamesVector.push_back(evalNodeNames[i]);
     }
 
+    // the models of one pass are evaluated together on a single read of the CV set, each with its own memory
+    // (0: as many as are evaluated concurrently, which is one on the GPU)
+    size_t numModelsPerPass = config(L"numModelsPerPass", "0");
+    size_t numThreads = config(L"numThreads", "0"); // number of models evaluated concurrently (0: automatic)
+
     std::vector<std::vector<double>> cvErrorResults;
     std::vector<std::wstring> cvModels;
 
@@ -145,13 +151,24 @@ void DoCrossValidate(const ConfigParameters& config)
         }
 
         cvModels.push_back(cvModelPath);
-        auto net = ComputationNetwork::CreateFromFile<ElemType>(deviceId, cvModelPath);
+    }
+
+    if (numModelsPerPass == 0)
+        numModelsPerPass = MultiModelEvaluator<ElemType>::DetermineNumThreads(deviceId, cvModels.size(), numThreads);
+    for (size_t first = 0; first < cvModels.size(); first += numModelsPerPass)
+    {
+        size_t end = min(first + numModelsPerPass, cvModels.size());
 
-        SimpleEvaluator<ElemType> eval(net, numMBsToShowResult, traceLevel);
+        std::vector<ComputationNetworkPtr> nets;
+        for (size_t k = first; k < end; k++)
+        {
+            fprintf(stderr, "model %d --> %ls\n", (int) (k - first), cvModels[k].c_str());
+            nets.push_back(ComputationNetwork::CreateFromFile<ElemType>(deviceId, cvModels[k]));
+        }
 
-        fprintf(stderr, "model %ls --> \n", cvModelPath.c_str());
+        MultiModelEvaluator<ElemType> eval(nets, numMBsToShowResult, traceLevel, numThreads);
         auto evalErrors = eval.Evaluate(&cvDataReader, evalNodeNamesVector, mbSize[0], epochSize);
-        cvErrorResults.push_back(evalErrors);
+        cvErrorResults.insert(cvErrorResults.end(), evalErrors.begin(), evalErrors.end());
 
         ::Sleep(1000 * sleepSecondsBetweenRuns);
     }
@@ -15,15 +15,19 @@
 #include "Config.h"
 #include "ScriptableObjects.h"
 #include "BrainScriptEvaluator.h"
+#include "ChunkedBinaryFile.h"
+#include "ImagePackFile.h"
 
 #include <string>
 #include <chrono>
+#include <cmath>
 #include <algorithm>
 #include <vector>
 #include <iostream>
 #include <queue>
 #include <set>
 #include <memory>
+#include <fstream>
 
 #ifndef let
 #define let const auto
@@ -513,3 +517,282 @@ void DoTopologyPlot(const ConfigParameters& config)
 
 template void DoTopologyPlot<float>(const ConfigParameters& config);
 template void DoTopologyPlot<double>(const ConfigParameters& config);
+
+// ===========================================================================
+// DoConvertToChunkedBinary() - implements CNTK "convertToChunkedBinary" command
+// ===========================================================================
+
+//////////////////////////////////////////////////////////////////////////
+//  for action convertToChunkedBinary
+//      Converts a dataset in UCI text format (one sample per line, columns separated by blanks or commas)
+//      or LibSVM format ("label index:value index:value ...") into the chunked binary format that the
+//      ChunkedBinaryReader memory-maps, so that reading an epoch needs no parsing.
+//
+//      To use this command, specify:
+//          inputFile, outputFile
+//          inputFormat         -- "uci" (default) or "libsvm"
+//          samplesPerChunk     -- number of samples per chunk, the unit of randomization and I/O (default 65536)
+//          features=[dim=...; start=...]
+//                              -- dimension and first column (UCI only); LibSVM features are stored sparse
+//          labels=[dim=1; start=...; labelDim=...]
+//                              -- with labelDim, the label is a class id in [0, labelDim), stored as a sparse
+//                                 one-hot vector; otherwise dim label values are stored dense
+//          oneBasedIndices     -- LibSVM feature indices start at 1 (default true)
+//          featureName, labelName -- stream names, to match the input nodes (default "features" and "labels")
+//      The precision of the stored values is the precision of the command.
+//////////////////////////////////////////////////////////////////////////
+
+// skips blanks and commas; returns false at the end of the line
+static bool SkipSeparators(const char*& p)
+{
+    while (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r')
+        p++;
+    return *p != 0 && *p != '\n';
+}
+
+static double ParseNumber(const char*& p, size_t lineNumber)
+{
+    char* end;
+    double value = strtod(p, &end);
+    if (end == p)
+        RuntimeError("ConvertToChunkedBinary: Invalid number in line %d: '%.20s'.", (int) lineNumber, p);
+    p = end;
+    return value;
+}
+
+// adds the label of a sample, either a class id stored as a one-hot vector or a dense value
+static void AddLabel(ChunkedBinaryWriter& writer, size_t streamId, size_t labelDim, size_t index, double value, size_t lineNumber)
+{
+    if (labelDim == 0)
+    {
+        writer.AddValue(streamId, index, value);
+        return;
+    }
+    if (value < 0 || value >= labelDim || value != floor(value))
+        RuntimeError("ConvertToChunkedBinary: Label %f in line %d is not a class id in [0, %d).", value, (int) lineNumber, (int) labelDim);
+    writer.AddValue(streamId, (size_t) value, 1.0);
+}
+
+template <typename ElemType>
+void DoConvertToChunkedBinary(const ConfigParameters& config)
+{
+    wstring inputFile = config(L"inputFile");
+    wstring outputFile = config(L"outputFile");
+    string inputFormat = config(L"inputFormat", "uci");
+    size_t samplesPerChunk = config(L"samplesPerChunk", (size_t) 65536);
+    int traceLevel = config(L"traceLevel", "0");
+    bool isLibSVM = inputFormat == "libsvm";
+    if (!isLibSVM && inputFormat != "uci")
+        InvalidArgument("ConvertToChunkedBinary: inputFormat must be 'uci' or 'libsvm'.");
+
+    ConfigParameters featureConfig(config(L"features"));
+    ConfigParameters labelConfig;
+    if (config.ExistsCurrent(L"labels"))
+        labelConfig = ConfigParameters(config(L"labels"));
+    size_t featureDim = featureConfig(L"dim");
+    size_t featureStart = isLibSVM ? 0 : (size_t) featureConfig(L"start");
+    size_t labelDim = labelConfig(L"labelDim", (size_t) 0);
+    size_t labelValueDim = labelConfig(L"dim", (size_t) 1);
+    size_t labelStart = isLibSVM ? 0 : (size_t) labelConfig(L"start", (size_t) 0);
+    bool hasLabels = isLibSVM || labelConfig.ExistsCurrent(L"start") || labelDim > 0;
+    bool oneBasedIndices = config(L"oneBasedIndices", true);
+    if (isLibSVM && labelValueDim != 1)
+        InvalidArgument("ConvertToChunkedBinary: LibSVM files have a single label.");
+
+    ElementType elementType = sizeof(ElemType) == sizeof(double) ? ElementType::tdouble : ElementType::tfloat;
+    vector<StreamDescriptionPtr> streams;
+    auto features = make_shared<StreamDescription>();
+    features->m_id = 0;
+    features->m_name = (wstring) config(L"featureName", L"features");
+    features->m_storageType = isLibSVM ? StorageType::sparse_csc : StorageType::dense;
+    features->m_elementType = elementType;
+    features->m_sampleLayout = make_shared<TensorShape>(featureDim);
+    streams.push_back(features);
+    if (hasLabels)
+    {
+        auto labels = make_shared<StreamDescription>();
+        labels->m_id = 1;
+        labels->m_name = (wstring) config(L"labelName", L"labels");
+        labels->m_storageType = labelDim > 0 ? StorageType::sparse_csc : StorageType::dense;
+        labels->m_elementType = elementType;
+        labels->m_sampleLayout = make_shared<TensorShape>(labelDim > 0 ? labelDim : labelValueDim);
+        streams.push_back(labels);
+    }
+
+    auto start = chrono::system_clock::now();
+    ifstream input(msra::strfun::utf8(inputFile).c_str());
+    if (!input)
+        RuntimeError("ConvertToChunkedBinary: Cannot open '%ls'.", inputFile.c_str());
+    ChunkedBinaryWriter writer(outputFile, streams, samplesPerChunk);
+
+    string line;
+    vector<double> columns;
+    for (size_t lineNumber = 1; getline(input, line); lineNumber++)
+    {
+        const char* p = line.c_str();
+        if (!SkipSeparators(p))
+            continue; // empty line
+
+        if (isLibSVM)
+        {
+            AddLabel(writer, 1, labelDim, 0, ParseNumber(p, lineNumber), lineNumber);
+            while (SkipSeparators(p) && *p != '#')
+            {
+                if (strncmp(p, "qid:", 4) == 0) // query ids of ranking data are not used
+                {
+                    p += 4;
+                    ParseNumber(p, lineNumber);
+                    continue;
+                }
+                double index = ParseNumber(p, lineNumber);
+                if (*p != ':')
+                    RuntimeError("ConvertToChunkedBinary: Expected 'index:value' in line %d.", (int) lineNumber);
+                p++;
+                double value = ParseNumber(p, lineNumber);
+                if (oneBasedIndices)
+                    index -= 1;
+                if (index < 0)
+                    RuntimeError("ConvertToChunkedBinary: Negative feature index in line %d; check oneBasedIndices.", (int) lineNumber);
+                writer.AddValue(0, (size_t) index, value);
+            }
+        }
+        else
+        {
+            columns.clear();
+            do
+            {
+                columns.push_back(ParseNumber(p, lineNumber));
+            } while (SkipSeparators(p));
+
+            if (columns.size() < featureStart + featureDim || (hasLabels && columns.size() < labelStart + labelValueDim))
+                RuntimeError("ConvertToChunkedBinary: Line %d has only %d columns.", (int) lineNumber, (int) columns.size());
+            for (size_t i = 0; i < featureDim; i++)
+                writer.AddValue(0, i, columns[featureStart + i]);
+            for (size_t i = 0; hasLabels && i < labelValueDim; i++)
+                AddLabel(writer, 1, labelDim, i, columns[labelStart + i], lineNumber);
+        }
+        writer.EndSample();
+
+        if (traceLevel > 0 && writer.GetNumSamples() % 1000000 == 0)
+            fprintf(stderr, "ConvertToChunkedBinary: %d samples converted.\n", (int) writer.GetNumSamples());
+    }
+    writer.Close();
+
+    double seconds = chrono::duration<double>(chrono::system_clock::now() - start).count();
+    fprintf(stderr, "ConvertToChunkedBinary: Converted %d samples from '%ls' to '%ls' in %.2f seconds.\n",
+            (int) writer.GetNumSamples(), inputFile.c_str(), outputFile.c_str(), seconds);
+}
+
+template void DoConvertToChunkedBinary<float>(const ConfigParameters& config);
+template void DoConvertToChunkedBinary<double>(const ConfigParameters& config);
+
+// ===========================================================================
+// DoConvertToImagePack() - implements CNTK "convertToImagePack" command
+// ===========================================================================
+
+//////////////////////////////////////////////////////////////////////////
+//  for action convertToImagePack
+//      Packs the images listed in an ImageReader map file (lines "path<TAB>classId") into one image pack file,
+//      which the ImageReader accepts as its 'file' in place of the map file. The images are copied as they
+//      are (still encoded), in map file order; they are decoded when they are read.
+//
+//      To use this command, specify:
+//          mapFile, outputFile
+//          imagesPerChunk      -- number of images per chunk, the unit of randomization and I/O (default 256);
+//                                 the reader holds up to chunkCacheSize chunks of decoded images in memory
+//////////////////////////////////////////////////////////////////////////
+
+template <typename ElemType>
+void DoConvertToImagePack(const ConfigParameters& config)
+{
+    wstring mapFile = config(L"mapFile");
+    wstring outputFile = config(L"outputFile");
+    size_t imagesPerChunk = config(L"imagesPerChunk", (size_t) 256);
+    int traceLevel = config(L"traceLevel", "0");
+
+    auto start = chrono::system_clock::now();
+    ifstream input(msra::strfun::utf8(mapFile).c_str());
+    if (!input)
+        RuntimeError("ConvertToImagePack: Cannot open '%ls'.", mapFile.c_str());
+    ImagePackWriter writer(outputFile, imagesPerChunk);
+
+    string line;
+    vector<char> image;
+    for (size_t lineNumber = 1; getline(input, line); lineNumber++)
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+            continue;
+
+        size_t tab = line.find('\t');
+        if (tab == string::npos)
+            RuntimeError("ConvertToImagePack: Line %d of '%ls' must contain 2 tab-delimited columns.", (int) lineNumber, mapFile.c_str());
+        string imagePath = line.substr(0, tab);
+        string classId = line.substr(tab + 1, line.find('\t', tab + 1) - tab - 1);
+        char* end;
+        unsigned long long label = strtoull(classId.c_str(), &end, 10);
+        if (classId.empty() || *end != 0)
+            RuntimeError("ConvertToImagePack: Invalid class id '%s' in line %d.", classId.c_str(), (int) lineNumber);
+
+        ifstream imageFile(imagePath.c_str(), ios::binary);
+        if (!imageFile)
+            RuntimeError("ConvertToImagePack: Cannot open image '%s' (line %d).", imagePath.c_str(), (int) lineNumber);
+        image.assign(istreambuf_iterator<char>(imageFile), istreambuf_iterator<char>());
+        writer.AddImage(image.data(), image.size(), (size_t) label);
+
+        if (traceLevel > 0 && writer.GetNumImages() % 100000 == 0)
+            fprintf(stderr, "ConvertToImagePack: %d images packed.\n", (int) writer.GetNumImages());
+    }
+    writer.Close();
+
+    double seconds = chrono::duration<double>(chrono::system_clock::now() - start).count();
+    fprintf(stderr, "ConvertToImagePack: Packed %d images from '%ls' into '%ls' in %.2f seconds.\n",
+            (int) writer.GetNumImages(), mapFile.c_str(), outputFile.c_str(), seconds);
+}
+
+template void DoConvertToImagePack<float>(const ConfigParameters& config);
+template void DoConvertToImagePack<double>(const ConfigParameters& config);
+
+// ===========================================================================
+// DoConvertToMappableModel() - implements CNTK "convertToMappableModel" command
+// ===========================================================================
+
+//////////////////////////////////////////////////////////////////////////
+//  for action convertToMappableModel
+//      Rewrites a model with its matrices stored as aligned blobs (model version 3), which are memory-mapped when the
+//      model is loaded: parameters on the CPU then use the mapped pages in place, so startup does not read or copy
+//      them and processes that load the same model share its pages.
+//
+//      To use this command, specify:
+//          modelPath           -- the model to convert
+//          outputModelPath     -- where to write the converted model
+//          benchmark           -- if true (default), load both models again and report their load times
+//////////////////////////////////////////////////////////////////////////
+
+template <typename ElemType>
+void DoConvertToMappableModel(const ConfigParameters& config)
+{
+    wstring modelPath = config(L"modelPath");
+    wstring outputModelPath = config(L"outputModelPath");
+    bool benchmark = config(L"benchmark", true);
+
+    auto net = ComputationNetwork::CreateFromFile<ElemType>(CPUDEVICE, modelPath);
+    net->Save(outputModelPath, (FileOptions) (fileOptionsBinary | fileOptionsMappable));
+    fprintf(stderr, "ConvertToMappableModel: Converted '%ls' to '%ls'.\n", modelPath.c_str(), outputModelPath.c_str());
+    net.reset();
+
+    if (benchmark)
+    {
+        for (const auto& path : {modelPath, outputModelPath})
+        {
+            auto start = chrono::system_clock::now();
+            auto loadedNet = ComputationNetwork::CreateFromFile<ElemType>(CPUDEVICE, path);
+            double seconds = chrono::duration<double>(chrono::system_clock::now() - start).count();
+            fprintf(stderr, "ConvertToMappableModel: Loading '%ls' takes %.3f seconds.\n", path.c_str(), seconds);
+        }
+    }
+}
+
+template void DoConvertToMappableModel<float>(const ConfigParameters& config);
+template void DoConvertToMappableModel<double>(const ConfigParameters& config);
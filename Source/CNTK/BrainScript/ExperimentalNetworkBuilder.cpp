@@ -46,6 +46,8 @@ wstring computationNodes = // TODO: use actual TypeName() here? would first need
     L"PastValue(dims, input, timeStep = 1, defaultHiddenActivation = 0.1, tag='') = new ComputationNode [ operation = 'PastValue' ; inputs = input ; shape = new TensorShape [ /*dims*/ ] /*plus the function args*/ ]\n"
     L"FutureValue(dims, input, timeStep = 1, defaultHiddenActivation = 0.1, tag='') = new ComputationNode [ operation = 'FutureValue' ; inputs = input ; shape = new TensorShape [ /*dims*/ ] /*plus the function args*/ ]\n"
     // TODO: ^^ DelayedValues no longer need to know their dimension. That is inferred in Validation.
+    L"LSTM(input, W, R, b, peepholes, defaultHiddenActivation = 0.1, tag='') = new ComputationNode [ operation = 'LSTM' ; inputs = (input : W : R : b : peepholes) /*plus the function args*/ ]\n"
+    L"GRU(input, W, R, b, defaultHiddenActivation = 0.1, tag='') = new ComputationNode [ operation = 'GRU' ; inputs = (input : W : R : b) /*plus the function args*/ ]\n"
     L"Shift(input, fromOffset, boundaryValue, boundaryMode=-1/*context*/, dim=-1, tag='') = new ComputationNode [ operation = 'Shift' ; inputs = (input : boundaryValue) /*plus the function args*/ ]\n"
     L"RowSlice(startIndex, numRows, input, needGradient = false, tag='') = new ComputationNode [ operation = 'RowSlice' ; inputs = input /*plus the function args*/ ]\n"
     L"RowRepeat(input, numRepeats, needGradient = false, tag='') = new ComputationNode [ operation = 'RowRepeat' ; inputs = input /*plus the function args*/ ]\n"
@@ -93,7 +95,6 @@ wstring computationNodes = // TODO: use actual TypeName() here? would first need
     QuaternaryStandardNode(GMMLogLikelihood, unnormalizedPriorVector, meansAsRows, logStdDevAsRows, dataVectorSequence)
     UnaryStandardNode(InvStdDev, dataVectorSequence)
     BinaryStandardNode(KhatriRaoProduct, leftMatrix, rightMatrix)
-    //BinaryStandardNode(LSTMNode)
     UnaryStandardNode(Log, x)
     UnaryStandardNode(LogSoftmax, z)
     //BinaryStandardNode(LookupTableNode)
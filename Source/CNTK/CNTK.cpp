@@ -278,6 +278,18 @@ void DoCommands(const ConfigParameters& config)
             {
                 DoParameterSVD<ElemType>(commandParams);
             }
+            else if (action[j] == "convertToChunkedBinary")
+            {
+                DoConvertToChunkedBinary<ElemType>(commandParams);
+            }
+            else if (action[j] == "convertToImagePack")
+            {
+                DoConvertToImagePack<ElemType>(commandParams);
+            }
+            else if (action[j] == "convertToMappableModel")
+            {
+                DoConvertToMappableModel<ElemType>(commandParams);
+            }
             else
             {
                 RuntimeError("unknown action: %s  in command set: %s", action[j].c_str(), command[i].c_str());
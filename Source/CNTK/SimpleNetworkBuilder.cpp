@@ -782,6 +782,9 @@ shared_ptr<ComputationNode<ElemType>> /*ComputationNodePtr*/ SimpleNetworkBuilde
 template <class ElemType>
 shared_ptr<ComputationNode<ElemType>> /*ComputationNodePtr*/ SimpleNetworkBuilder<ElemType>::BuildLSTMComponent(unsigned long& randomSeed, size_t iLayer, size_t inputDim, size_t outputDim, ComputationNodePtr inputObs)
 {
+    if (m_fusedLSTM)
+        return BuildLSTMNodeComponent(randomSeed, iLayer, inputDim, outputDim, inputObs);
+
     ComputationNetworkBuilder<ElemType> builder(*m_net);
 
     size_t numHiddenLayers = m_layerSizes.size() - 2;
@@ -1144,45 +1147,36 @@ ComputationNetworkPtr SimpleNetworkBuilder<ElemType>::BuildClassLSTMNetworkFromD
     return m_net;
 }
 
-#if 1
-template <class ElemType>
-shared_ptr<ComputationNode<ElemType>> /*ComputationNodePtr*/ SimpleNetworkBuilder<ElemType>::BuildLSTMNodeComponent(ULONG&, size_t, size_t, size_t, ComputationNodePtr)
-{
-    InvalidArgument("BuildLSTMNodeComponent: LSTMNode is no longer available. You should not get here.");
-}
-#else
+// same function as BuildLSTMComponent(), computed by a single fused LSTMNode
+// The gate weights are stacked (input, forget, cell, output) into one input and one recurrent matrix.
 template <class ElemType>
 shared_ptr<ComputationNode<ElemType>> /*ComputationNodePtr*/ SimpleNetworkBuilder<ElemType>::BuildLSTMNodeComponent(ULONG& randomSeed, size_t iLayer, size_t inputDim, size_t outputDim, ComputationNodePtr inputObs)
 {
     ComputationNetworkBuilder<ElemType> builder(*m_net);
-    size_t numHiddenLayers = m_layerSizes.size() - 2;
+
+    if (m_constInputGateValue || m_constForgetGateValue || m_constOutputGateValue)
+        InvalidArgument("BuildLSTMNodeComponent: The fused LSTM does not support constant gates. Set fusedLSTM=false.");
+    if (m_nonLinearFunctions[0] != OperationNameOf(SigmoidNode))
+        InvalidArgument("BuildLSTMNodeComponent: The fused LSTM requires Sigmoid as the gate nonlinearity. Set fusedLSTM=false.");
 
     ComputationNodePtr input, output;
-    ComputationNodePtr wInputGate, wForgetGate, wOutputGate, wMemoryCellMatrix;
+    ComputationNodePtr W, R, b, peepholes;
 
-    input = inputObs;
-    size_t nDim = inputDim + outputDim + 2;
-    wInputGate = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"WINPUTGATE%d", iLayer), outputDim, nDim);
-    m_net->InitLearnableParameters(wInputGate, m_uniformInit, randomSeed++, m_initValueScale);
-    wInputGate->Value().ColumnSlice(0, 1).SetValue(m_inputGateInitVal); // init to input gate bias
-    wForgetGate = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"WFORGETGATE%d", iLayer), outputDim, nDim);
-    m_net->InitLearnableParameters(wForgetGate, m_uniformInit, randomSeed++, m_initValueScale);
-    wForgetGate->Value().ColumnSlice(0, 1).SetValue(m_forgetGateInitVal); // init to forget gate bias
-    wOutputGate = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"WOUTPUTGATE%d", iLayer), outputDim, nDim);
-    m_net->InitLearnableParameters(wOutputGate, m_uniformInit, randomSeed++, m_initValueScale);
-    wOutputGate->Value().ColumnSlice(0, 1).SetValue(m_outputGateInitVal); // init to output gate bias
-    wMemoryCellMatrix = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"WMEMORYCELLWEIGHT%d", iLayer), outputDim, inputDim + outputDim + 1);
-    m_net->InitLearnableParameters(wMemoryCellMatrix, m_uniformInit, randomSeed++, m_initValueScale);
-    wMemoryCellMatrix->Value().ColumnSlice(0, 1).SetValue(0); // init to memory cell bias
-
-    output = builder.LSTM(inputObs, wInputGate, wForgetGate, wOutputGate, wMemoryCellMatrix, msra::strfun::wstrprintf(L"LSTM%d", iLayer));
+    W = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"WX%d", iLayer), 4 * outputDim, inputDim);
+    m_net->InitLearnableParameters(W, m_uniformInit, randomSeed++, m_initValueScale);
+    R = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"WH%d", iLayer), 4 * outputDim, outputDim);
+    m_net->InitLearnableParameters(R, m_uniformInit, randomSeed++, m_initValueScale);
+    peepholes = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"WC%d", iLayer), outputDim, 3);
+    m_net->InitLearnableParameters(peepholes, m_uniformInit, randomSeed++, m_initValueScale);
 
-#ifdef DEBUG_DECODER
-    wInputGate->Value().SetValue((ElemType) 0.01);
-    wForgetGate->Value().SetValue((ElemType) 0.01);
-    wOutputGate->Value().SetValue((ElemType) 0.01);
-    wMemoryCellMatrix->Value().SetValue((ElemType) 0.01);
-#endif
+    // one bias column per gate
+    b = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"b%d", iLayer), outputDim, 4);
+    b->Value().ColumnSlice(0, 1).SetValue(m_inputGateInitVal);
+    b->Value().ColumnSlice(1, 1).SetValue(m_forgetGateInitVal);
+    b->Value().ColumnSlice(2, 1).SetValue(0);
+    b->Value().ColumnSlice(3, 1).SetValue(m_outputGateInitVal);
+
+    output = builder.LSTM(inputObs, W, R, b, peepholes, m_defaultHiddenActivity, msra::strfun::wstrprintf(L"LSTM%d", iLayer));
 
     if (m_addDropoutNodes)
         input = builder.Dropout(output);
@@ -1192,7 +1186,6 @@ shared_ptr<ComputationNode<ElemType>> /*ComputationNodePtr*/ SimpleNetworkBuilde
 
     return output;
 }
-#endif
 
 template <class ElemType>
 ComputationNetworkPtr SimpleNetworkBuilder<ElemType>::BuildLSTMNetworkFromDescription()
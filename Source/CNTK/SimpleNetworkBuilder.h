@@ -160,6 +160,7 @@ public:
         m_forgetGateInitVal = config("forgetGateInitVal", "-1");
         m_inputGateInitVal = config("inputGateInitVal", "-1");
         m_outputGateInitVal = config("outputGateInitVal", "-1");
+        m_fusedLSTM = config("fusedLSTM", "false"); // use the fused LSTMNode instead of composing the LSTM from elementary nodes
 
         m_sparse_input = config("sparseinput", "false");
 
@@ -346,6 +347,7 @@ protected:
     ElemType m_forgetGateInitVal;
     ElemType m_inputGateInitVal;
     ElemType m_outputGateInitVal;
+    bool m_fusedLSTM;
 
     intargvector m_streamSizes;           // for multiple stream data
     intargvector m_lookupTabelOrderSizes; // each stream has its own projection, so need to provide with the lookup table order size for each stream
@@ -293,6 +293,26 @@ void SynchronousNodeEvaluator<ElemType>::Evaluate(NDLNode<ElemType>* node, const
             // nodePtr->SetParameterUpdateRequired(needGradient);    // TODO: what's this for?
         }
     }
+    else if (cnNodeType == OperationNameOf(LSTMNode) ||
+             cnNodeType == OperationNameOf(GRUNode))
+    {
+        size_t numInputs = cnNodeType == OperationNameOf(LSTMNode) ? 5 : 4;
+        if (parameter.size() != numInputs)
+            RuntimeError("%ls should have %d fixed parameters. Usage: LSTM(input, W, R, b, peepholes, [defaultHiddenActivity=0.1]) or GRU(input, W, R, b, [defaultHiddenActivity=0.1]).", cnNodeType.c_str(), (int) numInputs);
+
+        // all fixed parameters are inputs
+        nodeParamCount = numInputs;
+        nodeParamStart = 0;
+
+        if (pass == ndlPassInitial)
+        {
+            float defaultHiddenActivity = node->GetOptionalParameter("defaultHiddenActivity", "0.1");
+            if (cnNodeType == OperationNameOf(LSTMNode))
+                nodePtr = builder.LSTM(NULL, NULL, NULL, NULL, NULL, defaultHiddenActivity, name);
+            else
+                nodePtr = builder.GRU(NULL, NULL, NULL, NULL, defaultHiddenActivity, name);
+        }
+    }
     else if (cnNodeType == OperationNameOf(ConvolutionNode))
     {
         if (parameter.size() != 7)
@@ -34,6 +34,26 @@ std::string GetEvalName(double)
     return name;
 }
 
+template <class ElemType>
+std::string GetEvalConcurrentName(ElemType)
+{
+    std::string empty;
+    return empty;
+}
+
+template <>
+std::string GetEvalConcurrentName(float)
+{
+    std::string name = "GetEvalConcurrentF";
+    return name;
+}
+template <>
+std::string GetEvalConcurrentName(double)
+{
+    std::string name = "GetEvalConcurrentD";
+    return name;
+}
+
 template <class ElemType>
 void Eval<ElemType>::Init(const std::string& /*config*/)
 {
@@ -136,7 +156,94 @@ void Eval<ElemType>::ResetState()
     m_eval->ResetState();
 }
 
+// -----------------------------------------------------------------------
+// EvalConcurrent
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+void EvalConcurrent<ElemType>::Init(const std::string& /*config*/)
+{
+    LogicError("Init shouldn't be called, use constructor");
+    // not implemented, calls the underlying class instead
+}
+
+// Destroy - cleanup and remove this class
+// NOTE: this destroys the object, and it can't be used past this point
+template <class ElemType>
+void EvalConcurrent<ElemType>::Destroy()
+{
+    m_eval->Destroy();
+}
+
+template <class ElemType>
+void EvalConcurrent<ElemType>::GetEvalClass(const std::string& config)
+{
+    typedef void (*GetEvalProc)(IEvaluateModelConcurrent<ElemType>** peval);
+
+    // initialize just in case
+    m_eval = NULL;
+    std::wstring module = L"CNTKEval";
+    // get the name for the dll we want to use, default to CNTKEval.dll
+    std::string::size_type found = config.find("evaluator=");
+    if (found != std::string::npos)
+    {
+        std::string::size_type end = config.find_first_of("\n \t", found);
+        if (end != std::string::npos)
+        {
+            module = msra::strfun::utf16(config.substr(found, end - found));
+        }
+    }
+    // create a variable of each type just to call the proper templated version
+    ElemType elemType = ElemType();
+    GetEvalProc getEvalProc = (GetEvalProc) Plugin::Load(module, GetEvalConcurrentName(elemType));
+    getEvalProc(&m_eval);
+}
+
+template <class ElemType>
+EvalConcurrent<ElemType>::EvalConcurrent(const std::string& config)
+{
+    GetEvalClass(config);
+    m_eval->Init(config);
+}
+
+template <class ElemType>
+EvalConcurrent<ElemType>::~EvalConcurrent()
+{
+    // free up resources
+    if (m_eval != NULL)
+    {
+        m_eval->Destroy();
+        m_eval = NULL;
+    }
+}
+
+template <class ElemType>
+void EvalConcurrent<ElemType>::LoadModel(const std::wstring& modelFileName)
+{
+    m_eval->LoadModel(modelFileName);
+}
+
+template <class ElemType>
+void EvalConcurrent<ElemType>::GetNodeDimensions(std::map<std::wstring, size_t>& dimensions, NodeGroup nodeGroup)
+{
+    m_eval->GetNodeDimensions(dimensions, nodeGroup);
+}
+
+template <class ElemType>
+void EvalConcurrent<ElemType>::StartEvaluateMinibatchLoop(const std::vector<std::wstring>& inputNodeNames, const std::vector<std::wstring>& outputNodeNames)
+{
+    m_eval->StartEvaluateMinibatchLoop(inputNodeNames, outputNodeNames);
+}
+
+template <class ElemType>
+void EvalConcurrent<ElemType>::Evaluate(const ElemType* const* inputs, ElemType* const* outputs, size_t numSamples)
+{
+    m_eval->Evaluate(inputs, outputs, numSamples);
+}
+
 //The explicit instantiation
 template class Eval<double>;
 template class Eval<float>;
+template class EvalConcurrent<double>;
+template class EvalConcurrent<float>;
 } } }
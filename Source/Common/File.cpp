@@ -20,6 +20,9 @@
 #endif
 #ifdef __unix__
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #endif
 
 namespace Microsoft { namespace MSR { namespace CNTK {
@@ -43,6 +46,31 @@ File::File(const wchar_t* filename, int fileOptions)
     Init(filename, fileOptions);
 }
 
+File::File(int fileOptions)
+{
+    m_filename = L"<in-memory file>";
+    m_options = fileOptions;
+    m_mappingSize = 0;
+    m_pcloseNeeded = false;
+    m_seekable = true;
+    m_inMemory = true;
+    m_memoryBuffer = nullptr;
+    m_memorySize = 0;
+    if ((fileOptions & (fileOptionsType | fileOptionsReadWrite)) != (fileOptionsBinary | fileOptionsWrite))
+        RuntimeError("File: in-memory files are for writing binary data");
+#ifdef _WIN32
+    // there are no memory streams; a short-lived temporary file that is deleted on close is kept in the file cache
+    wchar_t tempDir[MAX_PATH], tempPath[MAX_PATH];
+    if (!GetTempPathW(MAX_PATH, tempDir) || !GetTempFileNameW(tempDir, L"cnt", 0, tempPath))
+        RuntimeError("File: cannot create a temporary file for an in-memory file");
+    m_file = fopenOrDie(tempPath, L"w+bTD");
+#else
+    m_file = open_memstream(&m_memoryBuffer, &m_memorySize);
+    if (!m_file)
+        RuntimeError("File: cannot create an in-memory file: %s", strerror(errno));
+#endif
+}
+
 template<class String>
 static bool IsNonFilePath(const String& filename)
 {
@@ -78,6 +106,10 @@ void File::Init(const wchar_t* filename, int fileOptions)
 {
     m_filename = filename;
     m_options = fileOptions;
+    m_mappingSize = 0;
+    m_inMemory = false;
+    m_memoryBuffer = nullptr;
+    m_memorySize = 0;
     if (m_filename.empty())
         RuntimeError("File: filename is empty");
     const auto outputPipe = (m_filename.front() == '|');
@@ -161,6 +193,90 @@ bool File::IsTextBased()
     return !!(m_options & fileOptionsText);
 }
 
+// alignment of mappable blobs, enough for aligned vector loads
+static const uint64_t MappableBlobAlignment = 64;
+
+// Map - map the whole file into memory
+// The mapping is read-only: its pages are shared with the page cache and other processes. Users that want to modify
+// data in place must copy it first (see CPUMatrix::MakeWritable()).
+void File::Map()
+{
+    if (m_mapping)
+        return;
+    if (!CanSeek() || !(m_options & fileOptionsRead))
+        RuntimeError("File: attempted to Map() a stream that is not a regular file opened for reading");
+
+    size_t size = Size();
+    if (size == 0)
+        RuntimeError("File: cannot map empty file '%ls'", m_filename.c_str());
+#ifdef _WIN32
+    HANDLE file = CreateFileW(m_filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        RuntimeError("File: cannot open '%ls' for mapping", m_filename.c_str());
+    HANDLE mappingHandle = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    char* data = mappingHandle ? (char*) MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!data)
+    {
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        CloseHandle(file);
+        RuntimeError("File: cannot map '%ls'", m_filename.c_str());
+    }
+    m_mapping.reset(data, [mappingHandle, file](char* p)
+                    {
+                        UnmapViewOfFile(p);
+                        CloseHandle(mappingHandle);
+                        CloseHandle(file);
+                    });
+#else
+    int file = open(msra::strfun::utf8(m_filename).c_str(), O_RDONLY);
+    if (file < 0)
+        RuntimeError("File: cannot open '%ls' for mapping", m_filename.c_str());
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+    close(file); // the mapping keeps the file open
+    if (data == MAP_FAILED)
+        RuntimeError("File: cannot map '%ls': %s", m_filename.c_str(), strerror(errno));
+    m_mapping.reset((char*) data, [size](char* p)
+                    {
+                        munmap(p, size);
+                    });
+#endif
+    m_mappingSize = size;
+}
+
+// WriteMappableBlob - write a data blob aligned to MappableBlobAlignment
+void File::WriteMappableBlob(const void* data, size_t numBytes)
+{
+    static const char zeros[MappableBlobAlignment] = {};
+    uint64_t pos = GetPosition() + sizeof(uint64_t);
+    uint64_t offset = (pos + MappableBlobAlignment - 1) / MappableBlobAlignment * MappableBlobAlignment;
+    fput(m_file, offset);
+    fwriteOrDie(zeros, 1, (size_t) (offset - pos), m_file);
+    if (numBytes > 0)
+        fwriteOrDie(data, 1, numBytes, m_file);
+}
+
+// ReadMappableBlob - reference a data blob in the mapping, or read it into 'buffer' if the file is not mapped
+char* File::ReadMappableBlob(size_t numBytes, void* buffer)
+{
+    uint64_t offset;
+    fget(m_file, offset);
+    if (m_mapping)
+    {
+        if (offset + numBytes > m_mappingSize)
+            RuntimeError("File: mappable blob at offset %llu exceeds the size of '%ls'", (unsigned long long) offset, m_filename.c_str());
+        SetPosition(offset + numBytes);
+        return m_mapping.get() + offset;
+    }
+
+    if (!buffer)
+        LogicError("ReadMappableBlob: a buffer is required when the file is not mapped");
+    SetPosition(offset);
+    if (numBytes > 0)
+        freadOrDie(buffer, 1, numBytes, m_file);
+    return (char*) buffer;
+}
+
 // File Destructor
 // closes the file
 // Note: this does not check for errors. Use Flush() before closing a file you are writing.
@@ -170,6 +286,7 @@ File::~File(void)
         _pclose(m_file);
     else if (m_file != stdin && m_file != stdout && m_file != stderr)
         fclose(m_file); // (since destructors may not throw, we ignore the return code here)
+    free(m_memoryBuffer);
 }
 
 void File::Flush()
@@ -177,6 +294,32 @@ void File::Flush()
     fflushOrDie(m_file);
 }
 
+// GetBuffer - return a copy of the data written to an in-memory file
+std::vector<char> File::GetBuffer()
+{
+    if (!m_inMemory)
+        LogicError("File: GetBuffer() called on '%ls', which is not an in-memory file", m_filename.c_str());
+#ifdef _WIN32
+    Flush();
+    uint64_t pos = GetPosition();
+    std::vector<char> buffer(filesize(m_file));
+    SetPosition(0);
+    if (!buffer.empty())
+        freadOrDie(buffer.data(), 1, buffer.size(), m_file);
+    SetPosition(pos);
+    return buffer;
+#else
+    // (a flush sets m_memorySize to the current position, so go to the end first)
+    uint64_t pos = GetPosition();
+    if (fseek(m_file, 0, SEEK_END) != 0)
+        RuntimeError("File: cannot seek in an in-memory file: %s", strerror(errno));
+    Flush();
+    std::vector<char> buffer(m_memoryBuffer, m_memoryBuffer + m_memorySize);
+    SetPosition(pos);
+    return buffer;
+#endif
+}
+
 // read a line
 // End of line is denoted by one of these, i.e. we don't support the old Mac OS convention of CR
 //  - LF
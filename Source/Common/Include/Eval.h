@@ -58,6 +58,29 @@ void EVAL_API GetEval(IEvaluateModel<ElemType>** peval);
 extern "C" EVAL_API void GetEvalF(IEvaluateModel<float>** peval);
 extern "C" EVAL_API void GetEvalD(IEvaluateModel<double>** peval);
 
+// IEvaluateModelConcurrent - interface for evaluation servers with many concurrent callers
+// All methods except Evaluate() must be called from a single thread before evaluation starts.
+// Evaluate() is thread-safe: requests from concurrent callers are coalesced into micro-batches, which are
+// evaluated by a pool of network instances that share the model parameters but have their own activations.
+// Only models without recurrence (frame mode) are supported; StartEvaluateMinibatchLoop() rejects the others.
+template <class ElemType>
+class IEvaluateModelConcurrent
+{
+public:
+    virtual void Init(const std::string& config) = 0;
+    virtual void Destroy() = 0;
+
+    virtual void LoadModel(const std::wstring& modelFileName) = 0;
+    virtual void GetNodeDimensions(std::map<std::wstring, size_t>& dimensions, NodeGroup nodeGroup) = 0;
+    virtual void StartEvaluateMinibatchLoop(const std::vector<std::wstring>& inputNodeNames, const std::vector<std::wstring>& outputNodeNames) = 0;
+    virtual void Evaluate(const ElemType* const* inputs, ElemType* const* outputs, size_t numSamples) = 0;
+};
+
+template <class ElemType>
+void EVAL_API GetEvalConcurrent(IEvaluateModelConcurrent<ElemType>** peval);
+extern "C" EVAL_API void GetEvalConcurrentF(IEvaluateModelConcurrent<float>** peval);
+extern "C" EVAL_API void GetEvalConcurrentD(IEvaluateModelConcurrent<double>** peval);
+
 // Data Reader class
 // interface for clients of the Data Reader
 // mirrors the IEvaluateModel interface, except the Init method is private (use the constructor)
@@ -102,4 +125,49 @@ public:
     virtual void Init(const std::string& config);
     virtual void ResetState();
 };
+
+// Concurrent evaluator class
+// interface for clients of the concurrent evaluator, analogous to Eval
+template <class ElemType>
+class EvalConcurrent : public IEvaluateModelConcurrent<ElemType>, protected Plugin
+{
+private:
+    IEvaluateModelConcurrent<ElemType>* m_eval; // evaluation class pointer
+
+    void GetEvalClass(const std::string& config);
+
+    // Destroy - cleanup and remove this class
+    // NOTE: this destroys the object, and it can't be used past this point
+    virtual void Destroy();
+
+public:
+    // EvalConcurrent Constructor
+    // config - configuration information, as for Eval, plus:
+    // numWorkers=4 (number of network instances evaluating in parallel)
+    // maxBatchSize=64 (max number of samples coalesced into one micro-batch)
+    // maxBatchLatency=1.0 (max time in milliseconds a request may wait for a micro-batch to fill up)
+    // numCPUThreads=1 (OpenMP/BLAS threads used by each network instance)
+    EvalConcurrent(const std::string& config);
+    virtual ~EvalConcurrent();
+
+    // LoadModel - load a model from the specified path
+    // modelFileName - file holding the model to load
+    virtual void LoadModel(const std::wstring& modelFileName);
+
+    // GetNodeDimensions - Get the node dimensions of the specified nodes
+    // dimensions - map from name of node to dimension of the node
+    // nodeGroup - type of node we are requesting (input/output/specified)
+    virtual void GetNodeDimensions(std::map<std::wstring, size_t>& dimensions, NodeGroup nodeGroup);
+
+    // StartEvaluateMinibatchLoop - Prepare the network instances for Evaluate() calls.
+    // inputNodeNames - input nodes, in the order in which Evaluate() receives their buffers
+    // outputNodeNames - output nodes, in the order in which Evaluate() receives their buffers
+    virtual void StartEvaluateMinibatchLoop(const std::vector<std::wstring>& inputNodeNames, const std::vector<std::wstring>& outputNodeNames);
+
+    // Evaluate - Evaluate numSamples samples; thread-safe
+    // inputs - one buffer per input node holding numSamples columns (numSamples * dim values, column-major)
+    // outputs - one preallocated buffer per output node for numSamples columns
+    virtual void Evaluate(const ElemType* const* inputs, ElemType* const* outputs, size_t numSamples);
+    virtual void Init(const std::string& config);
+};
 } } }
@@ -19,6 +19,7 @@
 #include "fileutil.h" // for f{ge,pu}t{,Text}()
 #include <fstream>    // for LoadMatrixFromTextFile() --TODO: change to using this File class
 #include <sstream>
+#include <memory>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -34,6 +35,7 @@ enum FileOptions
     fileOptionsRead = 8,                                        // open in read mode
     fileOptionsWrite = 16,                                      // open in write mode
     fileOptionsSequential = 32,                                 // optimize for sequential reads (allocates big buffer)
+    fileOptionsMappable = 64,                                   // binary only: store matrices as aligned blobs that can be memory-mapped (see File::Map())
     fileOptionsReadWrite = fileOptionsRead | fileOptionsWrite,  // read/write mode
 };
 
@@ -99,12 +101,20 @@ private:
     bool m_pcloseNeeded; // was opened with popen(), use pclose() when destructing
     bool m_seekable;     // this stream is seekable
     int m_options;       // FileOptions ored togther
+    std::shared_ptr<char> m_mapping; // memory mapping of the whole file, if Map() was called
+    size_t m_mappingSize;
+    bool m_inMemory;     // written to memory (see GetBuffer())
+    char* m_memoryBuffer; // open_memstream() buffer of an in-memory file
+    size_t m_memorySize;
     void Init(const wchar_t* filename, int fileOptions);
 
 public:
     File(const std::wstring& filename, int fileOptions);
     File(const std::string&  filename, int fileOptions);
     File(const wchar_t* filename, int fileOptions);
+    // An in-memory file for writing binary data, e.g. to serialize on one thread what another one writes to disk.
+    // fileOptions must be fileOptionsBinary | fileOptionsWrite, optionally with fileOptionsMappable.
+    explicit File(int fileOptions);
     ~File();
 
     void Flush();
@@ -117,6 +127,21 @@ public:
 
     bool IsTextBased();
 
+    bool IsInMemory() const { return m_inMemory; }
+    // the data written to an in-memory file
+    std::vector<char> GetBuffer();
+
+    // Aligned data blobs (fileOptionsMappable). A blob is stored as its absolute file offset, followed by padding
+    // up to that offset and then the data. Once the file is memory-mapped, a blob can be used in place without
+    // reading it, and several processes mapping the same file share its pages.
+    bool IsMappable() const { return (m_options & fileOptionsMappable) && (m_options & fileOptionsBinary); }
+    void Map(); // map the file read-only; reading through the stream continues to work
+    bool IsMapped() const { return m_mapping != nullptr; }
+    std::shared_ptr<char> GetMapping() const { return m_mapping; } // holding this keeps the mapping valid after the File is closed
+    void WriteMappableBlob(const void* data, size_t numBytes);
+    // If the file is mapped, returns a pointer into the mapping, otherwise reads the blob into 'buffer' and returns that.
+    char* ReadMappableBlob(size_t numBytes, void* buffer);
+
     bool IsUnicodeBOM(bool skip = false);
     bool IsEOF();
     bool IsWhiteSpace(bool skip = false);
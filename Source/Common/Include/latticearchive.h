@@ -22,8 +22,11 @@
 #include <string>
 #include <unordered_map>
 #include <algorithm> // for find()
+#include <memory>
+#include <mutex>
 #include "simplesenonehmm.h"
 #include "Matrix.h"
+#include "File.h" // for mapping archives
 
 namespace msra { namespace math {
 
@@ -1000,21 +1003,8 @@ public:
             }
 #endif
             // This is critical--we have a buggy lattice set that requires no mapping where mapping would fail
-            bool needsmapping = false;
-            foreach_index (k, idmap)
-            {
-                if (idmap[k] != (size_t) k
-#if 1
-                    && (k != (int) idmap.size() - 1 || idmap[k] != spunit) // that HACK that we add one more /sp/ entry at the end...
-#endif
-                    )
-                {
-                    needsmapping = true;
-                    break;
-                }
-            }
             // map align ids to user's symmap  --the lattice gets updated in place here
-            if (needsmapping)
+            if (needsunitmapping(idmap, spunit))
             {
                 if (info.impliedspunitid != SIZE_MAX)
                     info.impliedspunitid = idmap[info.impliedspunitid];
@@ -1064,6 +1054,97 @@ public:
             RuntimeError("fread: unsupported lattice format version");
     }
 
+    // test whether units stored w.r.t. 'idmap' need to be mapped at all
+    template <class IDMAP>
+    static bool needsunitmapping(const IDMAP& idmap, size_t spunit)
+    {
+        foreach_index (k, idmap)
+        {
+            if (idmap[k] != (size_t) k
+#if 1
+                && (k != (int) idmap.size() - 1 || idmap[k] != spunit) // that HACK that we add one more /sp/ entry at the end...
+#endif
+                )
+                return true;
+        }
+        return false;
+    }
+
+    // mapped-archive format (see archive::writemapped())
+    // A lattice is stored as its header, the number of align entries, and the nodes[], edges[] and align[] arrays in
+    // their in-memory layout, each section padded to 8 bytes. Reading it back is a bulk copy per array: there are no
+    // tags to parse, no uniqued alignments to expand (rebuildedges()), and units only need to be mapped if the archive
+    // was written for a different symbol table than the model's.
+    static size_t mappedsectionbytes(size_t numelements, size_t elementsize)
+    {
+        return (numelements * elementsize + 7) / 8 * 8;
+    }
+
+    template <class T>
+    static size_t fwritemappedsection(FILE* f, const T* p, size_t n)
+    {
+        static const char padding[8] = {0};
+        const size_t numbytes = n * sizeof(T);
+        const size_t paddedbytes = mappedsectionbytes(n, sizeof(T));
+        if (numbytes > 0)
+            fwriteOrDie(p, sizeof(T), n, f);
+        if (paddedbytes > numbytes)
+            fwriteOrDie(padding, 1, paddedbytes - numbytes, f);
+        return paddedbytes;
+    }
+
+    // write in mapped-archive format; returns the number of bytes written
+    size_t fwritemapped(FILE* f) const
+    {
+        if (info.numnodes != nodes.size() || info.numedges != edges.size())
+            LogicError("fwritemapped: lattice header inconsistent with nodes and edges");
+        const uint64_t numalign = align.size();
+        size_t numbytes = 0;
+        numbytes += fwritemappedsection(f, &info, 1);
+        numbytes += fwritemappedsection(f, &numalign, 1);
+        numbytes += fwritemappedsection(f, nodes.data(), nodes.size());
+        numbytes += fwritemappedsection(f, edges.data(), edges.size());
+        numbytes += fwritemappedsection(f, align.data(), align.size());
+        return numbytes;
+    }
+
+    // read from a lattice stored in mapped-archive format at 'p', with 'maxbytes' bytes available
+    // Same as fread(), this maps the align entries to the user's symbol table through idmap.
+    template <class IDMAP>
+    void readmapped(const char* p, size_t maxbytes, const IDMAP& idmap, size_t spunit)
+    {
+        const size_t headerbytes = mappedsectionbytes(1, sizeof(info)) + mappedsectionbytes(1, sizeof(uint64_t));
+        if (maxbytes < headerbytes)
+            RuntimeError("readmapped: malformed archive, lattice header out of bounds");
+        memcpy(&info, p, sizeof(info));
+        p += mappedsectionbytes(1, sizeof(info));
+        uint64_t numalign;
+        memcpy(&numalign, p, sizeof(numalign));
+        p += mappedsectionbytes(1, sizeof(numalign));
+        const size_t nodebytes = mappedsectionbytes(info.numnodes, sizeof(nodeinfo));
+        const size_t edgebytes = mappedsectionbytes(info.numedges, sizeof(edgeinfowithscores));
+        const size_t alignbytes = mappedsectionbytes((size_t) numalign, sizeof(aligninfo));
+        if (maxbytes - headerbytes < nodebytes + edgebytes + alignbytes)
+            RuntimeError("readmapped: malformed archive, lattice data out of bounds");
+        nodes.assign((const nodeinfo*) p, (const nodeinfo*) p + info.numnodes);
+        p += nodebytes;
+        edges.assign((const edgeinfowithscores*) p, (const edgeinfowithscores*) p + info.numedges);
+        p += edgebytes;
+        align.assign((const aligninfo*) p, (const aligninfo*) p + numalign);
+        edges2.clear(); // (V2 representation, not used)
+        uniquededgedatatokens.clear();
+        if (nodes.empty() || nodes.back().t != info.numframes)
+            RuntimeError("readmapped: mismatch between info.numframes and last node's time");
+        // map align ids to user's symmap  --the lattice gets updated in place here
+        if (needsunitmapping(idmap, spunit))
+        {
+            foreach_index (k, align)
+                align[k].updateunit(idmap); // updates itself
+            if (info.impliedspunitid < idmap.size())
+                info.impliedspunitid = idmap[info.impliedspunitid];
+        }
+    }
+
     // parallel versions (defined in parallelforwardbackward.cpp)
     class parallelstate
     {
@@ -1214,6 +1295,107 @@ class archive
     mutable size_t currentarchiveindex;               // which archive is open
     mutable auto_file_ptr f;                          // cached archive file handle of currentarchiveindex
     std::unordered_map<std::wstring, latticeref> toc; // [key] -> (file, offset)  --table of content (.toc file)
+    mutable std::mutex readmutex;                     // getlattice() may be called concurrently (prefetching); guards f and symmaps
+
+    // mapped archives (see writemapped())
+    // Such an archive is a single file: a header, the lattices in mapped-archive format (see lattice::fwritemapped()),
+    // an index sorted by key, and the keys (UTF-8). The file is memory-mapped; the index is searched in place, so there
+    // is no TOC to parse when opening it, and lattices are read from the mapping without any file I/O calls.
+    static const char* mappedmagic()
+    {
+        return "LATARCHV";
+    }
+    static const uint32_t mappedversion = 1;
+    struct mappedheader
+    {
+        char magic[8];        // mappedmagic(); written last, so an incompletely written archive is not recognized
+        uint32_t version;     // mappedversion
+        uint32_t reserved;
+        uint64_t numlattices;
+        uint64_t indexoffset; // byte offset of mappedindexentry[numlattices], sorted by key
+        uint64_t keysoffset;  // byte offset of the concatenated keys
+        uint64_t keysbytes;
+    };
+    struct mappedindexentry
+    {
+        uint64_t offset;    // byte offset of the lattice
+        uint64_t keyoffset; // byte offset of the key relative to keysoffset
+        uint32_t keylength; // in bytes
+        uint32_t numframes;
+    };
+    static_assert(sizeof(mappedheader) == 48, "unexpected byte size of struct mappedheader");
+    static_assert(sizeof(mappedindexentry) == 24, "unexpected byte size of struct mappedindexentry");
+    struct mappedarchive
+    {
+        std::shared_ptr<char> mapping; // whole file
+        size_t size;
+        const mappedheader* header;
+        const mappedindexentry* index;
+        const char* keys;
+        size_t archiveindex; // index into archivepaths[], for the .symlist
+    };
+    std::vector<mappedarchive> mappedarchives;
+
+    // order of keys in the index (bytewise, same as std::string)
+    static int comparekeys(const char* a, size_t alen, const char* b, size_t blen)
+    {
+        int diff = memcmp(a, b, std::min(alen, blen));
+        if (diff != 0)
+            return diff;
+        return alen < blen ? -1 : alen > blen ? 1 : 0;
+    }
+
+    // find a key in the mapped archives; returns NULL if not found
+    const mappedindexentry* findmapped(const std::wstring& key, const mappedarchive*& which) const
+    {
+        if (mappedarchives.empty())
+            return NULL;
+        const std::string utf8key = msra::strfun::utf8(key);
+        foreach_index (k, mappedarchives)
+        {
+            const auto& a = mappedarchives[k];
+            const mappedindexentry* begin = a.index;
+            const mappedindexentry* end = a.index + a.header->numlattices;
+            auto iter = std::lower_bound(begin, end, utf8key, [&](const mappedindexentry& e, const std::string& key)
+                                         {
+                                             return comparekeys(a.keys + e.keyoffset, e.keylength, key.data(), key.size()) < 0;
+                                         });
+            if (iter != end && comparekeys(a.keys + iter->keyoffset, iter->keylength, utf8key.data(), utf8key.size()) == 0)
+            {
+                which = &a;
+                return iter;
+            }
+        }
+        return NULL;
+    }
+
+    // test whether a path refers to a mapped archive rather than a TOC file
+    static bool ismappedarchive(const std::wstring& path)
+    {
+        auto_file_ptr f(fopenOrDie(path, L"rb"));
+        char magic[8];
+        return ::fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, mappedmagic(), sizeof(magic)) == 0;
+    }
+
+    void openmapped(const std::wstring& path)
+    {
+        Microsoft::MSR::CNTK::File file(path, Microsoft::MSR::CNTK::fileOptionsBinary | Microsoft::MSR::CNTK::fileOptionsRead);
+        mappedarchive a;
+        a.size = file.Size();
+        file.Map();
+        a.mapping = file.GetMapping(); // (keeps the mapping alive after the file is closed)
+        a.header = (const mappedheader*) a.mapping.get();
+        if (a.size < sizeof(mappedheader) || a.header->version != mappedversion)
+            RuntimeError("open: unsupported mapped lattice archive version: %ls", path.c_str());
+        if (a.header->indexoffset + a.header->numlattices * sizeof(mappedindexentry) > a.size || a.header->keysoffset + a.header->keysbytes > a.size)
+            RuntimeError("open: mapped lattice archive is truncated: %ls", path.c_str());
+        a.index = (const mappedindexentry*) (a.mapping.get() + a.header->indexoffset);
+        a.keys = a.mapping.get() + a.header->keysoffset;
+        a.archiveindex = getarchiveindex(path);
+        mappedarchives.push_back(a);
+        symmaps.resize(archivepaths.size());
+    }
+
 public:
     // construct = open the archive
     // archive() : currentarchiveindex (SIZE_MAX) {}
@@ -1241,14 +1423,29 @@ public:
                 fprintf(stderr, ".");
             open(tocpaths[i]);
         }
-        fprintf(stderr, " %d total lattices referenced in %d archive files\n", (int) toc.size(), (int) archivepaths.size());
+        fprintf(stderr, " %d total lattices referenced in %d archive files\n", (int) numlattices(), (int) archivepaths.size());
+    }
+
+    // number of lattices in all archives
+    size_t numlattices() const
+    {
+        size_t n = toc.size();
+        foreach_index (k, mappedarchives)
+            n += (size_t) mappedarchives[k].header->numlattices;
+        return n;
     }
 
     // open an archive
     // Can be called for multiple archives.
     // BUGBUG: NOT YET. We only really support one archive file at this point. Important to do that though.
+    // A mapped archive (see writemapped()) can be passed in place of a TOC file.
     void open(const std::wstring& tocpath)
     {
+        if (ismappedarchive(tocpath))
+        {
+            openmapped(tocpath);
+            return;
+        }
         // BUGBUG: we only really support one archive file at this point
         // read the TOC in one swoop
         std::vector<char> textbuffer;
@@ -1299,7 +1496,8 @@ public:
     // check if a lattice for a given key is available  --do this during initial check ideally
     bool haslattice(const std::wstring& key) const
     {
-        return toc.find(key) != toc.end();
+        const mappedarchive* which;
+        return toc.find(key) != toc.end() || findmapped(key, which) != NULL;
     }
 
 #if 0 // TODO: change design to keep the #frames in the TOC, so we can check for mismatches before entering the training iteration
@@ -1322,6 +1520,27 @@ public:
     void getlattice(const std::wstring& key, lattice& L,
                     size_t expectedframes = SIZE_MAX /*if unknown*/) const
     {
+        // lattices in mapped archives are read from the mapping, without holding the lock
+        const mappedarchive* mapped;
+        const mappedindexentry* entry = findmapped(key, mapped);
+        if (entry != NULL)
+        {
+            const symbolidmapping* idmap;
+            {
+                std::lock_guard<std::mutex> lock(readmutex);
+                idmap = &getcachedidmap(mapped->archiveindex, modelsymmap);
+            }
+            if (entry->offset > mapped->size)
+                RuntimeError("getlattice: mapped lattice archive is truncated");
+            L.readmapped(mapped->mapping.get() + entry->offset, mapped->size - (size_t) entry->offset, *idmap, idmap->back());
+            L.setverbosity(verbosity);
+            if (expectedframes != SIZE_MAX && L.getnumframes() != expectedframes)
+                LogicError("getlattice: number of frames mismatch between numerator lattice and features");
+            L.key = key;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(readmutex);
         auto iter = toc.find(key);
         if (iter == toc.end())
             LogicError("getlattice: requested lattice for non-existent key; haslattice() should have been used to check availability");
@@ -1374,6 +1593,10 @@ public:
                       const msra::asr::htkmlfreader<msra::asr::htkmlfentry, msra::lattices::lattice::htkmlfwordsequence>& labels,
                       const msra::lm::CMGramLM& lm, const msra::lm::CSymbolSet& unigramsymbols);
 
+    // static method for writing the lattices of a set of archives into one mapped archive (which can then be used in place of the TOC files)
+    static void writemapped(const std::vector<std::wstring>& intocpaths, const std::wstring& outpath,
+                            const std::unordered_map<std::string, size_t>& modelsymmap, const std::wstring& prefixPathInToc = L"");
+
     // static method for converting an archive to a new format
     // Extended features:
     //  - check consistency (don't write out)
@@ -2,6 +2,9 @@
 
 #include <vector>
 #include <memory>
+#include <future>
+#include <unordered_map>
+#include <unordered_set>
 #include "latticearchive.h"
 
 namespace msra { namespace dbn {
@@ -34,11 +37,37 @@ public:
 
 class latticesource
 {
+public:
+    typedef msra::dbn::latticepair latticepair; // (before its first use, so that the name does not change meaning within the class)
+
+private:
     const msra::lattices::archive numlattices, denlattices;
     int verbosity;
 
+    // lattices read ahead on a background thread (see prefetchlattices())
+    typedef std::unordered_map<std::wstring, std::shared_ptr<const latticepair>> latticecache;
+    mutable std::future<latticecache> prefetching;            // read in flight, if valid()
+    mutable std::unordered_set<std::wstring> prefetchingkeys; // keys being read by 'prefetching'
+    mutable latticecache prefetched;                          // read ahead, and not requested yet
+
+    void readlattices(const std::wstring& key, std::shared_ptr<const latticepair>& L, size_t expectedframes) const
+    {
+        std::shared_ptr<latticepair> LP(new latticepair);
+        denlattices.getlattice(key, LP->second, expectedframes); // this loads the lattice from disk, using the existing L.second object
+        L = LP;
+    }
+
+    // wait for the read in flight and move its lattices to 'prefetched'; rethrows its error
+    void finishprefetch() const
+    {
+        if (!prefetching.valid())
+            return;
+        prefetchingkeys.clear();
+        latticecache lattices = prefetching.get();
+        prefetched.insert(lattices.begin(), lattices.end());
+    }
+
 public:
-    typedef msra::dbn::latticepair latticepair;
     latticesource(std::pair<std::vector<std::wstring>, std::vector<std::wstring>> latticetocs, const std::unordered_map<std::string, size_t>& modelsymmap, std::wstring RootPathInToc)
         : numlattices(latticetocs.first, modelsymmap, RootPathInToc), denlattices(latticetocs.second, modelsymmap, RootPathInToc), verbosity(0)
     {
@@ -64,9 +93,43 @@ public:
 
     void getlattices(const std::wstring& key, std::shared_ptr<const latticepair>& L, size_t expectedframes) const
     {
-        std::shared_ptr<latticepair> LP(new latticepair);
-        denlattices.getlattice(key, LP->second, expectedframes); // this loads the lattice from disk, using the existing L.second object
-        L = LP;
+        if (prefetchingkeys.find(key) != prefetchingkeys.end())
+            finishprefetch();
+        auto iter = prefetched.find(key);
+        if (iter != prefetched.end())
+        {
+            L = iter->second;
+            prefetched.erase(iter);
+            return;
+        }
+        readlattices(key, L, expectedframes);
+    }
+
+    // start reading the lattices for a set of (key, expected #frames) on a background thread, e.g. those of the chunk
+    // that is going to be paged in next; getlattices() then takes them from there instead of reading them
+    // Only one read is in flight at a time. Lattices read ahead earlier and not requested since are dropped, so that
+    // at most two chunks' worth of lattices are held here.
+    void prefetchlattices(const std::vector<std::pair<std::wstring, size_t>>& keys) const
+    {
+        if (keys.empty() || prefetchingkeys.find(keys.front().first) != prefetchingkeys.end() || prefetched.find(keys.front().first) != prefetched.end())
+            return; // already read or being read
+        try
+        {
+            finishprefetch();
+        }
+        catch (...) // a failed read ahead is not an error: the lattices will be read again when requested, which reports the error
+        {
+        }
+        prefetched.clear();
+        for (const auto& key : keys)
+            prefetchingkeys.insert(key.first);
+        prefetching = std::async(std::launch::async, [this, keys]()
+                                 {
+                                     latticecache lattices;
+                                     for (const auto& key : keys)
+                                         readlattices(key.first, lattices[key.first], key.second);
+                                     return lattices;
+                                 });
     }
 
     void setverbosity(int veb)
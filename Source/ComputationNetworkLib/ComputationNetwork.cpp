@@ -34,15 +34,15 @@ namespace Microsoft { namespace MSR { namespace CNTK {
 // -----------------------------------------------------------------------
 
 template <>
-vector<shared_ptr<Matrix<float>>>& MatrixPool::GetReleasedMatrices<float>()
+MatrixPool::PlanState<float>& MatrixPool::GetPlan<float>()
 {
-    return m_releasedFloatMatrices;
+    return m_floatPlan;
 }
 
 template <>
-vector<shared_ptr<Matrix<double>>>& MatrixPool::GetReleasedMatrices<double>()
+MatrixPool::PlanState<double>& MatrixPool::GetPlan<double>()
 {
-    return m_releasedDoubleMatrices;
+    return m_doublePlan;
 }
 
 // -----------------------------------------------------------------------
@@ -67,6 +67,7 @@ void ComputationNetwork::ClearNetwork()
         iter.second->DetachInputs();
 
     m_nameToNodeMap.clear();
+    m_matrixPool.Clear();
 
     m_pMBLayout->Init(1, 0);
 }
@@ -99,15 +100,28 @@ void ComputationNetwork::Save(const wstring& fileName, const FileOptions fileFor
     }
 }
 
+std::vector<char> ComputationNetwork::SaveToBuffer(const FileOptions fileFormat) const
+{
+    VerifyIsCompiled("SaveToBuffer");
+    File fstream(fileFormat | FileOptions::fileOptionsWrite);
+    SaveToFileImpl(fstream);
+    return fstream.GetBuffer();
+}
+
 // TODO: how does the file distinguish float vs double nodes?
 void ComputationNetwork::SaveToFileImpl(const wstring& fileName, const FileOptions fileFormat) const
 {
     File fstream(fileName, fileFormat | FileOptions::fileOptionsWrite);
+    SaveToFileImpl(fstream);
+}
+
+void ComputationNetwork::SaveToFileImpl(File& fstream) const
+{
     fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BCN");
 
     // model version
     fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BVersion");
-    fstream << (size_t) CURRENT_CNTK_MODEL_VERSION;
+    fstream << (size_t) (fstream.IsMappable() ? CNTK_MODEL_VERSION_3 : CURRENT_CNTK_MODEL_VERSION);
     fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EVersion");
 
     fstream << (size_t) m_nameToNodeMap.size();
@@ -195,6 +209,12 @@ void ComputationNetwork::ReadPersistableParameters(File& fstream, bool create)
         fstream.GetMarker(FileMarker::fileMarkerEndSection, L"EVersion");
     }
 
+    // map files with mappable matrices, so that parameters on the CPU use the file's pages in place instead of copies
+    // (only when loading from scratch; when reloading, the existing matrices get the values copied into them)
+    // The matrices keep the read-only mapping alive, and get their own copies when modified (see MakeValuesWritable()).
+    if (create && modelVersion >= CNTK_MODEL_VERSION_3 && fstream.CanSeek())
+        fstream.Map();
+
     size_t numNodes;
     fstream >> numNodes;
 
@@ -365,6 +385,23 @@ void ComputationNetwork::InitLearnableParameters(const ComputationNodeBasePtr& n
     learnableParameterNode->InitRandom(uniformInit, randomSeed + GetRandomSeedOffset(), initValueScale, initOnCPUOnly);
 }
 
+// copy on first write: give the parameters and precomputed values that refer to the read-only mapping of a
+// mappable model file their own copies, before they are modified in place (e.g. by training)
+template <class ElemType>
+void ComputationNetwork::MakeValuesWritable()
+{
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        const auto& node = iter.second;
+        if (node->OperationName() == OperationNameOf(LearnableParameter) || dynamic_pointer_cast<IPreComputeNode>(node))
+        {
+            auto valueNode = dynamic_pointer_cast<ComputationNode<ElemType>>(node);
+            if (valueNode)
+                valueNode->Value().MakeWritable();
+        }
+    }
+}
+
 bool ComputationNetwork::IsTypicalCriterionNode(ComputationNodeBasePtr nodePtr)
 {
     // TODO: just use return!
@@ -1325,6 +1362,7 @@ void ComputationNetwork::SaveToDbnFile(ComputationNetworkPtr net, const std::wst
 
 template void ComputationNetwork::InitLearnableParameters<float>(const ComputationNodeBasePtr& node, const bool uniformInit, const unsigned long randomSeed, const float initValueScale, bool initOnCPUOnly);
 template void ComputationNetwork::Read<float>(const wstring& fileName);
+template void ComputationNetwork::MakeValuesWritable<float>();
 template void ComputationNetwork::ReadPersistableParameters<float>(File& fstream, bool create);
 template void ComputationNetwork::PerformSVDecomposition<float>(const map<wstring, float>& SVDConfig, size_t alignedsize);
 template /*static*/ void ComputationNetwork::SetDropoutRate<float>(ComputationNetworkPtr net, const ComputationNodeBasePtr& criterionNode, const double dropoutRate, double& prevDropoutRate, unsigned long& dropOutSeed);
@@ -1334,6 +1372,7 @@ template void ComputationNetwork::SaveToDbnFile<float>(ComputationNetworkPtr net
 
 template void ComputationNetwork::InitLearnableParameters<double>(const ComputationNodeBasePtr& node, const bool uniformInit, const unsigned long randomSeed, const double initValueScale, bool initOnCPUOnly);
 template void ComputationNetwork::Read<double>(const wstring& fileName);
+template void ComputationNetwork::MakeValuesWritable<double>();
 template void ComputationNetwork::ReadPersistableParameters<double>(File& fstream, bool create);
 template void ComputationNetwork::PerformSVDecomposition<double>(const map<wstring, float>& SVDConfig, size_t alignedsize);
 template /*static*/ void ComputationNetwork::SetDropoutRate<double>(ComputationNetworkPtr net, const ComputationNodeBasePtr& criterionNode, const double dropoutRate, double& prevDropoutRate, unsigned long& dropOutSeed);
@@ -12,6 +12,7 @@
 
 #include "ComputationNode.h"
 #include "ScriptableObjects.h"
+#include "DataflowScheduler.h"
 
 #include <map>
 #include <string>
@@ -27,6 +28,7 @@
 #include <chrono>
 #include <unordered_map>
 #include <set>
+#include <functional>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -46,6 +48,7 @@ public:
     ComputationNetwork()
         : m_randomSeedOffset(0),
           m_isCompiled(false),
+          m_numNodeExecutionThreads(1),
           m_pMBLayout(make_shared<MBLayout>())
     {
     }
@@ -106,12 +109,16 @@ public:
     void Save(const std::wstring& fileName, const FileOptions fileFormat = FileOptions::fileOptionsBinary) const;
     void SaveEdited(const std::wstring& fileName, const FileOptions fileFormat = FileOptions::fileOptionsBinary);
 
+    // the bytes Save() writes to the model file, e.g. so that the file can be written on another thread
+    std::vector<char> SaveToBuffer(const FileOptions fileFormat = FileOptions::fileOptionsBinary) const;
+
     template <class ElemType>
     void SaveToDbnFile(ComputationNetworkPtr net, const std::wstring& fileName) const;
 
 private:
 
     void SaveToFileImpl(const std::wstring& fileName, const FileOptions fileFormat) const;
+    void SaveToFileImpl(File& fstream) const;
 
 public:
 
@@ -123,7 +130,16 @@ public:
     void ForwardProp(const ComputationNodeBasePtr rootNode);
 
     // main entry point for backprop
-    void Backprop(const ComputationNodeBasePtr rootNode);
+    // If given, onGradientComplete() is called for every node of the root's network as soon as that node's gradient is final,
+    // i.e. while backprop continues with the remaining nodes. This allows e.g. to start aggregating gradients early.
+    typedef std::function<void(const ComputationNodeBasePtr&)> GradientCompleteCallback;
+    void Backprop(const ComputationNodeBasePtr rootNode, const GradientCompleteCallback& onGradientComplete = nullptr);
+
+    // Run nodes (and whole recurrent loops) that do not depend on each other concurrently, on 'numThreads' threads that divide
+    // the OpenMP/BLAS threads among them, e.g. the two directions of a bidirectional LSTM. 0 or 1 runs all nodes in order.
+    // This is for the CPU only, and must be called before AllocateAllMatrices(), since nodes that run concurrently cannot share matrices.
+    void SetNumNodeExecutionThreads(size_t numThreads);
+    size_t GetNumNodeExecutionThreads() const { return m_numNodeExecutionThreads; }
 
     template <class NODESET> // version that takes multiple nodes
     void ForwardProp(const NODESET& nodes)
@@ -173,6 +189,8 @@ private:
     void VerifyIsCompiled(const char* where) const;
 public:
     void AllocateAllMatrices(const std::vector<ComputationNodeBasePtr>& evalRootNodes, const std::vector<ComputationNodeBasePtr>& outValueRootNodes, ComputationNodeBasePtr trainRootNode);
+    // the pool with the memory plan of the last AllocateAllMatrices() call
+    const MatrixPool& GetMatrixPool() const { return m_matrixPool; }
 
 private:
     void ReleaseMatricesAfterEvalForChildren(ComputationNodeBasePtr n, std::unordered_map<ComputationNodeBasePtr, int>& parentCount);
@@ -301,6 +319,10 @@ public:
                                  const ElemType initValueScale,
                                  bool initOnCPUOnly = false);
 
+    // parameters loaded from a mappable model file are read-only until this is called (copy on first write)
+    template <class ElemType>
+    void MakeValuesWritable();
+
     template <typename N>
     static shared_ptr<N> AsNodePtr(const ComputationNodeBasePtr& inode)
     {
@@ -319,6 +341,8 @@ public:
     ComputationNodeBasePtr CopyNode(const ComputationNetwork& fromNet, const std::wstring fromName, std::wstring toName, const CopyNodeFlags flags);
     void CopySubTree(const ComputationNetwork& fromNet, const std::wstring fromName, std::wstring toNamePrefix, const CopyNodeFlags flags);
     void CopyInputs(const std::wstring fromName, std::wstring toName);
+    template <class ElemType>
+    ComputationNetworkPtr CloneSharingParameters() const;
     void RenameNode(const std::wstring& nodeNameOrig, const std::wstring& nodeNameNew);
     void RenameNode(ComputationNodeBasePtr node, const std::wstring& newNodeName);
     void DeleteNode(const std::wstring& nodeName);
@@ -820,11 +844,28 @@ protected:
         virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool);
         virtual void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool);
 
+    private:
+        void ForwardPropNode(const ComputationNodeBasePtr& node, const FrameRange& fr);
+        void BackpropNode(const ComputationNodeBasePtr& node, const FrameRange& fr);
+        void BuildDataflowGraphs();
+        void PrepareForConcurrentExecution();
+
     public:
         // this special constructor constructs the top-level network node
         // There is currently no other constructor for inner nested PAR-traversed sub-networks, but there will be.
         PARTraversalFlowControlNode(const std::vector<shared_ptr<SEQTraversalFlowControlNode>>& recurrentInfo, const std::list<ComputationNodeBasePtr>& allNodes);
         // Base::m_nestedNodes contains all top-level nodes, in evaluation order
+
+        GradientCompleteCallback m_onGradientComplete; // set by ComputationNetwork::Backprop() for the duration of one backprop pass
+        DataflowScheduler* m_scheduler;                // set by ComputationNetwork::ForwardProp() and Backprop() to run m_nestedNodes concurrently; null: in order
+
+    private:
+        // dependencies between m_nestedNodes (by index), built on first concurrent use
+        // Forward, a node waits for its inputs. Backward, it waits for its consumers, and consumers of the same input
+        // wait for each other in reverse evaluation order, so that gradients are summed up in the same order as without concurrency.
+        DataflowGraph m_forwardGraph;
+        DataflowGraph m_backwardGraph;
+        bool m_dataflowGraphsBuilt;
     };
 
 public:
@@ -892,6 +933,11 @@ private:
     // pool for matrices that can be shared across nodes
     // TODO: does this apply to anything else besides temporary node-internal intermediate results? What, for example?
     MatrixPool m_matrixPool;
+
+    // concurrent execution of nodes, see SetNumNodeExecutionThreads()
+    DataflowScheduler* GetDataflowScheduler();
+    size_t m_numNodeExecutionThreads;
+    std::shared_ptr<DataflowScheduler> m_dataflowScheduler; // null unless m_numNodeExecutionThreads > 1 on the CPU
 };
 typedef ComputationNetwork::ComputationNetworkPtr ComputationNetworkPtr;
 
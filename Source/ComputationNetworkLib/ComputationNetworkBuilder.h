@@ -90,6 +90,7 @@ public:
     ComputationNodePtr ErrorPrediction(const ComputationNodePtr a, const ComputationNodePtr b, const std::wstring nodeName = L"");
     ComputationNodePtr Exp(const ComputationNodePtr a, const std::wstring nodeName = L"");
     ComputationNodePtr FutureValue(const ComputationNodePtr a, const float initHiddenActivity, const size_t row_size, size_t timeStep, const std::wstring nodeName = L"");
+    ComputationNodePtr GRU(const ComputationNodePtr input, const ComputationNodePtr W, const ComputationNodePtr R, const ComputationNodePtr b, const float initHiddenActivity, const std::wstring nodeName = L"");
 #ifdef COMING_SOON
     ComputationNodePtr GMMLogLikelihood(const ComputationNodePtr unnormedPrior, const ComputationNodePtr mean, const ComputationNodePtr logStddev, const ComputationNodePtr feature, const std::wstring nodeName = L"");
 #endif
@@ -101,6 +102,7 @@ public:
     ComputationNodePtr Logistic(const ComputationNodePtr a, const ComputationNodePtr b, const ComputationNodePtr c, const std::wstring nodeName = L"");
     ComputationNodePtr Logistic(const ComputationNodePtr a, const ComputationNodePtr b, const std::wstring nodeName = L"");
     ComputationNodePtr LookupTable(const ComputationNodePtr dictionary, const ComputationNodePtr input, const std::wstring nodeName = L"");
+    ComputationNodePtr LSTM(const ComputationNodePtr input, const ComputationNodePtr W, const ComputationNodePtr R, const ComputationNodePtr b, const ComputationNodePtr peepholes, const float initHiddenActivity, const std::wstring nodeName = L"");
     ComputationNodePtr MatrixL1Reg(const ComputationNodePtr a, const std::wstring nodeName = L"");
     ComputationNodePtr MatrixL2Reg(const ComputationNodePtr a, const std::wstring nodeName = L"");
     ComputationNodePtr Mean(const ComputationNodePtr a, const std::wstring nodeName = L"");
@@ -100,6 +100,62 @@ void ComputationNetwork::CopyInputs(const std::wstring fromName, std::wstring to
     CopyNode(*this, fromName, toName, CopyNodeFlags::copyNodeChildren);
 }
 
+// CloneSharingParameters - create another instance of this network that evaluates independently, e.g. on another thread
+// The values of the LearnableParameters are shared with this network, i.e. they are held in memory only once and
+// must not be modified while the instances are in use; all other nodes get their own copies.
+template <class ElemType>
+ComputationNetworkPtr ComputationNetwork::CloneSharingParameters() const
+{
+    VerifyIsCompiled("CloneSharingParameters");
+
+    auto net = make_shared<ComputationNetwork>(m_deviceId);
+    net->m_randomSeedOffset = m_randomSeedOffset;
+
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        const auto& node = iter.second;
+        ComputationNodeBasePtr newNode;
+        if (node->OperationName() == OperationNameOf(LearnableParameter))
+        {
+            newNode = ComputationNodeBasePtr(node->NewThis(node->GetDeviceId(), node->NodeName()));
+            newNode->As<ComputationNode<ElemType>>()->ShareValueWith(*node->As<ComputationNode<ElemType>>());
+            node->CopyTo(newNode, node->NodeName(), CopyNodeFlags::copyNodeValue); // (does not copy the shared value)
+        }
+        else
+            newNode = node->Duplicate(node->NodeName(), CopyNodeFlags::copyNodeValue);
+        net->AddNodeToNet(newNode);
+    }
+
+    // connect the new nodes like the original ones
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        const auto& node = iter.second;
+        if (node->GetNumInputs() == 0)
+            continue;
+        vector<ComputationNodeBasePtr> inputs;
+        for (const auto& input : node->GetInputs())
+            inputs.push_back(net->GetNodeFromName(input->NodeName()));
+        net->GetNodeFromName(node->NodeName())->AttachInputs(inputs);
+    }
+
+    auto copyGroup = [&net](const vector<ComputationNodeBasePtr>& group, vector<ComputationNodeBasePtr>& newGroup)
+    {
+        for (const auto& node : group)
+            newGroup.push_back(net->GetNodeFromName(node->NodeName()));
+    };
+    copyGroup(m_features, net->m_features);
+    copyGroup(m_labels, net->m_labels);
+    copyGroup(m_finalCriteria, net->m_finalCriteria);
+    copyGroup(m_evalNodes, net->m_evalNodes);
+    copyGroup(m_outputNodes, net->m_outputNodes);
+
+    net->CompileNetwork();
+    return net;
+}
+
+template ComputationNetworkPtr ComputationNetwork::CloneSharingParameters<float>() const;
+template ComputationNetworkPtr ComputationNetwork::CloneSharingParameters<double>() const;
+
 // RenameNode - Rename a node to another name
 // nodeNameOrig - original node name
 // nodeNameNew - new node name
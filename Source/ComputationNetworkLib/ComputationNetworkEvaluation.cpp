@@ -10,12 +10,14 @@
 #include "ComputationNetwork.h"
 #include "RecurrentNodes.h"
 #include "InputAndParamNodes.h"
+#include "NodeProfiler.h"
 #include <string>
 #include <vector>
 #include <list>
 #include <set>
 #include <algorithm>
 #include <map>
+#include <unordered_map>
 
 using namespace std;
 
@@ -40,7 +42,10 @@ void ComputationNetwork::ForwardProp(const ComputationNodeBasePtr rootNode)
     VerifyIsCompiled("ForwardProp");
 
     // traverse all nodes in the pre-determined evaluation order
-    GetNestedNetwork(rootNode)->ForwardProp(FrameRange(nullptr));
+    auto network = dynamic_pointer_cast<PARTraversalFlowControlNode>(GetNestedNetwork(rootNode));
+    network->m_scheduler = GetDataflowScheduler();
+    network->ForwardProp(FrameRange(nullptr));
+    network->m_scheduler = nullptr;
 }
 
 // set the gradient matrix of a node to an 1x1 matrix containing 1.0
@@ -64,7 +69,8 @@ static bool SetGradientToScalarOne(ComputationNodeBasePtr nodep)
 //  - ForwardProp() for eval nodes
 //  - ForwardProp() for the training criterion (which will reuse computation results from the previous step)
 //  - Backprop() for the training criterion
-void ComputationNetwork::Backprop(const ComputationNodeBasePtr rootNode) // training criterion to compute the gradients for
+void ComputationNetwork::Backprop(const ComputationNodeBasePtr rootNode, // training criterion to compute the gradients for
+                                  const GradientCompleteCallback& onGradientComplete)
 {
     // reset all gradients to zero (actually, internally, this is lazy, but we don't care here)
     ZeroGradients(rootNode);
@@ -74,7 +80,43 @@ void ComputationNetwork::Backprop(const ComputationNodeBasePtr rootNode) // trai
         LogicError("Backprop: Training criterion is neither ComputationNode<float> nor ComputationNode<double>.");
 
     // backpropagate through the network
-    GetNestedNetwork(rootNode)->Backprop(FrameRange(nullptr), true, true);
+    auto network = dynamic_pointer_cast<PARTraversalFlowControlNode>(GetNestedNetwork(rootNode));
+    network->m_onGradientComplete = onGradientComplete;
+    network->m_scheduler = GetDataflowScheduler();
+    network->Backprop(FrameRange(nullptr), true, true);
+    network->m_onGradientComplete = nullptr;
+    network->m_scheduler = nullptr;
+}
+
+void ComputationNetwork::SetNumNodeExecutionThreads(size_t numThreads)
+{
+    if (numThreads > 1 && m_deviceId != CPUDEVICE)
+    {
+        fprintf(stderr, "SetNumNodeExecutionThreads: Nodes are executed concurrently on the CPU only; using 1 thread.\n");
+        numThreads = 1;
+    }
+    numThreads = max(numThreads, (size_t) 1);
+    if (numThreads == m_numNodeExecutionThreads)
+        return;
+
+    m_numNodeExecutionThreads = numThreads;
+    m_dataflowScheduler = (numThreads > 1) ? make_shared<DataflowScheduler>(numThreads) : nullptr;
+}
+
+// the scheduler for the next pass, or null if the nodes must run one after the other
+DataflowScheduler* ComputationNetwork::GetDataflowScheduler()
+{
+    if (!m_dataflowScheduler)
+        return nullptr;
+    // matrices that are shared between nodes were planned for sequential execution
+    if (m_matrixPool.HasSharedMatrices())
+    {
+        fprintf(stderr, "WARNING: SetNumNodeExecutionThreads() was called after AllocateAllMatrices() had let nodes share matrices; nodes will be executed one after the other.\n");
+        m_dataflowScheduler = nullptr;
+        m_numNodeExecutionThreads = 1;
+        return nullptr;
+    }
+    return m_dataflowScheduler.get();
 }
 
 void ComputationNetwork::FormNestedNetwork(const ComputationNodeBasePtr& rootNode)
@@ -101,6 +143,7 @@ ComputationNodeBasePtr ComputationNetwork::GetNestedNetwork(const ComputationNod
 // -----------------------------------------------------------------------
 
 ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(const std::vector<shared_ptr<SEQTraversalFlowControlNode>>& recurrentInfo, const std::list<ComputationNodeBasePtr>& allNodes /*must be in eval order*/)
+    : m_scheduler(nullptr), m_dataflowGraphsBuilt(false)
 {
     // traverse the network in evaluation order and create a new list that replaces all recurrence by a SEQTraversalFlowControlNode
     set<shared_ptr<IComputationNode>> loopsSeen; // for consistency check only
@@ -127,30 +170,145 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
 }
 /*virtual*/ void ComputationNetwork::PARTraversalFlowControlNode::ForwardProp(const FrameRange& fr) /*override*/
 {
+    if (m_scheduler)
+    {
+        // run each node (or loop) as soon as its inputs are computed
+        PrepareForConcurrentExecution();
+        m_scheduler->Run(m_forwardGraph, [this, &fr](size_t i)
+                         {
+                             ForwardPropNode(m_nestedNodes[i], fr);
+                         });
+        return;
+    }
+
     for (auto& node : m_nestedNodes)
+        ForwardPropNode(node, fr);
+}
+
+void ComputationNetwork::PARTraversalFlowControlNode::ForwardPropNode(const ComputationNodeBasePtr& node, const FrameRange& fr)
+{
+    if (node->IsOutOfDateWrtInputs())
     {
-        if (node->IsOutOfDateWrtInputs())
-        {
-            node->BeginForwardProp();
-            node->ForwardProp(fr.WithLayout(node->GetMBLayout()));
-            node->EndForwardProp();
+        NodeProfiler::Scope profile(node, fr, false);
+        node->BeginForwardProp();
+        node->ForwardProp(fr.WithLayout(node->GetMBLayout()));
+        node->EndForwardProp();
 
-            node->BumpEvalTimeStamp();
-        }
+        node->BumpEvalTimeStamp();
     }
 }
 
 /*virtual*/ void ComputationNetwork::PARTraversalFlowControlNode::Backprop(const FrameRange& fr, bool childrenInThisLoop, bool childrenInOuterLoop) /*override*/
 {
     childrenInThisLoop, childrenInOuterLoop; // TODO: think through what these mean when coming from PAR mode
+    if (m_scheduler)
+    {
+        // run each node (or loop) as soon as its gradient is final
+        // The callback may e.g. talk to MPI, so it is called on this thread only.
+        PrepareForConcurrentExecution();
+        std::function<void(size_t)> onGradientComplete;
+        if (m_onGradientComplete)
+        {
+            onGradientComplete = [this](size_t i)
+            {
+                m_onGradientComplete(m_nestedNodes[i]);
+            };
+        }
+        m_scheduler->Run(m_backwardGraph, [this, &fr](size_t i)
+                         {
+                             BackpropNode(m_nestedNodes[i], fr);
+                         }, onGradientComplete);
+        return;
+    }
+
     // process nodes in pre-determined order
     for (auto pnode = m_nestedNodes.rbegin(); pnode != m_nestedNodes.rend(); pnode++) // iterate backwards over evaluation order
     {
         auto& node = *pnode;
 
-        node->BeginBackprop();
-        node->Backprop(fr.WithLayout(node->GetMBLayout()), true /*childrenInThisLoop*/, true /*childrenInOuterLoop*/);
-        node->EndBackprop();
+        // all consumers of this node come later in evaluation order and have been processed, so its gradient is final
+        if (m_onGradientComplete)
+            m_onGradientComplete(node);
+
+        BackpropNode(node, fr);
+    }
+}
+
+void ComputationNetwork::PARTraversalFlowControlNode::BackpropNode(const ComputationNodeBasePtr& node, const FrameRange& fr)
+{
+    NodeProfiler::Scope profile(node, fr, true);
+    node->BeginBackprop();
+    node->Backprop(fr.WithLayout(node->GetMBLayout()), true /*childrenInThisLoop*/, true /*childrenInOuterLoop*/);
+    node->EndBackprop();
+}
+
+// determine which of m_nestedNodes may run concurrently (see m_forwardGraph, m_backwardGraph)
+void ComputationNetwork::PARTraversalFlowControlNode::BuildDataflowGraphs()
+{
+    // a loop is one entry in m_nestedNodes; its members depend on the rest of the network through it
+    const size_t numNodes = m_nestedNodes.size();
+    vector<vector<ComputationNodeBasePtr>> membersOf(numNodes);
+    unordered_map<const ComputationNodeBase*, size_t> indexOf; // node or loop member -> index into m_nestedNodes
+    for (size_t i = 0; i < numNodes; i++)
+    {
+        auto loop = dynamic_pointer_cast<SEQTraversalFlowControlNode>(m_nestedNodes[i]);
+        if (loop)
+            membersOf[i] = loop->m_nestedNodes;
+        else
+            membersOf[i].push_back(m_nestedNodes[i]);
+        for (const auto& member : membersOf[i])
+            indexOf[member.get()] = i;
+    }
+
+    // forward: wait for the inputs
+    vector<vector<size_t>> consumersOf(numNodes); // [i] -> nodes that take node i as an input, in evaluation order
+    m_forwardGraph.Resize(numNodes);
+    for (size_t i = 0; i < numNodes; i++)
+    {
+        for (const auto& member : membersOf[i])
+        {
+            for (const auto& input : member->GetInputs())
+            {
+                auto iter = indexOf.find(input.get());
+                if (iter == indexOf.end() || iter->second == i) // (inputs from within the same loop)
+                    continue;
+                if (iter->second > i)
+                    LogicError("BuildDataflowGraphs: %ls %ls operation comes before its input %ls in evaluation order.", member->NodeName().c_str(), member->OperationName().c_str(), input->NodeName().c_str());
+                m_forwardGraph.AddEdge(iter->second, i);
+                if (consumersOf[iter->second].empty() || consumersOf[iter->second].back() != i)
+                    consumersOf[iter->second].push_back(i);
+            }
+        }
+    }
+
+    // backward: wait for the consumers, which add into the gradient one at a time, in the order of sequential execution (the last one first)
+    m_backwardGraph.Resize(numNodes);
+    for (size_t i = 0; i < numNodes; i++)
+    {
+        const auto& consumers = consumersOf[i];
+        for (size_t k = 0; k < consumers.size(); k++)
+        {
+            m_backwardGraph.AddEdge(consumers[k], i);
+            if (k > 0)
+                m_backwardGraph.AddEdge(consumers[k], consumers[k - 1]);
+        }
+    }
+
+    m_dataflowGraphsBuilt = true;
+}
+
+void ComputationNetwork::PARTraversalFlowControlNode::PrepareForConcurrentExecution()
+{
+    if (!m_dataflowGraphsBuilt)
+        BuildDataflowGraphs();
+
+    // An MBLayout creates its mask of gap columns on first use. Do that now, rather than in nodes that run concurrently.
+    // (Concurrent consumers of one input may still both zero its gap columns through MaskedValueFor(), which is benign.)
+    for (const auto& node : m_nestedNodes)
+    {
+        const auto& pMBLayout = node->GetMBLayout();
+        if (pMBLayout && pMBLayout->HasGaps())
+            pMBLayout->GetColumnsValidityMask(CPUDEVICE);
     }
 }
 /*virtual*/ void ComputationNetwork::PARTraversalFlowControlNode::RequestMatricesBeforeForwardProp(MatrixPool& matrixPool) /*override*/
@@ -211,6 +369,7 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
     {
         for (auto& node : m_nestedNodes)
         {
+            NodeProfiler::Scope profile(node, t, false);
             node->ForwardProp(t);
             node->BumpEvalTimeStamp();
         }
@@ -242,6 +401,7 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
         for (auto nodeIter2 = recurrentNodes.rbegin(); nodeIter2 != recurrentNodes.rend(); ++nodeIter2)
         {
             auto& node2 = *nodeIter2;
+            NodeProfiler::Scope profile(node2, t, true);
             node2->Backprop(t, true /*childrenInThisLoop*/, false /*childrenInOuterLoop*/);
             // The above flags tell Backprop() to skip back-propagation from inside a node into
             // a node that is outside the loop, which is done later in EndBackprop() in PAR mode.
@@ -257,7 +417,9 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
     for (auto nodeIter2 = m_nestedNodes.rbegin(); nodeIter2 != m_nestedNodes.rend(); ++nodeIter2)
     {
         auto& node2 = *nodeIter2;
-        node2->Backprop(FrameRange(m_nestedNodes[0]->GetMBLayout()), false /*childrenInThisLoop*/, true /*childrenInOuterLoop*/);
+        FrameRange fr(m_nestedNodes[0]->GetMBLayout());
+        NodeProfiler::Scope profile(node2, fr, true);
+        node2->Backprop(fr, false /*childrenInThisLoop*/, true /*childrenInOuterLoop*/);
     }
 
     // tell all nodes we are done for this iteraTion
@@ -713,6 +875,11 @@ void ComputationNetwork::AllocateAllMatrices(const std::vector<ComputationNodeBa
     // Due to special topology, if a node is solely induced by parameters, its function value should not be shared
     MarkValueNonSharableNodes();
 
+    // plan from scratch; matrices that nodes already hold from an earlier plan are only released into the new one
+    m_matrixPool.ResetPlan();
+    // nodes that run concurrently cannot share matrices
+    m_matrixPool.EnableSharing(m_numNodeExecutionThreads <= 1);
+
     bool performingBackPropagation = (trainRootNode != nullptr);
 
     // Create a composite Eval order with the specified nodes as roots
@@ -837,6 +1004,8 @@ void ComputationNetwork::AllocateAllMatrices(const std::vector<ComputationNodeBa
             }
         }
     }
+
+    m_matrixPool.LogMemoryPlan();
 }
 
 void ComputationNetwork::ReleaseMatricesAfterEvalForChildren(ComputationNodeBasePtr n, std::unordered_map<ComputationNodeBasePtr, int>& parentCount)
@@ -268,6 +268,10 @@ template <>
 std::map<size_t, std::map<size_t, FloatMatrix*>> ComputationNode<float>::s_constOnes{};
 template <>
 std::map<size_t, std::map<size_t, DoubleMatrix*>> ComputationNode<double>::s_constOnes{};
+template <>
+std::mutex ComputationNode<float>::s_constOnesMutex{};
+template <>
+std::mutex ComputationNode<double>::s_constOnesMutex{};
 
 template class ComputationNode<float>;
 template class ComputationNode<double>;
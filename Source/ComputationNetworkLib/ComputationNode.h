@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <assert.h>
 #include <atomic>
+#include <mutex>
 
 #define DEFAULT_HIDDEN_ACTIVATION 0.1
 
@@ -30,6 +31,7 @@
 // version number to control how to read and write
 #define CNTK_MODEL_VERSION_1 1
 #define CNTK_MODEL_VERSION_2 2
+#define CNTK_MODEL_VERSION_3 3 // matrices may be stored as mappable blobs (fileOptionsMappable); only written when requested
 #define CURRENT_CNTK_MODEL_VERSION CNTK_MODEL_VERSION_2
 
 extern bool g_shareNodeValueMatrices;
@@ -574,6 +576,9 @@ public:
     // helper to access to element(0,0) without having to type-cast
     virtual double Get00Element() const = 0;
 
+    // the value and gradient matrices with the size of their buffers in bytes, for statistics (note: a matrix may be shared with other nodes, see MatrixPool)
+    virtual void GetValueAndGradientBuffers(std::vector<std::pair<const void*, size_t>>& buffers) const = 0;
+
     // TODO: two sets of functions, choose one
     const std::wstring& NodeName() const { return m_nodeName; }
     std::wstring GetName() const { return m_nodeName; }
@@ -899,20 +904,32 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = DownCast(nodeP);
-            *node->m_value = *m_value;
+            CopyMatrixTo(m_value, node->m_value);
             if (m_gradient)
-                *node->m_gradient = *m_gradient;
+                CopyMatrixTo(m_gradient, node->m_gradient);
             else
                 node->m_gradient = nullptr;
         }
     }
 
+    // copy one of the matrices of this node to the same matrix of another node (deep copy)
+    // Matrices that this node has not allocated (yet), e.g. values and temporaries that come from the matrix pool, are not copied,
+    // and neither are matrices that the other node shares with this one (see ShareValueWith()).
+    static void CopyMatrixTo(const shared_ptr<Matrix<ElemType>>& from, shared_ptr<Matrix<ElemType>>& to)
+    {
+        if (!from || to == from)
+            return;
+        if (!to)
+            to = make_shared<Matrix<ElemType>>(from->GetDeviceId());
+        *to = *from;
+    }
+
     // duplicate a node
     ComputationNodeBasePtr Duplicate(const std::wstring& newName, const CopyNodeFlags flags)
     {
         const std::wstring& name = (newName == L"") ? NodeName() : newName;
         ComputationNodeBasePtr node(NewThis(m_deviceId, name)); // NewThis() is a virtual function that creates a new node of the actual type of 'this'
-        node->CopyTo(shared_from_this(), newName, flags);       // note: shared_from_this() is the base class, but CopyTo() up-casts it as needed
+        CopyTo(node, name, flags);                              // note: node is the base class, but CopyTo() up-casts it as needed
         return node;
     }
 
@@ -1165,6 +1182,15 @@ public:
     // TODO: Are all these meant to read out a scalar? Then rename and verify dimensions.
     virtual double Get00Element() const override final { return Value().Get00Element(); }
 
+    virtual void GetValueAndGradientBuffers(std::vector<std::pair<const void*, size_t>>& buffers) const override final
+    {
+        buffers.clear();
+        if (m_value && m_value->GetNumElements() > 0)
+            buffers.push_back(std::make_pair((const void*) m_value.get(), m_value->BufferSize()));
+        if (m_gradient && m_gradient->GetNumElements() > 0)
+            buffers.push_back(std::make_pair((const void*) m_gradient.get(), m_gradient->BufferSize()));
+    }
+
     // -----------------------------------------------------------------------
     // dimensions and allocation
     // -----------------------------------------------------------------------
@@ -1411,6 +1437,12 @@ public:
         CreateMatrixIfNull(m_value);
     }
 
+    // use the value matrix of a node of another network instance, e.g. to share read-only model parameters between instances
+    void ShareValueWith(const ComputationNode<ElemType>& other)
+    {
+        m_value = other.m_value;
+    }
+
 protected:
 
     // this function is used to create matrices for those needed before matrix pool is available
@@ -1422,11 +1454,19 @@ protected:
             matrixPtr = make_shared<Matrix<ElemType>>(m_deviceId);
     }
 
+    // The pool matches requests to released matrices by size, i.e. the number of rows the matrix will have.
+    // By default this is this node's sample dimension, which is right for m_value, m_gradient, and most temporaries.
+    // Temporaries of a different height (e.g. the softmax of a criterion's input, or stacked gates) must pass theirs.
     void RequestMatrixFromPool(shared_ptr<Matrix<ElemType>>& matrixPtr, MatrixPool& matrixPool)
+    {
+        RequestMatrixFromPool(matrixPtr, matrixPool, GetSampleMatrixNumRows());
+    }
+
+    void RequestMatrixFromPool(shared_ptr<Matrix<ElemType>>& matrixPtr, MatrixPool& matrixPool, size_t numRows)
     {
         if (matrixPtr == nullptr)
         {
-            matrixPtr = matrixPool.Request<ElemType>(m_deviceId);
+            matrixPtr = matrixPool.Request<ElemType>(m_deviceId, numRows);
         }
     }
 
@@ -1525,13 +1565,14 @@ public:
         }
     }
 
-    // NOTE: we should reimplement this to be thread-safe and use a larger than requested initialized memory block
+    // NOTE: we should reimplement this to use a larger than requested initialized memory block
     // we can then just wrap that memory block in a matrix of the correct dimensions since it will be const no one can change it
     // should only need one memory block per device
-    // Thread-safety could be achieved by changing this to a shared_ptr.
+    // The cache is guarded by a mutex, since networks may be evaluated concurrently (e.g. by the MultiModelEvaluator).
     // When using the TensorView interface, one could instead just use a 1x1 matrix with a view that broadcasts its columns (stride 0).
     static const Matrix<ElemType>& ConstOnes(const size_t rows, const size_t cols, const DEVICEID_TYPE deviceId)
     {
+        std::lock_guard<std::mutex> lock(s_constOnesMutex);
         if (s_constOnes.find(rows) == s_constOnes.end() ||
             s_constOnes[rows].find(cols) == s_constOnes[rows].end()) // not found
         {
@@ -1555,6 +1596,7 @@ protected:
     shared_ptr<Matrix<ElemType>> m_value, m_gradient;
 
     static std::map<size_t, std::map<size_t, Matrix<ElemType>*>> s_constOnes;
+    static std::mutex s_constOnesMutex;
 };
 
 // convenience wrapper for ComputationNode::New()
@@ -1601,6 +1643,22 @@ public:
     // non-looping node types instead implement these functions
     virtual void ForwardPropNonLooping() = 0;
     virtual void BackpropToNonLooping(size_t inputIndex) = 0;
+
+protected:
+    // the sequences of the minibatch as column ranges, for nodes that process whole sequences at once (CRF training and decoding)
+    std::vector<RCRFSequence> GetWholeSequences(const MBLayoutPtr& pMBLayout) const
+    {
+        std::vector<RCRFSequence> sequences;
+        for (const auto& seq : pMBLayout->GetAllSequences())
+        {
+            if (seq.seqId == GAP_SEQUENCE_ID)
+                continue;
+            if (seq.tBegin < 0 || seq.tEnd > pMBLayout->GetNumTimeSteps())
+                InvalidArgument("%ls %ls operation needs whole sequences in each minibatch; truncated BPTT is not supported.", this->NodeName().c_str(), this->OperationName().c_str());
+            sequences.push_back(RCRFSequence{(size_t) seq.tBegin * pMBLayout->GetNumParallelSequences() + seq.s, seq.GetNumTimeSteps(), pMBLayout->GetNumParallelSequences()});
+        }
+        return sequences;
+    }
 };
 
 // =======================================================================
@@ -1627,6 +1685,7 @@ public:
     virtual void CopyTo(ComputationNodeBasePtr node, const std::wstring& newName, const CopyNodeFlags flags) const override { NOT_IMPLEMENTED; }
     virtual ComputationNodeBasePtr Duplicate(const std::wstring& newName, const CopyNodeFlags flags) override { NOT_IMPLEMENTED; }
     virtual double Get00Element() const override { NOT_IMPLEMENTED; }
+    virtual void GetValueAndGradientBuffers(std::vector<std::pair<const void*, size_t>>&) const override { NOT_IMPLEMENTED; }
     virtual void UpdateFunctionMBSize() override { NOT_IMPLEMENTED; }
     virtual void AttachInputs(const std::vector<ComputationNodeBasePtr>& inputs) override { NOT_IMPLEMENTED; }
     virtual void PrintSelf(bool) const override { NOT_IMPLEMENTED; }
@@ -1719,6 +1778,7 @@ protected:
     typedef shared_ptr<ComputationNode<ElemType>> ComputationNodePtr;                                                                                    \
     using Base::BackpropTo;                                                                                                                              \
     using Base::ConstOnes;                                                                                                                               \
+    using Base::CopyMatrixTo;                                                                                                                            \
     using Base::CopyTo;                                                                                                                                  \
     using Base::CreateMatrixIfNull;                                                                                                                      \
     using Base::CreateUniqId;                                                                                                                            \
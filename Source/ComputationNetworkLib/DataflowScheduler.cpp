@@ -0,0 +1,258 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// DataflowScheduler.cpp -- runs the tasks of a dependency graph on a pool of threads
+//
+
+#define _CRT_SECURE_NO_WARNINGS // "secure" CRT not available on all platforms  --add this at the top of all CPP files that give "function or variable may be unsafe" warnings
+
+#include "Basics.h"
+#include "DataflowScheduler.h"
+#include "CPUMatrix.h" // for SetNumThreadsOfCallingThread() and SetNumBLASThreadsOfProcess()
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+DataflowScheduler::DataflowScheduler(size_t numThreads)
+    : m_shutdown(false), m_running(false), m_graph(nullptr), m_runTask(nullptr), m_hasReadyCallback(false),
+      m_numPendingPredecessorsAllocated(0), m_numQueued(0), m_numCompleted(0), m_failed(false)
+{
+    if (numThreads == 0)
+        InvalidArgument("DataflowScheduler: The number of threads must be at least 1.");
+
+#ifdef _OPENMP
+    m_numInnerThreads = max(omp_get_max_threads() / (int) numThreads, 1);
+#else
+    m_numInnerThreads = 1;
+#endif
+
+    for (size_t i = 0; i < numThreads; i++)
+        m_workers.push_back(unique_ptr<Worker>(new Worker()));
+    for (size_t i = 1; i < numThreads; i++)
+        m_threads.push_back(thread(&DataflowScheduler::ThreadProc, this, i));
+}
+
+DataflowScheduler::~DataflowScheduler()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_wakeUp.notify_all();
+    for (auto& t : m_threads)
+        t.join();
+}
+
+void DataflowScheduler::Run(const DataflowGraph& graph, const function<void(size_t)>& runTask, const function<void(size_t)>& onTaskReady)
+{
+    if (m_running)
+        LogicError("DataflowScheduler::Run: Called while another Run() is in progress.");
+    const size_t numTasks = graph.GetNumTasks();
+    if (numTasks == 0)
+        return;
+    if (find(graph.m_numPredecessors.begin(), graph.m_numPredecessors.end(), 0) == graph.m_numPredecessors.end())
+        LogicError("DataflowScheduler::Run: The graph has no task to start with (cyclic dependency).");
+
+    // set up the state of this pass
+    if (m_numPendingPredecessorsAllocated < numTasks)
+    {
+        m_numPendingPredecessors.reset(new atomic<size_t>[numTasks]);
+        m_numPendingPredecessorsAllocated = numTasks;
+    }
+    for (size_t i = 0; i < numTasks; i++)
+        m_numPendingPredecessors[i] = graph.m_numPredecessors[i];
+    m_graph = &graph;
+    m_runTask = &runTask;
+    m_hasReadyCallback = (onTaskReady != nullptr);
+    m_numCompleted = 0;
+    m_failed = false;
+    m_error = nullptr;
+    m_readyForCaller.clear();
+
+    // The BLAS libraries without a per-thread setting get the budget of one thread here, once for all threads,
+    // before any of them runs a task; the threads have set their per-thread settings when they started.
+    int numBLASThreadsBefore = CPUMatrix<float /*any will do*/>::SetNumBLASThreadsOfProcess(m_numInnerThreads);
+    int numThreadsBefore = CPUMatrix<float>::SetNumThreadsOfCallingThread(m_numInnerThreads);
+
+    // the tasks without predecessors start out in our own queue, in task order
+    {
+        lock_guard<mutex> lock(m_mutex);
+        auto& readyTasks = m_workers[0]->m_readyTasks;
+        for (size_t i = 0; i < numTasks; i++)
+        {
+            if (graph.m_numPredecessors[i] != 0)
+                continue;
+            {
+                lock_guard<mutex> workerLock(m_workers[0]->m_mutex);
+                readyTasks.push_back(i);
+            }
+            m_numQueued++;
+            if (m_hasReadyCallback)
+                m_readyForCaller.push_back(i);
+        }
+        m_running = true;
+    }
+    m_wakeUp.notify_all();
+
+    // work along with the other threads until all tasks have completed
+    for (;;)
+    {
+        size_t task;
+        if (m_hasReadyCallback && TryPopReadyForCaller(task)) // work that must be done on this thread comes first
+        {
+            if (!m_failed)
+            {
+                try
+                {
+                    onTaskReady(task);
+                }
+                catch (...)
+                {
+                    RecordError();
+                }
+            }
+        }
+        else if (TryPop(0, task))
+            Execute(0, task);
+        else
+        {
+            unique_lock<mutex> lock(m_mutex);
+            if (m_numCompleted == numTasks && m_readyForCaller.empty())
+                break;
+            m_wakeUp.wait(lock, [this, numTasks]()
+                          {
+                              return m_numQueued > 0 || !m_readyForCaller.empty() || m_numCompleted == numTasks;
+                          });
+        }
+    }
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_running = false;
+    }
+    CPUMatrix<float>::SetNumThreadsOfCallingThread(numThreadsBefore);
+    CPUMatrix<float>::SetNumBLASThreadsOfProcess(numBLASThreadsBefore);
+
+    if (m_error)
+    {
+        auto error = m_error;
+        m_error = nullptr;
+        rethrow_exception(error);
+    }
+}
+
+void DataflowScheduler::ThreadProc(size_t workerIndex)
+{
+    CPUMatrix<float>::SetNumThreadsOfCallingThread(m_numInnerThreads);
+    for (;;)
+    {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_wakeUp.wait(lock, [this]()
+                          {
+                              return m_shutdown || (m_running && m_numQueued > 0);
+                          });
+            if (m_shutdown)
+                return;
+        }
+        size_t task;
+        while (TryPop(workerIndex, task))
+            Execute(workerIndex, task);
+    }
+}
+
+// run a task and queue the successors it was the last predecessor of
+// Once a task has failed, the remaining ones are only counted as completed, so that Run() can return.
+void DataflowScheduler::Execute(size_t workerIndex, size_t task)
+{
+    if (!m_failed)
+    {
+        try
+        {
+            (*m_runTask)(task);
+        }
+        catch (...)
+        {
+            RecordError();
+        }
+    }
+
+    for (auto successor : m_graph->m_successors[task])
+    {
+        if (--m_numPendingPredecessors[successor] == 0)
+            Push(workerIndex, successor);
+    }
+
+    if (++m_numCompleted == m_graph->GetNumTasks())
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_wakeUp.notify_all();
+    }
+}
+
+void DataflowScheduler::Push(size_t workerIndex, size_t task)
+{
+    // (counted before it is queued, so that the count never drops below the number of queued tasks)
+    m_numQueued++;
+    {
+        lock_guard<mutex> lock(m_workers[workerIndex]->m_mutex);
+        m_workers[workerIndex]->m_readyTasks.push_front(task);
+    }
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_hasReadyCallback)
+            m_readyForCaller.push_back(task);
+    }
+    m_wakeUp.notify_all();
+}
+
+// take the newest task of our own queue, else steal the oldest one of another thread
+bool DataflowScheduler::TryPop(size_t workerIndex, size_t& task)
+{
+    const size_t numWorkers = m_workers.size();
+    for (size_t k = 0; k < numWorkers; k++)
+    {
+        Worker& worker = *m_workers[(workerIndex + k) % numWorkers];
+        lock_guard<mutex> lock(worker.m_mutex);
+        if (worker.m_readyTasks.empty())
+            continue;
+        if (k == 0)
+        {
+            task = worker.m_readyTasks.front();
+            worker.m_readyTasks.pop_front();
+        }
+        else
+        {
+            task = worker.m_readyTasks.back();
+            worker.m_readyTasks.pop_back();
+        }
+        m_numQueued--;
+        return true;
+    }
+    return false;
+}
+
+bool DataflowScheduler::TryPopReadyForCaller(size_t& task)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_readyForCaller.empty())
+        return false;
+    task = m_readyForCaller.front();
+    m_readyForCaller.pop_front();
+    return true;
+}
+
+void DataflowScheduler::RecordError()
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (!m_error)
+        m_error = current_exception();
+    m_failed = true;
+}
+
+}}}
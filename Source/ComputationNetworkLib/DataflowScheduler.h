@@ -0,0 +1,120 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// DataflowScheduler.h -- runs the tasks of a dependency graph on a pool of threads
+//
+#pragma once
+
+#include "Basics.h"
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// DataflowGraph -- tasks 0..N-1 and the order constraints between them
+// -----------------------------------------------------------------------
+
+struct DataflowGraph
+{
+    std::vector<std::vector<size_t>> m_successors; // [i] -> tasks that can only start after task i has completed
+    std::vector<size_t> m_numPredecessors;         // [i] -> number of tasks that list i as their successor
+
+    size_t GetNumTasks() const { return m_numPredecessors.size(); }
+    void Resize(size_t numTasks)
+    {
+        m_successors.assign(numTasks, std::vector<size_t>());
+        m_numPredecessors.assign(numTasks, 0);
+    }
+    // add the constraint that 'to' starts after 'from' has completed; duplicates are ignored
+    void AddEdge(size_t from, size_t to)
+    {
+        auto& successors = m_successors[from];
+        if (std::find(successors.begin(), successors.end(), to) != successors.end())
+            return;
+        successors.push_back(to);
+        m_numPredecessors[to]++;
+    }
+};
+
+// -----------------------------------------------------------------------
+// DataflowScheduler -- executes a DataflowGraph with work stealing
+//
+// Run() executes every task once as soon as its predecessors have completed.
+// The calling thread takes part as one of the threads, so a scheduler for N threads
+// starts N-1 threads, which live as long as the scheduler and sleep between Run() calls.
+// Each thread keeps the tasks that became ready through it in its own queue and runs
+// the most recent one first (its data is most likely still in the cache); a thread
+// whose queue is empty takes the oldest task from another thread's queue.
+//
+// The threads divide the cores among them: each one runs OpenMP loops and BLAS calls
+// with (number of OpenMP threads at construction) / N threads (at least 1). Each thread sets
+// this for itself; BLAS libraries that only have a process-wide setting (OpenBLAS, ACML) are
+// set once by Run() for its duration.
+//
+// If a task throws, no further tasks are started, and Run() rethrows the first exception
+// once the tasks already running have completed.
+// -----------------------------------------------------------------------
+
+class DataflowScheduler
+{
+public:
+    DataflowScheduler(size_t numThreads);
+    ~DataflowScheduler();
+
+    size_t GetNumThreads() const { return m_workers.size(); }
+
+    // Run runTask(i) for all tasks i of 'graph'. Returns when all of them have completed.
+    // If given, onTaskReady(i) is called on the calling thread for every task i once its predecessors have completed,
+    // concurrently with runTask(i), for work that must stay on one thread.
+    void Run(const DataflowGraph& graph, const std::function<void(size_t)>& runTask, const std::function<void(size_t)>& onTaskReady = nullptr);
+
+private:
+    DataflowScheduler(const DataflowScheduler&) = delete;
+    DataflowScheduler& operator=(const DataflowScheduler&) = delete;
+
+    struct Worker
+    {
+        std::mutex m_mutex; // guards m_readyTasks (the owner takes from the front, others steal from the back)
+        std::deque<size_t> m_readyTasks;
+    };
+
+    void ThreadProc(size_t workerIndex);
+    void Push(size_t workerIndex, size_t task);
+    bool TryPop(size_t workerIndex, size_t& task);
+    bool TryPopReadyForCaller(size_t& task);
+    void Execute(size_t workerIndex, size_t task);
+    void RecordError();
+
+    std::vector<std::unique_ptr<Worker>> m_workers; // [0] is the thread that calls Run()
+    std::vector<std::thread> m_threads;             // the threads of m_workers[1..]
+    int m_numInnerThreads;                          // OpenMP/BLAS threads per worker
+
+    std::mutex m_mutex;                 // guards the waits below, m_readyForCaller, and m_error
+    std::condition_variable m_wakeUp;   // signaled when tasks were queued, the pass has completed, or the scheduler shuts down
+    bool m_shutdown;
+    bool m_running;                     // a Run() is in progress
+
+    // state of the current Run()
+    const DataflowGraph* m_graph;
+    const std::function<void(size_t)>* m_runTask;
+    bool m_hasReadyCallback;
+    std::unique_ptr<std::atomic<size_t>[]> m_numPendingPredecessors;
+    size_t m_numPendingPredecessorsAllocated;
+    std::atomic<size_t> m_numQueued;    // tasks in the queues of all workers
+    std::atomic<size_t> m_numCompleted;
+    std::atomic<bool> m_failed;
+    std::deque<size_t> m_readyForCaller; // tasks for onTaskReady()
+    std::exception_ptr m_error;
+};
+
+}}}
@@ -100,18 +100,18 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<ErrorPredictionNode<ElemType>>(nodeP);
-            *node->m_maxIndexes0 = *m_maxIndexes0;
-            *node->m_maxIndexes1 = *m_maxIndexes1;
-            *node->m_maxValues = *m_maxValues;
+            CopyMatrixTo(m_maxIndexes0, node->m_maxIndexes0);
+            CopyMatrixTo(m_maxIndexes1, node->m_maxIndexes1);
+            CopyMatrixTo(m_maxValues, node->m_maxValues);
         }
     }
     // request matrices needed to do node function value evaluation
     virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool)
     {
         Base::RequestMatricesBeforeForwardProp(matrixPool);
-        RequestMatrixFromPool(m_maxIndexes0, matrixPool);
-        RequestMatrixFromPool(m_maxIndexes1, matrixPool);
-        RequestMatrixFromPool(m_maxValues, matrixPool);
+        RequestMatrixFromPool(m_maxIndexes0, matrixPool, (size_t) m_topK);
+        RequestMatrixFromPool(m_maxIndexes1, matrixPool, (size_t) m_topK);
+        RequestMatrixFromPool(m_maxValues, matrixPool, (size_t) m_topK);
     }
 
     // release temp matrices that are only used by forward computation
@@ -143,6 +143,8 @@ template class ErrorPredictionNode<double>;
 //    in the R-CRF case, it is the RNN output score before softmax
 //  - transition score : score from the transition node,
 //    in the R-CRF case, it is the transition probability between labels
+// On the CPU, all sequences of the minibatch are decoded at once, in parallel, each constrained
+// to the labels given in its own first and last column (see CPUMatrix::RCRFViterbi()).
 // -----------------------------------------------------------------------
 
 template <class ElemType>
@@ -219,6 +221,15 @@ public:
     // compute posterior probability of label y at position t
     virtual void /*ComputationNodeNonLooping::*/ ForwardPropNonLooping() override
     {
+        if (m_deviceId == CPUDEVICE)
+        {
+            auto sequences = Base::GetWholeSequences(Input(0)->GetMBLayout());
+            Matrix<ElemType>::RCRFViterbi(Input(0)->Value(), Input(1)->Value(), Input(2)->Value(), Value(), sequences);
+            if (m_pMBLayout->HasGaps())
+                MaskMissingColumnsToZero(Value(), m_pMBLayout, FrameRange(m_pMBLayout));
+            return;
+        }
+
         DecideStartEndingOutputLab(Input(0)->Value(), mStartLab, mEndLab);
         ForwardPropS(mAlpha, mBacktrace, Value(), Input(1)->Value(),
                      Input(2)->Value(), mStartLab, mEndLab);
@@ -470,14 +470,30 @@ class LookupTableNode : public ComputationNode<ElemType>, public NumInputs<2>
 public:
     DeclareConstructorFromConfigWithNumInputs(LookupTableNode);
     LookupTableNode(DEVICEID_TYPE deviceId, const wstring& name)
-        : Base(deviceId, name)
+        : Base(deviceId, name), m_useSparseGradient(true)
+    {
+    }
+
+    // Gradient aggregation across workers handles dense gradients only, so data-parallel SGD turns the sparse
+    // embedding gradient off. Must be called before the matrices are allocated.
+    void SetUseSparseGradient(bool useSparseGradient)
     {
+        m_useSparseGradient = useSparseGradient;
     }
 
     virtual void /*ComputationNode::*/ BackpropTo(const size_t inputIndex, const FrameRange& t) override
     {
         if (inputIndex == 0) // left derivative (embedding matrix)
         {
+            if (UseSparseLookup())
+            {
+                // scatter into the looked-up columns only; masking the output gradient suffices to exclude gaps
+                Matrix<ElemType> sliceInput1Value = Input(1)->ValueFor(t);
+                Matrix<ElemType> sliceOutputGrad = MaskedGradientFor(t);
+                Matrix<ElemType>::SparseColumnLookupGradient(sliceOutputGrad, sliceInput1Value, Input(0)->GradientAsMatrix());
+                return;
+            }
+
             // This is a reduction operation, hence we need to mask out gaps.
             Matrix<ElemType> sliceInput1Value = Input(1)->MaskedValueFor(t);
             Matrix<ElemType> sliceOutputGrad = MaskedGradientFor(t);
@@ -538,6 +554,13 @@ public:
         if (cols0 * wordsInEachSample != rows1)
             LogicError("LookupTableNode: rows of input 1 is not a multiple of cols of input 0. This usually happens when the feature dimension is not specified as that in the network definition of look-up-table dimension size.");
 
+        if (UseSparseLookup())
+        {
+            // gather the embedding columns selected by the sparse input, rather than multiplying with it
+            Matrix<ElemType>::SparseColumnLookup(input0, input1, functionValues);
+            return;
+        }
+
         auto input1Reshaped = input1.Reshaped(rows1 / wordsInEachSample, cols1 * wordsInEachSample);
 
         auto functionValuesReshaped = functionValues.Reshaped(input0.GetNumRows(), input1Reshaped.GetNumCols());
@@ -560,6 +583,30 @@ public:
         SetDims(TensorShape(Input(0)->GetAsMatrixNumRows() * wordsInEachSample), true);
     }
 
+    virtual void AllocateGradientMatricesForInputs(MatrixPool& matrixPool) override
+    {
+        // with a sparse input on the CPU, the embedding gradient holds only the looked-up columns
+        // (like TimesNode, this matrix is allocated directly instead of from the pool)
+        if (Input(0)->NeedGradient() && UseSparseLookup() && m_useSparseGradient)
+        {
+            Input(0)->CreateGradientMatrixIfNull();
+            Input(0)->Gradient().SwitchToMatrixType(SPARSE, MatrixFormat::matrixFormatSparseBlockCol, false);
+        }
+
+        Base::AllocateGradientMatricesForInputs(matrixPool);
+    }
+
+private:
+    // sparse input on the CPU: gather/scatter embedding columns instead of multiplying with the one-hot input
+    bool UseSparseLookup() const
+    {
+        return Input(1)->Value().GetMatrixType() == SPARSE && Input(1)->Value().GetDeviceId() == CPUDEVICE;
+    }
+
+    bool m_useSparseGradient;
+
+public:
+
     bool UnitTest()
     {
         try
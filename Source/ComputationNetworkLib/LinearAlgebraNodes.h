@@ -508,8 +508,8 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<DiagTimesNode<ElemType>>(nodeP);
-            *node->m_innerproduct = *m_innerproduct;
-            *node->m_rightGradient = *m_rightGradient;
+            CopyMatrixTo(m_innerproduct, node->m_innerproduct);
+            CopyMatrixTo(m_rightGradient, node->m_rightGradient);
         }
     }
     // request matrices that are needed for gradient computation
@@ -823,11 +823,11 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<CosDistanceNode<ElemType>>(nodeP);
-            *node->m_invNorm0 = *m_invNorm0;
-            *node->m_invNorm1 = *m_invNorm1;
-            *node->m_leftTerm = *m_leftTerm;
-            *node->m_rightTerm = *m_rightTerm;
-            *node->m_temp = *m_temp;
+            CopyMatrixTo(m_invNorm0, node->m_invNorm0);
+            CopyMatrixTo(m_invNorm1, node->m_invNorm1);
+            CopyMatrixTo(m_leftTerm, node->m_leftTerm);
+            CopyMatrixTo(m_rightTerm, node->m_rightTerm);
+            CopyMatrixTo(m_temp, node->m_temp);
         }
     }
     // request matrices needed to do node function value evaluation
@@ -1140,12 +1140,12 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<CosDistanceWithNegativeSamplesNode<ElemType>>(nodeP);
-            *node->m_invNorm0 = *m_invNorm0;
-            *node->m_invNorm1 = *m_invNorm1;
-            *node->m_invNormSquare = *m_invNormSquare;
-            *node->m_leftTerm = *m_leftTerm;
-            *node->m_rightTerm = *m_rightTerm;
-            *node->m_temp = *m_temp;
+            CopyMatrixTo(m_invNorm0, node->m_invNorm0);
+            CopyMatrixTo(m_invNorm1, node->m_invNorm1);
+            CopyMatrixTo(m_invNormSquare, node->m_invNormSquare);
+            CopyMatrixTo(m_leftTerm, node->m_leftTerm);
+            CopyMatrixTo(m_rightTerm, node->m_rightTerm);
+            CopyMatrixTo(m_temp, node->m_temp);
         }
     }
     // request matrices needed to do node function value evaluation
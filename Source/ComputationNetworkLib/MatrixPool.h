@@ -8,6 +8,8 @@
 #include <string>
 #include <stdexcept>
 #include <vector>
+#include <map>
+#include <iterator>
 #include <algorithm>
 #include <stdlib.h>
 
@@ -17,52 +19,160 @@
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// -----------------------------------------------------------------------
+// MatrixPool -- shares matrix objects between nodes whose values are not alive at the same time
+//
+// ComputationNetwork::AllocateAllMatrices() simulates one forward and backward pass and requests/releases
+// matrices in the order in which nodes would compute and free them. Each request states the expected
+// number of elements per column (sample), which is known from the node dimensions at that point.
+// The pool then works like a register allocator over these liveness intervals: a request is served
+// from the released matrices with the smallest planned size that still fits (best fit); if none fits,
+// the largest released matrix is taken and its planned size grown, which costs less than allocating a new one.
+// The resulting assignment of matrix objects to nodes is the memory plan of the network; it is computed
+// once and then used for every minibatch. Since matrices only grow (Resize() is grow-only), a shared
+// buffer gets allocated once at the size of its largest user, and is not reallocated again unless the
+// minibatch size grows.
+// Sharing assumes that nodes run one after the other in the simulated order. When nodes run concurrently
+// (ComputationNetwork::SetNumNodeExecutionThreads()), it is turned off, and every request gets its own matrix.
+// -----------------------------------------------------------------------
+
 class MatrixPool
 {
-    vector<shared_ptr<Matrix<float>>> m_releasedFloatMatrices;
-    vector<shared_ptr<Matrix<double>>> m_releasedDoubleMatrices;
+    template <class ElemType>
+    struct PlanState
+    {
+        multimap<size_t, shared_ptr<Matrix<ElemType>>> m_releasedMatrices; // released matrices, keyed by planned elements per column
+        map<shared_ptr<Matrix<ElemType>>, size_t> m_plannedSizes;          // planned elements per column of every matrix handed out
+                                                                           // (holds a reference, so that an address cannot be reused while planning)
+        size_t m_numPlannedElements;                                       // sum over m_plannedSizes, i.e. elements per column with sharing
+        size_t m_numRequestedElements;                                     // sum over all requests, i.e. elements per column without sharing
+        size_t m_numRequests;
+        size_t m_numSharedRequests;                                        // requests served from m_releasedMatrices
+
+        PlanState()
+            : m_numPlannedElements(0), m_numRequestedElements(0), m_numRequests(0), m_numSharedRequests(0)
+        {
+        }
+    };
+
+    PlanState<float> m_floatPlan;
+    PlanState<double> m_doublePlan;
+    bool m_sharingEnabled;
+    bool m_hasSharedMatrices; // survives ResetPlan(), since matrices shared by an earlier plan are still shared
 
     template <class ElemType>
-    vector<shared_ptr<Matrix<ElemType>>>& GetReleasedMatrices();
+    PlanState<ElemType>& GetPlan();
+    template <class ElemType>
+    const PlanState<ElemType>& GetPlan() const
+    {
+        return const_cast<MatrixPool*>(this)->GetPlan<ElemType>();
+    }
 
 public:
+    MatrixPool()
+        : m_sharingEnabled(true), m_hasSharedMatrices(false)
+    {
+    }
+
+    // start a new plan (ComputationNetwork::AllocateAllMatrices()); drops the released matrices and planned sizes of the previous one
+    void ResetPlan()
+    {
+        m_floatPlan = PlanState<float>();
+        m_doublePlan = PlanState<double>();
+    }
+
+    // forget everything, for when the nodes that hold our matrices go away (ComputationNetwork::ClearNetwork())
+    void Clear()
+    {
+        ResetPlan();
+        m_hasSharedMatrices = false;
+    }
+
+    // if disabled, released matrices are not handed out again (this affects only later Release() calls)
+    void EnableSharing(bool enable) { m_sharingEnabled = enable; }
+    // true if any request since Clear() was served with a matrix that another request had released
+    bool HasSharedMatrices() const { return m_hasSharedMatrices; }
+
     // release here means the matrix can be put back and shared by others
     template <class ElemType>
     void Release(shared_ptr<Matrix<ElemType>> freeMatrix)
     {
-        vector<shared_ptr<Matrix<ElemType>>>& releasedMatrices = GetReleasedMatrices<ElemType>();
+        PlanState<ElemType>& plan = GetPlan<ElemType>();
         if (freeMatrix == nullptr || freeMatrix->GetMatrixType() == SPARSE)
             RuntimeError("MatrixPool::Release: freeMatrix should not be null or sparse.");
 #ifdef _DEBUG
-        for (int i = 0; i < releasedMatrices.size(); i++)
+        for (auto& released : plan.m_releasedMatrices)
         {
-            if (releasedMatrices[i] == freeMatrix)
+            if (released.second == freeMatrix)
                 RuntimeError("MatrixPool::Release: freeMatrix is already in the released pool.");
         }
-
 #endif
-        releasedMatrices.push_back(freeMatrix);
+        // matrices that were not created by us (e.g. created by a node itself) enter the plan with size 0
+        auto iter = plan.m_plannedSizes.find(freeMatrix);
+        size_t plannedSize = (iter != plan.m_plannedSizes.end()) ? iter->second : 0;
+        if (iter == plan.m_plannedSizes.end())
+            plan.m_plannedSizes[freeMatrix] = 0;
+        if (m_sharingEnabled)
+            plan.m_releasedMatrices.insert(make_pair(plannedSize, freeMatrix));
     }
 
+    // request a matrix that is expected to hold 'numElementsPerColumn' elements per column
     template <class ElemType>
-    shared_ptr<Matrix<ElemType>> Request(DEVICEID_TYPE deviceId)
+    shared_ptr<Matrix<ElemType>> Request(DEVICEID_TYPE deviceId, size_t numElementsPerColumn = 0)
     {
-        vector<shared_ptr<Matrix<ElemType>>>& releasedMatrices = GetReleasedMatrices<ElemType>();
+        PlanState<ElemType>& plan = GetPlan<ElemType>();
         shared_ptr<Matrix<ElemType>> matrixPtr;
-        if (releasedMatrices.empty())
+        if (plan.m_releasedMatrices.empty())
         {
             matrixPtr = make_shared<Matrix<ElemType>>(deviceId);
+            plan.m_plannedSizes[matrixPtr] = numElementsPerColumn;
+            plan.m_numPlannedElements += numElementsPerColumn;
         }
         else
         {
-            matrixPtr = releasedMatrices.back();
-            releasedMatrices.pop_back();
+            // best fit: smallest released matrix that is large enough, else the largest one, which we grow
+            auto iter = plan.m_releasedMatrices.lower_bound(numElementsPerColumn);
+            if (iter == plan.m_releasedMatrices.end())
+                iter = prev(plan.m_releasedMatrices.end());
+            matrixPtr = iter->second;
+            plan.m_releasedMatrices.erase(iter);
+            plan.m_numSharedRequests++;
+            m_hasSharedMatrices = true;
+
+            size_t& plannedSize = plan.m_plannedSizes[matrixPtr];
+            if (plannedSize < numElementsPerColumn)
+            {
+                plan.m_numPlannedElements += numElementsPerColumn - plannedSize;
+                plannedSize = numElementsPerColumn;
+            }
         }
+        plan.m_numRequestedElements += numElementsPerColumn;
+        plan.m_numRequests++;
 
         if (!matrixPtr) // this can't really happen
             LogicError("MatrixPool::Request: failed to get a valid matrix.");
 
         return matrixPtr;
     }
+
+    // statistics of the memory plan
+    // Sizes are per column, since the number of columns is only known once a minibatch is processed.
+    template <class ElemType>
+    size_t GetNumPlannedMatrices() const { return GetPlan<ElemType>().m_plannedSizes.size(); }
+    template <class ElemType>
+    size_t GetNumPlannedBytesPerColumn() const { return GetPlan<ElemType>().m_numPlannedElements * sizeof(ElemType); }
+    template <class ElemType>
+    size_t GetNumRequestedBytesPerColumn() const { return GetPlan<ElemType>().m_numRequestedElements * sizeof(ElemType); }
+
+    void LogMemoryPlan() const
+    {
+        size_t numRequests = GetPlan<float>().m_numRequests + GetPlan<double>().m_numRequests;
+        size_t numMatrices = GetNumPlannedMatrices<float>() + GetNumPlannedMatrices<double>();
+        size_t plannedBytes = GetNumPlannedBytesPerColumn<float>() + GetNumPlannedBytesPerColumn<double>();
+        size_t requestedBytes = GetNumRequestedBytesPerColumn<float>() + GetNumRequestedBytesPerColumn<double>();
+        fprintf(stderr, "Memory plan: %d requests served by %d shared matrices; peak %.1f KB per column vs. %.1f KB without sharing (%.1f%%).\n",
+                (int) numRequests, (int) numMatrices, plannedBytes / 1024.0, requestedBytes / 1024.0,
+                requestedBytes > 0 ? 100.0 * plannedBytes / requestedBytes : 100.0);
+    }
 };
 } } }
@@ -0,0 +1,278 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// NodeProfiler.cpp -- per-node timing of forward and backward propagation
+//
+
+#define _CRT_SECURE_NO_WARNINGS // "secure" CRT not available on all platforms  --add this at the top of all CPP files that give "function or variable may be unsafe" warnings
+
+#include "Basics.h"
+#include "NodeProfiler.h"
+#include "fileutil.h"
+#include <algorithm>
+#include <map>
+
+using namespace std;
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// upper bound for the timeline, to not run out of memory when profiling is left on for a long time
+static const size_t maxTraceEvents = 4 * 1024 * 1024;
+
+bool NodeProfiler::s_enabled = false;
+mutex NodeProfiler::s_mutex;
+unordered_map<const ComputationNodeBase*, size_t> NodeProfiler::s_statsIndex;
+vector<NodeProfiler::NodeStats> NodeProfiler::s_stats;
+wstring NodeProfiler::s_traceFile;
+vector<NodeProfiler::TraceEvent> NodeProfiler::s_trace;
+vector<pair<wstring, wstring>> NodeProfiler::s_traceNodes;
+map<pair<wstring, wstring>, size_t> NodeProfiler::s_traceNodeIndex;
+NodeProfiler::Clock::time_point NodeProfiler::s_traceStart;
+size_t NodeProfiler::s_numCarriedOverStates = 0;
+size_t NodeProfiler::s_numCarriedOverBytes = 0;
+size_t NodeProfiler::s_numCarriedOverBytesOfMinibatches = 0;
+
+/*static*/ void NodeProfiler::Enable(bool enable, const wstring& traceFile)
+{
+    s_enabled = enable;
+    if (enable && traceFile != s_traceFile)
+    {
+        s_traceFile = traceFile;
+        s_trace.clear();
+        s_traceNodes.clear();
+        s_traceNodeIndex.clear();
+        s_traceStart = Clock::now();
+        s_statsIndex.clear(); // (their entries refer to the previous timeline)
+        s_stats.clear();
+    }
+}
+
+/*static*/ void NodeProfiler::Reset()
+{
+    // The nodes are forgotten, too: they are identified by their address, which a new node may reuse once a network is deleted.
+    lock_guard<mutex> lock(s_mutex);
+    s_statsIndex.clear();
+    s_stats.clear();
+    s_numCarriedOverStates = s_numCarriedOverBytes = s_numCarriedOverBytesOfMinibatches = 0;
+}
+
+// rough number of floating-point operations of one call
+// Matrix products are counted exactly, everything else as one operation per output element and input.
+/*static*/ double NodeProfiler::EstimateFlops(const ComputationNodeBase& node, bool isAllFrames, bool isBackprop)
+{
+    size_t numCols = node.GetSampleMatrixNumCols();
+    if (!isAllFrames && node.HasMBLayout()) // a single time step of a loop
+        numCols = node.GetMBLayout()->GetNumParallelSequences();
+    double numOutputElements = (double) node.GetSampleMatrixNumRows() * numCols;
+
+    const wstring operationName = node.OperationName();
+    if ((operationName == L"Times" || operationName == L"TransposeTimes") && node.GetNumInputs() == 2)
+    {
+        double flops = 2 * numOutputElements * node.Input(1)->GetSampleMatrixNumRows();
+        return isBackprop ? 2 * flops : flops; // gradients w.r.t. both inputs
+    }
+    return numOutputElements * max(node.GetNumInputs(), (size_t) 1);
+}
+
+/*static*/ void NodeProfiler::Record(ComputationNodeBase& node, bool isAllFrames, bool isBackprop, Clock::time_point begin, Clock::time_point end)
+{
+    lock_guard<mutex> lock(s_mutex);
+    auto iter = s_statsIndex.find(&node);
+    if (iter == s_statsIndex.end())
+    {
+        iter = s_statsIndex.insert(make_pair(&node, s_stats.size())).first;
+        s_stats.push_back(NodeStats());
+        s_stats.back().m_nodeName = node.NodeName();
+        s_stats.back().m_operationName = node.OperationName();
+        if (!s_traceFile.empty())
+        {
+            auto names = make_pair(node.NodeName(), node.OperationName());
+            auto traceIter = s_traceNodeIndex.find(names);
+            if (traceIter == s_traceNodeIndex.end())
+            {
+                traceIter = s_traceNodeIndex.insert(make_pair(names, s_traceNodes.size())).first;
+                s_traceNodes.push_back(names);
+            }
+            s_stats.back().m_traceNodeIndex = traceIter->second;
+        }
+    }
+    auto& stats = s_stats[iter->second];
+
+    double seconds = chrono::duration<double>(end - begin).count();
+    if (isBackprop)
+    {
+        stats.m_backwardSeconds += seconds;
+        stats.m_numBackwardCalls++;
+    }
+    else
+    {
+        stats.m_forwardSeconds += seconds;
+        stats.m_numForwardCalls++;
+    }
+    stats.m_flops += EstimateFlops(node, isAllFrames, isBackprop);
+    static vector<pair<const void*, size_t>> buffers; // (guarded by s_mutex)
+    node.GetValueAndGradientBuffers(buffers);
+    size_t numBytes = 0;
+    for (const auto& buffer : buffers)
+    {
+        size_t& maxNumBytes = stats.m_buffers[buffer.first];
+        maxNumBytes = max(maxNumBytes, buffer.second);
+        numBytes += buffer.second;
+    }
+    stats.m_maxNumBytes = max(stats.m_maxNumBytes, numBytes);
+
+    if (!s_traceFile.empty() && s_trace.size() < maxTraceEvents)
+    {
+        TraceEvent event;
+        event.m_traceNodeIndex = stats.m_traceNodeIndex;
+        event.m_isBackprop = isBackprop;
+        event.m_beginMicroseconds = chrono::duration<double, micro>(begin - s_traceStart).count();
+        event.m_durationMicroseconds = seconds * 1e6;
+        s_trace.push_back(event);
+        if (s_trace.size() == maxTraceEvents)
+            fprintf(stderr, "NodeProfiler: Timeline is full with %d events; further events are not recorded.\n", (int) maxTraceEvents);
+    }
+}
+
+/*static*/ bool NodeProfiler::GetNodeStats(const ComputationNodeBase& node, NodeStats& stats)
+{
+    lock_guard<mutex> lock(s_mutex);
+    auto iter = s_statsIndex.find(&node);
+    if (iter == s_statsIndex.end())
+        return false;
+    stats = s_stats[iter->second];
+    return true;
+}
+
+/*static*/ size_t NodeProfiler::GetNumValueAndGradientBytes(size_t& numMatrices)
+{
+    lock_guard<mutex> lock(s_mutex);
+    map<const void*, size_t> allBuffers;
+    for (const auto& stats : s_stats)
+    {
+        for (const auto& buffer : stats.m_buffers)
+        {
+            size_t& numBytes = allBuffers[buffer.first];
+            numBytes = max(numBytes, buffer.second);
+        }
+    }
+    size_t totalNumBytes = 0;
+    for (const auto& buffer : allBuffers)
+        totalNumBytes += buffer.second;
+    numMatrices = allBuffers.size();
+    return totalNumBytes;
+}
+
+/*static*/ void NodeProfiler::PrintReport(FILE* f, size_t numTopNodes)
+{
+    double totalSeconds = 0;
+    map<wstring, NodeStats> operations;
+    auto addBuffers = [](map<const void*, size_t>& to, const map<const void*, size_t>& from)
+    {
+        for (const auto& buffer : from)
+        {
+            size_t& numBytes = to[buffer.first];
+            numBytes = max(numBytes, buffer.second);
+        }
+    };
+    vector<const NodeStats*> nodes;
+    for (const auto& stats : s_stats)
+    {
+        if (stats.m_numForwardCalls + stats.m_numBackwardCalls == 0)
+            continue;
+        nodes.push_back(&stats);
+        totalSeconds += stats.m_forwardSeconds + stats.m_backwardSeconds;
+
+        auto& op = operations[stats.m_operationName];
+        op.m_operationName = stats.m_operationName;
+        op.m_forwardSeconds += stats.m_forwardSeconds;
+        op.m_backwardSeconds += stats.m_backwardSeconds;
+        op.m_numForwardCalls += stats.m_numForwardCalls;
+        op.m_numBackwardCalls += stats.m_numBackwardCalls;
+        op.m_flops += stats.m_flops;
+        addBuffers(op.m_buffers, stats.m_buffers);
+    }
+    if (nodes.empty())
+        return;
+    for (auto& op : operations)
+    {
+        for (const auto& buffer : op.second.m_buffers)
+            op.second.m_maxNumBytes += buffer.second;
+    }
+    size_t numMatrices;
+    size_t totalNumBytes = GetNumValueAndGradientBytes(numMatrices);
+
+    auto byTotalTime = [](const NodeStats* a, const NodeStats* b)
+    {
+        return a->m_forwardSeconds + a->m_backwardSeconds > b->m_forwardSeconds + b->m_backwardSeconds;
+    };
+    auto printRow = [&](const NodeStats& stats, const wstring& name)
+    {
+        double seconds = stats.m_forwardSeconds + stats.m_backwardSeconds;
+        fprintf(f, "  %6.2f%% %10.4fs %10.4fs %9d %9d %10.3f %10.1f  %ls\n",
+                totalSeconds > 0 ? 100 * seconds / totalSeconds : 0.0, stats.m_forwardSeconds, stats.m_backwardSeconds,
+                (int) stats.m_numForwardCalls, (int) stats.m_numBackwardCalls,
+                seconds > 0 ? stats.m_flops / seconds * 1e-9 : 0.0, stats.m_maxNumBytes / 1048576.0, name.c_str());
+    };
+    const char* header = "  %%total    forward   backward   #fwd     #bwd      GFLOP/s     MBytes  %s\n";
+
+    sort(nodes.begin(), nodes.end(), byTotalTime);
+    fprintf(f, "\nNode profile: %.4f seconds in %d nodes; top %d nodes:\n", totalSeconds, (int) nodes.size(), (int) min(numTopNodes, nodes.size()));
+    fprintf(f, header, "node");
+    for (size_t i = 0; i < nodes.size() && i < numTopNodes; i++)
+        printRow(*nodes[i], nodes[i]->m_nodeName + L" (" + nodes[i]->m_operationName + L")");
+
+    vector<const NodeStats*> ops;
+    for (const auto& op : operations)
+        ops.push_back(&op.second);
+    sort(ops.begin(), ops.end(), byTotalTime);
+    fprintf(f, "Node profile by operation:\n");
+    fprintf(f, header, "operation");
+    for (const auto op : ops)
+        printRow(*op, op->m_operationName);
+    fprintf(f, "Value and gradient memory: %.1f MBytes in %d matrices (each counted once; a matrix that several nodes share appears in each of their rows above).\n",
+            totalNumBytes / 1048576.0, (int) numMatrices);
+
+    if (s_numCarriedOverStates > 0)
+        fprintf(f, "Carried-over state (truncated BPTT): %d times %.1f KBytes on average; copies of the full minibatches would have been %.1f KBytes (%.1f%% saved).\n",
+                (int) s_numCarriedOverStates, s_numCarriedOverBytes / 1024.0 / s_numCarriedOverStates, s_numCarriedOverBytesOfMinibatches / 1024.0 / s_numCarriedOverStates,
+                s_numCarriedOverBytesOfMinibatches > 0 ? 100.0 * (s_numCarriedOverBytesOfMinibatches - s_numCarriedOverBytes) / s_numCarriedOverBytesOfMinibatches : 0.0);
+    fflush(f);
+}
+
+// escape a node name for a JSON string
+static string JsonString(const wstring& s)
+{
+    string result;
+    for (char c : string(msra::strfun::utf8(s)))
+    {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        if ((unsigned char) c >= 0x20)
+            result += c;
+    }
+    return result;
+}
+
+/*static*/ void NodeProfiler::WriteTrace()
+{
+    if (s_traceFile.empty())
+        return;
+
+    FILE* f = fopenOrDie(s_traceFile, L"w");
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < s_trace.size(); i++)
+    {
+        const auto& event = s_trace[i];
+        const auto& names = s_traceNodes[event.m_traceNodeIndex];
+        fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,\"args\":{\"op\":\"%s\"}}\n",
+                i > 0 ? "," : "", JsonString(names.first).c_str(), event.m_isBackprop ? "backward" : "forward",
+                event.m_beginMicroseconds, event.m_durationMicroseconds, event.m_isBackprop ? 1 : 0, JsonString(names.second).c_str());
+    }
+    fprintf(f, "]}\n");
+    fcloseOrDie(f);
+    fprintf(stderr, "NodeProfiler: Wrote %d events to %ls.\n", (int) s_trace.size(), s_traceFile.c_str());
+}
+
+}}}
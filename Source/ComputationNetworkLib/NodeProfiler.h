@@ -0,0 +1,137 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// NodeProfiler.h -- per-node timing of forward and backward propagation
+//
+#pragma once
+
+#include "ComputationNode.h"
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// NodeProfiler -- records wall time, call count, a FLOP estimate, and the
+// value/gradient memory of every node executed by the PAR and SEQ traversals.
+//
+// Profiling is process-wide and off by default. When it is off, the only cost
+// is a test of a static flag per node call.
+// Note: GPU kernels are asynchronous, so on the GPU the times only reflect the
+// launch cost unless CUDA_LAUNCH_BLOCKING=1 is set.
+// Nodes may be recorded from several threads at once (ComputationNetwork::SetNumNodeExecutionThreads());
+// the statistics are then the sum over threads and can exceed the wall time.
+// -----------------------------------------------------------------------
+
+class NodeProfiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // enable or disable profiling; if traceFile is not empty, also record a timeline that WriteTrace() saves in Chrome-trace format (chrome://tracing)
+    static void Enable(bool enable, const std::wstring& traceFile = std::wstring());
+    static bool IsEnabled() { return s_enabled; }
+
+    // measures one ForwardProp() or Backprop() call of a node for the lifetime of the object
+    // Loops are not measured as a whole; instead, SEQTraversalFlowControlNode measures each of its nested nodes.
+    class Scope
+    {
+    public:
+        Scope(const ComputationNodeBasePtr& node, const FrameRange& fr, bool isBackprop)
+            : m_node(s_enabled && !dynamic_cast<FlowControlNode*>(node.get()) ? node.get() : nullptr)
+        {
+            if (m_node)
+            {
+                m_isBackprop = isBackprop;
+                m_isAllFrames = fr.IsAllFrames();
+                m_begin = Clock::now();
+            }
+        }
+        ~Scope()
+        {
+            if (m_node)
+                Record(*m_node, m_isAllFrames, m_isBackprop, m_begin, Clock::now());
+        }
+
+    private:
+        Scope(const Scope&) = delete;
+        void operator=(const Scope&) = delete;
+
+        ComputationNodeBase* m_node; // null if profiling is disabled
+        bool m_isBackprop;
+        bool m_isAllFrames;
+        Clock::time_point m_begin;
+    };
+
+    // record the memory kept for the next minibatch by a delay node in truncated BPTT, and what a copy of the whole minibatch would have taken
+    static void RecordCarriedOverState(size_t numBytesKept, size_t numBytesOfMinibatch)
+    {
+        if (s_enabled)
+        {
+            std::lock_guard<std::mutex> lock(s_mutex);
+            s_numCarriedOverStates++;
+            s_numCarriedOverBytes += numBytesKept;
+            s_numCarriedOverBytesOfMinibatches += numBytesOfMinibatch;
+        }
+    }
+
+    // statistics of one node since the last Reset()
+    struct NodeStats
+    {
+        std::wstring m_nodeName;
+        std::wstring m_operationName;
+        double m_forwardSeconds = 0;
+        double m_backwardSeconds = 0;
+        size_t m_numForwardCalls = 0;
+        size_t m_numBackwardCalls = 0;
+        double m_flops = 0;      // estimated floating-point operations
+        size_t m_maxNumBytes = 0; // largest value + gradient memory seen (note: may be shared with other nodes)
+        std::map<const void*, size_t> m_buffers; // value and gradient matrices -> largest size seen, to count shared matrices once
+        size_t m_traceNodeIndex = 0; // index into s_traceNodes
+    };
+
+    // get a copy of the statistics of a node; false if it was not executed since the last Reset()
+    static bool GetNodeStats(const ComputationNodeBase& node, NodeStats& stats);
+    // value and gradient memory of all nodes executed since the last Reset(), each matrix counted once even if several nodes share it
+    static size_t GetNumValueAndGradientBytes(size_t& numMatrices);
+
+    // print the numTopNodes nodes and operation types with the highest total time since the last Reset()
+    static void PrintReport(FILE* f, size_t numTopNodes);
+    // clear all statistics (but not the timeline), and forget the nodes, which may be deleted afterwards
+    static void Reset();
+    // save the recorded timeline, if one was requested
+    static void WriteTrace();
+
+private:
+    struct TraceEvent
+    {
+        size_t m_traceNodeIndex;
+        bool m_isBackprop;
+        double m_beginMicroseconds;
+        double m_durationMicroseconds;
+    };
+
+    static void Record(ComputationNodeBase& node, bool isAllFrames, bool isBackprop, Clock::time_point begin, Clock::time_point end);
+    static double EstimateFlops(const ComputationNodeBase& node, bool isAllFrames, bool isBackprop);
+
+    static bool s_enabled;
+    static std::mutex s_mutex; // guards the statistics and the timeline against concurrent Record() calls
+    static std::unordered_map<const ComputationNodeBase*, size_t> s_statsIndex; // node -> index into s_stats; cleared by Reset()
+    static std::vector<NodeStats> s_stats;
+    static std::wstring s_traceFile;
+    static std::vector<TraceEvent> s_trace;
+    static std::vector<std::pair<std::wstring, std::wstring>> s_traceNodes;      // names and operations of the nodes in the timeline, which outlives Reset()
+    static std::map<std::pair<std::wstring, std::wstring>, size_t> s_traceNodeIndex; // -> index into s_traceNodes
+    static Clock::time_point s_traceStart;
+    static size_t s_numCarriedOverStates;             // number of RecordCarriedOverState() calls
+    static size_t s_numCarriedOverBytes;              // total bytes kept by them
+    static size_t s_numCarriedOverBytesOfMinibatches; // total bytes of the minibatches they were taken from
+};
+
+}}}
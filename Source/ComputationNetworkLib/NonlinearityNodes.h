@@ -180,7 +180,7 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<SoftmaxNodeBase<ElemType>>(nodeP);
-            *node->m_gradientTemp = *m_gradientTemp;
+            CopyMatrixTo(m_gradientTemp, node->m_gradientTemp);
         }
     }
 
@@ -258,7 +258,7 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<SoftmaxNode<ElemType>>(nodeP);
-            *node->m_diff = *m_diff;
+            CopyMatrixTo(m_diff, node->m_diff);
         }
     }
     // request matrices that are needed for gradient computation
@@ -331,7 +331,7 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<LogSoftmaxNode<ElemType>>(nodeP);
-            *node->m_softmax = *m_softmax;
+            CopyMatrixTo(m_softmax, node->m_softmax);
         }
     }
     // request matrices that are needed for gradient computation
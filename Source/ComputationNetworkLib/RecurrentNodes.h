@@ -6,6 +6,7 @@
 
 #include "Basics.h"
 #include "ComputationNode.h"
+#include "NodeProfiler.h"
 #include "Sequences.h"
 #include "Matrix.h"
 #include "TensorShape.h"
@@ -22,6 +23,97 @@
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// -----------------------------------------------------------------------
+// DelayedFrameStore -- the frames of the previous minibatch that a delay reaches into
+// In truncated BPTT, a delay of n steps only ever reads the last n time steps of the previous
+// minibatch (or the first n, when looking into the future). Only those are kept, not a copy of the
+// whole minibatch. They are stored as one matrix with the column order of a minibatch of n time steps.
+// This is used by DelayedValueNodeBase and ShiftNode and the state objects they export and import.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class DelayedFrameStore
+{
+public:
+    DelayedFrameStore(DEVICEID_TYPE deviceId)
+        : m_frames(deviceId),
+          m_firstTimeStep(0)
+    {
+    }
+
+    // keep the last (direction < 0) or first (direction > 0) numTimeSteps time steps of 'value', which has the layout pMBLayout
+    void Capture(const Matrix<ElemType>& value, const MBLayoutPtr& pMBLayout, size_t numTimeSteps, int direction)
+    {
+        const size_t T = pMBLayout->GetNumTimeSteps();
+        const size_t S = pMBLayout->GetNumParallelSequences();
+        numTimeSteps = min(numTimeSteps, T);
+        m_firstTimeStep = direction < 0 ? T - numTimeSteps : 0;
+        m_frames.SetValue(value.ColumnSlice(m_firstTimeStep * S, numTimeSteps * S));
+        CacheMBLayout(pMBLayout);
+        NodeProfiler::RecordCarriedOverState(m_frames.GetNumElements() * sizeof(ElemType), value.GetNumElements() * sizeof(ElemType));
+    }
+
+    // set the frames from an exported state; 'frames' are the last (direction < 0) or first (direction > 0) time steps of a minibatch with the layout pMBLayout
+    void Import(const Matrix<ElemType>& frames, const MBLayoutPtr& pMBLayout, int direction)
+    {
+        const size_t T = pMBLayout->GetNumTimeSteps();
+        const size_t S = pMBLayout->GetNumParallelSequences();
+        const size_t numTimeSteps = S > 0 ? frames.GetNumCols() / S : 0;
+        if (numTimeSteps * S != frames.GetNumCols() || numTimeSteps > T)
+            LogicError("DelayedFrameStore: Imported state has %d columns, which does not match its layout of %d parallel sequences and %d time steps.",
+                       (int) frames.GetNumCols(), (int) S, (int) T);
+        m_firstTimeStep = direction < 0 ? T - numTimeSteps : 0;
+        m_frames.SetValue(frames);
+        CacheMBLayout(pMBLayout);
+    }
+
+    // get the frame(s) of time step t of the previous minibatch, for parallel sequence s or all of them (s == SIZE_MAX)
+    Matrix<ElemType> FramesFor(ptrdiff_t t, size_t s = SIZE_MAX)
+    {
+        if (t < (ptrdiff_t) m_firstTimeStep || t >= (ptrdiff_t) (m_firstTimeStep + GetNumTimeSteps()))
+            InvalidArgument("DelayedFrameStore: Time step %d of the previous minibatch was not kept; a delay cannot reach back further than one minibatch.", (int) t);
+        const size_t S = m_pMBLayout->GetNumParallelSequences();
+        const size_t firstColumn = (t - m_firstTimeStep) * S;
+        return s == SIZE_MAX ? m_frames.ColumnSlice(firstColumn, S) : m_frames.ColumnSlice(firstColumn + s, 1);
+    }
+
+    // the kept time steps of the previous minibatch are [GetFirstTimeStep(), GetFirstTimeStep() + GetNumTimeSteps())
+    size_t GetFirstTimeStep() const { return m_firstTimeStep; }
+    size_t GetNumTimeSteps() const { return m_pMBLayout && m_pMBLayout->GetNumParallelSequences() > 0 ? m_frames.GetNumCols() / m_pMBLayout->GetNumParallelSequences() : 0; }
+    Matrix<ElemType>& GetFrames() { return m_frames; }
+    const Matrix<ElemType>& GetFrames() const { return m_frames; }
+    const MBLayoutPtr& GetMBLayout() const { return m_pMBLayout; } // layout of the previous minibatch (null if there was none)
+    bool IsEmpty() const { return m_frames.IsEmpty(); }
+
+    void CopyFrom(const DelayedFrameStore& other) // note: this may copy between CPU and GPU
+    {
+        m_frames.SetValue(other.m_frames);
+        m_firstTimeStep = other.m_firstTimeStep;
+        if (other.m_pMBLayout)
+            CacheMBLayout(other.m_pMBLayout);
+        else
+            m_pMBLayout = nullptr;
+    }
+
+    void Clear()
+    {
+        m_frames.Resize(m_frames.GetNumRows(), 0); // (keeps the memory for the next Capture())
+        m_firstTimeStep = 0;
+    }
+
+private:
+    void CacheMBLayout(const MBLayoutPtr& pMBLayout)
+    {
+        if (!m_pMBLayout)
+            m_pMBLayout = make_shared<MBLayout>();
+        m_pMBLayout->CopyFrom(pMBLayout);
+    }
+
+    Matrix<ElemType> m_frames;  // [sample x (numTimeSteps * numParallelSequences)] the kept time steps
+    MBLayoutPtr m_pMBLayout;    // layout of the minibatch the frames were taken from
+    size_t m_firstTimeStep;     // time step of the first kept frame in that minibatch
+};
+
 // -----------------------------------------------------------------------
 // DelayedValueNodeState -- helper class for exporting/importing state from/to DelayedValueNodes.
 // This is used for sub-minibatching in case of truncated BPTT.
@@ -64,10 +156,7 @@ public:
     }
 
 protected:
-    Matrix<ElemType> m_cachedActivity; // 1 column per parallel sequence
-    // MBLayoutPtr         m_shiftedMBLayout;
-    // Currently, we only support saving state for m_timeStep == 1
-    // there is no need for this m_shiftedMBLayout if m_timeStep == 1
+    Matrix<ElemType> m_cachedActivity; // the frames kept by DelayedFrameStore: 1 column per parallel sequence and kept time step
     MBLayoutPtr m_delayedActivationMBLayout;
     bool m_isEmpty; // in some case
                     // (e.g., at the boundary of sentence end or begin/full utterance mode), we don't need to store state (but we do need to need know m_delayedActivationMBLayout)
@@ -84,7 +173,7 @@ protected:
 //  - full support/efficiency of non-recurrent use (in which case the range can be from negative to positive, e.g. a symmetric rolling window)
 //  - denoting which tensor dimension to loop over (this may not be completed, but I will plant a seed)
 //  - support for Yongqiangs sub-minibatching with truncated BPTT (export/import state)
-//  - more efficient storage of carried-over state (only store the needed frames, not a full copy of the previous MB as currently; which will on the other hand also allow windows that reach back beyond a minibatch)
+//  - windows that reach back beyond a minibatch (the carried-over state only keeps the frames of the previous MB that the delay reaches into)
 // -----------------------------------------------------------------------
 
 // TODO: 'direction' is really too general. signOfTimeOffset?
@@ -166,7 +255,7 @@ public:
         fstream >> rows >> colsDummy;
 
         SetDims(TensorShape(rows), HasMBLayout() /*may be true on reload (roll-back)*/); // tensor shape will be overwritten in Validate()  --TODO: We should serialize it here.
-        m_delayedValue.Resize(rows, 0);                                                  // Note: If we try to access history in first minibatch, we shall crash. It would be a consequence of a missing sentence-begin flag
+        m_delayedValue.Clear();                                                          // Note: If we try to access history in first minibatch, we shall crash. It would be a consequence of a missing sentence-begin flag
 
         if (modelVersion >= CNTK_MODEL_VERSION_2)
             fstream >> m_initialActivationValue;
@@ -247,17 +336,10 @@ public:
     virtual void EndForwardProp() override // called after last iteration step of ForwardProp()
     {
         // In truncated BPTT, we carry over left-to-right state across minibatches.
-        // It is kept in m_delayedValue, m_delayedActivationMBLayout.
-        // This could be optimized as follows:
-        //  - only keep the required number of frames (m_timeStep)
-        //  - we don't need to keep anything in full-sequence mode
-        //  - we don't need to keep anything if all sequences are closed (sentence end)
-        //    This condition includes full-sequence mode.
-        // TODO: Can we optimize this and only copy if there is a sequence spanning across the end of the MB? And add a check to BeginForwardProp() to make sure we got one if there is a boundary at the start?
-        m_delayedValue = Input(0)->Value();
-        if (!m_delayedActivationMBLayout)
-            m_delayedActivationMBLayout = make_shared<MBLayout>();
-        m_delayedActivationMBLayout->CopyFrom(m_pMBLayout);
+        // Only the m_timeStep frames that the next minibatch can reach into are kept in m_delayedValue, together with the layout.
+        // TODO: We don't need to keep anything if all sequences are closed (sentence end), which includes full-sequence mode.
+        //       But a frame of all gaps takes the no-boundary path in ForwardProp() and would then fail; so we always keep the (few) frames.
+        m_delayedValue.Capture(Input(0)->Value(), m_pMBLayout, m_timeStep, direction);
 
         Base::EndForwardProp();
     }
@@ -284,7 +366,7 @@ public:
         FrameRange frDelayed = fr.WithTimeOffset(direction * m_timeStep);
 
         size_t T = GetNumTimeSteps();
-        size_t T_delayedActivation = m_delayedActivationMBLayout ? m_delayedActivationMBLayout->GetNumTimeSteps() : 0; // (note: should never happen in full-sequence mode)
+        size_t T_delayedActivation = m_delayedValue.GetMBLayout() ? m_delayedValue.GetMBLayout()->GetNumTimeSteps() : 0; // (note: should never happen in full-sequence mode)
 
         // compute logical position of delayed value
         assert(m_timeStep > 0);
@@ -313,9 +395,9 @@ public:
                 {
                     // inside the sequence: access delayed value
                     if (t_delayed < 0)
-                        inp = DataWithMBLayoutFor(m_delayedValue, FrameRange(m_delayedActivationMBLayout, t_delayed + T_delayedActivation).Sequence(id), m_delayedActivationMBLayout); // delay reaches in previous minibatch
+                        inp = m_delayedValue.FramesFor(t_delayed + (int) T_delayedActivation, id); // delay reaches in previous minibatch
                     else if (t_delayed >= T)
-                        inp = DataWithMBLayoutFor(m_delayedValue, FrameRange(m_delayedActivationMBLayout, t_delayed - T).Sequence(id), m_delayedActivationMBLayout); // delay reaches in previous minibatch
+                        inp = m_delayedValue.FramesFor(t_delayed - (int) T, id); // delay reaches in previous minibatch
                     else
                         inp = Input(0)->ValueFor(frDelayed.Sequence(id));
                     // inp = Input(0)->ValueFor(FrameRange(m_pMBLayout, t_delayed).Sequence(id));
@@ -338,7 +420,7 @@ public:
                         inp = Input(0)->ValueFor(FrameRange(m_pMBLayout, 0));
                 }
                 else
-                    inp = DataWithMBLayoutFor(m_delayedValue, FrameRange(m_delayedActivationMBLayout, t_delayed + T_delayedActivation), m_delayedActivationMBLayout);
+                    inp = m_delayedValue.FramesFor(t_delayed + (int) T_delayedActivation);
             }
 
             else if (t_delayed >= T)
@@ -351,7 +433,7 @@ public:
                         inp = Input(0)->ValueFor(FrameRange(m_pMBLayout, T - 1));
                 }
                 else
-                    inp = DataWithMBLayoutFor(m_delayedValue, FrameRange(m_delayedActivationMBLayout, t_delayed - T), m_delayedActivationMBLayout);
+                    inp = m_delayedValue.FramesFor(t_delayed - (int) T);
             }
             else
                 inp = Input(0)->ValueFor(frDelayed);
@@ -379,62 +461,20 @@ public:
             auto node = dynamic_pointer_cast<DelayedValueNodeBase<ElemType, direction /*, SequenceStart_or_End*/>>(nodeP);
             node->m_timeStep = m_timeStep;
             node->m_initialActivationValue = m_initialActivationValue;
-            node->m_delayedValue = m_delayedValue;
-            if (m_delayedActivationMBLayout)
-                (node->m_delayedActivationMBLayout = make_shared<MBLayout>())->CopyFrom(m_delayedActivationMBLayout);
-            else
-                node->m_delayedActivationMBLayout = nullptr;
+            node->m_delayedValue.CopyFrom(m_delayedValue);
         }
     }
 
+    // The exported state holds the frames kept in m_delayedValue, i.e. the last (past) or first (future) m_timeStep time steps.
     virtual NodeStatePtr /*IStatefulNode::*/ ExportState() override
     {
-        NodeStatePtr pExportedState;
-        size_t nT = m_pMBLayout->GetNumTimeSteps();
-        size_t nU = m_pMBLayout->GetNumParallelSequences();
+        auto pState = make_shared<DelayedValueNodeState<ElemType>>(m_deviceId);
         int dir = direction;
-        if (m_timeStep != 1)
-        {
-            // not support yet; give user a hint
-            RuntimeError("Currently importing/exporting state info for timeStep>1 is not supported. Contact erw@microsoft.com for more detail");
-        }
-        if (dir == -1) // we look into past
-        {
-            if (!m_pMBLayout->HasSequenceBeyondEnd()) // only need to export state if anything crosses the MB boundary
-            {
-                auto pState = make_shared<DelayedValueNodeState<ElemType>>(m_deviceId);
-                pState->CacheDelayedMBLayout(m_delayedActivationMBLayout);
-                // return an empty one
-            }
-            else
-            {
-                auto pState = make_shared<DelayedValueNodeState<ElemType>>(m_deviceId);
-                pState->CacheState(m_delayedValue.ColumnSlice((nT - 1) * nU, nU));
-                pState->CacheDelayedMBLayout(m_delayedActivationMBLayout);
-                pExportedState = pState;
-            }
-        }
-        else if (dir == 1) // we look into future
-        {
-            if (!m_pMBLayout->HasSequenceBeyondBegin()) // only need to export state if anything crosses the MB boundary
-            {
-                auto pState = make_shared<DelayedValueNodeState<ElemType>>(m_deviceId);
-                pState->CacheDelayedMBLayout(m_delayedActivationMBLayout);
-                pExportedState = pState;
-            }
-            else
-            {
-                auto pState = make_shared<DelayedValueNodeState<ElemType>>(m_deviceId);
-                pState->CacheState(m_delayedValue.ColumnSlice((nT - 1) * nU, nU));
-                pState->CacheDelayedMBLayout(m_delayedActivationMBLayout);
-                pExportedState = pState;
-            }
-        }
-        else
-        {
-            LogicError("Unrecognized direction in DelayedValueNodeBase");
-        }
-        return pExportedState;
+        if (dir == -1 ? m_pMBLayout->HasSequenceBeyondEnd() : m_pMBLayout->HasSequenceBeyondBegin()) // only need to export state if anything crosses the MB boundary
+            pState->CacheState(m_delayedValue.GetFrames());
+        // else return an empty one (that still knows the layout)
+        pState->CacheDelayedMBLayout(m_delayedValue.GetMBLayout());
+        return pState;
     }
 
     virtual void /*IStatefulNode::*/ ImportState(const NodeStatePtr& pImportedState) override
@@ -444,31 +484,19 @@ public:
         if (!pState)
             LogicError("Expecting DelayValueNodeState after downcasting");
 
-        pState->ExportDelayedMBLayout(m_delayedActivationMBLayout); // pstate copy to m_delayedActivationMBLayout
+        auto pDelayedMBLayout = make_shared<MBLayout>();
+        pState->ExportDelayedMBLayout(pDelayedMBLayout);
         if (pState->IsEmpty())
-        {
-            return;
-        }
-
-        const Matrix<ElemType>& delayedActivation = pState->ExportCachedActivity();
-        size_t nT = m_delayedActivationMBLayout->GetNumTimeSteps();
-        size_t nU = m_delayedActivationMBLayout->GetNumParallelSequences();
-
-        int dir = direction;
-        if (dir == -1) // looking backward
-            m_delayedValue.SetColumnSlice(delayedActivation, (nT - 1) * nU, nU);
-        else if (dir == 1)
-            m_delayedValue.SetColumnSlice(delayedActivation, 0, nU);
+            m_delayedValue.Import(Matrix<ElemType>(m_deviceId), pDelayedMBLayout, direction);
         else
-            LogicError("Unrecognized direction in DelayedValueNodeBase");
+            m_delayedValue.Import(pState->ExportCachedActivity(), pDelayedMBLayout, direction);
     }
 
 protected:
-    ElemType m_initialActivationValue;       // starting value for hidden activation vector at boundary
-    Matrix<ElemType> m_delayedValue;         // saves the activation of the previous step that this node points to
-    MBLayoutPtr m_delayedActivationMBLayout; // layout for m_delayedValue
-    int m_timeStep;                          // delay in frames (typ. 1)
-    function<void()> m_attachInputsFn;       // for late expansion of inputs (scripting)
+    ElemType m_initialActivationValue;          // starting value for hidden activation vector at boundary
+    DelayedFrameStore<ElemType> m_delayedValue; // saves the frames of the previous minibatch that this node points to, and their layout
+    int m_timeStep;                             // delay in frames (typ. 1)
+    function<void()> m_attachInputsFn;          // for late expansion of inputs (scripting)
 };
 
 #define UsingDelayedValueNodeMembers        \
@@ -578,7 +606,6 @@ template class FutureValueNode<double>;
 // TODO (this is still unfinished):
 //  - backprop into boundary node
 //  - backprop with packed sequences
-//  - import/export for sub-minibatching
 // -----------------------------------------------------------------------
 
 template <class ElemType>
@@ -656,10 +683,19 @@ public:
         Base::EndForwardProp();
 
         // In truncated BPTT, we carry over left-to-right state across minibatches.
-        // The necessary frames are stored in m_state->m_delayedValue.
-
-        if (GetMBLayout()->HasSequenceBeyondEnd()) // only if layout has any sequence that has ends beyond this minibatch
+        // The necessary frames (abs(m_fromOffset) time steps) are stored in m_state.m_delayedValue.
+        size_t rank = DetermineElementwiseTensorRank();
+        bool isTimeIteration = m_shiftDim >= rank;
+        if (isTimeIteration && (m_fromOffset < 0 ? GetMBLayout()->HasSequenceBeyondEnd() : GetMBLayout()->HasSequenceBeyondBegin())) // only if layout has any sequence that crosses the boundary of this minibatch
         {
+            size_t numSteps = (size_t) abs(m_fromOffset);
+            if (GetNumTimeSteps() < numSteps)
+                InvalidArgument("%ls %ls operation: For truncated BPTT, minibatches must have at least as many time steps as the shift (%d).", NodeName().c_str(), OperationName().c_str(), (int) numSteps);
+            m_state.m_delayedValue.Capture(Input(0)->Value(), GetMBLayout(), numSteps, m_fromOffset);
+            auto dims = Input(0)->GetTensorShape(rank).GetDims();
+            dims[m_shiftDim] = numSteps;
+            m_state.m_shape = TensorShape(std::move(dims));
+            m_state.m_delayedSequences = GetMBLayout()->GetAllSequences();
         }
         else
             m_state.clear();
@@ -725,11 +761,11 @@ private:
                 // now inSliceOutside represents only the region that falls outside
 
                 // map to dimensions of our saved state
-                SliceBounds inSliceState = ShiftDim(inSliceOutside, m_state.m_shape[m_shiftDim]);
+                inSliceState = ShiftDim(inSliceOutside, (int) m_state.m_shape[m_shiftDim]);
                 // E.g. for offset = -4, m_state will be 4 elements, so [-2,0) -> [2,4), and [-2,-1) -> [2,3)
 
                 // map to target dimensions
-                SliceBounds outSliceState = ShiftDim(inSliceOutside, -m_fromOffset);
+                outSliceState = ShiftDim(inSliceOutside, -m_fromOffset);
                 assert(inSliceState == outSliceState); // (when we fall out on the left, both must be the same)
             }
             // else: no truncated BPTT means we must have a proper boundary. So don't write those values here, they will be initialized with boundary values below.
@@ -750,12 +786,12 @@ private:
                 // now inSliceOutside is where we should copy from, with indices completely out of bounds
 
                 // map to dimensions of our saved state
-                SliceBounds inSliceState = ShiftDim(inSliceOutside, -T);
+                inSliceState = ShiftDim(inSliceOutside, -T);
                 // E.g. for offset = 4, m_state will be 4 elements, so [100,102) -> [0,2), and [101,102) -> [1,2)
 
                 // map to target dimensions
-                SliceBounds outSliceState = ShiftDim(inSliceOutside, T - m_fromOffset);
-                // E.g. [0,2) -> [96,98), and [1,2) -> [97,98)
+                outSliceState = ShiftDim(inSliceOutside, -m_fromOffset);
+                // E.g. [100,102) -> [96,98), and [101,102) -> [97,98)
             }
             // and trim main (if 'from' is entirely outside, such as in the common single-frame case, we get begin >= end)
             outSliceMain.first[m_shiftDim] -= (inSliceMain.second[m_shiftDim] - T);
@@ -969,7 +1005,7 @@ public:
             {
                 // Note: If all sequences begin at the start of the range, this would copy invalid values which would be overwrittten below.
                 // This is prevented in that m_state will be set to empty in the previous MB if all sequences ended, which will in turn return an empty slice.
-                auto from = DataTensorFor(m_state.m_delayedValue, m_state.m_shape, inSliceState);
+                auto from = DataTensorFor(m_state.m_delayedValue.GetFrames(), m_state.m_shape, inSliceState);
                 auto to = DataTensorFor(Value(), outShape, outSliceState);
                 to.AssignCopyOf(from);
             }
@@ -1112,14 +1148,14 @@ public:
             node->m_boundaryMode = m_boundaryMode;
             node->m_shiftDimParam = m_shiftDimParam;
             node->m_shiftDim = m_shiftDim;
-            node->m_state = m_state;
+            node->m_state.CopyFrom(m_state);
         }
     }
 
     class ShiftNodeState : public INodeState
     {
     public:
-        Matrix<ElemType> m_delayedValue;                   // saves the activation of the previous step that this node points to
+        DelayedFrameStore<ElemType> m_delayedValue;        // saves the frames of the previous minibatch that this node points to
         TensorShape m_shape;                               // tensor shape that describes m_delayedValue
         vector<MBLayout::SequenceInfo> m_delayedSequences; // and associated sequence info. This is only used for consistency checking (it must match).
         ShiftNodeState(DEVICEID_TYPE deviceId)
@@ -1132,10 +1168,16 @@ public:
         }
         void clear()
         {
-            m_delayedValue.Resize(0, 0);
+            m_delayedValue.Clear();
             m_shape = TensorShape();
             m_delayedSequences.clear();
         }
+        void CopyFrom(const ShiftNodeState& other) // note: this may copy between CPU and GPU
+        {
+            m_delayedValue.CopyFrom(other.m_delayedValue);
+            m_shape = other.m_shape;
+            m_delayedSequences = other.m_delayedSequences;
+        }
     };
     typedef std::shared_ptr<ShiftNodeState> ShiftNodeStatePtr;
 
@@ -1147,10 +1189,8 @@ public:
     virtual NodeStatePtr ExportState() // TODO: can we instead pass the shared_ptr object in? So we don't need to create a new one all the time? Or should we still take ownership of the ptr?
     {
         auto state = make_shared<ShiftNodeState>(CPUDEVICE);
-        state->m_delayedValue.SetValue(m_state.m_delayedValue); // note: this will transfer from GPU to CPU
-        m_state.m_delayedValue.Resize(0, 0);
-        state->m_shape = std::move(m_state.m_shape);
-        state->m_delayedSequences = std::move(m_state.m_delayedSequences);
+        state->CopyFrom(m_state); // note: this will transfer from GPU to CPU
+        m_state.clear();
         return state;
     }
     virtual void ImportState(const NodeStatePtr& statep) override
@@ -1158,10 +1198,8 @@ public:
         ShiftNodeStatePtr state = dynamic_pointer_cast<ShiftNodeState>(statep);
         if (!state)
             LogicError("ImportState: Wrong state object passed (wrong type).");
-        m_state.m_delayedValue.SetValue(state->m_delayedValue); // note: this will transfer from CPU to GPU
-        state->m_delayedValue.Resize(0, 0);
-        m_state.m_shape = std::move(state->m_shape);
-        m_state.m_delayedSequences = std::move(state->m_delayedSequences);
+        m_state.CopyFrom(*state); // note: this will transfer from CPU to GPU
+        state->clear();
     }
 
 protected:
@@ -1180,4 +1218,580 @@ protected:
 
 #endif
 
+// -----------------------------------------------------------------------
+// RecurrentCellNodeBase (input, W, R, b, ...) -- common base of the fused LSTMNode and GRUNode
+// These nodes run an entire recurrence over the minibatch in one node, instead of building it
+// from PastValue, Times, Plus and nonlinearity nodes that are stepped frame by frame:
+//  - the input projection W * x of all frames is computed with one GEMM upfront
+//  - each step does a single GEMM R * hPrev for all gates of all parallel sequences
+//  - the gate nonlinearities and the state update are one fused pass over the step (Matrix::LSTMCellForward() etc.)
+// The gates are stacked in W and R row-wise; the bias b has one column per gate.
+// Sequence starts, gaps, and state carried over from the previous minibatch (truncated BPTT) are handled here.
+// -----------------------------------------------------------------------
+
+template <class ElemType, size_t numGates>
+class RecurrentCellNodeBase : public ComputationNodeNonLooping<ElemType>
+{
+    typedef ComputationNodeNonLooping<ElemType> Base;
+    UsingComputationNodeMembers;
+
+public:
+    RecurrentCellNodeBase(DEVICEID_TYPE deviceId, const wstring& name, ElemType initialActivationValue = (ElemType) DEFAULT_HIDDEN_ACTIVATION)
+        : Base(deviceId, name),
+          m_initialActivationValue(initialActivationValue),
+          m_carryH(deviceId),
+          m_continueMask(deviceId),
+          m_biasGradient(deviceId),
+          m_gradientsComputed(false)
+    {
+    }
+
+    virtual void CopyTo(ComputationNodeBasePtr nodeP, const std::wstring& newName, const CopyNodeFlags flags) const override
+    {
+        Base::CopyTo(nodeP, newName, flags);
+        if (flags & CopyNodeFlags::copyNodeValue)
+        {
+            auto node = dynamic_pointer_cast<RecurrentCellNodeBase<ElemType, numGates>>(nodeP);
+            node->m_initialActivationValue = m_initialActivationValue;
+        }
+    }
+
+    virtual void Save(File& fstream) const override
+    {
+        Base::Save(fstream);
+        fstream << m_initialActivationValue;
+    }
+
+    virtual void Load(File& fstream, size_t modelVersion) override
+    {
+        Base::Load(fstream, modelVersion);
+        fstream >> m_initialActivationValue;
+    }
+
+    virtual void PrintSelfBeforeValidation() const override
+    {
+        Base::PrintSelfBeforeValidation();
+        fprintf(stderr, ", defaultHiddenActivation=%f", (double) m_initialActivationValue);
+    }
+
+    // inputs: 0 = x [D], 1 = W [numGates*H x D], 2 = R [numGates*H x H], 3 = b [H x numGates]
+    virtual void /*ComputationNodeBase::*/ Validate(bool isFinalValidationPass) override
+    {
+        Base::Validate(isFinalValidationPass);
+        InferMBLayoutFromInputsForStandardCase();
+        if (isFinalValidationPass && !HasMBLayout())
+            InvalidArgument("%ls: The input of a recurrent cell must be minibatch data.", NodeName().c_str());
+
+        // the hidden dimension is defined by the recurrent weights; W and b can be inferred from it
+        const size_t H = Input(2)->GetAsMatrixNumCols();
+        const size_t D = Input(0)->GetSampleMatrixNumRows();
+        Input(1)->ValidateInferInputDimsFrom(TensorShape(numGates * H, D));
+        Input(3)->ValidateInferInputDimsFrom(TensorShape(H, numGates));
+
+        if (isFinalValidationPass)
+        {
+            if (Input(1)->GetAsMatrixNumRows() != numGates * H || Input(1)->GetAsMatrixNumCols() != D)
+                InvalidArgument("%ls: The input weights must be [%d x %d] but are [%d x %d].", NodeName().c_str(),
+                                (int) (numGates * H), (int) D, (int) Input(1)->GetAsMatrixNumRows(), (int) Input(1)->GetAsMatrixNumCols());
+            if (Input(2)->GetAsMatrixNumRows() != numGates * H)
+                InvalidArgument("%ls: The recurrent weights must have %d rows (%d gates of dimension %d).", NodeName().c_str(),
+                                (int) (numGates * H), (int) numGates, (int) H);
+            if (Input(3)->GetAsMatrixNumRows() != H || Input(3)->GetAsMatrixNumCols() != numGates)
+                InvalidArgument("%ls: The bias must be [%d x %d] (one column per gate).", NodeName().c_str(), (int) H, (int) numGates);
+        }
+
+        SetDims(TensorShape(H), true);
+    }
+
+    virtual bool OutputUsedInComputingInputNodesGradients() const override
+    {
+        // the backward pass works off the saved gates and previous states
+        return false;
+    }
+
+    virtual void /*IComputationNode::*/ BeginBackprop() override
+    {
+        Base::BeginBackprop();
+        m_gradientsComputed = false;
+    }
+
+    virtual void BackpropToNonLooping(size_t inputIndex) override
+    {
+        // the recurrence is back-propagated once, when the first input asks for its gradient
+        if (!m_gradientsComputed)
+        {
+            BackpropThroughTime();
+            m_gradientsComputed = true;
+        }
+
+        FrameRange fr(Input(0)->GetMBLayout());
+        if (inputIndex == 0) // dx += W' * dGates
+        {
+            auto inputGradient = Input(0)->GradientFor(fr);
+            Matrix<ElemType>::MultiplyAndWeightedAdd(1, Input(1)->Value(), true, *m_dGates, false, 1, inputGradient);
+        }
+        else if (inputIndex == 1) // dW += dGates * x'
+            Matrix<ElemType>::MultiplyAndWeightedAdd(1, *m_dGates, false, Input(0)->ValueFor(fr), true, 1, Input(1)->Gradient());
+        else if (inputIndex == 2) // dR += dRecurrentProjection * hPrev'
+            Matrix<ElemType>::MultiplyAndWeightedAdd(1, RecurrentProjectionGradient(), false, *m_hPrev, true, 1, Input(2)->Gradient());
+        else if (inputIndex == 3) // db += rowsum(dGates), seen as a [H x numGates] matrix
+        {
+            Matrix<ElemType>::VectorSum(*m_dGates, m_biasGradient, false);
+            auto biasGradient = Input(3)->Gradient().Reshaped(m_biasGradient.GetNumRows(), 1);
+            Matrix<ElemType>::ScaleAndAdd(1, m_biasGradient, biasGradient);
+        }
+        else
+            BackpropToAdditionalInput(inputIndex);
+    }
+
+    virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeForwardProp(matrixPool);
+        RequestMatrixFromPool(m_gates, matrixPool, numGates * GetSampleMatrixNumRows());
+        RequestMatrixFromPool(m_hPrev, matrixPool);
+    }
+
+    virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeBackprop(matrixPool);
+        RequestMatrixFromPool(m_dGates, matrixPool, numGates * GetSampleMatrixNumRows());
+        RequestMatrixFromPool(m_dH, matrixPool);
+        RequestMatrixFromPool(m_dRecurrent, matrixPool);
+    }
+
+    virtual void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool) override
+    {
+        Base::ReleaseMatricesAfterBackprop(matrixPool);
+        ReleaseMatrixToPool(m_gates, matrixPool);
+        ReleaseMatrixToPool(m_hPrev, matrixPool);
+        ReleaseMatrixToPool(m_dGates, matrixPool);
+        ReleaseMatrixToPool(m_dH, matrixPool);
+        ReleaseMatrixToPool(m_dRecurrent, matrixPool);
+    }
+
+protected:
+    // per-frame classification of the previous state, determined once per minibatch from the MBLayout
+    enum ColumnKind : char
+    {
+        gapColumn,      // no data; the previous state is set to the initial value just to keep it finite
+        startColumn,    // first frame of a sequence: previous state is the initial value
+        continueColumn, // previous state is the output of the previous frame of the same parallel sequence
+        carryColumn     // sequence started in an earlier minibatch: previous state was carried over
+    };
+
+    virtual void BackpropThroughTime() = 0;
+    virtual const Matrix<ElemType>& RecurrentProjectionGradient() const = 0;
+    virtual void BackpropToAdditionalInput(size_t inputIndex)
+    {
+        LogicError("%ls: Invalid input index %d.", NodeName().c_str(), (int) inputIndex);
+    }
+
+    // classify all frames of the minibatch, and compute the input projection of all frames with a single GEMM
+    // Must be called first by ForwardPropNonLooping().
+    void BeginRecurrence()
+    {
+        const size_t T = GetNumTimeSteps();
+        const size_t S = GetNumParallelSequences();
+
+        m_columnKinds.assign(T * S, gapColumn);
+        m_canCarryOver.assign(S, false);
+        for (const auto& seq : m_pMBLayout->GetAllSequences())
+        {
+            if (seq.seqId == GAP_SEQUENCE_ID)
+                continue;
+            size_t tBegin = seq.tBegin < 0 ? 0 : (size_t) seq.tBegin;
+            size_t tEnd = min(seq.tEnd, T);
+            for (size_t t = tBegin; t < tEnd; t++)
+                m_columnKinds[t * S + seq.s] = (ptrdiff_t) t == seq.tBegin ? startColumn : t == 0 ? carryColumn : continueColumn;
+            if (seq.tEnd > T)
+                m_canCarryOver[seq.s] = true; // continues in the next minibatch
+        }
+
+        // steps where all sequences just continue can copy the previous state in one block
+        m_stepIsContinuous.assign(T, true);
+        vector<ElemType> continueMask(T * S);
+        for (size_t j = 0; j < T * S; j++)
+        {
+            continueMask[j] = m_columnKinds[j] == continueColumn ? (ElemType) 1 : (ElemType) 0;
+            if (m_columnKinds[j] != continueColumn)
+                m_stepIsContinuous[j / S] = false;
+        }
+        m_continueMask.SetValue(1, T * S, m_continueMask.GetDeviceId(), continueMask.data());
+
+        // input projection of all frames at once: gates = W * x + b
+        FrameRange fr(Input(0)->GetMBLayout());
+        Matrix<ElemType>::Multiply(Input(1)->Value(), false, Input(0)->MaskedValueFor(fr), false, *m_gates);
+        Matrix<ElemType>::ScaleAndAdd(1, Input(3)->Value().Reshaped(numGates * Input(3)->GetAsMatrixNumRows(), 1), *m_gates);
+
+        m_hPrev->Resize(GetSampleMatrixNumRows(), T * S);
+        m_gradientsComputed = false;
+    }
+
+    // fill the previous state for step t into prevStates(:, t*S .. t*S+S-1), from states(:, (t-1)*S ..), the initial value, or carried-over state
+    Matrix<ElemType> GetPreviousState(Matrix<ElemType>& prevStates, const Matrix<ElemType>& states, const Matrix<ElemType>& carriedState, size_t t)
+    {
+        const size_t S = GetNumParallelSequences();
+        Matrix<ElemType> prev = prevStates.ColumnSlice(t * S, S);
+        if (t > 0)
+            prev.SetValue(states.ColumnSlice((t - 1) * S, S));
+        if (m_stepIsContinuous[t])
+            return prev;
+
+        if (t == 0)
+            prev.SetValue(m_initialActivationValue);
+        for (size_t s = 0; s < S; s++)
+        {
+            ColumnKind kind = (ColumnKind) m_columnKinds[t * S + s];
+            if (kind == carryColumn)
+            {
+                if (s >= m_carriedOver.size() || !m_carriedOver[s])
+                    InvalidArgument("%ls: Parallel sequence %d continues a sequence from the previous minibatch, but no state was carried over for it.", NodeName().c_str(), (int) s);
+                prev.ColumnSlice(s, 1).SetValue(carriedState.ColumnSlice(s, 1));
+            }
+            else if (kind != continueColumn && t > 0)
+                prev.ColumnSlice(s, 1).SetValue(m_initialActivationValue);
+        }
+        return prev;
+    }
+
+    // keep the final state of sequences that continue into the next minibatch
+    void SaveCarriedState(const Matrix<ElemType>& states, Matrix<ElemType>& carriedState)
+    {
+        const size_t T = GetNumTimeSteps();
+        const size_t S = GetNumParallelSequences();
+        if (std::find(m_canCarryOver.begin(), m_canCarryOver.end(), true) != m_canCarryOver.end())
+            carriedState.SetValue(states.ColumnSlice((T - 1) * S, S));
+    }
+
+    void EndRecurrence()
+    {
+        m_carriedOver = m_canCarryOver;
+    }
+
+    // get the output gradient (with gaps zeroed), into which the recurrent gradients are accumulated
+    void BeginBackpropThroughTime()
+    {
+        FrameRange fr(Input(0)->GetMBLayout());
+        m_dH->SetValue(MaskedGradientFor(fr));
+        m_dGates->Resize(m_gates->GetNumRows(), m_gates->GetNumCols());
+    }
+
+    // dh(:, t-1) += dhPrev for all frames at step t whose previous state came from step t-1
+    // If 'direct', dhPrev = R' * dRecurrentProjection(:, step t) is computed directly into dh; otherwise m_dRecurrent holds dhPrev.
+    void BackpropToPreviousStep(size_t t, bool direct)
+    {
+        const size_t S = GetNumParallelSequences();
+        if (t == 0) // the gradient does not flow back into the previous minibatch (truncated BPTT)
+            return;
+        auto dhPrev = m_dH->ColumnSlice((t - 1) * S, S);
+        if (direct && m_stepIsContinuous[t])
+        {
+            Matrix<ElemType>::MultiplyAndWeightedAdd(1, Input(2)->Value(), true, RecurrentProjectionGradient().ColumnSlice(t * S, S), false, 1, dhPrev);
+            return;
+        }
+        if (direct)
+            Matrix<ElemType>::Multiply(Input(2)->Value(), true, RecurrentProjectionGradient().ColumnSlice(t * S, S), false, *m_dRecurrent);
+        if (!m_stepIsContinuous[t])
+            m_dRecurrent->RowElementMultiplyWith(m_continueMask.ColumnSlice(t * S, S));
+        Matrix<ElemType>::ScaleAndAdd(1, *m_dRecurrent, dhPrev);
+    }
+
+    // gap frames must not contribute to the parameter gradients
+    void EndBackpropThroughTime()
+    {
+        FrameRange fr(Input(0)->GetMBLayout());
+        MaskMissingColumnsToZero(*m_dGates, m_pMBLayout, fr);
+    }
+
+protected:
+    ElemType m_initialActivationValue; // previous state at sequence start
+
+    shared_ptr<Matrix<ElemType>> m_gates;      // [numGates*H x T*S] gate pre-activations; gate activations after the forward pass
+    shared_ptr<Matrix<ElemType>> m_hPrev;      // [H x T*S] previous output used at each frame
+    shared_ptr<Matrix<ElemType>> m_dGates;     // [numGates*H x T*S] gradient of the gate pre-activations
+    shared_ptr<Matrix<ElemType>> m_dH;         // [H x T*S] gradient of the output, including the recurrent part
+    shared_ptr<Matrix<ElemType>> m_dRecurrent; // [H x S] gradient of hPrev of one step
+
+    Matrix<ElemType> m_carryH;       // [H x S] output of the last step of the previous minibatch
+    Matrix<ElemType> m_continueMask; // [1 x T*S] 1 for frames of kind continueColumn
+    Matrix<ElemType> m_biasGradient; // [numGates*H x 1]
+
+    vector<char> m_columnKinds;      // [T*S] ColumnKind of each frame
+    vector<bool> m_stepIsContinuous; // [T] all frames of the step are continueColumn
+    vector<bool> m_canCarryOver;     // [S] last frame of this minibatch continues in the next one
+    vector<bool> m_carriedOver;      // [S] state of the previous minibatch is valid for this parallel sequence
+    bool m_gradientsComputed;
+};
+
+#define UsingRecurrentCellNodeBaseMembers      \
+    UsingComputationNodeMembersBoilerplate;    \
+    using Base::m_initialActivationValue;      \
+    using Base::m_gates;                       \
+    using Base::m_hPrev;                       \
+    using Base::m_dGates;                      \
+    using Base::m_dH;                          \
+    using Base::m_dRecurrent;                  \
+    using Base::m_carryH;                      \
+    using Base::m_continueMask;                \
+    using Base::m_stepIsContinuous;            \
+    using Base::BeginRecurrence;               \
+    using Base::GetPreviousState;              \
+    using Base::SaveCarriedState;              \
+    using Base::EndRecurrence;                 \
+    using Base::BeginBackpropThroughTime;      \
+    using Base::BackpropToPreviousStep;        \
+    using Base::EndBackpropThroughTime
+
+// -----------------------------------------------------------------------
+// LSTMNode (input, W, R, b, peepholes) -- fused LSTM with peephole connections
+// Computes the same function as SimpleNetworkBuilder::BuildLSTMComponent():
+//   i = sigmoid(Wi x + Ri hPrev + bi + pi .* cPrev)
+//   f = sigmoid(Wf x + Rf hPrev + bf + pf .* cPrev)
+//   c = f .* cPrev + i .* tanh(Wc x + Rc hPrev + bc)
+//   o = sigmoid(Wo x + Ro hPrev + bo + po .* c)
+//   h = o .* tanh(c)
+// W and R stack the gates (i, f, c, o) row-wise; b is [H x 4], peepholes is [H x 3] (pi, pf, po).
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class LSTMNode : public RecurrentCellNodeBase<ElemType, 4>, public NumInputs<5>
+{
+    typedef RecurrentCellNodeBase<ElemType, 4> Base;
+    UsingRecurrentCellNodeBaseMembers;
+    static const std::wstring TypeName()
+    {
+        return L"LSTM";
+    }
+
+public:
+    LSTMNode(DEVICEID_TYPE deviceId, const wstring& name, ElemType initialActivationValue = (ElemType) DEFAULT_HIDDEN_ACTIVATION)
+        : Base(deviceId, name, initialActivationValue),
+          m_carryC(deviceId),
+          m_peepholeGradient(deviceId)
+    {
+    }
+    LSTMNode(const ScriptableObjects::IConfigRecordPtr configp)
+        : LSTMNode(configp->Get(L"deviceId"), L"<placeholder>", configp->Get(L"defaultHiddenActivation"))
+    {
+        AttachInputs(configp, this->GetExpectedNumInputs());
+    }
+
+    virtual void /*ComputationNodeBase::*/ Validate(bool isFinalValidationPass) override
+    {
+        Base::Validate(isFinalValidationPass);
+
+        const size_t H = GetSampleMatrixNumRows();
+        Input(4)->ValidateInferInputDimsFrom(TensorShape(H, 3));
+        if (isFinalValidationPass && (Input(4)->GetAsMatrixNumRows() != H || Input(4)->GetAsMatrixNumCols() != 3))
+            InvalidArgument("%ls %ls operation: The peephole weights must be [%d x 3].", NodeName().c_str(), OperationName().c_str(), (int) H);
+    }
+
+    virtual void /*ComputationNodeNonLooping::*/ ForwardPropNonLooping() override
+    {
+        const size_t H = GetSampleMatrixNumRows();
+        const size_t T = GetNumTimeSteps();
+        const size_t S = GetNumParallelSequences();
+
+        BeginRecurrence();
+        m_c->Resize(H, T * S);
+        m_cPrev->Resize(H, T * S);
+        for (size_t t = 0; t < T; t++)
+        {
+            auto hPrev = GetPreviousState(*m_hPrev, Value(), m_carryH, t);
+            auto cPrev = GetPreviousState(*m_cPrev, *m_c, m_carryC, t);
+            auto gates = m_gates->ColumnSlice(t * S, S);
+            auto c = m_c->ColumnSlice(t * S, S);
+            auto h = Value().ColumnSlice(t * S, S);
+
+            // one GEMM for all four gates
+            Matrix<ElemType>::MultiplyAndWeightedAdd(1, Input(2)->Value(), false, hPrev, false, 1, gates);
+            Matrix<ElemType>::LSTMCellForward(gates, Input(4)->Value(), cPrev, c, h);
+        }
+        SaveCarriedState(Value(), m_carryH);
+        SaveCarriedState(*m_c, m_carryC);
+        EndRecurrence();
+    }
+
+    virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeForwardProp(matrixPool);
+        RequestMatrixFromPool(m_c, matrixPool);
+        RequestMatrixFromPool(m_cPrev, matrixPool);
+    }
+
+    virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeBackprop(matrixPool);
+        RequestMatrixFromPool(m_dC, matrixPool);
+    }
+
+    virtual void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool) override
+    {
+        Base::ReleaseMatricesAfterBackprop(matrixPool);
+        ReleaseMatrixToPool(m_c, matrixPool);
+        ReleaseMatrixToPool(m_cPrev, matrixPool);
+        ReleaseMatrixToPool(m_dC, matrixPool);
+    }
+
+protected:
+    virtual void BackpropThroughTime() override
+    {
+        const size_t H = GetSampleMatrixNumRows();
+        const size_t T = GetNumTimeSteps();
+        const size_t S = GetNumParallelSequences();
+
+        BeginBackpropThroughTime();
+        m_dC->Resize(H, S);
+        m_dC->SetValue(0);
+        m_peepholeGradient.Resize(H, 3);
+        m_peepholeGradient.SetValue(0);
+        for (size_t t = T; t-- > 0;)
+        {
+            auto dh = m_dH->ColumnSlice(t * S, S);
+            auto dGates = m_dGates->ColumnSlice(t * S, S);
+            // m_dC holds the cell gradient from step t+1 and is updated in place to the gradient of cPrev
+            Matrix<ElemType>::LSTMCellBackward(m_gates->ColumnSlice(t * S, S), Input(4)->Value(), m_cPrev->ColumnSlice(t * S, S), m_c->ColumnSlice(t * S, S),
+                                               dh, *m_dC, dGates, m_peepholeGradient);
+            if (!m_stepIsContinuous[t])
+                m_dC->RowElementMultiplyWith(m_continueMask.ColumnSlice(t * S, S));
+            BackpropToPreviousStep(t, true);
+        }
+        EndBackpropThroughTime();
+    }
+
+    virtual const Matrix<ElemType>& RecurrentProjectionGradient() const override
+    {
+        return *m_dGates;
+    }
+
+    virtual void BackpropToAdditionalInput(size_t inputIndex) override
+    {
+        if (inputIndex != 4)
+            LogicError("%ls %ls operation: Invalid input index %d.", NodeName().c_str(), OperationName().c_str(), (int) inputIndex);
+        Matrix<ElemType>::ScaleAndAdd(1, m_peepholeGradient, Input(4)->Gradient());
+    }
+
+private:
+    shared_ptr<Matrix<ElemType>> m_c;     // [H x T*S] cell state
+    shared_ptr<Matrix<ElemType>> m_cPrev; // [H x T*S] previous cell state used at each frame
+    shared_ptr<Matrix<ElemType>> m_dC;    // [H x S] cell gradient of one step
+    Matrix<ElemType> m_carryC;            // [H x S] cell state of the last step of the previous minibatch
+    Matrix<ElemType> m_peepholeGradient;  // [H x 3]
+};
+
+template class LSTMNode<float>;
+template class LSTMNode<double>;
+
+// -----------------------------------------------------------------------
+// GRUNode (input, W, R, b) -- fused gated recurrent unit
+//   z = sigmoid(Wz x + Rz hPrev + bz)
+//   r = sigmoid(Wr x + Rr hPrev + br)
+//   n = tanh(Wn x + bn + r .* (Rn hPrev))
+//   h = (1 - z) .* n + z .* hPrev
+// The reset gate is applied after the recurrent projection, so that all gates of a step share one GEMM.
+// W and R stack the gates (z, r, n) row-wise; b is [H x 3].
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class GRUNode : public RecurrentCellNodeBase<ElemType, 3>, public NumInputs<4>
+{
+    typedef RecurrentCellNodeBase<ElemType, 3> Base;
+    UsingRecurrentCellNodeBaseMembers;
+    static const std::wstring TypeName()
+    {
+        return L"GRU";
+    }
+
+public:
+    GRUNode(DEVICEID_TYPE deviceId, const wstring& name, ElemType initialActivationValue = (ElemType) DEFAULT_HIDDEN_ACTIVATION)
+        : Base(deviceId, name, initialActivationValue)
+    {
+    }
+    GRUNode(const ScriptableObjects::IConfigRecordPtr configp)
+        : GRUNode(configp->Get(L"deviceId"), L"<placeholder>", configp->Get(L"defaultHiddenActivation"))
+    {
+        AttachInputs(configp, this->GetExpectedNumInputs());
+    }
+
+    virtual void /*ComputationNodeNonLooping::*/ ForwardPropNonLooping() override
+    {
+        const size_t T = GetNumTimeSteps();
+        const size_t S = GetNumParallelSequences();
+
+        BeginRecurrence();
+        m_hiddenProj->Resize(m_gates->GetNumRows(), T * S);
+        for (size_t t = 0; t < T; t++)
+        {
+            auto hPrev = GetPreviousState(*m_hPrev, Value(), m_carryH, t);
+            auto gates = m_gates->ColumnSlice(t * S, S);
+            auto hiddenProj = m_hiddenProj->ColumnSlice(t * S, S);
+            auto h = Value().ColumnSlice(t * S, S);
+
+            // one GEMM for all three gates
+            Matrix<ElemType>::Multiply(Input(2)->Value(), false, hPrev, false, hiddenProj);
+            Matrix<ElemType>::GRUCellForward(gates, hiddenProj, hPrev, h);
+        }
+        SaveCarriedState(Value(), m_carryH);
+        EndRecurrence();
+    }
+
+    virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeForwardProp(matrixPool);
+        RequestMatrixFromPool(m_hiddenProj, matrixPool, 3 * GetSampleMatrixNumRows());
+    }
+
+    virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeBackprop(matrixPool);
+        RequestMatrixFromPool(m_dHiddenProj, matrixPool, 3 * GetSampleMatrixNumRows());
+    }
+
+    virtual void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool) override
+    {
+        Base::ReleaseMatricesAfterBackprop(matrixPool);
+        ReleaseMatrixToPool(m_hiddenProj, matrixPool);
+        ReleaseMatrixToPool(m_dHiddenProj, matrixPool);
+    }
+
+protected:
+    virtual void BackpropThroughTime() override
+    {
+        const size_t H = GetSampleMatrixNumRows();
+        const size_t T = GetNumTimeSteps();
+        const size_t S = GetNumParallelSequences();
+
+        BeginBackpropThroughTime();
+        m_dHiddenProj->Resize(m_hiddenProj->GetNumRows(), T * S);
+        m_dRecurrent->Resize(H, S);
+        for (size_t t = T; t-- > 0;)
+        {
+            auto dGates = m_dGates->ColumnSlice(t * S, S);
+            auto dHiddenProj = m_dHiddenProj->ColumnSlice(t * S, S);
+            // dhPrev = dh .* z + R' * dHiddenProj
+            Matrix<ElemType>::GRUCellBackward(m_gates->ColumnSlice(t * S, S), m_hiddenProj->ColumnSlice(t * S, S), m_hPrev->ColumnSlice(t * S, S),
+                                              m_dH->ColumnSlice(t * S, S), dGates, dHiddenProj, *m_dRecurrent);
+            if (t > 0)
+            {
+                Matrix<ElemType>::MultiplyAndWeightedAdd(1, Input(2)->Value(), true, dHiddenProj, false, 1, *m_dRecurrent);
+                BackpropToPreviousStep(t, false);
+            }
+        }
+        EndBackpropThroughTime();
+        MaskMissingColumnsToZero(*m_dHiddenProj, m_pMBLayout, FrameRange(m_pMBLayout));
+    }
+
+    virtual const Matrix<ElemType>& RecurrentProjectionGradient() const override
+    {
+        return *m_dHiddenProj;
+    }
+
+private:
+    shared_ptr<Matrix<ElemType>> m_hiddenProj;  // [3H x T*S] recurrent projection R * hPrev
+    shared_ptr<Matrix<ElemType>> m_dHiddenProj; // [3H x T*S] its gradient
+};
+
+template class GRUNode<float>;
+template class GRUNode<double>;
+
 } } }
@@ -356,11 +356,11 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<GMMLogLikelihoodNode<ElemType>>(nodeP);
-            *node->m_prior = *m_prior;
-            *node->m_normedDeviation = *m_normedDeviation;
-            *node->m_normedDeviationVectors = *m_normedDeviationVectors;
-            *node->m_stddev = *m_stddev;
-            *node->m_posterior = *m_posterior;
+            CopyMatrixTo(m_prior, node->m_prior);
+            CopyMatrixTo(m_normedDeviation, node->m_normedDeviation);
+            CopyMatrixTo(m_normedDeviationVectors, node->m_normedDeviationVectors);
+            CopyMatrixTo(m_stddev, node->m_stddev);
+            CopyMatrixTo(m_posterior, node->m_posterior);
         }
     }
 
@@ -564,9 +564,9 @@ public:
         {
             auto node = dynamic_pointer_cast<SequenceWithSoftmaxNode<ElemType>>(nodeP);
 
-            *node->m_logSoftmaxOfRight = *m_logSoftmaxOfRight;
-            *node->m_softmaxOfRight = *m_softmaxOfRight;
-            *node->m_gammaFromLattice = *m_gammaFromLattice;
+            CopyMatrixTo(m_logSoftmaxOfRight, node->m_logSoftmaxOfRight);
+            CopyMatrixTo(m_softmaxOfRight, node->m_softmaxOfRight);
+            CopyMatrixTo(m_gammaFromLattice, node->m_gammaFromLattice);
             node->m_fsSmoothingWeight = m_fsSmoothingWeight;
             node->m_frameDropThreshold = m_frameDropThreshold;
             node->m_doReferenceAlignment = m_doReferenceAlignment;
@@ -577,9 +577,9 @@ public:
     virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool)
     {
         Base::RequestMatricesBeforeForwardProp(matrixPool);
-        RequestMatrixFromPool(m_logSoftmaxOfRight, matrixPool);
-        RequestMatrixFromPool(m_softmaxOfRight, matrixPool);
-        RequestMatrixFromPool(m_gammaFromLattice, matrixPool);
+        RequestMatrixFromPool(m_logSoftmaxOfRight, matrixPool, Input(1)->GetSampleMatrixNumRows());
+        RequestMatrixFromPool(m_softmaxOfRight, matrixPool, Input(1)->GetSampleMatrixNumRows());
+        RequestMatrixFromPool(m_gammaFromLattice, matrixPool, Input(1)->GetSampleMatrixNumRows());
     }
 
     // request matrices needed to do node function value evaluation
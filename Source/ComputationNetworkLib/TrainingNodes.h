@@ -10,6 +10,7 @@
 
 #include <map>
 #include <string>
+#include <algorithm>
 #include <vector>
 #include <stdexcept>
 #include <list>
@@ -85,7 +86,7 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<SquareErrorNode<ElemType>>(nodeP);
-            *node->m_leftMinusRight = *m_leftMinusRight;
+            CopyMatrixTo(m_leftMinusRight, node->m_leftMinusRight);
         }
     }
 
@@ -93,7 +94,7 @@ public:
     virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool)
     {
         Base::RequestMatricesBeforeForwardProp(matrixPool);
-        RequestMatrixFromPool(m_leftMinusRight, matrixPool);
+        RequestMatrixFromPool(m_leftMinusRight, matrixPool, Input(0)->GetSampleMatrixNumRows());
     }
 
     // release gradient and temp matrices that no longer needed after all the children's gradients are computed.
@@ -214,8 +215,8 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<CrossEntropyWithSoftmaxNode<ElemType>>(nodeP);
-            *node->m_logSoftmaxOfRight = *m_logSoftmaxOfRight;
-            *node->m_softmaxOfRight = *m_softmaxOfRight;
+            CopyMatrixTo(m_logSoftmaxOfRight, node->m_logSoftmaxOfRight);
+            CopyMatrixTo(m_softmaxOfRight, node->m_softmaxOfRight);
         }
     }
 
@@ -223,8 +224,8 @@ public:
     virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool)
     {
         Base::RequestMatricesBeforeForwardProp(matrixPool);
-        RequestMatrixFromPool(m_logSoftmaxOfRight, matrixPool);
-        RequestMatrixFromPool(m_softmaxOfRight, matrixPool);
+        RequestMatrixFromPool(m_logSoftmaxOfRight, matrixPool, Input(1)->GetSampleMatrixNumRows());
+        RequestMatrixFromPool(m_softmaxOfRight, matrixPool, Input(1)->GetSampleMatrixNumRows());
     }
 
 protected:
@@ -325,8 +326,8 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<CrossEntropyNode<ElemType>>(nodeP);
-            *node->m_logOfRight = *m_logOfRight;
-            *node->m_leftDivRight = *m_leftDivRight;
+            CopyMatrixTo(m_logOfRight, node->m_logOfRight);
+            CopyMatrixTo(m_leftDivRight, node->m_leftDivRight);
         }
     }
 
@@ -334,14 +335,14 @@ public:
     virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool)
     {
         Base::RequestMatricesBeforeForwardProp(matrixPool);
-        RequestMatrixFromPool(m_logOfRight, matrixPool);
+        RequestMatrixFromPool(m_logOfRight, matrixPool, Input(1)->GetSampleMatrixNumRows());
     }
 
     // request matrices that are needed for gradient computation
     virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool)
     {
         Base::RequestMatricesBeforeBackprop(matrixPool);
-        RequestMatrixFromPool(m_leftDivRight, matrixPool);
+        RequestMatrixFromPool(m_leftDivRight, matrixPool, Input(1)->GetSampleMatrixNumRows());
     }
 
     // release gradient and temp matrices that no longer needed after all the children's gradients are computed.
@@ -430,7 +431,7 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<MatrixL1RegNode<ElemType>>(nodeP);
-            *node->m_gradientOfL1Norm = *m_gradientOfL1Norm;
+            CopyMatrixTo(m_gradientOfL1Norm, node->m_gradientOfL1Norm);
         }
     }
 
@@ -438,7 +439,7 @@ public:
     virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool)
     {
         Base::RequestMatricesBeforeBackprop(matrixPool);
-        RequestMatrixFromPool(m_gradientOfL1Norm, matrixPool);
+        RequestMatrixFromPool(m_gradientOfL1Norm, matrixPool, Input(0)->GetSampleMatrixNumRows());
     }
 
     // release gradient and temp matrices that no longer needed after all the children's gradients are computed.
@@ -705,6 +706,11 @@ template class NoiseContrastiveEstimationNode<double>;
 //  - Input(1) [hdsize x T] hidden layer activation to the node in. for a simple rnn, this is the hidden layer activty
 //  - Input(2) [hdsize x vocab_size] weight matrix in, for speed-up, as per word matrix can be simply obtained as column slice
 //  - Input(3) [nbr_cls x T] clsprob in dense matrix in. This input, if applied softmax on, is the posterior probabilty of class given observations
+//
+// The frames of a minibatch are grouped by the class of their word, so that each class costs one matrix product over
+// all its frames rather than one per frame. The class-conditional distributions of a group are stored as one
+// [nbr_wrd x numFrames] block of the packed buffers, and the objective and the gradient w.r.t. the softmax inputs
+// are each computed in a single pass over all groups against one-hot target matrices.
 // -----------------------------------------------------------------------
 
 // calculates: -sum(left_i * log(softmax_i(right))) for class given history and for word given history
@@ -732,8 +738,14 @@ public:
           m_logSoftmax(deviceId),
           m_softMax(deviceId),
           m_grdToSoftMaxInput(deviceId),
+          m_wordTargets(deviceId),
+          m_groupedInput(deviceId),
+          m_groupedInputGradient(deviceId),
           m_clsLogSoftmax(deviceId),
-          m_clsSoftmax(deviceId)
+          m_clsSoftmax(deviceId),
+          m_clsTargets(deviceId),
+          m_clsGradient(deviceId),
+          m_objectiveTerm(deviceId)
     {
     }
 
@@ -746,68 +758,147 @@ public:
 
         ComputeSoftMaxPartial();
 
+        switch (inputIndex)
+        {
+        case 1:
+        {
+            // gradient to input: one product per class group, then added to the frames' columns
+            const size_t hdSize = Input(INPUTDATA)->GetSampleMatrixNumRows();
+            m_groupedInputGradient.Resize(hdSize, m_frameColumns.size());
+            for (const auto& group : m_classGroups)
+            {
+                Matrix<ElemType> weightForClass = Input(EMBEDDINGMATRIX)->ValueAsMatrix().ColumnSlice(group.lft_bnd, group.nbr_wrd);
+                Matrix<ElemType> grd_to_soft_max_input = GroupSlice(m_grdToSoftMaxInput, group);
+                Matrix<ElemType> grd = m_groupedInputGradient.ColumnSlice(group.firstFrame, group.numFrames);
+                grd.AssignProductOf(weightForClass, false, grd_to_soft_max_input, false); // [hdSize x numFrames]
+            }
+            Matrix<ElemType>& inputGradient = Input(INPUTDATA)->Gradient();
+            for (size_t k = 0; k < m_frameColumns.size(); k++)
+            {
+                Matrix<ElemType> grd_t = inputGradient.ColumnSlice(m_frameColumns[k], 1);
+                grd_t += m_groupedInputGradient.ColumnSlice(k, 1);
+            }
+            break;
+        }
+        case 2:
+        {
+            // gradient to input weight
+            for (const auto& group : m_classGroups)
+            {
+                Matrix<ElemType> obs = m_groupedInput.ColumnSlice(group.firstFrame, group.numFrames);
+                Matrix<ElemType> grd_to_soft_max_input = GroupSlice(m_grdToSoftMaxInput, group);
+                Matrix<ElemType> grd_to_wgt = Input(EMBEDDINGMATRIX)->GradientAsMatrix().ColumnSlice(group.lft_bnd, group.nbr_wrd);
+                Matrix<ElemType>::MultiplyAndAdd(obs, false, grd_to_soft_max_input, true, grd_to_wgt);
+            }
+            break;
+        }
+        case 3:
+        {
+            // gradient to the class log posteriors: (softmax - target) * gradient, zero in the gaps
+            // Like the per-frame computation, this assigns the gradient rather than adding to it.
+            FrameRange fr(Input(CLASSPROBINDATA)->GetMBLayout());
+            m_clsGradient.AssignDifferenceOf(m_clsSoftmax, m_clsTargets);
+            Matrix<ElemType>::Scale(Gradient(), m_clsGradient);
+            MaskMissingColumnsToZero(m_clsGradient, Input(CLASSPROBINDATA)->GetMBLayout(), fr);
+            Input(CLASSPROBINDATA)->GradientFor(fr).SetValue(DataWithMBLayoutFor(m_clsGradient, fr, Input(CLASSPROBINDATA)->GetMBLayout()));
+            break;
+        }
+        }
+    }
+
+    virtual bool OutputUsedInComputingInputNodesGradients() const override
+    {
+        return false;
+    }
+
+private:
+    // frames whose words share the same class-member index range [lft_bnd, lft_bnd + nbr_wrd)
+    struct ClassGroup
+    {
+        size_t lft_bnd;    // index of the first word of the class
+        size_t nbr_wrd;    // number of words in the class
+        size_t firstFrame; // position of the group's first frame in m_frameColumns
+        size_t numFrames;
+        size_t offset;     // offset of the group's [nbr_wrd x numFrames] block in the packed buffers
+    };
+
+    // a non-gap frame: its word's class-member range, its column in the minibatch, and its word and class
+    struct FrameInfo
+    {
+        size_t lft_bnd, nbr_wrd, column, idx_in_class, c_t;
+    };
+
+    // view of a group's block of one of the packed buffers
+    static Matrix<ElemType> GroupSlice(const Matrix<ElemType>& packed, const ClassGroup& group)
+    {
+        return packed.ColumnSlice(group.offset, group.nbr_wrd * group.numFrames).Reshaped(group.nbr_wrd, group.numFrames);
+    }
+
+    // group the non-gap frames by class, lay out the packed buffers, and build the one-hot target matrices
+    void PlanClassGroups()
+    {
+        m_frames.clear();
+
         const size_t nT = Input(LABELDATA)->GetNumTimeSteps();
         const size_t nS = Input(LABELDATA)->GetNumParallelSequences();
-        size_t sz = 0; // iterate over the packed concatenated class-conditioned prob vectors
         for (size_t s = 0; s < nS; s++)
             for (size_t t = 0; t < nT; t++)
             {
                 FrameRange fr = FrameRange(Input(LABELDATA)->GetMBLayout(), t).Sequence(s);
-
                 if (Input(LABELDATA)->GetMBLayout()->IsGap(fr)) // skip gaps
                     continue;
 
-                Matrix<ElemType> lbl_t = Input(LABELDATA)->ValueFor(fr);
-                size_t c_t = (size_t) lbl_t(1, 0);
+                const Matrix<ElemType>& lbl_t = Input(LABELDATA)->ValueFor(fr);
+                size_t y_t = (size_t) lbl_t(0, 0);     // current word token index
+                size_t c_t = (size_t) lbl_t(1, 0);     // current word token's class index
                 size_t lft_bnd = (size_t) lbl_t(2, 0); // index of first word belonging to current word token's class
                 size_t rgt_bnd = (size_t) lbl_t(3, 0); // and end of that range
                 size_t nbr_wrd = (rgt_bnd - lft_bnd);  // number of words in the class
+                if (nbr_wrd == 0)
+                    LogicError("ClassBasedCrossEntropyWithSoftmax (ForwardPropNonLooping()): Encountered a class of size 0. This sample seems to lack an NoInput flag.");
+                if (y_t < lft_bnd || y_t >= rgt_bnd)
+                    LogicError("ClassBasedCrossEntropyWithSoftmax (ForwardPropNonLooping()): Word index out of bounds of class-member index range (word not a class member).");
+                if (c_t >= m_nbrCls)
+                    LogicError("ClassBasedCrossEntropyWithSoftmax (ForwardPropNonLooping()): Class index out of bounds.");
 
-                // compute prb - 1 and prb
-                Matrix<ElemType> weightForClass = Input(EMBEDDINGMATRIX)->ValueAsMatrix().ColumnSlice(lft_bnd, nbr_wrd);
-                Matrix<ElemType> obs = Input(INPUTDATA)->ValueFor(fr); // hidden activation vector for current word token
-                Matrix<ElemType> grd_to_soft_max_input = m_grdToSoftMaxInput.ColumnSlice(sz, nbr_wrd);
-                Matrix<ElemType> grd_to_cls_prob = DataWithMBLayoutFor(m_clsLogSoftmax, fr, Input(CLASSPROBINDATA)->GetMBLayout());
-
-                switch (inputIndex)
-                {
-                case 1:
-                {
-                    // gradient to input
-                    Matrix<ElemType> grd_t = Input(INPUTDATA)->GradientFor(fr);
-                    Matrix<ElemType>::MultiplyAndAdd(weightForClass, false, grd_to_soft_max_input, true, grd_t);
-                    break;
-                }
-                case 2:
-                {
-                    // gradient to input weight
-                    Matrix<ElemType> grd_to_wgt_t = Input(EMBEDDINGMATRIX)->GradientAsMatrix().ColumnSlice(lft_bnd, nbr_wrd);
-                    Matrix<ElemType>::MultiplyAndAdd(obs, false, grd_to_soft_max_input, false, grd_to_wgt_t);
-                    break;
-                }
-                case 3:
-                {
-                    Matrix<ElemType> grd_t = Input(CLASSPROBINDATA)->GradientFor(fr);
-                    grd_t.SetValue(DataWithMBLayoutFor(m_clsSoftmax, fr, Input(CLASSPROBINDATA)->GetMBLayout()));
-                    ComputeCEPartialToSoftmaxInputs(grd_t, Gradient(), c_t);
-                    break;
-                }
-                }
-
-                sz += nbr_wrd;
+                m_frames.push_back(FrameInfo{lft_bnd, nbr_wrd, t * nS + s /*column of frame (s,t)*/, y_t - lft_bnd, c_t});
             }
-    }
 
-    virtual bool OutputUsedInComputingInputNodesGradients() const override
-    {
-        return false;
-    }
+        // frames of the same class become adjacent, in their original order
+        std::stable_sort(m_frames.begin(), m_frames.end(), [](const FrameInfo& a, const FrameInfo& b)
+                         {
+                             return a.lft_bnd < b.lft_bnd || (a.lft_bnd == b.lft_bnd && a.nbr_wrd < b.nbr_wrd);
+                         });
 
-private:
-    void ComputeCEPartialToSoftmaxInputs(Matrix<ElemType>& inputGradientValues, Matrix<ElemType>& gradientValues, size_t y_t)
-    {
-        Matrix<ElemType>::MinusOneAt(inputGradientValues, y_t);
-        Matrix<ElemType>::Scale(gradientValues, inputGradientValues);
+        m_classGroups.clear();
+        m_frameColumns.resize(m_frames.size());
+        size_t sz = 0; // offset into the packed concatenated class-conditioned prob vectors
+        for (size_t k = 0; k < m_frames.size(); k++)
+        {
+            const auto& frame = m_frames[k];
+            if (m_classGroups.empty() || m_classGroups.back().lft_bnd != frame.lft_bnd || m_classGroups.back().nbr_wrd != frame.nbr_wrd)
+                m_classGroups.push_back(ClassGroup{frame.lft_bnd, frame.nbr_wrd, k, 0, sz});
+            m_classGroups.back().numFrames++;
+            m_frameColumns[k] = frame.column;
+            sz += frame.nbr_wrd;
+        }
+        m_totalNbrWords = sz; // total size of concatenated vector
+
+        // one-hot targets: the word within its group's block, and the class of each frame
+        const size_t numCols = Input(CLASSPROBINDATA)->Value().GetNumCols();
+        m_wordTargetsBuffer.assign(m_totalNbrWords, 0);
+        m_clsTargetsBuffer.assign(m_nbrCls * numCols, 0);
+        for (const auto& group : m_classGroups)
+        {
+            for (size_t i = 0; i < group.numFrames; i++)
+            {
+                const auto& frame = m_frames[group.firstFrame + i];
+                m_wordTargetsBuffer[group.offset + i * group.nbr_wrd + frame.idx_in_class] = 1;
+                m_clsTargetsBuffer[frame.column * m_nbrCls + frame.c_t] = 1;
+            }
+        }
+        m_wordTargets.SetValue(1, m_totalNbrWords, m_deviceId, m_wordTargetsBuffer.data());
+        m_clsTargets.SetValue(m_nbrCls, numCols, m_deviceId, m_clsTargetsBuffer.data());
     }
 
     // gradient of cross entropy w.r.t. to input to softmax
@@ -815,35 +906,8 @@ private:
     {
         if (m_needRecomputeGradientToSoftmaxInput)
         {
-            m_grdToSoftMaxInput.Resize(1, m_totalNbrWords); // buffer that contains a concatenation of class-conditional values
-
-            const size_t nT = Input(LABELDATA)->GetNumTimeSteps();
-            const size_t nS = Input(LABELDATA)->GetNumParallelSequences();
-            size_t sz = 0; // iterate over the packed concatenated class-conditioned prob vectors
-            for (size_t s = 0; s < nS; s++)
-                for (size_t t = 0; t < nT; t++)
-                {
-                    FrameRange fr = FrameRange(Input(LABELDATA)->GetMBLayout(), t).Sequence(s);
-
-                    // if (Input(LABELDATA)->GetMBLayout()->IsGap(s, t))  // skip gaps
-                    if (Input(LABELDATA)->GetMBLayout()->IsGap(fr)) // skip gaps
-                        continue;
-
-                    Matrix<ElemType> lbl_t = Input(LABELDATA)->ValueFor(fr);
-                    size_t y_t = (size_t) lbl_t(0, 0);     // word index
-                    size_t lft_bnd = (size_t) lbl_t(2, 0); // index of first word belonging to current word token's class
-                    size_t rgt_bnd = (size_t) lbl_t(3, 0); // and end of that range
-                    size_t nbr_wrd = (rgt_bnd - lft_bnd);  // number of words in the class
-
-                    Matrix<ElemType> softMax = m_softMax.ColumnSlice(sz, nbr_wrd);
-
-                    size_t idx_in_class = y_t - lft_bnd;
-                    ComputeCEPartialToSoftmaxInputs(softMax, Gradient(), idx_in_class);
-
-                    m_grdToSoftMaxInput.ColumnSlice(sz, nbr_wrd).SetValue(softMax);
-
-                    sz += nbr_wrd;
-                }
+            m_grdToSoftMaxInput.AssignDifferenceOf(m_softMax, m_wordTargets);
+            Matrix<ElemType>::Scale(Gradient(), m_grdToSoftMaxInput);
 
             m_needRecomputeGradientToSoftmaxInput = false;
         }
@@ -867,92 +931,43 @@ public:
         const size_t hdSize = Input(INPUTDATA)->GetSampleMatrixNumRows(); // hdSize
         assert(m_nbrCls == Input(CLASSPROBINDATA)->GetSampleMatrixNumRows());
 
-        // compute the class posteriors
+        // compute the class posteriors; the gaps are not part of the objective, mask them so that they stay finite
         m_clsLogSoftmax = Input(CLASSPROBINDATA)->Value();
+        MaskMissingColumnsToZero(m_clsLogSoftmax, Input(CLASSPROBINDATA)->GetMBLayout(), FrameRange(Input(CLASSPROBINDATA)->GetMBLayout()));
         m_clsLogSoftmax.InplaceLogSoftmax(true);   // log
         m_clsSoftmax.AssignExpOf(m_clsLogSoftmax); // non-log
 
-        // create a large workspace to contain all class-conditioned probs concatenated
-        // 'sz' is the offset into that vector. We will iterate over these vectors at a few places. Always use this same boilerplate code.
-        // TODO: should we pull this iteration into an iterator, to reduce the code dup?
-        const size_t nT = Input(LABELDATA)->GetNumTimeSteps();
-        const size_t nS = Input(LABELDATA)->GetNumParallelSequences();
-        size_t sz = 0;
-        for (size_t s = 0; s < nS; s++)
-            for (size_t t = 0; t < nT; t++)
-            {
-                FrameRange fr = FrameRange(Input(LABELDATA)->GetMBLayout(), t).Sequence(s);
-                if (Input(LABELDATA)->GetMBLayout()->IsGap(fr)) // skip gaps
-                    continue;
-
-                const Matrix<ElemType>& lbl_t = Input(LABELDATA)->ValueFor(fr);
-                size_t lft_bnd = (size_t) lbl_t(2, 0);
-                size_t rgt_bnd = (size_t) lbl_t(3, 0);
-                size_t nbr_wrd = (rgt_bnd - lft_bnd); // number of words in the class
-                if (nbr_wrd == 0)
-                    LogicError("ClassBasedCrossEntropyWithSoftmax (ForwardPropNonLooping()): Encountered a class of size 0. This sample seems to lack an NoInput flag.");
-
-                sz += nbr_wrd;
-            }
-        m_totalNbrWords = sz; // total size of concatenated vector
+        PlanClassGroups();
 
         // buffer to hold the concatenated class-conditioned prob vectors
-        m_softMax.Resize(1, sz);
-        m_logSoftmax.Resize(1, sz);
+        m_softMax.Resize(1, m_totalNbrWords);
+        m_logSoftmax.Resize(1, m_totalNbrWords);
 
-        // accumulate objective
-        functionValues.SetValue(0);
-        sz = 0; // iterate over the packed concatenated class-conditioned prob vectors
-        for (size_t s = 0; s < nS; s++)
-            for (size_t t = 0; t < nT; t++)
-            {
-                FrameRange fr = FrameRange(Input(LABELDATA)->GetMBLayout(), t).Sequence(s);
-                if (Input(LABELDATA)->GetMBLayout()->IsGap(fr)) // skip gaps
-                    continue;
+        // hidden activations of all frames, in group order
+        const Matrix<ElemType>& inputValue = Input(INPUTDATA)->Value();
+        m_groupedInput.Resize(hdSize, m_frameColumns.size());
+        for (size_t k = 0; k < m_frameColumns.size(); k++)
+            m_groupedInput.SetColumnSlice(inputValue.ColumnSlice(m_frameColumns[k], 1), k, 1);
 
-                const Matrix<ElemType>& lbl_t = Input(LABELDATA)->ValueFor(fr);
-                size_t y_t = (size_t) lbl_t(0, 0);     // current word token index
-                size_t c_t = (size_t) lbl_t(1, 0);     // current word token's class index
-                size_t lft_bnd = (size_t) lbl_t(2, 0); // index of first word belonging to current word token's class
-                size_t rgt_bnd = (size_t) lbl_t(3, 0); // and end of that range
-                size_t nbr_wrd = (rgt_bnd - lft_bnd);  // number of words in the class
-
-                // now get views of various arrays that correspond to the index range of words belonging to this class
-
-                // get hidden vectors for the words in this class
-                Matrix<ElemType> weightForClass = Input(EMBEDDINGMATRIX)->ValueAsMatrix().ColumnSlice(lft_bnd, nbr_wrd); // [hdSize x nbr_wrd]
-
-                // buffer to hold the class-conditional distribution
-                Matrix<ElemType> softMax_t = m_softMax.ColumnSlice(sz, nbr_wrd); // TODO: declare these outside of the loop to avoid the malloc
-                Matrix<ElemType> logSoftMax_t = m_logSoftmax.ColumnSlice(sz, nbr_wrd);
-
-                Matrix<ElemType> obs = Input(INPUTDATA)->ValueFor(fr); // hidden activation vector for current word token
-
-                // multiply hidden activation with weight matrix (the slice of the weight matrix for the range of class members)
-                // TODO: can we use 'true' here instead? Above transposition hack won't work with row slices. 'obs' not used elsewhere
-                obs.Reshape(1, hdSize);                                                                                // transpose it (make it a column vector)
-                logSoftMax_t.AssignProductOf(obs /*(1 x hdSize)*/, false, weightForClass /*hdSize x nbr_wrd*/, false); // -> 1 x nbr_word
-
-                // log softmax(W x_t)
-                logSoftMax_t.InplaceLogSoftmax(false);
-
-                // and non-log version
-                softMax_t.SetValue(logSoftMax_t);
-                softMax_t.InplaceExp();
-                // we now have a column vector of class-conditional probabilities over the class members
-
-                // add  the word's class-conditional log posterior
-                if (y_t < lft_bnd || y_t >= rgt_bnd)
-                    LogicError("ClassBasedCrossEntropyWithSoftmax (ForwardPropNonLooping()): Word index out of bounds of class-member index range (word not a class member).");
-                size_t idx_in_class = y_t - lft_bnd;
-                Matrix<ElemType>::AddElementToElement(logSoftMax_t, 0, idx_in_class, functionValues, 0, 0); // (1x1)
+        for (const auto& group : m_classGroups)
+        {
+            // weights for the words in this class
+            Matrix<ElemType> weightForClass = Input(EMBEDDINGMATRIX)->ValueAsMatrix().ColumnSlice(group.lft_bnd, group.nbr_wrd); // [hdSize x nbr_wrd]
+            Matrix<ElemType> obs = m_groupedInput.ColumnSlice(group.firstFrame, group.numFrames);                                  // [hdSize x numFrames]
+
+            // log softmax(W' x_t) for all frames of the class at once
+            Matrix<ElemType> logSoftMax = GroupSlice(m_logSoftmax, group);
+            logSoftMax.AssignProductOf(weightForClass, true, obs, false); // -> nbr_wrd x numFrames
+            logSoftMax.InplaceLogSoftmax(true);
+        }
 
-                // add the class log posterior probability
-                Matrix<ElemType>::AddElementToElement(m_clsLogSoftmax, c_t, t, functionValues, 0, 0); // (1x1)
-
-                sz += nbr_wrd;
-            }
+        // and non-log version
+        m_softMax.AssignExpOf(m_logSoftmax);
 
+        // accumulate objective: the words' class-conditional log posteriors and the class log posteriors
+        functionValues.AssignInnerProductOfMatrices(m_wordTargets, m_logSoftmax);
+        m_objectiveTerm.AssignInnerProductOfMatrices(m_clsTargets, m_clsLogSoftmax);
+        functionValues += m_objectiveTerm;
         functionValues *= (-1);
 
 #if NANCHECK
@@ -982,17 +997,29 @@ public:
     }
 
 protected:
+    // packed buffers: the class-conditional distributions of each class group as a [nbr_wrd x numFrames] block
     Matrix<ElemType> m_logSoftmax;
     Matrix<ElemType> m_softMax;
 
+    // gradient of cross entropy with respect to the input of softmax, in the same packed layout
+    Matrix<ElemType> m_grdToSoftMaxInput;
+    bool m_needRecomputeGradientToSoftmaxInput;
+
+    Matrix<ElemType> m_wordTargets;          // one-hot word targets, in the packed layout
+    Matrix<ElemType> m_groupedInput;         // [hdSize x numFrames] hidden activations in group order
+    Matrix<ElemType> m_groupedInputGradient; // [hdSize x numFrames] their gradient
+
     Matrix<ElemType> m_clsLogSoftmax;
     Matrix<ElemType> m_clsSoftmax;
+    Matrix<ElemType> m_clsTargets;  // [nbr_cls x T] one-hot class targets, zero in the gaps
+    Matrix<ElemType> m_clsGradient; // (temp)
+    Matrix<ElemType> m_objectiveTerm; // (temp)
 
-    // gradient of cross entropy with respect to the input of softmax
-    // a 1 row by \sum_t m_nbrWordsInEachTime[t] vector
-    // one slice of size m_nbrWordsInEachTime[t] saves the input to softmax for word y_t
-    Matrix<ElemType> m_grdToSoftMaxInput;
-    bool m_needRecomputeGradientToSoftmaxInput;
+    // frames of the current minibatch, grouped by class
+    std::vector<FrameInfo> m_frames;
+    std::vector<ClassGroup> m_classGroups;
+    std::vector<size_t> m_frameColumns; // [k] minibatch column of the k-th frame in group order
+    std::vector<ElemType> m_wordTargetsBuffer, m_clsTargetsBuffer; // host-side targets
 
     size_t m_nbrCls;
     size_t m_totalNbrWords;
@@ -1010,7 +1037,8 @@ template class ClassBasedCrossEntropyWithSoftmaxNode<double>;
 //    in the R-CRF case, it is the RNN output score before softmax
 //  - transition scores: square transition matrix,  --TODO: log?
 //    in the R-CRF case, it is the transition probability between labels
-// BUGBUG: This node cannot operate with truncated BPTT, but does not detect it. It also does not handle gaps or test boundary flags.
+// On the CPU, all sequences of the minibatch are processed at once, in parallel (see CPUMatrix::RCRFForwardBackward()).
+// BUGBUG: On the GPU, this node cannot operate with truncated BPTT, but does not detect it. It also does not handle gaps or test boundary flags.
 // -----------------------------------------------------------------------
 
 /**
@@ -1059,6 +1087,16 @@ public:
         mBeta.Resize(nrow, ncol);
         mPostProb.Resize(nrow, ncol);
 
+        if (m_deviceId == CPUDEVICE)
+        {
+            auto sequences = Base::GetWholeSequences(Input(0)->GetMBLayout());
+            Value().SetValue(Matrix<ElemType>::RCRFForwardBackward(Input(0)->Value(), Input(1)->Value(), Input(2)->ValueAsMatrix(),
+                                                                   mAlpha, mBeta, mPostProb, sequences));
+            if (Input(0)->GetMBLayout()->HasGaps())
+                MaskMissingColumnsToZero(mPostProb, Input(0)->GetMBLayout(), fr); // (no gradient from the gaps)
+            return;
+        }
+
         Value().SetValue(0.0);
         Matrix<ElemType> funcVal = Value(); // TODO: This just creates a 1x1 matrix set to 0.
 
@@ -1098,6 +1136,12 @@ public:
         else if (inputIndex == 2)
         {
             assert(Input(inputIndex)->GradientFor(fr).GetNumElements() > 0);
+            if (m_deviceId == CPUDEVICE)
+            {
+                auto sequences = Base::GetWholeSequences(Input(0)->GetMBLayout());
+                Matrix<ElemType>::RCRFTransGrdCompute(Input(0)->Value(), mAlpha, mBeta, Input(2)->ValueAsMatrix(), Input(2)->GradientAsMatrix(), sequences);
+                return;
+            }
             size_t nS = Input(0)->GetNumParallelSequences();
             for (size_t i = 0; i < nS; i++) // process all sequences one by one
             {
@@ -1447,9 +1491,9 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<LogisticNode<ElemType>>(nodeP);
-            *node->m_classZeroLabels = *m_classZeroLabels;
-            *node->m_result = *m_result;
-            *node->m_temp = *m_temp;
+            CopyMatrixTo(m_classZeroLabels, node->m_classZeroLabels);
+            CopyMatrixTo(m_result, node->m_result);
+            CopyMatrixTo(m_temp, node->m_temp);
         }
     }
 
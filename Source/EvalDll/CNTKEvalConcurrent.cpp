@@ -0,0 +1,349 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// CNTKEvalConcurrent.cpp : thread-safe evaluator that serves concurrent callers with micro-batches
+//
+
+#include "stdafx.h"
+#define EVAL_EXPORTS // creating the exports here
+#include "Eval.h"
+#include "CNTKEvalConcurrent.h"
+#include "CPUMatrix.h" // for SetNumThreads()
+#include "RecurrentNodes.h"
+#include "BestGpu.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+template <class ElemType>
+void EVAL_API GetEvalConcurrent(IEvaluateModelConcurrent<ElemType>** peval)
+{
+    *peval = new CNTKEvalConcurrent<ElemType>();
+}
+
+extern "C" EVAL_API void GetEvalConcurrentF(IEvaluateModelConcurrent<float>** peval)
+{
+    GetEvalConcurrent(peval);
+}
+extern "C" EVAL_API void GetEvalConcurrentD(IEvaluateModelConcurrent<double>** peval)
+{
+    GetEvalConcurrent(peval);
+}
+
+template <class ElemType>
+void CNTKEvalConcurrent<ElemType>::Init(const std::string& config)
+{
+    m_config.Parse(config);
+    m_numWorkers = m_config("numWorkers", "4");
+    m_maxBatchSize = m_config("maxBatchSize", "64");
+    m_numCPUThreads = m_config("numCPUThreads", "1");
+    double maxBatchLatencyMs = m_config("maxBatchLatency", "1.0");
+    if (m_numWorkers == 0 || m_maxBatchSize == 0 || m_numCPUThreads == 0)
+        InvalidArgument("CNTKEvalConcurrent: numWorkers, maxBatchSize, and numCPUThreads must be at least 1.");
+    m_maxBatchLatency = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(maxBatchLatencyMs));
+    if (m_config.Exists("modelPath"))
+    {
+        std::wstring path = m_config("modelPath");
+        LoadModel(path);
+    }
+}
+
+// Destroy - cleanup and remove this class
+// NOTE: this destroys the object, and it can't be used past this point
+template <class ElemType>
+void CNTKEvalConcurrent<ElemType>::Destroy()
+{
+    StopWorkers();
+    m_net.reset();
+    delete this;
+}
+
+// LoadModel - load a model from the specified path
+// modelFileName - file holding the model to load
+// The workers' instances are created in StartEvaluateMinibatchLoop().
+template <class ElemType>
+void CNTKEvalConcurrent<ElemType>::LoadModel(const std::wstring& modelFileName)
+{
+    StopWorkers();
+    m_deviceId = DeviceFromConfig(m_config);
+    fprintf(stderr, "DeviceID=%d\n", (int) m_deviceId);
+    m_net = ComputationNetwork::CreateFromFile<ElemType>(m_deviceId, modelFileName);
+}
+
+// GetNodeDimensions - Get the node dimensions of the specified nodes
+// dimensions - map from name of node to dimension of the node, will be appended to for Input/Output scenarios
+// nodeGroup - type of node we are requesting (input/output/specified)
+template <class ElemType>
+void CNTKEvalConcurrent<ElemType>::GetNodeDimensions(std::map<std::wstring, size_t>& dimensions, NodeGroup nodeGroup)
+{
+    if (m_net == NULL)
+    {
+        for (auto iter = dimensions.begin(); iter != dimensions.end(); iter++)
+            iter->second = 0;
+        return;
+    }
+
+    const auto& outputNodes = m_net->OutputNodes();
+    switch (nodeGroup)
+    {
+    case nodeInput:
+        for (auto& node : m_net->InputNodes(outputNodes[0]))
+            dimensions[node->NodeName()] = node->GetSampleMatrixNumRows();
+        break;
+    case nodeOutput:
+        for (auto& node : outputNodes)
+            dimensions[node->NodeName()] = node->GetSampleMatrixNumRows();
+        break;
+    case nodeSpecified:
+        for (auto iter = dimensions.begin(); iter != dimensions.end(); iter++)
+            iter->second = m_net->GetNodeFromName(iter->first)->GetSampleMatrixNumRows();
+        break;
+    }
+}
+
+// StartEvaluateMinibatchLoop - create the worker instances and start their threads
+// inputNodeNames, outputNodeNames - nodes in the order in which Evaluate() receives their buffers
+template <class ElemType>
+void CNTKEvalConcurrent<ElemType>::StartEvaluateMinibatchLoop(const std::vector<std::wstring>& inputNodeNames, const std::vector<std::wstring>& outputNodeNames)
+{
+    if (m_net == NULL)
+        LogicError("CNTKEvalConcurrent: StartEvaluateMinibatchLoop() called before LoadModel().");
+    StopWorkers();
+
+    m_inputDims.clear();
+    for (const auto& name : inputNodeNames)
+        m_inputDims.push_back(m_net->GetNodeFromName(name)->GetSampleMatrixNumRows());
+    m_outputDims.clear();
+    std::vector<ComputationNodeBasePtr> outputNodes;
+    for (const auto& name : outputNodeNames)
+    {
+        outputNodes.push_back(m_net->GetNodeFromName(name));
+        m_outputDims.push_back(outputNodes.back()->GetSampleMatrixNumRows());
+    }
+
+    // The requests of a batch are unrelated samples, which a recurrence would mix up (and the workers would carry
+    // its state over from one batch to the next), so only frame-mode models are accepted.
+    for (const auto& node : ComputationNodeBase::EnumerateNodes(outputNodes))
+    {
+        if (node->IsPartOfLoop() || node->Is<IRecurrentNode>() ||
+            node->OperationName() == OperationNameOf(LSTMNode) || node->OperationName() == OperationNameOf(GRUNode))
+            InvalidArgument("CNTKEvalConcurrent: Node %ls %ls is recurrent; only models without recurrence (frame mode) are supported.",
+                            node->NodeName().c_str(), node->OperationName().c_str());
+    }
+
+    // A GPU is not shared by several workers: its computations are not made safe for concurrent use, so requests
+    // are evaluated one batch at a time there.
+    size_t numWorkers = m_numWorkers;
+    if (m_deviceId != CPUDEVICE && numWorkers > 1)
+    {
+        fprintf(stderr, "CNTKEvalConcurrent: Evaluating on GPU %d, using a single worker instead of %d.\n", (int) m_deviceId, (int) numWorkers);
+        numWorkers = 1;
+    }
+
+    // the other instances are clones of the first one that use its parameters, so that they only exist once
+    for (size_t i = 0; i < numWorkers; i++)
+    {
+        std::unique_ptr<Worker> worker(new Worker());
+        worker->m_net = i == 0 ? m_net : m_net->CloneSharingParameters<ElemType>();
+        m_workers.push_back(std::move(worker));
+    }
+
+    for (auto& worker : m_workers)
+    {
+        for (const auto& name : inputNodeNames)
+            worker->m_inputNodes.push_back(worker->m_net->GetNodeFromName(name));
+        for (const auto& name : outputNodeNames)
+            worker->m_outputNodes.push_back(worker->m_net->GetNodeFromName(name));
+
+        worker->m_net->AllocateAllMatrices({}, worker->m_outputNodes, nullptr);
+        worker->m_net->StartEvaluateMinibatchLoop(worker->m_outputNodes);
+    }
+
+    // The BLAS thread count is a process-wide setting, so it is set here once for all workers; the workers only set
+    // the OpenMP count, which is a per-thread setting (see WorkerLoop()).
+    CPUMatrix<ElemType>::SetNumThreads((int) m_numCPUThreads);
+
+    fprintf(stderr, "CNTKEvalConcurrent: %d workers, micro-batches of up to %d samples.\n", (int) numWorkers, (int) m_maxBatchSize);
+    for (auto& worker : m_workers)
+    {
+        Worker* pWorker = worker.get();
+        worker->m_thread = std::thread([this, pWorker]
+                                       {
+                                           WorkerLoop(*pWorker);
+                                       });
+    }
+}
+
+// StopWorkers - let the worker threads finish and fail all requests that are still queued
+template <class ElemType>
+void CNTKEvalConcurrent<ElemType>::StopWorkers()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+        for (auto request : m_requests)
+        {
+            request->m_error = std::make_exception_ptr(std::runtime_error("CNTKEvalConcurrent: evaluator was stopped."));
+            request->m_done = true;
+            request->m_doneSignal.notify_one();
+        }
+        m_requests.clear();
+    }
+    m_requestSignal.notify_all();
+    for (auto& worker : m_workers)
+        if (worker->m_thread.joinable())
+            worker->m_thread.join();
+    m_workers.clear();
+    m_shutdown = false;
+}
+
+// Evaluate - Evaluate numSamples samples; thread-safe
+// inputs - one buffer per input node holding numSamples columns
+// outputs - one preallocated buffer per output node for numSamples columns
+template <class ElemType>
+void CNTKEvalConcurrent<ElemType>::Evaluate(const ElemType* const* inputs, ElemType* const* outputs, size_t numSamples)
+{
+    Request request;
+    request.m_inputs = inputs;
+    request.m_outputs = outputs;
+    request.m_numSamples = numSamples;
+    request.m_done = false;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_workers.empty())
+        LogicError("CNTKEvalConcurrent: Evaluate() called before StartEvaluateMinibatchLoop().");
+    request.m_arrivalTime = Clock::now();
+    m_requests.push_back(&request);
+    m_requestSignal.notify_one();
+    request.m_doneSignal.wait(lock, [&request]
+                              {
+                                  return request.m_done;
+                              });
+    lock.unlock();
+
+    if (request.m_error)
+        std::rethrow_exception(request.m_error);
+}
+
+// WorkerLoop - form micro-batches from the request queue and evaluate them, until stopped
+template <class ElemType>
+void CNTKEvalConcurrent<ElemType>::WorkerLoop(Worker& worker)
+{
+    // OpenMP settings are per thread; by default, each worker uses a single core
+#ifdef _OPENMP
+    omp_set_num_threads((int) m_numCPUThreads);
+#endif
+
+    std::vector<Request*> batch;
+    for (;;)
+    {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_requestSignal.wait(lock, [this]
+                                 {
+                                     return m_shutdown || !m_requests.empty();
+                                 });
+            if (m_shutdown)
+                return;
+
+            const Clock::time_point deadline = m_requests.front()->m_arrivalTime + m_maxBatchLatency;
+            size_t numSamples = 0;
+            for (;;)
+            {
+                // take queued requests as long as they fit (a single oversized request is taken as a batch of its own)
+                while (!m_requests.empty() && (batch.empty() || numSamples + m_requests.front()->m_numSamples <= m_maxBatchSize))
+                {
+                    numSamples += m_requests.front()->m_numSamples;
+                    batch.push_back(m_requests.front());
+                    m_requests.pop_front();
+                }
+                // stop if the batch is full, or if the deadline of the oldest request has passed
+                if (numSamples >= m_maxBatchSize || !m_requests.empty() || m_shutdown || Clock::now() >= deadline)
+                    break;
+                m_requestSignal.wait_until(lock, deadline);
+            }
+            // there may be more work left for another worker
+            if (!m_requests.empty())
+                m_requestSignal.notify_one();
+        }
+
+        std::exception_ptr error;
+        try
+        {
+            EvaluateBatch(worker, batch);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (auto request : batch)
+        {
+            request->m_error = error;
+            request->m_done = true;
+            request->m_doneSignal.notify_one();
+        }
+    }
+}
+
+// EvaluateBatch - evaluate the requests of one micro-batch on the worker's network instance
+template <class ElemType>
+void CNTKEvalConcurrent<ElemType>::EvaluateBatch(Worker& worker, const std::vector<Request*>& batch)
+{
+    size_t numCols = 0;
+    for (auto request : batch)
+        numCols += request->m_numSamples;
+
+    // copy the requests' columns next to each other into the input nodes
+    for (size_t i = 0; i < worker.m_inputNodes.size(); i++)
+    {
+        Matrix<ElemType>& value = worker.m_inputNodes[i]->template As<ComputationNode<ElemType>>()->Value();
+        DEVICEID_TYPE deviceId = value.GetDeviceId();
+        value.Resize(m_inputDims[i], numCols);
+        size_t col = 0;
+        for (auto request : batch)
+        {
+            // on the CPU, wrap the caller's buffer without copying it
+            Matrix<ElemType> source(m_inputDims[i], request->m_numSamples, const_cast<ElemType*>(request->m_inputs[i]), deviceId,
+                                    deviceId == CPUDEVICE ? matrixFlagDontOwnBuffer : matrixFlagNormal);
+            value.SetColumnSlice(source, col, request->m_numSamples);
+            col += request->m_numSamples;
+        }
+    }
+
+    worker.m_net->GetMBLayoutPtr()->InitAsFrameMode(numCols);
+    for (auto& node : worker.m_inputNodes)
+    {
+        node->NotifyFunctionValuesMBSizeModified();
+        node->BumpEvalTimeStamp();
+    }
+
+    for (auto& node : worker.m_outputNodes)
+        worker.m_net->ForwardProp(node);
+
+    // copy the output columns back into the callers' buffers
+    for (size_t i = 0; i < worker.m_outputNodes.size(); i++)
+    {
+        const Matrix<ElemType>& value = worker.m_outputNodes[i]->template As<ComputationNode<ElemType>>()->Value();
+        if (value.GetNumRows() != m_outputDims[i] || value.GetNumCols() != numCols)
+            LogicError("CNTKEvalConcurrent: Output %ls has unexpected dimensions.", worker.m_outputNodes[i]->NodeName().c_str());
+        size_t col = 0;
+        for (auto request : batch)
+        {
+            ElemType* target = request->m_outputs[i];
+            size_t targetSize = m_outputDims[i] * request->m_numSamples;
+            value.ColumnSlice(col, request->m_numSamples).CopyToArray(target, targetSize);
+            col += request->m_numSamples;
+        }
+    }
+}
+
+// instantiate all the combinations we expect to be used
+template class CNTKEvalConcurrent<double>;
+template class CNTKEvalConcurrent<float>;
+} } }
@@ -0,0 +1,97 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// CNTKEvalConcurrent.h - thread-safe evaluator that serves concurrent callers with micro-batches
+//
+#pragma once
+
+#include <string>
+#include <map>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+
+#include "Eval.h"
+#include "ComputationNetwork.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// CNTKEvalConcurrent -- evaluator for many concurrent callers
+//
+// The model is loaded once; the other workers' instances are clones that share its LearnableParameter
+// values, so the weights are held in memory only once. Each worker has its own activation memory and runs
+// on its own thread. On a GPU, a single worker is used.
+// Evaluate() enqueues the request and blocks until a worker has processed it. A worker takes all queued
+// requests up to maxBatchSize samples; if that does not fill the batch, it waits for more requests for
+// at most maxBatchLatency after the oldest one arrived. The requests' columns are then copied into the
+// input nodes, the batch is evaluated with a single ForwardProp(), and the output columns are copied back.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class CNTKEvalConcurrent : public IEvaluateModelConcurrent<ElemType>
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // one call to Evaluate(), lives on the caller's stack
+    struct Request
+    {
+        const ElemType* const* m_inputs;
+        ElemType* const* m_outputs;
+        size_t m_numSamples;
+        Clock::time_point m_arrivalTime;
+        bool m_done;
+        std::exception_ptr m_error;
+        std::condition_variable m_doneSignal;
+    };
+
+    // one network instance with its own activations, evaluated by its own thread
+    struct Worker
+    {
+        ComputationNetworkPtr m_net;
+        std::vector<ComputationNodeBasePtr> m_inputNodes;
+        std::vector<ComputationNodeBasePtr> m_outputNodes;
+        std::thread m_thread;
+    };
+
+    ConfigParameters m_config;
+    DEVICEID_TYPE m_deviceId;
+    ComputationNetworkPtr m_net; // the instance that owns the parameters
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<size_t> m_inputDims;
+    std::vector<size_t> m_outputDims;
+
+    size_t m_numWorkers;
+    size_t m_maxBatchSize;
+    size_t m_numCPUThreads; // OpenMP threads per worker (read in Init(), the workers do not access m_config)
+    Clock::duration m_maxBatchLatency;
+
+    std::mutex m_mutex; // protects everything below
+    std::condition_variable m_requestSignal;
+    std::deque<Request*> m_requests;
+    bool m_shutdown;
+
+    void StopWorkers();
+    void WorkerLoop(Worker& worker);
+    void EvaluateBatch(Worker& worker, const std::vector<Request*>& batch);
+
+public:
+    CNTKEvalConcurrent()
+        : m_deviceId(CPUDEVICE), m_numWorkers(1), m_maxBatchSize(1), m_numCPUThreads(1), m_shutdown(false)
+    {
+    }
+
+    virtual void Init(const std::string& config);
+    virtual void Destroy();
+
+    virtual void LoadModel(const std::wstring& modelFileName);
+    virtual void GetNodeDimensions(std::map<std::wstring, size_t>& dimensions, NodeGroup nodeGroup);
+    virtual void StartEvaluateMinibatchLoop(const std::vector<std::wstring>& inputNodeNames, const std::vector<std::wstring>& outputNodeNames);
+    virtual void Evaluate(const ElemType* const* inputs, ElemType* const* outputs, size_t numSamples);
+};
+} } }
@@ -24,8 +24,10 @@
 #ifdef _WIN32
 #define NOMINMAX
 #include "Windows.h"
+#include <intrin.h> // for SSE/AVX intrinsics used by TensorOp
 #else
 #include <cfloat>
+#include <x86intrin.h>
 #endif
 
 #ifdef LEAKDETECT
@@ -125,6 +127,7 @@ void CPUMatrix<ElemType>::ZeroInit()
     m_matrixName = NULL;
     m_format = matrixFormatDense;
     m_externalBuffer = false;
+    m_mappedFile.reset();
 }
 
 template <class ElemType>
@@ -208,6 +211,7 @@ CPUMatrix<ElemType>::CPUMatrix(CPUMatrix<ElemType>&& moveFrom)
     m_matrixName = moveFrom.m_matrixName;
     m_format = moveFrom.m_format;
     m_externalBuffer = moveFrom.m_externalBuffer;
+    m_mappedFile = std::move(moveFrom.m_mappedFile);
     // release the pointer from the source object so that the destructor won't release it twice
     moveFrom.ZeroInit();
 }
@@ -228,6 +232,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::operator=(CPUMatrix<ElemType>&& moveFr
         m_pArray = moveFrom.m_pArray;
         m_format = moveFrom.m_format;
         m_externalBuffer = moveFrom.m_externalBuffer;
+        m_mappedFile = std::move(moveFrom.m_mappedFile);
 
         // release the pointer from the source object so that the destructor won't release it twice
         moveFrom.ZeroInit();
@@ -255,6 +260,31 @@ void CPUMatrix<ElemType>::Clear()
     ZeroInit();
 }
 
+template <class ElemType>
+void CPUMatrix<ElemType>::MakeWritable()
+{
+    if (!IsMapped())
+        return;
+    ElemType* pArray = IsEmpty() ? nullptr : NewArray<ElemType>(GetNumElements());
+    if (pArray)
+        memcpy(pArray, m_pArray, GetNumElements() * sizeof(ElemType));
+    m_pArray = pArray;
+    m_elemSizeAllocated = GetNumElements();
+    m_externalBuffer = false;
+    m_mappedFile.reset();
+}
+
+template <class ElemType>
+void CPUMatrix<ElemType>::ReleaseMappedFile()
+{
+    if (!IsMapped())
+        return;
+    m_pArray = IsEmpty() ? nullptr : NewArray<ElemType>(GetNumElements());
+    m_elemSizeAllocated = GetNumElements();
+    m_externalBuffer = false;
+    m_mappedFile.reset();
+}
+
 #pragma endregion Constructors and Destructor
 
 #pragma region Basic Operators
@@ -694,6 +724,7 @@ void CPUMatrix<ElemType>::SetValue(const ElemType v)
 {
     if (IsEmpty())
         LogicError("SetValue: Matrix is empty.");
+    ReleaseMappedFile();
     bool isFinite = std::numeric_limits<ElemType>::is_integer || std::isfinite((double) v);
     if (isFinite && v == 0)
     {
@@ -834,6 +865,7 @@ void CPUMatrix<ElemType>::SetValue(const CPUMatrix<ElemType>& deepCopyFrom)
     if (this == &deepCopyFrom)
         return;
 
+    ReleaseMappedFile();
     Resize(deepCopyFrom.GetNumRows(), deepCopyFrom.GetNumCols());
     memcpy(m_pArray, deepCopyFrom.m_pArray, deepCopyFrom.GetNumElements() * sizeof(ElemType));
 }
@@ -851,10 +883,11 @@ void CPUMatrix<ElemType>::SetValue(const size_t numRows, const size_t numCols, E
     if (matrixFlags & matrixFlagDontOwnBuffer)
     {
         // free previous array allocation if any before overwriting
-        if (m_pArray != nullptr)
+        if (m_pArray != nullptr && OwnBuffer())
             delete[] m_pArray;
 
         m_pArray = pArray;
+        m_mappedFile.reset(); // (ReadMappable() sets it after this)
         m_numRows = numRows;
         m_numCols = numCols;
         m_elemSizeAllocated = GetNumElements();
@@ -862,6 +895,7 @@ void CPUMatrix<ElemType>::SetValue(const size_t numRows, const size_t numCols, E
     }
     else
     {
+        ReleaseMappedFile();
         Resize(numRows, numCols);
 
         if (IsEmpty())
@@ -909,6 +943,47 @@ void CPUMatrix<ElemType>::SetValue(const size_t numRows, const size_t numCols, E
     }
 }
 
+template <class ElemType>
+void CPUMatrix<ElemType>::ReadMappable(File& stream)
+{
+    stream.GetMarker(fileMarkerBeginSection, std::wstring(L"BMAP"));
+    size_t elsize;
+    stream >> elsize;
+    if (sizeof(ElemType) != elsize)
+        RuntimeError("Template argument size doesn't match those in file");
+    std::wstring matrixName;
+    size_t numRows, numCols;
+    stream >> matrixName >> numRows >> numCols;
+    const size_t numBytes = numRows * numCols * sizeof(ElemType);
+    if (stream.IsMapped())
+    {
+        ElemType* pArray = (ElemType*) stream.ReadMappableBlob(numBytes, nullptr);
+        Clear(); // (releases our buffer if we own it; SetValue() would delete it regardless)
+        SetValue(numRows, numCols, pArray, matrixFlagDontOwnBuffer);
+        m_mappedFile = stream.GetMapping(); // keeps the mapping alive as long as we refer to it
+    }
+    else
+    {
+        if (!OwnBuffer())
+            Clear();
+        Resize(numRows, numCols);
+        stream.ReadMappableBlob(numBytes, m_pArray);
+    }
+    stream.GetMarker(fileMarkerEndSection, std::wstring(L"EMAP"));
+    SetMatrixName(matrixName.c_str());
+}
+
+template <class ElemType>
+void CPUMatrix<ElemType>::WriteMappable(File& stream) const
+{
+    stream.PutMarker(fileMarkerBeginSection, std::wstring(L"BMAP"));
+    stream << sizeof(ElemType);
+    stream << ((m_matrixName == NULL) ? std::wstring(L"unnamed") : std::wstring(m_matrixName));
+    stream << m_numRows << m_numCols;
+    stream.WriteMappableBlob(m_pArray, GetNumElements() * sizeof(ElemType));
+    stream.PutMarker(fileMarkerEndSection, std::wstring(L"EMAP"));
+}
+
 template <class ElemType>
 void CPUMatrix<ElemType>::SetDiagonalValue(const ElemType v)
 {
@@ -999,6 +1074,7 @@ void CPUMatrix<ElemType>::SetUniformRandomValue(const ElemType low, const ElemTy
 {
     if (IsEmpty())
         LogicError("SetUniformRandomValue: Matrix is empty.");
+    ReleaseMappedFile();
 
 #ifdef _MSC_VER // TODO: check if available under GCC/Linux
     std::ranlux64_base_01 generator;
@@ -1032,6 +1108,7 @@ void CPUMatrix<ElemType>::SetGaussianRandomValue(const ElemType mean, const Elem
 
     if (IsEmpty())
         LogicError("SetUniformRandomValue: Matrix is empty.");
+    ReleaseMappedFile();
 
     auto& us = *this;
 #ifdef _MSC_VER // TODO: check if available under GCC/Linux
@@ -1056,6 +1133,7 @@ void CPUMatrix<ElemType>::AddGaussianRandomValue(const ElemType mean, const Elem
 
     if (IsEmpty())
         LogicError("SetUniformRandomValue: Matrix is empty.");
+    MakeWritable();
 
     auto& us = *this;
 #ifdef _MSC_VER // TODO: check if available under GCC/Linux
@@ -1428,10 +1506,15 @@ size_t CPUMatrix<ElemType>::CopyToArray(ElemType*& arrayCopyTo, size_t& currentA
 }
 
 template <typename ElemType>
-void CPUMatrix<ElemType>::CopySection(size_t /*numRows*/, size_t /*numCols*/, ElemType* /*dst*/, size_t /*colStride*/) const
+void CPUMatrix<ElemType>::CopySection(size_t numRows, size_t numCols, ElemType* dst, size_t colStride) const
 {
-    // REVIEW alexeyk: currently not used by CPU, but implement when possible.
-    RuntimeError("Not implemented.");
+    if (numRows > m_numRows || numCols > m_numCols || numRows > colStride)
+        InvalidArgument("CopySection: The section [%d x %d] does not fit the matrix [%d x %d] or the destination column stride %d.",
+                        (int) numRows, (int) numCols, (int) m_numRows, (int) m_numCols, (int) colStride);
+
+#pragma omp parallel for
+    for (long j = 0; j < (long) numCols; j++)
+        memcpy(dst + j * colStride, m_pArray + LocateColumn(j), sizeof(ElemType) * numRows);
 }
 
 template <class ElemType>
@@ -5288,72 +5371,153 @@ ElemType CPUMatrix<ElemType>::LogAddSumOfElements() const
     return fAlpha;
 }
 
+// -----------------------------------------------------------------------
+// RCRF
+// The kernels below process one sequence on the raw columns of the
+// [numLabels x numColumns] label, score, alpha and beta matrices. Their inner
+// loops run over contiguous columns (of alpha, beta and pair_scores), and the
+// log normalizers of the transitions into each label are computed once per
+// time step instead of once per label and time step. Each log-sum still adds
+// up its terms in the same order as the former label-by-label implementation,
+// so the results are identical to it.
+// -----------------------------------------------------------------------
+
+// LogAdd() as computed by Matrix<ElemType>::LogAdd(), which the forward pass has always used
 template <class ElemType>
-void CPUMatrix<ElemType>::RCRFBackwardCompute(const CPUMatrix<ElemType>& alpha, CPUMatrix<ElemType>& beta,
-                                              const CPUMatrix<ElemType>& lbls,
-                                              const CPUMatrix<ElemType>& pair_scores)
+static inline ElemType RCRFLogAdd(ElemType x, ElemType y)
 {
-    int iNumPos = (int) lbls.GetNumCols();
-    int iNumLab = (int) lbls.GetNumRows();
-
-    int lastLbl = -1;
-    for (int ik = 0; ik < lbls.GetNumRows(); ik++)
-        if (lbls(ik, iNumPos - 1) != 0)
-        {
-            lastLbl = ik;
-            break;
-        }
+    if (x < y)
+        std::swap(x, y);
+    ElemType diff = y - x;
+    if (diff < MINLOGEXP)
+        return (ElemType)((x < LSMALL) ? LZERO : x);
+    ElemType z = exp(diff);
+    return (ElemType)(x + log(1.0 + z));
+}
 
-    beta.Resize(iNumLab, iNumPos);
+static inline size_t RCRFColumn(const RCRFSequence& seq, size_t t)
+{
+    return seq.firstColumn + t * seq.columnStride;
+}
 
-    for (int t = iNumPos - 1; t >= 0; t--)
+// determine the label index (first non-zero row) of the columns of all sequences; -1 for no label
+// Training needs the labels of all time steps, decoding only those of the first and last one.
+template <class ElemType>
+static void RCRFGetLabels(const CPUMatrix<ElemType>& lbls, const std::vector<RCRFSequence>& sequences, std::vector<int>& labels, bool allTimeSteps)
+{
+    const size_t numLabels = lbls.GetNumRows();
+    labels.assign(lbls.GetNumCols(), -1);
+    for (const auto& seq : sequences)
     {
-#pragma omp parallel for
-        for (int k = 0; k < iNumLab; k++)
+        if (seq.numSteps == 0 || RCRFColumn(seq, seq.numSteps - 1) >= lbls.GetNumCols())
+            InvalidArgument("RCRF: Sequence at column %d is empty or exceeds the minibatch.", (int) seq.firstColumn);
+        for (size_t t = 0; t < seq.numSteps; t++)
         {
-            _rcrfBackwardCompute(t, k, alpha, beta, pair_scores);
+            if (!allTimeSteps && t != 0 && t != seq.numSteps - 1)
+                continue;
+            const size_t j = RCRFColumn(seq, t);
+            const ElemType* lbl = lbls.BufferPointer() + j * numLabels;
+            for (size_t k = 0; k < numLabels; k++)
+            {
+                if (lbl[k] != 0)
+                {
+                    labels[j] = (int) k;
+                    break;
+                }
+            }
+            if (labels[j] < 0)
+                InvalidArgument("RCRF: Column %d of the labels has no label.", (int) j);
         }
     }
-};
+}
 
-/// the kernel function for RCRF backward computation
+// alpha(k,t) = log sum_j exp(alpha(j,t-1) + pair_scores(k,j)) + pos_scores(k,t), where alpha(j,-1) is 0 for the first label and LZERO otherwise
 template <class ElemType>
-void CPUMatrix<ElemType>::_rcrfBackwardCompute(size_t t, size_t k, const CPUMatrix<ElemType>& alpha,
-                                               CPUMatrix<ElemType>& beta,
-                                               const CPUMatrix<ElemType>& pair_scores)
+static void RCRFForwardSequence(const ElemType* pos, const ElemType* pair, ElemType* alpha, const size_t numLabels, const RCRFSequence& seq, const int firstLbl)
 {
-    size_t iNumLab = alpha.GetNumRows();
-    size_t iNumPos = alpha.GetNumCols();
-
-    ElemType fSum;
-    ElemType fTmp = (ElemType) LZERO;
-    if (t == iNumPos - 1)
+    for (size_t t = 0; t < seq.numSteps; t++)
     {
-        fSum = (ElemType) LZERO;
-        for (int j = 0; j < iNumLab; j++)
+        ElemType* a = alpha + RCRFColumn(seq, t) * numLabels;
+        const ElemType* aPrev = t > 0 ? alpha + RCRFColumn(seq, t - 1) * numLabels : nullptr;
+        for (size_t k = 0; k < numLabels; k++)
+            a[k] = (ElemType) LZERO;
+        for (size_t j = 0; j < numLabels; j++)
         {
-            fSum = (ElemType) LogAddD(fSum, alpha(j, t));
+            const ElemType fAlpha = aPrev ? aPrev[j] : ((int) j == firstLbl) ? (ElemType) 0.0 : (ElemType) LZERO;
+            const ElemType* pairj = pair + j * numLabels; // pair_scores(., j)
+            for (size_t k = 0; k < numLabels; k++)
+                a[k] = RCRFLogAdd(a[k], fAlpha + pairj[k]);
         }
+        const ElemType* p = pos + RCRFColumn(seq, t) * numLabels;
+        for (size_t k = 0; k < numLabels; k++)
+            a[k] += p[k];
+    }
+}
 
-        fTmp = alpha(k, t) - fSum;
-        beta(k, t) = fTmp;
+// zeta(j) = log sum_m exp(aPrev(m) + pair_scores(j,m)), the log normalizer of the transitions into label j
+template <class ElemType>
+static void RCRFNormalizers(const ElemType* aPrev, const ElemType* pair, const size_t numLabels, ElemType* zeta)
+{
+    for (size_t j = 0; j < numLabels; j++)
+        zeta[j] = (ElemType) LZERO;
+    for (size_t m = 0; m < numLabels; m++)
+    {
+        const ElemType* pairm = pair + m * numLabels; // pair_scores(., m)
+        for (size_t j = 0; j < numLabels; j++)
+            zeta[j] = (ElemType) LogAddD(zeta[j], aPrev[m] + pairm[j]);
     }
-    else
+}
+
+// beta(k,t) = log sum_j exp(beta(j,t+1) + alpha(k,t) + pair_scores(j,k) - zeta_t(j)), starting from the normalized last alpha column
+// Returns the log partition function, log sum_k exp(alpha(k,T-1)).
+template <class ElemType>
+static ElemType RCRFBackwardSequence(const ElemType* alpha, ElemType* beta, const ElemType* pair, const size_t numLabels, const RCRFSequence& seq, ElemType* zeta)
+{
+    const size_t T = seq.numSteps;
+    const ElemType* aLast = alpha + RCRFColumn(seq, T - 1) * numLabels;
+    ElemType* bLast = beta + RCRFColumn(seq, T - 1) * numLabels;
+    ElemType fSum = (ElemType) LZERO;
+    for (size_t j = 0; j < numLabels; j++)
+        fSum = (ElemType) LogAddD(fSum, aLast[j]);
+    for (size_t k = 0; k < numLabels; k++)
+        bLast[k] = aLast[k] - fSum;
+
+    for (size_t t = T - 1; t-- > 0;)
     {
-        for (int j = 0; j < iNumLab; j++)
+        const ElemType* a = alpha + RCRFColumn(seq, t) * numLabels;
+        const ElemType* bNext = beta + RCRFColumn(seq, t + 1) * numLabels;
+        ElemType* b = beta + RCRFColumn(seq, t) * numLabels;
+        RCRFNormalizers(a, pair, numLabels, zeta);
+        for (size_t k = 0; k < numLabels; k++)
         {
-            fSum = (ElemType) LZERO;
-            for (int m = 0; m < iNumLab; m++)
-            {
-                fSum = (ElemType) LogAddD(fSum, alpha(m, t) + pair_scores(j, m));
-            }
-
-            fTmp = (ElemType) LogAddD(fTmp, beta(j, t + 1) + alpha(k, t) + pair_scores(j, k) - fSum);
+            const ElemType* pairk = pair + k * numLabels; // pair_scores(., k)
+            ElemType fTmp = (ElemType) LZERO;
+            for (size_t j = 0; j < numLabels; j++)
+                fTmp = (ElemType) LogAddD(fTmp, bNext[j] + a[k] + pairk[j] - zeta[j]);
+            b[k] = fTmp;
         }
-        beta(k, t) = fTmp;
     }
+    return fSum;
 }
 
+template <class ElemType>
+void CPUMatrix<ElemType>::RCRFBackwardCompute(const CPUMatrix<ElemType>& alpha, CPUMatrix<ElemType>& beta,
+                                              const CPUMatrix<ElemType>& lbls,
+                                              const CPUMatrix<ElemType>& pair_scores)
+{
+    const size_t iNumPos = lbls.GetNumCols();
+    const size_t iNumLab = lbls.GetNumRows();
+    if (alpha.GetNumRows() != iNumLab || alpha.GetNumCols() != iNumPos || pair_scores.GetNumRows() != iNumLab || pair_scores.GetNumCols() != iNumLab)
+        LogicError("RCRFBackwardCompute: The dimensions of the label, alpha and transition score matrices do not match.");
+
+    beta.Resize(iNumLab, iNumPos);
+    if (iNumPos == 0)
+        return;
+
+    std::vector<ElemType> zeta(iNumLab);
+    RCRFBackwardSequence(alpha.m_pArray, beta.m_pArray, pair_scores.m_pArray, iNumLab, RCRFSequence{0, iNumPos, 1}, zeta.data());
+};
+
 template <class ElemType>
 void CPUMatrix<ElemType>::RCRFTransGrdCompute(const CPUMatrix<ElemType>& lbls,
                                               const CPUMatrix<ElemType>& alpha,
@@ -5361,133 +5525,402 @@ void CPUMatrix<ElemType>::RCRFTransGrdCompute(const CPUMatrix<ElemType>& lbls,
                                               const CPUMatrix<ElemType>& pair_scores,
                                               CPUMatrix<ElemType>& grd)
 {
-    int iNumPos = (int) alpha.GetNumCols();
-    int iNumLab = (int) alpha.GetNumRows();
+    RCRFTransGrdCompute(lbls, alpha, beta, pair_scores, grd, std::vector<RCRFSequence>(1, RCRFSequence{0, lbls.GetNumCols(), 1}));
+};
 
-    int firstLbl = -1;
-    for (int ik = 0; ik < lbls.GetNumRows(); ik++)
-        if (lbls(ik, 0) != 0)
-        {
-            firstLbl = ik;
-            break;
-        }
+// forward-backward of all sequences; alpha, beta and postprob = exp(beta) are computed for the columns of the sequences only
+template <class ElemType>
+ElemType CPUMatrix<ElemType>::RCRFForwardBackward(const CPUMatrix<ElemType>& lbls, const CPUMatrix<ElemType>& pos_scores, const CPUMatrix<ElemType>& pair_scores,
+                                                  CPUMatrix<ElemType>& alpha, CPUMatrix<ElemType>& beta, CPUMatrix<ElemType>& postprob,
+                                                  const std::vector<RCRFSequence>& sequences)
+{
+    const size_t numLabels = lbls.GetNumRows();
+    const size_t numCols = lbls.GetNumCols();
+    if (pos_scores.GetNumRows() != numLabels || pos_scores.GetNumCols() != numCols || pair_scores.GetNumRows() != numLabels || pair_scores.GetNumCols() != numLabels)
+        LogicError("RCRFForwardBackward: The dimensions of the label, score and transition score matrices do not match.");
 
-    for (size_t tPos = 0; tPos < iNumPos; tPos++)
+    std::vector<int> labels;
+    RCRFGetLabels(lbls, sequences, labels, true);
+
+    alpha.Resize(numLabels, numCols);
+    beta.Resize(numLabels, numCols);
+    postprob.Resize(numLabels, numCols);
+
+    std::vector<ElemType> scores(sequences.size());
+#pragma omp parallel for schedule(dynamic, 1) if (sequences.size() > 1)
+    for (long s = 0; s < (long) sequences.size(); s++)
     {
-        CPUMatrix<ElemType> b = beta.ColumnSlice(tPos, 1);
-        CPUMatrix<ElemType> a;
-        if (tPos > 0)
-            a = alpha.ColumnSlice(tPos - 1, 1);
+        const RCRFSequence& seq = sequences[s];
+        std::vector<ElemType> zeta(numLabels);
+        RCRFForwardSequence(pos_scores.m_pArray, pair_scores.m_pArray, alpha.m_pArray, numLabels, seq, labels[RCRFColumn(seq, 0)]);
+        const ElemType fAlpha = RCRFBackwardSequence(alpha.m_pArray, beta.m_pArray, pair_scores.m_pArray, numLabels, seq, zeta.data());
 
-#pragma omp parallel for
-        for (int i = 0; i < iNumLab; i++)
+        // score of the labeled path (position dependent and transition scores), reduced by the scores of all paths
+        ElemType lscore = 0;
+        ElemType tscore = 0;
+        for (size_t t = 0; t < seq.numSteps; t++)
         {
-            _rcrfTransGrdCompute(i, lbls, alpha, beta, pair_scores, grd, tPos);
+            const size_t j = RCRFColumn(seq, t);
+            const ElemType* lbl = lbls.m_pArray + j * numLabels;
+            const ElemType* pos = pos_scores.m_pArray + j * numLabels;
+            const ElemType* b = beta.m_pArray + j * numLabels;
+            ElemType* p = postprob.m_pArray + j * numLabels;
+            for (size_t k = 0; k < numLabels; k++)
+            {
+                lscore += lbl[k] * pos[k];
+                p[k] = exp(b[k]);
+            }
+            if (t > 0)
+                tscore += pair_scores(labels[j], labels[RCRFColumn(seq, t - 1)]);
         }
+        tscore += lscore;
+        tscore -= fAlpha;
+        scores[s] = -tscore;
+    }
 
-        // transition score
-        int i = -1;
-        if (tPos == 0)
-            i = firstLbl;
-        else
+    ElemType sum = 0;
+    for (const auto& score : scores) // (in sequence order, for reproducible results)
+        sum += score;
+    return sum;
+}
+
+// gradient of the summed negative log likelihoods w.r.t. the transition scores, added to grd
+// The normalizers are computed per sequence in parallel; the accumulation then runs in parallel over the columns of grd.
+template <class ElemType>
+void CPUMatrix<ElemType>::RCRFTransGrdCompute(const CPUMatrix<ElemType>& lbls, const CPUMatrix<ElemType>& alpha, const CPUMatrix<ElemType>& beta,
+                                              const CPUMatrix<ElemType>& pair_scores, CPUMatrix<ElemType>& grd,
+                                              const std::vector<RCRFSequence>& sequences)
+{
+    const size_t numLabels = lbls.GetNumRows();
+    const size_t numCols = lbls.GetNumCols();
+    if (alpha.GetNumRows() != numLabels || alpha.GetNumCols() != numCols || beta.GetNumRows() != numLabels || beta.GetNumCols() != numCols ||
+        pair_scores.GetNumRows() != numLabels || pair_scores.GetNumCols() != numLabels || grd.GetNumRows() != numLabels || grd.GetNumCols() != numLabels)
+        LogicError("RCRFTransGrdCompute: The dimensions of the label, alpha, beta and transition score matrices do not match.");
+
+    std::vector<int> labels;
+    RCRFGetLabels(lbls, sequences, labels, true);
+
+    // zeta(., j) = normalizers of the transitions into column j, from the previous column (or the start label)
+    std::vector<ElemType> zeta(numLabels * numCols);
+#pragma omp parallel for schedule(dynamic, 1) if (sequences.size() > 1)
+    for (long s = 0; s < (long) sequences.size(); s++)
+    {
+        const RCRFSequence& seq = sequences[s];
+        std::vector<ElemType> start(numLabels, (ElemType) LZERO);
+        start[labels[RCRFColumn(seq, 0)]] = 0;
+        for (size_t t = 0; t < seq.numSteps; t++)
         {
-            for (int ik = 0; ik < lbls.GetNumRows(); ik++)
-                if (lbls(ik, tPos - 1) != 0)
-                {
-                    i = ik;
-                    break;
-                }
+            const ElemType* aPrev = t > 0 ? alpha.m_pArray + RCRFColumn(seq, t - 1) * numLabels : start.data();
+            RCRFNormalizers(aPrev, pair_scores.m_pArray, numLabels, zeta.data() + RCRFColumn(seq, t) * numLabels);
         }
+    }
 
-        int j = -1;
-        for (int ik = 0; ik < lbls.GetNumRows(); ik++)
+#pragma omp parallel for
+    for (long i = 0; i < (long) numLabels; i++)
+    {
+        ElemType* g = grd.m_pArray + i * numLabels;                  // grd(., i)
+        const ElemType* pairi = pair_scores.m_pArray + i * numLabels; // pair_scores(., i)
+        for (const auto& seq : sequences)
         {
-            if (lbls(ik, tPos) != 0)
+            const int firstLbl = labels[RCRFColumn(seq, 0)];
+            for (size_t t = 0; t < seq.numSteps; t++)
             {
-                j = ik;
-                break;
+                const size_t j = RCRFColumn(seq, t);
+                const ElemType aPrev = t > 0 ? alpha(i, RCRFColumn(seq, t - 1)) : (i == firstLbl) ? (ElemType) 0 : (ElemType) LZERO;
+                const ElemType* z = zeta.data() + j * numLabels;
+                const ElemType* b = beta.m_pArray + j * numLabels;
+                for (size_t k = 0; k < numLabels; k++)
+                {
+                    ElemType fTmp = aPrev;
+                    fTmp += pairi[k];
+                    fTmp -= z[k];
+                    fTmp += b[k];
+                    g[k] += exp(fTmp);
+                }
+
+                // transition of the labeled path
+                const int prevLbl = t > 0 ? labels[RCRFColumn(seq, t - 1)] : firstLbl;
+                if (prevLbl == i)
+                    g[labels[j]] -= 1.0;
             }
         }
-
-        grd(j, i) -= 1.0;
     }
-};
+}
 
+// Viterbi decoding of all sequences, matching the CRF training. The first and last label of a sequence are
+// constrained to the labels given in its first and last column. decodedPath receives the one-hot best path.
 template <class ElemType>
-void CPUMatrix<ElemType>::_rcrfTransGrdCompute(size_t i,
-                                               const CPUMatrix<ElemType>& lbls,
-                                               const CPUMatrix<ElemType>& alpha,
-                                               const CPUMatrix<ElemType>& beta,
-                                               const CPUMatrix<ElemType>& pair_scores,
-                                               CPUMatrix<ElemType>& grd,
-                                               const size_t tPos // position
-                                               )
+void CPUMatrix<ElemType>::RCRFViterbi(const CPUMatrix<ElemType>& lbls, const CPUMatrix<ElemType>& pos_scores, const CPUMatrix<ElemType>& pair_scores,
+                                      CPUMatrix<ElemType>& decodedPath, const std::vector<RCRFSequence>& sequences)
 {
-    int iNumLab = (int) alpha.GetNumRows();
+    const size_t numLabels = lbls.GetNumRows();
+    const size_t numCols = lbls.GetNumCols();
+    if (pos_scores.GetNumRows() != numLabels || pos_scores.GetNumCols() != numCols || pair_scores.GetNumRows() != numLabels || pair_scores.GetNumCols() != numLabels)
+        LogicError("RCRFViterbi: The dimensions of the label, score and transition score matrices do not match.");
 
-    int firstLbl = -1;
-    for (int ik = 0; ik < lbls.GetNumRows(); ik++)
-        if (lbls(ik, 0) != 0)
-        {
-            firstLbl = ik;
-            break;
-        }
+    std::vector<int> labels;
+    RCRFGetLabels(lbls, sequences, labels, false);
 
-    CPUMatrix<ElemType> b = beta.ColumnSlice(tPos, 1);
-    CPUMatrix<ElemType> a;
-    if (tPos > 0)
-        a = alpha.ColumnSlice(tPos - 1, 1);
+    decodedPath.Resize(numLabels, numCols);
 
+#pragma omp parallel for schedule(dynamic, 1) if (sequences.size() > 1)
+    for (long s = 0; s < (long) sequences.size(); s++)
     {
-        ElemType fTmp = (ElemType) LZERO;
-        for (int j = 0; j < iNumLab; j++)
+        const RCRFSequence& seq = sequences[s];
+        const size_t T = seq.numSteps;
+        const int stt = labels[RCRFColumn(seq, 0)];
+        const int stp = labels[RCRFColumn(seq, T - 1)];
+        std::vector<ElemType> alpha(numLabels * T);
+        std::vector<int> backtrace(numLabels * T, stt);
+
+        const ElemType* pos = pos_scores.m_pArray + RCRFColumn(seq, 0) * numLabels;
+        for (size_t k = 0; k < numLabels; k++)
+            alpha[k] = ((int) k == stt) ? pos[k] : (ElemType) LZERO;
+        if (T > 1)
         {
-            if (tPos == 0)
+            pos = pos_scores.m_pArray + RCRFColumn(seq, 1) * numLabels;
+            const ElemType* pairstt = pair_scores.m_pArray + stt * numLabels; // pair_scores(., stt)
+            for (size_t k = 0; k < numLabels; k++)
             {
-                if (i == firstLbl)
-                {
-                    fTmp = 0;
-                }
-                else
-                {
-                    fTmp = (ElemType) LZERO;
-                }
+                ElemType fTmp = alpha[stt];
+                fTmp += pairstt[k];
+                fTmp += pos[k];
+                alpha[numLabels + k] = fTmp;
             }
-            else
+        }
+
+        int iTmp = stt; // a label without a predecessor scoring above LZERO inherits the backpointer of the label before it
+        for (size_t t = 2; t < T; t++)
+        {
+            const ElemType* aPrev = alpha.data() + (t - 1) * numLabels;
+            ElemType* a = alpha.data() + t * numLabels;
+            int* bt = backtrace.data() + t * numLabels;
+            for (size_t k = 0; k < numLabels; k++)
             {
-                fTmp = a(i, 0);
+                a[k] = (ElemType) LZERO;
+                bt[k] = -1;
             }
-            fTmp += pair_scores(j, i);
-
-            ElemType fSum = (ElemType) LZERO;
-            for (int k = 0; k < iNumLab; k++)
+            for (size_t j = 0; j < numLabels; j++)
             {
-                ElemType fTmp2;
-                if (tPos == 0)
+                const ElemType* pairj = pair_scores.m_pArray + j * numLabels; // pair_scores(., j)
+                for (size_t k = 0; k < numLabels; k++)
                 {
-                    if (k == firstLbl)
+                    const ElemType fAlpha = aPrev[j] + pairj[k];
+                    if (fAlpha > a[k])
                     {
-                        fTmp2 = 0;
-                    }
-                    else
-                    {
-                        fTmp2 = (ElemType) LZERO;
+                        a[k] = fAlpha;
+                        bt[k] = (int) j;
                     }
                 }
-                else
-                {
-                    fTmp2 = a(k, 0);
-                }
-                fSum = (ElemType) LogAddD(fSum, fTmp2 + pair_scores(j, k));
             }
+            pos = pos_scores.m_pArray + RCRFColumn(seq, t) * numLabels;
+            for (size_t k = 0; k < numLabels; k++)
+            {
+                if (bt[k] < 0)
+                    bt[k] = iTmp;
+                iTmp = bt[k];
+                a[k] += pos[k];
+            }
+        }
 
-            fTmp -= fSum;
-            fTmp += b(j, 0);
+        // trace back the best path ending in the last label
+        int lastlbl = stp;
+        for (size_t t = T; t-- > 0;)
+        {
+            ElemType* path = decodedPath.m_pArray + RCRFColumn(seq, t) * numLabels;
+            for (size_t k = 0; k < numLabels; k++)
+                path[k] = 0;
+            path[lastlbl] = 1;
+            lastlbl = backtrace[t * numLabels + lastlbl];
+        }
+    }
+}
+
+// -----------------------------------------------------------------------
+// fused LSTM/GRU cells
+// One call processes one time step of all parallel sequences. The gate
+// pre-activations (input projection + recurrent projection + bias) have
+// already been computed by the caller with one GEMM each.
+// -----------------------------------------------------------------------
 
-            grd(j, i) += exp(fTmp);
+// gates: [4H x S] in: pre-activations of the input, forget, cell and output gate (stacked in this order)
+//                 out: the gate activations, which are needed by LSTMCellBackward()
+// peepholes: [H x 3] diagonal peephole weights of the input, forget and output gate
+// cPrev: [H x S] cell state of the previous step; c, h: [H x S] new cell state and output
+template <class ElemType>
+void CPUMatrix<ElemType>::LSTMCellForward(CPUMatrix<ElemType>& gates, const CPUMatrix<ElemType>& peepholes,
+                                          const CPUMatrix<ElemType>& cPrev, CPUMatrix<ElemType>& c, CPUMatrix<ElemType>& h)
+{
+    const long H = (long) c.GetNumRows();
+    const long S = (long) c.GetNumCols();
+    if (gates.GetNumRows() != 4 * H || gates.GetNumCols() != S || cPrev.GetNumRows() != H || cPrev.GetNumCols() != S ||
+        h.GetNumRows() != H || h.GetNumCols() != S || peepholes.GetNumRows() != H || peepholes.GetNumCols() != 3)
+        LogicError("LSTMCellForward: The dimensions of the gates, peephole and state matrices do not match.");
+
+    const ElemType* pi = peepholes.m_pArray;
+    const ElemType* pf = pi + H;
+    const ElemType* po = pf + H;
+
+#pragma omp parallel for if (H * S >= 4096)
+    for (long j = 0; j < S; j++)
+    {
+        ElemType* g = gates.m_pArray + 4 * H * j;
+        const ElemType* cp = cPrev.m_pArray + H * j;
+        ElemType* cc = c.m_pArray + H * j;
+        ElemType* hh = h.m_pArray + H * j;
+        for (long r = 0; r < H; r++)
+        {
+            ElemType it = Sigmoid(g[r] + pi[r] * cp[r]);
+            ElemType ft = Sigmoid(g[H + r] + pf[r] * cp[r]);
+            ElemType gt = tanh_(g[2 * H + r]);
+            ElemType ct = ft * cp[r] + it * gt;
+            ElemType ot = Sigmoid(g[3 * H + r] + po[r] * ct);
+            g[r] = it;
+            g[H + r] = ft;
+            g[2 * H + r] = gt;
+            g[3 * H + r] = ot;
+            cc[r] = ct;
+            hh[r] = ot * tanh_(ct);
+        }
+    }
+}
+
+// gates, peepholes, cPrev, c: as computed by LSTMCellForward()
+// dh: [H x S] gradient of the output h (including the gradient that flows back from the next step)
+// dc: [H x S] in: gradient of c from the next step; out: gradient of cPrev
+// dGates: [4H x S] gradient of the gate pre-activations
+// dPeepholes: [H x 3] the peephole gradient is added to this
+template <class ElemType>
+void CPUMatrix<ElemType>::LSTMCellBackward(const CPUMatrix<ElemType>& gates, const CPUMatrix<ElemType>& peepholes,
+                                           const CPUMatrix<ElemType>& cPrev, const CPUMatrix<ElemType>& c, const CPUMatrix<ElemType>& dh,
+                                           CPUMatrix<ElemType>& dc, CPUMatrix<ElemType>& dGates, CPUMatrix<ElemType>& dPeepholes)
+{
+    const long H = (long) c.GetNumRows();
+    const long S = (long) c.GetNumCols();
+    if (gates.GetNumRows() != 4 * H || gates.GetNumCols() != S || dGates.GetNumRows() != 4 * H || dGates.GetNumCols() != S ||
+        cPrev.GetNumRows() != H || cPrev.GetNumCols() != S || dh.GetNumRows() != H || dh.GetNumCols() != S ||
+        dc.GetNumRows() != H || dc.GetNumCols() != S || peepholes.GetNumRows() != H || peepholes.GetNumCols() != 3 ||
+        dPeepholes.GetNumRows() != H || dPeepholes.GetNumCols() != 3)
+        LogicError("LSTMCellBackward: The dimensions of the gates, peephole and state matrices do not match.");
+
+    const ElemType* pi = peepholes.m_pArray;
+    const ElemType* pf = pi + H;
+    const ElemType* po = pf + H;
+
+    // parallel over rows, so that each thread owns its row of the peephole gradient
+#pragma omp parallel for if (H * S >= 4096)
+    for (long r = 0; r < H; r++)
+    {
+        ElemType dpi = 0, dpf = 0, dpo = 0;
+        for (long j = 0; j < S; j++)
+        {
+            const ElemType* g = gates.m_pArray + 4 * H * j;
+            ElemType* dg = dGates.m_pArray + 4 * H * j;
+            const long k = H * j + r;
+            ElemType it = g[r], ft = g[H + r], gt = g[2 * H + r], ot = g[3 * H + r];
+            ElemType cp = cPrev.m_pArray[k];
+            ElemType ct = c.m_pArray[k];
+            ElemType tc = tanh_(ct);
+            ElemType dhv = dh.m_pArray[k];
+
+            ElemType dGo = dhv * tc * ot * (1 - ot);
+            ElemType dcv = dc.m_pArray[k] + dhv * ot * (1 - tc * tc) + dGo * po[r];
+            ElemType dGi = dcv * gt * it * (1 - it);
+            ElemType dGf = dcv * cp * ft * (1 - ft);
+            ElemType dGg = dcv * it * (1 - gt * gt);
+            dg[r] = dGi;
+            dg[H + r] = dGf;
+            dg[2 * H + r] = dGg;
+            dg[3 * H + r] = dGo;
+            dc.m_pArray[k] = dcv * ft + dGi * pi[r] + dGf * pf[r];
+
+            dpi += dGi * cp;
+            dpf += dGf * cp;
+            dpo += dGo * ct;
+        }
+        dPeepholes.m_pArray[r] += dpi;
+        dPeepholes.m_pArray[H + r] += dpf;
+        dPeepholes.m_pArray[2 * H + r] += dpo;
+    }
+}
+
+// gates: [3H x S] in: input projection (incl. bias) of the update, reset and candidate gate (stacked in this order)
+//                 out: the gate activations z, r, n
+// hiddenProj: [3H x S] recurrent projection R * hPrev (no bias); the candidate uses r .* (Rn * hPrev)
+// hPrev, h: [H x S] previous and new output
+template <class ElemType>
+void CPUMatrix<ElemType>::GRUCellForward(CPUMatrix<ElemType>& gates, const CPUMatrix<ElemType>& hiddenProj,
+                                         const CPUMatrix<ElemType>& hPrev, CPUMatrix<ElemType>& h)
+{
+    const long H = (long) h.GetNumRows();
+    const long S = (long) h.GetNumCols();
+    if (gates.GetNumRows() != 3 * H || gates.GetNumCols() != S || hiddenProj.GetNumRows() != 3 * H || hiddenProj.GetNumCols() != S ||
+        hPrev.GetNumRows() != H || hPrev.GetNumCols() != S)
+        LogicError("GRUCellForward: The dimensions of the gates and state matrices do not match.");
+
+#pragma omp parallel for if (H * S >= 4096)
+    for (long j = 0; j < S; j++)
+    {
+        ElemType* g = gates.m_pArray + 3 * H * j;
+        const ElemType* rh = hiddenProj.m_pArray + 3 * H * j;
+        const ElemType* hp = hPrev.m_pArray + H * j;
+        ElemType* hh = h.m_pArray + H * j;
+        for (long r = 0; r < H; r++)
+        {
+            ElemType zt = Sigmoid(g[r] + rh[r]);
+            ElemType rt = Sigmoid(g[H + r] + rh[H + r]);
+            ElemType nt = tanh_(g[2 * H + r] + rt * rh[2 * H + r]);
+            g[r] = zt;
+            g[H + r] = rt;
+            g[2 * H + r] = nt;
+            hh[r] = (1 - zt) * nt + zt * hp[r];
+        }
+    }
+}
+
+// gates, hiddenProj, hPrev: as used by GRUCellForward()
+// dh: [H x S] gradient of the output h (including the gradient that flows back from the next step)
+// dGates: [3H x S] gradient of the input projection; dHiddenProj: [3H x S] gradient of the recurrent projection
+// dhPrev: [H x S] the direct (non-projected) part of the gradient of hPrev
+template <class ElemType>
+void CPUMatrix<ElemType>::GRUCellBackward(const CPUMatrix<ElemType>& gates, const CPUMatrix<ElemType>& hiddenProj,
+                                          const CPUMatrix<ElemType>& hPrev, const CPUMatrix<ElemType>& dh,
+                                          CPUMatrix<ElemType>& dGates, CPUMatrix<ElemType>& dHiddenProj, CPUMatrix<ElemType>& dhPrev)
+{
+    const long H = (long) dh.GetNumRows();
+    const long S = (long) dh.GetNumCols();
+    if (gates.GetNumRows() != 3 * H || gates.GetNumCols() != S || hiddenProj.GetNumRows() != 3 * H || hiddenProj.GetNumCols() != S ||
+        dGates.GetNumRows() != 3 * H || dGates.GetNumCols() != S || dHiddenProj.GetNumRows() != 3 * H || dHiddenProj.GetNumCols() != S ||
+        hPrev.GetNumRows() != H || hPrev.GetNumCols() != S || dhPrev.GetNumRows() != H || dhPrev.GetNumCols() != S)
+        LogicError("GRUCellBackward: The dimensions of the gates and state matrices do not match.");
+
+#pragma omp parallel for if (H * S >= 4096)
+    for (long j = 0; j < S; j++)
+    {
+        const ElemType* g = gates.m_pArray + 3 * H * j;
+        const ElemType* rh = hiddenProj.m_pArray + 3 * H * j;
+        const ElemType* hp = hPrev.m_pArray + H * j;
+        const ElemType* dhh = dh.m_pArray + H * j;
+        ElemType* dg = dGates.m_pArray + 3 * H * j;
+        ElemType* drh = dHiddenProj.m_pArray + 3 * H * j;
+        ElemType* dhp = dhPrev.m_pArray + H * j;
+        for (long r = 0; r < H; r++)
+        {
+            ElemType zt = g[r], rt = g[H + r], nt = g[2 * H + r];
+            ElemType dGn = dhh[r] * (1 - zt) * (1 - nt * nt);
+            ElemType dGz = dhh[r] * (hp[r] - nt) * zt * (1 - zt);
+            ElemType dGr = dGn * rh[2 * H + r] * rt * (1 - rt);
+            dg[r] = dGz;
+            dg[H + r] = dGr;
+            dg[2 * H + r] = dGn;
+            drh[r] = dGz;
+            drh[H + r] = dGr;
+            drh[2 * H + r] = dGn * rt;
+            dhp[r] = dhh[r] * zt;
         }
     }
-};
+}
+
 template <class ElemType>
 CPUMatrix<ElemType>& CPUMatrix<ElemType>::DropFrame(const CPUMatrix<ElemType>& label, const CPUMatrix<ElemType>& gamma, const ElemType& threshhold)
 {
@@ -5558,6 +5991,50 @@ int CPUMatrix<ElemType>::SetNumThreads(int numThreads)
     return numThreads;
 }
 
+// Set the number of threads that OpenMP loops and BLAS calls started by the calling thread use, and return the previous number.
+// This is for threads that each run math at the same time, e.g. one node each, and share the cores among them.
+// Only per-thread settings are changed (OpenMP, and MKL's local setting), so concurrent threads do not affect each other.
+// ACML and OpenBLAS only have a process-wide setting, see SetNumBLASThreadsOfProcess().
+// note: this function does not depend on the <ElemType> parameter
+template <class ElemType>
+int CPUMatrix<ElemType>::SetNumThreadsOfCallingThread(int numThreads)
+{
+#ifdef _OPENMP
+    int previousNumThreads = omp_get_max_threads();
+    numThreads = std::max(numThreads, 1);
+    omp_set_num_threads(numThreads);
+#ifdef USE_MKL
+    mkl_set_num_threads_local(numThreads);
+#endif
+    return previousNumThreads;
+#else
+    numThreads;
+    return 1;
+#endif
+}
+
+// Set the number of threads of BLAS libraries that have no per-thread setting (ACML, OpenBLAS), and return the previous number.
+// This affects all threads, so it must be called once before threads that use SetNumThreadsOfCallingThread() start their math,
+// and restored once they are all done. With MKL, or without OpenMP, it does nothing.
+// note: this function does not depend on the <ElemType> parameter
+template <class ElemType>
+int CPUMatrix<ElemType>::SetNumBLASThreadsOfProcess(int numThreads)
+{
+    numThreads = std::max(numThreads, 1);
+#ifdef _OPENMP
+#ifdef USE_ACML
+    int previousNumThreads = acmlgetnumthreads();
+    acmlsetnumthreads(numThreads);
+    return previousNumThreads;
+#elif defined(USE_OPENBLAS)
+    int previousNumThreads = openblas_get_num_threads();
+    openblas_set_num_threads(numThreads);
+    return previousNumThreads;
+#endif
+#endif
+    return numThreads;
+}
+
 // =======================================================================
 // TensorView support
 // =======================================================================
@@ -5605,6 +6082,180 @@ struct TensorOpReduction<ElemType, OPFN, N, -1>
     }
 };
 
+// -----------------------------------------------------------------------
+// SIMD support for the innermost loop when all strides are 1 and there is no reduction
+// -----------------------------------------------------------------------
+
+// TensorOpPacket<ElemType> wraps the SSE or AVX intrinsics for one vector register of ElemType.
+// AVX is used if the compiler targets it (e.g. -mavx2), otherwise SSE2, which every x64 CPU has.
+template <class ElemType>
+struct TensorOpPacket;
+
+template <>
+struct TensorOpPacket<float>
+{
+#ifdef __AVX__
+    typedef __m256 Type;
+    static const size_t width = 8;
+    static inline Type Load(const float* p)      { return _mm256_loadu_ps(p); }
+    static inline void Store(float* p, Type v)   { _mm256_storeu_ps(p, v); }
+    static inline Type Set1(float f)             { return _mm256_set1_ps(f); }
+    static inline Type Zero()                    { return _mm256_setzero_ps(); }
+    static inline Type Add(Type a, Type b)       { return _mm256_add_ps(a, b); }
+    static inline Type Sub(Type a, Type b)       { return _mm256_sub_ps(a, b); }
+    static inline Type Mul(Type a, Type b)       { return _mm256_mul_ps(a, b); }
+    static inline Type Max(Type a, Type b)       { return _mm256_max_ps(a, b); }
+#else
+    typedef __m128 Type;
+    static const size_t width = 4;
+    static inline Type Load(const float* p)      { return _mm_loadu_ps(p); }
+    static inline void Store(float* p, Type v)   { _mm_storeu_ps(p, v); }
+    static inline Type Set1(float f)             { return _mm_set1_ps(f); }
+    static inline Type Zero()                    { return _mm_setzero_ps(); }
+    static inline Type Add(Type a, Type b)       { return _mm_add_ps(a, b); }
+    static inline Type Sub(Type a, Type b)       { return _mm_sub_ps(a, b); }
+    static inline Type Mul(Type a, Type b)       { return _mm_mul_ps(a, b); }
+    static inline Type Max(Type a, Type b)       { return _mm_max_ps(a, b); }
+#endif
+};
+
+template <>
+struct TensorOpPacket<double>
+{
+#ifdef __AVX__
+    typedef __m256d Type;
+    static const size_t width = 4;
+    static inline Type Load(const double* p)     { return _mm256_loadu_pd(p); }
+    static inline void Store(double* p, Type v)  { _mm256_storeu_pd(p, v); }
+    static inline Type Set1(double f)            { return _mm256_set1_pd(f); }
+    static inline Type Zero()                    { return _mm256_setzero_pd(); }
+    static inline Type Add(Type a, Type b)       { return _mm256_add_pd(a, b); }
+    static inline Type Sub(Type a, Type b)       { return _mm256_sub_pd(a, b); }
+    static inline Type Mul(Type a, Type b)       { return _mm256_mul_pd(a, b); }
+    static inline Type Max(Type a, Type b)       { return _mm256_max_pd(a, b); }
+#else
+    typedef __m128d Type;
+    static const size_t width = 2;
+    static inline Type Load(const double* p)     { return _mm_loadu_pd(p); }
+    static inline void Store(double* p, Type v)  { _mm_storeu_pd(p, v); }
+    static inline Type Set1(double f)            { return _mm_set1_pd(f); }
+    static inline Type Zero()                    { return _mm_setzero_pd(); }
+    static inline Type Add(Type a, Type b)       { return _mm_add_pd(a, b); }
+    static inline Type Sub(Type a, Type b)       { return _mm_sub_pd(a, b); }
+    static inline Type Mul(Type a, Type b)       { return _mm_mul_pd(a, b); }
+    static inline Type Max(Type a, Type b)       { return _mm_max_pd(a, b); }
+#endif
+};
+
+// TensorOpSimdFn<ElemType, op> is used instead of a lambda for the ops that have an exact SIMD equivalent.
+// operator() is the scalar version used for all non-contiguous loops and for the remainder of the contiguous ones.
+// Packet() computes 'width' results starting at offset k. Both must produce bit-identical results.
+// Note: MaxOp(a,0) is used for LinearRectifier since, like 'a > 0 ? a : 0', it returns +0 for NaN and for -0.
+template <class ElemType, ElementWiseOperator op>
+struct TensorOpSimdFn;
+
+template <typename OPFN>
+struct IsTensorOpSimdFn
+{
+    static const bool value = false;
+};
+template <class ElemType, ElementWiseOperator op>
+struct IsTensorOpSimdFn<TensorOpSimdFn<ElemType, op>>
+{
+    static const bool value = true;
+};
+
+#define DefUnarySimdFn(oper, packetExpr)                                                              \
+    template <class ElemType>                                                                         \
+    struct TensorOpSimdFn<ElemType, ElementWiseOperator::op##oper>                                    \
+    {                                                                                                 \
+        typedef TensorOpPacket<ElemType> P;                                                           \
+        inline ElemType operator()(const array<ElemType*, 2>& pp) const                               \
+        {                                                                                             \
+            return Op##oper((*(pp[0])));                                                              \
+        }                                                                                             \
+        static inline typename P::Type Packet(const array<ElemType*, 2>& pp, size_t k)                \
+        {                                                                                             \
+            typename P::Type a = P::Load(pp[0] + k);                                                  \
+            return packetExpr;                                                                        \
+        }                                                                                             \
+    }
+
+#define DefBinarySimdFn(oper, packetExpr)                                                             \
+    template <class ElemType>                                                                         \
+    struct TensorOpSimdFn<ElemType, ElementWiseOperator::op##oper>                                    \
+    {                                                                                                 \
+        typedef TensorOpPacket<ElemType> P;                                                           \
+        inline ElemType operator()(const array<ElemType*, 3>& pp) const                               \
+        {                                                                                             \
+            return Op##oper((*(pp[0])), (*(pp[1])));                                                  \
+        }                                                                                             \
+        static inline typename P::Type Packet(const array<ElemType*, 3>& pp, size_t k)                \
+        {                                                                                             \
+            typename P::Type a = P::Load(pp[0] + k);                                                  \
+            typename P::Type b = P::Load(pp[1] + k);                                                  \
+            return packetExpr;                                                                        \
+        }                                                                                             \
+    }
+
+DefUnarySimdFn(Copy, a);
+DefUnarySimdFn(LinearRectifier, P::Max(a, P::Zero()));
+DefBinarySimdFn(Sum, P::Add(a, b));
+DefBinarySimdFn(Difference, P::Sub(a, b));
+DefBinarySimdFn(ElementwiseProduct, P::Mul(a, b));
+
+#undef DefUnarySimdFn
+#undef DefBinarySimdFn
+
+// contiguous innermost loop over K elements, for any op
+// The loop body is written against raw pointers so that the compiler has a chance to auto-vectorize it.
+template <class ElemType, typename OPFN, size_t N, bool simd>
+struct TensorOpContiguousLoop
+{
+    static inline void Loop(ElemType beta, const array<ElemType*, N>& pointers, ElemType alpha, const OPFN& opfn, size_t begin, size_t K)
+    {
+        ElemType* pout = pointers.back();
+        for (size_t k = begin; k < K; k++)
+        {
+            array<ElemType*, N> pp;
+            for (size_t i = 0; i < N; i++) // N = a small constant, this will be unrolled
+                pp[i] = pointers[i] + k;
+            // same computation as TensorOpIteration<..., -1> below
+            ElemType val = opfn(pp);
+            val *= alpha;
+            if (beta != 0)
+                val += beta * pout[k];
+            pout[k] = val;
+        }
+    }
+};
+
+// contiguous innermost loop for ops with an explicit SIMD implementation
+template <class ElemType, typename OPFN, size_t N>
+struct TensorOpContiguousLoop<ElemType, OPFN, N, true /*simd*/>
+{
+    static inline void Loop(ElemType beta, const array<ElemType*, N>& pointers, ElemType alpha, const OPFN& opfn, size_t begin, size_t K)
+    {
+        typedef TensorOpPacket<ElemType> P;
+        ElemType* pout = pointers.back();
+        const typename P::Type alphaPacket = P::Set1(alpha);
+        const typename P::Type betaPacket = P::Set1(beta);
+        size_t k = begin;
+        if (beta != 0)
+        {
+            for (; k + P::width <= K; k += P::width)
+                P::Store(pout + k, P::Add(P::Mul(OPFN::Packet(pointers, k), alphaPacket), P::Mul(betaPacket, P::Load(pout + k))));
+        }
+        else
+        {
+            for (; k + P::width <= K; k += P::width)
+                P::Store(pout + k, P::Mul(OPFN::Packet(pointers, k), alphaPacket));
+        }
+        // remaining elements
+        TensorOpContiguousLoop<ElemType, OPFN, N, false>::Loop(beta, pointers, alpha, opfn, k, K);
+    }
+};
+
 // -----------------------------------------------------------------------
 // perform loop over regular index k for N-nary operations (N counting the output)
 // -----------------------------------------------------------------------
@@ -5632,61 +6283,25 @@ struct TensorOpIteration
     }
 };
 
-// Special version for innermost loop with strides all being 1 and no further reduction. Compiler can use SSE.
+// Special version for innermost loop with strides all being 1 and no further reduction.
 // This is a very common case, e.g. adding vectors or computing the Sigmoid.
-template <class ElemType, typename OPFN>
-struct TensorOpIteration<ElemType, OPFN, 3, true /*vectorizable*/, -1 /*no reduction*/, 0 /*innermost loop*/>
-{
-    static inline void Loop(ElemType beta, array<ElemType*, 3> pointers, ElemType alpha, const OPFN& opfn,
-                            const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, 3>& regularStrides,
-                            const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, 3>& reducingStrides)
-    {
-        ElemType* pa = pointers[0];
-        ElemType* pb = pointers[1];
-        ElemType* pc = pointers[2];
-        size_t K = regularOpDims[0];
-        // special-case beta and alpha to allow the compiler to short-circuit it
-        if (beta != 0)
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 3, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(beta, array<ElemType*, 3>{pa + k, pb + k, pc + k}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
-        else if (alpha != 1)
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 3, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 3>{pa + k, pb + k, pc + k}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
-        else
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 3, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 3>{pa + k, pb + k, pc + k}, 1, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
-        // TODO: According to Amit, the VS compiler is not able to vectorize into lambdas. Solution: change the lambda to take an N, or to implement the loop inside (with 1 element by default).
-        // TODO: The signedness of k (required for omp) causes an extra sign-extend.
-        // TODO: OMP adds LOTS of overhead. Do we need a guard, a min size when to use it?
-    }
-};
-// and unary
-template <class ElemType, typename OPFN>
-struct TensorOpIteration<ElemType, OPFN, 2, true /*vectorizable*/, -1 /*no reduction*/, 0 /*innermost loop*/>
+// Ops that have a TensorOpSimdFn use explicit SSE/AVX; all others use a plain loop that the compiler may vectorize.
+// This runs single-threaded; TensorOpWithFn() splits large tensors across threads before we get here.
+template <class ElemType, typename OPFN, size_t N>
+struct TensorOpIteration<ElemType, OPFN, N, true /*vectorizable*/, -1 /*no reduction*/, 0 /*innermost loop*/>
 {
-    static inline void Loop(ElemType beta, array<ElemType*, 2> pointers, ElemType alpha, const OPFN& opfn,
-                            const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, 2>& regularStrides,
-                            const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, 2>& reducingStrides)
+    static inline void Loop(ElemType beta, array<ElemType*, N> pointers, ElemType alpha, const OPFN& opfn,
+                            const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, N>&,
+                            const SmallVector<size_t>&, const array<SmallVector<ptrdiff_t>, N>&)
     {
-        ElemType* pa = pointers[0];
-        ElemType* pb = pointers[1];
         size_t K = regularOpDims[0];
         // special-case beta and alpha to allow the compiler to short-circuit it
         if (beta != 0)
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 2, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(beta, array<ElemType*, 2>{pa + k, pb + k}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+            TensorOpContiguousLoop<ElemType, OPFN, N, IsTensorOpSimdFn<OPFN>::value>::Loop(beta, pointers, alpha, opfn, 0, K);
         else if (alpha != 1)
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 2, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 2>{pa + k, pb + k}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+            TensorOpContiguousLoop<ElemType, OPFN, N, IsTensorOpSimdFn<OPFN>::value>::Loop(0, pointers, alpha, opfn, 0, K);
         else
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 2, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 2>{pa + k, pb + k}, 1, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+            TensorOpContiguousLoop<ElemType, OPFN, N, IsTensorOpSimdFn<OPFN>::value>::Loop(0, pointers, 1, opfn, 0, K);
     }
 };
 
@@ -5744,16 +6359,13 @@ static void TensorOpWithRegularLoop(ElemType beta, const array<ElemType*, N>& po
     }
 }
 
-// tensor operation, generalized in number of arguments, operation already provided as a lambda
-// This function now expands into different k.
+// tensor operation on a given range of the output, single-threaded
+// This function expands into different k.
 template <class ElemType, typename OPFN, size_t N>
-static void TensorOpWithFn(ElemType beta, array<ElemType*, N> pointers, ElemType alpha, const OPFN& opfn,
-                           const array<size_t, N>& offsets,
-                           const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, N>& regularStrides,
-                           const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, N>& reducingStrides)
+static void TensorOpWithRegularDims(ElemType beta, const array<ElemType*, N>& pointers, ElemType alpha, const OPFN& opfn,
+                                    const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, N>& regularStrides,
+                                    const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, N>& reducingStrides)
 {
-    for (size_t i = 0; i < N; i++) // N = a small constant, this will be unrolled
-        pointers[i] += offsets[i];
     size_t dims = regularOpDims.size();
     switch (dims)
     {
@@ -5772,6 +6384,80 @@ static void TensorOpWithFn(ElemType beta, array<ElemType*, N> pointers, ElemType
     }
 }
 
+// -----------------------------------------------------------------------
+// multi-threading
+// -----------------------------------------------------------------------
+
+// OMP adds a lot of overhead, so we only go parallel if each thread gets at least this many elementary ops.
+static const size_t TENSOROP_MIN_OPS_PER_THREAD = 16384;
+
+static inline size_t TensorOpNumThreads(size_t numOps)
+{
+#ifdef _OPENMP
+    if (omp_in_parallel()) // already inside a parallel region (e.g. a per-sequence loop): do not nest
+        return 1;
+    size_t maxThreads = (size_t) omp_get_max_threads();
+    return max((size_t) 1, min(maxThreads, numOps / TENSOROP_MIN_OPS_PER_THREAD));
+#else
+    UNUSED(numOps);
+    return 1;
+#endif
+}
+
+// tensor operation, generalized in number of arguments, operation already provided as a lambda
+// Large operations are distributed over OpenMP threads:
+//  - the regular (non-reducing) index space is split along its largest dimension into one range per thread;
+//    each element is computed exactly as in the single-threaded case, so results are bit-identical
+//  - a reduction is never split: each output is aggregated by one thread in the serial order, so that reductions
+//    (in particular to a scalar) give the same result regardless of the number of threads
+template <class ElemType, typename OPFN, size_t N>
+static void TensorOpWithFn(ElemType beta, array<ElemType*, N> pointers, ElemType alpha, const OPFN& opfn,
+                           const array<size_t, N>& offsets,
+                           const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, N>& regularStrides,
+                           const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, N>& reducingStrides)
+{
+    for (size_t i = 0; i < N; i++) // N = a small constant, this will be unrolled
+        pointers[i] += offsets[i];
+
+    // determine how many threads the op is worth
+    size_t numOutputs = 1;
+    size_t splitDim = 0;
+    for (size_t j = 0; j < regularOpDims.size(); j++)
+    {
+        numOutputs *= regularOpDims[j];
+        if (regularOpDims[j] > regularOpDims[splitDim])
+            splitDim = j;
+    }
+    size_t reductionSize = 1;
+    for (size_t j = 0; j < reducingOpDims.size(); j++)
+        reductionSize *= reducingOpDims[j];
+    size_t numThreads = TensorOpNumThreads(numOutputs * reductionSize);
+
+    if (numThreads <= 1 || regularOpDims.empty()) // (a scalar output has no regular dimension to split)
+        return TensorOpWithRegularDims(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+
+    // split the regular index space along its largest dimension
+    const size_t splitDimSize = regularOpDims[splitDim];
+    const size_t numChunks = min(numThreads, splitDimSize);
+    size_t chunkSize = (splitDimSize + numChunks - 1) / numChunks;
+    if (splitDim == 0) // keep chunk boundaries of the innermost dimension on SIMD-friendly multiples
+        chunkSize = min(splitDimSize, (chunkSize + 15) / 16 * 16);
+#pragma omp parallel for num_threads((int) numChunks)
+    for (int chunk = 0; chunk < (int) numChunks; chunk++)
+    {
+        size_t begin = chunk * chunkSize;
+        size_t end = min(begin + chunkSize, splitDimSize);
+        if (begin >= end)
+            continue;
+        SmallVector<size_t> chunkOpDims = regularOpDims;
+        chunkOpDims[splitDim] = end - begin;
+        array<ElemType*, N> chunkPointers = pointers;
+        for (size_t i = 0; i < N; i++)
+            chunkPointers[i] += begin * regularStrides[i][splitDim];
+        TensorOpWithRegularDims(beta, chunkPointers, alpha, opfn, chunkOpDims, regularStrides, reducingOpDims, reducingStrides);
+    }
+}
+
 // -----------------------------------------------------------------------
 // entry points from Matrix.cpp; also map op to a lambda
 // -----------------------------------------------------------------------
@@ -5784,7 +6470,6 @@ void CPUMatrix<ElemType>::TensorOp(ElemType beta, const CPUMatrix<ElemType>& a,
                                    const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, 2>& regularStrides,
                                    const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, 2>& reducingStrides)
 {
-// TODO: Change the lambda to take a pointer and a number of elements, so that we can pass it 1 or 4 elements, in order for it to SSE-vectorize.
 #define CaseUnaryTensorOp(oper)                                                        \
     case ElementWiseOperator::op##oper:                                                \
         return TensorOpWithFn(beta, pointers, alpha, [](const array<ElemType*, 2>& pp) \
@@ -5794,6 +6479,13 @@ void CPUMatrix<ElemType>::TensorOp(ElemType beta, const CPUMatrix<ElemType>& a,
                               offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides)
 
     array<ElemType*, 2> pointers = {a.m_pArray, m_pArray};
+
+    // ops with an explicit SIMD implementation
+    if (op == ElementWiseOperator::opCopy)
+        return TensorOpWithFn(beta, pointers, alpha, TensorOpSimdFn<ElemType, ElementWiseOperator::opCopy>(), offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+    else if (op == ElementWiseOperator::opLinearRectifier)
+        return TensorOpWithFn(beta, pointers, alpha, TensorOpSimdFn<ElemType, ElementWiseOperator::opLinearRectifier>(), offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+
     switch (op)
     {
         ForAllUnaryOps(CaseUnaryTensorOp);
@@ -5819,6 +6511,15 @@ void CPUMatrix<ElemType>::TensorOp(ElemType beta, const CPUMatrix<ElemType>& a,
                               offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides)
 
     array<ElemType*, 3> pointers = {a.m_pArray, b.m_pArray, m_pArray};
+
+    // ops with an explicit SIMD implementation
+    if (op == ElementWiseOperator::opSum)
+        return TensorOpWithFn(beta, pointers, alpha, TensorOpSimdFn<ElemType, ElementWiseOperator::opSum>(), offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+    else if (op == ElementWiseOperator::opDifference)
+        return TensorOpWithFn(beta, pointers, alpha, TensorOpSimdFn<ElemType, ElementWiseOperator::opDifference>(), offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+    else if (op == ElementWiseOperator::opElementwiseProduct)
+        return TensorOpWithFn(beta, pointers, alpha, TensorOpSimdFn<ElemType, ElementWiseOperator::opElementwiseProduct>(), offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+
     switch (op)
     {
         ForAllBinaryOps(CaseBinaryTensorOp);
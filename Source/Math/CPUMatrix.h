@@ -318,6 +318,8 @@ public:
 
 public:
     static int SetNumThreads(int numThreads); // note: this does not depend on <ElemType>, i.e. you can call it on any <ElemType>
+    static int SetNumThreadsOfCallingThread(int numThreads); // same, for threads that run math concurrently; returns the previous value
+    static int SetNumBLASThreadsOfProcess(int numThreads); // the process-wide part of the above for ACML/OpenBLAS; returns the previous value
 
     // static BLAS functions
     static void SVD(const CPUMatrix<ElemType>& A, CPUMatrix<ElemType>& SIGMA, CPUMatrix<ElemType>& U, CPUMatrix<ElemType>& VT, CPUMatrix<ElemType>& W);
@@ -422,6 +424,19 @@ public:
         return stream;
     }
 
+    // serialization as an aligned blob (fileOptionsMappable). When reading from a memory-mapped file, the matrix refers
+    // to the read-only mapped data in place instead of holding a copy, and keeps the mapping alive.
+    void ReadMappable(File& stream);
+    void WriteMappable(File& stream) const;
+
+    // copy on first write: a matrix that refers to a read-only file mapping (see ReadMappable()) gets its own copy of the values
+    // Functions that replace all values do this by themselves; other in-place modifications must call MakeWritable() first.
+    bool IsMapped() const
+    {
+        return m_mappedFile != nullptr;
+    }
+    void MakeWritable();
+
 public:
     ElemType LogAddSumOfElements() const;
 
@@ -430,9 +445,6 @@ public:
     static void RCRFBackwardCompute(const CPUMatrix<ElemType>& alpha, CPUMatrix<ElemType>& beta,
                                     const CPUMatrix<ElemType>& lbls,
                                     const CPUMatrix<ElemType>& pair_scores);
-    static void _rcrfBackwardCompute(size_t t, size_t k, const CPUMatrix<ElemType>& alpha,
-                                     CPUMatrix<ElemType>& beta,
-                                     const CPUMatrix<ElemType>& pair_scores);
 
     static void RCRFTransGrdCompute(const CPUMatrix<ElemType>& lbls,
                                     const CPUMatrix<ElemType>& alpha,
@@ -440,14 +452,29 @@ public:
                                     const CPUMatrix<ElemType>& pair_scores,
                                     CPUMatrix<ElemType>& grd);
 
-    static void _rcrfTransGrdCompute(size_t i,
-                                     const CPUMatrix<ElemType>& lbls,
-                                     const CPUMatrix<ElemType>& alpha,
-                                     const CPUMatrix<ElemType>& beta,
-                                     const CPUMatrix<ElemType>& pair_scores,
-                                     CPUMatrix<ElemType>& grd,
-                                     const size_t tPos // position
-                                     );
+    // batched RCRF (CRFNode, SequenceDecoderNode): all sequences of a minibatch in one call, sequences in parallel
+    // Returns the sum over the sequences of the negative log likelihood of their label sequences.
+    static ElemType RCRFForwardBackward(const CPUMatrix<ElemType>& lbls, const CPUMatrix<ElemType>& pos_scores, const CPUMatrix<ElemType>& pair_scores,
+                                        CPUMatrix<ElemType>& alpha, CPUMatrix<ElemType>& beta, CPUMatrix<ElemType>& postprob,
+                                        const std::vector<RCRFSequence>& sequences);
+    static void RCRFTransGrdCompute(const CPUMatrix<ElemType>& lbls, const CPUMatrix<ElemType>& alpha, const CPUMatrix<ElemType>& beta,
+                                    const CPUMatrix<ElemType>& pair_scores, CPUMatrix<ElemType>& grd,
+                                    const std::vector<RCRFSequence>& sequences);
+    static void RCRFViterbi(const CPUMatrix<ElemType>& lbls, const CPUMatrix<ElemType>& pos_scores, const CPUMatrix<ElemType>& pair_scores,
+                            CPUMatrix<ElemType>& decodedPath, const std::vector<RCRFSequence>& sequences);
+
+public:
+    // fused recurrent cells (one time step of LSTMNode/GRUNode, all parallel sequences at once)
+    static void LSTMCellForward(CPUMatrix<ElemType>& gates, const CPUMatrix<ElemType>& peepholes,
+                                const CPUMatrix<ElemType>& cPrev, CPUMatrix<ElemType>& c, CPUMatrix<ElemType>& h);
+    static void LSTMCellBackward(const CPUMatrix<ElemType>& gates, const CPUMatrix<ElemType>& peepholes,
+                                 const CPUMatrix<ElemType>& cPrev, const CPUMatrix<ElemType>& c, const CPUMatrix<ElemType>& dh,
+                                 CPUMatrix<ElemType>& dc, CPUMatrix<ElemType>& dGates, CPUMatrix<ElemType>& dPeepholes);
+    static void GRUCellForward(CPUMatrix<ElemType>& gates, const CPUMatrix<ElemType>& hiddenProj,
+                               const CPUMatrix<ElemType>& hPrev, CPUMatrix<ElemType>& h);
+    static void GRUCellBackward(const CPUMatrix<ElemType>& gates, const CPUMatrix<ElemType>& hiddenProj,
+                                const CPUMatrix<ElemType>& hPrev, const CPUMatrix<ElemType>& dh,
+                                CPUMatrix<ElemType>& dGates, CPUMatrix<ElemType>& dHiddenProj, CPUMatrix<ElemType>& dhPrev);
 
 protected:
     size_t LocateElement(const size_t i, const size_t j) const;
@@ -456,6 +483,12 @@ protected:
 private:
     void ZeroInit(); // should only be used by constructors.
     void Clear();
+    void ReleaseMappedFile(); // own a buffer of the same size instead of the mapped data, without copying the values
+
+#pragma warning(push)
+#pragma warning(disable : 4251) // (private member, we use the same compiler everywhere)
+    std::shared_ptr<char> m_mappedFile; // the file mapping that m_pArray points into, if any (read-only)
+#pragma warning(pop)
 };
 
 typedef CPUMatrix<float> CPUSingleMatrix;
@@ -17,6 +17,7 @@
 #include <random>
 #include <chrono>
 #include <iostream>
+#include <algorithm>
 #ifdef LEAKDETECT
 #include <vld.h>
 #endif
@@ -807,6 +808,264 @@ void CPUSparseMatrix<ElemType>::MultiplyAndAdd(ElemType alpha, const CPUMatrix<E
     }
 }
 
+// call f(packRow, packCol) for all places in the packed convolution input that input element 'id' is copied to
+// This is the iteration of CPUMatrix::AssignPackedConvolutionInput(), with packCol relative to the sample.
+template <class F>
+static inline void ForEachPackedConvolutionPosition(const long id, const size_t inputHeight, const size_t inputChannels,
+                                                    const size_t outputWidth, const size_t outputHeight,
+                                                    const size_t kernelWidth, const size_t kernelHeight, const size_t horizontalSubsample, const size_t verticalSubsample,
+                                                    const bool zeroPadding, const F& f)
+{
+    const long inputHeightTimesChannel = (long) (inputHeight * inputChannels);
+    const long y = id / inputHeightTimesChannel;   // inputCol
+    const long nXC = id % inputHeightTimesChannel; // channel + inputRow*inputChannels
+    const long x = nXC / (long) inputChannels;     // inputRow
+    const long c = nXC % (long) inputChannels;     // channel
+
+    // first output row/col that the element contributes to, and its position in the kernel there
+    const long xOffset = zeroPadding ? (long) kernelHeight / 2 : 0;
+    const long yOffset = zeroPadding ? (long) kernelWidth / 2 : 0;
+    const long xNum = x - (long) kernelHeight + 1 + xOffset;
+    const long yNum = y - (long) kernelWidth + 1 + yOffset;
+    const long x0 = xNum <= 0 ? 0 : (xNum + (long) verticalSubsample - 1) / (long) verticalSubsample;
+    const long y0 = yNum <= 0 ? 0 : (yNum + (long) horizontalSubsample - 1) / (long) horizontalSubsample;
+    const long x1 = x + xOffset - x0 * (long) verticalSubsample;
+    const long y1 = y + yOffset - y0 * (long) horizontalSubsample;
+
+    for (long wcol = y0, posyInKernel = y1; wcol < (long) outputWidth && posyInKernel >= 0; wcol++, posyInKernel -= (long) horizontalSubsample)
+    {
+        const long packRowBase = (long) (c * kernelWidth * kernelHeight + posyInKernel * kernelHeight);
+        for (long wrow = x0, posxInKernel = x1; wrow < (long) outputHeight && posxInKernel >= 0; wrow++, posxInKernel -= (long) verticalSubsample)
+            f(packRowBase + posxInKernel, wcol * (long) outputHeight + wrow);
+    }
+}
+
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::ConvolutionForward(const CPUMatrix<ElemType>& filter, const CPUSparseMatrix<ElemType>& in, CPUMatrix<ElemType>& out,
+                                                   const size_t inputWidth, const size_t inputHeight, const size_t inputChannels,
+                                                   const size_t outputWidth, const size_t outputHeight,
+                                                   const size_t kernelWidth, const size_t kernelHeight, const size_t horizontalSubsample, const size_t verticalSubsample,
+                                                   const bool zeroPadding)
+{
+    if (in.GetFormat() != matrixFormatSparseCSC)
+        NOT_IMPLEMENTED;
+    if (in.GetNumRows() != inputWidth * inputHeight * inputChannels || filter.GetNumCols() != kernelWidth * kernelHeight * inputChannels)
+        InvalidArgument("CPUSparseMatrix::ConvolutionForward: The input or filter dimensions do not match the convolution geometry.");
+
+    const size_t numOutputChannels = filter.GetNumRows();
+    const size_t outputDim = numOutputChannels * outputWidth * outputHeight;
+    const long numSamples = (long) in.GetNumCols();
+    out.Resize(outputDim, numSamples);
+    const ElemType* pFilter = filter.BufferPointer();
+
+    // each sample writes its own output column
+#pragma omp parallel for
+    for (long sample = 0; sample < numSamples; sample++)
+    {
+        ElemType* pOut = out.BufferPointer() + sample * outputDim;
+        memset(pOut, 0, sizeof(ElemType) * outputDim);
+        for (size_t p = in.m_compIndex[sample]; p < in.m_compIndex[sample + 1]; p++)
+        {
+            const ElemType val = in.m_pArray[p];
+            ForEachPackedConvolutionPosition((long) in.m_unCompIndex[p], inputHeight, inputChannels, outputWidth, outputHeight,
+                                             kernelWidth, kernelHeight, horizontalSubsample, verticalSubsample, zeroPadding,
+                                             [&](long packRow, long packCol)
+                                             {
+                                                 const ElemType* w = pFilter + packRow * numOutputChannels;
+                                                 ElemType* o = pOut + packCol * numOutputChannels;
+                                                 for (size_t k = 0; k < numOutputChannels; k++)
+                                                     o[k] += w[k] * val;
+                                             });
+        }
+    }
+    UNUSED(inputWidth);
+}
+
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::ConvolutionBackwardFilter(const CPUMatrix<ElemType>& srcGrad, const CPUSparseMatrix<ElemType>& in, CPUMatrix<ElemType>& filterGrad,
+                                                          const size_t inputWidth, const size_t inputHeight, const size_t inputChannels,
+                                                          const size_t outputWidth, const size_t outputHeight,
+                                                          const size_t kernelWidth, const size_t kernelHeight, const size_t horizontalSubsample, const size_t verticalSubsample,
+                                                          const bool zeroPadding)
+{
+    if (in.GetFormat() != matrixFormatSparseCSC)
+        NOT_IMPLEMENTED;
+    const size_t numOutputChannels = filterGrad.GetNumRows();
+    const size_t filterSize = filterGrad.GetNumElements();
+    if (in.GetNumRows() != inputWidth * inputHeight * inputChannels || filterGrad.GetNumCols() != kernelWidth * kernelHeight * inputChannels ||
+        srcGrad.GetNumRows() != numOutputChannels * outputWidth * outputHeight || srcGrad.GetNumCols() != in.GetNumCols())
+        InvalidArgument("CPUSparseMatrix::ConvolutionBackwardFilter: The matrix dimensions do not match the convolution geometry.");
+
+    // samples are split over threads, each of which accumulates into its own copy of the filter gradient
+    const long numSamples = (long) in.GetNumCols();
+    const int numThreads = max(1, min(omp_get_max_threads(), (int) numSamples));
+    std::vector<ElemType> partialGrads(filterSize * numThreads, 0);
+#pragma omp parallel for num_threads(numThreads) schedule(static, 1)
+    for (int t = 0; t < numThreads; t++)
+    {
+        ElemType* pGrad = partialGrads.data() + t * filterSize;
+        for (long sample = t; sample < numSamples; sample += numThreads)
+        {
+            const ElemType* pSrcGrad = srcGrad.BufferPointer() + sample * srcGrad.GetNumRows();
+            for (size_t p = in.m_compIndex[sample]; p < in.m_compIndex[sample + 1]; p++)
+            {
+                const ElemType val = in.m_pArray[p];
+                ForEachPackedConvolutionPosition((long) in.m_unCompIndex[p], inputHeight, inputChannels, outputWidth, outputHeight,
+                                                 kernelWidth, kernelHeight, horizontalSubsample, verticalSubsample, zeroPadding,
+                                                 [&](long packRow, long packCol)
+                                                 {
+                                                     ElemType* g = pGrad + packRow * numOutputChannels;
+                                                     const ElemType* s = pSrcGrad + packCol * numOutputChannels;
+                                                     for (size_t k = 0; k < numOutputChannels; k++)
+                                                         g[k] += s[k] * val;
+                                                 });
+            }
+        }
+    }
+
+    // sum up the per-thread gradients in a fixed order, so that the result does not depend on scheduling
+    ElemType* pFilterGrad = filterGrad.BufferPointer();
+#pragma omp parallel for
+    for (long i = 0; i < (long) filterSize; i++)
+    {
+        ElemType sum = 0;
+        for (int t = 0; t < numThreads; t++)
+            sum += partialGrads[t * filterSize + i];
+        pFilterGrad[i] += sum;
+    }
+}
+
+// Embedding lookup. The rows of the CSC matrix 'indices' are read as k = indices.GetNumRows() / table.GetNumCols()
+// stacked selectors of table columns, i.e. row r of a sample selects column (r % V) of the table into
+// output rows [(r / V) * D, (r / V + 1) * D). This is table * indices with indices and out reshaped to k times as many
+// columns, but copies the selected columns instead of multiplying by the (usually one-hot) input.
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::ColumnLookup(const CPUMatrix<ElemType>& table, const CPUSparseMatrix<ElemType>& indices, CPUMatrix<ElemType>& out)
+{
+    if (indices.GetFormat() != matrixFormatSparseCSC)
+        NOT_IMPLEMENTED;
+
+    const size_t dim = table.GetNumRows();
+    const size_t vocabSize = table.GetNumCols();
+    if (vocabSize == 0 || indices.GetNumRows() % vocabSize != 0)
+        InvalidArgument("CPUSparseMatrix::ColumnLookup: The number of rows of the indices (%d) is not a multiple of the number of table columns (%d).", (int) indices.GetNumRows(), (int) vocabSize);
+
+    const size_t outDim = dim * (indices.GetNumRows() / vocabSize);
+    const long numSamples = (long) indices.GetNumCols();
+    out.Resize(outDim, numSamples);
+    const ElemType* pTable = table.BufferPointer();
+
+    // each sample writes its own output column
+#pragma omp parallel for
+    for (long j = 0; j < numSamples; j++)
+    {
+        ElemType* pOut = out.BufferPointer() + j * outDim;
+        memset(pOut, 0, sizeof(ElemType) * outDim);
+        for (size_t p = indices.m_compIndex[j]; p < indices.m_compIndex[j + 1]; p++)
+        {
+            const size_t r = indices.m_unCompIndex[p];
+            const ElemType val = indices.m_pArray[p];
+            const ElemType* src = pTable + (r % vocabSize) * dim;
+            ElemType* dst = pOut + (r / vocabSize) * dim;
+            if (val == 1)
+            {
+                for (size_t h = 0; h < dim; h++)
+                    dst[h] += src[h];
+            }
+            else
+            {
+                for (size_t h = 0; h < dim; h++)
+                    dst[h] += val * src[h];
+            }
+        }
+    }
+}
+
+// tableGrad += outGrad * indices^T with the reshaping of ColumnLookup(), accumulated into the selected columns only
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::ColumnLookupGradient(const CPUMatrix<ElemType>& outGrad, const CPUSparseMatrix<ElemType>& indices, CPUMatrix<ElemType>& tableGrad)
+{
+    if (indices.GetFormat() != matrixFormatSparseCSC)
+        NOT_IMPLEMENTED;
+
+    const size_t dim = tableGrad.GetNumRows();
+    const size_t vocabSize = tableGrad.GetNumCols();
+    if (vocabSize == 0 || indices.GetNumRows() % vocabSize != 0 || outGrad.GetNumRows() != dim * (indices.GetNumRows() / vocabSize) || outGrad.GetNumCols() != indices.GetNumCols())
+        InvalidArgument("CPUSparseMatrix::ColumnLookupGradient: The matrix dimensions do not match.");
+
+    const size_t outDim = outGrad.GetNumRows();
+    for (size_t j = 0; j < indices.GetNumCols(); j++)
+    {
+        const ElemType* pOutGrad = outGrad.BufferPointer() + j * outDim;
+        for (size_t p = indices.m_compIndex[j]; p < indices.m_compIndex[j + 1]; p++)
+        {
+            const size_t r = indices.m_unCompIndex[p];
+            const ElemType val = indices.m_pArray[p];
+            const ElemType* src = pOutGrad + (r / vocabSize) * dim;
+            ElemType* dst = tableGrad.BufferPointer() + (r % vocabSize) * dim;
+            for (size_t h = 0; h < dim; h++)
+                dst[h] += val * src[h];
+        }
+    }
+}
+
+// same for a block-column gradient, which receives one block per selected table column
+// Unlike MultiplyAndAdd(), this accumulates into the blocks already present, so it can be called once per time step.
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::ColumnLookupGradient(const CPUMatrix<ElemType>& outGrad, const CPUSparseMatrix<ElemType>& indices, CPUSparseMatrix<ElemType>& tableGrad)
+{
+    if (indices.GetFormat() != matrixFormatSparseCSC)
+        NOT_IMPLEMENTED;
+    if (!tableGrad.OwnBuffer())
+        LogicError("Cannot modify since the buffer is managed externally.");
+
+    const size_t dim = tableGrad.GetNumRows();
+    const size_t vocabSize = tableGrad.GetNumCols();
+    if (vocabSize == 0 || indices.GetNumRows() % vocabSize != 0 || outGrad.GetNumRows() != dim * (indices.GetNumRows() / vocabSize) || outGrad.GetNumCols() != indices.GetNumCols())
+        InvalidArgument("CPUSparseMatrix::ColumnLookupGradient: The matrix dimensions do not match.");
+
+    if (tableGrad.GetFormat() != matrixFormatSparseBlockCol)
+    {
+        tableGrad.SetFormat(matrixFormatSparseBlockCol);
+        tableGrad.Reset();
+    }
+
+    // column -> block of the blocks accumulated so far
+    std::unordered_map<size_t, size_t> colToBlock;
+    for (size_t b = 0; b < tableGrad.m_blockSize; b++)
+        colToBlock[tableGrad.m_blockIds[b] - tableGrad.m_blockIdShift] = b;
+
+    const size_t outDim = outGrad.GetNumRows();
+    for (size_t j = 0; j < indices.GetNumCols(); j++)
+    {
+        const ElemType* pOutGrad = outGrad.BufferPointer() + j * outDim;
+        for (size_t p = indices.m_compIndex[j]; p < indices.m_compIndex[j + 1]; p++)
+        {
+            const size_t r = indices.m_unCompIndex[p];
+            const size_t col = r % vocabSize;
+            auto iter = colToBlock.find(col);
+            if (iter == colToBlock.end())
+            {
+                // new block: grow geometrically, keeping the existing blocks
+                const size_t b = tableGrad.m_blockSize;
+                if ((b + 1) * dim > tableGrad.GetSizeAllocated())
+                    tableGrad.Resize(dim, vocabSize, max((b + 1) * dim, 2 * tableGrad.GetSizeAllocated()), true, true);
+                tableGrad.m_blockIds[b] = col + tableGrad.m_blockIdShift;
+                memset(tableGrad.m_pArray + b * dim, 0, sizeof(ElemType) * dim);
+                tableGrad.m_blockSize++;
+                tableGrad.m_nz = tableGrad.m_blockSize * dim;
+                iter = colToBlock.insert(make_pair(col, b)).first;
+            }
+
+            const ElemType val = indices.m_pArray[p];
+            const ElemType* src = pOutGrad + (r / vocabSize) * dim;
+            ElemType* dst = tableGrad.m_pArray + iter->second * dim;
+            for (size_t h = 0; h < dim; h++)
+                dst[h] += val * src[h];
+        }
+    }
+}
+
 template <class ElemType>
 void CPUSparseMatrix<ElemType>::ScaleAndAdd(const ElemType alpha, const CPUSparseMatrix<ElemType>& lhs, CPUMatrix<ElemType>& rhs)
 {
@@ -884,10 +1143,15 @@ bool CPUSparseMatrix<ElemType>::AreEqual(const CPUSparseMatrix<ElemType>& a, con
     return result;
 }
 
-// normal update for smoothed gradients c and current gradients (this)
-// TODO: comment seems wrong; cf. SGD.cpp: smoothedGradient.NormalGrad(gradientValues, functionValues,...)
+// momentum SGD update of functionValues with this gradient and smoothed gradient c, restricted to the columns (rows) that
+// have a block in this gradient. The arithmetic is that of the dense update in Matrix::NormalGrad():
+//     c = momentum * c + (1 - momentum) * learnRatePerSample * this
+//     functionValues -= c                                                          (plain momentum)
+//     functionValues -= momentum * c + (1 - momentum) * learnRatePerSample * this  (Nesterov momentum)
+// Columns without a block are left alone, i.e. their momentum decay is not applied; callers that need results identical
+// to the dense update must bring them up to date themselves (cf. SGDLib/LazySparseUpdater.h).
 template <class ElemType>
-void CPUSparseMatrix<ElemType>::NormalGrad(CPUMatrix<ElemType>& c, const ElemType momentum)
+void CPUSparseMatrix<ElemType>::NormalGrad(CPUMatrix<ElemType>& c, CPUMatrix<ElemType>& functionValues, const ElemType learnRatePerSample, const ElemType momentum, const bool useNesterovMomentum)
 {
     if (c.IsEmpty())
     {
@@ -897,18 +1161,21 @@ void CPUSparseMatrix<ElemType>::NormalGrad(CPUMatrix<ElemType>& c, const ElemTyp
 
     if (m_format == MatrixFormat::matrixFormatSparseBlockCol || m_format == MatrixFormat::matrixFormatSparseBlockRow)
     {
-        for (size_t j = 0; j < m_blockSize; j++)
+        const ElemType gradScale = (1 - momentum) * learnRatePerSample;
+        const size_t len = (m_format == MatrixFormat::matrixFormatSparseBlockCol) ? GetNumRows() : GetNumCols();
+#pragma omp parallel for
+        for (long j = 0; j < (long) m_blockSize; j++)
         {
             size_t i = m_blockIds[j] - m_blockIdShift;
-            size_t len = (m_format == MatrixFormat::matrixFormatSparseBlockCol) ? GetNumRows() : GetNumCols();
             size_t start = j * len;
             for (size_t p = start; p < start + len; p++)
             {
-                ElemType val = m_pArray[p];
+                ElemType val = gradScale * m_pArray[p];
                 size_t row = (m_format == MatrixFormat::matrixFormatSparseBlockCol) ? (p - start) : i;
                 size_t col = (m_format == MatrixFormat::matrixFormatSparseBlockCol) ? i : (p - start);
-                c(row, col) = (1 - momentum) * val + momentum * c(row, col);
-                m_pArray[p] = c(row, col);
+                ElemType& v = c(row, col);
+                v = momentum * v + val;
+                functionValues(row, col) -= useNesterovMomentum ? momentum * v + val : v;
             }
         }
     }
@@ -985,6 +1252,46 @@ ElemType CPUSparseMatrix<ElemType>::Adagrad(CPUMatrix<ElemType>& c, const bool n
         return 1;
 }
 
+// ids of the rows that hold non-zero entries (CSC), ascending and without duplicates
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::GetNonZeroRowIds(std::vector<size_t>& ids) const
+{
+    if (m_format != MatrixFormat::matrixFormatSparseCSC)
+        NOT_IMPLEMENTED;
+
+    ids.clear();
+    if (m_numCols == 0)
+        return;
+    for (size_t p = m_compIndex[0]; p < m_compIndex[m_numCols]; p++)
+        ids.push_back(m_unCompIndex[p]);
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+}
+
+// ids of the columns that hold non-zero entries (CSC) or a block (block-column), ascending and without duplicates
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::GetNonZeroColumnIds(std::vector<size_t>& ids) const
+{
+    ids.clear();
+    if (m_format == MatrixFormat::matrixFormatSparseCSC)
+    {
+        for (size_t j = 0; j < m_numCols; j++)
+        {
+            if (m_compIndex[j + 1] > m_compIndex[j])
+                ids.push_back(j);
+        }
+    }
+    else if (m_format == MatrixFormat::matrixFormatSparseBlockCol)
+    {
+        for (size_t b = 0; b < m_blockSize; b++)
+            ids.push_back(m_blockIds[b] - m_blockIdShift);
+        sort(ids.begin(), ids.end());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    }
+    else
+        NOT_IMPLEMENTED;
+}
+
 template <class ElemType>
 CPUSparseMatrix<ElemType>& CPUSparseMatrix<ElemType>::InplaceTruncateTop(const ElemType threshold)
 {
@@ -95,6 +95,29 @@ public:
 
     static void ScaleAndAdd(const ElemType alpha, const CPUSparseMatrix<ElemType>& lhs, CPUMatrix<ElemType>& c);
 
+    // convolution of the images in the columns of a CSC matrix, without unpacking them into a dense matrix
+    // The layouts of input, filter and output are those of CPUMatrix::AssignPackedConvolutionInput().
+    // out = filter * packed(in)
+    static void ConvolutionForward(const CPUMatrix<ElemType>& filter, const CPUSparseMatrix<ElemType>& in, CPUMatrix<ElemType>& out,
+                                   const size_t inputWidth, const size_t inputHeight, const size_t inputChannels,
+                                   const size_t outputWidth, const size_t outputHeight,
+                                   const size_t kernelWidth, const size_t kernelHeight, const size_t horizontalSubsample, const size_t verticalSubsample,
+                                   const bool zeroPadding);
+    // filterGrad += srcGrad * packed(in)^T
+    static void ConvolutionBackwardFilter(const CPUMatrix<ElemType>& srcGrad, const CPUSparseMatrix<ElemType>& in, CPUMatrix<ElemType>& filterGrad,
+                                          const size_t inputWidth, const size_t inputHeight, const size_t inputChannels,
+                                          const size_t outputWidth, const size_t outputHeight,
+                                          const size_t kernelWidth, const size_t kernelHeight, const size_t horizontalSubsample, const size_t verticalSubsample,
+                                          const bool zeroPadding);
+
+    // embedding lookup: out = table * indices, where indices holds k = indices.GetNumRows() / table.GetNumCols() stacked
+    // column selectors per sample and indices and out are read as k times as many columns; the selected columns are
+    // gathered instead of multiplied
+    static void ColumnLookup(const CPUMatrix<ElemType>& table, const CPUSparseMatrix<ElemType>& indices, CPUMatrix<ElemType>& out);
+    // tableGrad += outGrad * indices^T (same reshaping), touching only the selected columns; a sparse tableGrad is block-column
+    static void ColumnLookupGradient(const CPUMatrix<ElemType>& outGrad, const CPUSparseMatrix<ElemType>& indices, CPUMatrix<ElemType>& tableGrad);
+    static void ColumnLookupGradient(const CPUMatrix<ElemType>& outGrad, const CPUSparseMatrix<ElemType>& indices, CPUSparseMatrix<ElemType>& tableGrad);
+
     static bool AreEqual(const CPUSparseMatrix<ElemType>& a, const CPUSparseMatrix<ElemType>& b, const ElemType threshold = 1e-8);
 
     // sum(vec(a).*vec(b))
@@ -151,9 +174,13 @@ public:
     }
 
 public:
-    void NormalGrad(CPUMatrix<ElemType>& c, const ElemType momentum);
+    void NormalGrad(CPUMatrix<ElemType>& c, CPUMatrix<ElemType>& functionValues, const ElemType learnRatePerSample, const ElemType momentum, const bool useNesterovMomentum);
     ElemType Adagrad(CPUMatrix<ElemType>& c, const bool needAveMultiplier);
 
+public:
+    void GetNonZeroRowIds(std::vector<size_t>& ids) const;
+    void GetNonZeroColumnIds(std::vector<size_t>& ids) const;
+
 public:
     CPUSparseMatrix<ElemType>& InplaceTruncateTop(const ElemType threshold);
     CPUSparseMatrix<ElemType>& InplaceTruncateBottom(const ElemType threshold);
@@ -2,6 +2,7 @@
 #define __COLUMN_QUANTIZER_H__
 #include "ValueQuantizer.h"
 #include <math.h>
+#include <algorithm>
 
 #pragma warning(disable : 4127) // conditional expression is constant
 
@@ -76,6 +77,67 @@ public:
         }
     }
 
+    // CPU versions of Quantize() and Unquantize() that produce the same interleaved bit layout but walk the column
+    // contiguously: rows [k * numQWordsPerCol, (k + 1) * numQWordsPerCol) go to bit field k of QWords 0, 1, 2, ...,
+    // so each such row block is a unit-stride loop over both the values and the QWords, which the compiler can vectorize.
+    template <bool ZeroThresholdFor1Bit>
+    void QuantizeContiguous(const ElemType* inMat, const ElemType* inResidual, long M, size_t j, QWord* qColBits, ElemType* outResidual) const
+    {
+        // the no-quantization hack packs one value per QWord; nothing to gain here
+        if (valQ.NBits() == QWordNumBits)
+        {
+            Quantize<ZeroThresholdFor1Bit>(inMat, inResidual, M, j, qColBits, outResidual);
+            return;
+        }
+
+        const size_t numQWordsPerCol = QWordsPerCol(M);
+        const ElemType* in = inMat + ColMIDX(0, j, M);
+        const ElemType* inRes = inResidual + ColMIDX(0, j, M);
+        ElemType* outRes = outResidual + ColMIDX(0, j, M);
+        for (size_t iQWord = 0; iQWord < numQWordsPerCol; iQWord++)
+            qColBits[iQWord] = 0;
+
+        for (size_t rowBegin = 0, k = 0; rowBegin < (size_t) M; rowBegin += numQWordsPerCol, k += valQ.NBits())
+        {
+            const size_t n = std::min(numQWordsPerCol, (size_t) M - rowBegin);
+            for (size_t iQWord = 0; iQWord < n; iQWord++)
+            {
+                // inResidual = outResidual is allowed: each value is read before its residual is written
+                ElemType val = in[rowBegin + iQWord] + inRes[rowBegin + iQWord];
+                QWordVal qval = valQ.template Quantize<ZeroThresholdFor1Bit>(val);
+                outRes[rowBegin + iQWord] = val - valQ.Unquantize(qval);
+                qColBits[iQWord] |= qval << k;
+            }
+        }
+    }
+
+    void UnquantizeContiguous(ElemType* outMat, long M, size_t j, const QWord* qColBits, bool add) const
+    {
+        if (valQ.NBits() == QWordNumBits)
+        {
+            Unquantize(outMat, M, j, qColBits, add);
+            return;
+        }
+
+        const size_t numQWordsPerCol = QWordsPerCol(M);
+        const QWordVal bitmask = valQ.QuanRangeEnd() - 1;
+        ElemType* out = outMat + ColMIDX(0, j, M);
+        for (size_t rowBegin = 0, k = 0; rowBegin < (size_t) M; rowBegin += numQWordsPerCol, k += valQ.NBits())
+        {
+            const size_t n = std::min(numQWordsPerCol, (size_t) M - rowBegin);
+            if (add)
+            {
+                for (size_t iQWord = 0; iQWord < n; iQWord++)
+                    out[rowBegin + iQWord] += valQ.Unquantize((qColBits[iQWord] >> k) & bitmask);
+            }
+            else
+            {
+                for (size_t iQWord = 0; iQWord < n; iQWord++)
+                    out[rowBegin + iQWord] = valQ.Unquantize((qColBits[iQWord] >> k) & bitmask);
+            }
+        }
+    }
+
     // workaround for not being able to declare a default argument for lambda parameters
     template <bool ZeroThresholdFor1Bit>
     static cudacode void ComputeRangeStatColj(const ElemType* inMat, const ElemType* inResidual, long M, size_t j, size_t bits, ElemType& lower, ElemType& upper)
@@ -137,7 +199,7 @@ public:
                 // quantize
                 size_t ij = ColMIDX(i, colIdx, M);
                 ElemType val = inMat[ij] + inResidual[ij];
-                QWordVal qval = valQ.Quantize<ZeroThresholdFor1Bit>(val);
+                QWordVal qval = valQ.template Quantize<ZeroThresholdFor1Bit>(val);
 
                 // compute residual
                 ElemType uval = valQ.Unquantize(qval);
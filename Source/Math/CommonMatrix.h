@@ -203,6 +203,19 @@ enum MatrixFlags
     matrixFlagSetValueOnDevice = 1 << bitPosSetValueOnDevice, // SetValue() call has a buffer that is already on the device
 };
 
+// -----------------------------------------------------------------------
+// RCRFSequence -- one sequence of a minibatch, for the batched RCRF functions
+// Its time steps are the columns firstColumn + t * columnStride, t < numSteps,
+// so that sequences interleaved as in an MBLayout can be addressed in place.
+// -----------------------------------------------------------------------
+
+struct RCRFSequence
+{
+    size_t firstColumn;
+    size_t numSteps;
+    size_t columnStride;
+};
+
 // -----------------------------------------------------------------------
 // BaseMatrix -- base class for all matrix types (CPU, GPU) x (dense, sparse)
 // -----------------------------------------------------------------------
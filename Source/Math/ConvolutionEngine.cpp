@@ -6,6 +6,8 @@
 #include "stdafx.h"
 #include "ConvolutionEngine.h"
 #include "CuDnnConvolutionEngine.h"
+#include "CPUMatrix.h"
+#include <omp.h>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -342,6 +344,361 @@ private:
     bool m_gpuSparse1D;
 };
 
+// -----------------------------------------------------------------------
+// CpuConvolutionEngine -- convolution of HWC images on the CPU.
+//
+// Instead of unpacking (im2col) a whole sub-batch into one large workspace
+// and then running a single matrix product, each sample is unpacked into a
+// workspace owned by its thread and multiplied right away, so that unpacking
+// runs in parallel and the unpacked data stays in cache. In addition:
+//  - 1x1 filters with stride 1 are a single matrix product over all pixels;
+//  - small filters over a single input channel are applied directly, without
+//    unpacking, as the unpacked input would cost more than it saves;
+//  - sparse (CSC) input is convolved as is, without converting it to dense.
+// Data that is not on the CPU is left to DefaultConvolutionEngine.
+// Note: the workspace argument is not used, so BackwardFilter() never reuses it.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class CpuConvolutionEngine : public DefaultConvolutionEngine<ElemType>
+{
+public:
+    using Base = DefaultConvolutionEngine<ElemType>;
+    using typename Base::Mat;
+    using typename Base::Tensor4D;
+    using typename Base::Filter;
+    using typename Base::ConvDesc;
+
+    enum class Algorithm
+    {
+        Default,       // not on the CPU: use DefaultConvolutionEngine
+        MatrixProduct, // 1x1 filter, stride 1
+        Direct,        // small filter, few input channels
+        Unpack,        // per-sample im2col and matrix product
+        Sparse         // sparse input
+    };
+
+public:
+    CpuConvolutionEngine(DEVICEID_TYPE deviceId, size_t maxTempMemSizeInSamples)
+        : Base(deviceId, maxTempMemSizeInSamples)
+    {
+    }
+
+    // heuristic to select how to compute a convolution
+    static Algorithm SelectAlgorithm(const Mat& in, const Mat& filter, const Filter& filterT, const ConvDesc& convDesc)
+    {
+        if (in.GetCurrentMatrixLocation() != CurrentDataLocation::CPU || filter.GetCurrentMatrixLocation() != CurrentDataLocation::CPU ||
+            filter.GetMatrixType() != MatrixType::DENSE)
+            return Algorithm::Default;
+        if (in.GetMatrixType() == MatrixType::SPARSE)
+            return in.GetFormat() == matrixFormatSparseCSC ? Algorithm::Sparse : Algorithm::Default;
+        if (filterT.w() == 1 && filterT.h() == 1 && convDesc.wStride() == 1 && convDesc.hStride() == 1)
+            return Algorithm::MatrixProduct;
+        if (filterT.w() * filterT.h() * filterT.c() <= maxDirectKernelSize && filterT.k() >= minDirectOutputChannels)
+            return Algorithm::Direct;
+        return Algorithm::Unpack;
+    }
+
+public:
+    void Forward(const Tensor4D& inT, const Mat& in, const Filter& filterT, const Mat& filter, const ConvDesc& convDesc,
+                 const Tensor4D& outT, Mat& out, Mat& workspace) override
+    {
+        Algorithm algorithm = SelectAlgorithm(in, filter, filterT, convDesc);
+        if (algorithm == Algorithm::Default)
+            return Base::Forward(inT, in, filterT, filter, convDesc, outT, out, workspace);
+
+        assert(inT.w() * inT.h() * inT.c() == in.GetNumRows());
+        assert(inT.n() == in.GetNumCols());
+        assert(filterT.k() == filter.GetNumRows());
+        assert(filterT.w() * filterT.h() * filterT.c() == filter.GetNumCols());
+        assert(inT.c() == filterT.c());
+        assert(outT.c() == filterT.k());
+
+        const Geometry g(inT, filterT, convDesc, outT);
+        const size_t batchSize = inT.n();
+        out.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense, false);
+        out.Resize(g.outputDim, batchSize);
+
+        if (algorithm == Algorithm::Sparse)
+        {
+            Mat::SparseConvolutionForward(filter, in, out, inT.w(), inT.h(), inT.c(), outT.w(), outT.h(),
+                                          filterT.w(), filterT.h(), convDesc.wStride(), convDesc.hStride(), convDesc.padding());
+        }
+        else if (algorithm == Algorithm::MatrixProduct)
+        {
+            // each pixel is a column of inT.c() channels
+            Mat outPixels = out.Reshaped(outT.c(), g.numOutputPixels * batchSize);
+            Mat::Multiply(filter, false, in.Reshaped(inT.c(), g.numOutputPixels * batchSize), false, outPixels);
+        }
+        else if (algorithm == Algorithm::Direct)
+        {
+            const ElemType* pIn = in.BufferPointer();
+            const ElemType* pFilter = filter.BufferPointer();
+            ElemType* pOut = out.BufferPointer();
+#pragma omp parallel for
+            for (long j = 0; j < (long) (batchSize * g.outW); j++)
+                DirectConvolveColumn(pIn + (j / g.outW) * g.inputDim, pFilter, pOut + (j / g.outW) * g.outputDim, j % g.outW, g);
+        }
+        else
+        {
+            const ElemType* pIn = in.BufferPointer();
+            ElemType* pOut = out.BufferPointer();
+            CPUMatrix<ElemType> filterMatrix(g.K, g.packedRows, filter.BufferPointer(), matrixFlagDontOwnBuffer);
+            PrepareThreadWorkspaces(g.packedRows * g.numOutputPixels);
+#pragma omp parallel for
+            for (long sample = 0; sample < (long) batchSize; sample++)
+            {
+                ElemType* pPacked = m_threadWorkspaces[omp_get_thread_num()].data();
+                UnpackSample(pIn + sample * g.inputDim, pPacked, g);
+                CPUMatrix<ElemType> packed(g.packedRows, g.numOutputPixels, pPacked, matrixFlagDontOwnBuffer);
+                CPUMatrix<ElemType> outSample(g.K, g.numOutputPixels, pOut + sample * g.outputDim, matrixFlagDontOwnBuffer);
+                CPUMatrix<ElemType>::MultiplyAndWeightedAdd(1, filterMatrix, false, packed, false, 0, outSample);
+            }
+        }
+
+        assert(outT.w() * outT.h() * outT.c() == out.GetNumRows());
+        assert(outT.n() == out.GetNumCols());
+    }
+
+    void BackwardData(const Tensor4D& srcGradT, const Mat& srcGrad, const Filter& filterT, const Mat& filter, const ConvDesc& convDesc,
+                      const Tensor4D& gradT, Mat& grad, Mat& workspace) override
+    {
+        Algorithm algorithm = SelectAlgorithm(srcGrad, filter, filterT, convDesc);
+        if (algorithm == Algorithm::Default || algorithm == Algorithm::Sparse || grad.GetCurrentMatrixLocation() != CurrentDataLocation::CPU)
+            return Base::BackwardData(srcGradT, srcGrad, filterT, filter, convDesc, gradT, grad, workspace);
+
+        assert(srcGradT.w() * srcGradT.h() * srcGradT.c() == srcGrad.GetNumRows());
+        assert(srcGradT.n() == srcGrad.GetNumCols());
+        assert(gradT.w() * gradT.h() * gradT.c() == grad.GetNumRows());
+        assert(gradT.n() == grad.GetNumCols());
+
+        const Geometry g(gradT, filterT, convDesc, srcGradT);
+        const size_t batchSize = srcGradT.n();
+
+        if (algorithm == Algorithm::MatrixProduct)
+        {
+            Mat gradPixels = grad.Reshaped(gradT.c(), g.numOutputPixels * batchSize);
+            Mat::MultiplyAndAdd(filter, true, srcGrad.Reshaped(srcGradT.c(), g.numOutputPixels * batchSize), false, gradPixels);
+            return;
+        }
+
+        // the direct kernel has no advantage here, so both go through per-sample unpacking
+        const ElemType* pSrcGrad = srcGrad.BufferPointer();
+        ElemType* pGrad = grad.BufferPointer();
+        CPUMatrix<ElemType> filterMatrix(g.K, g.packedRows, filter.BufferPointer(), matrixFlagDontOwnBuffer);
+        PrepareThreadWorkspaces(g.packedRows * g.numOutputPixels);
+#pragma omp parallel for
+        for (long sample = 0; sample < (long) batchSize; sample++)
+        {
+            ElemType* pPacked = m_threadWorkspaces[omp_get_thread_num()].data();
+            CPUMatrix<ElemType> packed(g.packedRows, g.numOutputPixels, pPacked, matrixFlagDontOwnBuffer);
+            CPUMatrix<ElemType> srcGradSample(g.K, g.numOutputPixels, const_cast<ElemType*>(pSrcGrad) + sample * g.outputDim, matrixFlagDontOwnBuffer);
+            CPUMatrix<ElemType>::MultiplyAndWeightedAdd(1, filterMatrix, true, srcGradSample, false, 0, packed);
+            PackedSampleAddTo(pPacked, pGrad + sample * g.inputDim, g);
+        }
+    }
+
+    void BackwardFilter(const Tensor4D& srcGradT, const Mat& srcGrad, const Tensor4D& inT, const Mat& in, const ConvDesc& convDesc,
+                        const Filter& filterT, Mat& filter, bool allowReuse, Mat& workspace) override
+    {
+        Algorithm algorithm = SelectAlgorithm(in, filter, filterT, convDesc);
+        if (algorithm == Algorithm::Default || srcGrad.GetCurrentMatrixLocation() != CurrentDataLocation::CPU)
+            return Base::BackwardFilter(srcGradT, srcGrad, inT, in, convDesc, filterT, filter, allowReuse, workspace);
+
+        assert(srcGradT.w() * srcGradT.h() * srcGradT.c() == srcGrad.GetNumRows());
+        assert(srcGradT.n() == srcGrad.GetNumCols());
+        assert(inT.w() * inT.h() * inT.c() == in.GetNumRows());
+        assert(inT.n() == in.GetNumCols());
+        assert(filterT.k() == filter.GetNumRows());
+        assert(filterT.w() * filterT.h() * filterT.c() == filter.GetNumCols());
+
+        const Geometry g(inT, filterT, convDesc, srcGradT);
+        const size_t batchSize = inT.n();
+        if (batchSize == 0) // nothing to add (and no thread would write its workspace below)
+            return;
+
+        if (algorithm == Algorithm::Sparse)
+        {
+            Mat::SparseConvolutionBackwardFilter(srcGrad, in, filter, inT.w(), inT.h(), inT.c(), srcGradT.w(), srcGradT.h(),
+                                                 filterT.w(), filterT.h(), convDesc.wStride(), convDesc.hStride(), convDesc.padding());
+            return;
+        }
+        if (algorithm == Algorithm::MatrixProduct)
+        {
+            Mat::MultiplyAndAdd(srcGrad.Reshaped(srcGradT.c(), g.numOutputPixels * batchSize), false,
+                                in.Reshaped(inT.c(), g.numOutputPixels * batchSize), true, filter);
+            return;
+        }
+
+        // Each thread unpacks its samples and accumulates their gradients into a filter gradient of its own.
+        // The per-thread gradients are then summed in a fixed order. There are no more threads than samples, so that
+        // each of the summed workspaces is written here; the others may hold results of earlier calls.
+        const ElemType* pIn = in.BufferPointer();
+        const ElemType* pSrcGrad = srcGrad.BufferPointer();
+        const size_t filterSize = g.K * g.packedRows;
+        const int numThreads = (int) min((size_t) max(omp_get_max_threads(), 1), batchSize);
+        PrepareThreadWorkspaces(g.packedRows * g.numOutputPixels + filterSize);
+#pragma omp parallel for num_threads(numThreads) schedule(static, 1)
+        for (int t = 0; t < numThreads; t++)
+        {
+            ElemType* pPacked = m_threadWorkspaces[t].data();
+            ElemType* pFilterGrad = pPacked + g.packedRows * g.numOutputPixels;
+            CPUMatrix<ElemType> packed(g.packedRows, g.numOutputPixels, pPacked, matrixFlagDontOwnBuffer);
+            CPUMatrix<ElemType> filterGrad(g.K, g.packedRows, pFilterGrad, matrixFlagDontOwnBuffer);
+            bool first = true;
+            for (size_t sample = t; sample < batchSize; sample += numThreads)
+            {
+                UnpackSample(pIn + sample * g.inputDim, pPacked, g);
+                CPUMatrix<ElemType> srcGradSample(g.K, g.numOutputPixels, const_cast<ElemType*>(pSrcGrad) + sample * g.outputDim, matrixFlagDontOwnBuffer);
+                CPUMatrix<ElemType>::MultiplyAndWeightedAdd(1, srcGradSample, false, packed, true, first ? 0 : 1, filterGrad);
+                first = false;
+            }
+        }
+        ElemType* pFilter = filter.BufferPointer();
+#pragma omp parallel for
+        for (long i = 0; i < (long) filterSize; i++)
+        {
+            ElemType sum = 0;
+            for (int t = 0; t < numThreads; t++)
+                sum += m_threadWorkspaces[t][g.packedRows * g.numOutputPixels + i];
+            pFilter[i] += sum;
+        }
+    }
+
+private:
+    // The direct kernel is used for filters with at most this many weights per output channel, and enough output channels
+    // to fill its inner loop. Beyond that, a matrix product over the unpacked input is faster (see MathPerformanceTests).
+    static const size_t maxDirectKernelSize = 9;
+    static const size_t minDirectOutputChannels = 32;
+
+    // convolution geometry in the terms of CPUMatrix::AssignPackedConvolutionInput():
+    //  - input element (c, row, col) of a sample is at c + (row + col * inH) * C
+    //  - packed row (c, kernelRow, kernelCol) is c * kW * kH + kernelCol * kH + kernelRow, which is also the filter column
+    //  - output pixel (row, col) is pixel col * outH + row, with its K channels next to each other
+    struct Geometry
+    {
+        size_t inW, inH, C;
+        size_t outW, outH, K;
+        size_t kW, kH;
+        size_t strideW, strideH;
+        long padW, padH;
+        size_t inputDim, outputDim, numOutputPixels, packedRows;
+
+        Geometry(const Tensor4D& inT, const Filter& filterT, const ConvDesc& convDesc, const Tensor4D& outT)
+            : inW(inT.w()), inH(inT.h()), C(inT.c()), outW(outT.w()), outH(outT.h()), K(outT.c()), kW(filterT.w()), kH(filterT.h()),
+              strideW(convDesc.wStride()), strideH(convDesc.hStride()),
+              padW(convDesc.padding() ? (long) filterT.w() / 2 : 0), padH(convDesc.padding() ? (long) filterT.h() / 2 : 0)
+        {
+            inputDim = inW * inH * C;
+            outputDim = outW * outH * K;
+            numOutputPixels = outW * outH;
+            packedRows = kW * kH * C;
+        }
+    };
+
+    // unpack (im2col) one sample; out-of-image positions (padding) become 0
+    static void UnpackSample(const ElemType* pIn, ElemType* pPacked, const Geometry& g)
+    {
+        for (size_t wcol = 0; wcol < g.outW; wcol++)
+        {
+            for (size_t wrow = 0; wrow < g.outH; wrow++)
+            {
+                ElemType* pPixel = pPacked + (wcol * g.outH + wrow) * g.packedRows;
+                for (size_t kcol = 0; kcol < g.kW; kcol++)
+                {
+                    const long col = (long) (wcol * g.strideW + kcol) - g.padW;
+                    for (size_t krow = 0; krow < g.kH; krow++)
+                    {
+                        const long row = (long) (wrow * g.strideH + krow) - g.padH;
+                        ElemType* pDst = pPixel + kcol * g.kH + krow;
+                        if (col < 0 || col >= (long) g.inW || row < 0 || row >= (long) g.inH)
+                        {
+                            for (size_t c = 0; c < g.C; c++)
+                                pDst[c * g.kW * g.kH] = 0;
+                        }
+                        else
+                        {
+                            const ElemType* pSrc = pIn + (row + col * g.inH) * g.C;
+                            for (size_t c = 0; c < g.C; c++)
+                                pDst[c * g.kW * g.kH] = pSrc[c];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // inverse of UnpackSample(): add the unpacked values back to the image they came from (col2im)
+    static void PackedSampleAddTo(const ElemType* pPacked, ElemType* pIn, const Geometry& g)
+    {
+        for (size_t wcol = 0; wcol < g.outW; wcol++)
+        {
+            for (size_t wrow = 0; wrow < g.outH; wrow++)
+            {
+                const ElemType* pPixel = pPacked + (wcol * g.outH + wrow) * g.packedRows;
+                for (size_t kcol = 0; kcol < g.kW; kcol++)
+                {
+                    const long col = (long) (wcol * g.strideW + kcol) - g.padW;
+                    if (col < 0 || col >= (long) g.inW)
+                        continue;
+                    for (size_t krow = 0; krow < g.kH; krow++)
+                    {
+                        const long row = (long) (wrow * g.strideH + krow) - g.padH;
+                        if (row < 0 || row >= (long) g.inH)
+                            continue;
+                        const ElemType* pSrc = pPixel + kcol * g.kH + krow;
+                        ElemType* pDst = pIn + (row + col * g.inH) * g.C;
+                        for (size_t c = 0; c < g.C; c++)
+                            pDst[c] += pSrc[c * g.kW * g.kH];
+                    }
+                }
+            }
+        }
+    }
+
+    // direct convolution of one output column (all output rows at one col) of one sample
+    // The innermost loop runs over the output channels, which are contiguous both in the output and in the filter.
+    static void DirectConvolveColumn(const ElemType* pIn, const ElemType* pFilter, ElemType* pOut, size_t wcol, const Geometry& g)
+    {
+        for (size_t wrow = 0; wrow < g.outH; wrow++)
+        {
+            ElemType* pPixel = pOut + (wcol * g.outH + wrow) * g.K;
+            for (size_t k = 0; k < g.K; k++)
+                pPixel[k] = 0;
+            for (size_t kcol = 0; kcol < g.kW; kcol++)
+            {
+                const long col = (long) (wcol * g.strideW + kcol) - g.padW;
+                if (col < 0 || col >= (long) g.inW)
+                    continue;
+                for (size_t krow = 0; krow < g.kH; krow++)
+                {
+                    const long row = (long) (wrow * g.strideH + krow) - g.padH;
+                    if (row < 0 || row >= (long) g.inH)
+                        continue;
+                    const ElemType* pSrc = pIn + (row + col * g.inH) * g.C;
+                    for (size_t c = 0; c < g.C; c++)
+                    {
+                        const ElemType value = pSrc[c];
+                        const ElemType* pWeights = pFilter + (c * g.kW * g.kH + kcol * g.kH + krow) * g.K;
+                        for (size_t k = 0; k < g.K; k++)
+                            pPixel[k] += value * pWeights[k];
+                    }
+                }
+            }
+        }
+    }
+
+    void PrepareThreadWorkspaces(size_t size)
+    {
+        m_threadWorkspaces.resize(omp_get_max_threads());
+        for (auto& workspace : m_threadWorkspaces)
+            if (workspace.size() < size)
+                workspace.resize(size);
+    }
+
+    std::vector<std::vector<ElemType>> m_threadWorkspaces;
+};
+
 template class ConvolutionEngine<float>;
 template class ConvolutionEngine<double>;
 
@@ -460,6 +817,20 @@ public:
     }
 };
 
+template <class ElemType>
+class CpuConvolutionEngineFactory : public DefaultConvolutionEngineFactory<ElemType>
+{
+public:
+    using Base = DefaultConvolutionEngineFactory<ElemType>;
+    using typename Base::ConvEnginePtr;
+
+public:
+    ConvEnginePtr CreateConvEngine(DEVICEID_TYPE deviceId, size_t maxTempMemSizeInSamples, BatchNormImpl /*bnImpl*/) override
+    {
+        return std::make_unique<CpuConvolutionEngine<ElemType>>(deviceId, maxTempMemSizeInSamples);
+    }
+};
+
 template <class ElemType>
 std::unique_ptr<ConvolutionEngineFactory<ElemType>> ConvolutionEngineFactory<ElemType>::Create(DEVICEID_TYPE deviceId, EngineType engType, ImageLayoutKind imageLayoutKind)
 {
@@ -468,6 +839,8 @@ std::unique_ptr<ConvolutionEngineFactory<ElemType>> ConvolutionEngineFactory<Ele
         // REVIEW alexeyk: make cuDNN default when running on GPU and compiled with cuDNN, add config parameter to enable runtime switch between implementations.
         if (deviceId >= 0 && CuDnnConvolutionEngineFactory<ElemType>::IsSupported(deviceId) && imageLayoutKind == ImageLayoutKind::CHW)
             return Create(deviceId, EngineType::CuDnn, imageLayoutKind);
+        else if (deviceId < 0 && imageLayoutKind == ImageLayoutKind::HWC)
+            return Create(deviceId, EngineType::Cpu, imageLayoutKind);
         else
             return Create(deviceId, EngineType::Legacy, imageLayoutKind);
     }
@@ -487,6 +860,12 @@ std::unique_ptr<ConvolutionEngineFactory<ElemType>> ConvolutionEngineFactory<Ele
         // InvalidArgument("ConvolutionEngineFactory: ImageLayout '%s' is not compatible with the legacy convolution engine.", ToString(imageLayoutKind).c_str());
         return std::make_unique<DefaultConvolutionEngineFactory<ElemType>>();
     }
+    else if (engType == EngineType::Cpu)
+    {
+        if (imageLayoutKind != ImageLayoutKind::HWC)
+            InvalidArgument("ConvolutionEngineFactory: ImageLayout '%s' is not compatible with the CPU convolution engine.", ToString(imageLayoutKind).c_str());
+        return std::make_unique<CpuConvolutionEngineFactory<ElemType>>();
+    }
 
     RuntimeError("Not supported convolution engine type: %d.", (int)engType);
 }
@@ -331,7 +331,8 @@ public:
     {
         Auto,
         CuDnn,
-        Legacy
+        Legacy,
+        Cpu // HWC layout on the CPU only; falls back to Legacy for data on the GPU
     };
     static std::unique_ptr<ConvolutionEngineFactory<ElemType>> Create(DEVICEID_TYPE deviceId, EngineType engType, ImageLayoutKind imageLayoutKind);
 
@@ -4743,6 +4743,80 @@ void GPUMatrix<ElemType>::RCRFTransGrdCompute(const GPUMatrix<ElemType>& lbls,
     TracingGPUMemoryAllocator::Free<ElemType>(alpha.GetComputeDeviceId(), d_zeta);
 };
 
+// -----------------------------------------------------------------------
+// fused LSTM/GRU cells (see CPUMatrix.cpp for the matrix layouts)
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+void GPUMatrix<ElemType>::LSTMCellForward(GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& peepholes,
+                                          const GPUMatrix<ElemType>& cPrev, GPUMatrix<ElemType>& c, GPUMatrix<ElemType>& h)
+{
+    const CUDA_LONG H = (CUDA_LONG) c.GetNumRows();
+    const CUDA_LONG S = (CUDA_LONG) c.GetNumCols();
+    if (gates.GetNumRows() != 4 * H || gates.GetNumCols() != S || cPrev.GetNumRows() != H || cPrev.GetNumCols() != S ||
+        h.GetNumRows() != H || h.GetNumCols() != S || peepholes.GetNumRows() != H || peepholes.GetNumCols() != 3)
+        LogicError("LSTMCellForward: The dimensions of the gates, peephole and state matrices do not match.");
+
+    gates.PrepareDevice();
+    CUDA_LONG N = H * S;
+    int blocksPerGrid = (int) ceil(1.0 * N / GridDim::maxThreadsPerBlock);
+    _lstmCellForward<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(gates.m_pArray, peepholes.m_pArray, cPrev.m_pArray, c.m_pArray, h.m_pArray, H, N);
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::LSTMCellBackward(const GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& peepholes,
+                                           const GPUMatrix<ElemType>& cPrev, const GPUMatrix<ElemType>& c, const GPUMatrix<ElemType>& dh,
+                                           GPUMatrix<ElemType>& dc, GPUMatrix<ElemType>& dGates, GPUMatrix<ElemType>& dPeepholes)
+{
+    const CUDA_LONG H = (CUDA_LONG) c.GetNumRows();
+    const CUDA_LONG S = (CUDA_LONG) c.GetNumCols();
+    if (gates.GetNumRows() != 4 * H || gates.GetNumCols() != S || dGates.GetNumRows() != 4 * H || dGates.GetNumCols() != S ||
+        cPrev.GetNumRows() != H || cPrev.GetNumCols() != S || dh.GetNumRows() != H || dh.GetNumCols() != S ||
+        dc.GetNumRows() != H || dc.GetNumCols() != S || peepholes.GetNumRows() != H || peepholes.GetNumCols() != 3 ||
+        dPeepholes.GetNumRows() != H || dPeepholes.GetNumCols() != 3)
+        LogicError("LSTMCellBackward: The dimensions of the gates, peephole and state matrices do not match.");
+
+    gates.PrepareDevice();
+    int blocksPerGrid = (int) ceil(1.0 * H / GridDim::maxThreadsPerBlock);
+    _lstmCellBackward<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(gates.m_pArray, peepholes.m_pArray, cPrev.m_pArray, c.m_pArray, dh.m_pArray,
+                                                                                             dc.m_pArray, dGates.m_pArray, dPeepholes.m_pArray, H, S);
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::GRUCellForward(GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& hiddenProj,
+                                         const GPUMatrix<ElemType>& hPrev, GPUMatrix<ElemType>& h)
+{
+    const CUDA_LONG H = (CUDA_LONG) h.GetNumRows();
+    const CUDA_LONG S = (CUDA_LONG) h.GetNumCols();
+    if (gates.GetNumRows() != 3 * H || gates.GetNumCols() != S || hiddenProj.GetNumRows() != 3 * H || hiddenProj.GetNumCols() != S ||
+        hPrev.GetNumRows() != H || hPrev.GetNumCols() != S)
+        LogicError("GRUCellForward: The dimensions of the gates and state matrices do not match.");
+
+    gates.PrepareDevice();
+    CUDA_LONG N = H * S;
+    int blocksPerGrid = (int) ceil(1.0 * N / GridDim::maxThreadsPerBlock);
+    _gruCellForward<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(gates.m_pArray, hiddenProj.m_pArray, hPrev.m_pArray, h.m_pArray, H, N);
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::GRUCellBackward(const GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& hiddenProj,
+                                          const GPUMatrix<ElemType>& hPrev, const GPUMatrix<ElemType>& dh,
+                                          GPUMatrix<ElemType>& dGates, GPUMatrix<ElemType>& dHiddenProj, GPUMatrix<ElemType>& dhPrev)
+{
+    const CUDA_LONG H = (CUDA_LONG) dh.GetNumRows();
+    const CUDA_LONG S = (CUDA_LONG) dh.GetNumCols();
+    if (gates.GetNumRows() != 3 * H || gates.GetNumCols() != S || hiddenProj.GetNumRows() != 3 * H || hiddenProj.GetNumCols() != S ||
+        dGates.GetNumRows() != 3 * H || dGates.GetNumCols() != S || dHiddenProj.GetNumRows() != 3 * H || dHiddenProj.GetNumCols() != S ||
+        hPrev.GetNumRows() != H || hPrev.GetNumCols() != S || dhPrev.GetNumRows() != H || dhPrev.GetNumCols() != S)
+        LogicError("GRUCellBackward: The dimensions of the gates and state matrices do not match.");
+
+    gates.PrepareDevice();
+    CUDA_LONG N = H * S;
+    int blocksPerGrid = (int) ceil(1.0 * N / GridDim::maxThreadsPerBlock);
+    _gruCellBackward<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(gates.m_pArray, hiddenProj.m_pArray, hPrev.m_pArray, dh.m_pArray,
+                                                                                            dGates.m_pArray, dHiddenProj.m_pArray, dhPrev.m_pArray, H, N);
+}
+
 // -----------------------------------------------------------------------
 // TensorView entry points from Matrix.cpp
 // -----------------------------------------------------------------------
@@ -484,6 +484,19 @@ public:
                                     const int startLbl, // the time 0 start symbol in the output layer
                                     const int shift);
 
+public:
+    // fused recurrent cells (one time step of LSTMNode/GRUNode, all parallel sequences at once)
+    static void LSTMCellForward(GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& peepholes,
+                                const GPUMatrix<ElemType>& cPrev, GPUMatrix<ElemType>& c, GPUMatrix<ElemType>& h);
+    static void LSTMCellBackward(const GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& peepholes,
+                                 const GPUMatrix<ElemType>& cPrev, const GPUMatrix<ElemType>& c, const GPUMatrix<ElemType>& dh,
+                                 GPUMatrix<ElemType>& dc, GPUMatrix<ElemType>& dGates, GPUMatrix<ElemType>& dPeepholes);
+    static void GRUCellForward(GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& hiddenProj,
+                               const GPUMatrix<ElemType>& hPrev, GPUMatrix<ElemType>& h);
+    static void GRUCellBackward(const GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& hiddenProj,
+                                const GPUMatrix<ElemType>& hPrev, const GPUMatrix<ElemType>& dh,
+                                GPUMatrix<ElemType>& dGates, GPUMatrix<ElemType>& dHiddenProj, GPUMatrix<ElemType>& dhPrev);
+
 public:
     friend File& operator>>(File& stream, GPUMatrix<ElemType>& us)
     {
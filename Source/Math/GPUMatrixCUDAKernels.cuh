@@ -4847,6 +4847,138 @@ __global__ void _rcrfTransGrdCompute(
     }
 };
 
+// fused LSTM cell, one thread per (row, sequence); see CPUMatrix::LSTMCellForward() for the layout
+template <class ElemType>
+__global__ void _lstmCellForward(
+    ElemType* gates,
+    const ElemType* peepholes,
+    const ElemType* cPrev,
+    ElemType* c,
+    ElemType* h,
+    const CUDA_LONG H,
+    const CUDA_LONG N) // H * S
+{
+    CALCULATE_ELEMENTWISE_INDEX_OR_EXIT(id, N);
+    CUDA_LONG r = id % H;
+    CUDA_LONG j = id / H;
+    ElemType* g = gates + 4 * H * j;
+    ElemType cp = cPrev[id];
+    ElemType it = Microsoft::MSR::CNTK::Sigmoid(g[r] + peepholes[r] * cp);
+    ElemType ft = Microsoft::MSR::CNTK::Sigmoid(g[H + r] + peepholes[H + r] * cp);
+    ElemType gt = tanh_(g[2 * H + r]);
+    ElemType ct = ft * cp + it * gt;
+    ElemType ot = Microsoft::MSR::CNTK::Sigmoid(g[3 * H + r] + peepholes[2 * H + r] * ct);
+    g[r] = it;
+    g[H + r] = ft;
+    g[2 * H + r] = gt;
+    g[3 * H + r] = ot;
+    c[id] = ct;
+    h[id] = ot * tanh_(ct);
+}
+
+// fused LSTM cell backward, one thread per row so that the peephole gradient is accumulated without atomics
+template <class ElemType>
+__global__ void _lstmCellBackward(
+    const ElemType* gates,
+    const ElemType* peepholes,
+    const ElemType* cPrev,
+    const ElemType* c,
+    const ElemType* dh,
+    ElemType* dc,
+    ElemType* dGates,
+    ElemType* dPeepholes,
+    const CUDA_LONG H,
+    const CUDA_LONG S)
+{
+    CALCULATE_ELEMENTWISE_INDEX_OR_EXIT(r, H);
+    ElemType dpi = 0, dpf = 0, dpo = 0;
+    for (CUDA_LONG j = 0; j < S; j++)
+    {
+        const ElemType* g = gates + 4 * H * j;
+        ElemType* dg = dGates + 4 * H * j;
+        CUDA_LONG k = H * j + r;
+        ElemType it = g[r], ft = g[H + r], gt = g[2 * H + r], ot = g[3 * H + r];
+        ElemType cp = cPrev[k];
+        ElemType ct = c[k];
+        ElemType tc = tanh_(ct);
+        ElemType dhv = dh[k];
+
+        ElemType dGo = dhv * tc * ot * (1 - ot);
+        ElemType dcv = dc[k] + dhv * ot * (1 - tc * tc) + dGo * peepholes[2 * H + r];
+        ElemType dGi = dcv * gt * it * (1 - it);
+        ElemType dGf = dcv * cp * ft * (1 - ft);
+        ElemType dGg = dcv * it * (1 - gt * gt);
+        dg[r] = dGi;
+        dg[H + r] = dGf;
+        dg[2 * H + r] = dGg;
+        dg[3 * H + r] = dGo;
+        dc[k] = dcv * ft + dGi * peepholes[r] + dGf * peepholes[H + r];
+
+        dpi += dGi * cp;
+        dpf += dGf * cp;
+        dpo += dGo * ct;
+    }
+    dPeepholes[r] += dpi;
+    dPeepholes[H + r] += dpf;
+    dPeepholes[2 * H + r] += dpo;
+}
+
+// fused GRU cell; see CPUMatrix::GRUCellForward() for the layout
+template <class ElemType>
+__global__ void _gruCellForward(
+    ElemType* gates,
+    const ElemType* hiddenProj,
+    const ElemType* hPrev,
+    ElemType* h,
+    const CUDA_LONG H,
+    const CUDA_LONG N) // H * S
+{
+    CALCULATE_ELEMENTWISE_INDEX_OR_EXIT(id, N);
+    CUDA_LONG r = id % H;
+    CUDA_LONG j = id / H;
+    ElemType* g = gates + 3 * H * j;
+    const ElemType* rh = hiddenProj + 3 * H * j;
+    ElemType zt = Microsoft::MSR::CNTK::Sigmoid(g[r] + rh[r]);
+    ElemType rt = Microsoft::MSR::CNTK::Sigmoid(g[H + r] + rh[H + r]);
+    ElemType nt = tanh_(g[2 * H + r] + rt * rh[2 * H + r]);
+    g[r] = zt;
+    g[H + r] = rt;
+    g[2 * H + r] = nt;
+    h[id] = (1 - zt) * nt + zt * hPrev[id];
+}
+
+template <class ElemType>
+__global__ void _gruCellBackward(
+    const ElemType* gates,
+    const ElemType* hiddenProj,
+    const ElemType* hPrev,
+    const ElemType* dh,
+    ElemType* dGates,
+    ElemType* dHiddenProj,
+    ElemType* dhPrev,
+    const CUDA_LONG H,
+    const CUDA_LONG N) // H * S
+{
+    CALCULATE_ELEMENTWISE_INDEX_OR_EXIT(id, N);
+    CUDA_LONG r = id % H;
+    CUDA_LONG j = id / H;
+    const ElemType* g = gates + 3 * H * j;
+    const ElemType* rh = hiddenProj + 3 * H * j;
+    ElemType* dg = dGates + 3 * H * j;
+    ElemType* drh = dHiddenProj + 3 * H * j;
+    ElemType zt = g[r], rt = g[H + r], nt = g[2 * H + r];
+    ElemType dGn = dh[id] * (1 - zt) * (1 - nt * nt);
+    ElemType dGz = dh[id] * (hPrev[id] - nt) * zt * (1 - zt);
+    ElemType dGr = dGn * rh[2 * H + r] * rt * (1 - rt);
+    dg[r] = dGz;
+    dg[H + r] = dGr;
+    dg[2 * H + r] = dGn;
+    drh[r] = dGz;
+    drh[H + r] = dGr;
+    drh[2 * H + r] = dGn * rt;
+    dhPrev[id] = dh[id] * zt;
+}
+
 template <class ElemType>
 __global__ void _reductionLogAddSum(
     const ElemType* data,
@@ -588,15 +588,57 @@ void Matrix<ElemType>::Read(File& stream)
             M.SetDataLocation(GPU, SPARSE);
         }
     }
+    else if (type == 'm') // dense, stored as an aligned blob (see File::IsMappable())
+    {
+        if (M.GetDeviceId() < 0)
+        {
+            if (M.m_CPUMatrix == NULL)
+                M.m_CPUMatrix = new CPUMatrix<ElemType>();
+            M.m_CPUMatrix->ReadMappable(stream); // refers to the mapped file if it is mapped
+            M.SetDataLocation(CPU, DENSE);
+        }
+        else
+        {
+            CPUMatrix<ElemType> hostMatrix;
+            hostMatrix.ReadMappable(stream);
+            if (M.m_GPUMatrix == NULL)
+                M.m_GPUMatrix = new GPUMatrix<ElemType>(M.GetDeviceId());
+            if (hostMatrix.IsEmpty())
+                M.m_GPUMatrix->Resize(hostMatrix.GetNumRows(), hostMatrix.GetNumCols());
+            else
+                M.m_GPUMatrix->SetValue(hostMatrix.GetNumRows(), hostMatrix.GetNumCols(), M.GetDeviceId(), hostMatrix.BufferPointer());
+            M.SetDataLocation(GPU, DENSE);
+        }
+    }
     else
         LogicError("Read: Input file corrupt (invalid matrix type field 0x%02d, should be 'f' or 'd').", type);
 }
 
+template <class ElemType>
+void Matrix<ElemType>::MakeWritable()
+{
+    if (m_CPUMatrix != nullptr)
+        m_CPUMatrix->MakeWritable();
+}
+
 template <class ElemType>
 void Matrix<ElemType>::Write(File& stream) const
 {
     const Matrix<ElemType>& M = *this;
-    if (M.GetMatrixType() == MatrixType::DENSE)
+    if (M.GetMatrixType() == MatrixType::DENSE && stream.IsMappable())
+    {
+        stream << 'm';
+        if (M.GetDeviceId() < 0)
+            M.m_CPUMatrix->WriteMappable(stream);
+        else
+        {
+            CPUMatrix<ElemType> hostMatrix(M.GetNumRows(), M.GetNumCols());
+            if (!M.IsEmpty())
+                M.m_GPUMatrix->CopySection(M.GetNumRows(), M.GetNumCols(), hostMatrix.BufferPointer(), M.GetNumRows());
+            hostMatrix.WriteMappable(stream);
+        }
+    }
+    else if (M.GetMatrixType() == MatrixType::DENSE)
     {
         stream << 'd';
         if (M.GetDeviceId() < 0)
@@ -1024,6 +1066,7 @@ const ElemType Matrix<ElemType>::operator()(const size_t row, const size_t col)
 template <class ElemType>
 ElemType& Matrix<ElemType>::operator()(const size_t row, const size_t col)
 {
+    MakeWritable(); // the caller may write through the reference
     DISPATCH_MATRIX_ON_FLAG_USECPU_4BOTH(this,
                                          nullptr,
                                          return m_CPUMatrix->operator()(row, col),
@@ -1364,8 +1407,7 @@ void Matrix<ElemType>::NormalGrad(Matrix<ElemType>& gradients,
                                 functionValues -= *this,
                                 ScaleAndAdd((1 - momentum) * learnRatePerSample, gradients, momentum, *this);
                                 functionValues -= *this,
-                                if (momentum != 0) gradients.m_CPUSparseMatrix->NormalGrad(*m_CPUMatrix, momentum);
-                                ScaleAndAdd(-learnRatePerSample, gradients, functionValues),
+                                gradients.m_CPUSparseMatrix->NormalGrad(*m_CPUMatrix, *functionValues.m_CPUMatrix, learnRatePerSample, momentum, false),
                                 if (momentum != 0) gradients.m_GPUSparseMatrix->NormalGrad(*m_GPUMatrix, momentum);
                                 ScaleAndAdd(-learnRatePerSample, gradients, functionValues));
     }
@@ -1385,14 +1427,7 @@ void Matrix<ElemType>::NormalGrad(Matrix<ElemType>& gradients,
                                   ScaleAndAdd(-(1 - momentum) * learnRatePerSample, gradients, functionValues);
                                 },
                                 { /* CPU sparse */
-                                  if (momentum != 0)
-                                  {
-                                      Matrix<ElemType> gradientCache(gradients.GetDeviceId());
-                                      gradientCache.SetValue(gradients);
-                                      gradients.m_CPUSparseMatrix->NormalGrad(*m_CPUMatrix, momentum);
-                                      ScaleAndAdd(-momentum, *this, functionValues);
-                                      ScaleAndAdd(-(1 - momentum) * learnRatePerSample, gradientCache, functionValues);
-                                  }
+                                  gradients.m_CPUSparseMatrix->NormalGrad(*m_CPUMatrix, *functionValues.m_CPUMatrix, learnRatePerSample, momentum, true);
                                 },
                                 { /* GPU sparse */
                                   if (momentum != 0)
@@ -4209,6 +4244,106 @@ void Matrix<ElemType>::ConvolveAndWeightedAdd(ElemType alpha, const Matrix<ElemT
     }
 }
 
+template <class ElemType>
+/*static*/ void Matrix<ElemType>::SparseConvolutionForward(const Matrix<ElemType>& filter, const Matrix<ElemType>& in, Matrix<ElemType>& out,
+                                                         const size_t inputWidth, const size_t inputHeight, const size_t inputChannels,
+                                                         const size_t outputWidth, const size_t outputHeight,
+                                                         const size_t kernelWidth, const size_t kernelHeight, const size_t horizontalSubsample, const size_t verticalSubsample,
+                                                         const bool zeroPadding)
+{
+    DecideAndMoveToRightDevice(filter, in, out);
+
+    if (in.GetDeviceId() < 0 && in.GetMatrixType() == MatrixType::SPARSE && filter.GetMatrixType() == MatrixType::DENSE)
+    {
+        out.SwitchToMatrixType(MatrixType::DENSE, matrixFormatDense, false);
+        CPUSparseMatrix<ElemType>::ConvolutionForward(*filter.m_CPUMatrix, *in.m_CPUSparseMatrix, *out.m_CPUMatrix,
+                                                      inputWidth, inputHeight, inputChannels, outputWidth, outputHeight,
+                                                      kernelWidth, kernelHeight, horizontalSubsample, verticalSubsample, zeroPadding);
+        out.SetDataLocation(CPU, DENSE);
+    }
+    else
+    {
+        NOT_IMPLEMENTED;
+    }
+}
+
+template <class ElemType>
+/*static*/ void Matrix<ElemType>::SparseConvolutionBackwardFilter(const Matrix<ElemType>& srcGrad, const Matrix<ElemType>& in, Matrix<ElemType>& filterGrad,
+                                                                const size_t inputWidth, const size_t inputHeight, const size_t inputChannels,
+                                                                const size_t outputWidth, const size_t outputHeight,
+                                                                const size_t kernelWidth, const size_t kernelHeight, const size_t horizontalSubsample, const size_t verticalSubsample,
+                                                                const bool zeroPadding)
+{
+    DecideAndMoveToRightDevice(srcGrad, in, filterGrad);
+
+    if (in.GetDeviceId() < 0 && in.GetMatrixType() == MatrixType::SPARSE && srcGrad.GetMatrixType() == MatrixType::DENSE && filterGrad.GetMatrixType() == MatrixType::DENSE)
+    {
+        CPUSparseMatrix<ElemType>::ConvolutionBackwardFilter(*srcGrad.m_CPUMatrix, *in.m_CPUSparseMatrix, *filterGrad.m_CPUMatrix,
+                                                             inputWidth, inputHeight, inputChannels, outputWidth, outputHeight,
+                                                             kernelWidth, kernelHeight, horizontalSubsample, verticalSubsample, zeroPadding);
+    }
+    else
+    {
+        NOT_IMPLEMENTED;
+    }
+}
+
+template <class ElemType>
+/*static*/ void Matrix<ElemType>::SparseColumnLookup(const Matrix<ElemType>& table, const Matrix<ElemType>& indices, Matrix<ElemType>& out)
+{
+    DecideAndMoveToRightDevice(table, indices, out);
+
+    if (indices.GetDeviceId() < 0 && indices.GetMatrixType() == MatrixType::SPARSE && table.GetMatrixType() == MatrixType::DENSE)
+    {
+        out.SwitchToMatrixType(MatrixType::DENSE, matrixFormatDense, false);
+        CPUSparseMatrix<ElemType>::ColumnLookup(*table.m_CPUMatrix, *indices.m_CPUSparseMatrix, *out.m_CPUMatrix);
+        out.SetDataLocation(CPU, DENSE);
+    }
+    else
+    {
+        NOT_IMPLEMENTED;
+    }
+}
+
+template <class ElemType>
+/*static*/ void Matrix<ElemType>::SparseColumnLookupGradient(const Matrix<ElemType>& outGrad, const Matrix<ElemType>& indices, Matrix<ElemType>& tableGrad)
+{
+    DecideAndMoveToRightDevice(outGrad, indices, tableGrad);
+
+    if (indices.GetDeviceId() < 0 && indices.GetMatrixType() == MatrixType::SPARSE && outGrad.GetMatrixType() == MatrixType::DENSE)
+    {
+        if (tableGrad.GetMatrixType() == MatrixType::DENSE)
+            CPUSparseMatrix<ElemType>::ColumnLookupGradient(*outGrad.m_CPUMatrix, *indices.m_CPUSparseMatrix, *tableGrad.m_CPUMatrix);
+        else
+        {
+            CPUSparseMatrix<ElemType>::ColumnLookupGradient(*outGrad.m_CPUMatrix, *indices.m_CPUSparseMatrix, *tableGrad.m_CPUSparseMatrix);
+            tableGrad.SetDataLocation(CPU, SPARSE);
+        }
+    }
+    else
+    {
+        NOT_IMPLEMENTED;
+    }
+}
+
+template <class ElemType>
+void Matrix<ElemType>::GetNonZeroRowIds(std::vector<size_t>& ids) const
+{
+    if (GetDeviceId() < 0 && GetMatrixType() == MatrixType::SPARSE)
+        m_CPUSparseMatrix->GetNonZeroRowIds(ids);
+    else
+        NOT_IMPLEMENTED;
+}
+
+template <class ElemType>
+void Matrix<ElemType>::GetNonZeroColumnIds(std::vector<size_t>& ids) const
+{
+    if (GetDeviceId() < 0 && GetMatrixType() == MatrixType::SPARSE)
+        m_CPUSparseMatrix->GetNonZeroColumnIds(ids);
+    else
+        NOT_IMPLEMENTED;
+}
+
 /// <summary>Matrix-scalar multiply with col-major matrices: c = alpha * a + c</summary>
 /// if a is a column vector, add to all columns of c
 /// if a is a row vector, add to all rows of c
@@ -4965,6 +5100,135 @@ void Matrix<ElemType>::RCRFTransGrdCompute(const Matrix<ElemType>& lbls,
                             NOT_IMPLEMENTED);
 }
 
+template <class ElemType>
+ElemType Matrix<ElemType>::RCRFForwardBackward(const Matrix<ElemType>& lbls, const Matrix<ElemType>& pos_scores, const Matrix<ElemType>& pair_scores,
+                                               Matrix<ElemType>& alpha, Matrix<ElemType>& beta, Matrix<ElemType>& postprob,
+                                               const std::vector<RCRFSequence>& sequences)
+{
+    DecideAndMoveToRightDevice(lbls, pos_scores, pair_scores);
+    alpha._transferToDevice(lbls.GetDeviceId());
+    beta._transferToDevice(lbls.GetDeviceId());
+    postprob._transferToDevice(lbls.GetDeviceId());
+
+    DISPATCH_MATRIX_ON_FLAG(&lbls,
+                            nullptr,
+                            return CPUMatrix<ElemType>::RCRFForwardBackward(*lbls.m_CPUMatrix, *pos_scores.m_CPUMatrix, *pair_scores.m_CPUMatrix,
+                                                                            *alpha.m_CPUMatrix, *beta.m_CPUMatrix, *postprob.m_CPUMatrix, sequences),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+template <class ElemType>
+void Matrix<ElemType>::RCRFTransGrdCompute(const Matrix<ElemType>& lbls, const Matrix<ElemType>& alpha, const Matrix<ElemType>& beta,
+                                           const Matrix<ElemType>& pair_scores, Matrix<ElemType>& grd,
+                                           const std::vector<RCRFSequence>& sequences)
+{
+    DecideAndMoveToRightDevice(alpha, grd);
+    grd._transferToDevice(alpha.GetDeviceId());
+
+    DISPATCH_MATRIX_ON_FLAG(&alpha,
+                            &grd,
+                            CPUMatrix<ElemType>::RCRFTransGrdCompute(*lbls.m_CPUMatrix, *alpha.m_CPUMatrix, *beta.m_CPUMatrix, *pair_scores.m_CPUMatrix,
+                                                                     *grd.m_CPUMatrix, sequences),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+template <class ElemType>
+void Matrix<ElemType>::RCRFViterbi(const Matrix<ElemType>& lbls, const Matrix<ElemType>& pos_scores, const Matrix<ElemType>& pair_scores,
+                                   Matrix<ElemType>& decodedPath, const std::vector<RCRFSequence>& sequences)
+{
+    DecideAndMoveToRightDevice(lbls, pos_scores, pair_scores);
+    decodedPath._transferToDevice(lbls.GetDeviceId());
+
+    DISPATCH_MATRIX_ON_FLAG(&lbls,
+                            &decodedPath,
+                            CPUMatrix<ElemType>::RCRFViterbi(*lbls.m_CPUMatrix, *pos_scores.m_CPUMatrix, *pair_scores.m_CPUMatrix, *decodedPath.m_CPUMatrix, sequences),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+// -----------------------------------------------------------------------
+// fused LSTM/GRU cells (see CPUMatrix.cpp for the matrix layouts)
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+void Matrix<ElemType>::LSTMCellForward(Matrix<ElemType>& gates, const Matrix<ElemType>& peepholes,
+                                       const Matrix<ElemType>& cPrev, Matrix<ElemType>& c, Matrix<ElemType>& h)
+{
+    DecideAndMoveToRightDevice(gates, peepholes, cPrev);
+    c._transferToDevice(gates.GetDeviceId());
+    h._transferToDevice(gates.GetDeviceId());
+
+    DISPATCH_MATRIX_ON_FLAG(&gates,
+                            &h,
+                            CPUMatrix<ElemType>::LSTMCellForward(*gates.m_CPUMatrix, *peepholes.m_CPUMatrix, *cPrev.m_CPUMatrix, *c.m_CPUMatrix, *h.m_CPUMatrix),
+                            GPUMatrix<ElemType>::LSTMCellForward(*gates.m_GPUMatrix, *peepholes.m_GPUMatrix, *cPrev.m_GPUMatrix, *c.m_GPUMatrix, *h.m_GPUMatrix),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+template <class ElemType>
+void Matrix<ElemType>::LSTMCellBackward(const Matrix<ElemType>& gates, const Matrix<ElemType>& peepholes,
+                                        const Matrix<ElemType>& cPrev, const Matrix<ElemType>& c, const Matrix<ElemType>& dh,
+                                        Matrix<ElemType>& dc, Matrix<ElemType>& dGates, Matrix<ElemType>& dPeepholes)
+{
+    DecideAndMoveToRightDevice(gates, peepholes, cPrev);
+    c._transferToDevice(gates.GetDeviceId());
+    dh._transferToDevice(gates.GetDeviceId());
+    dc._transferToDevice(gates.GetDeviceId());
+    dGates._transferToDevice(gates.GetDeviceId());
+    dPeepholes._transferToDevice(gates.GetDeviceId());
+
+    DISPATCH_MATRIX_ON_FLAG(&gates,
+                            &dGates,
+                            CPUMatrix<ElemType>::LSTMCellBackward(*gates.m_CPUMatrix, *peepholes.m_CPUMatrix, *cPrev.m_CPUMatrix, *c.m_CPUMatrix, *dh.m_CPUMatrix,
+                                                                  *dc.m_CPUMatrix, *dGates.m_CPUMatrix, *dPeepholes.m_CPUMatrix),
+                            GPUMatrix<ElemType>::LSTMCellBackward(*gates.m_GPUMatrix, *peepholes.m_GPUMatrix, *cPrev.m_GPUMatrix, *c.m_GPUMatrix, *dh.m_GPUMatrix,
+                                                                  *dc.m_GPUMatrix, *dGates.m_GPUMatrix, *dPeepholes.m_GPUMatrix),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+template <class ElemType>
+void Matrix<ElemType>::GRUCellForward(Matrix<ElemType>& gates, const Matrix<ElemType>& hiddenProj,
+                                      const Matrix<ElemType>& hPrev, Matrix<ElemType>& h)
+{
+    DecideAndMoveToRightDevice(gates, hiddenProj, hPrev);
+    h._transferToDevice(gates.GetDeviceId());
+
+    DISPATCH_MATRIX_ON_FLAG(&gates,
+                            &h,
+                            CPUMatrix<ElemType>::GRUCellForward(*gates.m_CPUMatrix, *hiddenProj.m_CPUMatrix, *hPrev.m_CPUMatrix, *h.m_CPUMatrix),
+                            GPUMatrix<ElemType>::GRUCellForward(*gates.m_GPUMatrix, *hiddenProj.m_GPUMatrix, *hPrev.m_GPUMatrix, *h.m_GPUMatrix),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+template <class ElemType>
+void Matrix<ElemType>::GRUCellBackward(const Matrix<ElemType>& gates, const Matrix<ElemType>& hiddenProj,
+                                       const Matrix<ElemType>& hPrev, const Matrix<ElemType>& dh,
+                                       Matrix<ElemType>& dGates, Matrix<ElemType>& dHiddenProj, Matrix<ElemType>& dhPrev)
+{
+    DecideAndMoveToRightDevice(gates, hiddenProj, hPrev);
+    dh._transferToDevice(gates.GetDeviceId());
+    dGates._transferToDevice(gates.GetDeviceId());
+    dHiddenProj._transferToDevice(gates.GetDeviceId());
+    dhPrev._transferToDevice(gates.GetDeviceId());
+
+    DISPATCH_MATRIX_ON_FLAG(&gates,
+                            &dGates,
+                            CPUMatrix<ElemType>::GRUCellBackward(*gates.m_CPUMatrix, *hiddenProj.m_CPUMatrix, *hPrev.m_CPUMatrix, *dh.m_CPUMatrix,
+                                                                 *dGates.m_CPUMatrix, *dHiddenProj.m_CPUMatrix, *dhPrev.m_CPUMatrix),
+                            GPUMatrix<ElemType>::GRUCellBackward(*gates.m_GPUMatrix, *hiddenProj.m_GPUMatrix, *hPrev.m_GPUMatrix, *dh.m_GPUMatrix,
+                                                                 *dGates.m_GPUMatrix, *dHiddenProj.m_GPUMatrix, *dhPrev.m_GPUMatrix),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
 template <class ElemType>
 Matrix<ElemType>& Matrix<ElemType>::DropFrame(const Matrix<ElemType>& label, const Matrix<ElemType>& gamma, const ElemType& threshhold)
 {
@@ -168,6 +168,9 @@ public:
     size_t BufferSize() const;
     ElemType* BufferPointer() const;
     size_t NzCount() const;
+    // sparse CPU matrices only: rows with non-zero entries (CSC), columns with non-zero entries (CSC, block-column)
+    void GetNonZeroRowIds(std::vector<size_t>& ids) const;
+    void GetNonZeroColumnIds(std::vector<size_t>& ids) const;
 
     ElemType* CopyToArray() const;                                              // allocated by the callee but need to be deleted by the caller
     size_t CopyToArray(ElemType*& arrayCopyTo, size_t& currentArraySize) const; // allocated by the callee but need to be deleted by the caller
@@ -484,6 +487,20 @@ public:
     static void Multiply(const Matrix<ElemType>& a, const Matrix<ElemType>& b, Matrix<ElemType>& c);
     static void Multiply1x1AndWeightedAdd(ElemType alpha, const Matrix<ElemType>& a, const Matrix<ElemType>& b, ElemType beta, Matrix<ElemType>& c);
     static void ConvolveAndWeightedAdd(ElemType alpha, const Matrix<ElemType>& a, const bool transposeA, const Matrix<ElemType>& b, const bool transposeB, ElemType beta, Matrix<ElemType>& c, size_t numChannels, size_t horizontalSubsample, bool padding, bool channelwise);
+    // convolution with a sparse input, without unpacking it (CPU only); see CPUSparseMatrix::ConvolutionForward()
+    static void SparseConvolutionForward(const Matrix<ElemType>& filter, const Matrix<ElemType>& in, Matrix<ElemType>& out,
+                                         const size_t inputWidth, const size_t inputHeight, const size_t inputChannels,
+                                         const size_t outputWidth, const size_t outputHeight,
+                                         const size_t kernelWidth, const size_t kernelHeight, const size_t horizontalSubsample, const size_t verticalSubsample,
+                                         const bool zeroPadding);
+    static void SparseConvolutionBackwardFilter(const Matrix<ElemType>& srcGrad, const Matrix<ElemType>& in, Matrix<ElemType>& filterGrad,
+                                                const size_t inputWidth, const size_t inputHeight, const size_t inputChannels,
+                                                const size_t outputWidth, const size_t outputHeight,
+                                                const size_t kernelWidth, const size_t kernelHeight, const size_t horizontalSubsample, const size_t verticalSubsample,
+                                                const bool zeroPadding);
+    // embedding lookup with a sparse index matrix, gathering table columns instead of multiplying (CPU only); see CPUSparseMatrix::ColumnLookup()
+    static void SparseColumnLookup(const Matrix<ElemType>& table, const Matrix<ElemType>& indices, Matrix<ElemType>& out);
+    static void SparseColumnLookupGradient(const Matrix<ElemType>& outGrad, const Matrix<ElemType>& indices, Matrix<ElemType>& tableGrad);
 
     static void ScaleAndAdd(ElemType alpha, const Matrix<ElemType>& a, Matrix<ElemType>& c);
     static void ScaleAndAdd(ElemType alpha, const Matrix<ElemType>& a, ElemType beta, Matrix<ElemType>& c);
@@ -525,6 +542,7 @@ public:
 public:
     void Read(File& stream);
     void Write(File& stream) const;
+    void MakeWritable(); // copy on first write of values that Read() left in a read-only file mapping (see CPUMatrix::MakeWritable())
 
     Matrix<ElemType>& Shift(const Matrix<ElemType>& a, int shift);
 
@@ -548,6 +566,28 @@ public:
                                     const int startLbl, // the time 0 start symbol in the output layer
                                     const int shift);
 
+    // batched RCRF over all sequences of a minibatch (CPU only; see CPUMatrix)
+    static ElemType RCRFForwardBackward(const Matrix<ElemType>& lbls, const Matrix<ElemType>& pos_scores, const Matrix<ElemType>& pair_scores,
+                                        Matrix<ElemType>& alpha, Matrix<ElemType>& beta, Matrix<ElemType>& postprob,
+                                        const std::vector<RCRFSequence>& sequences);
+    static void RCRFTransGrdCompute(const Matrix<ElemType>& lbls, const Matrix<ElemType>& alpha, const Matrix<ElemType>& beta,
+                                    const Matrix<ElemType>& pair_scores, Matrix<ElemType>& grd,
+                                    const std::vector<RCRFSequence>& sequences);
+    static void RCRFViterbi(const Matrix<ElemType>& lbls, const Matrix<ElemType>& pos_scores, const Matrix<ElemType>& pair_scores,
+                            Matrix<ElemType>& decodedPath, const std::vector<RCRFSequence>& sequences);
+
+    // fused recurrent cells (one time step of LSTMNode/GRUNode, all parallel sequences at once)
+    static void LSTMCellForward(Matrix<ElemType>& gates, const Matrix<ElemType>& peepholes,
+                                const Matrix<ElemType>& cPrev, Matrix<ElemType>& c, Matrix<ElemType>& h);
+    static void LSTMCellBackward(const Matrix<ElemType>& gates, const Matrix<ElemType>& peepholes,
+                                 const Matrix<ElemType>& cPrev, const Matrix<ElemType>& c, const Matrix<ElemType>& dh,
+                                 Matrix<ElemType>& dc, Matrix<ElemType>& dGates, Matrix<ElemType>& dPeepholes);
+    static void GRUCellForward(Matrix<ElemType>& gates, const Matrix<ElemType>& hiddenProj,
+                               const Matrix<ElemType>& hPrev, Matrix<ElemType>& h);
+    static void GRUCellBackward(const Matrix<ElemType>& gates, const Matrix<ElemType>& hiddenProj,
+                                const Matrix<ElemType>& hPrev, const Matrix<ElemType>& dh,
+                                Matrix<ElemType>& dGates, Matrix<ElemType>& dHiddenProj, Matrix<ElemType>& dhPrev);
+
     template <typename T>
     friend class MatrixQuantizer;
 
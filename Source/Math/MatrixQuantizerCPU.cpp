@@ -30,7 +30,9 @@ void MatrixQuantizerCPU<ElemType>::QuantizeAsync(const Matrix<ElemType>& inMatri
 #ifdef QUANTUSEPPL
     Concurrency::parallel_for((size_t) 0, us.cols(), [&](size_t j)
 #else
-    for (size_t j = 0; j < nCol; j++)
+    // columns are independent; each is quantized by a contiguous, vectorizable pass
+#pragma omp parallel for
+    for (long j = 0; j < (long) nCol; j++)
 #endif
                               {
                                   auto& qcol = *(outQMatrix.GetQuantizedColumn(j));
@@ -49,12 +51,12 @@ void MatrixQuantizerCPU<ElemType>::QuantizeAsync(const Matrix<ElemType>& inMatri
                                   if (zeroThresholdFor1Bit)
                                   {
                                       // Explicit use of 'template' keyword is needed to compile with GCC
-                                      q.template Quantize<true>(inMatrix.BufferPointer(), inResidual.BufferPointer(), (long) nRow, j, qcol.bits, outResidual.BufferPointer());
+                                      q.template QuantizeContiguous<true>(inMatrix.BufferPointer(), inResidual.BufferPointer(), (long) nRow, j, qcol.bits, outResidual.BufferPointer());
                                   }
                                   else
                                   {
                                       // Explicit use of 'template' keyword is needed to compile with GCC
-                                      q.template Quantize<false>(inMatrix.BufferPointer(), inResidual.BufferPointer(), (long) nRow, j, qcol.bits, outResidual.BufferPointer());
+                                      q.template QuantizeContiguous<false>(inMatrix.BufferPointer(), inResidual.BufferPointer(), (long) nRow, j, qcol.bits, outResidual.BufferPointer());
                                   }
                               }
 #ifdef QUANTUSEPPL
@@ -87,12 +89,13 @@ void MatrixQuantizerCPU<ElemType>::UnquantizeAsync(QuantizedMatrix<ElemType>& in
 #ifdef QUANTUSEPPL
     Concurrency::parallel_for((size_t) 0, us.cols(), [&](size_t j)
 #else
-    for (size_t j = 0; j < nCol; j++)
+#pragma omp parallel for
+    for (long j = 0; j < (long) nCol; j++)
 #endif
                               {
                                   const auto& qcol = *(inQMatrix.GetQuantizedColumn(j));
                                   ColumnQuantizer<ElemType> q(ldNbits, qcol.lower, qcol.upper);
-                                  q.Unquantize(outMatrix.BufferPointer(), (long) nRow, j, qcol.bits, add);
+                                  q.UnquantizeContiguous(outMatrix.BufferPointer(), (long) nRow, j, qcol.bits, add);
                               }
 #ifdef QUANTUSEPPL
                               );
@@ -1998,6 +1998,32 @@ void GPUMatrix<ElemType>::RCRFTransGrdCompute(const GPUMatrix<ElemType>& lbls,
 {
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::LSTMCellForward(GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& peepholes,
+                                          const GPUMatrix<ElemType>& cPrev, GPUMatrix<ElemType>& c, GPUMatrix<ElemType>& h)
+{
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::LSTMCellBackward(const GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& peepholes,
+                                           const GPUMatrix<ElemType>& cPrev, const GPUMatrix<ElemType>& c, const GPUMatrix<ElemType>& dh,
+                                           GPUMatrix<ElemType>& dc, GPUMatrix<ElemType>& dGates, GPUMatrix<ElemType>& dPeepholes)
+{
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::GRUCellForward(GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& hiddenProj,
+                                         const GPUMatrix<ElemType>& hPrev, GPUMatrix<ElemType>& h)
+{
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::GRUCellBackward(const GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& hiddenProj,
+                                          const GPUMatrix<ElemType>& hPrev, const GPUMatrix<ElemType>& dh,
+                                          GPUMatrix<ElemType>& dGates, GPUMatrix<ElemType>& dHiddenProj, GPUMatrix<ElemType>& dhPrev)
+{
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::AssignNoiseContrastiveEstimation(const GPUMatrix<ElemType>& a,
                                                            const GPUMatrix<ElemType>& b, const GPUMatrix<ElemType>& bias, size_t sampleCount, GPUMatrix<ElemType>& tmp, GPUMatrix<ElemType>& c)
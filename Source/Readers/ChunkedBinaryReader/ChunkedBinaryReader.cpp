@@ -0,0 +1,126 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#include "stdafx.h"
+#include "ChunkedBinaryReader.h"
+#include "Config.h"
+#include "StringUtil.h"
+#include "BlockRandomizer.h"
+#include "NoRandomizer.h"
+#include "ChunkedBinaryDeserializer.h"
+#include <algorithm>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+ChunkedBinaryReader::ChunkedBinaryReader(MemoryProviderPtr provider,
+                                         const ConfigParameters& config)
+    : m_provider(provider)
+{
+    std::wstring path = config(L"file");
+    m_verbosity = config(L"verbosity", 0);
+    auto deserializer = std::make_shared<ChunkedBinaryDeserializer>(path);
+    m_streams = deserializer->GetStreamDescriptions();
+    m_hasSparseStreams = std::any_of(m_streams.begin(), m_streams.end(), [](const StreamDescriptionPtr& stream)
+    {
+        return stream->m_storageType == StorageType::sparse_csc;
+    });
+    m_numParallelSequencesForAllEpochs = config(L"nbruttsineachrecurrentiter", ConfigParameters::Array(intargvector(vector<int>{0})));
+    for (size_t i = 0; i < m_numParallelSequencesForAllEpochs.size(); i++)
+    {
+        if (m_numParallelSequencesForAllEpochs[i] < 0)
+        {
+            InvalidArgument("ChunkedBinaryReader: nbrUttsInEachRecurrentIter cannot be negative.");
+        }
+    }
+
+    std::string precision = config.Find("precision", "float");
+    ElementType elementType;
+    if (AreEqualIgnoreCase(precision, "float"))
+    {
+        elementType = ElementType::tfloat;
+    }
+    else if (AreEqualIgnoreCase(precision, "double"))
+    {
+        elementType = ElementType::tdouble;
+    }
+    else
+    {
+        RuntimeError("Not supported precision '%s'. Expected 'double' or 'float'.", precision.c_str());
+    }
+    for (const auto& stream : m_streams)
+    {
+        if (stream->m_elementType != elementType)
+        {
+            RuntimeError("ChunkedBinaryReader: Stream '%ls' of '%ls' does not have the precision '%s'; convert the data with this precision.",
+                         stream->m_name.c_str(), path.c_str(), precision.c_str());
+        }
+    }
+
+    TransformerPtr randomizer;
+    std::string randomize = config(L"randomize", "auto");
+    if (AreEqualIgnoreCase(randomize, "auto"))
+    {
+        size_t randomizationWindow = config(L"randomizationWindow", SIZE_MAX);
+        randomizer = std::make_shared<BlockRandomizer>(m_verbosity, randomizationWindow, deserializer);
+    }
+    else if (AreEqualIgnoreCase(randomize, "none"))
+    {
+        randomizer = std::make_shared<NoRandomizer>(deserializer);
+    }
+    else
+    {
+        RuntimeError("'randomize' parameter must be set to 'auto' or 'none'");
+    }
+
+    randomizer->Initialize(nullptr, config);
+    m_transformer = randomizer;
+}
+
+std::vector<StreamDescriptionPtr> ChunkedBinaryReader::GetStreamDescriptions()
+{
+    assert(!m_streams.empty());
+    return m_streams;
+}
+
+void ChunkedBinaryReader::StartEpoch(const EpochConfiguration& config)
+{
+    if (config.m_totalEpochSizeInSamples <= 0)
+    {
+        RuntimeError("Unsupported minibatch size '%u'.", (int) config.m_totalEpochSizeInSamples);
+    }
+
+    m_transformer->StartEpoch(config);
+    size_t numParallelSequences = m_numParallelSequencesForAllEpochs[config.m_epochIndex];
+    if (numParallelSequences == 0 && !m_hasSparseStreams)
+    {
+        // SampleModePacker unpacks sparse streams, so it only takes dense ones
+        m_sequencePacker = nullptr;
+        m_sampleModePacker = std::make_shared<SampleModePacker>(
+            m_provider,
+            m_transformer,
+            config.m_minibatchSizeInSamples,
+            m_streams);
+    }
+    else
+    {
+        // 0 parallel sequences: one per sample, as in frame mode
+        m_sampleModePacker = nullptr;
+        m_sequencePacker = std::make_shared<SequencePacker>(
+            m_provider,
+            m_transformer,
+            config.m_minibatchSizeInSamples,
+            m_streams,
+            0,
+            numParallelSequences,
+            m_verbosity);
+    }
+}
+
+Minibatch ChunkedBinaryReader::ReadMinibatch()
+{
+    assert(m_sampleModePacker != nullptr || m_sequencePacker != nullptr);
+    return m_sampleModePacker ? m_sampleModePacker->ReadMinibatch() : m_sequencePacker->ReadMinibatch();
+}
+} } }
@@ -0,0 +1,60 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#pragma once
+
+#include "Reader.h"
+#include "Config.h"
+#include "SampleModePacker.h"
+#include "SequencePacker.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Reader for datasets in the chunked binary format (see ChunkedBinaryFile.h), as produced by the
+// "convertToChunkedBinary" action. It connects the deserializer, the randomizer and the packer.
+// Configuration:
+//   file                        the dataset
+//   randomize                   "auto" (default) or "none"
+//   randomizationWindow         randomization window in samples (default: the whole dataset)
+//   precision                   "float" (default) or "double"; must match the element type of the file
+//   nbrUttsInEachRecurrentIter  number of parallel sequences, per epoch (default: one per sample)
+// Stream names are taken from the file; sparse streams are returned as sparse matrices.
+// Each sample is a sequence of one frame. By default they are packed in frame mode (SampleModePacker); datasets with
+// sparse streams, or a configured number of parallel sequences, go through the SequencePacker.
+class ChunkedBinaryReader : public Reader
+{
+public:
+    ChunkedBinaryReader(MemoryProviderPtr provider,
+                        const ConfigParameters& parameters);
+
+    // Description of streams that this reader provides.
+    std::vector<StreamDescriptionPtr> GetStreamDescriptions() override;
+
+    // Starts a new epoch with the provided configuration.
+    void StartEpoch(const EpochConfiguration& config) override;
+
+    // Reads a single minibatch.
+    Minibatch ReadMinibatch() override;
+
+private:
+    // All streams this reader provides.
+    std::vector<StreamDescriptionPtr> m_streams;
+
+    // A head transformer in a list of transformers.
+    TransformerPtr m_transformer;
+
+    // Packer; one of them is used in an epoch.
+    SampleModePackerPtr m_sampleModePacker;
+    SequencePackerPtr m_sequencePacker;
+
+    intargvector m_numParallelSequencesForAllEpochs; // 0 for frame mode
+    bool m_hasSparseStreams;
+
+    int m_verbosity;
+
+    MemoryProviderPtr m_provider;
+};
+
+}}}
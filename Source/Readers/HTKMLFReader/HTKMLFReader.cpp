@@ -98,6 +98,21 @@ void HTKMLFReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfig
     }
 }
 
+// replace a set of lattice TOC files by a mapped archive (see msra::lattices::archive::writemapped()), which is written
+// from them first unless it exists already
+static void UseMappedLatticeArchive(vector<wstring>& tocPaths, const wstring& mappedArchivePath,
+                                    const std::unordered_map<std::string, size_t>& modelSymMap, const wstring& prefixPathInToc)
+{
+    if (mappedArchivePath.empty() || tocPaths.empty())
+        return;
+    if (!fexists(mappedArchivePath))
+    {
+        fprintf(stderr, "Writing mapped lattice archive '%ls' from %d TOC files.\n", mappedArchivePath.c_str(), (int) tocPaths.size());
+        msra::lattices::archive::writemapped(tocPaths, mappedArchivePath, modelSymMap, prefixPathInToc);
+    }
+    tocPaths.assign(1, mappedArchivePath);
+}
+
 // Load all input and output data.
 // Note that the terms features imply be real-valued quanities and
 // labels imply categorical quantities, irrespective of whether they
@@ -109,6 +124,7 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
     vector<wstring> scriptpaths;
     vector<wstring> RootPathInScripts;
     wstring RootPathInLatticeTocs;
+    std::pair<wstring, wstring> mappedLatticeArchives; // (numer, denom)
     vector<wstring> mlfpaths;
     vector<vector<wstring>> mlfpathsmulti;
     size_t firstfilesonly = SIZE_MAX; // set to a lower value for testing
@@ -272,6 +288,10 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
             latticetocs.first.insert(latticetocs.first.end(), paths.begin(), paths.end());
         }
         RootPathInLatticeTocs = (wstring) thisLattice(L"prefixPathInToc", L"");
+
+        // optionally, read the lattices from mapped archives, which are written from the TOC files if they do not exist yet
+        mappedLatticeArchives.first = (wstring) thisLattice(L"numLatMappedArchive", L"");
+        mappedLatticeArchives.second = (wstring) thisLattice(L"denLatMappedArchive", L"");
     }
 
     // get HMM related file names
@@ -458,6 +478,8 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
     {
         // construct all the parameters we don't need, but need to be passed to the constructor...
 
+        UseMappedLatticeArchive(latticetocs.first, mappedLatticeArchives.first, m_hset.getsymmap(), RootPathInLatticeTocs);
+        UseMappedLatticeArchive(latticetocs.second, mappedLatticeArchives.second, m_hset.getsymmap(), RootPathInLatticeTocs);
         m_lattices.reset(new msra::dbn::latticesource(latticetocs, m_hset.getsymmap(), RootPathInLatticeTocs));
         m_lattices->setverbosity(m_verbosity);
 
@@ -3,8 +3,6 @@
 // Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
 //
 
-#pragma once
-
 #include "stdafx.h"
 #include "Basics.h"
 #include "fileutil.h"
@@ -45,7 +43,7 @@ static void writeunitmap(const wstring &symlistpath, const UNITMAP &unitmap)
             units[unitid] = label;
     }
 
-    auto_file_ptr flist = fopenOrDie(symlistpath, L"wb");
+    auto_file_ptr flist(fopenOrDie(symlistpath, L"wb"));
     // write (physical) units
     foreach_index (k, units)
     {
@@ -102,8 +100,8 @@ static size_t tryfind(const MAPTYPE &map, const KEYTYPE &key, VALTYPE deflt)
     std::set<std::wstring> seenkeys; // (keep track of seen keys; throw error for duplicate keys)
     msra::files::make_intermediate_dirs(outpath);
 
-    auto_file_ptr f = fopenOrDie(outpath, L"wb");
-    auto_file_ptr ftoc = fopenOrDie(tocpath, L"wb");
+    auto_file_ptr f(fopenOrDie(outpath, L"wb"));
+    auto_file_ptr ftoc(fopenOrDie(tocpath, L"wb"));
     size_t brokeninputfiles = 0;
     foreach_index (i, infiles)
     {
@@ -429,8 +427,8 @@ void lattice::dedup()
     std::vector<char> textbuffer;
     auto toclines = msra::files::fgetfilelines(intocpath, textbuffer);
 
-    auto_file_ptr f = NULL;
-    auto_file_ptr ftoc = NULL;
+    auto_file_ptr f;
+    auto_file_ptr ftoc;
 
     // process all files
     if (outpath != L"" && outpath != L"-") // test for special syntaxes that bypass to actually create an output archive
@@ -524,6 +522,78 @@ void lattice::dedup()
     fprintf(stderr, "converted %d lattices\n", toclines.size());
 }
 
+// write the lattices referenced by a set of TOC files into one mapped archive (see archive::open())
+//  - OUTPATH               --the archive, incl. its index; pass it in place of the TOC files
+//  - OUTPATH.symlist       --the units, as for build()
+// The archive is written to a temporary file that is renamed when complete, so an existing OUTPATH is always complete.
+// The lattices are stored after conversion to the in-memory format, i.e. with expanded (not uniqued) alignments, so
+// the archive is larger than a V2 archive, but reading a lattice from it is a copy of three arrays.
+/*static*/ void archive::writemapped(const std::vector<std::wstring> &intocpaths, const std::wstring &outpath,
+                                     const std::unordered_map<std::string, size_t> &modelsymmap, const std::wstring &prefixPathInToc)
+{
+    const std::wstring symlistpath = outpath + L".symlist";
+
+    msra::lattices::archive archive(intocpaths, modelsymmap, prefixPathInToc);
+
+    // the index is sorted by key; we write the lattices in the same order
+    std::vector<std::string> keys;
+    keys.reserve(archive.toc.size());
+    for (auto iter = archive.toc.begin(); iter != archive.toc.end(); iter++)
+        keys.push_back(msra::strfun::utf8(iter->first));
+    std::sort(keys.begin(), keys.end(), [](const std::string &a, const std::string &b)
+              {
+                  return comparekeys(a.data(), a.size(), b.data(), b.size()) < 0;
+              });
+
+    const std::wstring tmppath = outpath + L".tmp";
+    msra::files::make_intermediate_dirs(outpath);
+    {
+        auto_file_ptr f(fopenOrDie(tmppath, L"wb"));
+
+        // header (rewritten at the end, with the magic)
+        mappedheader header;
+        memset(&header, 0, sizeof(header));
+        header.version = mappedversion;
+        header.numlattices = keys.size();
+        fwriteOrDie(&header, sizeof(header), 1, f);
+        uint64_t offset = sizeof(header);
+
+        // lattices
+        std::vector<mappedindexentry> index(keys.size());
+        uint64_t keyoffset = 0;
+        lattice L;
+        foreach_index (i, keys)
+        {
+            archive.getlattice(msra::strfun::utf16(keys[i]), L);
+            index[i].offset = offset;
+            index[i].keyoffset = keyoffset;
+            index[i].keylength = (uint32_t) keys[i].size();
+            index[i].numframes = (uint32_t) L.getnumframes();
+            offset += L.fwritemapped(f);
+            keyoffset += keys[i].size();
+        }
+
+        // index and keys
+        header.indexoffset = offset;
+        if (!index.empty())
+            fwriteOrDie(index.data(), sizeof(index[0]), index.size(), f);
+        header.keysoffset = offset + index.size() * sizeof(mappedindexentry);
+        header.keysbytes = keyoffset;
+        foreach_index (i, keys)
+            fwriteOrDie(keys[i].data(), 1, keys[i].size(), f);
+
+        memcpy(header.magic, mappedmagic(), sizeof(header.magic));
+        fsetpos(f, (uint64_t) 0);
+        fwriteOrDie(&header, sizeof(header), 1, f);
+        fflushOrDie(f);
+    } // (closes the file)
+
+    writeunitmap(symlistpath, modelsymmap);
+    renameOrDie(tmppath, outpath);
+
+    fprintf(stderr, "writemapped: %d lattices written to '%ls'\n", (int) keys.size(), outpath.c_str());
+}
+
 // ---------------------------------------------------------------------------
 // reading lattices from external formats (HTK lat, MLF)
 // ---------------------------------------------------------------------------
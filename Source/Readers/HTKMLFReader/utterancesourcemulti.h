@@ -1441,6 +1441,29 @@ private:
         }
     }
 
+    // start reading the lattices of the next chunk to be paged in, i.e. of the first utterance at or after 'pos' whose
+    // chunk is not in RAM, in the background (lattices are only used in utterance mode)
+    void prefetchnextchunklattices(size_t pos, const size_t subsetnum, const size_t numsubsets) const
+    {
+        if (lattices.empty())
+            return;
+        for (; pos < randomizedutterancerefs.size(); pos++)
+        {
+            const size_t chunkindex = randomizedutterancerefs[pos].chunkindex;
+            if ((chunkindex % numsubsets) != subsetnum)
+                continue;
+            const auto &chunkdata = randomizedchunks[0][chunkindex].getchunkdata();
+            if (chunkdata.isinram())
+                continue;
+            std::vector<std::pair<wstring, size_t>> keys;
+            keys.reserve(chunkdata.numutterances());
+            for (size_t i = 0; i < chunkdata.numutterances(); i++)
+                keys.push_back(std::make_pair(chunkdata.utteranceset[i].key(), chunkdata.numframes(i)));
+            lattices.prefetchlattices(keys);
+            return;
+        }
+    }
+
     class matrixasvectorofvectors // wrapper around a matrix that views it as a vector of column vectors
     {
         void operator=(const matrixasvectorofvectors &); // non-assignable
@@ -1537,6 +1560,8 @@ public:
             for (size_t pos = spos; pos < epos; pos++)
                 if ((randomizedutterancerefs[pos].chunkindex % numsubsets) == subsetnum)
                     readfromdisk |= requirerandomizedchunk(randomizedutterancerefs[pos].chunkindex, windowbegin, windowend); // (window range passed in for checking only)
+            if (readfromdisk)
+                prefetchnextchunklattices(epos, subsetnum, numsubsets);
 
             // Note that the above loop loops over all chunks incl. those that we already should have.
             // This has an effect, e.g., if 'numsubsets' has changed (we will fill gaps).
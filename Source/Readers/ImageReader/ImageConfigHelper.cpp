@@ -108,6 +108,10 @@ namespace Microsoft { namespace MSR { namespace CNTK {
         }
 
         m_cpuThreadCount = config(L"numCPUThreads", 0);
+
+        m_imageCacheSize = (size_t) config(L"imageCacheSizeMB", (size_t) 0) * 1024 * 1024;
+        m_decodeShorterSide = config(L"decodeShorterSide", (size_t) 0);
+        m_fuseTransforms = config(L"fuseTransforms", false);
     }
 
     std::vector<StreamDescriptionPtr> ImageConfigHelper::GetStreams() const
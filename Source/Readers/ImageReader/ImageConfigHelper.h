@@ -46,6 +46,24 @@ public:
         return m_randomize;
     }
 
+    // Maximum size in bytes of the decoded images kept in memory across epochs (0: none).
+    size_t GetImageCacheSize() const
+    {
+        return m_imageCacheSize;
+    }
+
+    // Length the shorter side of each image is scaled to when it is decoded (0: images keep their size).
+    size_t GetDecodeShorterSide() const
+    {
+        return m_decodeShorterSide;
+    }
+
+    // Whether crop, scale, mean and transposition run as one stage (ImageAugmentationTransformer; 'fuseTransforms', off by default).
+    bool ShouldFuseTransforms() const
+    {
+        return m_fuseTransforms;
+    }
+
 private:
     ImageConfigHelper(const ImageConfigHelper&) = delete;
     ImageConfigHelper& operator=(const ImageConfigHelper&) = delete;
@@ -55,6 +73,9 @@ private:
     ImageLayoutKind m_dataFormat;
     int m_cpuThreadCount;
     bool m_randomize;
+    size_t m_imageCacheSize;
+    size_t m_decodeShorterSide;
+    bool m_fuseTransforms;
 };
 
 typedef std::shared_ptr<ImageConfigHelper> ImageConfigHelperPtr;
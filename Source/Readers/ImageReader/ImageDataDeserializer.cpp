@@ -5,6 +5,7 @@
 
 #include "stdafx.h"
 #include <opencv2/opencv.hpp>
+#include <exception>
 #include "ImageDataDeserializer.h"
 #include "ImageConfigHelper.h"
 
@@ -47,40 +48,43 @@ struct DeserializedImage : DenseSequenceData
     cv::Mat m_image;
 };
 
-// For image, chunks correspond to a single image.
+// A chunk of images: a single image of a map file, which is read when its sequence is requested,
+// or the images of a chunk of an image pack, which are decoded when the chunk is created.
 class ImageDataDeserializer::ImageChunk : public Chunk, public std::enable_shared_from_this<ImageChunk>
 {
-    ImageSequenceDescription m_description;
+    size_t m_firstSequenceId;
+    std::vector<cv::Mat> m_images; // decoded 8-bit images (possibly shared with the image cache), or empty
     ImageDataDeserializer& m_parent;
 
 public:
-    ImageChunk(ImageSequenceDescription& description, ImageDataDeserializer& parent)
-        : m_description(description), m_parent(parent)
+    ImageChunk(size_t firstSequenceId, std::vector<cv::Mat>&& images, ImageDataDeserializer& parent)
+        : m_firstSequenceId(firstSequenceId), m_images(std::move(images)), m_parent(parent)
     {
     }
 
     virtual std::vector<SequenceDataPtr> GetSequence(const size_t& sequenceId) override
     {
-        assert(sequenceId == m_description.m_id);
-        UNUSED(sequenceId);
-        const auto& imageSequence = m_description;
+        assert(sequenceId >= m_firstSequenceId);
+        const auto& imageSequence = m_parent.m_imageSequences[sequenceId];
 
-        auto image = std::make_shared<DeserializedImage>();
-        image->m_image = std::move(cv::imread(imageSequence.m_path, cv::IMREAD_COLOR));
-        auto& cvImage = image->m_image;
-
-        if (!cvImage.data)
+        cv::Mat decodedImage;
+        if (m_images.empty())
         {
-            RuntimeError("Cannot open file '%s'", imageSequence.m_path.c_str());
+            assert(sequenceId == m_firstSequenceId);
+            decodedImage = m_parent.ReadImage(sequenceId);
         }
-
-        // Convert element type.
-        int dataType = m_parent.m_featureElementType == ElementType::tfloat ? CV_32F : CV_64F;
-        if (cvImage.type() != CV_MAKETYPE(dataType, cvImage.channels()))
+        else
         {
-            cvImage.convertTo(cvImage, dataType);
+            assert(sequenceId - m_firstSequenceId < m_images.size());
+            decodedImage = m_images[sequenceId - m_firstSequenceId];
         }
 
+        // Convert element type. This creates a new image, so the decoded one stays unchanged.
+        auto image = std::make_shared<DeserializedImage>();
+        int dataType = m_parent.m_featureElementType == ElementType::tfloat ? CV_32F : CV_64F;
+        decodedImage.convertTo(image->m_image, dataType);
+        auto& cvImage = image->m_image;
+
         if (!cvImage.isContinuous())
         {
             cvImage = cvImage.clone();
@@ -131,7 +135,21 @@ ImageDataDeserializer::ImageDataDeserializer(const ConfigParameters& config)
         RuntimeError("Unsupported label element type '%d'.", label->m_elementType);
     }
 
-    CreateSequenceDescriptions(configHelper.GetMapPath(), labelDimension);
+    m_decodeShorterSide = configHelper.GetDecodeShorterSide();
+    m_imageCacheSize = 0;
+    m_maxImageCacheSize = configHelper.GetImageCacheSize();
+
+    // An image pack can be given in place of the map file.
+    std::wstring path = msra::strfun::utf16(configHelper.GetMapPath());
+    if (ImagePackFile::IsImagePack(path))
+    {
+        m_pack = std::make_shared<ImagePackFile>(path);
+        CreateSequenceDescriptionsFromPack(configHelper.GetMapPath(), labelDimension);
+    }
+    else
+    {
+        CreateSequenceDescriptions(configHelper.GetMapPath(), labelDimension);
+    }
 }
 
 void ImageDataDeserializer::CreateSequenceDescriptions(std::string mapPath, size_t labelDimension)
@@ -177,6 +195,36 @@ void ImageDataDeserializer::CreateSequenceDescriptions(std::string mapPath, size
     }
 }
 
+void ImageDataDeserializer::CreateSequenceDescriptionsFromPack(std::string packPath, size_t labelDimension)
+{
+    ImageSequenceDescription description;
+    description.m_numberOfSamples = 1;
+    description.m_isValid = true;
+    description.m_path = packPath;
+    m_imageSequences.reserve(m_pack->GetNumImages());
+    for (size_t chunkId = 0; chunkId < m_pack->GetNumChunks(); ++chunkId)
+    {
+        size_t firstImage = m_pack->GetFirstImage(chunkId);
+        for (size_t imageId = firstImage; imageId < firstImage + m_pack->GetNumImages(chunkId); ++imageId)
+        {
+            description.m_id = imageId;
+            description.m_chunkId = chunkId;
+            description.m_classId = m_pack->GetImage(imageId).m_classId;
+
+            if (description.m_classId >= labelDimension)
+            {
+                RuntimeError(
+                    "Image %d of '%s' has invalid class id '%d'. Expected label dimension is '%d'.",
+                    static_cast<int>(imageId),
+                    packPath.c_str(),
+                    static_cast<int>(description.m_classId),
+                    static_cast<int>(labelDimension));
+            }
+            m_imageSequences.push_back(description);
+        }
+    }
+}
+
 std::vector<StreamDescriptionPtr> ImageDataDeserializer::GetStreamDescriptions() const
 {
     return m_streams;
@@ -197,8 +245,140 @@ void ImageDataDeserializer::FillSequenceDescriptions(SequenceDescriptions& timel
 
 ChunkPtr ImageDataDeserializer::GetChunk(size_t chunkId)
 {
-    auto sequenceDescription = m_imageSequences[chunkId];
-    return std::make_shared<ImageChunk>(sequenceDescription, *this);
+    if (!m_pack)
+    {
+        // sequence id and chunk id are the same; the image is read by GetSequence()
+        return std::make_shared<ImageChunk>(chunkId, std::vector<cv::Mat>(), *this);
+    }
+
+    size_t firstImage = m_pack->GetFirstImage(chunkId);
+    size_t numImages = m_pack->GetNumImages(chunkId);
+    std::vector<cv::Mat> images(numImages);
+    bool allCached = true;
+    for (size_t i = 0; i < numImages; i++)
+    {
+        allCached &= TryGetCachedImage(firstImage + i, images[i]);
+    }
+
+    if (!allCached)
+    {
+        std::vector<char> buffer;
+        m_pack->ReadChunk(chunkId, buffer);
+        uint64_t chunkOffset = m_pack->GetChunkOffset(chunkId);
+
+        std::vector<std::exception_ptr> errors(numImages);
+#pragma omp parallel for schedule(dynamic)
+        for (long i = 0; i < (long) numImages; i++)
+        {
+            if (images[i].data)
+            {
+                continue;
+            }
+            try
+            {
+                const ImagePackEntry& entry = m_pack->GetImage(firstImage + i);
+                images[i] = DecodeImage(firstImage + i, buffer.data() + (entry.m_offset - chunkOffset), entry.m_size);
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        }
+        for (const auto& error : errors)
+        {
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    return std::make_shared<ImageChunk>(firstImage, std::move(images), *this);
+}
+
+cv::Mat ImageDataDeserializer::DecodeImage(size_t sequenceId, const char* data, size_t size)
+{
+    cv::Mat image = cv::imdecode(cv::Mat(1, static_cast<int>(size), CV_8U, const_cast<char*>(data)), cv::IMREAD_COLOR);
+    if (!image.data)
+    {
+        RuntimeError("Cannot decode image %d of '%s'", static_cast<int>(sequenceId), m_imageSequences[sequenceId].m_path.c_str());
+    }
+
+    image = Resize(image);
+    CacheImage(sequenceId, image);
+    return image;
+}
+
+cv::Mat ImageDataDeserializer::ReadImage(size_t sequenceId)
+{
+    cv::Mat image;
+    if (TryGetCachedImage(sequenceId, image))
+    {
+        return image;
+    }
+
+    const auto& path = m_imageSequences[sequenceId].m_path;
+    image = cv::imread(path, cv::IMREAD_COLOR);
+    if (!image.data)
+    {
+        RuntimeError("Cannot open file '%s'", path.c_str());
+    }
+
+    image = Resize(image);
+    CacheImage(sequenceId, image);
+    return image;
+}
+
+// Scales the image so that its shorter side has the configured length.
+cv::Mat ImageDataDeserializer::Resize(const cv::Mat& image) const
+{
+    int shorterSide = std::min(image.rows, image.cols);
+    if (m_decodeShorterSide == 0 || shorterSide == static_cast<int>(m_decodeShorterSide))
+    {
+        return image;
+    }
+
+    double scale = static_cast<double>(m_decodeShorterSide) / shorterSide;
+    cv::Size size(std::max(static_cast<int>(image.cols * scale + 0.5), 1), std::max(static_cast<int>(image.rows * scale + 0.5), 1));
+    cv::Mat resized;
+    cv::resize(image, resized, size, 0, 0, scale < 1 ? cv::INTER_AREA : cv::INTER_LINEAR);
+    return resized;
+}
+
+bool ImageDataDeserializer::TryGetCachedImage(size_t sequenceId, cv::Mat& image)
+{
+    if (m_maxImageCacheSize == 0)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_imageCacheMutex);
+    auto cached = m_imageCache.find(sequenceId);
+    if (cached == m_imageCache.end())
+    {
+        return false;
+    }
+    image = cached->second;
+    return true;
+}
+
+void ImageDataDeserializer::CacheImage(size_t sequenceId, const cv::Mat& image)
+{
+    if (m_maxImageCacheSize == 0)
+    {
+        return;
+    }
+
+    size_t size = image.total() * image.elemSize();
+    std::lock_guard<std::mutex> lock(m_imageCacheMutex);
+    if (m_imageCacheSize + size > m_maxImageCacheSize)
+    {
+        return;
+    }
+    if (m_imageCache.insert(std::make_pair(sequenceId, image)).second)
+    {
+        m_imageCacheSize += size;
+    }
 }
 
 }}}
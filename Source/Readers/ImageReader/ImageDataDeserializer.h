@@ -5,8 +5,11 @@
 
 #pragma once
 #include <opencv2/core/mat.hpp>
+#include <mutex>
+#include <unordered_map>
 #include "DataDeserializerBase.h"
 #include "Config.h"
+#include "ImagePackFile.h"
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -15,6 +18,9 @@ namespace Microsoft { namespace MSR { namespace CNTK {
 // All sequences consist only of a single sample (image/label).
 // For features it uses dense storage format with different layout (dimensions) per sequence.
 // For labels it uses the csc sparse storage format.
+// The images come either from a map file (one image file per line, each image is a chunk) or from an image pack
+// (see ImagePackFile.h; the chunks of the pack are read as a whole and their images decoded in parallel).
+// Decoded images can be kept in memory across epochs, up to a configured size.
 class ImageDataDeserializer : public DataDeserializerBase
 {
 public:
@@ -32,6 +38,14 @@ protected:
 private:
     // Creates a set of sequence descriptions.
     void CreateSequenceDescriptions(std::string mapPath, size_t labelDimension);
+    void CreateSequenceDescriptionsFromPack(std::string packPath, size_t labelDimension);
+
+    // Decodes an image, or gets it from the cache. The result is 8-bit and must not be modified.
+    cv::Mat DecodeImage(size_t sequenceId, const char* data, size_t size);
+    cv::Mat ReadImage(size_t sequenceId);
+    cv::Mat Resize(const cv::Mat& image) const;
+    bool TryGetCachedImage(size_t sequenceId, cv::Mat& image);
+    void CacheImage(size_t sequenceId, const cv::Mat& image);
 
     // Image sequence descriptions. Currently, a sequence contains a single sample only.
     struct ImageSequenceDescription : public SequenceDescription
@@ -44,6 +58,8 @@ private:
 
     // A helper class for generation of type specific labels (currently float/double only).
     class LabelGenerator;
+    template <class TElement>
+    friend class TypedLabelGenerator; // (derives from the private LabelGenerator, which gcc checks)
     typedef std::shared_ptr<LabelGenerator> LabelGeneratorPtr;
     LabelGeneratorPtr m_labelGenerator;
 
@@ -52,6 +68,18 @@ private:
 
     // Element type of the feature/label stream (currently float/double only).
     ElementType m_featureElementType;
+
+    // The image pack, if the images are read from one.
+    ImagePackFilePtr m_pack;
+
+    size_t m_decodeShorterSide;
+
+    // Decoded images kept across epochs. Images are added until the cache is full and stay there: with randomized
+    // access every image is equally likely to be needed next, so replacing cached images would not raise the hit rate.
+    std::mutex m_imageCacheMutex;
+    std::unordered_map<size_t, cv::Mat> m_imageCache; // sequence id -> decoded image
+    size_t m_imageCacheSize;
+    size_t m_maxImageCacheSize;
 };
 
 }}}
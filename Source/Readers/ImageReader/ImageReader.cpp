@@ -27,6 +27,7 @@ ImageReader::ImageReader(MemoryProviderPtr provider,
     ImageConfigHelper configHelper(config);
     m_streams = configHelper.GetStreams();
     assert(m_streams.size() == 2);
+    m_verbosity = config(L"verbosity", 0);
 
     int threadCount = configHelper.GetCpuThreadCount();
     if (threadCount > 0)
@@ -48,20 +49,30 @@ ImageReader::ImageReader(MemoryProviderPtr provider,
 
     randomizer->Initialize(nullptr, config);
 
-    auto cropper = std::make_shared<CropTransformer>();
-    cropper->Initialize(randomizer, config);
+    TransformerPtr last;
+    if (configHelper.ShouldFuseTransforms())
+    {
+        m_augmentation = std::make_shared<ImageAugmentationTransformer>();
+        m_augmentation->Initialize(randomizer, config);
+        last = m_augmentation;
+    }
+    else
+    {
+        auto cropper = std::make_shared<CropTransformer>();
+        cropper->Initialize(randomizer, config);
 
-    auto scaler = std::make_shared<ScaleTransformer>();
-    scaler->Initialize(cropper, config);
+        auto scaler = std::make_shared<ScaleTransformer>();
+        scaler->Initialize(cropper, config);
 
-    auto mean = std::make_shared<MeanTransformer>();
-    mean->Initialize(scaler, config);
+        auto mean = std::make_shared<MeanTransformer>();
+        mean->Initialize(scaler, config);
 
-    TransformerPtr last = mean;
-    if (configHelper.GetDataFormat() == CHW)
-    {
-        last = std::make_shared<TransposeTransformer>();
-        last->Initialize(mean, config);
+        last = mean;
+        if (configHelper.GetDataFormat() == CHW)
+        {
+            last = std::make_shared<TransposeTransformer>();
+            last->Initialize(mean, config);
+        }
     }
 
     m_transformer = last;
@@ -91,6 +102,11 @@ void ImageReader::StartEpoch(const EpochConfiguration& config)
 Minibatch ImageReader::ReadMinibatch()
 {
     assert(m_packer != nullptr);
-    return m_packer->ReadMinibatch();
+    Minibatch minibatch = m_packer->ReadMinibatch();
+    if (minibatch.m_endOfEpoch && m_augmentation && m_verbosity > 0)
+    {
+        m_augmentation->PrintStatistics();
+    }
+    return minibatch;
 }
 } } }
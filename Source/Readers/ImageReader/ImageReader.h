@@ -36,12 +36,17 @@ private:
     // A head transformer in a list of transformers.
     TransformerPtr m_transformer;
 
+    // The fused augmentation stage (m_transformer), if used.
+    std::shared_ptr<ImageAugmentationTransformer> m_augmentation;
+
     // Packer.
     SampleModePackerPtr m_packer;
 
     // Seed for the random generator.
     unsigned int m_seed;
 
+    int m_verbosity;
+
     // Memory provider (TODO: this will possibly change in the near future.)
     MemoryProviderPtr m_provider;
 };
@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <unordered_map>
 #include <random>
+#include <chrono>
 #include "ImageTransformers.h"
 #include "Config.h"
 #include "ConcStack.h"
@@ -141,6 +142,20 @@ void CropTransformer::Apply(cv::Mat &mat)
             return std::make_unique<std::mt19937>(seed);
         });
 
+    cv::Rect rect;
+    bool flip;
+    SelectCrop(mat.rows, mat.cols, *rng, rect, flip);
+    mat = mat(rect);
+    if (flip)
+    {
+        cv::flip(mat, mat, 1);
+    }
+
+    m_rngs.push(std::move(rng));
+}
+
+void CropTransformer::SelectCrop(int rows, int cols, std::mt19937 &rng, cv::Rect &rect, bool &flip)
+{
     double ratio = 1;
     switch (m_jitterType)
     {
@@ -154,7 +169,7 @@ void CropTransformer::Apply(cv::Mat &mat)
         }
         else
         {
-            ratio = UniRealT(m_cropRatioMin, m_cropRatioMax)(*rng);
+            ratio = UniRealT(m_cropRatioMin, m_cropRatioMax)(rng);
             assert(m_cropRatioMin <= ratio && ratio < m_cropRatioMax);
         }
         break;
@@ -162,13 +177,8 @@ void CropTransformer::Apply(cv::Mat &mat)
         RuntimeError("Jitter type currently not implemented.");
     }
 
-    mat = mat(GetCropRect(m_cropType, mat.rows, mat.cols, ratio, *rng));
-    if (m_hFlip && std::bernoulli_distribution()(*rng))
-    {
-        cv::flip(mat, mat, 1);
-    }
-
-    m_rngs.push(std::move(rng));
+    rect = GetCropRect(m_cropType, rows, cols, ratio, rng);
+    flip = m_hFlip && std::bernoulli_distribution()(rng);
 }
 
 CropTransformer::CropType
@@ -310,16 +320,21 @@ void ScaleTransformer::Apply(cv::Mat &mat)
         });
 
 
-    auto index = UniIntT(0, static_cast<int>(m_interp.size()) - 1)(*rng);
-    assert(m_interp.size() > 0);
     cv::resize(
         mat, mat,
         cv::Size(static_cast<int>(m_imgWidth), static_cast<int>(m_imgHeight)), 0,
-        0, m_interp[index]);
+        0, SelectInterpolation(*rng));
 
     m_rngs.push(std::move(rng));
 }
 
+int ScaleTransformer::SelectInterpolation(std::mt19937 &rng) const
+{
+    assert(m_interp.size() > 0);
+    auto index = UniIntT(0, static_cast<int>(m_interp.size()) - 1)(rng);
+    return m_interp[index];
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void MeanTransformer::Initialize(TransformerPtr next,
@@ -471,4 +486,231 @@ TransposeTransformer::TypedApply(SequenceDataPtr sequence,
     return result;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// An image with the drawn parameters of its augmentation, written by the packer.
+struct ImageAugmentationTransformer::AugmentedImage : DeferredDenseSequenceData
+{
+    SequenceDataPtr m_original; // the decoded image (HWC)
+    cv::Rect m_cropRect;
+    bool m_flip;
+    int m_interpolation;
+    ImageAugmentationTransformer* m_parent;
+
+    virtual void WriteTo(char* destination) const override
+    {
+        if (m_parent->m_dataType == CV_32F)
+        {
+            m_parent->Write<float>(*this, destination);
+        }
+        else
+        {
+            m_parent->Write<double>(*this, destination);
+        }
+    }
+};
+
+ImageAugmentationTransformer::ImageAugmentationTransformer()
+    : m_dimensions(0, 0, 0), m_dataFormat(CHW), m_dataType(CV_32F), m_seed(0),
+      m_numImages(0), m_cropTicks(0), m_scaleTicks(0), m_writeTicks(0)
+{
+}
+
+void ImageAugmentationTransformer::Initialize(TransformerPtr next,
+                                              const ConfigParameters &readerConfig)
+{
+    TransformerBase::Initialize(next, readerConfig);
+    m_seed = std::stoi(readerConfig(L"seed", "0"));
+
+    ImageConfigHelper config(readerConfig);
+    size_t featureStreamId = config.GetFeatureStreamId();
+    m_appliedStreamIds.push_back(featureStreamId);
+    m_dataFormat = config.GetDataFormat();
+
+    // The stages only parse their configuration here.
+    m_cropper = std::make_shared<CropTransformer>();
+    m_cropper->Initialize(next, readerConfig);
+    m_scaler = std::make_shared<ScaleTransformer>();
+    m_scaler->Initialize(next, readerConfig);
+    auto mean = std::make_shared<MeanTransformer>();
+    mean->Initialize(next, readerConfig);
+
+    const auto &inputStreams = GetInputStreams();
+    m_outputStreams.resize(inputStreams.size());
+    std::copy(inputStreams.begin(), inputStreams.end(), m_outputStreams.begin());
+
+    const auto &feature = inputStreams[featureStreamId];
+    m_dataType = feature->m_elementType == ElementType::tfloat ? CV_32F : CV_64F;
+    m_dimensions = m_scaler->GetDimensions();
+    auto changedStream = std::make_shared<StreamDescription>(*feature);
+    changedStream->m_sampleLayout = std::make_shared<TensorShape>(m_dimensions.AsTensorShape(m_dataFormat));
+    m_outputStreams[featureStreamId] = changedStream;
+
+    const cv::Mat &meanImg = mean->GetMeanImage();
+    if (!meanImg.empty())
+    {
+        if (meanImg.cols != static_cast<int>(m_dimensions.m_width) ||
+            meanImg.rows != static_cast<int>(m_dimensions.m_height) ||
+            meanImg.channels() != static_cast<int>(m_dimensions.m_numChannels))
+        {
+            RuntimeError("The mean image must have the dimensions of the scaled image (%dx%dx%d).",
+                         static_cast<int>(m_dimensions.m_width), static_cast<int>(m_dimensions.m_height), static_cast<int>(m_dimensions.m_numChannels));
+        }
+        meanImg.convertTo(m_meanImg, m_dataType);
+        if (!m_meanImg.isContinuous())
+        {
+            m_meanImg = m_meanImg.clone();
+        }
+    }
+}
+
+void ImageAugmentationTransformer::StartEpoch(const EpochConfiguration &config)
+{
+    TransformerBase::StartEpoch(config);
+    m_numImages = 0;
+    m_cropTicks = 0;
+    m_scaleTicks = 0;
+    m_writeTicks = 0;
+}
+
+SequenceDataPtr
+ImageAugmentationTransformer::Apply(SequenceDataPtr sequence,
+                                    const StreamDescription &inputStream,
+                                    const StreamDescription &outputStream)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    assert(inputStream.m_storageType == StorageType::dense);
+    UNUSED(inputStream);
+    const auto &inputSequence = static_cast<const DenseSequenceData&>(*sequence);
+    ImageDimensions dimensions(*inputSequence.m_sampleLayout, HWC);
+    if (dimensions.m_numChannels != m_dimensions.m_numChannels)
+    {
+        RuntimeError("Image has %d channels, expected %d.", static_cast<int>(dimensions.m_numChannels), static_cast<int>(m_dimensions.m_numChannels));
+    }
+
+    // The crop and the interpolation are drawn from generators of their own, like the separate Crop and Scale
+    // transformers do, so that a given seed gives the same images either way.
+    auto seed = m_seed;
+    auto createRng = [seed]()
+    {
+        return std::make_unique<std::mt19937>(seed);
+    };
+
+    auto result = std::make_shared<AugmentedImage>();
+    auto cropRng = m_cropRngs.pop_or_create(createRng);
+    m_cropper->SelectCrop(static_cast<int>(dimensions.m_height), static_cast<int>(dimensions.m_width), *cropRng, result->m_cropRect, result->m_flip);
+    m_cropRngs.push(std::move(cropRng));
+
+    auto scaleRng = m_scaleRngs.pop_or_create(createRng);
+    result->m_interpolation = m_scaler->SelectInterpolation(*scaleRng);
+    m_scaleRngs.push(std::move(scaleRng));
+
+    result->m_original = sequence;
+    result->m_parent = this;
+    result->m_sampleLayout = outputStream.m_sampleLayout;
+    result->m_numberOfSamples = inputSequence.m_numberOfSamples;
+
+    m_cropTicks += (std::chrono::high_resolution_clock::now() - start).count();
+    return result;
+}
+
+template <class TElement>
+void ImageAugmentationTransformer::Write(const AugmentedImage &image, char *destination)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    const auto &inputSequence = static_cast<const DenseSequenceData&>(*image.m_original);
+    ImageDimensions inputDimensions(*inputSequence.m_sampleLayout, HWC);
+    int width = static_cast<int>(m_dimensions.m_width);
+    int height = static_cast<int>(m_dimensions.m_height);
+    int channels = static_cast<int>(m_dimensions.m_numChannels);
+    int type = CV_MAKETYPE(m_dataType, channels);
+
+    cv::Mat source(static_cast<int>(inputDimensions.m_height), static_cast<int>(inputDimensions.m_width), type, inputSequence.m_data);
+    cv::Mat scaled = source(image.m_cropRect);
+    auto scratch = m_scratchImages.pop_or_create(
+        []()
+        {
+            return std::make_unique<ScratchImages>();
+        });
+
+    // The crop is flipped before it is scaled, as the Crop transformer does (the interpolation is not exactly symmetric).
+    if (image.m_flip)
+    {
+        cv::flip(scaled, scratch->m_flipped, 1);
+        scaled = scratch->m_flipped;
+    }
+
+    // If nothing but scaling is left, the scaled image is the result.
+    bool scaleOnly = m_dataFormat == HWC && m_meanImg.empty();
+    bool done = false;
+    if (scaled.cols != width || scaled.rows != height)
+    {
+        cv::Mat target = scaleOnly ? cv::Mat(height, width, type, destination) : scratch->m_scaled;
+        cv::resize(scaled, target, cv::Size(width, height), 0, 0, image.m_interpolation);
+        assert(!scaleOnly || target.data == reinterpret_cast<uchar*>(destination));
+        if (!scaleOnly)
+        {
+            scratch->m_scaled = target; // keeps the buffer for the next image
+        }
+        scaled = target;
+        done = scaleOnly;
+    }
+    auto scaleEnd = std::chrono::high_resolution_clock::now();
+
+    if (!done)
+    {
+        // subtract the mean and change the layout in one pass
+        TElement* output = reinterpret_cast<TElement*>(destination);
+        const TElement* mean = m_meanImg.empty() ? nullptr : m_meanImg.ptr<TElement>();
+        size_t pixelCount = static_cast<size_t>(width) * height;
+        size_t channelStride = m_dataFormat == CHW ? pixelCount : 1;
+        size_t pixelStride = m_dataFormat == CHW ? 1 : channels;
+        for (int y = 0; y < height; y++)
+        {
+            const TElement* row = scaled.ptr<TElement>(y);
+            for (int x = 0; x < width; x++)
+            {
+                const TElement* pixel = row + x * channels;
+                size_t pixelIndex = static_cast<size_t>(y) * width + x;
+                TElement* outputPixel = output + pixelIndex * pixelStride;
+                for (int c = 0; c < channels; c++)
+                {
+                    TElement value = pixel[c];
+                    if (mean)
+                    {
+                        value -= mean[pixelIndex * channels + c];
+                    }
+                    outputPixel[c * channelStride] = value;
+                }
+            }
+        }
+    }
+    m_scratchImages.push(std::move(scratch));
+
+    auto end = std::chrono::high_resolution_clock::now();
+    m_numImages++;
+    m_scaleTicks += (scaleEnd - start).count();
+    m_writeTicks += (end - scaleEnd).count();
+}
+
+ImageAugmentationTransformer::Statistics ImageAugmentationTransformer::GetStatistics() const
+{
+    typedef std::chrono::high_resolution_clock::duration Ticks;
+    Statistics statistics;
+    statistics.m_numImages = m_numImages;
+    statistics.m_cropSeconds = std::chrono::duration<double>(Ticks(m_cropTicks.load())).count();
+    statistics.m_scaleSeconds = std::chrono::duration<double>(Ticks(m_scaleTicks.load())).count();
+    statistics.m_writeSeconds = std::chrono::duration<double>(Ticks(m_writeTicks.load())).count();
+    return statistics;
+}
+
+void ImageAugmentationTransformer::PrintStatistics() const
+{
+    Statistics statistics = GetStatistics();
+    double totalSeconds = statistics.m_cropSeconds + statistics.m_scaleSeconds + statistics.m_writeSeconds;
+    fprintf(stderr, "ImageAugmentationTransformer: %d images in %.3fs (summed over threads): crop %.3fs, scale %.3fs, flip/mean/layout %.3fs; %.1f us per image.\n",
+            static_cast<int>(statistics.m_numImages), totalSeconds, statistics.m_cropSeconds, statistics.m_scaleSeconds, statistics.m_writeSeconds,
+            statistics.m_numImages > 0 ? 1e6 * totalSeconds / statistics.m_numImages : 0.0);
+}
+
 }}}
@@ -8,6 +8,7 @@
 
 #include <unordered_map>
 #include <random>
+#include <atomic>
 #include <opencv2/opencv.hpp>
 
 #include "Transformer.h"
@@ -70,6 +71,9 @@ public:
     virtual void Initialize(TransformerPtr next,
                             const ConfigParameters &readerConfig) override;
 
+    // Draws the crop of an image of the given size, and whether to flip it horizontally.
+    void SelectCrop(int rows, int cols, std::mt19937 &rng, cv::Rect &rect, bool &flip);
+
 protected:
     virtual void Apply(cv::Mat &mat) override;
 
@@ -109,6 +113,14 @@ public:
     virtual void Initialize(TransformerPtr next,
                             const ConfigParameters &readerConfig) override;
 
+    // Draws one of the configured interpolation methods.
+    int SelectInterpolation(std::mt19937 &rng) const;
+
+    ImageDimensions GetDimensions() const
+    {
+        return ImageDimensions(m_imgWidth, m_imgHeight, m_imgChannels);
+    }
+
 private:
     void InitFromConfig(const ConfigParameters &config);
     virtual void Apply(cv::Mat &mat) override;
@@ -131,6 +143,12 @@ public:
     virtual void Initialize(TransformerPtr next,
                             const ConfigParameters &readerConfig) override;
 
+    // The mean image, or an empty one.
+    const cv::Mat &GetMeanImage() const
+    {
+        return m_meanImg;
+    }
+
 private:
     virtual void Apply(cv::Mat &mat) override;
     void InitFromConfig(const ConfigParameters &config);
@@ -170,4 +188,81 @@ private:
     std::vector<StreamId> m_appliedStreamIds;
 };
 
+// Crop (with ratio jitter and horizontal flip), scale, mean subtraction and the transposition to CHW as a single stage.
+// The configuration is that of the separate transformers above, which are used to parse it.
+// This stage only draws the random parameters of each image. The image is produced when the packer writes it into
+// the minibatch buffer (see DeferredDenseSequenceData): the crop is flipped and scaled into scratch images that are
+// reused, and mean subtraction and layout change are done while copying it to the buffer. Without mean and
+// transposition, the crop is scaled directly into the buffer. For a given seed, the images are the same as those of the
+// separate transformers.
+class ImageAugmentationTransformer : public TransformerBase
+{
+public:
+    ImageAugmentationTransformer();
+
+    virtual void Initialize(TransformerPtr next,
+                            const ConfigParameters &readerConfig) override;
+
+    virtual void StartEpoch(const EpochConfiguration &config) override;
+
+    // Time spent in each stage since the start of the epoch, summed over all threads.
+    struct Statistics
+    {
+        size_t m_numImages;
+        double m_cropSeconds;  // drawing crops, flips and interpolations
+        double m_scaleSeconds; // scaling
+        double m_writeSeconds; // flip, mean subtraction and layout change, while writing to the minibatch buffer
+    };
+    Statistics GetStatistics() const;
+    void PrintStatistics() const;
+
+protected:
+    virtual const std::vector<StreamId> &GetAppliedStreamIds() const override
+    {
+        return m_appliedStreamIds;
+    }
+
+    virtual const std::vector<StreamDescriptionPtr> &GetOutputStreams() const override
+    {
+        return m_outputStreams;
+    }
+
+    SequenceDataPtr Apply(SequenceDataPtr inputSequence,
+                          const StreamDescription &inputStream,
+                          const StreamDescription &outputStream) override;
+
+private:
+    struct AugmentedImage;
+
+    template <class TElement>
+    void Write(const AugmentedImage &image, char *destination);
+
+    std::shared_ptr<CropTransformer> m_cropper;
+    std::shared_ptr<ScaleTransformer> m_scaler;
+    cv::Mat m_meanImg; // in the element type of the stream, or empty
+    ImageDimensions m_dimensions;
+    ImageLayoutKind m_dataFormat;
+    int m_dataType;
+
+    unsigned int m_seed;
+    conc_stack<std::unique_ptr<std::mt19937>> m_cropRngs;
+    conc_stack<std::unique_ptr<std::mt19937>> m_scaleRngs;
+
+    // buffers for the flipped crop and the scaled image, reused between images
+    struct ScratchImages
+    {
+        cv::Mat m_flipped;
+        cv::Mat m_scaled;
+    };
+    conc_stack<std::unique_ptr<ScratchImages>> m_scratchImages;
+
+    std::vector<StreamDescriptionPtr> m_outputStreams;
+    std::vector<StreamId> m_appliedStreamIds;
+
+    std::atomic<size_t> m_numImages;
+    std::atomic<long long> m_cropTicks; // in std::chrono::high_resolution_clock ticks
+    std::atomic<long long> m_scaleTicks;
+    std::atomic<long long> m_writeTicks;
+};
+
 }}}
@@ -12,6 +12,7 @@
 
 #include "DataReader.h"
 #include <random>
+#include <unordered_set>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -76,6 +77,12 @@ void BlockRandomizer::RandomizeChunks()
     // Add sentinel
     m_randomizedChunks.push_back(RandomizedChunk { sequencePosition, samplePosition, SIZE_MAX });
 
+    m_chunkToRandomizedChunk.resize(m_numChunks);
+    for (chunkId = 0; chunkId < m_numChunks; chunkId++)
+    {
+        m_chunkToRandomizedChunk[randomizedChunkIndices[chunkId]] = chunkId;
+    }
+
     // For each chunk, compute the randomization range (w.r.t. the randomized chunk sequence)
     size_t halfWindowRange = m_randomizationRangeInSamples / 2;
     for (size_t chunkId = 0; chunkId < m_numChunks; chunkId++)
@@ -221,7 +228,22 @@ void BlockRandomizer::RandomizeForGlobalSamplePosition(const size_t samplePositi
         m_sweepStartInSamples = sweep * m_numSamples;
         Randomize();
     }
-    m_sequencePositionInSweep = samplePosition % m_numSamples; // TODO only for m_frameMode
+
+    size_t samplePositionInSweep = samplePosition % m_numSamples;
+    if (m_frameMode)
+    {
+        m_sequencePositionInSweep = samplePositionInSweep;
+        return;
+    }
+
+    // Sequence mode: start with the first sequence that begins at or after the sample position.
+    size_t samples = 0;
+    m_sequencePositionInSweep = 0;
+    while (m_sequencePositionInSweep < m_numSequences && samples < samplePositionInSweep)
+    {
+        samples += m_randomTimeline[m_sequencePositionInSweep].m_numberOfSamples;
+        m_sequencePositionInSweep++;
+    }
 };
 
 //
@@ -236,7 +258,11 @@ BlockRandomizer::BlockRandomizer(int verbosity, size_t randomizationRangeInSampl
       m_sweep(SIZE_MAX),
       m_sequencePositionInSweep(SIZE_MAX),
       m_samplePositionInEpoch(SIZE_MAX),
-      m_epochSize(SIZE_MAX)
+      m_epochSize(SIZE_MAX),
+      m_maxCachedChunks(32),
+      m_prefetchChunks(true),
+      m_chunkCacheTime(0),
+      m_stopPrefetch(false)
 {
     assert(deserializer != nullptr);
     const SequenceDescriptions& timeline = m_deserializer->GetSequenceDescriptions();
@@ -283,11 +309,18 @@ BlockRandomizer::BlockRandomizer(int verbosity, size_t randomizationRangeInSampl
     m_frameMode = (maxNumberOfSamples == 1);
 }
 
+BlockRandomizer::~BlockRandomizer()
+{
+    StopPrefetch();
+}
+
 void BlockRandomizer::Initialize(TransformerPtr next, const ConfigParameters& readerConfig)
 {
     // Not used for the block randomizer.
     UNUSED(next);
-    UNUSED(readerConfig);
+
+    m_maxCachedChunks = readerConfig(L"chunkCacheSize", m_maxCachedChunks);
+    m_prefetchChunks = readerConfig(L"chunkPrefetch", m_prefetchChunks);
 }
 
 void BlockRandomizer::StartEpoch(const EpochConfiguration& config)
@@ -308,16 +341,14 @@ void BlockRandomizer::StartEpoch(const EpochConfiguration& config)
     // TODO add some asserts on EpochConfiguration
     m_samplePositionInEpoch = 0;
     size_t timeframe = m_epochSize * config.m_epochIndex;
-    assert(m_frameMode); // TODO !m_frameMode needs fixes
     assert(timeframe != SIZE_MAX); // used as special value for init
     RandomizeForGlobalSamplePosition(timeframe);
 };
 
 bool BlockRandomizer::GetNextSequenceDescriptions(size_t sampleCount, SequenceDescriptions& sequenceDescriptions)
 {
-    assert(m_frameMode); // TODO !m_frameMode not implemented yet
     assert(sequenceDescriptions.size() == 0);
-    assert(sampleCount < m_numSamples);
+    assert(!m_frameMode || sampleCount < m_numSamples);
 
     if (m_samplePositionInEpoch < m_epochSize)
     {
@@ -325,8 +356,9 @@ bool BlockRandomizer::GetNextSequenceDescriptions(size_t sampleCount, SequenceDe
         {
             assert(m_numberOfWorkers == 1); // TODO needs implementation
 
+            size_t numSamples = 0;
             while (m_samplePositionInEpoch < m_epochSize &&
-                   sequenceDescriptions.size() < sampleCount)
+                   numSamples < sampleCount)
             {
                 RandomizeIfNewSweepIsEntered();
 
@@ -335,12 +367,42 @@ bool BlockRandomizer::GetNextSequenceDescriptions(size_t sampleCount, SequenceDe
                 {
                     // Got one, collect it
                     sequenceDescriptions.push_back(m_deserializer->GetSequenceDescriptions()[seqDesc.m_id]);
+                    numSamples += seqDesc.m_numberOfSamples;
                 }
 
                 m_samplePositionInEpoch += seqDesc.m_numberOfSamples;
                 m_sequencePositionInSweep++;
             }
         }
+        else if (!m_frameMode)
+        {
+            assert(m_distributionMode == DistributionMode::sequences_strides);
+
+            // Sequence mode: whole sequences (at least one) up to sampleCount samples, distributed by sequence.
+            std::vector<size_t> sequenceIds;
+            size_t numSamples = 0;
+            while (m_samplePositionInEpoch < m_epochSize)
+            {
+                RandomizeIfNewSweepIsEntered();
+
+                const auto& seqDesc = m_randomTimeline[m_sequencePositionInSweep];
+                if (!sequenceIds.empty() && numSamples + seqDesc.m_numberOfSamples > sampleCount)
+                {
+                    break;
+                }
+                sequenceIds.push_back(seqDesc.m_id);
+                numSamples += seqDesc.m_numberOfSamples;
+                m_samplePositionInEpoch += seqDesc.m_numberOfSamples;
+                m_sequencePositionInSweep++;
+            }
+
+            size_t strideBegin = sequenceIds.size() * m_workerRank / m_numberOfWorkers;
+            size_t strideEnd = sequenceIds.size() * (m_workerRank + 1) / m_numberOfWorkers;
+            for (size_t i = strideBegin; i < strideEnd; ++i)
+            {
+                sequenceDescriptions.push_back(m_deserializer->GetSequenceDescriptions()[sequenceIds[i]]);
+            }
+        }
         else
         {
             assert(m_distributionMode == DistributionMode::sequences_strides);
@@ -371,7 +433,6 @@ Sequences BlockRandomizer::GetNextSequences(size_t sampleCount)
     assert(m_samplePositionInEpoch != SIZE_MAX); // SetEpochConfiguration() must be called first
 
     Sequences result;
-    assert(m_frameMode); // TODO sequence mode not implemented yet
 
     SequenceDescriptions sequenceDescriptions;
     result.m_endOfEpoch = GetNextSequenceDescriptions(sampleCount, sequenceDescriptions);
@@ -388,16 +449,297 @@ Sequences BlockRandomizer::GetNextSequences(size_t sampleCount)
     // For current implementation of image reader it does no matter because chunk = image.
     // We have to reassamble the exposed result from sequences drawn from diffrent chunks.
     result.m_data.resize(sequenceDescriptions.size());
+    std::vector<ChunkPtr> chunks = GetChunks(sequenceDescriptions);
 
-    // TODO: Should prefetching be done on a single thread?
 #pragma omp parallel for ordered schedule(dynamic)
     for (int i = 0; i < sequenceDescriptions.size(); ++i)
     {
-        ChunkPtr chunk = m_deserializer->GetChunk(sequenceDescriptions[i]->m_chunkId);
-        result.m_data[i] = chunk->GetSequence(sequenceDescriptions[i]->m_id);
+        result.m_data[i] = chunks[i]->GetSequence(sequenceDescriptions[i]->m_id);
+    }
+
+    // Sequence data keeps its chunk alive, so the chunks can be evicted right away.
+    UpdateChunkCache(sampleCount);
+    if (result.m_endOfEpoch && m_verbosity > 0)
+    {
+        PrintChunkCacheStatistics();
     }
 
     return result;
 };
 
+std::vector<ChunkPtr> BlockRandomizer::GetChunks(const SequenceDescriptions& sequences)
+{
+    m_chunkCacheTime++;
+
+    std::vector<size_t> missingChunks;
+    for (const auto& sequence : sequences)
+    {
+        auto& entry = m_chunkCache[sequence->m_chunkId];
+        if (entry.m_lastUse == m_chunkCacheTime)
+        {
+            continue; // already requested for this minibatch
+        }
+        entry.m_lastUse = m_chunkCacheTime;
+
+        if (entry.m_prefetching)
+        {
+            entry.m_chunk = TakePrefetchedChunk(sequence->m_chunkId);
+            entry.m_prefetching = false;
+        }
+
+        if (entry.m_chunk)
+        {
+            m_chunkCacheStatistics.m_numHits++;
+        }
+        else
+        {
+            m_chunkCacheStatistics.m_numMisses++;
+            missingChunks.push_back(sequence->m_chunkId);
+        }
+    }
+
+    std::vector<ChunkPtr> loadedChunks(missingChunks.size());
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < missingChunks.size(); ++i)
+    {
+        loadedChunks[i] = m_deserializer->GetChunk(missingChunks[i]);
+    }
+    for (size_t i = 0; i < missingChunks.size(); ++i)
+    {
+        m_chunkCache[missingChunks[i]].m_chunk = loadedChunks[i];
+    }
+
+    std::vector<ChunkPtr> chunks;
+    chunks.reserve(sequences.size());
+    for (const auto& sequence : sequences)
+    {
+        chunks.push_back(m_chunkCache[sequence->m_chunkId].m_chunk);
+    }
+    m_chunkCacheStatistics.m_maxNumCachedChunks = std::max(m_chunkCacheStatistics.m_maxNumCachedChunks, m_chunkCache.size());
+    return chunks;
+}
+
+void BlockRandomizer::UpdateChunkCache(size_t sampleCount)
+{
+    if (m_maxCachedChunks == 0)
+    {
+        m_chunkCacheStatistics.m_numEvictions += m_chunkCache.size();
+        m_chunkCache.clear();
+        return;
+    }
+
+    // Chunks of the next minibatch (within the current sweep); assumes it has the same size as this one.
+    std::vector<size_t> nextChunks;
+    std::unordered_set<size_t> isNextChunk;
+    if (m_samplePositionInEpoch < m_epochSize)
+    {
+        size_t numSamples = std::min(sampleCount, m_epochSize - m_samplePositionInEpoch);
+        size_t samples = 0;
+        for (size_t position = m_sequencePositionInSweep; position < m_numSequences && samples < numSamples; position++)
+        {
+            const auto& seqDesc = m_randomTimeline[position];
+            size_t chunkId = m_randomizedChunks[seqDesc.m_chunkId].m_originalChunkIndex;
+            if (isNextChunk.insert(chunkId).second)
+            {
+                nextChunks.push_back(chunkId);
+            }
+            samples += seqDesc.m_numberOfSamples;
+        }
+    }
+
+    // Chunks before the randomization window of the current position are not needed again in this sweep.
+    size_t windowBegin = m_sequencePositionInSweep < m_numSequences ?
+        m_randomizedChunks[m_sequencePositionToChunkIndex[m_sequencePositionInSweep]].m_windowBegin :
+        m_numChunks;
+    std::vector<std::pair<size_t, size_t>> evictionCandidates; // last use and chunk index
+    for (auto it = m_chunkCache.begin(); it != m_chunkCache.end();)
+    {
+        if (it->second.m_prefetching || isNextChunk.find(it->first) != isNextChunk.end())
+        {
+            ++it;
+        }
+        else if (m_chunkToRandomizedChunk[it->first] < windowBegin)
+        {
+            it = m_chunkCache.erase(it);
+            m_chunkCacheStatistics.m_numEvictions++;
+        }
+        else
+        {
+            evictionCandidates.push_back(std::make_pair(it->second.m_lastUse, it->first));
+            ++it;
+        }
+    }
+
+    // Make room for the chunks of the next minibatch, least recently used first.
+    size_t numNextChunksToLoad = std::count_if(nextChunks.begin(), nextChunks.end(), [this](size_t chunkId)
+    {
+        return m_chunkCache.find(chunkId) == m_chunkCache.end();
+    });
+    std::sort(evictionCandidates.begin(), evictionCandidates.end());
+    for (size_t i = 0; i < evictionCandidates.size() && m_chunkCache.size() + numNextChunksToLoad > m_maxCachedChunks; i++)
+    {
+        m_chunkCache.erase(evictionCandidates[i].second);
+        m_chunkCacheStatistics.m_numEvictions++;
+    }
+
+    if (!m_prefetchChunks)
+    {
+        return;
+    }
+
+    std::vector<size_t> chunksToLoad;
+    for (size_t chunkId : nextChunks)
+    {
+        if (m_chunkCache.size() + chunksToLoad.size() >= m_maxCachedChunks)
+        {
+            break;
+        }
+        if (m_chunkCache.find(chunkId) == m_chunkCache.end())
+        {
+            chunksToLoad.push_back(chunkId);
+        }
+    }
+    if (chunksToLoad.empty())
+    {
+        return;
+    }
+
+    PrefetchChunks(chunksToLoad);
+    for (size_t chunkId : chunksToLoad)
+    {
+        auto& entry = m_chunkCache[chunkId];
+        entry.m_prefetching = true;
+        entry.m_lastUse = m_chunkCacheTime;
+    }
+    m_chunkCacheStatistics.m_numPrefetches += chunksToLoad.size();
+    m_chunkCacheStatistics.m_maxNumCachedChunks = std::max(m_chunkCacheStatistics.m_maxNumCachedChunks, m_chunkCache.size());
+}
+
+void BlockRandomizer::PrefetchChunks(const std::vector<size_t>& chunkIds)
+{
+    if (!m_prefetchThread.joinable())
+    {
+        m_stopPrefetch = false;
+        m_prefetchError = nullptr;
+        m_prefetchThread = std::thread([this]()
+        {
+            PrefetchLoop();
+        });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        m_prefetchQueue.insert(m_prefetchQueue.end(), chunkIds.begin(), chunkIds.end());
+    }
+    m_prefetchCondition.notify_all();
+}
+
+ChunkPtr BlockRandomizer::TakePrefetchedChunk(size_t chunkId)
+{
+    std::unique_lock<std::mutex> lock(m_prefetchMutex);
+    auto isDone = [this, chunkId]()
+    {
+        return m_prefetchedChunks.find(chunkId) != m_prefetchedChunks.end() || m_prefetchError;
+    };
+    if (!isDone())
+    {
+        m_chunkCacheStatistics.m_numWaits++;
+    }
+    m_prefetchCondition.wait(lock, isDone);
+
+    auto it = m_prefetchedChunks.find(chunkId);
+    if (it == m_prefetchedChunks.end())
+    {
+        // the prefetch thread failed
+        auto error = m_prefetchError;
+        lock.unlock();
+        StopPrefetch();
+        std::rethrow_exception(error);
+    }
+    ChunkPtr chunk = it->second;
+    m_prefetchedChunks.erase(it);
+    return chunk;
+}
+
+// The deserializer must allow GetChunk() calls from several threads, as in GetNextSequences().
+void BlockRandomizer::PrefetchLoop()
+{
+    try
+    {
+        for (;;)
+        {
+            size_t chunkId;
+            {
+                std::unique_lock<std::mutex> lock(m_prefetchMutex);
+                m_prefetchCondition.wait(lock, [this]()
+                {
+                    return m_stopPrefetch || !m_prefetchQueue.empty();
+                });
+                if (m_stopPrefetch)
+                {
+                    return;
+                }
+                chunkId = m_prefetchQueue.front();
+                m_prefetchQueue.pop_front();
+            }
+
+            ChunkPtr chunk = m_deserializer->GetChunk(chunkId);
+
+            {
+                std::lock_guard<std::mutex> lock(m_prefetchMutex);
+                m_prefetchedChunks[chunkId] = chunk;
+            }
+            m_prefetchCondition.notify_all();
+        }
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_prefetchMutex);
+            m_prefetchError = std::current_exception();
+        }
+        m_prefetchCondition.notify_all();
+    }
+}
+
+// Stops the prefetch thread and forgets the chunks it has not delivered yet; it is started again by the next prefetch.
+void BlockRandomizer::StopPrefetch()
+{
+    if (!m_prefetchThread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        m_stopPrefetch = true;
+    }
+    m_prefetchCondition.notify_all();
+    m_prefetchThread.join();
+
+    m_prefetchQueue.clear();
+    m_prefetchedChunks.clear();
+    m_prefetchError = nullptr;
+    for (auto it = m_chunkCache.begin(); it != m_chunkCache.end();)
+    {
+        if (it->second.m_prefetching)
+        {
+            it = m_chunkCache.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void BlockRandomizer::PrintChunkCacheStatistics() const
+{
+    const auto& statistics = m_chunkCacheStatistics;
+    std::cerr << "BlockRandomizer: chunk cache hit rate " << 100 * statistics.GetHitRate() << "% ("
+              << statistics.m_numHits << " hits, " << statistics.m_numMisses << " misses, "
+              << statistics.m_numPrefetches << " prefetched, " << statistics.m_numWaits << " waits), "
+              << statistics.m_numEvictions << " evictions, at most " << statistics.m_maxNumCachedChunks << " chunks cached" << endl;
+}
+
 } } }
@@ -6,23 +6,48 @@
 #pragma once
 
 #include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <unordered_map>
 
 #include "Transformer.h"
 #include "DataDeserializer.h"
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// Counters of the chunk cache of the BlockRandomizer, to tune the randomization window against memory.
+struct ChunkCacheStatistics
+{
+    size_t m_numHits = 0;        // chunk requests served from the cache, including prefetched chunks
+    size_t m_numMisses = 0;      // chunk requests that had to load the chunk
+    size_t m_numPrefetches = 0;  // chunks loaded ahead in the background
+    size_t m_numWaits = 0;       // hits that had to wait for the background load to finish
+    size_t m_numEvictions = 0;
+    size_t m_maxNumCachedChunks = 0;
+
+    double GetHitRate() const
+    {
+        size_t numRequests = m_numHits + m_numMisses;
+        return numRequests > 0 ? (double) m_numHits / numRequests : 0.0;
+    }
+};
+
 // The class represents a randomizer that does randomization based on chunks/sequences inside a set of chunk.
 // TODO: currently this code moved from the old block randomizer.
 // The class will be further refactored and common based will be extracted with NoRandomizer.
-// Currently works only for frame mode (numberOfSample in sequence == 1)
+// In sequence mode (sequences with more than one sample), GetNextSequences() returns whole sequences.
+//
+// Loaded chunks are cached: a chunk stays in memory while it can still be needed in the randomization window of the
+// current position, up to chunkCacheSize chunks (least recently used ones are evicted first), and the chunks of the
+// next minibatch are loaded in the background (chunkPrefetch), by a prefetch thread that lives as long as the randomizer.
 class BlockRandomizer : public Transformer
 {
 public:
     BlockRandomizer(int verbosity, size_t randomizationRangeInSamples, IDataDeserializerPtr deserializer);
-    virtual ~BlockRandomizer()
-    {
-    }
+    virtual ~BlockRandomizer();
 
     virtual void Initialize(TransformerPtr next, const ConfigParameters& readerConfig) override;
     virtual void StartEpoch(const EpochConfiguration& config) override;
@@ -32,6 +57,12 @@ public:
         return m_deserializer->GetStreamDescriptions();
     }
 
+    // counters since construction
+    const ChunkCacheStatistics& GetChunkCacheStatistics() const
+    {
+        return m_chunkCacheStatistics;
+    }
+
 private:
     enum class DistributionMode {
         // TODO better names, description
@@ -58,6 +89,19 @@ private:
         size_t m_windowEnd;
     };
 
+    // A chunk in the cache; either loaded, or being loaded in the background.
+    struct CachedChunk
+    {
+        ChunkPtr m_chunk;
+        bool m_prefetching; // queued for the prefetch thread, and not yet taken from m_prefetchedChunks
+        size_t m_lastUse;   // m_chunkCacheTime of the last request
+
+        CachedChunk()
+            : m_prefetching(false), m_lastUse(0)
+        {
+        }
+    };
+
     // General configuration
     int m_verbosity;
     size_t m_randomizationRangeInSamples; // full window
@@ -84,6 +128,23 @@ private:
     std::vector<RandomizedChunk> m_randomizedChunks;    // (includes a sentinel)
     std::vector<size_t> m_sequencePositionToChunkIndex; // TODO find on m_randomizedChunks instead?
     std::vector<SequenceDescription> m_randomTimeline;
+    std::vector<size_t> m_chunkToRandomizedChunk;       // original chunk index -> randomized chunk index
+
+    // Chunk cache, by original chunk index
+    std::unordered_map<size_t, CachedChunk> m_chunkCache;
+    size_t m_maxCachedChunks;
+    bool m_prefetchChunks;
+    size_t m_chunkCacheTime; // number of GetNextSequences() calls that needed chunks
+    ChunkCacheStatistics m_chunkCacheStatistics;
+
+    // Prefetch thread: loads the chunks of m_prefetchQueue into m_prefetchedChunks, where GetChunks() takes them.
+    std::thread m_prefetchThread;
+    std::mutex m_prefetchMutex;
+    std::condition_variable m_prefetchCondition;
+    std::deque<size_t> m_prefetchQueue;
+    std::unordered_map<size_t, ChunkPtr> m_prefetchedChunks;
+    bool m_stopPrefetch;
+    std::exception_ptr m_prefetchError; // the thread stops at the first failed load
 
     // Check that timeline has only valid sequences of non-zero length
     // with incrementing IDs and non-decreasing chunk identifiers.
@@ -100,5 +161,23 @@ private:
     void RandomizeIfNewSweepIsEntered();
 
     bool GetNextSequenceDescriptions(size_t sampleCount, SequenceDescriptions& sequences);
+
+    // Returns the chunk of each of the sequences, from the cache or loaded.
+    std::vector<ChunkPtr> GetChunks(const SequenceDescriptions& sequences);
+
+    // Evicts the chunks that are no longer needed and starts loading the chunks of the next sampleCount samples.
+    void UpdateChunkCache(size_t sampleCount);
+
+    // Queues chunks for the prefetch thread, starting it if needed.
+    void PrefetchChunks(const std::vector<size_t>& chunkIds);
+
+    // Waits for a queued chunk; rethrows the error of the prefetch thread if it failed.
+    ChunkPtr TakePrefetchedChunk(size_t chunkId);
+
+    void PrefetchLoop();
+
+    void StopPrefetch();
+
+    void PrintChunkCacheStatistics() const;
 };
 } } }
@@ -0,0 +1,151 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "Basics.h"
+#include "ChunkedBinaryDeserializer.h"
+#include "ElementTypeUtils.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+class ChunkedBinaryDeserializer::BinaryChunk : public Chunk, public std::enable_shared_from_this<BinaryChunk>
+{
+public:
+    BinaryChunk(ChunkedBinaryFilePtr file, size_t chunkId)
+        : m_file(file), m_firstSample(file->GetFirstSample(chunkId)), m_numSamples(file->GetNumSamples(chunkId))
+    {
+        for (const auto& stream : m_file->GetStreams())
+        {
+            auto block = m_file->GetBlock(chunkId, stream->m_id);
+            StreamBlock streamBlock;
+            streamBlock.m_values = m_file->GetData(block.m_offset);
+            streamBlock.m_rowIndices = nullptr;
+            streamBlock.m_columnStarts = nullptr;
+            if (stream->m_storageType == StorageType::sparse_csc)
+            {
+                // see ChunkedBinaryFile.h for the layout
+                size_t valuesSize = block.m_numNonZeros * GetSizeByType(stream->m_elementType);
+                size_t rowIndicesOffset = (valuesSize + ChunkedBinaryAlignment - 1) / ChunkedBinaryAlignment * ChunkedBinaryAlignment;
+                size_t rowIndicesSize = block.m_numNonZeros * sizeof(int32_t);
+                size_t columnStartsOffset = rowIndicesOffset + (rowIndicesSize + ChunkedBinaryAlignment - 1) / ChunkedBinaryAlignment * ChunkedBinaryAlignment;
+                streamBlock.m_rowIndices = reinterpret_cast<const int32_t*>(streamBlock.m_values + rowIndicesOffset);
+                streamBlock.m_columnStarts = reinterpret_cast<const int32_t*>(streamBlock.m_values + columnStartsOffset);
+                ValidateSparseBlock(*stream, chunkId, block.m_numNonZeros, streamBlock);
+            }
+            m_blocks.push_back(streamBlock);
+        }
+    }
+
+    virtual std::vector<SequenceDataPtr> GetSequence(const size_t& sequenceId) override
+    {
+        assert(m_firstSample <= sequenceId && sequenceId < m_firstSample + m_numSamples);
+        size_t sample = sequenceId - m_firstSample;
+
+        std::vector<SequenceDataPtr> result;
+        for (const auto& stream : m_file->GetStreams())
+        {
+            const auto& block = m_blocks[stream->m_id];
+            size_t elementSize = GetSizeByType(stream->m_elementType);
+            if (stream->m_storageType == StorageType::sparse_csc)
+            {
+                auto data = std::make_shared<SparseSequenceData>();
+                int32_t begin = block.m_columnStarts[sample];
+                int32_t end = block.m_columnStarts[sample + 1];
+                data->m_indices.push_back(std::vector<size_t>(block.m_rowIndices + begin, block.m_rowIndices + end));
+                data->m_data = const_cast<char*>(block.m_values + begin * elementSize);
+                data->m_chunk = shared_from_this();
+                result.push_back(data);
+            }
+            else
+            {
+                auto data = std::make_shared<DenseSequenceData>();
+                size_t sampleSize = stream->m_sampleLayout->GetNumElements() * elementSize;
+                data->m_data = const_cast<char*>(block.m_values + sample * sampleSize);
+                data->m_sampleLayout = stream->m_sampleLayout;
+                data->m_numberOfSamples = 1;
+                data->m_chunk = shared_from_this();
+                result.push_back(data);
+            }
+        }
+        return result;
+    }
+
+private:
+    struct StreamBlock
+    {
+        const char* m_values;
+        const int32_t* m_rowIndices;   // sparse only
+        const int32_t* m_columnStarts; // sparse only
+    };
+
+    // GetBlock() checks that the block fits into the file; its CSC structure must also be consistent.
+    void ValidateSparseBlock(const StreamDescription& stream, size_t chunkId, size_t numNonZeros, const StreamBlock& block) const
+    {
+        bool isValid = block.m_columnStarts[0] == 0 && (size_t) block.m_columnStarts[m_numSamples] == numNonZeros;
+        for (size_t i = 0; i < m_numSamples && isValid; i++)
+        {
+            isValid = block.m_columnStarts[i] <= block.m_columnStarts[i + 1];
+        }
+        size_t dimension = stream.m_sampleLayout->GetNumElements();
+        for (size_t k = 0; k < numNonZeros && isValid; k++)
+        {
+            isValid = block.m_rowIndices[k] >= 0 && (size_t) block.m_rowIndices[k] < dimension;
+        }
+        if (!isValid)
+        {
+            RuntimeError("ChunkedBinaryDeserializer: Stream '%ls' has invalid sparse data in chunk %d.", stream.m_name.c_str(), (int) chunkId);
+        }
+    }
+
+    ChunkedBinaryFilePtr m_file; // keeps the mapping alive
+    size_t m_firstSample;
+    size_t m_numSamples;
+    std::vector<StreamBlock> m_blocks;
+};
+
+ChunkedBinaryDeserializer::ChunkedBinaryDeserializer(const std::wstring& path)
+    : m_file(std::make_shared<ChunkedBinaryFile>(path))
+{
+    m_streams = m_file->GetStreams();
+}
+
+std::vector<StreamDescriptionPtr> ChunkedBinaryDeserializer::GetStreamDescriptions() const
+{
+    return m_streams;
+}
+
+ChunkPtr ChunkedBinaryDeserializer::GetChunk(size_t chunkId)
+{
+    if (chunkId >= m_file->GetNumChunks())
+    {
+        LogicError("ChunkedBinaryDeserializer: Chunk %d does not exist.", (int) chunkId);
+    }
+    m_file->Prefetch(chunkId);
+    return std::make_shared<BinaryChunk>(m_file, chunkId);
+}
+
+void ChunkedBinaryDeserializer::FillSequenceDescriptions(SequenceDescriptions& timeline) const
+{
+    m_descriptions.clear();
+    m_descriptions.reserve(m_file->GetNumSamples());
+    for (size_t chunkId = 0; chunkId < m_file->GetNumChunks(); chunkId++)
+    {
+        size_t firstSample = m_file->GetFirstSample(chunkId);
+        for (size_t sample = firstSample; sample < firstSample + m_file->GetNumSamples(chunkId); sample++)
+        {
+            m_descriptions.push_back(SequenceDescription{ sample, 1, chunkId, true });
+        }
+    }
+
+    timeline.clear();
+    timeline.reserve(m_descriptions.size());
+    for (const auto& description : m_descriptions)
+    {
+        timeline.push_back(&description);
+    }
+}
+
+}}}
@@ -0,0 +1,36 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#pragma once
+
+#include "DataDeserializerBase.h"
+#include "ChunkedBinaryFile.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Data deserializer for the chunked binary dataset format (see ChunkedBinaryFile.h).
+// Each sample is a sequence of its own, and the chunks of the file are the chunks of the deserializer.
+// Sequence data points directly into the memory-mapped file; only the row indices of sparse samples are copied.
+class ChunkedBinaryDeserializer : public DataDeserializerBase
+{
+public:
+    explicit ChunkedBinaryDeserializer(const std::wstring& path);
+
+    std::vector<StreamDescriptionPtr> GetStreamDescriptions() const override;
+
+    // Gets a chunk; the operating system is asked to read it ahead, since it is typically used a little later.
+    virtual ChunkPtr GetChunk(size_t chunkId) override;
+
+protected:
+    void FillSequenceDescriptions(SequenceDescriptions& timeline) const override;
+
+private:
+    class BinaryChunk;
+
+    ChunkedBinaryFilePtr m_file;
+    mutable std::vector<SequenceDescription> m_descriptions;
+};
+
+}}}
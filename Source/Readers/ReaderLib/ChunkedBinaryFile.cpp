@@ -0,0 +1,489 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "Basics.h"
+#include "ChunkedBinaryFile.h"
+#include "fileutil.h"
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+static const char ChunkedBinaryMagic[8] = { 'C', 'N', 'T', 'K', 'C', 'B', 'F', '1' };
+static const uint32_t ChunkedBinaryVersion = 1;
+
+static size_t AlignUp(size_t size)
+{
+    return (size + ChunkedBinaryAlignment - 1) / ChunkedBinaryAlignment * ChunkedBinaryAlignment;
+}
+
+// Number of uint64 values per chunk in the chunk index.
+static size_t GetChunkIndexEntrySize(size_t numStreams)
+{
+    return 2 + 2 * numStreams;
+}
+
+// ---------------------------------------------------------------------------
+// ChunkedBinaryWriter
+// ---------------------------------------------------------------------------
+
+ChunkedBinaryWriter::ChunkedBinaryWriter(const std::wstring& path, const std::vector<StreamDescriptionPtr>& streams, size_t samplesPerChunk)
+    : m_path(path), m_file(nullptr), m_offset(0), m_streams(streams), m_samplesPerChunk(samplesPerChunk), m_numSamples(0), m_numChunkSamples(0)
+{
+    if (m_samplesPerChunk == 0)
+    {
+        InvalidArgument("ChunkedBinaryWriter: The number of samples per chunk must be positive.");
+    }
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        const auto& stream = m_streams[i];
+        if (stream->m_id != i)
+        {
+            InvalidArgument("ChunkedBinaryWriter: Stream '%ls' has id %d, expected %d.", stream->m_name.c_str(), (int) stream->m_id, (int) i);
+        }
+        if (stream->m_elementType != ElementType::tfloat && stream->m_elementType != ElementType::tdouble)
+        {
+            InvalidArgument("ChunkedBinaryWriter: Stream '%ls' must have float or double elements.", stream->m_name.c_str());
+        }
+        if (stream->m_storageType == StorageType::sparse_csc && stream->m_sampleLayout->GetNumElements() > INT32_MAX)
+        {
+            InvalidArgument("ChunkedBinaryWriter: Sparse stream '%ls' is too large.", stream->m_name.c_str());
+        }
+    }
+
+    m_values.resize(m_streams.size());
+    m_rowIndices.resize(m_streams.size());
+    m_columnStarts.resize(m_streams.size(), std::vector<int32_t>(1, 0));
+
+    m_file = fopenOrDie(m_path, L"wb");
+
+    // The header is written again by Close(), when the counts are known.
+    ChunkedBinaryHeader header = {};
+    Write(&header, sizeof(header));
+
+    for (const auto& stream : m_streams)
+    {
+        uint32_t storageType = stream->m_storageType == StorageType::sparse_csc ? 1 : 0;
+        uint32_t elementType = stream->m_elementType == ElementType::tdouble ? 1 : 0;
+        uint64_t dimension = stream->m_sampleLayout->GetNumElements();
+        std::string name = msra::strfun::utf8(stream->m_name);
+        uint32_t nameLength = (uint32_t) name.size();
+        Write(&storageType, sizeof(storageType));
+        Write(&elementType, sizeof(elementType));
+        Write(&dimension, sizeof(dimension));
+        Write(&nameLength, sizeof(nameLength));
+        Write(name.data(), name.size());
+    }
+}
+
+ChunkedBinaryWriter::~ChunkedBinaryWriter()
+{
+    if (m_file)
+    {
+        try
+        {
+            Close();
+        }
+        catch (...)
+        {
+            // destructors must not throw
+        }
+    }
+}
+
+void ChunkedBinaryWriter::AddValue(size_t streamId, size_t index, double value)
+{
+    const auto& stream = m_streams[streamId];
+    size_t dimension = stream->m_sampleLayout->GetNumElements();
+    if (index >= dimension)
+    {
+        RuntimeError("ChunkedBinaryWriter: Index %d of sample %d is out of range for stream '%ls' of dimension %d.",
+                     (int) index, (int) m_numSamples, stream->m_name.c_str(), (int) dimension);
+    }
+
+    if (stream->m_storageType == StorageType::sparse_csc)
+    {
+        m_values[streamId].push_back(value);
+        m_rowIndices[streamId].push_back((int32_t) index);
+    }
+    else
+    {
+        auto& values = m_values[streamId];
+        values.resize((m_numChunkSamples + 1) * dimension, 0.0);
+        values[m_numChunkSamples * dimension + index] = value;
+    }
+}
+
+void ChunkedBinaryWriter::EndSample()
+{
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        if (m_streams[i]->m_storageType == StorageType::sparse_csc)
+        {
+            // sort the non-zero values of the sample by row index
+            auto& values = m_values[i];
+            auto& rowIndices = m_rowIndices[i];
+            size_t begin = m_columnStarts[i].back();
+            std::vector<std::pair<int32_t, double>> sample;
+            for (size_t k = begin; k < values.size(); k++)
+            {
+                sample.push_back(std::make_pair(rowIndices[k], values[k]));
+            }
+            std::sort(sample.begin(), sample.end());
+            for (size_t k = 0; k < sample.size(); k++)
+            {
+                rowIndices[begin + k] = sample[k].first;
+                values[begin + k] = sample[k].second;
+            }
+            if (values.size() > INT32_MAX)
+            {
+                RuntimeError("ChunkedBinaryWriter: Too many non-zero values in a chunk of '%ls'; use smaller chunks.", m_streams[i]->m_name.c_str());
+            }
+            m_columnStarts[i].push_back((int32_t) values.size());
+        }
+        else
+        {
+            // samples without any values are all zero
+            m_values[i].resize((m_numChunkSamples + 1) * m_streams[i]->m_sampleLayout->GetNumElements(), 0.0);
+        }
+    }
+
+    m_numSamples++;
+    if (++m_numChunkSamples == m_samplesPerChunk)
+    {
+        WriteChunk();
+    }
+}
+
+void ChunkedBinaryWriter::WriteChunk()
+{
+    m_chunkIndex.push_back(m_numSamples - m_numChunkSamples);
+    m_chunkIndex.push_back(m_numChunkSamples);
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        Align();
+        m_chunkIndex.push_back(m_offset);
+
+        const auto& values = m_values[i];
+        if (m_streams[i]->m_elementType == ElementType::tdouble)
+        {
+            Write(values.data(), values.size() * sizeof(double));
+        }
+        else
+        {
+            std::vector<float> converted(values.begin(), values.end());
+            Write(converted.data(), converted.size() * sizeof(float));
+        }
+
+        if (m_streams[i]->m_storageType == StorageType::sparse_csc)
+        {
+            m_chunkIndex.push_back(values.size());
+            Align();
+            Write(m_rowIndices[i].data(), m_rowIndices[i].size() * sizeof(int32_t));
+            Align();
+            Write(m_columnStarts[i].data(), m_columnStarts[i].size() * sizeof(int32_t));
+        }
+        else
+        {
+            m_chunkIndex.push_back(0);
+        }
+
+        m_values[i].clear();
+        m_rowIndices[i].clear();
+        m_columnStarts[i].assign(1, 0);
+    }
+    m_numChunkSamples = 0;
+}
+
+void ChunkedBinaryWriter::Close()
+{
+    if (!m_file)
+    {
+        return;
+    }
+
+    if (m_numChunkSamples > 0)
+    {
+        WriteChunk();
+    }
+
+    ChunkedBinaryHeader header = {};
+    std::copy(ChunkedBinaryMagic, ChunkedBinaryMagic + sizeof(header.m_magic), header.m_magic);
+    header.m_version = ChunkedBinaryVersion;
+    header.m_numStreams = (uint32_t) m_streams.size();
+    header.m_numSamples = m_numSamples;
+    header.m_numChunks = m_chunkIndex.size() / GetChunkIndexEntrySize(m_streams.size());
+    header.m_streamTableOffset = sizeof(header);
+
+    Align();
+    header.m_chunkIndexOffset = m_offset;
+    Write(m_chunkIndex.data(), m_chunkIndex.size() * sizeof(uint64_t));
+
+    fseekOrDie(m_file, 0, SEEK_SET);
+    fwriteOrDie(&header, sizeof(header), 1, m_file);
+    fflushOrDie(m_file);
+    fcloseOrDie(m_file);
+    m_file = nullptr;
+}
+
+void ChunkedBinaryWriter::Write(const void* data, size_t size)
+{
+    if (size > 0)
+    {
+        fwriteOrDie(data, 1, size, m_file);
+        m_offset += size;
+    }
+}
+
+void ChunkedBinaryWriter::Align()
+{
+    static const char zeros[ChunkedBinaryAlignment] = {};
+    Write(zeros, AlignUp(m_offset) - m_offset);
+}
+
+// ---------------------------------------------------------------------------
+// ChunkedBinaryFile
+// ---------------------------------------------------------------------------
+
+ChunkedBinaryFile::ChunkedBinaryFile(const std::wstring& path)
+    : m_path(path), m_data(nullptr), m_size(0), m_fileHandle(nullptr), m_mappingHandle(nullptr), m_header(nullptr), m_dataOffset(0)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        RuntimeError("ChunkedBinaryFile: Cannot open '%ls'.", path.c_str());
+    }
+    m_fileHandle = file;
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    m_size = (size_t) size.QuadPart;
+    if (m_size > 0)
+    {
+        m_mappingHandle = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (m_mappingHandle != NULL)
+        {
+            m_data = (const char*) MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        }
+    }
+#else
+    int file = open(msra::strfun::utf8(path).c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        RuntimeError("ChunkedBinaryFile: Cannot open '%ls'.", path.c_str());
+    }
+    struct stat status;
+    if (fstat(file, &status) == 0)
+    {
+        m_size = (size_t) status.st_size;
+    }
+    if (m_size > 0)
+    {
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, file, 0);
+        m_data = data != MAP_FAILED ? (const char*) data : nullptr;
+    }
+    close(file); // the mapping keeps the file open
+#endif
+
+    if (!m_data)
+    {
+        Unmap();
+        RuntimeError("ChunkedBinaryFile: Cannot map '%ls'.", path.c_str());
+    }
+
+    try
+    {
+        ReadHeader();
+    }
+    catch (...)
+    {
+        Unmap();
+        throw;
+    }
+}
+
+void ChunkedBinaryFile::ReadHeader()
+{
+    const std::wstring& path = m_path;
+    m_header = reinterpret_cast<const ChunkedBinaryHeader*>(m_data);
+    if (m_size < sizeof(ChunkedBinaryHeader) || !std::equal(ChunkedBinaryMagic, ChunkedBinaryMagic + sizeof(ChunkedBinaryMagic), m_header->m_magic))
+    {
+        RuntimeError("ChunkedBinaryFile: '%ls' is not a chunked binary dataset (or was not completely written).", path.c_str());
+    }
+    if (m_header->m_version != ChunkedBinaryVersion)
+    {
+        RuntimeError("ChunkedBinaryFile: '%ls' has unsupported version %d.", path.c_str(), (int) m_header->m_version);
+    }
+
+    // the stream table
+    if (m_header->m_streamTableOffset < sizeof(ChunkedBinaryHeader) || m_header->m_streamTableOffset > m_size)
+    {
+        RuntimeError("ChunkedBinaryFile: '%ls' is truncated.", path.c_str());
+    }
+    uint64_t offset = m_header->m_streamTableOffset;
+    for (uint32_t i = 0; i < m_header->m_numStreams; i++)
+    {
+        uint32_t storageType, elementType, nameLength;
+        uint64_t dimension;
+        if (offset + sizeof(storageType) + sizeof(elementType) + sizeof(dimension) + sizeof(nameLength) > m_size)
+        {
+            RuntimeError("ChunkedBinaryFile: '%ls' is truncated.", path.c_str());
+        }
+        memcpy(&storageType, m_data + offset, sizeof(storageType));
+        offset += sizeof(storageType);
+        memcpy(&elementType, m_data + offset, sizeof(elementType));
+        offset += sizeof(elementType);
+        memcpy(&dimension, m_data + offset, sizeof(dimension));
+        offset += sizeof(dimension);
+        memcpy(&nameLength, m_data + offset, sizeof(nameLength));
+        offset += sizeof(nameLength);
+        if (nameLength > m_size - offset)
+        {
+            RuntimeError("ChunkedBinaryFile: '%ls' is truncated.", path.c_str());
+        }
+        if (storageType > 1 || elementType > 1 || dimension == 0 || dimension > m_size || (storageType == 1 && dimension > INT32_MAX))
+        {
+            RuntimeError("ChunkedBinaryFile: '%ls' has an invalid description of stream %d.", path.c_str(), (int) i);
+        }
+
+        auto stream = std::make_shared<StreamDescription>();
+        stream->m_id = i;
+        stream->m_name = msra::strfun::utf16(std::string(m_data + offset, nameLength));
+        stream->m_storageType = storageType == 1 ? StorageType::sparse_csc : StorageType::dense;
+        stream->m_elementType = elementType == 1 ? ElementType::tdouble : ElementType::tfloat;
+        stream->m_sampleLayout = std::make_shared<TensorShape>((size_t) dimension);
+        m_streams.push_back(stream);
+        offset += nameLength;
+    }
+
+    // the chunk index; the blocks are checked when they are used (GetBlock())
+    size_t entrySize = GetChunkIndexEntrySize(m_header->m_numStreams) * sizeof(uint64_t);
+    if (m_header->m_chunkIndexOffset < offset || m_header->m_chunkIndexOffset > m_size ||
+        m_header->m_numChunks > (m_size - m_header->m_chunkIndexOffset) / entrySize)
+    {
+        RuntimeError("ChunkedBinaryFile: '%ls' is truncated.", path.c_str());
+    }
+    if (m_header->m_chunkIndexOffset % sizeof(uint64_t) != 0)
+    {
+        RuntimeError("ChunkedBinaryFile: '%ls' has an invalid chunk index.", path.c_str());
+    }
+    m_dataOffset = offset;
+    uint64_t numSamples = 0;
+    for (size_t chunkId = 0; chunkId < m_header->m_numChunks; chunkId++)
+    {
+        const uint64_t* entry = GetChunkIndexEntry(chunkId);
+        if (entry[0] != numSamples || entry[1] > m_header->m_numSamples - numSamples)
+        {
+            RuntimeError("ChunkedBinaryFile: '%ls' has an invalid chunk index.", path.c_str());
+        }
+        numSamples += entry[1];
+    }
+    if (numSamples != m_header->m_numSamples)
+    {
+        RuntimeError("ChunkedBinaryFile: '%ls' has an invalid chunk index.", path.c_str());
+    }
+}
+
+ChunkedBinaryFile::~ChunkedBinaryFile()
+{
+    Unmap();
+}
+
+void ChunkedBinaryFile::Unmap()
+{
+#ifdef _WIN32
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mappingHandle)
+        CloseHandle(m_mappingHandle);
+    if (m_fileHandle)
+        CloseHandle(m_fileHandle);
+#else
+    if (m_data)
+        munmap(const_cast<char*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_mappingHandle = m_fileHandle = nullptr;
+}
+
+const uint64_t* ChunkedBinaryFile::GetChunkIndexEntry(size_t chunkId) const
+{
+    assert(chunkId < m_header->m_numChunks);
+    return reinterpret_cast<const uint64_t*>(m_data + m_header->m_chunkIndexOffset) + chunkId * GetChunkIndexEntrySize(m_streams.size());
+}
+
+size_t ChunkedBinaryFile::GetFirstSample(size_t chunkId) const
+{
+    return (size_t) GetChunkIndexEntry(chunkId)[0];
+}
+
+size_t ChunkedBinaryFile::GetNumSamples(size_t chunkId) const
+{
+    return (size_t) GetChunkIndexEntry(chunkId)[1];
+}
+
+ChunkedBinaryBlock ChunkedBinaryFile::GetBlock(size_t chunkId, size_t streamId) const
+{
+    assert(streamId < m_streams.size());
+    const uint64_t* entry = GetChunkIndexEntry(chunkId) + 2 + 2 * streamId;
+    ChunkedBinaryBlock block{ entry[0], entry[1] };
+
+    // the block must lie between the stream table and the chunk index (see ChunkedBinaryFile.h for the layout)
+    const auto& stream = m_streams[streamId];
+    uint64_t elementSize = stream->m_elementType == ElementType::tdouble ? sizeof(double) : sizeof(float);
+    uint64_t numSamples = GetNumSamples(chunkId);
+    uint64_t available = block.m_offset >= m_dataOffset && block.m_offset <= m_header->m_chunkIndexOffset ? m_header->m_chunkIndexOffset - block.m_offset : 0;
+    bool isValid = block.m_offset >= m_dataOffset && block.m_offset % ChunkedBinaryAlignment == 0;
+    if (stream->m_storageType == StorageType::sparse_csc)
+    {
+        isValid = isValid && block.m_numNonZeros <= available / elementSize && numSamples < available / sizeof(int32_t) &&
+                  AlignUp(block.m_numNonZeros * elementSize) + AlignUp(block.m_numNonZeros * sizeof(int32_t)) + (numSamples + 1) * sizeof(int32_t) <= available;
+    }
+    else
+    {
+        isValid = isValid && block.m_numNonZeros == 0 &&
+                  (numSamples == 0 || stream->m_sampleLayout->GetNumElements() <= available / elementSize / numSamples);
+    }
+    if (!isValid)
+    {
+        RuntimeError("ChunkedBinaryFile: '%ls' has an invalid block for stream '%ls' in chunk %d.", m_path.c_str(), stream->m_name.c_str(), (int) chunkId);
+    }
+    return block;
+}
+
+void ChunkedBinaryFile::Prefetch(size_t chunkId) const
+{
+    if (m_streams.empty())
+    {
+        return;
+    }
+
+    // a chunk extends to the next one, or to the chunk index
+    size_t begin = (size_t) GetBlock(chunkId, 0).m_offset;
+    size_t end = chunkId + 1 < GetNumChunks() ? (size_t) GetBlock(chunkId + 1, 0).m_offset : (size_t) m_header->m_chunkIndexOffset;
+#ifdef _WIN32
+    // touch each page
+    volatile char sum = 0;
+    for (size_t offset = begin; offset < end; offset += 4096)
+    {
+        sum += m_data[offset];
+    }
+#else
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t pageBegin = begin / pageSize * pageSize;
+    madvise(const_cast<char*>(m_data) + pageBegin, end - pageBegin, MADV_WILLNEED);
+#endif
+}
+
+}}}
@@ -0,0 +1,154 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "Reader.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Chunked binary dataset format: a column-oriented container for datasets of single-sample sequences (e.g. tabular
+// data), read through a memory mapping, so that reading needs neither parsing nor copying.
+//
+// Layout (native byte order, little endian on all supported platforms):
+//   header           ChunkedBinaryHeader
+//   stream table     for each stream: storage type (uint32), element type (uint32), dimension (uint64),
+//                    name length (uint32), name (UTF-8, not terminated)
+//   chunks           for each chunk and stream a block; every block starts at a multiple of ChunkedBinaryAlignment:
+//                      dense:  numSamples columns of dimension values (float or double)
+//                      sparse: the nnz values, then their nnz row indices (int32), then numSamples + 1 column starts
+//                              (int32), each part aligned (CSC format)
+//   chunk index      for each chunk: first sample and number of samples (uint64), then for each stream the absolute
+//                    offset of its block and its number of non-zero values (uint64; 0 for dense streams)
+
+const size_t ChunkedBinaryAlignment = 64;
+
+struct ChunkedBinaryHeader
+{
+    char m_magic[8]; // "CNTKCBF1"
+    uint32_t m_version;
+    uint32_t m_numStreams;
+    uint64_t m_numSamples;
+    uint64_t m_numChunks;
+    uint64_t m_streamTableOffset;
+    uint64_t m_chunkIndexOffset;
+    uint64_t m_reserved[2];
+};
+
+// Location of the data of one stream of a chunk.
+struct ChunkedBinaryBlock
+{
+    uint64_t m_offset;
+    uint64_t m_numNonZeros;
+};
+
+// Writes a chunked binary dataset, sample by sample.
+class ChunkedBinaryWriter
+{
+public:
+    // Stream ids must be 0, 1, ... in the order of 'streams'; only m_name, m_storageType, m_elementType and the number
+    // of elements of m_sampleLayout are used.
+    ChunkedBinaryWriter(const std::wstring& path, const std::vector<StreamDescriptionPtr>& streams, size_t samplesPerChunk);
+    ~ChunkedBinaryWriter();
+
+    // Adds a value of the current sample for a stream. Dense streams need all values, sparse streams only the
+    // non-zero ones, in any order of indices.
+    void AddValue(size_t streamId, size_t index, double value);
+
+    // Completes the current sample.
+    void EndSample();
+
+    // Writes the rest of the data; called by the destructor if needed.
+    void Close();
+
+    size_t GetNumSamples() const
+    {
+        return m_numSamples;
+    }
+
+private:
+    void WriteChunk();
+    void Write(const void* data, size_t size);
+    void Align();
+
+    std::wstring m_path;
+    FILE* m_file;
+    uint64_t m_offset; // current write position
+    std::vector<StreamDescriptionPtr> m_streams;
+    size_t m_samplesPerChunk;
+    size_t m_numSamples;
+
+    // current chunk, per stream: dense values, or sparse values, row indices and column starts
+    size_t m_numChunkSamples;
+    std::vector<std::vector<double>> m_values;
+    std::vector<std::vector<int32_t>> m_rowIndices;
+    std::vector<std::vector<int32_t>> m_columnStarts;
+
+    std::vector<uint64_t> m_chunkIndex;
+};
+
+// A read-only memory mapping of a chunked binary dataset.
+class ChunkedBinaryFile
+{
+public:
+    explicit ChunkedBinaryFile(const std::wstring& path);
+    ~ChunkedBinaryFile();
+
+    // Stream descriptions, with ids in file order.
+    const std::vector<StreamDescriptionPtr>& GetStreams() const
+    {
+        return m_streams;
+    }
+
+    size_t GetNumSamples() const
+    {
+        return m_header->m_numSamples;
+    }
+
+    size_t GetNumChunks() const
+    {
+        return m_header->m_numChunks;
+    }
+
+    size_t GetFirstSample(size_t chunkId) const;
+    size_t GetNumSamples(size_t chunkId) const;
+
+    // Location of a block; fails if it does not fit into the file.
+    ChunkedBinaryBlock GetBlock(size_t chunkId, size_t streamId) const;
+
+    // Data at an offset in the file.
+    const char* GetData(uint64_t offset) const
+    {
+        return m_data + offset;
+    }
+
+    // Hints the operating system to read a chunk ahead of its use.
+    void Prefetch(size_t chunkId) const;
+
+private:
+    ChunkedBinaryFile(const ChunkedBinaryFile&) = delete;
+    ChunkedBinaryFile& operator=(const ChunkedBinaryFile&) = delete;
+
+    void ReadHeader();
+    void Unmap();
+    const uint64_t* GetChunkIndexEntry(size_t chunkId) const;
+
+    std::wstring m_path;
+    const char* m_data;
+    size_t m_size;
+    void* m_fileHandle;    // Windows only
+    void* m_mappingHandle; // Windows only
+    const ChunkedBinaryHeader* m_header;
+    std::vector<StreamDescriptionPtr> m_streams;
+    uint64_t m_dataOffset; // end of the stream table
+};
+typedef std::shared_ptr<ChunkedBinaryFile> ChunkedBinaryFilePtr;
+
+}}}
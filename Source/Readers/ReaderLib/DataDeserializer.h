@@ -72,6 +72,16 @@ struct DenseSequenceData : SequenceDataBase
 };
 typedef std::shared_ptr<DenseSequenceData> DenseSequenceDataPtr;
 
+// Dense sequence whose data is not materialized (m_data is null), but written by the packer directly into
+// its place in the minibatch buffer. This saves a copy per sequence for transformations whose last step produces
+// a new buffer anyway (see ImageAugmentationTransformer). Currently supported by the SampleModePacker only.
+struct DeferredDenseSequenceData : DenseSequenceData
+{
+    // Writes all samples of the sequence, in the layout of its stream, to 'destination'.
+    // Can be called from several threads for different sequences.
+    virtual void WriteTo(char* destination) const = 0;
+};
+
 // Sparse sequence. Should be returned by the deserializer for streams with storage type StorageType::csc_sparse.
 // All non zero values are store in the 'data' member as a contiguous array.
 // The corresponding row indices are stored in 'indices' per sample.
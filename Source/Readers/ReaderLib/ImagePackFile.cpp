@@ -0,0 +1,213 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "Basics.h"
+#include "ImagePackFile.h"
+#include "fileutil.h"
+#include <algorithm>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+static const char ImagePackMagic[8] = { 'C', 'N', 'T', 'K', 'I', 'M', 'P', '1' };
+static const uint32_t ImagePackVersion = 1;
+
+// ---------------------------------------------------------------------------
+// ImagePackWriter
+// ---------------------------------------------------------------------------
+
+ImagePackWriter::ImagePackWriter(const std::wstring& path, size_t imagesPerChunk)
+    : m_path(path), m_file(nullptr), m_offset(0), m_imagesPerChunk(imagesPerChunk)
+{
+    if (m_imagesPerChunk == 0)
+    {
+        InvalidArgument("ImagePackWriter: The number of images per chunk must be positive.");
+    }
+
+    m_file = fopenOrDie(m_path, L"wb");
+
+    // The header is written again by Close(), when the counts are known.
+    ImagePackHeader header = {};
+    fwriteOrDie(&header, sizeof(header), 1, m_file);
+    m_offset = sizeof(header);
+}
+
+ImagePackWriter::~ImagePackWriter()
+{
+    if (m_file)
+    {
+        try
+        {
+            Close();
+        }
+        catch (...)
+        {
+            // destructors must not throw
+        }
+    }
+}
+
+void ImagePackWriter::AddImage(const void* data, size_t size, size_t classId)
+{
+    if (size == 0 || size > UINT32_MAX)
+    {
+        RuntimeError("ImagePackWriter: Image %d has an invalid size of %llu bytes.", (int) m_index.size(), (unsigned long long) size);
+    }
+    if (classId > UINT32_MAX)
+    {
+        RuntimeError("ImagePackWriter: Image %d has an invalid class id %llu.", (int) m_index.size(), (unsigned long long) classId);
+    }
+
+    fwriteOrDie(data, 1, size, m_file);
+    m_index.push_back(ImagePackEntry{ m_offset, (uint32_t) size, (uint32_t) classId });
+    m_offset += size;
+}
+
+void ImagePackWriter::Close()
+{
+    if (!m_file)
+    {
+        return;
+    }
+
+    std::vector<uint64_t> chunkIndex;
+    for (size_t i = 0; i < m_index.size(); i += m_imagesPerChunk)
+    {
+        chunkIndex.push_back(i);
+    }
+    chunkIndex.push_back(m_index.size());
+
+    ImagePackHeader header = {};
+    std::copy(ImagePackMagic, ImagePackMagic + sizeof(header.m_magic), header.m_magic);
+    header.m_version = ImagePackVersion;
+    header.m_numImages = m_index.size();
+    header.m_numChunks = chunkIndex.size() - 1;
+    header.m_imageIndexOffset = m_offset;
+    if (!m_index.empty())
+    {
+        fwriteOrDie(m_index.data(), sizeof(ImagePackEntry), m_index.size(), m_file);
+    }
+    header.m_chunkIndexOffset = m_offset + m_index.size() * sizeof(ImagePackEntry);
+    fwriteOrDie(chunkIndex.data(), sizeof(uint64_t), chunkIndex.size(), m_file);
+
+    fseekOrDie(m_file, 0, SEEK_SET);
+    fwriteOrDie(&header, sizeof(header), 1, m_file);
+    fflushOrDie(m_file);
+    fcloseOrDie(m_file);
+    m_file = nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// ImagePackFile
+// ---------------------------------------------------------------------------
+
+ImagePackFile::ImagePackFile(const std::wstring& path)
+    : m_path(path), m_file(nullptr)
+{
+    m_file = fopenOrDie(m_path, L"rb");
+    try
+    {
+        ImagePackHeader header;
+        if (fread(&header, sizeof(header), 1, m_file) != 1 || !std::equal(ImagePackMagic, ImagePackMagic + sizeof(ImagePackMagic), header.m_magic))
+        {
+            RuntimeError("ImagePackFile: '%ls' is not an image pack (or was not completely written).", path.c_str());
+        }
+        if (header.m_version != ImagePackVersion)
+        {
+            RuntimeError("ImagePackFile: '%ls' has unsupported version %d.", path.c_str(), (int) header.m_version);
+        }
+        // (the counts are bounded by the file size first, so that a corrupted header cannot overflow the offsets below)
+        uint64_t fileSize = (uint64_t) filesize64(path.c_str());
+        if (header.m_numImages > fileSize / sizeof(ImagePackEntry) || header.m_numChunks >= fileSize / sizeof(uint64_t) ||
+            header.m_imageIndexOffset < sizeof(header) || header.m_imageIndexOffset > fileSize ||
+            header.m_chunkIndexOffset != header.m_imageIndexOffset + header.m_numImages * sizeof(ImagePackEntry) ||
+            header.m_chunkIndexOffset + (header.m_numChunks + 1) * sizeof(uint64_t) > fileSize)
+        {
+            RuntimeError("ImagePackFile: '%ls' is truncated or has an invalid header.", path.c_str());
+        }
+
+        m_index.resize((size_t) header.m_numImages);
+        fsetpos(m_file, header.m_imageIndexOffset);
+        freadOrDie(m_index, m_index.size(), m_file);
+
+        // ReadChunk() relies on the images lying back to back in front of the image index
+        uint64_t offset = sizeof(header);
+        for (const auto& entry : m_index)
+        {
+            if (entry.m_offset != offset || entry.m_size == 0)
+            {
+                RuntimeError("ImagePackFile: '%ls' has an invalid image index.", path.c_str());
+            }
+            offset += entry.m_size;
+        }
+        if (offset != header.m_imageIndexOffset)
+        {
+            RuntimeError("ImagePackFile: '%ls' has an invalid image index.", path.c_str());
+        }
+
+        std::vector<uint64_t> chunkIndex((size_t) header.m_numChunks + 1);
+        fsetpos(m_file, header.m_chunkIndexOffset);
+        freadOrDie(chunkIndex, chunkIndex.size(), m_file);
+        m_chunkFirstImage.assign(chunkIndex.begin(), chunkIndex.end());
+        if (m_chunkFirstImage.front() != 0 || m_chunkFirstImage.back() != m_index.size() || !std::is_sorted(m_chunkFirstImage.begin(), m_chunkFirstImage.end()))
+        {
+            RuntimeError("ImagePackFile: '%ls' has an invalid chunk index.", path.c_str());
+        }
+    }
+    catch (...)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+        throw;
+    }
+}
+
+ImagePackFile::~ImagePackFile()
+{
+    if (m_file)
+    {
+        fclose(m_file);
+    }
+}
+
+bool ImagePackFile::IsImagePack(const std::wstring& path)
+{
+    FILE* file = _wfopen(path.c_str(), L"rb");
+    if (!file)
+    {
+        return false;
+    }
+    char magic[sizeof(ImagePackMagic)];
+    bool isImagePack = fread(magic, sizeof(magic), 1, file) == 1 && std::equal(ImagePackMagic, ImagePackMagic + sizeof(ImagePackMagic), magic);
+    fclose(file);
+    return isImagePack;
+}
+
+uint64_t ImagePackFile::GetChunkOffset(size_t chunkId) const
+{
+    return GetNumImages(chunkId) > 0 ? m_index[GetFirstImage(chunkId)].m_offset : 0;
+}
+
+void ImagePackFile::ReadChunk(size_t chunkId, std::vector<char>& buffer) const
+{
+    size_t numImages = GetNumImages(chunkId);
+    if (numImages == 0)
+    {
+        buffer.clear();
+        return;
+    }
+
+    // the images of a chunk are contiguous
+    const ImagePackEntry& last = m_index[GetFirstImage(chunkId) + numImages - 1];
+    uint64_t begin = GetChunkOffset(chunkId);
+    buffer.resize((size_t) (last.m_offset + last.m_size - begin));
+
+    std::lock_guard<std::mutex> lock(m_fileMutex);
+    fsetpos(m_file, begin);
+    freadOrDie(buffer.data(), 1, buffer.size(), m_file);
+}
+
+} } }
@@ -0,0 +1,125 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Image pack format: many encoded images (JPEG, PNG, ... as they were stored on disk) with their class ids in one
+// file, grouped into chunks, so that an epoch reads a few large blocks instead of opening one file per image.
+// The images are not decoded here; this class does not depend on an image library.
+//
+// Layout (native byte order, little endian on all supported platforms):
+//   header           ImagePackHeader
+//   images           the encoded images, back to back; the images of a chunk are contiguous
+//   image index      for each image an ImagePackEntry
+//   chunk index      for each chunk its first image (uint64), then the number of images (uint64) as an end marker
+
+struct ImagePackHeader
+{
+    char m_magic[8]; // "CNTKIMP1"
+    uint32_t m_version;
+    uint32_t m_reserved0;
+    uint64_t m_numImages;
+    uint64_t m_numChunks;
+    uint64_t m_imageIndexOffset;
+    uint64_t m_chunkIndexOffset;
+    uint64_t m_reserved[2];
+};
+
+struct ImagePackEntry
+{
+    uint64_t m_offset; // absolute offset of the encoded image
+    uint32_t m_size;   // size of the encoded image in bytes
+    uint32_t m_classId;
+};
+
+// Writes an image pack, image by image.
+class ImagePackWriter
+{
+public:
+    ImagePackWriter(const std::wstring& path, size_t imagesPerChunk);
+    ~ImagePackWriter();
+
+    // Appends an encoded image.
+    void AddImage(const void* data, size_t size, size_t classId);
+
+    // Writes the indices; called by the destructor if needed.
+    void Close();
+
+    size_t GetNumImages() const
+    {
+        return m_index.size();
+    }
+
+private:
+    std::wstring m_path;
+    FILE* m_file;
+    uint64_t m_offset; // current write position
+    size_t m_imagesPerChunk;
+    std::vector<ImagePackEntry> m_index;
+};
+
+// Read access to an image pack. The indices are kept in memory; the images are read one chunk at a time.
+class ImagePackFile
+{
+public:
+    explicit ImagePackFile(const std::wstring& path);
+    ~ImagePackFile();
+
+    // Whether the file at 'path' starts like an image pack (so that a reader can accept a pack in place of a map file).
+    static bool IsImagePack(const std::wstring& path);
+
+    size_t GetNumImages() const
+    {
+        return m_index.size();
+    }
+
+    size_t GetNumChunks() const
+    {
+        return m_chunkFirstImage.size() - 1;
+    }
+
+    const ImagePackEntry& GetImage(size_t imageId) const
+    {
+        return m_index[imageId];
+    }
+
+    size_t GetFirstImage(size_t chunkId) const
+    {
+        return m_chunkFirstImage[chunkId];
+    }
+
+    size_t GetNumImages(size_t chunkId) const
+    {
+        return m_chunkFirstImage[chunkId + 1] - m_chunkFirstImage[chunkId];
+    }
+
+    // Reads the encoded images of a chunk into 'buffer'. The image 'imageId' of the chunk starts at
+    // buffer[GetImage(imageId).m_offset - GetChunkOffset(chunkId)]. Can be called from several threads.
+    void ReadChunk(size_t chunkId, std::vector<char>& buffer) const;
+
+    uint64_t GetChunkOffset(size_t chunkId) const;
+
+private:
+    ImagePackFile(const ImagePackFile&) = delete;
+    ImagePackFile& operator=(const ImagePackFile&) = delete;
+
+    std::wstring m_path;
+    FILE* m_file;
+    mutable std::mutex m_fileMutex; // guards the file position
+    std::vector<ImagePackEntry> m_index;
+    std::vector<size_t> m_chunkFirstImage; // with a sentinel at the end
+};
+typedef std::shared_ptr<ImagePackFile> ImagePackFilePtr;
+
+} } }
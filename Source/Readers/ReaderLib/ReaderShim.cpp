@@ -16,13 +16,26 @@
 #include "DataReader.h"
 //#include "commandArgUtil.h"
 #include "ReaderShim.h"
+#include "HeapMemoryProvider.h"
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
 template <class ElemType>
-ReaderShim<ElemType>::ReaderShim(ReaderFactory factory)
-    : m_layout(make_shared<MBLayout>()), m_factory(factory)
+ReaderShim<ElemType>::ReaderShim(ReaderFactory factory, MemoryProviderPtr memoryProvider)
+    : m_layout(make_shared<MBLayout>()), m_factory(factory), m_memoryProvider(memoryProvider), m_endOfEpoch(false), m_epoch(0), m_verbosity(0),
+      m_prefetchDepth(0), m_stopPrefetch(false), m_prefetchDone(false)
 {
+    if (!m_memoryProvider)
+        m_memoryProvider = make_shared<HeapMemoryProvider>();
+}
+
+template <class ElemType>
+ReaderShim<ElemType>::~ReaderShim()
+{
+    StopPrefetch();
+    for (auto& buffer : m_freeBuffers)
+        for (auto& stream : buffer->m_streams)
+            m_memoryProvider->Free(stream.m_data);
 }
 
 template <class ElemType>
@@ -31,10 +44,11 @@ void ReaderShim<ElemType>::Init(const ConfigParameters& config)
     intargvector numberOfuttsPerMinibatchForAllEpochs =
         config(L"nbruttsineachrecurrentiter", ConfigParameters::Array(intargvector(vector<int> { 1 })));
 
+    // if prefetch - reading up to prefetchDepth minibatches ahead on a separate thread,
+    // otherwise - synchronous reading during the GetMinibatch() call
     bool prefetch = config(L"prefetch", true);
-    // if prefetch - launching asynchronously,
-    // otherwise deferring - synchronous execution during .get() call
-    m_launchType = prefetch ? launch::async : launch::deferred;
+    m_prefetchDepth = prefetch ? config(L"prefetchDepth", (size_t) 2) : 0;
+    m_verbosity = config(L"verbosity", 0);
 
     auto numSeqsPerMBForAllEpochs = numberOfuttsPerMinibatchForAllEpochs;
     m_layout->Init(numSeqsPerMBForAllEpochs[0], 0);
@@ -68,15 +82,182 @@ void ReaderShim<ElemType>::StartDistributedMinibatchLoop(
     config.m_totalEpochSizeInSamples = requestedEpochSamples;
     config.m_epochIndex = epoch;
 
+    // The reader is not thread-safe, so the previous epoch's prefetching must end before the new epoch starts.
+    StopPrefetch();
+
     m_reader->StartEpoch(config);
     m_endOfEpoch = false;
+    m_epoch = epoch;
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        m_statistics = PrefetchStatistics();
+    }
 
-    m_prefetchTask = std::async(m_launchType, [this]()
+    if (m_prefetchDepth > 0)
     {
-        return m_reader->ReadMinibatch();
+        StartPrefetch();
+    }
+    m_lastMinibatchTime = Clock::now();
+}
+
+template <class ElemType>
+void ReaderShim<ElemType>::StartPrefetch()
+{
+    assert(!m_prefetchThread.joinable() && m_readyBuffers.empty());
+
+    // buffers are kept across epochs
+    while (m_freeBuffers.size() < m_prefetchDepth)
+    {
+        m_freeBuffers.push_back(make_shared<PrefetchBuffer>());
+    }
+
+    m_stopPrefetch = false;
+    m_prefetchDone = false;
+    m_prefetchError = nullptr;
+    m_prefetchThread = std::thread([this]()
+    {
+        PrefetchLoop();
     });
 }
 
+template <class ElemType>
+void ReaderShim<ElemType>::StopPrefetch()
+{
+    if (!m_prefetchThread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        m_stopPrefetch = true;
+    }
+    m_prefetchCondition.notify_all();
+    m_prefetchThread.join();
+
+    // minibatches that were read but not consumed are dropped
+    for (auto& buffer : m_readyBuffers)
+    {
+        m_freeBuffers.push_back(buffer);
+    }
+    m_readyBuffers.clear();
+}
+
+template <class ElemType>
+void ReaderShim<ElemType>::PrefetchLoop()
+{
+    try
+    {
+        bool endOfEpoch = false;
+        while (!endOfEpoch)
+        {
+            PrefetchBufferPtr buffer;
+            {
+                std::unique_lock<std::mutex> lock(m_prefetchMutex);
+                auto waitStart = Clock::now();
+                m_prefetchCondition.wait(lock, [this]()
+                {
+                    return m_stopPrefetch || !m_freeBuffers.empty();
+                });
+                m_statistics.m_backPressureSeconds += std::chrono::duration<double>(Clock::now() - waitStart).count();
+                if (m_stopPrefetch)
+                {
+                    return;
+                }
+                buffer = m_freeBuffers.back();
+                m_freeBuffers.pop_back();
+            }
+
+            auto readStart = Clock::now();
+            Minibatch minibatch = m_reader->ReadMinibatch();
+            CopyToBuffer(minibatch, *buffer);
+            endOfEpoch = minibatch.m_endOfEpoch;
+
+            {
+                std::lock_guard<std::mutex> lock(m_prefetchMutex);
+                m_statistics.m_readSeconds += std::chrono::duration<double>(Clock::now() - readStart).count();
+                m_readyBuffers.push_back(buffer);
+                m_prefetchDone = endOfEpoch;
+            }
+            m_prefetchCondition.notify_all();
+        }
+    }
+    catch (...)
+    {
+        // passed on to the consumer, after the minibatches read before the error
+        {
+            std::lock_guard<std::mutex> lock(m_prefetchMutex);
+            m_prefetchError = std::current_exception();
+            m_prefetchDone = true;
+        }
+        m_prefetchCondition.notify_all();
+    }
+}
+
+// copy the minibatch out of the reader's buffers
+template <class ElemType>
+void ReaderShim<ElemType>::CopyToBuffer(const Minibatch& minibatch, PrefetchBuffer& buffer)
+{
+    buffer.m_endOfEpoch = minibatch.m_endOfEpoch;
+    buffer.m_hasData = !minibatch.m_data.empty();
+    if (!buffer.m_hasData)
+    {
+        return;
+    }
+
+    buffer.m_streams.resize(minibatch.m_data.size());
+    for (size_t i = 0; i < minibatch.m_data.size(); ++i)
+    {
+        const auto& stream = minibatch.m_data[i];
+        auto& bufferStream = buffer.m_streams[i];
+        if (bufferStream.m_capacity < stream->m_dataSize)
+        {
+            if (bufferStream.m_data)
+            {
+                m_memoryProvider->Free(bufferStream.m_data);
+            }
+            bufferStream.m_data = m_memoryProvider->Alloc(1, stream->m_dataSize);
+            bufferStream.m_capacity = stream->m_dataSize;
+        }
+        memcpy(bufferStream.m_data, stream->m_data, stream->m_dataSize);
+        bufferStream.m_size = stream->m_dataSize;
+    }
+
+    // all streams share the layout
+    buffer.m_layout->CopyFrom(minibatch.m_data.front()->m_layout);
+}
+
+template <class ElemType>
+void ReaderShim<ElemType>::CopyToMatrices(const std::vector<const void*>& streamData, const std::vector<size_t>& streamDataSizes, const MBLayoutPtr& layout, std::map<std::wstring, Matrix<ElemType>*>& matrices)
+{
+    m_layout->CopyFrom(layout);
+    for (const auto& mx : matrices)
+    {
+        assert(m_nameToStreamId.find(mx.first) != m_nameToStreamId.end());
+        size_t streamId = m_nameToStreamId[mx.first];
+
+        size_t columnNumber = m_layout->GetNumCols();
+        size_t rowNumber = m_streams[streamId]->m_sampleLayout->GetNumElements();
+
+        if (m_streams[streamId]->m_storageType == StorageType::sparse_csc)
+        {
+            // values, row indices and column starts, see StreamMinibatch
+            size_t indexSize = sizeof(CPUSPARSE_INDEX_TYPE);
+            size_t nnz = (streamDataSizes[streamId] - (columnNumber + 1) * indexSize) / (sizeof(ElemType) + indexSize);
+            auto values = reinterpret_cast<const ElemType*>(streamData[streamId]);
+            auto rows = reinterpret_cast<const CPUSPARSE_INDEX_TYPE*>(values + nnz);
+            auto columnStarts = rows + nnz;
+            mx.second->SwitchToMatrixType(MatrixType::SPARSE, matrixFormatSparseCSC, false);
+            mx.second->SetMatrixFromCSCFormat(columnStarts, rows, values, nnz, rowNumber, columnNumber);
+        }
+        else
+        {
+            auto data = reinterpret_cast<const ElemType*>(streamData[streamId]);
+            mx.second->SetValue(rowNumber, columnNumber, mx.second->GetDeviceId(), const_cast<ElemType*>(data), matrixFlagNormal);
+        }
+    }
+}
+
 template <class ElemType>
 bool ReaderShim<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType>*>& matrices)
 {
@@ -96,43 +277,111 @@ bool ReaderShim<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType>*
         }
     }
 
-    assert(m_prefetchTask.valid());
+    auto waitStart = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        m_statistics.m_computeSeconds += std::chrono::duration<double>(waitStart - m_lastMinibatchTime).count();
+    }
 
-    Minibatch minibatch = m_prefetchTask.get();
-    if (minibatch.m_endOfEpoch)
+    bool hasData;
+    std::vector<const void*> streamData;
+    std::vector<size_t> streamDataSizes;
+    if (m_prefetchDepth == 0)
     {
-        m_endOfEpoch = true;
-        if (minibatch.m_data.empty())
+        Minibatch minibatch = m_reader->ReadMinibatch();
+        {
+            std::lock_guard<std::mutex> lock(m_prefetchMutex);
+            m_statistics.m_readSeconds += std::chrono::duration<double>(Clock::now() - waitStart).count();
+        }
+        m_endOfEpoch = minibatch.m_endOfEpoch;
+        hasData = !minibatch.m_data.empty();
+        if (hasData)
         {
-            return false;
+            for (const auto& stream : minibatch.m_data)
+            {
+                streamData.push_back(stream->m_data);
+                streamDataSizes.push_back(stream->m_dataSize);
+            }
+            CopyToMatrices(streamData, streamDataSizes, minibatch.m_data.front()->m_layout, matrices);
         }
     }
-
-    if (!minibatch.m_data.empty())
+    else
     {
-        // Copy returned minibatch to the matrices.
-        for (const auto& mx : matrices)
+        PrefetchBufferPtr buffer;
         {
-            assert(m_nameToStreamId.find(mx.first) != m_nameToStreamId.end());
-            size_t streamId = m_nameToStreamId[mx.first];
+            std::unique_lock<std::mutex> lock(m_prefetchMutex);
+            if (m_readyBuffers.empty())
+            {
+                m_statistics.m_numStalls++;
+            }
+            m_prefetchCondition.wait(lock, [this]()
+            {
+                return !m_readyBuffers.empty() || m_prefetchDone;
+            });
+            if (m_readyBuffers.empty())
+            {
+                // the prefetch thread failed
+                assert(m_prefetchError);
+                auto error = m_prefetchError;
+                lock.unlock();
+                StopPrefetch();
+                std::rethrow_exception(error);
+            }
+            buffer = m_readyBuffers.front();
+            m_readyBuffers.pop_front();
+        }
 
-            const auto& stream = minibatch.m_data[streamId];
-            m_layout = stream->m_layout;
+        m_endOfEpoch = buffer->m_endOfEpoch;
+        hasData = buffer->m_hasData;
+        if (hasData)
+        {
+            for (const auto& stream : buffer->m_streams)
+            {
+                streamData.push_back(stream.m_data);
+                streamDataSizes.push_back(stream.m_size);
+            }
+            CopyToMatrices(streamData, streamDataSizes, buffer->m_layout, matrices);
+        }
 
-            size_t columnNumber = m_layout->GetNumCols();
-            size_t rowNumber = m_streams[streamId]->m_sampleLayout->GetNumElements();
+        {
+            std::lock_guard<std::mutex> lock(m_prefetchMutex);
+            m_freeBuffers.push_back(buffer);
+        }
+        m_prefetchCondition.notify_all();
 
-            auto data = reinterpret_cast<const ElemType*>(stream->m_data);
-            mx.second->SetValue(rowNumber, columnNumber, mx.second->GetDeviceId(), const_cast<ElemType*>(data), matrixFlagNormal);
+        if (m_endOfEpoch)
+        {
+            StopPrefetch(); // the thread is done with this epoch
         }
     }
 
-    m_prefetchTask = std::async(m_launchType, [this]()
+    m_lastMinibatchTime = Clock::now();
     {
-        return m_reader->ReadMinibatch();
-    });
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        m_statistics.m_readerWaitSeconds += std::chrono::duration<double>(m_lastMinibatchTime - waitStart).count();
+        if (hasData)
+        {
+            m_statistics.m_numMinibatches++;
+        }
+    }
+    if (m_endOfEpoch && m_verbosity > 0)
+    {
+        PrintPrefetchStatistics();
+    }
+
+    return hasData;
+}
 
-    return !minibatch.m_data.empty();
+template <class ElemType>
+void ReaderShim<ElemType>::PrintPrefetchStatistics()
+{
+    const auto s = GetPrefetchStatistics();
+    double totalSeconds = s.m_readerWaitSeconds + s.m_computeSeconds;
+    fprintf(stderr, "ReaderShim: Epoch %d: %d minibatches, prefetch depth %d: waited %.3fs for the reader (%.1f%% of %.3fs), %d stalls; "
+                    "reading took %.3fs, reader waited %.3fs for free buffers.\n",
+            (int) m_epoch + 1, (int) s.m_numMinibatches, (int) m_prefetchDepth, s.m_readerWaitSeconds,
+            totalSeconds > 0 ? 100 * s.m_readerWaitSeconds / totalSeconds : 0.0, totalSeconds, (int) s.m_numStalls,
+            s.m_readSeconds, s.m_backPressureSeconds);
 }
 
 template <class ElemType>
@@ -10,20 +10,38 @@
 
 #include <map>
 #include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "DataReader.h"
-#include <future>
 #include "Reader.h"
+#include "MemoryProvider.h"
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
 typedef ReaderPtr (*ReaderFactory)(const ConfigParameters& parameters);
 
+// Counters of the prefetch pipeline, to tell whether the reader is on the critical path.
+// Times are wall-clock seconds since the start of the epoch.
+struct PrefetchStatistics
+{
+    size_t m_numMinibatches = 0;
+    size_t m_numStalls = 0;          // number of GetMinibatch() calls that found no minibatch ready
+    double m_readerWaitSeconds = 0;  // time spent in GetMinibatch() waiting for the reader
+    double m_computeSeconds = 0;     // time between GetMinibatch() calls, i.e. spent by the caller
+    double m_readSeconds = 0;        // time the prefetch thread spent in Reader::ReadMinibatch()
+    double m_backPressureSeconds = 0; // time the prefetch thread waited for a free buffer
+};
+
 template <class ElemType>
 class ReaderShim : public IDataReader<ElemType>
 {
 public:
-    explicit ReaderShim(ReaderFactory factory);
-    virtual ~ReaderShim() { }
+    // memoryProvider allocates the prefetch buffers; by default they are taken from the heap
+    explicit ReaderShim(ReaderFactory factory, MemoryProviderPtr memoryProvider = nullptr);
+    virtual ~ReaderShim();
 
     virtual void Init(const ScriptableObjects::IConfigRecord& /*config*/) override
     {
@@ -52,17 +70,67 @@ public:
 
     virtual size_t GetNumParallelSequences() override;
 
+    // counters of the current (or last) epoch; a copy, since the prefetch thread keeps updating them
+    PrefetchStatistics GetPrefetchStatistics() const
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        return m_statistics;
+    }
+
 private:
-    std::future<Minibatch> m_prefetchTask;
+    typedef std::chrono::steady_clock Clock;
+
+    // A minibatch copied out of the reader, since the reader only keeps its data valid until the next ReadMinibatch() call.
+    // Buffers are recycled between minibatches and only grow.
+    struct PrefetchBuffer
+    {
+        struct Stream
+        {
+            void* m_data = nullptr;
+            size_t m_capacity = 0; // in bytes
+            size_t m_size = 0;     // in bytes
+        };
+        std::vector<Stream> m_streams;
+        MBLayoutPtr m_layout = std::make_shared<MBLayout>();
+        bool m_hasData = false;
+        bool m_endOfEpoch = false;
+    };
+    typedef std::shared_ptr<PrefetchBuffer> PrefetchBufferPtr;
+
+    void StartPrefetch();
+    void StopPrefetch();
+    void PrefetchLoop();
+    void CopyToBuffer(const Minibatch& minibatch, PrefetchBuffer& buffer);
+    void CopyToMatrices(const std::vector<const void*>& streamData, const std::vector<size_t>& streamDataSizes, const MBLayoutPtr& layout, std::map<std::wstring, Matrix<ElemType>*>& matrices);
+    void PrintPrefetchStatistics();
+
     ReaderPtr m_reader;
     ReaderFactory m_factory;
+    MemoryProviderPtr m_memoryProvider;
     bool m_endOfEpoch;
+    size_t m_epoch;
+    int m_verbosity;
 
     MBLayoutPtr m_layout;
 
     std::map<std::wstring, size_t> m_nameToStreamId;
     std::vector<StreamDescriptionPtr> m_streams;
-    launch m_launchType;
+
+    // Prefetch pipeline: a thread reads up to m_prefetchDepth minibatches ahead into recycled buffers.
+    // The thread blocks while all buffers are full (back-pressure); GetMinibatch() blocks while none is.
+    // With a depth of 0, minibatches are read synchronously in GetMinibatch().
+    size_t m_prefetchDepth;
+    std::thread m_prefetchThread;
+    mutable std::mutex m_prefetchMutex; // guards the buffer queues, the flags below, and m_statistics
+    std::condition_variable m_prefetchCondition;
+    std::deque<PrefetchBufferPtr> m_readyBuffers; // filled, in reading order
+    std::vector<PrefetchBufferPtr> m_freeBuffers;
+    bool m_stopPrefetch;
+    bool m_prefetchDone; // the thread has read the last minibatch of the epoch
+    std::exception_ptr m_prefetchError;
+
+    PrefetchStatistics m_statistics; // updated by both threads, under m_prefetchMutex
+    Clock::time_point m_lastMinibatchTime;
 };
 
 }}}
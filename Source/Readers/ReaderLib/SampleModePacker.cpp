@@ -8,6 +8,7 @@
 
 #include "SampleModePacker.h"
 #include "ElementTypeUtils.h"
+#include <exception>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -55,13 +56,30 @@ Minibatch SampleModePacker::ReadMinibatch()
     minibatch.m_endOfEpoch = sequences.m_endOfEpoch;
 
     // Iterating for sequences inside the batch of sequences.
-    for (size_t sequenceIndex = 0; sequenceIndex < sequences.m_data.size(); sequenceIndex++)
+    // Sequences go to disjoint parts of the buffers, so they can be copied (or written, see DeferredDenseSequenceData) in parallel.
+    std::vector<std::exception_ptr> errors(sequences.m_data.size());
+#pragma omp parallel for schedule(dynamic)
+    for (long sequenceIndex = 0; sequenceIndex < (long) sequences.m_data.size(); sequenceIndex++)
     {
-        // For each sequence iterating thru all the streams with this sequence id and copying to the buffer.
-        assert(m_streamBuffers.size() == sequences.m_data[sequenceIndex].size());
-        for (int streamIndex = 0; streamIndex < sequences.m_data[sequenceIndex].size(); ++streamIndex)
+        try
         {
-            CopySequenceToBuffer(sequenceIndex, streamIndex, sequences.m_data);
+            // For each sequence iterating thru all the streams with this sequence id and copying to the buffer.
+            assert(m_streamBuffers.size() == sequences.m_data[sequenceIndex].size());
+            for (int streamIndex = 0; streamIndex < sequences.m_data[sequenceIndex].size(); ++streamIndex)
+            {
+                CopySequenceToBuffer(sequenceIndex, streamIndex, sequences.m_data);
+            }
+        }
+        catch (...)
+        {
+            errors[sequenceIndex] = std::current_exception();
+        }
+    }
+    for (const auto& error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
         }
     }
 
@@ -109,6 +127,18 @@ void SampleModePacker::CopySequenceToBuffer(size_t sampleIndex, size_t streamInd
         // Expect single sample.
         assert(data.m_numberOfSamples == 1);
 
+        if (!sampleData)
+        {
+            // The sequence writes itself.
+            auto deferred = dynamic_cast<const DeferredDenseSequenceData*>(sample.get());
+            if (!deferred)
+            {
+                LogicError("Dense sequence without data.");
+            }
+            deferred->WriteTo(buffer + sampleIndex * sampleSize);
+            return;
+        }
+
         // Copying the sequence to its position in the buffer. Effectivly a buffer contains concatenation of samples for a stream.
         std::copy(sampleData, sampleData + sampleSize, buffer + sampleIndex * sampleSize);
     }
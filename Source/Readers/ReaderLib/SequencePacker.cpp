@@ -0,0 +1,496 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+#define _SCL_SECURE_NO_WARNINGS
+
+#include <algorithm>
+#include <stdint.h>
+#include "SequencePacker.h"
+#include "ElementTypeUtils.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Copies of sequence data that outlive the transformer's buffers (truncated mode).
+struct OwnedDenseSequenceData : DenseSequenceData
+{
+    std::vector<char> m_buffer;
+};
+
+struct OwnedSparseSequenceData : SparseSequenceData
+{
+    std::vector<char> m_buffer;
+};
+
+SequencePacker::SequencePacker(
+    MemoryProviderPtr memoryProvider,
+    TransformerPtr transformer,
+    size_t minibatchSize,
+    const std::vector<StreamDescriptionPtr>& streams,
+    size_t truncationLength,
+    size_t numParallelSequences,
+    int verbosity) : m_memoryProvider(memoryProvider),
+                     m_transformer(transformer),
+                     m_outputStreams(streams),
+                     m_minibatchLayout(std::make_shared<MBLayout>()),
+                     m_minibatchSize(minibatchSize),
+                     m_truncationLength(truncationLength),
+                     m_numParallelSequences(numParallelSequences),
+                     m_verbosity(verbosity),
+                     m_nextSequenceId(0),
+                     m_transformerEndOfEpoch(false)
+{
+    m_inputStreams = m_transformer->GetStreamDescriptions();
+    assert(m_inputStreams.size() == m_outputStreams.size());
+    assert(m_minibatchSize > 0 || m_truncationLength > 0); // (in truncated mode, the minibatch size is given by the truncation)
+
+    if (m_truncationLength > 0 && m_numParallelSequences == 0)
+    {
+        InvalidArgument("SequencePacker: Truncated mode needs at least one parallel sequence.");
+    }
+
+    for (int i = 0; i < m_outputStreams.size(); ++i)
+    {
+        const auto& stream = m_outputStreams[i];
+        // Input and output should match in everything except for sparse/dense.
+        assert(stream->m_elementType == ElementType::tfloat || stream->m_elementType == ElementType::tdouble);
+        assert(stream->m_name == m_inputStreams[i]->m_name);
+        assert(stream->m_id == m_inputStreams[i]->m_id);
+        assert(GetSampleSize(m_inputStreams[i]) == GetSampleSize(stream));
+
+        if (stream->m_storageType == StorageType::sparse_csc && m_inputStreams[i]->m_storageType != StorageType::sparse_csc)
+        {
+            RuntimeError("SequencePacker: Stream '%ls' is dense and cannot be packed as sparse.", stream->m_name.c_str());
+        }
+    }
+
+    m_streamBuffers.resize(m_outputStreams.size());
+    m_streamBufferSizes.resize(m_outputStreams.size(), 0);
+    m_currentSequences.resize(m_numParallelSequences);
+    m_currentPositions.resize(m_numParallelSequences, 0);
+}
+
+Minibatch SequencePacker::ReadMinibatch()
+{
+    return m_truncationLength > 0 ? ReadTruncatedMinibatch() : ReadMinibatchOfWholeSequences();
+}
+
+// Wraps the data of all streams of a sequence; returns null for sequences without samples.
+// If 'copy' is set, the data is copied, so that it stays valid after the next call to the transformer.
+SequencePacker::SequencePtr SequencePacker::MakeSequence(const std::vector<SequenceDataPtr>& data, bool copy)
+{
+    assert(data.size() == m_inputStreams.size());
+
+    auto sequence = std::make_shared<Sequence>();
+    sequence->m_numberOfSamples = SIZE_MAX;
+    sequence->m_valueOffsets.resize(data.size());
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        const auto& stream = m_inputStreams[i];
+        size_t numberOfSamples;
+        if (stream->m_storageType == StorageType::dense)
+        {
+            const auto& dense = static_cast<const DenseSequenceData&>(*data[i]);
+            numberOfSamples = dense.m_numberOfSamples;
+            if (!copy)
+            {
+                sequence->m_data.push_back(data[i]);
+            }
+            else
+            {
+                auto owned = std::make_shared<OwnedDenseSequenceData>();
+                const char* begin = reinterpret_cast<const char*>(dense.m_data);
+                owned->m_buffer.assign(begin, begin + numberOfSamples * GetSampleSize(stream));
+                owned->m_data = owned->m_buffer.data();
+                owned->m_numberOfSamples = numberOfSamples;
+                owned->m_sampleLayout = dense.m_sampleLayout;
+                sequence->m_data.push_back(owned);
+            }
+        }
+        else if (stream->m_storageType == StorageType::sparse_csc)
+        {
+            const auto& sparse = static_cast<const SparseSequenceData&>(*data[i]);
+            numberOfSamples = sparse.m_indices.size();
+
+            // values of all samples are stored one after the other
+            auto& offsets = sequence->m_valueOffsets[i];
+            offsets.resize(numberOfSamples + 1);
+            offsets[0] = 0;
+            for (size_t k = 0; k < numberOfSamples; ++k)
+            {
+                offsets[k + 1] = offsets[k] + sparse.m_indices[k].size();
+            }
+
+            if (!copy)
+            {
+                sequence->m_data.push_back(data[i]);
+            }
+            else
+            {
+                auto owned = std::make_shared<OwnedSparseSequenceData>();
+                const char* begin = reinterpret_cast<const char*>(sparse.m_data);
+                owned->m_buffer.assign(begin, begin + offsets[numberOfSamples] * GetSizeByType(stream->m_elementType));
+                owned->m_data = owned->m_buffer.data();
+                owned->m_indices = sparse.m_indices;
+                sequence->m_data.push_back(owned);
+            }
+        }
+        else
+        {
+            RuntimeError("Storage type %d is not supported.", (int) stream->m_storageType);
+        }
+
+        if (sequence->m_numberOfSamples == SIZE_MAX)
+        {
+            sequence->m_numberOfSamples = numberOfSamples;
+        }
+        else if (sequence->m_numberOfSamples != numberOfSamples)
+        {
+            RuntimeError("SequencePacker: The streams of a sequence have different numbers of samples (%d and %d).",
+                         (int) sequence->m_numberOfSamples, (int) numberOfSamples);
+        }
+    }
+
+    if (sequence->m_numberOfSamples == 0 || sequence->m_numberOfSamples == SIZE_MAX)
+    {
+        return nullptr;
+    }
+    sequence->m_id = m_nextSequenceId++;
+    return sequence;
+}
+
+Minibatch SequencePacker::ReadMinibatchOfWholeSequences()
+{
+    auto sequences = m_transformer->GetNextSequences(m_minibatchSize);
+
+    std::vector<SequencePtr> batch;
+    for (const auto& data : sequences.m_data)
+    {
+        auto sequence = MakeSequence(data, false);
+        if (sequence)
+        {
+            batch.push_back(sequence);
+        }
+    }
+
+    if (batch.empty())
+    {
+        Minibatch minibatch;
+        minibatch.m_endOfEpoch = sequences.m_endOfEpoch;
+        if (minibatch.m_endOfEpoch && m_verbosity > 0)
+        {
+            PrintStatistics();
+        }
+        return minibatch;
+    }
+
+    // Length bucketing: place the sequences longest first, each into the first parallel sequence that still has room
+    // for it within the length of the longest sequence (first fit decreasing); open a new parallel sequence otherwise,
+    // or, if there are m_numParallelSequences already, append it to the shortest one.
+    std::vector<size_t> order(batch.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&batch](size_t a, size_t b)
+    {
+        return batch[a]->m_numberOfSamples > batch[b]->m_numberOfSamples;
+    });
+
+    size_t numTimeSteps = batch[order.front()]->m_numberOfSamples;
+    std::vector<size_t> parallelSequenceLengths;
+    std::vector<std::pair<size_t, size_t>> placements(batch.size()); // parallel sequence and first time step of each sequence
+    size_t firstNotFull = 0; // parallel sequences before it are full (e.g. all of them for single-sample sequences)
+    for (size_t i : order)
+    {
+        const size_t length = batch[i]->m_numberOfSamples;
+        size_t s = firstNotFull;
+        while (s < parallelSequenceLengths.size() && parallelSequenceLengths[s] + length > numTimeSteps)
+        {
+            s++;
+        }
+        if (s == parallelSequenceLengths.size())
+        {
+            if (m_numParallelSequences == 0 || parallelSequenceLengths.size() < m_numParallelSequences)
+            {
+                parallelSequenceLengths.push_back(0);
+            }
+            else
+            {
+                s = std::min_element(parallelSequenceLengths.begin(), parallelSequenceLengths.end()) - parallelSequenceLengths.begin();
+                numTimeSteps = std::max(numTimeSteps, parallelSequenceLengths[s] + length);
+                firstNotFull = 0; // the other parallel sequences may have room again
+            }
+        }
+        placements[i] = std::make_pair(s, parallelSequenceLengths[s]);
+        parallelSequenceLengths[s] += length;
+        while (firstNotFull < parallelSequenceLengths.size() && parallelSequenceLengths[firstNotFull] == numTimeSteps)
+        {
+            firstNotFull++;
+        }
+    }
+
+    const size_t numParallelSequences = parallelSequenceLengths.size();
+    m_minibatchLayout->Init(numParallelSequences, numTimeSteps);
+    std::vector<ColumnSource> columns(numParallelSequences * numTimeSteps, ColumnSource{ nullptr, 0 });
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        const size_t s = placements[i].first;
+        const size_t t = placements[i].second;
+        const size_t length = batch[i]->m_numberOfSamples;
+        m_minibatchLayout->AddSequence(batch[i]->m_id, s, t, t + length);
+        for (size_t k = 0; k < length; ++k)
+        {
+            columns[(t + k) * numParallelSequences + s] = ColumnSource{ batch[i].get(), k };
+        }
+    }
+    for (size_t s = 0; s < numParallelSequences; ++s)
+    {
+        m_minibatchLayout->AddGap(s, parallelSequenceLengths[s], numTimeSteps);
+    }
+
+    return PackColumns(columns, sequences.m_endOfEpoch);
+}
+
+// Gets more sequences from the transformer (truncated mode); returns false if there are none left in the epoch.
+bool SequencePacker::FetchSequences()
+{
+    while (!m_transformerEndOfEpoch)
+    {
+        auto sequences = m_transformer->GetNextSequences(m_truncationLength * m_numParallelSequences);
+        m_transformerEndOfEpoch = sequences.m_endOfEpoch;
+        for (const auto& data : sequences.m_data)
+        {
+            auto sequence = MakeSequence(data, true);
+            if (sequence)
+            {
+                m_pendingSequences.push_back(sequence);
+            }
+        }
+
+        if (!m_pendingSequences.empty())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Minibatch SequencePacker::ReadTruncatedMinibatch()
+{
+    const size_t numParallelSequences = m_numParallelSequences;
+    const size_t numTimeSteps = m_truncationLength;
+    m_minibatchLayout->Init(numParallelSequences, numTimeSteps);
+    std::vector<ColumnSource> columns(numParallelSequences * numTimeSteps, ColumnSource{ nullptr, 0 });
+    std::vector<SequencePtr> sequencesInMinibatch; // keeps the sequences that end in this minibatch alive until it is packed
+
+    bool hasData = false;
+    for (size_t s = 0; s < numParallelSequences; ++s)
+    {
+        size_t t = 0;
+        while (t < numTimeSteps)
+        {
+            auto& sequence = m_currentSequences[s];
+            auto& position = m_currentPositions[s];
+            if (!sequence || position == sequence->m_numberOfSamples)
+            {
+                sequence = nullptr;
+                if (m_pendingSequences.empty() && !FetchSequences())
+                {
+                    break;
+                }
+                sequence = m_pendingSequences.front();
+                m_pendingSequences.pop_front();
+                position = 0;
+            }
+
+            // the sequence may have started in an earlier minibatch, and may continue in a later one
+            const size_t length = sequence->m_numberOfSamples;
+            const size_t numSamples = std::min(numTimeSteps - t, length - position);
+            m_minibatchLayout->AddSequence(sequence->m_id, s, (ptrdiff_t) t - (ptrdiff_t) position, t + length - position);
+            for (size_t k = 0; k < numSamples; ++k)
+            {
+                columns[(t + k) * numParallelSequences + s] = ColumnSource{ sequence.get(), position + k };
+            }
+            sequencesInMinibatch.push_back(sequence);
+            position += numSamples;
+            t += numSamples;
+            hasData = true;
+        }
+        m_minibatchLayout->AddGap(s, t, numTimeSteps);
+    }
+
+    // the epoch ends with the last sample of the last sequence
+    bool endOfEpoch = m_transformerEndOfEpoch && m_pendingSequences.empty() &&
+        std::all_of(m_currentSequences.begin(), m_currentSequences.end(), [this](const SequencePtr& sequence)
+        {
+            return !sequence || m_currentPositions[&sequence - m_currentSequences.data()] == sequence->m_numberOfSamples;
+        });
+
+    if (!hasData)
+    {
+        Minibatch minibatch;
+        minibatch.m_endOfEpoch = true;
+        if (m_verbosity > 0)
+        {
+            PrintStatistics();
+        }
+        return minibatch;
+    }
+
+    return PackColumns(columns, endOfEpoch);
+}
+
+Minibatch SequencePacker::PackColumns(const std::vector<ColumnSource>& columns, bool endOfEpoch)
+{
+    Minibatch minibatch;
+    minibatch.m_endOfEpoch = endOfEpoch;
+
+    size_t numSamples = std::count_if(columns.begin(), columns.end(), [](const ColumnSource& column)
+    {
+        return column.m_sequence != nullptr;
+    });
+    m_statistics.m_numMinibatches++;
+    m_statistics.m_numSamples += numSamples;
+    m_statistics.m_numGapFrames += columns.size() - numSamples;
+
+    for (size_t i = 0; i < m_outputStreams.size(); ++i)
+    {
+        auto stream = std::make_shared<StreamMinibatch>();
+        if (m_outputStreams[i]->m_storageType == StorageType::sparse_csc)
+        {
+            stream->m_dataSize = PackSparseStream(i, columns);
+        }
+        else
+        {
+            stream->m_dataSize = columns.size() * GetSampleSize(m_outputStreams[i]);
+            PackDenseStream(i, columns, GetBuffer(i, stream->m_dataSize));
+        }
+        stream->m_data = m_streamBuffers[i].get();
+        stream->m_layout = m_minibatchLayout;
+        minibatch.m_data.push_back(stream);
+    }
+
+    if (endOfEpoch && m_verbosity > 0)
+    {
+        PrintStatistics();
+    }
+    return minibatch;
+}
+
+// Gaps are filled with zeros.
+void SequencePacker::PackDenseStream(size_t streamIndex, const std::vector<ColumnSource>& columns, char* buffer)
+{
+    const auto& stream = m_inputStreams[streamIndex];
+    const size_t sampleSize = GetSampleSize(stream);
+    const size_t elementSize = GetSizeByType(stream->m_elementType);
+
+    for (size_t c = 0; c < columns.size(); ++c)
+    {
+        char* destination = buffer + c * sampleSize;
+        const auto& column = columns[c];
+        if (!column.m_sequence)
+        {
+            std::fill(destination, destination + sampleSize, 0);
+            continue;
+        }
+
+        const auto& data = *column.m_sequence->m_data[streamIndex];
+        const char* source = reinterpret_cast<const char*>(data.m_data);
+        if (stream->m_storageType == StorageType::dense)
+        {
+            std::copy(source + column.m_sampleIndex * sampleSize, source + (column.m_sampleIndex + 1) * sampleSize, destination);
+        }
+        else
+        {
+            // Sparse input is unpacked to dense.
+            std::fill(destination, destination + sampleSize, 0);
+            const auto& indices = static_cast<const SparseSequenceData&>(data).m_indices[column.m_sampleIndex];
+            const size_t firstValue = column.m_sequence->m_valueOffsets[streamIndex][column.m_sampleIndex];
+            for (size_t nonZeroIndex = 0; nonZeroIndex < indices.size(); ++nonZeroIndex)
+            {
+                const char* value = source + (firstValue + nonZeroIndex) * elementSize;
+                std::copy(value, value + elementSize, destination + indices[nonZeroIndex] * elementSize);
+            }
+        }
+    }
+}
+
+// Packs a sparse stream in the format described at StreamMinibatch; returns its size in bytes.
+size_t SequencePacker::PackSparseStream(size_t streamIndex, const std::vector<ColumnSource>& columns)
+{
+    const auto& stream = m_inputStreams[streamIndex];
+    const size_t elementSize = GetSizeByType(stream->m_elementType);
+
+    size_t numNonZeros = 0;
+    for (const auto& column : columns)
+    {
+        if (column.m_sequence)
+        {
+            const auto& offsets = column.m_sequence->m_valueOffsets[streamIndex];
+            numNonZeros += offsets[column.m_sampleIndex + 1] - offsets[column.m_sampleIndex];
+        }
+    }
+
+    const size_t size = numNonZeros * elementSize + (numNonZeros + columns.size() + 1) * sizeof(int32_t);
+    char* values = GetBuffer(streamIndex, size);
+    int32_t* rowIndices = reinterpret_cast<int32_t*>(values + numNonZeros * elementSize);
+    int32_t* columnStarts = rowIndices + numNonZeros;
+
+    size_t nonZero = 0;
+    for (size_t c = 0; c < columns.size(); ++c)
+    {
+        columnStarts[c] = (int32_t) nonZero;
+        const auto& column = columns[c];
+        if (!column.m_sequence)
+        {
+            continue;
+        }
+
+        const auto& data = *column.m_sequence->m_data[streamIndex];
+        const auto& indices = static_cast<const SparseSequenceData&>(data).m_indices[column.m_sampleIndex];
+        const char* source = reinterpret_cast<const char*>(data.m_data) +
+                             column.m_sequence->m_valueOffsets[streamIndex][column.m_sampleIndex] * elementSize;
+        std::copy(source, source + indices.size() * elementSize, values + nonZero * elementSize);
+        for (size_t index : indices)
+        {
+            rowIndices[nonZero++] = (int32_t) index;
+        }
+    }
+    columnStarts[columns.size()] = (int32_t) nonZero;
+    assert(nonZero == numNonZeros);
+    return size;
+}
+
+// Returns the output buffer of a stream, grown to at least 'size' bytes.
+char* SequencePacker::GetBuffer(size_t streamIndex, size_t size)
+{
+    if (m_streamBufferSizes[streamIndex] < size)
+    {
+        m_streamBuffers[streamIndex] = std::shared_ptr<char>(
+            reinterpret_cast<char*>(m_memoryProvider->Alloc(1, size)),
+            [this](char* p)
+            {
+                m_memoryProvider->Free(p);
+            });
+        m_streamBufferSizes[streamIndex] = size;
+    }
+    return m_streamBuffers[streamIndex].get();
+}
+
+size_t SequencePacker::GetSampleSize(const StreamDescriptionPtr& stream) const
+{
+    assert(stream != nullptr);
+    size_t elementSize = GetSizeByType(stream->m_elementType);
+    return stream->m_sampleLayout->GetNumElements() * elementSize;
+}
+
+void SequencePacker::PrintStatistics() const
+{
+    fprintf(stderr, "SequencePacker: %d minibatches with %d samples and %d gap frames, padding efficiency %.1f%%.\n",
+            (int) m_statistics.m_numMinibatches, (int) m_statistics.m_numSamples, (int) m_statistics.m_numGapFrames,
+            100 * m_statistics.GetEfficiency());
+}
+} } }
@@ -0,0 +1,118 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#pragma once
+
+#include <deque>
+#include "Reader.h"
+#include "MemoryProvider.h"
+#include "Transformer.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Counters of how well the sequences filled the minibatches.
+struct PackingStatistics
+{
+    size_t m_numMinibatches = 0;
+    size_t m_numSamples = 0;   // frames with data
+    size_t m_numGapFrames = 0; // padding
+
+    // fraction of the minibatch frames that carry data
+    double GetEfficiency() const
+    {
+        size_t numFrames = m_numSamples + m_numGapFrames;
+        return numFrames > 0 ? (double) m_numSamples / numFrames : 1.0;
+    }
+};
+
+// A packer that packs variable-length sequences into the parallel sequences of a minibatch (sequence mode).
+//
+// Without truncation, each minibatch consists of the whole sequences returned by the transformer for minibatchSize
+// samples. They are packed by length (first fit decreasing): the longest sequence determines the number of time
+// steps, and shorter sequences share a parallel sequence as long as they fit, so that as few gap frames as possible
+// are needed. If numParallelSequences is not 0, there are at most that many parallel sequences; a sequence that does
+// not fit into any of them then goes to the shortest one, which makes the minibatch longer.
+//
+// With truncation (truncated BPTT), each minibatch has numParallelSequences parallel sequences of truncationLength
+// time steps. Sequences continue across minibatches; a parallel sequence is refilled with the next sequence as soon as
+// its current one ends. Partial sequences are copied, since the transformer's data is only valid until its next call.
+//
+// Dense streams can be packed from dense or sparse input. Sparse output streams (StorageType::sparse_csc) must have
+// sparse input; see StreamMinibatch for their format.
+class SequencePacker
+{
+public:
+    SequencePacker(
+        MemoryProviderPtr memoryProvider,
+        TransformerPtr transformer,
+        size_t minibatchSize,
+        const std::vector<StreamDescriptionPtr>& streams,
+        size_t truncationLength = 0,
+        size_t numParallelSequences = 0,
+        int verbosity = 0);
+
+    Minibatch ReadMinibatch();
+
+    // counters since construction, i.e. usually for the current epoch
+    const PackingStatistics& GetStatistics() const
+    {
+        return m_statistics;
+    }
+
+private:
+    // one sequence in the minibatch: all streams of a sequence from the transformer
+    struct Sequence
+    {
+        std::vector<SequenceDataPtr> m_data;             // per stream
+        std::vector<std::vector<size_t>> m_valueOffsets; // per sparse stream: offset of the values of each sample, plus the end
+        size_t m_numberOfSamples;
+        size_t m_id;
+    };
+    typedef std::shared_ptr<Sequence> SequencePtr;
+
+    // where the data of a minibatch column comes from
+    struct ColumnSource
+    {
+        const Sequence* m_sequence; // null for gaps
+        size_t m_sampleIndex;
+    };
+
+    Minibatch ReadMinibatchOfWholeSequences();
+    Minibatch ReadTruncatedMinibatch();
+
+    SequencePtr MakeSequence(const std::vector<SequenceDataPtr>& data, bool copy);
+    bool FetchSequences();
+    Minibatch PackColumns(const std::vector<ColumnSource>& columns, bool endOfEpoch);
+    void PackDenseStream(size_t streamIndex, const std::vector<ColumnSource>& columns, char* buffer);
+    size_t PackSparseStream(size_t streamIndex, const std::vector<ColumnSource>& columns);
+    char* GetBuffer(size_t streamIndex, size_t size);
+    size_t GetSampleSize(const StreamDescriptionPtr& stream) const;
+    void PrintStatistics() const;
+
+    MemoryProviderPtr m_memoryProvider;
+    TransformerPtr m_transformer;
+    std::vector<StreamDescriptionPtr> m_outputStreams;
+    std::vector<StreamDescriptionPtr> m_inputStreams;
+    std::vector<std::shared_ptr<char>> m_streamBuffers;
+    std::vector<size_t> m_streamBufferSizes;
+
+    MBLayoutPtr m_minibatchLayout;
+    size_t m_minibatchSize;
+    size_t m_truncationLength;
+    size_t m_numParallelSequences;
+    int m_verbosity;
+    size_t m_nextSequenceId;
+
+    // truncated mode: the sequence in each parallel sequence and the number of its samples already returned
+    std::vector<SequencePtr> m_currentSequences;
+    std::vector<size_t> m_currentPositions;
+    std::deque<SequencePtr> m_pendingSequences; // returned by the transformer but not started yet
+    bool m_transformerEndOfEpoch;
+
+    PackingStatistics m_statistics;
+};
+
+typedef std::shared_ptr<SequencePacker> SequencePackerPtr;
+} } }
@@ -0,0 +1,92 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// AsyncCheckpointWriter.h -- writes models and checkpoints on a background thread while training continues
+//
+// SGD serializes the model and the checkpoint info into memory on the training thread (see File(int fileOptions))
+// and hands only the file I/O to this writer. Only one write is in flight at a time: starting the next one waits
+// for the previous one, which bounds the memory held by serialized checkpoints to one and keeps the files in the
+// order they were requested. Files are still written to a temporary name and renamed when complete, so a crash
+// during a background write leaves the previously written files intact.
+
+#pragma once
+
+#include "Basics.h"
+#include "File.h"
+#include <thread>
+#include <functional>
+#include <exception>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+class AsyncCheckpointWriter
+{
+public:
+    AsyncCheckpointWriter()
+    {
+    }
+
+    ~AsyncCheckpointWriter()
+    {
+        if (!m_thread.joinable())
+            return;
+        m_thread.join();
+        if (m_error)
+            fprintf(stderr, "AsyncCheckpointWriter: Writing the last checkpoint failed.\n");
+    }
+
+    // Run 'write' on the background thread, after the previous write has completed.
+    // 'write' must only access data it owns (captured by value), e.g. serialized files; errors are reported by the next Wait().
+    void Start(const std::function<void()>& write)
+    {
+        Wait();
+        m_thread = std::thread([this, write]()
+        {
+            try
+            {
+                write();
+            }
+            catch (...)
+            {
+                m_error = std::current_exception();
+            }
+        });
+    }
+
+    // Block until the write in flight (if any) is complete, e.g. before the files are read or deleted.
+    // Rethrows the exception the write ended with.
+    void Wait()
+    {
+        if (m_thread.joinable())
+            m_thread.join();
+        if (m_error)
+        {
+            auto error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Write 'data' to 'fileName' via a temporary file that is renamed when complete, as ComputationNetwork::Save() does.
+    static void WriteFile(const std::wstring& fileName, const std::vector<char>& data)
+    {
+        std::wstring tmpFileName = fileName + L".tmp";
+        {
+            File fstream(tmpFileName, FileOptions::fileOptionsBinary | FileOptions::fileOptionsWrite);
+            if (!data.empty())
+                fwriteOrDie(data.data(), 1, data.size(), fstream);
+            fstream.Flush();
+        }
+        renameOrDie(tmpFileName, fileName);
+    }
+
+private:
+    AsyncCheckpointWriter(const AsyncCheckpointWriter&) = delete;
+    AsyncCheckpointWriter& operator=(const AsyncCheckpointWriter&) = delete;
+
+    std::thread m_thread;
+    std::exception_ptr m_error; // set by the thread; read after it was joined
+};
+} } }
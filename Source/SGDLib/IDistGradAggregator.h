@@ -21,6 +21,12 @@ public:
     // Returns a boolean indicating if any samples were processed
     virtual bool AggregateGradients(const std::vector<Matrix<ElemType>*>& gradients, DistGradHeader* headerCPU, int epochNumber) = 0;
 
+    // Called during backprop as soon as the given gradient matrix is final, ahead of the AggregateGradients() call
+    // for the same minibatch. Aggregators may use this to start communicating while backprop is still running.
+    virtual void OnGradientComputed(Matrix<ElemType>* /*gradient*/)
+    {
+    }
+
     size_t NumProc()
     {
         return m_mpi->NumNodesInUse();
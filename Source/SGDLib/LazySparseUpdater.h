@@ -0,0 +1,289 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// LazySparseUpdater.h -- momentum SGD and AdaGrad for a parameter with a sparse block-column gradient on the CPU
+// (e.g. an embedding table fed by a sparse input), touching only the columns a minibatch uses
+//
+// The dense momentum update also changes the columns whose gradient is zero: their smoothed gradient v decays and is
+// still applied to the weights w. Here this is deferred. Each column remembers up to which step it is current, and
+// before a column is read by forward prop or updated, the steps it skipped are applied at once in closed form,
+//     w -= S * v,  v *= P,
+// where P is the product of the momenta of the skipped steps and S the sum of the decay factors applied to v along
+// the way (momentum, or momentum^2 with Nesterov momentum). P and S come from prefix products and sums over the steps,
+// which are restarted ("segments") whenever the product gets small, so that their ratios stay accurate.
+// AdaGrad does not change columns with zero gradient at all; only its average multiplier is defined over all elements,
+// and is kept up to date incrementally.
+// The results match the dense update up to rounding, as long as nothing else changes the weights (regularization,
+// gradient noise or model averaging) and Flush() is called before the parameters are used outside the minibatch loop.
+
+#pragma once
+
+#include "Basics.h"
+#include "Matrix.h"
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+template <class ElemType>
+class LazySparseUpdater
+{
+public:
+    // 'sparseInputs' are the sparse CSC input matrices that select the columns forward prop reads (row index modulo the
+    // number of columns, as in LookupTableNode); 'readsAllColumns' means that the parameter is also read in other ways
+    LazySparseUpdater(Matrix<ElemType>& weights, Matrix<ElemType>& smoothedGradient,
+                      const std::vector<const Matrix<ElemType>*>& sparseInputs, bool readsAllColumns, bool useNesterovMomentum)
+        : m_weights(weights), m_smoothedGradient(smoothedGradient), m_sparseInputs(sparseInputs), m_readsAllColumns(readsAllColumns), m_useNesterovMomentum(useNesterovMomentum), m_adagradTotalsValid(false)
+    {
+        if (weights.GetDeviceId() != CPUDEVICE || weights.GetMatrixType() != DENSE)
+            LogicError("LazySparseUpdater: Only dense parameters on the CPU are supported.");
+        ResetHistory();
+    }
+
+    // bring the columns that the upcoming forward prop reads up to date
+    void CatchUpReadColumns()
+    {
+        if (m_step == 0)
+            return;
+
+        if (m_readsAllColumns)
+        {
+            CatchUpAllColumns();
+            return;
+        }
+
+        const size_t numCols = m_weights.GetNumCols();
+        for (const auto* input : m_sparseInputs)
+        {
+            input->GetNonZeroRowIds(m_columns);
+            for (auto& col : m_columns)
+                col %= numCols;
+            std::sort(m_columns.begin(), m_columns.end());
+            m_columns.erase(std::unique(m_columns.begin(), m_columns.end()), m_columns.end());
+            CatchUp(m_columns);
+        }
+    }
+
+    // momentum SGD step; lazy counterpart of smoothedGradient.NormalGrad(gradient, weights, ...)
+    void NormalGrad(Matrix<ElemType>& gradient, const ElemType learnRatePerSample, const ElemType momentum)
+    {
+        if (gradient.GetMatrixType() != SPARSE)
+        {
+            CatchUpAllColumns();
+            m_smoothedGradient.NormalGrad(gradient, m_weights, learnRatePerSample, momentum, m_useNesterovMomentum);
+            PushStep(momentum);
+            std::fill(m_columnStep.begin(), m_columnStep.end(), m_step);
+            return;
+        }
+
+        gradient.GetNonZeroColumnIds(m_columns);
+        CatchUp(m_columns);
+        m_smoothedGradient.NormalGrad(gradient, m_weights, learnRatePerSample, momentum, m_useNesterovMomentum);
+        PushStep(momentum);
+        for (auto col : m_columns)
+            m_columnStep[col] = m_step;
+    }
+
+    // AdaGrad step with the average multiplier taken over all elements as in the dense update;
+    // lazy counterpart of smoothedGradient.Adagrad(gradient, needAveMultiplier)
+    ElemType Adagrad(Matrix<ElemType>& gradient, const bool needAveMultiplier)
+    {
+        if (!needAveMultiplier || gradient.GetMatrixType() != SPARSE)
+        {
+            m_adagradTotalsValid = false;
+            return m_smoothedGradient.Adagrad(gradient, needAveMultiplier);
+        }
+
+        if (m_smoothedGradient.GetNumRows() != m_weights.GetNumRows() || m_smoothedGradient.GetNumCols() != m_weights.GetNumCols())
+        {
+            m_smoothedGradient.Resize(m_weights.GetNumRows(), m_weights.GetNumCols());
+            m_smoothedGradient.SetValue(0);
+            m_adagradTotalsValid = false;
+        }
+        if (!m_adagradTotalsValid)
+            ComputeAdagradTotals();
+
+        gradient.GetNonZeroColumnIds(m_columns);
+        AccumulateAdagradTotals(m_columns, -1);
+        m_smoothedGradient.Adagrad(gradient, false);
+        AccumulateAdagradTotals(m_columns, +1);
+
+        double sum = m_numUnseenElements * (double) Multiplier(0) + m_sumOfMultipliers;
+        return (ElemType) (sum / m_smoothedGradient.GetNumElements());
+    }
+
+    // bring all columns up to date, e.g. at the end of an epoch before the model is evaluated or saved
+    void Flush()
+    {
+        CatchUpAllColumns();
+        ResetHistory();
+    }
+
+private:
+    // below this, the prefix product of the momenta is restarted
+    static double SegmentThreshold()
+    {
+        return 1e-6;
+    }
+    // a smoothed gradient that decayed below this is considered gone
+    static double NegligibleDecay()
+    {
+        return 1e-30;
+    }
+
+    void ResetHistory()
+    {
+        m_step = 0;
+        m_columnStep.assign(m_weights.GetNumCols(), 0);
+        m_prefixProduct.assign(1, 1.0);
+        m_prefixSum.assign(1, 0.0);
+        m_stepSegment.assign(1, 0);
+        m_segmentEnd.clear();
+        m_segmentEndProduct.clear();
+        m_segmentEndSum.clear();
+    }
+
+    // record step m_step + 1 with the given momentum
+    void PushStep(double momentum)
+    {
+        double product = m_prefixProduct.back() * momentum;
+        double sum = m_prefixSum.back() + (m_useNesterovMomentum ? momentum * product : product);
+        m_step++;
+        if (product < SegmentThreshold())
+        {
+            m_segmentEnd.push_back(m_step);
+            m_segmentEndProduct.push_back(product);
+            m_segmentEndSum.push_back(sum);
+            product = 1;
+            sum = 0;
+        }
+        m_prefixProduct.push_back(product);
+        m_prefixSum.push_back(sum);
+        m_stepSegment.push_back(m_segmentEnd.size());
+    }
+
+    // decay P and displacement S of a smoothed gradient over the steps after step 'from'
+    void SkippedStepFactors(size_t from, double& decay, double& displacement) const
+    {
+        decay = 1;
+        displacement = 0;
+        while (from < m_step)
+        {
+            size_t segment = m_stepSegment[from];
+            bool ended = segment < m_segmentEnd.size();
+            double product = ended ? m_segmentEndProduct[segment] : m_prefixProduct[m_step];
+            double sum = ended ? m_segmentEndSum[segment] : m_prefixSum[m_step];
+            displacement += decay * (sum - m_prefixSum[from]) / m_prefixProduct[from];
+            decay *= product / m_prefixProduct[from];
+            if (decay < NegligibleDecay())
+            {
+                decay = 0;
+                break;
+            }
+            from = ended ? m_segmentEnd[segment] : m_step;
+        }
+    }
+
+    void CatchUp(const std::vector<size_t>& columns)
+    {
+        if (m_step == 0 || m_smoothedGradient.IsEmpty())
+            return;
+
+        const size_t numRows = m_weights.GetNumRows();
+        ElemType* w = m_weights.BufferPointer();
+        ElemType* v = m_smoothedGradient.BufferPointer();
+#pragma omp parallel for
+        for (long i = 0; i < (long) columns.size(); i++)
+        {
+            const size_t col = columns[i];
+            if (m_columnStep[col] == m_step)
+                continue;
+
+            double decay, displacement;
+            SkippedStepFactors(m_columnStep[col], decay, displacement);
+            const ElemType s = (ElemType) displacement, p = (ElemType) decay;
+            ElemType* wCol = w + col * numRows;
+            ElemType* vCol = v + col * numRows;
+            for (size_t h = 0; h < numRows; h++)
+            {
+                wCol[h] -= s * vCol[h];
+                vCol[h] *= p;
+            }
+            m_columnStep[col] = m_step;
+        }
+    }
+
+    void CatchUpAllColumns()
+    {
+        m_columns.resize(m_weights.GetNumCols());
+        for (size_t col = 0; col < m_columns.size(); col++)
+            m_columns[col] = col;
+        CatchUp(m_columns);
+    }
+
+    // AdaGrad multiplier 1 / sqrt(c + floor) of an element, computed as in CPUMatrix::Adagrad()
+    static ElemType Multiplier(ElemType c)
+    {
+        const ElemType floor = 1e-16f;
+        return 1 / sqrt(c + floor);
+    }
+
+    void ComputeAdagradTotals()
+    {
+        const ElemType* c = m_smoothedGradient.BufferPointer();
+        m_numUnseenElements = 0;
+        m_sumOfMultipliers = 0;
+        for (size_t i = 0; i < m_smoothedGradient.GetNumElements(); i++)
+        {
+            if (c[i] == 0)
+                m_numUnseenElements++;
+            else
+                m_sumOfMultipliers += Multiplier(c[i]);
+        }
+        m_adagradTotalsValid = true;
+    }
+
+    // add (sign = +1) or remove (sign = -1) the multipliers of the given columns
+    void AccumulateAdagradTotals(const std::vector<size_t>& columns, int sign)
+    {
+        const size_t numRows = m_smoothedGradient.GetNumRows();
+        const ElemType* c = m_smoothedGradient.BufferPointer();
+        for (auto col : columns)
+        {
+            for (size_t h = 0; h < numRows; h++)
+            {
+                ElemType a = c[col * numRows + h];
+                if (a == 0)
+                    m_numUnseenElements += sign;
+                else
+                    m_sumOfMultipliers += sign * (double) Multiplier(a);
+            }
+        }
+    }
+
+private:
+    Matrix<ElemType>& m_weights;
+    Matrix<ElemType>& m_smoothedGradient;
+    std::vector<const Matrix<ElemType>*> m_sparseInputs;
+    bool m_readsAllColumns;
+    bool m_useNesterovMomentum;
+
+    // momentum history since the last flush
+    size_t m_step;                       // number of steps taken
+    std::vector<size_t> m_columnStep;    // [col] number of steps applied to this column
+    std::vector<double> m_prefixProduct; // [step] product of the momenta since the start of the step's segment
+    std::vector<double> m_prefixSum;     // [step] sum of the decay factors since the start of the step's segment
+    std::vector<size_t> m_stepSegment;   // [step] segment that continues after the step
+    std::vector<size_t> m_segmentEnd;    // [segment] last step of each ended segment
+    std::vector<double> m_segmentEndProduct, m_segmentEndSum; // [segment] prefix product and sum at that step
+
+    // AdaGrad: sum of 1 / sqrt(c + floor) over all elements, split into the elements with c == 0 and the others
+    bool m_adagradTotalsValid;
+    long long m_numUnseenElements;
+    double m_sumOfMultipliers;
+
+    std::vector<size_t> m_columns; // (buffer)
+};
+} } }
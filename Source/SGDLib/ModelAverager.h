@@ -0,0 +1,222 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// ModelAverager.h -- bucketed, pipelined model averaging across MPI workers
+//
+// All learnable parameters are packed into a few fixed-size buckets that live in
+// preallocated host buffers (page-locked when the model is on a GPU). For each bucket
+// the copy-out of the weights, the non-blocking allreduce (NonBlockingAllReduce) and the
+// copy-in of the averaged result are pipelined against the neighbouring buckets, i.e.
+//          (bucket 1) GPU -> CPU  -> allreduce ---------------> CPU -> GPU
+//          (bucket 2)        GPU  -> CPU -> allreduce ---------------> CPU -> GPU
+//          (bucket 3)               GPU  -> CPU -> allreduce ---------------> ...
+// The buffers are reused across syncs, so no memory is allocated per call.
+
+#pragma once
+
+#include "Basics.h"
+#include "Matrix.h"
+#include "MPIWrapper.h"
+#include "MatrixQuantizerImpl.h"
+#include "CUDAPageLockedMemAllocator.h"
+#include "GPUDataTransferer.h"
+#include "NonBlockingAllReduce.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+template <class ElemType>
+class ModelAverager
+{
+public:
+    ModelAverager(MPIWrapper* mpi, size_t bucketSizeInBytes, AllReduceAlgorithm allReduceAlgorithm = AllReduceAlgorithm::MPI)
+        : m_mpi(mpi), m_bucketSize(std::max(bucketSizeInBytes / sizeof(ElemType), (size_t) 1)), m_allReduceAlgorithm(allReduceAlgorithm), m_deviceId(CPUDEVICE)
+    {
+    }
+
+    // Replace each model matrix by the sum over all workers of factor * matrix,
+    // where factor is the share of samples this worker contributed since the last sync.
+    void Average(const std::vector<Matrix<ElemType>*>& models, ElemType factor)
+    {
+        if (models.empty())
+            return;
+
+        if (!IsPlannedFor(models))
+            Plan(models);
+
+        const size_t numBuckets = m_buckets.size();
+
+        // scale in place on the device and make the data transfer stream wait for it
+        if (m_deviceId != CPUDEVICE)
+        {
+            for (auto* model : models)
+                Matrix<ElemType>::Scale(factor, *model);
+
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(m_deviceId));
+            mainStreamSyncEvent->SynchronizeDataTransferFetchStreamWithEvent<ElemType>();
+
+            // queue the copy-out of all buckets at once; they complete in bucket order
+            for (auto& bucket : m_buckets)
+            {
+                for (const auto& slice : bucket.slices)
+                    bucket.transferer->CopyGPUToCPUAsync(slice.matrix->BufferPointer() + slice.matrixOffset, slice.numElements, bucket.buffer.get() + slice.bufferOffset);
+            }
+        }
+
+        // buckets are written back in order; each reduction uses its bucket index as the tag, since all may be in flight at once
+        size_t numCopiedIn = 0;
+        for (size_t i = 0; i < numBuckets; i++)
+        {
+            auto& bucket = m_buckets[i];
+            if (m_deviceId != CPUDEVICE)
+                bucket.transferer->WaitForCopyGPUToCPUAsync();
+            else
+                CopyOutScaled(bucket, factor);
+
+            bucket.allReduce.Start(bucket.buffer.get(), bucket.numElements, m_allReduceAlgorithm, m_mpi->Communicator(), (int) i);
+
+            // drive progress of the reductions already in flight and write back those that are done
+            for (size_t k = numCopiedIn; k < i; k++)
+                m_buckets[k].allReduce.Test();
+            while (numCopiedIn < i && m_buckets[numCopiedIn].allReduce.Test())
+                CopyIn(m_buckets[numCopiedIn++]);
+        }
+
+        for (; numCopiedIn < numBuckets; numCopiedIn++)
+        {
+            m_buckets[numCopiedIn].allReduce.Wait();
+            CopyIn(m_buckets[numCopiedIn]);
+        }
+
+        if (m_deviceId != CPUDEVICE)
+        {
+            for (auto& bucket : m_buckets)
+                bucket.transferer->WaitForCopyCPUToGPUAsync();
+        }
+    }
+
+private:
+    // a contiguous range of one model matrix, placed at bufferOffset in its bucket
+    struct Slice
+    {
+        Matrix<ElemType>* matrix;
+        size_t matrixOffset;
+        size_t bufferOffset;
+        size_t numElements;
+    };
+
+    struct Bucket
+    {
+        std::vector<Slice> slices;
+        size_t numElements;
+        std::shared_ptr<ElemType> buffer;
+        std::shared_ptr<GPUDataTransferer<ElemType>> transferer;
+        NonBlockingAllReduce<ElemType> allReduce;
+    };
+
+    bool IsPlannedFor(const std::vector<Matrix<ElemType>*>& models) const
+    {
+        if (models.size() != m_plannedModels.size())
+            return false;
+        for (size_t i = 0; i < models.size(); i++)
+        {
+            if (models[i] != m_plannedModels[i].first || models[i]->GetNumElements() != m_plannedModels[i].second || models[i]->GetDeviceId() != m_deviceId)
+                return false;
+        }
+        return true;
+    }
+
+    // pack the models into buckets of at most m_bucketSize elements; matrices larger than that are split
+    void Plan(const std::vector<Matrix<ElemType>*>& models)
+    {
+        m_buckets.clear();
+        m_plannedModels.clear();
+        m_deviceId = models[0]->GetDeviceId();
+
+        for (auto* model : models)
+        {
+            if (model->GetMatrixType() != DENSE)
+                RuntimeError("ModelAverager: model averaging of sparse parameter matrices is currently unsupported.");
+            if (model->GetDeviceId() != m_deviceId)
+                LogicError("ModelAverager: all model matrices are expected to live on the same device.");
+            m_plannedModels.push_back(make_pair(model, model->GetNumElements()));
+
+            size_t offset = 0;
+            while (offset < model->GetNumElements())
+            {
+                if (m_buckets.empty() || m_buckets.back().numElements == m_bucketSize)
+                {
+                    m_buckets.push_back(Bucket());
+                    m_buckets.back().numElements = 0;
+                }
+                auto& bucket = m_buckets.back();
+                size_t n = std::min(model->GetNumElements() - offset, m_bucketSize - bucket.numElements);
+                bucket.slices.push_back(Slice{model, offset, bucket.numElements, n});
+                bucket.numElements += n;
+                offset += n;
+            }
+        }
+
+        for (auto& bucket : m_buckets)
+        {
+            bucket.buffer = AllocateBuffer(bucket.numElements);
+            if (m_deviceId != CPUDEVICE)
+                bucket.transferer.reset(new GPUDataTransferer<ElemType>(m_deviceId, true /*useConcurrentStreams*/));
+        }
+    }
+
+    std::shared_ptr<ElemType> AllocateBuffer(size_t numElements) const
+    {
+        // use pinned memory for GPU devices for better copy performance
+        if (m_deviceId != CPUDEVICE)
+        {
+            int deviceId = m_deviceId;
+            return std::shared_ptr<ElemType>((ElemType*) CUDAPageLockedMemAllocator::Malloc(sizeof(ElemType) * numElements, deviceId), [deviceId](ElemType* p)
+                                             {
+                                                 CUDAPageLockedMemAllocator::Free(p, deviceId);
+                                             });
+        }
+        return std::shared_ptr<ElemType>(new ElemType[numElements], [](ElemType* p)
+                                         {
+                                             delete[] p;
+                                         });
+    }
+
+    // CPU models: fuse the scaling into the copy into the bucket
+    static void CopyOutScaled(Bucket& bucket, ElemType factor)
+    {
+        for (const auto& slice : bucket.slices)
+        {
+            const ElemType* src = slice.matrix->BufferPointer() + slice.matrixOffset;
+            ElemType* dst = bucket.buffer.get() + slice.bufferOffset;
+            for (size_t k = 0; k < slice.numElements; k++)
+                dst[k] = factor * src[k];
+        }
+    }
+
+    void CopyIn(Bucket& bucket)
+    {
+        for (const auto& slice : bucket.slices)
+        {
+            ElemType* src = bucket.buffer.get() + slice.bufferOffset;
+            ElemType* dst = slice.matrix->BufferPointer() + slice.matrixOffset;
+            if (m_deviceId != CPUDEVICE)
+                bucket.transferer->CopyCPUToGPUAsync(src, slice.numElements, dst);
+            else
+                memcpy(dst, src, sizeof(ElemType) * slice.numElements);
+        }
+    }
+
+private:
+    MPIWrapper* m_mpi;
+    size_t m_bucketSize; // in elements
+    AllReduceAlgorithm m_allReduceAlgorithm;
+    int m_deviceId;
+
+    std::vector<Bucket> m_buckets;
+    std::vector<std::pair<Matrix<ElemType>*, size_t>> m_plannedModels; // models and their sizes the buckets were laid out for
+};
+} } }
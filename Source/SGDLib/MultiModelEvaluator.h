@@ -0,0 +1,249 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// MultiModelEvaluator.h -- evaluates several models on the same data in one pass over the reader
+//
+// Cross-validating the models of a training run one after the other reads and decodes the CV set once per model.
+// Here each minibatch is read once, into the input nodes of the first model, and copied into the inputs of the other
+// models, which must have the same input nodes. The forward passes of the models then run concurrently, one model
+// per thread. Each model keeps its own activation memory, so a pass needs as much memory as evaluating all of its
+// models at once; the caller decides how many models go into one pass, by default as many as run concurrently
+// (see DetermineNumThreads()).
+// On the GPU the models are evaluated one after the other, since the math library's per-device handles are not
+// meant to be used from several threads; the reading and decoding is still shared.
+
+#pragma once
+
+#include "Basics.h"
+#include "DataReader.h"
+#include "ComputationNetwork.h"
+#include "DataReaderHelpers.h"
+#include "SimpleEvaluator.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+template <class ElemType>
+class MultiModelEvaluator
+{
+public:
+    // 'numThreads' is the number of models evaluated concurrently (0: as many as there are models, up to the number of cores)
+    MultiModelEvaluator(const std::vector<ComputationNetworkPtr>& nets, const size_t numMBsToShowResult = 100, const int traceLevel = 0, const size_t numThreads = 0)
+        : m_nets(nets), m_numMBsToShowResult(numMBsToShowResult), m_traceLevel(traceLevel), m_numThreads(numThreads)
+    {
+        if (nets.empty())
+            InvalidArgument("MultiModelEvaluator: No models given.");
+        for (const auto& net : nets)
+            m_evaluators.push_back(std::make_shared<SimpleEvaluator<ElemType>>(net, numMBsToShowResult, traceLevel));
+    }
+
+    // returns, for each model, the evaluation node values per sample determined by evalNodeNames (cf. SimpleEvaluator::Evaluate())
+    std::vector<std::vector<double>> Evaluate(IDataReader<ElemType>* dataReader, const std::vector<std::wstring>& evalNodeNames, const size_t mbSize, const size_t testSize = requestDataSize)
+    {
+        const size_t numModels = m_nets.size();
+
+        // determine nodes to evaluate and allocate memory for forward computation, for each model
+        std::vector<std::vector<ComputationNodeBasePtr>> evalNodes(numModels);
+        std::vector<std::map<std::wstring, Matrix<ElemType>*>> inputMatrices(numModels);
+        for (size_t k = 0; k < numModels; k++)
+        {
+            evalNodes[k] = m_evaluators[k]->DetermineEvalNodes(evalNodeNames);
+            m_nets[k]->AllocateAllMatrices(evalNodes[k], {}, nullptr);
+
+            for (const auto& node : m_nets[k]->FeatureNodes())
+                inputMatrices[k][node->NodeName()] = &dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+            for (const auto& node : m_nets[k]->LabelNodes())
+                inputMatrices[k][node->NodeName()] = &dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+
+            if (k > 0 && !HaveSameInputs(inputMatrices[0], inputMatrices[k]))
+                InvalidArgument("MultiModelEvaluator: All models must have the same feature and label nodes.");
+        }
+
+        std::vector<std::vector<double>> evalResults(numModels), evalResultsLastMBs(numModels);
+        for (size_t k = 0; k < numModels; k++)
+        {
+            evalResults[k].assign(evalNodes[k].size(), 0);
+            evalResultsLastMBs[k].assign(evalNodes[k].size(), 0);
+        }
+
+        const size_t numThreads = DetermineNumThreads(m_nets[0]->GetDeviceId(), numModels, m_numThreads);
+        if (m_traceLevel > 0)
+            fprintf(stderr, "MultiModelEvaluator: Evaluating %d models, %d at a time.\n", (int) numModels, (int) numThreads);
+
+        // evaluate through minibatches
+        size_t totalEpochSamples = 0;
+        size_t numMBsRun = 0;
+        size_t actualMBSize = 0;
+        size_t numSamplesLastMBs = 0;
+        size_t lastMBsRun = 0; // MBs run before this display
+
+        dataReader->StartMinibatchLoop(mbSize, 0, testSize);
+        for (size_t k = 0; k < numModels; k++)
+            m_nets[k]->StartEvaluateMinibatchLoop(evalNodes[k]);
+
+        // use the cores left over by the outer loop within each model's forward pass
+#ifdef _OPENMP
+        const int wasNested = omp_get_nested();
+        const int numInnerThreads = std::max(omp_get_num_procs() / (int) numThreads, 1);
+        if (numThreads > 1 && numInnerThreads > 1)
+            omp_set_nested(1);
+#endif
+
+        std::vector<std::exception_ptr> errors(numModels);
+        while (DataReaderHelpers::GetMinibatchIntoNetwork(*dataReader, m_nets[0], nullptr, false, false, inputMatrices[0], actualMBSize))
+        {
+            size_t numSamplesWithLabel = m_nets[0]->GetNumSamplesWithLabel(actualMBSize);
+
+#pragma omp parallel for num_threads((int) numThreads) schedule(dynamic, 1)
+            for (long k = 0; k < (long) numModels; k++)
+            {
+                try
+                {
+#ifdef _OPENMP
+                    if (numThreads > 1)
+                        omp_set_num_threads(numInnerThreads);
+#endif
+                    EvaluateMinibatch(k, inputMatrices[0], inputMatrices[k], evalNodes[k], evalResults[k]);
+                }
+                catch (...)
+                {
+                    errors[k] = std::current_exception();
+                }
+            }
+
+            for (const auto& error : errors)
+            {
+                if (error)
+                {
+#ifdef _OPENMP
+                    omp_set_nested(wasNested);
+#endif
+                    std::rethrow_exception(error);
+                }
+            }
+
+            totalEpochSamples += numSamplesWithLabel;
+            numMBsRun++;
+
+            if (m_traceLevel > 0)
+            {
+                numSamplesLastMBs += numSamplesWithLabel;
+
+                if (numMBsRun % m_numMBsToShowResult == 0)
+                {
+                    for (size_t k = 0; k < numModels; k++)
+                    {
+                        fprintf(stderr, "model %d: ", (int) k);
+                        m_evaluators[k]->DisplayEvalStatistics(lastMBsRun + 1, numMBsRun, numSamplesLastMBs, evalNodes[k], evalResults[k], evalResultsLastMBs[k]);
+                        evalResultsLastMBs[k] = evalResults[k];
+                    }
+                    numSamplesLastMBs = 0;
+                    lastMBsRun = numMBsRun;
+                }
+            }
+
+            // call DataEnd to check if end of sentence is reached
+            // datareader will do its necessary/specific process for sentence ending
+            dataReader->DataEnd();
+        }
+
+#ifdef _OPENMP
+        omp_set_nested(wasNested);
+#endif
+
+        // show last batch of results
+        if (m_traceLevel > 0 && numSamplesLastMBs > 0)
+        {
+            for (size_t k = 0; k < numModels; k++)
+            {
+                fprintf(stderr, "model %d: ", (int) k);
+                m_evaluators[k]->DisplayEvalStatistics(lastMBsRun + 1, numMBsRun, numSamplesLastMBs, evalNodes[k], evalResults[k], evalResultsLastMBs[k]);
+            }
+        }
+
+        // final statistics
+        for (size_t k = 0; k < numModels; k++)
+        {
+            evalResultsLastMBs[k].assign(evalResults[k].size(), 0);
+            fprintf(stderr, "model %d: Final Results: ", (int) k);
+            m_evaluators[k]->DisplayEvalStatistics(1, numMBsRun, totalEpochSamples, evalNodes[k], evalResults[k], evalResultsLastMBs[k], true);
+
+            for (auto& evalResult : evalResults[k])
+                evalResult /= totalEpochSamples;
+        }
+
+        return evalResults;
+    }
+
+    // The number of models that are evaluated concurrently: 'numThreads', or with 0 one per core, but at most 'numModels'.
+    // On the GPU it is 1, see above.
+    static size_t DetermineNumThreads(DEVICEID_TYPE deviceId, size_t numModels, size_t numThreads)
+    {
+        if (deviceId != CPUDEVICE)
+            return 1;
+#ifdef _OPENMP
+        if (numThreads == 0)
+            numThreads = (size_t) omp_get_num_procs();
+#else
+        numThreads = 1; // (the parallel loop runs sequentially)
+#endif
+        return std::max(std::min(numThreads, numModels), (size_t) 1);
+    }
+
+private:
+    static bool HaveSameInputs(const std::map<std::wstring, Matrix<ElemType>*>& a, const std::map<std::wstring, Matrix<ElemType>*>& b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (auto ia = a.begin(), ib = b.begin(); ia != a.end(); ia++, ib++)
+        {
+            if (ia->first != ib->first)
+                return false;
+        }
+        return true;
+    }
+
+    // run model k on the minibatch that was read into the inputs of model 0, and accumulate its criteria
+    void EvaluateMinibatch(size_t k, const std::map<std::wstring, Matrix<ElemType>*>& readInputs, std::map<std::wstring, Matrix<ElemType>*>& inputs,
+                           const std::vector<ComputationNodeBasePtr>& evalNodes, std::vector<double>& evalResults)
+    {
+        auto& net = m_nets[k];
+        if (k > 0)
+        {
+            for (auto ia = readInputs.begin(), ib = inputs.begin(); ia != readInputs.end(); ia++, ib++)
+                ib->second->SetValue(*ia->second);
+            net->GetMBLayoutPtr()->CopyFrom(m_nets[0]->GetMBLayoutPtr());
+            for (auto& node : net->FeatureNodes())
+                node->NotifyFunctionValuesMBSizeModified();
+            for (auto& node : net->LabelNodes())
+                node->NotifyFunctionValuesMBSizeModified();
+            net->DetermineActualMBSizeFromFeatures();
+        }
+
+        ComputationNetwork::BumpEvalTimeStamp(net->FeatureNodes());
+        ComputationNetwork::BumpEvalTimeStamp(net->LabelNodes());
+
+        for (size_t i = 0; i < evalNodes.size(); i++)
+        {
+            net->ForwardProp(evalNodes[i]);
+            evalResults[i] += (double) evalNodes[i]->Get00Element(); // criterionNode should be a scalar
+        }
+    }
+
+private:
+    std::vector<ComputationNetworkPtr> m_nets;
+    std::vector<std::shared_ptr<SimpleEvaluator<ElemType>>> m_evaluators; // for the evaluation nodes and the statistics display
+    size_t m_numMBsToShowResult;
+    int m_traceLevel;
+    size_t m_numThreads;
+};
+} } }
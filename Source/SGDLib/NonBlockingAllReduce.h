@@ -0,0 +1,273 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// NonBlockingAllReduce.h -- in-place, non-blocking sum-allreduce of a host buffer with a selectable algorithm
+//
+// Besides MPI_Iallreduce, which leaves the choice of algorithm to the MPI library, this implements
+//  - ring allreduce: reduce-scatter followed by allgather around a ring of all workers; each worker
+//    sends and receives 2 (P-1) messages of N/P elements, which is bandwidth-optimal for large buffers;
+//  - recursive halving/doubling (Rabenseifner): reduce-scatter by recursive halving followed by allgather
+//    by recursive doubling; only 2 log2(P) messages, which is better for small buffers. This requires
+//    the number of workers to be a power of two, otherwise ring is used.
+// The explicit algorithms are state machines built on MPI_Isend/MPI_Irecv. They advance whenever Test() is
+// called, so that several reductions can be in flight and interleaved with other work.
+
+#pragma once
+
+#include "Basics.h"
+#include "MPIWrapper.h"
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+enum class AllReduceAlgorithm : int
+{
+    MPI,                     // MPI_Iallreduce
+    Ring,                    // ring reduce-scatter + allgather
+    RecursiveHalvingDoubling // recursive-halving reduce-scatter + recursive-doubling allgather
+};
+
+static inline AllReduceAlgorithm ParseAllReduceAlgorithm(const wstring& s)
+{
+    // clang-format off
+    if      (EqualCI(s, L"mpi"))                      return AllReduceAlgorithm::MPI;
+    else if (EqualCI(s, L"ring"))                     return AllReduceAlgorithm::Ring;
+    else if (EqualCI(s, L"recursiveHalvingDoubling")) return AllReduceAlgorithm::RecursiveHalvingDoubling;
+    else InvalidArgument("ParseAllReduceAlgorithm: Invalid all-reduce algorithm '%ls'. Valid values are (mpi | ring | recursiveHalvingDoubling)", s.c_str());
+    // clang-format on
+}
+
+template <class ElemType>
+class NonBlockingAllReduce
+{
+public:
+    NonBlockingAllReduce()
+        : m_data(nullptr), m_numElements(0), m_done(true), m_step(0), m_numSteps(0)
+    {
+        m_requests[0] = m_requests[1] = MPI_REQUEST_NULL;
+    }
+
+    // Start reducing data[0..numElements) in place. The tag must not be used by any other
+    // point-to-point communication on the communicator while this reduction is in flight.
+    void Start(ElemType* data, size_t numElements, AllReduceAlgorithm algorithm, MPI_Comm comm, int tag)
+    {
+        if (!m_done)
+            LogicError("NonBlockingAllReduce: Start() called while the previous reduction is still in flight.");
+
+        m_data = data;
+        m_numElements = numElements;
+        m_comm = comm;
+        m_tag = tag;
+        MPI_Comm_size(comm, &m_numProc) || MpiFail("MPI_Comm_size");
+        MPI_Comm_rank(comm, &m_rank) || MpiFail("MPI_Comm_rank");
+
+        m_done = (m_numProc <= 1);
+        if (m_done)
+            return;
+
+        m_algorithm = algorithm;
+        if (m_algorithm == AllReduceAlgorithm::RecursiveHalvingDoubling && (m_numProc & (m_numProc - 1)) != 0)
+            m_algorithm = AllReduceAlgorithm::Ring;
+
+        if (m_algorithm == AllReduceAlgorithm::MPI)
+        {
+            // On Windows this async MPI_Iallreduce call requires MS MPI v7 or higher to be installed
+            MPI_Iallreduce(MPI_IN_PLACE, m_data, (int) m_numElements, MPIWrapper::GetDataType(m_data), MPI_SUM, m_comm, &m_requests[0]) || MpiFail("MPI_Iallreduce");
+            return;
+        }
+
+        // split the buffer into one chunk per worker
+        m_chunkOffsets.resize(m_numProc + 1);
+        for (int c = 0; c <= m_numProc; c++)
+            m_chunkOffsets[c] = m_numElements * c / m_numProc;
+        if (m_scratch.size() < m_numElements / 2 + 1) // enough for the largest chunk (ring) or half buffer (halving)
+            m_scratch.resize(m_numElements / 2 + 1);
+
+        if (m_algorithm == AllReduceAlgorithm::Ring)
+            m_numSteps = 2 * (m_numProc - 1);
+        else
+        {
+            int log2NumProc = 0;
+            while ((1 << log2NumProc) < m_numProc)
+                log2NumProc++;
+            m_numSteps = 2 * log2NumProc;
+            m_lo = 0;
+            m_hi = m_numProc;
+        }
+        m_step = 0;
+        PostStep();
+    }
+
+    // Advance the reduction as far as possible without blocking. Returns true once it is complete.
+    bool Test()
+    {
+        if (m_done)
+            return true;
+
+        if (m_algorithm == AllReduceAlgorithm::MPI)
+        {
+            int done = 0;
+            MPI_Test(&m_requests[0], &done, MPI_STATUS_IGNORE) || MpiFail("MPI_Test");
+            m_done = (done != 0);
+            return m_done;
+        }
+
+        for (;;)
+        {
+            int done = 0;
+            MPI_Testall(2, m_requests, &done, MPI_STATUSES_IGNORE) || MpiFail("MPI_Testall");
+            if (!done)
+                return false;
+            if (FinishStep())
+                return true;
+        }
+    }
+
+    // Block until the reduction is complete.
+    void Wait()
+    {
+        if (m_done)
+            return;
+
+        if (m_algorithm == AllReduceAlgorithm::MPI)
+        {
+            MPI_Wait(&m_requests[0], MPI_STATUS_IGNORE) || MpiFail("MPI_Wait");
+            m_done = true;
+            return;
+        }
+
+        do
+        {
+            MPI_Waitall(2, m_requests, MPI_STATUSES_IGNORE) || MpiFail("MPI_Waitall");
+        } while (!FinishStep());
+    }
+
+private:
+    int Mod(int i) const
+    {
+        return ((i % m_numProc) + m_numProc) % m_numProc;
+    }
+
+    // chunk range [loChunk, hiChunk) as element range
+    ElemType* ChunkPtr(int loChunk) const
+    {
+        return m_data + m_chunkOffsets[loChunk];
+    }
+    int ChunkSize(int loChunk, int hiChunk) const
+    {
+        return (int) (m_chunkOffsets[hiChunk] - m_chunkOffsets[loChunk]);
+    }
+
+    bool IsReduceScatterStep() const
+    {
+        return m_step < m_numSteps / 2;
+    }
+
+    // Determine the peers and ranges of the current step and post its send and receive.
+    // In the reduce-scatter phase the received data goes to m_scratch and is added in FinishStep(),
+    // in the allgather phase it is received in place.
+    void PostStep()
+    {
+        int sendTo, recvFrom, sendLo, sendHi;
+        if (m_algorithm == AllReduceAlgorithm::Ring)
+        {
+            sendTo = Mod(m_rank + 1);
+            recvFrom = Mod(m_rank - 1);
+            int sendChunk, recvChunk;
+            if (IsReduceScatterStep())
+            {
+                sendChunk = Mod(m_rank - m_step);
+                recvChunk = Mod(m_rank - m_step - 1);
+            }
+            else
+            {
+                int k = m_step - m_numSteps / 2;
+                sendChunk = Mod(m_rank + 1 - k);
+                recvChunk = Mod(m_rank - k);
+            }
+            sendLo = sendChunk;
+            sendHi = sendChunk + 1;
+            m_recvLo = recvChunk;
+            m_recvHi = recvChunk + 1;
+        }
+        else
+        {
+            int numHalvingSteps = m_numSteps / 2;
+            if (IsReduceScatterStep())
+            {
+                // distance P/2, P/4, ..., 1: keep the half of the current segment selected by our bit, send the other
+                int distance = m_numProc >> (m_step + 1);
+                int mid = (m_lo + m_hi) / 2;
+                bool keepUpper = (m_rank & distance) != 0;
+                sendLo = keepUpper ? m_lo : mid;
+                sendHi = keepUpper ? mid : m_hi;
+                m_recvLo = keepUpper ? mid : m_lo;
+                m_recvHi = keepUpper ? m_hi : mid;
+                sendTo = recvFrom = m_rank ^ distance;
+            }
+            else
+            {
+                // distance 1, 2, ..., P/2: exchange segments with the partner, doubling the segment we hold
+                int distance = 1 << (m_step - numHalvingSteps);
+                int size = m_hi - m_lo;
+                sendLo = m_lo;
+                sendHi = m_hi;
+                bool partnerIsUpper = (m_rank & distance) == 0;
+                m_recvLo = partnerIsUpper ? m_hi : m_lo - size;
+                m_recvHi = m_recvLo + size;
+                sendTo = recvFrom = m_rank ^ distance;
+            }
+        }
+
+        ElemType* recvBuffer = IsReduceScatterStep() ? m_scratch.data() : ChunkPtr(m_recvLo);
+        MPI_Irecv(recvBuffer, ChunkSize(m_recvLo, m_recvHi), MPIWrapper::GetDataType(m_data), recvFrom, m_tag, m_comm, &m_requests[0]) || MpiFail("MPI_Irecv");
+        MPI_Isend(ChunkPtr(sendLo), ChunkSize(sendLo, sendHi), MPIWrapper::GetDataType(m_data), sendTo, m_tag, m_comm, &m_requests[1]) || MpiFail("MPI_Isend");
+    }
+
+    // Complete the current step (whose requests have finished) and post the next one. Returns true when done.
+    bool FinishStep()
+    {
+        if (IsReduceScatterStep())
+        {
+            ElemType* dst = ChunkPtr(m_recvLo);
+            const ElemType* src = m_scratch.data();
+            int n = ChunkSize(m_recvLo, m_recvHi);
+            for (int i = 0; i < n; i++)
+                dst[i] += src[i];
+        }
+
+        if (m_algorithm == AllReduceAlgorithm::RecursiveHalvingDoubling)
+        {
+            // the segment we hold: the half we reduced, or the union of ours and the partner's
+            m_lo = IsReduceScatterStep() ? m_recvLo : std::min(m_lo, m_recvLo);
+            m_hi = IsReduceScatterStep() ? m_recvHi : std::max(m_hi, m_recvHi);
+        }
+
+        m_step++;
+        m_done = (m_step == m_numSteps);
+        if (!m_done)
+            PostStep();
+        return m_done;
+    }
+
+private:
+    ElemType* m_data;
+    size_t m_numElements;
+    MPI_Comm m_comm;
+    int m_tag;
+    int m_numProc;
+    int m_rank;
+    AllReduceAlgorithm m_algorithm;
+    bool m_done;
+
+    // state of the explicit algorithms
+    int m_step;
+    int m_numSteps;
+    std::vector<size_t> m_chunkOffsets;
+    int m_lo, m_hi;         // chunk range currently held by this worker (recursive halving/doubling)
+    int m_recvLo, m_recvHi; // chunk range received in the current step
+    std::vector<ElemType> m_scratch;
+    MPI_Request m_requests[2];
+};
+} } }
@@ -0,0 +1,432 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// QuantizedDistGradAggregator.h -- data-parallel gradient aggregation with n-bit quantization and error feedback on the CPU
+//
+// Each worker adds to every gradient the quantization error it made in the previous minibatch (the residual)
+// and quantizes it column by column to 1, 2, 4 or 8 bits. The quantized gradients are then summed by
+//  - reduce-scatter: the columns of each gradient are split into one stripe per worker; every worker sends
+//    each stripe to the worker owning it, which unquantizes and sums the copies of its stripe;
+//  - allgather: the owner quantizes the summed stripe again (with a residual of its own) and sends it to all
+//    other workers, which then unquantize the complete gradient.
+// Only packed QuantizedColumn buffers go over the wire, i.e. about gradientBits / (8 * sizeof(ElemType)) of
+// the data exchanged by full-precision aggregation. All workers end up with bit-identical gradients.
+// This aggregator handles CPU gradients; builds with QUANTIZED_GRADIENT_AGGREGATION use AllReduceDistGradAggregator.
+
+#pragma once
+
+#include "IDistGradAggregator.h"
+#include "MatrixQuantizerImpl.h"
+#include "QuantizedMatrix.h"
+#include "TimerUtility.h"
+#include <memory>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+template <class ElemType>
+class QuantizedDistGradAggregator : public IDistGradAggregator<ElemType>
+{
+    UsingIDistGradAggregatorMembers;
+
+public:
+    QuantizedDistGradAggregator(MPIWrapper* mpi, int numBits, bool zeroThresholdFor1Bit, int traceLevel, int syncStatsTrace)
+        : IDistGradAggregator<ElemType>(mpi), m_numBits(numBits), m_zeroThresholdFor1Bit(zeroThresholdFor1Bit), m_traceLevel(traceLevel), m_syncStatsTrace(syncStatsTrace),
+          m_iterationCount(0), m_currentEpochNumber(-1), m_numGradMatrices(0), m_epochBytesSent(0), m_epochBytesFullPrecision(0)
+    {
+        if ((numBits != 1) && (numBits != 2) && (numBits != 4) && (numBits != 8))
+            InvalidArgument("QuantizedDistGradAggregator: gradientBits must be 1, 2, 4 or 8 for quantized gradient aggregation on the CPU, but is %d.", numBits);
+
+        m_quantizer.reset(MatrixQuantizerImpl<ElemType>::Create(CPUDEVICE, /*useAsync=*/false));
+    }
+
+    ~QuantizedDistGradAggregator()
+    {
+        for (size_t i = 0; i < m_recvHeaders.size(); ++i)
+        {
+            DistGradHeader::Destroy(m_recvHeaders[i]);
+        }
+    }
+
+    // Aggregate the gradient matrices across all nodes
+    bool AggregateGradients(const std::vector<Matrix<ElemType>*>& gradients, DistGradHeader* headerCPU, int epochNumber) override
+    {
+        bool showSyncPerfStats = (m_syncStatsTrace > 0) && ((m_iterationCount % m_syncStatsTrace) == 0);
+        m_iterationCount++;
+
+        if (epochNumber != m_currentEpochNumber)
+        {
+            m_epochBytesSent = 0;
+            m_epochBytesFullPrecision = 0;
+            m_currentEpochNumber = epochNumber;
+        }
+
+        if (!IsPlannedFor(gradients))
+            Plan(gradients, headerCPU->numEvalNode);
+
+        Timer aggregationTimer;
+        if (showSyncPerfStats)
+            aggregationTimer.Start();
+
+        // If the current node did not process any samples, the gradients should be zero'd.
+        // The residuals are kept and still go into this minibatch's aggregate.
+        if (headerCPU->numSamples == 0)
+        {
+            assert(headerCPU->criterion == 0);
+            for (size_t i = 0; i < gradients.size(); ++i)
+            {
+                gradients[i]->SetValue(0);
+            }
+        }
+
+        std::vector<MPI_Request> recvHeaderRequests;
+        MPI_Request sendHeaderRequest;
+        StartHeaderExchange(headerCPU, recvHeaderRequests, sendHeaderRequest);
+
+        AggregateQuantizedGradients(showSyncPerfStats);
+
+        FinishHeaderExchange(headerCPU, recvHeaderRequests, sendHeaderRequest);
+
+        if (showSyncPerfStats)
+        {
+            aggregationTimer.Stop();
+            fprintf(stderr, "Actual gradient aggregation time: %.6g\n", aggregationTimer.ElapsedSeconds());
+            fprintf(stderr, "\t%d-bit quantized gradients: sent %.6g MB for %.6g MB of full-precision gradient stripes (%.1fx less; %.6g MB for %.6g MB this epoch); relative quantization error %.4g (local), %.4g (aggregate)\n",
+                    m_numBits, m_stats.bytesSent / 1e6, m_stats.bytesFullPrecision / 1e6, (double) m_stats.bytesFullPrecision / std::max(m_stats.bytesSent, (size_t) 1),
+                    m_epochBytesSent / 1e6, m_epochBytesFullPrecision / 1e6,
+                    RelativeError(m_stats.localResidualSqr, m_stats.localValueSqr), RelativeError(m_stats.aggregateResidualSqr, m_stats.aggregateValueSqr));
+        }
+
+        return (headerCPU->numSamples != 0);
+    }
+
+    // The quantization errors that are fed back into the next aggregation of gradient i: that of this worker's
+    // quantization of the gradient, and that of re-quantizing the sums of the columns this worker owns (zero in the other columns).
+    void GetResiduals(size_t i, Matrix<ElemType>& localResidual, Matrix<ElemType>& aggregateResidual) const
+    {
+        const auto& state = m_states[i];
+        localResidual.SetValue(*state.residual);
+        aggregateResidual.Resize(state.residual->GetNumRows(), state.residual->GetNumCols());
+        aggregateResidual.SetValue(0);
+        const size_t myRank = m_mpi->CurrentNodeRank();
+        if (StripeCols(state, myRank) > 0)
+            aggregateResidual.SetColumnSlice(*state.stripeResidual, state.stripeBegin[myRank], StripeCols(state, myRank));
+    }
+
+private:
+    // Per-gradient quantization state. Worker r owns the columns [stripeBegin[r], stripeBegin[r + 1]).
+    struct GradientState
+    {
+        Matrix<ElemType>* gradient;
+        size_t qColSize; // bytes per quantized column
+        std::vector<size_t> stripeBegin;
+
+        std::shared_ptr<Matrix<ElemType>> residual;               // error feedback of the local quantization
+        std::shared_ptr<QuantizedMatrix<ElemType>> quantized;     // local quantized gradient, all stripes
+        std::shared_ptr<QuantizedMatrix<ElemType>> aggregated;    // quantized aggregate, all stripes (assembled by the allgather)
+        std::shared_ptr<QuantizedMatrix<ElemType>> ownLocal;      // our stripe within 'quantized'
+        std::shared_ptr<QuantizedMatrix<ElemType>> ownAggregated; // our stripe within 'aggregated'
+
+        // our stripe: the other workers' quantized copies of it, their sum and the error feedback of its re-quantization
+        std::vector<std::shared_ptr<QuantizedMatrix<ElemType>>> peerStripes;
+        std::shared_ptr<Matrix<ElemType>> stripeSum;
+        std::shared_ptr<Matrix<ElemType>> stripeResidual;
+
+        std::vector<MPI_Request> reduceRequests;
+        std::vector<MPI_Request> gatherRequests;
+    };
+
+    // traffic and accuracy of one aggregation
+    struct Stats
+    {
+        size_t bytesSent;
+        size_t bytesFullPrecision; // what the same stripes would take unquantized
+        double localValueSqr, localResidualSqr;
+        double aggregateValueSqr, aggregateResidualSqr;
+    };
+
+    static double RelativeError(double residualSqr, double valueSqr)
+    {
+        return valueSqr > 0 ? sqrt(residualSqr / valueSqr) : 0.0;
+    }
+
+    size_t StripeCols(const GradientState& state, size_t rank) const
+    {
+        return state.stripeBegin[rank + 1] - state.stripeBegin[rank];
+    }
+
+    size_t StripeBytes(const GradientState& state, size_t rank) const
+    {
+        return state.qColSize * StripeCols(state, rank);
+    }
+
+    char* StripePtr(const GradientState& state, const QuantizedMatrix<ElemType>& qMatrix, size_t rank) const
+    {
+        return qMatrix.GetArray() + state.qColSize * state.stripeBegin[rank];
+    }
+
+    // P2P tags; 'numGradMatrices' and '2 * numGradMatrices + 1' are used for the headers
+    int ReduceScatterTag(size_t i) const
+    {
+        return (int) i;
+    }
+    int AllGatherTag(size_t i) const
+    {
+        return (int) (m_numGradMatrices + 1 + i);
+    }
+
+    bool IsPlannedFor(const std::vector<Matrix<ElemType>*>& gradients) const
+    {
+        if (gradients.size() != m_states.size())
+            return false;
+        for (size_t i = 0; i < gradients.size(); i++)
+        {
+            if (gradients[i] != m_states[i].gradient ||
+                gradients[i]->GetNumRows() != m_states[i].residual->GetNumRows() ||
+                gradients[i]->GetNumCols() != m_states[i].residual->GetNumCols())
+                return false;
+        }
+        return true;
+    }
+
+    void Plan(const std::vector<Matrix<ElemType>*>& gradients, int numEvalNode)
+    {
+        const size_t numProc = NumProc();
+        const size_t myRank = MyRank();
+
+        m_states.clear();
+        size_t quantizedBytes = 0, fullPrecisionBytes = 0;
+        for (auto* gradient : gradients)
+        {
+            if (gradient->GetMatrixType() != DENSE)
+                RuntimeError("Gradient aggregation for sparse gradient matrices is currently unsupported!");
+            if (gradient->GetDeviceId() != CPUDEVICE)
+                RuntimeError("Quantized gradient aggregation of GPU gradients requires a CNTK binary built with quantized gradient aggregation support!");
+
+            const size_t rows = gradient->GetNumRows();
+            const size_t cols = gradient->GetNumCols();
+
+            GradientState state;
+            state.gradient = gradient;
+            state.qColSize = QuantizedColumn<ElemType>::QuantizedColumnSize(m_numBits, rows);
+            for (size_t r = 0; r <= numProc; r++)
+                state.stripeBegin.push_back(cols * r / numProc);
+
+            state.residual = std::make_shared<Matrix<ElemType>>(rows, cols, CPUDEVICE);
+            state.residual->SetValue(0);
+            state.quantized = std::make_shared<QuantizedMatrix<ElemType>>(rows, cols, m_numBits, CPUDEVICE);
+            state.aggregated = std::make_shared<QuantizedMatrix<ElemType>>(rows, cols, m_numBits, CPUDEVICE);
+
+            const size_t ownCols = StripeCols(state, myRank);
+            state.peerStripes.resize(numProc);
+            if (ownCols > 0)
+            {
+                state.ownLocal = std::make_shared<QuantizedMatrix<ElemType>>(state.quantized->ColumnSlice(state.stripeBegin[myRank], ownCols));
+                state.ownAggregated = std::make_shared<QuantizedMatrix<ElemType>>(state.aggregated->ColumnSlice(state.stripeBegin[myRank], ownCols));
+                for (size_t r = 0; r < numProc; r++)
+                {
+                    if (r != myRank)
+                        state.peerStripes[r] = std::make_shared<QuantizedMatrix<ElemType>>(rows, ownCols, m_numBits, CPUDEVICE);
+                }
+                state.stripeSum = std::make_shared<Matrix<ElemType>>(rows, ownCols, CPUDEVICE);
+                state.stripeResidual = std::make_shared<Matrix<ElemType>>(rows, ownCols, CPUDEVICE);
+                state.stripeResidual->SetValue(0);
+            }
+            state.reduceRequests.assign(numProc, MPI_REQUEST_NULL);
+            state.gatherRequests.assign(numProc, MPI_REQUEST_NULL);
+
+            quantizedBytes += state.qColSize * cols;
+            fullPrecisionBytes += sizeof(ElemType) * rows * cols;
+            m_states.push_back(state);
+        }
+        m_numGradMatrices = gradients.size();
+
+        if (m_recvHeaders.empty() && m_mpi->IsMainNode())
+        {
+            for (size_t i = 0; i < numProc - 1; ++i)
+            {
+                m_recvHeaders.push_back(DistGradHeader::Create(numEvalNode));
+            }
+        }
+
+        if (m_traceLevel > 0)
+            fprintf(stderr, "QuantizedDistGradAggregator: %d-bit quantization of %d gradient matrices, %.6g MB instead of %.6g MB per worker and minibatch.\n",
+                    m_numBits, (int) m_numGradMatrices, quantizedBytes / 1e6, fullPrecisionBytes / 1e6);
+    }
+
+    void AggregateQuantizedGradients(bool collectStats)
+    {
+        const size_t numProc = NumProc();
+        const size_t myRank = MyRank();
+        const MPI_Comm comm = m_mpi->Communicator();
+
+        m_stats = Stats();
+        std::vector<MPI_Request> sendRequests;
+
+        // post all receives up front: the other workers' copies of our stripes, and the aggregated stripes of the other workers
+        for (size_t i = 0; i < m_states.size(); i++)
+        {
+            auto& state = m_states[i];
+            for (size_t r = 0; r < numProc; r++)
+            {
+                if (r == myRank)
+                    continue;
+                if (StripeCols(state, myRank) > 0)
+                    MPI_Irecv(state.peerStripes[r]->GetArray(), (int) StripeBytes(state, myRank), MPI_CHAR, (int) r, ReduceScatterTag(i), comm, &state.reduceRequests[r]) || MpiFail("MPI_Irecv");
+                if (StripeCols(state, r) > 0)
+                    MPI_Irecv(StripePtr(state, *state.aggregated, r), (int) StripeBytes(state, r), MPI_CHAR, (int) r, AllGatherTag(i), comm, &state.gatherRequests[r]) || MpiFail("MPI_Irecv");
+            }
+        }
+
+        // reduce-scatter: quantize each gradient and send its stripes off to their owners while quantizing the next one
+        for (size_t i = 0; i < m_states.size(); i++)
+        {
+            auto& state = m_states[i];
+            if (collectStats)
+                m_stats.localValueSqr += SquaredNorm(*state.gradient);
+
+            m_quantizer->QuantizeAsync(*state.gradient, *state.residual, *state.quantized, *state.residual, m_zeroThresholdFor1Bit);
+            m_quantizer->WaitQuantizeAsyncDone();
+
+            if (collectStats)
+                m_stats.localResidualSqr += SquaredNorm(*state.residual);
+
+            for (size_t r = 0; r < numProc; r++)
+            {
+                if (r == myRank || StripeCols(state, r) == 0)
+                    continue;
+                sendRequests.push_back(MPI_REQUEST_NULL);
+                MPI_Isend(StripePtr(state, *state.quantized, r), (int) StripeBytes(state, r), MPI_CHAR, (int) r, ReduceScatterTag(i), comm, &sendRequests.back()) || MpiFail("MPI_Isend");
+                m_stats.bytesSent += StripeBytes(state, r);
+                m_stats.bytesFullPrecision += sizeof(ElemType) * state.gradient->GetNumRows() * StripeCols(state, r);
+            }
+        }
+
+        // sum up our stripes, quantize the sums and send them to everybody (allgather)
+        for (size_t i = 0; i < m_states.size(); i++)
+        {
+            auto& state = m_states[i];
+            if (StripeCols(state, myRank) == 0)
+                continue;
+
+            // our own contribution is quantized as well, so that its error is fed back like everybody else's
+            m_quantizer->UnquantizeAsync(*state.ownLocal, *state.stripeSum, /*add=*/false);
+            m_quantizer->WaitUnquantizeAsyncDone();
+            MPI_Waitall((int) numProc, state.reduceRequests.data(), MPI_STATUSES_IGNORE) || MpiFail("MPI_Waitall");
+            for (size_t r = 0; r < numProc; r++)
+            {
+                if (r == myRank)
+                    continue;
+                m_quantizer->UnquantizeAsync(*state.peerStripes[r], *state.stripeSum, /*add=*/true);
+                m_quantizer->WaitUnquantizeAsyncDone();
+            }
+
+            if (collectStats)
+                m_stats.aggregateValueSqr += SquaredNorm(*state.stripeSum);
+
+            m_quantizer->QuantizeAsync(*state.stripeSum, *state.stripeResidual, *state.ownAggregated, *state.stripeResidual, m_zeroThresholdFor1Bit);
+            m_quantizer->WaitQuantizeAsyncDone();
+
+            if (collectStats)
+                m_stats.aggregateResidualSqr += SquaredNorm(*state.stripeResidual);
+
+            for (size_t r = 0; r < numProc; r++)
+            {
+                if (r == myRank)
+                    continue;
+                sendRequests.push_back(MPI_REQUEST_NULL);
+                MPI_Isend(StripePtr(state, *state.aggregated, myRank), (int) StripeBytes(state, myRank), MPI_CHAR, (int) r, AllGatherTag(i), comm, &sendRequests.back()) || MpiFail("MPI_Isend");
+                m_stats.bytesSent += StripeBytes(state, myRank);
+                m_stats.bytesFullPrecision += sizeof(ElemType) * state.gradient->GetNumRows() * StripeCols(state, myRank);
+            }
+        }
+
+        // unquantize the aggregated gradients as they become complete
+        for (auto& state : m_states)
+        {
+            MPI_Waitall((int) numProc, state.gatherRequests.data(), MPI_STATUSES_IGNORE) || MpiFail("MPI_Waitall");
+            m_quantizer->UnquantizeAsync(*state.aggregated, *state.gradient, /*add=*/false);
+            m_quantizer->WaitUnquantizeAsyncDone();
+        }
+
+        MPI_Waitall((int) sendRequests.size(), sendRequests.data(), MPI_STATUSES_IGNORE) || MpiFail("MPI_Waitall");
+
+        m_epochBytesSent += m_stats.bytesSent;
+        m_epochBytesFullPrecision += m_stats.bytesFullPrecision;
+    }
+
+    static double SquaredNorm(const Matrix<ElemType>& m)
+    {
+        double norm = m.FrobeniusNorm();
+        return norm * norm;
+    }
+
+    // Send the headers to the main node, which aggregates them and sends the result back (see SimpleDistGradAggregator)
+    void StartHeaderExchange(DistGradHeader* headerCPU, std::vector<MPI_Request>& recvHeaderRequests, MPI_Request& sendHeaderRequest)
+    {
+        recvHeaderRequests.resize(NumProc() - 1);
+        if (m_mpi->IsMainNode())
+        {
+            for (size_t j = 0; j < NumProc() - 1; ++j)
+            {
+                int source = (j >= MyRank()) ? (j + 1) : j;
+                MPI_Irecv(m_recvHeaders[j], m_recvHeaders[j]->Size(), MPI_CHAR, source, (int) m_numGradMatrices, m_mpi->Communicator(), &(recvHeaderRequests[j])) || MpiFail("MPI_Irecv");
+            }
+        }
+        else
+        {
+            MPI_Isend(headerCPU, headerCPU->Size(), MPI_CHAR, m_mpi->MainNodeRank(), (int) m_numGradMatrices, m_mpi->Communicator(), &sendHeaderRequest) || MpiFail("MPI_Isend");
+        }
+    }
+
+    void FinishHeaderExchange(DistGradHeader* headerCPU, std::vector<MPI_Request>& recvHeaderRequests, MPI_Request& sendHeaderRequest)
+    {
+        const int aggHeaderTag = (int) (2 * m_numGradMatrices + 1);
+        if (m_mpi->IsMainNode())
+        {
+            for (size_t n = 0; n < NumProc() - 1; ++n)
+            {
+                int idx = MPI_UNDEFINED;
+                MPI_Waitany((int) recvHeaderRequests.size(), recvHeaderRequests.data(), &idx, MPI_STATUS_IGNORE) || MpiFail("MPI_Waitany");
+                if (idx == MPI_UNDEFINED)
+                    break;
+                headerCPU->Aggregate(m_recvHeaders[idx], true);
+            }
+
+            std::vector<MPI_Request> sendAggHeaderRequests(NumProc() - 1);
+            for (size_t j = 0; j < NumProc() - 1; ++j)
+            {
+                int dest = (j >= MyRank()) ? (j + 1) : j;
+                MPI_Isend(headerCPU, headerCPU->Size(), MPI_CHAR, dest, aggHeaderTag, m_mpi->Communicator(), &(sendAggHeaderRequests[j])) || MpiFail("MPI_Isend");
+            }
+            MPI_Waitall((int) sendAggHeaderRequests.size(), sendAggHeaderRequests.data(), MPI_STATUSES_IGNORE) || MpiFail("MPI_Waitall");
+        }
+        else
+        {
+            MPI_Wait(&sendHeaderRequest, MPI_STATUS_IGNORE) || MpiFail("MPI_Wait");
+            MPI_Recv(headerCPU, headerCPU->Size(), MPI_CHAR, m_mpi->MainNodeRank(), aggHeaderTag, m_mpi->Communicator(), MPI_STATUS_IGNORE) || MpiFail("MPI_Recv");
+        }
+    }
+
+private:
+    std::unique_ptr<MatrixQuantizerImpl<ElemType>> m_quantizer;
+    int m_numBits;
+    bool m_zeroThresholdFor1Bit;
+
+    std::vector<GradientState> m_states;
+    size_t m_numGradMatrices;
+    std::vector<DistGradHeader*> m_recvHeaders;
+
+    int m_traceLevel;
+    int m_syncStatsTrace;
+
+    // Only used for controlling frequency of measuring/showing gradient aggregation perf stats
+    size_t m_iterationCount;
+
+    int m_currentEpochNumber;
+    Stats m_stats;
+    size_t m_epochBytesSent;
+    size_t m_epochBytesFullPrecision;
+};
+} } }
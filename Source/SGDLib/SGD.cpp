@@ -6,12 +6,18 @@
 #include "SGD.h"
 #include "NonlinearityNodes.h"          // for DropoutNode
 #include "SpecialPurposeNodes.h"        // for SequenceWithSoftmaxNode
+#include "InputAndParamNodes.h"         // for LookupTableNode
+#include "LinearAlgebraNodes.h"         // for TimesNode
 #include "DataReaderHelpers.h"
 #include "MatrixQuantizerImpl.h"
 #ifdef QUANTIZED_GRADIENT_AGGREGATION
 #include "AllReduceDistGradAggregator.h"
 #endif
 #include "SimpleDistGradAggregator.h"
+#include "QuantizedDistGradAggregator.h"
+#include "ModelAverager.h"
+#include "AsyncCheckpointWriter.h"
+#include "LazySparseUpdater.h"
 #include "ProgressTracing.h"
 
 #include <map>
@@ -142,6 +148,9 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                                       IDataReader<ElemType>* trainSetDataReader,
                                       IDataReader<ElemType>* validationSetDataReader)
 {
+    // parameters of a model that was loaded from a mappable file refer to its read-only pages; training modifies them
+    net->MakeValuesWritable<ElemType>();
+
     auto& featureNodes = net->FeatureNodes();
     auto& labelNodes = net->LabelNodes();
     auto& criterionNodes = GetTrainCriterionNodes(net);
@@ -178,6 +187,14 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
     additionalNodesToEvaluate.insert(additionalNodesToEvaluate.end(), preComputeNodesList.cbegin(), preComputeNodesList.cend());
 
     // allocate memory for forward and backward computation
+    // (nodes that run concurrently cannot share memory, so this must be decided first)
+    net->SetNumNodeExecutionThreads(m_numNodeExecutionThreads);
+    if (m_parallelizationMethod == ParallelizationMethod::DataParallelSGD)
+    {
+        // the gradient aggregators handle dense gradients only
+        for (const auto& node : net->GetNodesWithType(OperationNameOf(LookupTableNode)))
+            node->As<LookupTableNode<ElemType>>()->SetUseSparseGradient(false);
+    }
     net->AllocateAllMatrices(evaluationNodes, additionalNodesToEvaluate, criterionNodes[0]);
 
     // get feature and label nodes into an array of matrices that will be passed to GetMinibatch()
@@ -322,6 +339,15 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
     // --- MAIN EPOCH LOOP
     for (int i = startEpoch; i < (int) m_maxEpochs; i++) // TODO: why is this an int, and not a size_t?
     {
+        // The checkpoint of the previous epoch is written in the background while this epoch trains, unless
+        // it may be read back during this epoch, by the learning-rate or minibatch-size search or when going
+        // back to the best model. Then it must be complete before any rank proceeds.
+        if (m_autoLearnRateSearchType == LearningRateSearchAlgorithm::SearchBeforeEpoch || m_autoAdjustMinibatch ||
+            (m_autoLearnRateSearchType == LearningRateSearchAlgorithm::AdjustAfterEpoch && m_loadBestModel))
+        {
+            WaitForCheckPoint();
+        }
+
         // Synchronize all ranks before proceeding to ensure that
         // rank 0 has finished writing the previous model file
         if (g_mpi != nullptr)
@@ -431,7 +457,8 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                       evaluationNodes,
                       inputMatrices,
                       learnableNodes, smoothedGradients,
-                      epochCriterion, epochEvalErrors, totalSamplesSeen);
+                      epochCriterion, epochEvalErrors, totalSamplesSeen,
+                      "", &prevCriterion);
 
         timer.Stop();
         double epochTime = timer.ElapsedSeconds();
@@ -628,10 +655,13 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
         // persist model and check-point info
         if ((g_mpi == nullptr) || g_mpi->IsMainNode())
         {
-            SaveCheckPointInfo(i, totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion, chosenMinibatchSize);
-            auto modelName = GetModelNameForEpoch(i);
-            fprintf(stderr, "SGD: Saving checkpoint model '%ls'\n", modelName.c_str());
-            net->Save(modelName);
+            // files that are superseded once the new checkpoint is complete
+            std::vector<wstring> filesToDelete;
+            if (m_checkpointIntervalSamples > 0)
+            {
+                filesToDelete.push_back(GetMidEpochModelName(i));
+                filesToDelete.push_back(GetMidEpochModelName(i) + L".ckp");
+            }
             if (!m_keepCheckPointFiles)
             {
                 // delete previous checkpoint file to save space
@@ -639,18 +669,22 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                 {
                     if (epochsSinceLastLearnRateAdjust != 1)
                     {
-                        _wunlink(GetCheckPointFileNameForEpoch(i - 1).c_str());
+                        filesToDelete.push_back(GetCheckPointFileNameForEpoch(i - 1));
                     }
                     if (epochsSinceLastLearnRateAdjust == m_learnRateAdjustInterval)
                     {
-                        _wunlink(GetCheckPointFileNameForEpoch(i - m_learnRateAdjustInterval).c_str());
+                        filesToDelete.push_back(GetCheckPointFileNameForEpoch(i - m_learnRateAdjustInterval));
                     }
                 }
                 else
                 {
-                    _wunlink(GetCheckPointFileNameForEpoch(i - 1).c_str());
+                    filesToDelete.push_back(GetCheckPointFileNameForEpoch(i - 1));
                 }
             }
+
+            auto modelName = GetModelNameForEpoch(i);
+            fprintf(stderr, "SGD: Saving checkpoint model '%ls'\n", modelName.c_str());
+            SaveCheckPoint(net, modelName, GetCheckPointFileNameForEpoch(i), totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion, chosenMinibatchSize, filesToDelete);
         }
 
         if (learnRatePerSample < 1e-12)
@@ -661,6 +695,8 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
     }
     // --- END OF MAIN EPOCH LOOP
 
+    WaitForCheckPoint();
+
     // Synchronize all ranks before proceeding to ensure that
     // rank 0 has finished writing the model file
     if (g_mpi != nullptr)
@@ -710,7 +746,8 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
                                     /*out*/ double& epochCriterion,
                                     /*out*/ std::vector<double>& epochEvalErrors,
                                     /*out*/ size_t& totalSamplesSeen,
-                                    std::string prefixMsg)
+                                    std::string prefixMsg,
+                                    const double* prevCriterion)
 {
     double totalTimeInMBs = 0; // use double since timer has sub-microsecond time resolution
     double epochCriterionLastMBs = 0;
@@ -756,6 +793,9 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
     // resetting this, so profiling is performed for one epoch only
     m_numMBsToCUDAProfile = 0;
 
+    NodeProfiler::Enable(m_profileNodes, m_nodeProfileTraceFile);
+    NodeProfiler::Reset();
+
     bool useDistributedMBReading = useParallelTrain &&
                                    m_enableDistributedMBReading &&
                                    trainSetDataReader->SupportsDistributedMBRead();
@@ -799,6 +839,12 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
     if (numSubminibatchesNeeded > 1)
         smbDispatcher.Init(net, learnableNodes, criterionNodes, evaluationNodes);
 
+    // parameters with a sparse gradient on the CPU (e.g. embedding tables with a sparse input) are updated lazily,
+    // touching only the columns each minibatch uses
+    std::map<ComputationNodeBasePtr, shared_ptr<LazySparseUpdater<ElemType>>> lazySparseUpdaters;
+    if (!useParallelTrain)
+        CreateLazySparseUpdaters(net, featureNodes, learnableNodes, smoothedGradients, lazySparseUpdaters);
+
     // The following is a special feature only supported by the Kaldi2Reader for more efficient sequence training.
     // This attemps to compute the error signal for the whole utterance, which will
     // be fed to the neural network as features. Currently it is a workaround
@@ -899,6 +945,10 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
                     ComputationNetwork::BumpEvalTimeStamp(labelNodes);
                 }
 
+                // columns of lazily updated parameters that this (sub-)minibatch reads must be brought up to date first
+                for (auto& updater : lazySparseUpdaters)
+                    updater.second->CatchUpReadColumns();
+
                 // ===========================================================
                 // forward prop for evaluate eval nodes
                 // ===========================================================
@@ -918,7 +968,19 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
                 // ===========================================================
 
                 if (learnRatePerSample > 0.01 * m_minLearnRate) // only compute gradient when learning rate is large enough
-                    net->Backprop(criterionNodes[0]);
+                {
+                    // with data-parallel training, let the aggregator start reducing gradients while backprop is still running
+                    ComputationNetwork::GradientCompleteCallback onGradientComplete;
+                    if (useGradientAggregation && actualNumSubminibatches == 1)
+                    {
+                        onGradientComplete = [this](const ComputationNodeBasePtr& node)
+                        {
+                            if (node->IsParameterUpdateRequired())
+                                m_distGradAgg->OnGradientComputed(&dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Gradient());
+                        };
+                    }
+                    net->Backprop(criterionNodes[0], onGradientComplete);
+                }
 
                 // house-keeping for sub-minibatching
                 if (actualNumSubminibatches > 1)
@@ -1009,10 +1071,12 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
                     if (smoothedGradient.HasNan("TrainOneEpoch/UpdateWeights(): "))
                         LogicError("%ls %ls operation has NaNs in smoothedGradient.", node->NodeName().c_str(), node->OperationName().c_str());
 #endif
+                    auto lazySparseUpdater = lazySparseUpdaters.find(node);
                     UpdateWeights(node, smoothedGradient, learnRatePerSample,
                                   GetMomentumPerSample(epochNumber /*BUGBUG workaround:*/, net->GetMBLayoutPtr()->GetNumParallelSequences()), aggregateNumSamples,
                                   m_L2RegWeight, m_L1RegWeight,
-                                  m_needAveMultiplier, m_useNesterovMomentum);
+                                  m_needAveMultiplier, m_useNesterovMomentum,
+                                  lazySparseUpdater != lazySparseUpdaters.end() ? lazySparseUpdater->second.get() : nullptr);
 #ifdef _DEBUG
                     if (dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value().HasNan("TrainOneEpoch/UpdateWeights(): "))
                         LogicError("%ls %ls operation has NaNs in functionValues after parameter update.", node->NodeName().c_str(), node->OperationName().c_str());
@@ -1170,6 +1234,23 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
         totalEpochSamples += aggregateNumSamplesWithLabel;
         totalSamplesSeen += aggregateNumSamplesWithLabel;
 
+        // mid-epoch checkpoint each time another m_checkpointIntervalSamples samples have been processed
+        // The condition depends on aggregated sample counts only, so all workers agree on it. All of them flush the
+        // lazy updates, since the workers' models must stay identical; only the main node saves.
+        bool midEpochCheckpoint = prevCriterion && m_checkpointIntervalSamples > 0 &&
+                                  totalEpochSamples / m_checkpointIntervalSamples != (totalEpochSamples - aggregateNumSamplesWithLabel) / m_checkpointIntervalSamples;
+        if (midEpochCheckpoint)
+        {
+            for (auto& updater : lazySparseUpdaters)
+                updater.second->Flush();
+        }
+        if (midEpochCheckpoint && ((g_mpi == nullptr) || g_mpi->IsMainNode()))
+        {
+            auto modelName = GetMidEpochModelName(epochNumber);
+            fprintf(stderr, "SGD: Saving mid-epoch checkpoint model '%ls' after %d samples\n", modelName.c_str(), (int) totalEpochSamples);
+            SaveCheckPoint(net, modelName, modelName + L".ckp", totalSamplesSeen, learnRatePerSample, smoothedGradients, *prevCriterion, tunedMBSize, std::vector<wstring>());
+        }
+
         // call DataEnd function
         // This signals something from SGD to the reader.
         // DataEnd does reader specific process if sentence ending is reached
@@ -1183,10 +1264,27 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
         AttemptUtteranceDerivativeFeatures(net, trainSetDataReader, featureNodes, inputMatrices);
 
         profiler.NextSample();
+
+        if (m_profileNodes && m_numMBsToShowNodeProfile > 0 && numMBsRun % m_numMBsToShowNodeProfile == 0)
+        {
+            NodeProfiler::PrintReport(stderr, m_numNodesInNodeProfile);
+            NodeProfiler::Reset();
+        }
     }
 
     // --- END MAIN MINIBATCH LOOP
 
+    // apply the momentum updates deferred by the lazy updaters, so that the model is the one the dense update gives
+    for (auto& updater : lazySparseUpdaters)
+        updater.second->Flush();
+
+    if (m_profileNodes)
+    {
+        NodeProfiler::PrintReport(stderr, m_numNodesInNodeProfile);
+        NodeProfiler::Reset();
+        NodeProfiler::WriteTrace();
+    }
+
     if (useModelAveraging && (g_mpi->NumNodesInUse() > 1))
     {
         // may not be synced after epoch finished, so do the sync here
@@ -1842,10 +1940,14 @@ void SGD<ElemType>::InitDistGradAgg(int numEvalNodes, int traceLevel)
 #else
             if (m_numGradientBits != (8 * sizeof(ElemType)))
             {
-                RuntimeError("Gradient quantization is unsupported in CNTK binaries built without quantized gradient aggregation support!");
-            }
+                // without 1-bit SGD, fall back to CPU-side quantization (CPU gradients only)
+                if (m_bufferedAsyncGradientAggregation)
+                    fprintf(stderr, "WARNING: useBufferedAsyncGradientAggregation is not supported by quantized gradient aggregation in this build and is ignored.\n");
 
-            m_distGradAgg = new SimpleDistGradAggregator<ElemType>(g_mpi, m_bufferedAsyncGradientAggregation, m_syncStatsTrace);
+                m_distGradAgg = new QuantizedDistGradAggregator<ElemType>(g_mpi, m_numGradientBits, m_zeroThresholdFor1Bit, traceLevel, m_syncStatsTrace);
+            }
+            else
+                m_distGradAgg = new SimpleDistGradAggregator<ElemType>(g_mpi, m_bufferedAsyncGradientAggregation, m_syncStatsTrace, m_gradientBucketSizeInBytes, m_allReduceAlgorithm);
 #endif // !QUANTIZED_GRADIENT_AGGREGATION
         }
 
@@ -1928,34 +2030,23 @@ size_t SGD<ElemType>::ModelAveragingSync(int nSamplesSinceLastSync, const std::l
 
     // ========================================
     // Sec. 2 sync models based on factor
-    // Note: this is suboptimal at the moment:
-    //       we do the averaging for each node in a sequence manner, i.e.,
-    //          (node1) GPU->CPU->MPI_AllReduce -> (node2)GPU->CPU->MPI_AllReduce
-    //       we can improve it by using a pipeline
-    //          (node1) GPU ->  CPU  ->  MPI_AllReduce
-    //          (node2)         GPU  ->  CPU            -> MPI_AllReduce
-    //          (node3)                  GPU            -> CPU              -> MPI_AllReduce
+    // The parameters are packed into a few large buckets whose
+    // copy-out, MPI_Iallreduce and copy-in are pipelined (see ModelAverager.h)
     // ========================================
+    std::vector<Matrix<ElemType>*> models;
     for (auto iter = learnableNodes.begin(); iter != learnableNodes.end(); iter++)
     {
         ComputationNodeBasePtr pNode = *iter;
         if (!pNode->IsParameterUpdateRequired())
             continue;
 
-        Matrix<ElemType>& mat = dynamic_pointer_cast<ComputationNode<ElemType>>(pNode)->Value();
-        // 1. normalize the weight matrix
-        Matrix<ElemType>::Scale(factor, mat);
-        // 2. send weight matrix over MPI nodes;
-        ElemType* px = mat.CopyToArray();
-        size_t nx = mat.GetNumElements();
-
-        // 3. inplace sum
-        g_mpi->AllReduce(px, nx);
-        mat.SetValue(mat.GetNumRows(), mat.GetNumCols(), mat.GetDeviceId(), px);
-        // 4. clean up
-        delete[] px;
+        models.push_back(&dynamic_pointer_cast<ComputationNode<ElemType>>(pNode)->Value());
     }
 
+    if (!m_modelAverager)
+        m_modelAverager = make_shared<ModelAverager<ElemType>>(g_mpi, m_nMASyncBucketSizeInBytes);
+    m_modelAverager->Average(models, (ElemType) factor);
+
     return nTotalSamples;
 }
 
@@ -1972,7 +2063,8 @@ template <class ElemType>
                                               const double L2RegWeight,
                                               const double L1RegWeight,
                                               const bool needAveMultiplier,
-                                              const bool useNesterovMomentum)
+                                              const bool useNesterovMomentum,
+                                              LazySparseUpdater<ElemType>* lazySparseUpdater)
 {
     // we use simple linear (instead of log linear) scaling here
     const double momentum = MomentumPerMB(momentumPerSample, actualMBSize);
@@ -2012,8 +2104,11 @@ template <class ElemType>
 
     if (adpType == GradientsUpdateType::None)
     {
-        smoothedGradient.NormalGrad(gradientValues, functionValues,
-                                    (ElemType) learnRatePerSample, (ElemType) momentum, useNesterovMomentum);
+        if (lazySparseUpdater)
+            lazySparseUpdater->NormalGrad(gradientValues, (ElemType) learnRatePerSample, (ElemType) momentum);
+        else
+            smoothedGradient.NormalGrad(gradientValues, functionValues,
+                                        (ElemType) learnRatePerSample, (ElemType) momentum, useNesterovMomentum);
     }
     else if (adpType == GradientsUpdateType::AdaGrad ||
              (adpType == GradientsUpdateType::RmsProp && gradientValues.GetMatrixType() == MatrixType::SPARSE) ||
@@ -2021,7 +2116,8 @@ template <class ElemType>
     {
         // rmsprop for sparse is not implemented yet, delegate it with adagrad
 
-        double aveMultiplier = smoothedGradient.Adagrad(gradientValues, needAveMultiplier);
+        double aveMultiplier = lazySparseUpdater && adpType == GradientsUpdateType::AdaGrad ? lazySparseUpdater->Adagrad(gradientValues, needAveMultiplier)
+                                                                                            : smoothedGradient.Adagrad(gradientValues, needAveMultiplier);
         Matrix<ElemType>::ScaleAndAdd((ElemType)(-learnRatePerSample / aveMultiplier), gradientValues, functionValues);
     }
     else if (adpType == GradientsUpdateType::FSAdaGrad)
@@ -2064,7 +2160,8 @@ void SGD<ElemType>::UpdateWeights(const ComputationNodeBasePtr& node,
                                   const size_t actualMBSize,
                                   const double L2RegWeight, const double L1RegWeight,
                                   const bool needAveMultiplier,
-                                  const bool useNesterovMomentum) const
+                                  const bool useNesterovMomentum,
+                                  LazySparseUpdater<ElemType>* lazySparseUpdater) const
 {
 #if DUMPOUTPUT
     fprintf(stderr, "Update_%ls\n", node->NodeName().c_str());
@@ -2075,10 +2172,58 @@ void SGD<ElemType>::UpdateWeights(const ComputationNodeBasePtr& node,
     UpdateWeightsS(this, dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value(), dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Gradient(),
                    smoothedGradient, learnRatePerSample, momentumPerSample,
                    actualMBSize, L2RegWeight, L1RegWeight,
-                   needAveMultiplier, m_useNesterovMomentum);
+                   needAveMultiplier, m_useNesterovMomentum, lazySparseUpdater);
     node->BumpEvalTimeStamp();
 }
 
+// CreateLazySparseUpdaters - set up lazy updates for the learnable parameters that get a sparse block-column gradient on the CPU,
+// i.e. those used as the left input of a LookupTable or Times node whose right input is a sparse feature
+template <class ElemType>
+void SGD<ElemType>::CreateLazySparseUpdaters(const ComputationNetworkPtr& net,
+                                             const std::vector<ComputationNodeBasePtr>& featureNodes,
+                                             const std::list<ComputationNodeBasePtr>& learnableNodes,
+                                             std::list<Matrix<ElemType>>& smoothedGradients,
+                                             std::map<ComputationNodeBasePtr, shared_ptr<LazySparseUpdater<ElemType>>>& lazySparseUpdaters) const
+{
+    // the lazy updates equal the dense ones only if nothing else touches all weights in each minibatch
+    GradientsUpdateType adpType = GradUpdateType();
+    if ((adpType != GradientsUpdateType::None && adpType != GradientsUpdateType::AdaGrad) ||
+        m_L2RegWeight > 0 || m_L1RegWeight > 0 || GradientUpdateNoiseStd() > 0 || m_doGradientCheck)
+        return;
+
+    const auto allNodes = net->GetAllNodes();
+    auto smoothedGradientIter = smoothedGradients.begin();
+    for (auto nodeIter = learnableNodes.begin(); nodeIter != learnableNodes.end(); nodeIter++, smoothedGradientIter++)
+    {
+        ComputationNodePtr node = dynamic_pointer_cast<ComputationNode<ElemType>>(*nodeIter);
+        if (!node->IsParameterUpdateRequired() || node->Value().GetDeviceId() != CPUDEVICE)
+            continue;
+
+        std::vector<const Matrix<ElemType>*> sparseInputs;
+        bool readsAllColumns = false;
+        for (const auto& consumer : allNodes)
+        {
+            for (size_t i = 0; i < consumer->GetNumInputs(); i++)
+            {
+                if (consumer->Input(i) != *nodeIter)
+                    continue;
+
+                bool isSparseLookup = i == 0 && consumer->GetNumInputs() == 2 &&
+                                      (consumer->OperationName() == OperationNameOf(LookupTableNode) || consumer->OperationName() == OperationNameOf(TimesNode)) &&
+                                      std::find(featureNodes.begin(), featureNodes.end(), consumer->Input(1)) != featureNodes.end() &&
+                                      dynamic_pointer_cast<ComputationNode<ElemType>>(consumer->Input(1))->Value().GetMatrixType() == SPARSE;
+                if (isSparseLookup)
+                    sparseInputs.push_back(&dynamic_pointer_cast<ComputationNode<ElemType>>(consumer->Input(1))->Value());
+                else
+                    readsAllColumns = true;
+            }
+        }
+
+        if (!sparseInputs.empty())
+            lazySparseUpdaters[*nodeIter] = make_shared<LazySparseUpdater<ElemType>>(node->Value(), *smoothedGradientIter, sparseInputs, readsAllColumns, m_useNesterovMomentum);
+    }
+}
+
 template <class ElemType>
 void SGD<ElemType>::ClipGradient(Matrix<ElemType>& gradient, const size_t actualMBSize) const
 {
@@ -2101,7 +2246,7 @@ void SGD<ElemType>::ClipGradient(Matrix<ElemType>& gradient, const size_t actual
 }
 
 template <class ElemType>
-void SGD<ElemType>::SaveCheckPointInfo(const size_t epoch, const size_t totalSamplesSeen,
+void SGD<ElemType>::SaveCheckPointInfo(const wstring& checkPointFileName, const size_t totalSamplesSeen,
                                        const double learnRatePerSample,
                                        const std::list<Matrix<ElemType>>& smoothedGradients,
                                        const double prevCriterion,
@@ -2111,41 +2256,105 @@ void SGD<ElemType>::SaveCheckPointInfo(const size_t epoch, const size_t totalSam
     // the parallel training nodes from colliding to write the same file
     if ((g_mpi == nullptr) || g_mpi->IsMainNode())
     {
-        wstring checkPointFileName = GetCheckPointFileNameForEpoch(int(epoch));
         // Saving into temporary file and then renaming it to the checkPointFileName
         // This is a standard trick to avoid havign corrupted checkpoints files if process dies during writing
         wstring tempFileName = checkPointFileName + L".tmp";
 
         {
             File fstream(tempFileName, FileOptions::fileOptionsBinary | FileOptions::fileOptionsWrite);
-            fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BCKP");
+            SaveCheckPointInfo(fstream, totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion, minibatchSize);
 
-            fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BLearnRate");
-            fstream << totalSamplesSeen << learnRatePerSample << prevCriterion;
-            fstream.PutMarker(FileMarker::fileMarkerEndSection, L"ELearnRate");
+            // Ensuring that data is written
+            fstream.Flush();
+        }
 
-            fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BMinibatchSize");
-            fstream << minibatchSize;
-            fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EMinibatchSize");
+        renameOrDie(tempFileName, checkPointFileName);
+    }
+}
 
-            fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BGradient");
+template <class ElemType>
+void SGD<ElemType>::SaveCheckPointInfo(File& fstream, const size_t totalSamplesSeen,
+                                       const double learnRatePerSample,
+                                       const std::list<Matrix<ElemType>>& smoothedGradients,
+                                       const double prevCriterion,
+                                       const size_t minibatchSize)
+{
+    fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BCKP");
 
-            for (auto smoothedGradientIter = smoothedGradients.begin(); smoothedGradientIter != smoothedGradients.end(); smoothedGradientIter++)
-            {
-                const Matrix<ElemType>& smoothedGradient = *smoothedGradientIter;
-                fstream << smoothedGradient;
-            }
+    fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BLearnRate");
+    fstream << totalSamplesSeen << learnRatePerSample << prevCriterion;
+    fstream.PutMarker(FileMarker::fileMarkerEndSection, L"ELearnRate");
 
-            fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EGradient");
+    fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BMinibatchSize");
+    fstream << minibatchSize;
+    fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EMinibatchSize");
 
-            fstream.PutMarker(FileMarker::fileMarkerEndSection, L"ECKP");
+    fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BGradient");
 
-            // Ensuring that data is written
-            fstream.Flush();
-        }
+    for (auto smoothedGradientIter = smoothedGradients.begin(); smoothedGradientIter != smoothedGradients.end(); smoothedGradientIter++)
+    {
+        const Matrix<ElemType>& smoothedGradient = *smoothedGradientIter;
+        fstream << smoothedGradient;
+    }
 
-        renameOrDie(tempFileName, checkPointFileName);
+    fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EGradient");
+
+    fstream.PutMarker(FileMarker::fileMarkerEndSection, L"ECKP");
+}
+
+template <class ElemType>
+void SGD<ElemType>::SaveCheckPoint(ComputationNetworkPtr net, const wstring& modelFileName, const wstring& checkPointFileName,
+                                   const size_t totalSamplesSeen,
+                                   const double learnRatePerSample,
+                                   const std::list<Matrix<ElemType>>& smoothedGradients,
+                                   const double prevCriterion,
+                                   const size_t minibatchSize,
+                                   const std::vector<wstring>& filesToDelete)
+{
+    if (!m_asyncCheckpointing)
+    {
+        SaveCheckPointInfo(checkPointFileName, totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion, minibatchSize);
+        net->Save(modelFileName);
+        for (const auto& fileName : filesToDelete)
+            _wunlink(fileName.c_str());
+        return;
+    }
+
+    // only one checkpoint is held in memory at a time
+    WaitForCheckPoint();
+
+    // serialize the checkpoint info and the model into memory, so that they show the state at this point...
+    bool isMainNode = (g_mpi == nullptr) || g_mpi->IsMainNode();
+    auto checkPointInfo = make_shared<std::vector<char>>();
+    auto model = make_shared<std::vector<char>>();
+    if (isMainNode)
+    {
+        File fstream(FileOptions::fileOptionsBinary | FileOptions::fileOptionsWrite);
+        SaveCheckPointInfo(fstream, totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion, minibatchSize);
+        *checkPointInfo = fstream.GetBuffer();
+        *model = net->SaveToBuffer();
     }
+
+    // ...and write the files while training continues
+    if (!m_checkpointWriter)
+        m_checkpointWriter = make_shared<AsyncCheckpointWriter>();
+    m_checkpointWriter->Start([=]()
+    {
+        if (isMainNode)
+        {
+            AsyncCheckpointWriter::WriteFile(checkPointFileName, *checkPointInfo);
+            AsyncCheckpointWriter::WriteFile(modelFileName, *model);
+        }
+        for (const auto& fileName : filesToDelete)
+            _wunlink(fileName.c_str());
+    });
+}
+
+template <class ElemType>
+void SGD<ElemType>::WaitForCheckPoint()
+{
+    if (m_checkpointWriter)
+        m_checkpointWriter->Wait();
 }
 
 template <class ElemType>
@@ -2201,6 +2410,14 @@ wstring SGD<ElemType>::GetCheckPointFileNameForEpoch(const int epoch)
     return GetModelNameForEpoch(epoch) + L".ckp";
 }
 
+// checkpoint saved within an epoch every m_checkpointIntervalSamples samples; it is for recovery by hand, as the reader
+// position within the epoch is not saved, and is deleted once the checkpoint of the full epoch is complete
+template <class ElemType>
+wstring SGD<ElemType>::GetMidEpochModelName(const int epoch)
+{
+    return GetModelNameForEpoch(epoch) + L".partial";
+}
+
 template <class ElemType>
 wstring SGD<ElemType>::GetModelNameForEpoch(const int epoch, bool bLastModel)
 {
@@ -2461,6 +2678,11 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
     m_traceLevel = configSGD(L"traceLevel", (int) 0);
     m_numMBsToShowResult = configSGD(L"numMBsToShowResult", (size_t) 10);
     m_numMBsToCUDAProfile = configSGD(L"numMBsToCUDAProfile", (size_t) 0);
+    m_profileNodes = configSGD(L"profileNodes", false);
+    m_numMBsToShowNodeProfile = configSGD(L"numMBsToShowNodeProfile", (size_t) 100);
+    m_numNodesInNodeProfile = configSGD(L"numNodesInNodeProfile", (size_t) 20);
+    m_nodeProfileTraceFile = (wstring) configSGD(L"nodeProfileTraceFile", L"");
+    m_numNodeExecutionThreads = configSGD(L"numNodeExecutionThreads", (size_t) 1);
 
     m_gradientClippingWithTruncation = configSGD(L"gradientClippingWithTruncation", true);
     m_clippingThresholdPerSample = configSGD(L"clippingThresholdPerSample", numeric_limits<double>::infinity());
@@ -2617,9 +2839,12 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
     m_numGradientBits = 32;
     m_zeroThresholdFor1Bit = true;
     m_bufferedAsyncGradientAggregation = false;
+    m_gradientBucketSizeInBytes = 8 * 1024 * 1024;
+    m_allReduceAlgorithm = AllReduceAlgorithm::MPI;
     m_enableDistributedMBReading = false;
     m_parallelizationStartEpochNum = 0;
     m_nFramesBetweenMASync = 40000; // default 40k frames
+    m_nMASyncBucketSizeInBytes = 8 * 1024 * 1024;
 
     if ((g_mpi != nullptr) && configSGD.Exists(L"ParallelTrain"))
     {
@@ -2636,6 +2861,8 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
             m_numGradientBits = configDataParallelSGD(L"gradientBits", defaultGradientBits);
             m_zeroThresholdFor1Bit = configDataParallelSGD(L"useZeroThresholdFor1BitQuantization", true);
             m_bufferedAsyncGradientAggregation = configDataParallelSGD(L"useBufferedAsyncGradientAggregation", false);
+            m_gradientBucketSizeInBytes = configDataParallelSGD(L"gradientBucketSizeInMB", (size_t) 8) * 1024 * 1024;
+            m_allReduceAlgorithm = ParseAllReduceAlgorithm(configDataParallelSGD(L"allReduceAlgorithm", L"mpi"));
             if ((m_numGradientBits < 1) || (m_numGradientBits > (8 * sizeofElemType)))
             {
                 InvalidArgument("gradientBits must be in the range [1, 32] when using precision=float and in range [1, 64] when using precision=double!");
@@ -2646,6 +2873,9 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
         {
             const ConfigRecordType& configMASGD(configParallelTrain(L"ModelAveragingSGD", ConfigRecordType::Record()));
             m_nFramesBetweenMASync = configMASGD(L"syncFrequencyInFrames", (size_t) 40000);
+            m_nMASyncBucketSizeInBytes = configMASGD(L"syncBucketSizeInMB", (size_t) 8) * 1024 * 1024;
+            if (m_nMASyncBucketSizeInBytes == 0)
+                InvalidArgument("syncBucketSizeInMB must be greater than 0.");
         }
     }
 }
@@ -17,6 +17,8 @@
 #include <chrono>
 #include <random>
 #include "Profiler.h"
+#include "NodeProfiler.h"
+#include "NonBlockingAllReduce.h"
 
 using namespace std; // ugh! TODO: get rid of this from .h files!!!
 
@@ -212,6 +214,14 @@ protected:
     int m_numMBsToShowResult;
     int m_numMBsToCUDAProfile;
 
+    // per-node profiling (see NodeProfiler)
+    bool m_profileNodes;
+    size_t m_numMBsToShowNodeProfile;    // print the hot-node table every this many MBs (0: only at end of epoch)
+    size_t m_numNodesInNodeProfile;      // number of nodes in the table
+    std::wstring m_nodeProfileTraceFile; // if not empty, write a Chrome-trace timeline here
+
+    size_t m_numNodeExecutionThreads; // run independent nodes concurrently on this many threads (CPU only, see ComputationNetwork::SetNumNodeExecutionThreads())
+
     bool m_doGradientCheck;
     double m_gradientCheckSigDigit;
 
@@ -234,9 +244,12 @@ protected:
     int m_numGradientBits;
     bool m_bufferedAsyncGradientAggregation;
     bool m_zeroThresholdFor1Bit;
+    size_t m_gradientBucketSizeInBytes; // gradients are fused into buckets of this size for aggregation (0: one per gradient)
+    AllReduceAlgorithm m_allReduceAlgorithm;
 
     // Parallel training related with MA
     size_t m_nFramesBetweenMASync;
+    size_t m_nMASyncBucketSizeInBytes;
 
     bool m_needAveMultiplier;
     double m_L2RegWeight;
@@ -256,6 +269,14 @@ protected:
 template <class ElemType>
 class IDistGradAggregator;
 
+template <class ElemType>
+class ModelAverager;
+
+template <class ElemType>
+class LazySparseUpdater;
+
+class AsyncCheckpointWriter;
+
 // -----------------------------------------------------------------------
 // class SGD
 // -----------------------------------------------------------------------
@@ -277,6 +298,8 @@ public:
           // TODO: The next few do not belong into SGD any more than the network or reader we operate on. Either move network and reader in here, or move these out.
           m_modelPath((const wstring&) configSGD(L"modelPath")),
           m_keepCheckPointFiles(configSGD(L"keepCheckPointFiles", false)),
+          m_asyncCheckpointing(configSGD(L"asyncCheckpointing", false)),
+          m_checkpointIntervalSamples(configSGD(L"checkpointIntervalSamples", (size_t) 0)),
           // m_validateAfterModelReloading(configSGD(L"validateAfterModelReloading", true)),
           m_trainCriterionNodeName((const wstring&) configSGD(L"trainCriterionNodeName", L"")),
           m_evalCriterionNodeName((const wstring&) configSGD(L"evalCriterionNodeName", L"")),
@@ -422,7 +445,8 @@ protected:
                          /*out*/ double& epochCriterion,
                          /*out*/ std::vector<double>& epochEvalErrors,
                          /*out*/ size_t& totalSamplesSeen,
-                         std::string prefixMsg = "");
+                         std::string prefixMsg = "",
+                         const double* prevCriterion = nullptr); // if given, mid-epoch checkpoints are saved (m_checkpointIntervalSamples)
 
     void InitDistGradAgg(int numEvalNodes, int traceLevel);
 
@@ -442,7 +466,8 @@ public:
                                const double L2RegWeight,
                                const double L1RegWeight,
                                const bool needAveMultiplier,
-                               const bool useNesterovMomentum);
+                               const bool useNesterovMomentum,
+                               LazySparseUpdater<ElemType>* lazySparseUpdater = nullptr);
 
 protected:
     // UpdateWeights - update the weights in
@@ -453,15 +478,39 @@ protected:
                        const size_t actualMBSize,
                        const double L2RegWeight, const double L1RegWeight,
                        const bool needAveMultiplier,
-                       const bool useNesterovMomentum) const;
+                       const bool useNesterovMomentum,
+                       LazySparseUpdater<ElemType>* lazySparseUpdater = nullptr) const;
+
+    void CreateLazySparseUpdaters(const ComputationNetworkPtr& net,
+                                  const std::vector<ComputationNodeBasePtr>& featureNodes,
+                                  const std::list<ComputationNodeBasePtr>& learnableNodes,
+                                  std::list<Matrix<ElemType>>& smoothedGradients,
+                                  std::map<ComputationNodeBasePtr, shared_ptr<LazySparseUpdater<ElemType>>>& lazySparseUpdaters) const;
 
     void ClipGradient(Matrix<ElemType>& gradient, const size_t actualMBSize) const;
 
-    void SaveCheckPointInfo(const size_t epoch, const size_t totalSamplesSeen,
-                            const double learnRatePerSample,
-                            const std::list<Matrix<ElemType>>& smoothedGradients,
-                            const double prevCriterion,
-                            const size_t minibatchSize);
+    static void SaveCheckPointInfo(const wstring& checkPointFileName, const size_t totalSamplesSeen,
+                                   const double learnRatePerSample,
+                                   const std::list<Matrix<ElemType>>& smoothedGradients,
+                                   const double prevCriterion,
+                                   const size_t minibatchSize);
+    static void SaveCheckPointInfo(File& fstream, const size_t totalSamplesSeen,
+                                   const double learnRatePerSample,
+                                   const std::list<Matrix<ElemType>>& smoothedGradients,
+                                   const double prevCriterion,
+                                   const size_t minibatchSize);
+
+    // save the checkpoint info and the model, and then delete 'filesToDelete'; with m_asyncCheckpointing, both are
+    // serialized into memory here, and the files are written and deleted on a background thread
+    void SaveCheckPoint(ComputationNetworkPtr net, const wstring& modelFileName, const wstring& checkPointFileName,
+                        const size_t totalSamplesSeen,
+                        const double learnRatePerSample,
+                        const std::list<Matrix<ElemType>>& smoothedGradients,
+                        const double prevCriterion,
+                        const size_t minibatchSize,
+                        const std::vector<wstring>& filesToDelete);
+    // wait for the checkpoint being written in the background, if any
+    void WaitForCheckPoint();
 
     bool LoadCheckPointInfo(const size_t epochNumber,
                             /*out*/ size_t& totalSamplesSeen,
@@ -472,6 +521,7 @@ protected:
 
     wstring GetCheckPointFileNameForEpoch(const int epoch);
     wstring GetModelNameForEpoch(const int epoch, bool bLastModel = false);
+    wstring GetMidEpochModelName(const int epoch);
 
     // return -1 if nothing exists
     int DetermineStartEpoch(const bool makeMode);
@@ -496,6 +546,8 @@ public:
 protected:
     wstring m_modelPath;
     bool m_keepCheckPointFiles;
+    bool m_asyncCheckpointing;          // write checkpoints on a background thread while training continues
+    size_t m_checkpointIntervalSamples; // additionally save a checkpoint every this many samples within an epoch (0: only at the end of each epoch)
     // bool m_validateAfterModelReloading; // TODO: remove this. Why would one not validate a model?
 
     wstring m_trainCriterionNodeName;
@@ -507,6 +559,9 @@ protected:
     IDistGradAggregator<ElemType>* m_distGradAgg;
     struct DistGradHeader* m_gradHeader;
 
+    shared_ptr<ModelAverager<ElemType>> m_modelAverager;
+    shared_ptr<AsyncCheckpointWriter> m_checkpointWriter;
+
 private:
     int SGDTrace(FILE* __restrict __stream, const char* __restrict __format, ...);
 };
@@ -1,21 +1,30 @@
 #pragma once
 
 #include "IDistGradAggregator.h"
+#include "MatrixQuantizerImpl.h"
 #include "CUDAPageLockedMemAllocator.h"
 #include <future>
 #include "GPUDataTransferer.h"
 #include "TimerUtility.h"
+#include "NonBlockingAllReduce.h"
+#include <unordered_map>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// The gradients are fused into buckets of up to bucketSizeInBytes (0: one bucket per gradient matrix), which
+// are laid out in reverse order of the gradient list, i.e. roughly in the order backprop completes them.
+// Unless async aggregation is used, a bucket is sent off as soon as OnGradientComputed() has been called for
+// all of its gradients, so that its reduction overlaps with the remainder of backprop.
 template <class ElemType>
 class SimpleDistGradAggregator : public IDistGradAggregator<ElemType>
 {
     UsingIDistGradAggregatorMembers;
 
 public:
-    SimpleDistGradAggregator(MPIWrapper* mpi, bool useAsyncAggregation, int syncStatsTrace)
-        : IDistGradAggregator<ElemType>(mpi), m_useAsyncAggregation(useAsyncAggregation), m_currentEpochNumber(-1), m_bufferedGradHeader(nullptr), m_syncStatsTrace(syncStatsTrace), m_iterationCount(0)
+    SimpleDistGradAggregator(MPIWrapper* mpi, bool useAsyncAggregation, int syncStatsTrace,
+                             size_t bucketSizeInBytes = 0, AllReduceAlgorithm allReduceAlgorithm = AllReduceAlgorithm::MPI)
+        : IDistGradAggregator<ElemType>(mpi), m_useAsyncAggregation(useAsyncAggregation), m_currentEpochNumber(-1), m_bufferedGradHeader(nullptr), m_syncStatsTrace(syncStatsTrace), m_iterationCount(0),
+          m_bucketSize(bucketSizeInBytes / sizeof(ElemType)), m_allReduceAlgorithm(allReduceAlgorithm), m_numBucketsLaunched(0)
     {
     }
 
@@ -121,7 +130,187 @@ public:
         }
     }
 
+    void OnGradientComputed(Matrix<ElemType>* gradient) override
+    {
+        // with async aggregation the gradients being computed are not the ones being aggregated
+        if (m_useAsyncAggregation)
+            return;
+
+        auto iter = m_bucketsOfGradient.find(gradient);
+        if (iter == m_bucketsOfGradient.end()) // not (yet) known, e.g. during the first minibatch
+            return;
+
+        for (size_t i : iter->second)
+        {
+            if (m_buckets[i].numPendingGradients > 0)
+                m_buckets[i].numPendingGradients--;
+        }
+
+        LaunchBuckets(/*all=*/false, /*duringBackprop=*/true);
+        ProgressBuckets();
+    }
+
 private:
+    // a contiguous range of one gradient matrix, placed at bufferOffset in its bucket
+    struct Slice
+    {
+        Matrix<ElemType>* matrix;
+        size_t matrixOffset;
+        size_t bufferOffset;
+        size_t numElements;
+    };
+
+    enum class BucketState
+    {
+        Idle,
+        CopyingOut, // GPU->CPU transfer queued, reduction not started yet
+        Reducing,
+        Done
+    };
+
+    struct GradientBucket
+    {
+        std::vector<Slice> slices;
+        size_t numElements;
+        size_t numGradients;
+        size_t numPendingGradients; // gradients not yet reported complete in the current minibatch
+        std::shared_ptr<ElemType> buffer;
+        std::shared_ptr<GPUDataTransferer<ElemType>> transferer;
+        NonBlockingAllReduce<ElemType> reduction;
+        BucketState state;
+        bool launchedDuringBackprop;
+        Timer timer;
+    };
+
+    bool IsPlannedFor(const std::vector<Matrix<ElemType>*>& gradients) const
+    {
+        if (gradients.size() != m_plannedGradients.size())
+            return false;
+        for (size_t i = 0; i < gradients.size(); i++)
+        {
+            if (gradients[i] != m_plannedGradients[i].first || gradients[i]->GetNumElements() != m_plannedGradients[i].second)
+                return false;
+        }
+        return true;
+    }
+
+    // Lay out the gradients into buckets, last gradient first
+    void PlanBuckets(const std::vector<Matrix<ElemType>*>& gradients)
+    {
+        m_buckets.clear();
+        m_bucketsOfGradient.clear();
+        m_plannedGradients.clear();
+        m_numBucketsLaunched = 0;
+
+        int deviceId = gradients[0]->GetDeviceId();
+        for (auto iter = gradients.rbegin(); iter != gradients.rend(); iter++)
+        {
+            Matrix<ElemType>* gradient = *iter;
+            size_t offset = 0;
+            do
+            {
+                if (m_buckets.empty() || m_bucketSize == 0 || m_buckets.back().numElements >= m_bucketSize)
+                {
+                    m_buckets.push_back(GradientBucket());
+                    m_buckets.back().numElements = 0;
+                    m_buckets.back().numGradients = 0;
+                }
+                auto& bucket = m_buckets.back();
+                size_t n = gradient->GetNumElements() - offset;
+                if (m_bucketSize != 0)
+                    n = std::min(n, m_bucketSize - bucket.numElements);
+                bucket.slices.push_back(Slice{gradient, offset, bucket.numElements, n});
+                bucket.numElements += n;
+                bucket.numGradients++;
+                m_bucketsOfGradient[gradient].push_back(m_buckets.size() - 1);
+                offset += n;
+            } while (offset < gradient->GetNumElements());
+        }
+
+        for (auto& bucket : m_buckets)
+        {
+            if (deviceId != CPUDEVICE)
+            {
+                bucket.buffer = AllocateIntermediateBuffer(deviceId, bucket.numElements);
+                bucket.transferer.reset(new GPUDataTransferer<ElemType>(deviceId, m_useAsyncAggregation));
+            }
+            else
+            {
+                bucket.buffer = std::shared_ptr<ElemType>(new ElemType[bucket.numElements], [](ElemType* p)
+                                                          {
+                                                              delete[] p;
+                                                          });
+            }
+            bucket.numPendingGradients = bucket.numGradients;
+            bucket.state = BucketState::Idle;
+        }
+
+        for (auto* gradient : gradients)
+            m_plannedGradients.push_back(make_pair(gradient, gradient->GetNumElements()));
+        m_numGradMatrices = gradients.size();
+    }
+
+    // P2P tags of the bucket reductions; must not collide with the header tags
+    int BucketTag(size_t bucketIndex) const
+    {
+        return (int) (2 * m_numGradMatrices + 2 + bucketIndex);
+    }
+
+    // Copy out the next buckets in order, either all remaining ones or as long as all their gradients are complete.
+    // Reductions are always started in bucket order, which keeps the MPI collectives in the same order on all workers.
+    void LaunchBuckets(bool all, bool duringBackprop)
+    {
+        while (m_numBucketsLaunched < m_buckets.size() && (all || m_buckets[m_numBucketsLaunched].numPendingGradients == 0))
+        {
+            auto& bucket = m_buckets[m_numBucketsLaunched];
+            bucket.launchedDuringBackprop = duringBackprop;
+            bucket.timer.Start();
+
+            int deviceId = bucket.slices[0].matrix->GetDeviceId();
+            if (deviceId != CPUDEVICE)
+            {
+                // make sure the gradients have been computed on the main compute stream before copying them out
+                std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+                mainStreamSyncEvent->SynchronizeDataTransferFetchStreamWithEvent<ElemType>();
+                for (const auto& slice : bucket.slices)
+                    bucket.transferer->CopyGPUToCPUAsync(slice.matrix->BufferPointer() + slice.matrixOffset, slice.numElements, bucket.buffer.get() + slice.bufferOffset);
+                bucket.state = BucketState::CopyingOut;
+            }
+            else
+            {
+                for (const auto& slice : bucket.slices)
+                    memcpy(bucket.buffer.get() + slice.bufferOffset, slice.matrix->BufferPointer() + slice.matrixOffset, sizeof(ElemType) * slice.numElements);
+                bucket.reduction.Start(bucket.buffer.get(), bucket.numElements, m_allReduceAlgorithm, m_mpi->Communicator(), BucketTag(m_numBucketsLaunched));
+                bucket.state = BucketState::Reducing;
+            }
+            m_numBucketsLaunched++;
+        }
+    }
+
+    // Drive the reductions in flight and write back the finished ones
+    void ProgressBuckets()
+    {
+        for (auto& bucket : m_buckets)
+        {
+            if (bucket.state == BucketState::Reducing && bucket.reduction.Test())
+                FinishBucket(bucket);
+        }
+    }
+
+    void FinishBucket(GradientBucket& bucket)
+    {
+        for (const auto& slice : bucket.slices)
+        {
+            ElemType* src = bucket.buffer.get() + slice.bufferOffset;
+            ElemType* dst = slice.matrix->BufferPointer() + slice.matrixOffset;
+            if (bucket.transferer)
+                bucket.transferer->CopyCPUToGPUAsync(src, slice.numElements, dst);
+            else
+                memcpy(dst, src, sizeof(ElemType) * slice.numElements);
+        }
+        bucket.timer.Stop();
+        bucket.state = BucketState::Done;
+    }
     std::shared_ptr<ElemType> AllocateIntermediateBuffer(int deviceID, size_t numElements)
     {
         assert(deviceID >= 0);
@@ -153,12 +342,6 @@ private:
                 if (gradients[i]->GetMatrixType() != DENSE)
                     RuntimeError("Gradient aggregation for sparse gradient matrices is currently unsupported!");
 
-                if (deviceId != CPUDEVICE)
-                {
-                    m_gpuDataTransferers.push_back(std::unique_ptr<GPUDataTransferer<ElemType>>(new GPUDataTransferer<ElemType>(deviceId, m_useAsyncAggregation)));
-                    m_intermediateCPUBuffers.push_back(AllocateIntermediateBuffer(deviceId, gradients[i]->GetNumElements()));
-                }
-
                 if (m_useAsyncAggregation)
                 {
                     m_bufferedGradients[gradients[i]].reset(new Matrix<ElemType>(gradients[i]->GetNumRows(), gradients[i]->GetNumCols(), deviceId));
@@ -216,6 +399,9 @@ private:
             aggregationTimer.Start();
         }
 
+        if (!IsPlannedFor(gradients))
+            PlanBuckets(gradients);
+
         size_t numGradMatrices = gradients.size();
 
         if (headerCPU->numSamples == 0)
@@ -227,26 +413,15 @@ private:
             }
 
             // If the current node did not process any samples, the gradients should be zero'd
+            // (no backprop ran, so none of the buckets can have been launched yet)
             for (size_t i = 0; i < numGradMatrices; ++i)
             {
                 gradients[i]->SetValue(0);
             }
-
-            if (m_useAsyncAggregation)
-            {
-                std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
-                mainStreamSyncEvent->SynchronizeDataTransferFetchStreamWithEvent<ElemType>();
-            }
         }
 
-        // Initiate transfer of the gradient matrices to the CPU if needed
-        if (deviceId >= 0)
-        {
-            for (size_t i = 0; i < numGradMatrices; ++i)
-            {
-                m_gpuDataTransferers[i]->CopyGPUToCPUAsync(gradients[i]->BufferPointer(), gradients[i]->GetNumElements(), m_intermediateCPUBuffers[i].get());
-            }
-        }
+        // Initiate transfer of the remaining buckets to the CPU if needed (on CPU: start reducing them)
+        LaunchBuckets(/*all=*/true, /*duringBackprop=*/false);
 
         // Initiate receive of the header on the main node
         std::vector<MPI_Request> recvHeaderRequests(NumProc() - 1);
@@ -267,19 +442,16 @@ private:
             MPI_Isend(headerCPU, headerCPU->Size(), MPI_CHAR, m_mpi->MainNodeRank(), numGradMatrices, m_mpi->Communicator(), &sendHeaderRequest) || MpiFail("MPI_Isend");
         }
 
-        // Perform MPI async allreduce on the gradient data
-        std::vector<MPI_Request> allReduceRequests(numGradMatrices);
-        for (size_t i = 0; i < numGradMatrices; ++i)
+        // Start the reductions of the buckets whose data are on their way from the GPU, in bucket order
+        for (size_t i = 0; i < m_buckets.size(); ++i)
         {
-            ElemType* reductionBuffer = gradients[i]->BufferPointer();
-            if (deviceId >= 0)
-            {
-                m_gpuDataTransferers[i]->WaitForCopyGPUToCPUAsync();
-                reductionBuffer = m_intermediateCPUBuffers[i].get();
-            }
-
-            // On Windows this async MPI_Iallreduce call requires MS MPI v7 or higher to be installed
-            MPI_Iallreduce(MPI_IN_PLACE, reductionBuffer, gradients[i]->GetNumElements(), MPIWrapper::GetDataType(reductionBuffer), MPI_SUM, m_mpi->Communicator(), &allReduceRequests[i]) || MpiFail("MPI_Iallreduce");
+            auto& bucket = m_buckets[i];
+            if (bucket.state != BucketState::CopyingOut)
+                continue;
+            bucket.transferer->WaitForCopyGPUToCPUAsync();
+            bucket.reduction.Start(bucket.buffer.get(), bucket.numElements, m_allReduceAlgorithm, m_mpi->Communicator(), BucketTag(i));
+            bucket.state = BucketState::Reducing;
+            ProgressBuckets();
         }
 
         // On the main node wait for the headers to arrive and aggregate
@@ -322,13 +494,13 @@ private:
             }
         }
 
-        // Wait for the allreduce operations to finish and initiate transfer back to the GPU if needed
-        for (size_t i = 0; i < numGradMatrices; ++i)
+        // Wait for the bucket reductions to finish and initiate transfer back to the GPU if needed
+        for (auto& bucket : m_buckets)
         {
-            MPI_Wait(&allReduceRequests[i], MPI_STATUSES_IGNORE) || MpiFail("MPI_Wait");
-            if (deviceId >= 0)
+            if (bucket.state == BucketState::Reducing)
             {
-                m_gpuDataTransferers[i]->CopyCPUToGPUAsync(m_intermediateCPUBuffers[i].get(), gradients[i]->GetNumElements(), gradients[i]->BufferPointer());
+                bucket.reduction.Wait();
+                FinishBucket(bucket);
             }
         }
 
@@ -341,9 +513,9 @@ private:
         // Wait for all the transfers to finish
         if (deviceId >= 0)
         {
-            for (size_t i = 0; i < numGradMatrices; ++i)
+            for (auto& bucket : m_buckets)
             {
-                m_gpuDataTransferers[i]->WaitForCopyCPUToGPUAsync();
+                bucket.transferer->WaitForCopyCPUToGPUAsync();
             }
         }
 
@@ -362,14 +534,34 @@ private:
             aggregationTimer.Stop();
             double epochTime = aggregationTimer.ElapsedSeconds();
             fprintf(stderr, "Actual gradient aggregation time: %.6g\n", epochTime);
+            for (size_t i = 0; i < m_buckets.size(); ++i)
+            {
+                auto& bucket = m_buckets[i];
+                fprintf(stderr, "\tGradient bucket %d: %d gradients, %d elements, started %s backprop, reduced in %.6g seconds\n",
+                        (int) i, (int) bucket.numGradients, (int) bucket.numElements, bucket.launchedDuringBackprop ? "during" : "after", bucket.timer.ElapsedSeconds());
+            }
+        }
+
+        // get ready for the next minibatch
+        for (auto& bucket : m_buckets)
+        {
+            bucket.numPendingGradients = bucket.numGradients;
+            bucket.state = BucketState::Idle;
         }
+        m_numBucketsLaunched = 0;
     }
 
 private:
     std::unique_ptr<CUDAPageLockedMemAllocator> m_allocator;
-    std::vector<std::shared_ptr<ElemType>> m_intermediateCPUBuffers;
 
-    std::vector<std::unique_ptr<GPUDataTransferer<ElemType>>> m_gpuDataTransferers;
+    // gradient buckets, in the order their reductions are started
+    size_t m_bucketSize; // in elements; 0 means one bucket per gradient matrix
+    AllReduceAlgorithm m_allReduceAlgorithm;
+    std::vector<GradientBucket> m_buckets;
+    std::unordered_map<Matrix<ElemType>*, std::vector<size_t>> m_bucketsOfGradient;
+    std::vector<std::pair<Matrix<ElemType>*, size_t>> m_plannedGradients; // gradients and their sizes the buckets were laid out for
+    size_t m_numGradMatrices;
+    size_t m_numBucketsLaunched; // buckets [0, m_numBucketsLaunched) have been launched in the current minibatch
 
     std::vector<DistGradHeader*> m_recvHeaders;
 
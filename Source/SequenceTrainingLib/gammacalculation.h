@@ -1,11 +1,13 @@
 #pragma once
 
 #include <unordered_map>
+#include <exception>
 #include "simplesenonehmm.h"
 #include "latticearchive.h"
 #include "latticesource.h"
 #include "ssematrix.h"
 #include "Matrix.h"
+#include "Sequences.h"
 #include "CUDAPageLockedMemAllocator.h"
 
 #pragma warning(disable : 4127) // conditional expression is constant
@@ -85,7 +87,7 @@ public:
     // Sec. 3 calculation functions
     // ========================================
     void calgammaformb(Microsoft::MSR::CNTK::Matrix<ElemType>& functionValues,
-                       std::vector<shared_ptr<const msra::dbn::latticepair>>& lattices,
+                       std::vector<std::shared_ptr<const msra::dbn::latticepair>>& lattices,
                        const Microsoft::MSR::CNTK::Matrix<ElemType>& loglikelihood,
                        Microsoft::MSR::CNTK::Matrix<ElemType>& labels,
                        Microsoft::MSR::CNTK::Matrix<ElemType>& gammafromlattice,
@@ -97,7 +99,6 @@ public:
     {
         // check total frame number to be added ?
         // int deviceid = loglikelihood.GetDeviceId();
-        size_t boundaryframenum;
         std::vector<size_t> validframes; // [s] cursor pointing to next utterance begin within a single parallel sequence [s]
         validframes.assign(samplesInRecurrentStep, 0);
         ElemType objectValue = 0.0;
@@ -123,31 +124,19 @@ public:
             assert(T == pMBLayout->GetNumTimeSteps());
         }
 
-        size_t mapi = 0; // parallel-sequence index for utterance [i]
-        // cal gamma for each utterance
+        // determine where each utterance is located in the minibatch
+        std::vector<size_t> uttbegin(lattices.size()); // [i] first column of utterance [i] in pred, dengammas and uids
+        std::vector<size_t> uttmapi(lattices.size());  // [i] parallel-sequence index of utterance [i]
+        std::vector<size_t> uttmapt(lattices.size());  // [i] first time step of utterance [i] within its parallel sequence
         size_t ts = 0;
         for (size_t i = 0; i < lattices.size(); i++)
         {
             const size_t numframes = lattices[i]->getnumframes();
-
-            msra::dbn::matrixstripe predstripe(pred, ts, numframes);           // logLLs for this utterance
-            msra::dbn::matrixstripe dengammasstripe(dengammas, ts, numframes); // denominator gammas
-
-            if (samplesInRecurrentStep == 1) // no sequence parallelism
-            {
-                tempmatrix = loglikelihood.ColumnSlice(ts, numframes);
-                // if (m_deviceid == CPUDEVICE)
-                {
-                    CopyFromCNTKMatrixToSSEMatrix(tempmatrix, numframes, predstripe);
-                }
-
-                if (m_deviceid != CPUDEVICE)
-                    parallellattice.setloglls(tempmatrix);
-            }
-            else // multiple parallel sequences
+            uttbegin[i] = ts;
+            if (samplesInRecurrentStep > 1) // multiple parallel sequences
             {
                 // get number of frames for the utterance
-                mapi = extrauttmap[i]; // parallel-sequence index; in case of >1 utterance within this parallel sequence, this is in order of concatenation
+                size_t mapi = extrauttmap[i]; // parallel-sequence index; in case of >1 utterance within this parallel sequence, this is in order of concatenation
 
                 // scan MBLayout for end of utterance
                 size_t mapframenum = SIZE_MAX; // duration of utterance [i] as determined from MBLayout
@@ -166,88 +155,164 @@ public:
                     LogicError("gammacalculation: IsEnd() not working, numframes (%d) vs. mapframenum (%d)", (int) numframes, (int) mapframenum);
                 assert(numframes == mapframenum);
 
-                if (numframes > tempmatrix.GetNumCols())
-                    tempmatrix.Resize(numrows, numframes);
+                uttmapi[i] = mapi;
+                uttmapt[i] = validframes[mapi];
+                validframes[mapi] += numframes; // advance the cursor within the parallel sequence
+            }
+            ts += numframes;
+        }
 
-                Microsoft::MSR::CNTK::Matrix<ElemType> loglikelihoodForCurrentParallelUtterance = loglikelihood.ColumnSlice(mapi + (validframes[mapi] * samplesInRecurrentStep), ((numframes - 1) * samplesInRecurrentStep) + 1);
-                tempmatrix.CopyColumnsStrided(loglikelihoodForCurrentParallelUtterance, numframes, samplesInRecurrentStep, 1);
+        // cal gamma for each utterance
+        // On the GPU, the lattice state holds the LLs and gammas of one utterance at a time. On the CPU, the utterances are
+        // independent (each one only touches its own columns of pred, dengammas and uids), so their lattices are processed
+        // concurrently; copying the LLs in and the gammas out still goes through the shared buffers, one utterance at a time.
+        std::vector<double> numavlogps(lattices.size()), denavlogps(lattices.size());
+        if (parallellattice.enabled())
+        {
+            for (size_t i = 0; i < lattices.size(); i++)
+            {
+                getloglls(i, loglikelihood, lattices, uttbegin, uttmapi, uttmapt, samplesInRecurrentStep, tempmatrix);
+                forwardbackwardutterance(i, lattices, uids, boundaries, uttbegin, doreferencealign, numavlogps, denavlogps);
+                putgammas(i, numrows, gammafromlattice, labels, lattices, uids, uttbegin, uttmapi, uttmapt, samplesInRecurrentStep, doreferencealign, tempmatrix);
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < lattices.size(); i++)
+                getloglls(i, loglikelihood, lattices, uttbegin, uttmapi, uttmapt, samplesInRecurrentStep, tempmatrix);
 
-                // if (doreferencealign || m_deviceid == CPUDEVICE)
+            std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic, 1)
+            for (long i = 0; i < (long) lattices.size(); i++)
+            {
+                try
                 {
-                    CopyFromCNTKMatrixToSSEMatrix(tempmatrix, numframes, predstripe);
+                    forwardbackwardutterance(i, lattices, uids, boundaries, uttbegin, doreferencealign, numavlogps, denavlogps);
                 }
-
-                if (m_deviceid != CPUDEVICE)
+                catch (...)
                 {
-                    parallellattice.setloglls(tempmatrix);
+#pragma omp critical
+                    error = std::current_exception();
                 }
             }
+            if (error)
+                std::rethrow_exception(error);
 
-            array_ref<size_t> uidsstripe(&uids[ts], numframes);
+            for (size_t i = 0; i < lattices.size(); i++)
+                putgammas(i, numrows, gammafromlattice, labels, lattices, uids, uttbegin, uttmapi, uttmapt, samplesInRecurrentStep, doreferencealign, tempmatrix);
+        }
 
-            if (doreferencealign)
-            {
-                boundaryframenum = numframes;
-            }
-            else
-                boundaryframenum = 0;
-            array_ref<size_t> boundariesstripe(&boundaries[ts], boundaryframenum);
+        for (size_t i = 0; i < lattices.size(); i++)
+        {
+            const size_t numframes = lattices[i]->getnumframes();
+            objectValue += (ElemType)((numavlogps[i] - denavlogps[i]) * numframes);
+            fprintf(stderr, "dengamma value %f\n", denavlogps[i]);
+        }
+        functionValues.SetValue(objectValue);
+    }
 
-            double numavlogp = 0;
-            foreach_column (t, dengammasstripe) // we do not allocate memory for numgamma now, should be the same as numgammasstripe
-            {
-                const size_t s = uidsstripe[t];
-                numavlogp += predstripe(s, t) / amf;
-            }
-            numavlogp /= numframes;
+private:
+    // copy the LLs of utterance [i] from the minibatch into its columns of pred (and to the GPU lattice state)
+    void getloglls(size_t i, const Microsoft::MSR::CNTK::Matrix<ElemType>& loglikelihood, const std::vector<std::shared_ptr<const msra::dbn::latticepair>>& lattices,
+                   const std::vector<size_t>& uttbegin, const std::vector<size_t>& uttmapi, const std::vector<size_t>& uttmapt,
+                   size_t samplesInRecurrentStep, Microsoft::MSR::CNTK::Matrix<ElemType>& tempmatrix)
+    {
+        const size_t numframes = lattices[i]->getnumframes();
+        const size_t ts = uttbegin[i];
+        msra::dbn::matrixstripe predstripe(pred, ts, numframes); // logLLs for this utterance
 
-            // auto_timer dengammatimer;
-            double denavlogp = lattices[i]->second.forwardbackward(parallellattice,
-                                                                   (const msra::math::ssematrixbase&) predstripe, (const msra::asr::simplesenonehmm&) m_hset,
-                                                                   (msra::math::ssematrixbase&) dengammasstripe, (msra::math::ssematrixbase&) gammasbuffer /*empty, not used*/,
-                                                                   lmf, wp, amf, boostmmifactor, seqsMBRmode, uidsstripe, boundariesstripe);
-            objectValue += (ElemType)((numavlogp - denavlogp) * numframes);
+        if (samplesInRecurrentStep == 1) // no sequence parallelism
+            tempmatrix = loglikelihood.ColumnSlice(ts, numframes);
+        else // multiple parallel sequences
+        {
+            if (numframes > tempmatrix.GetNumCols())
+                tempmatrix.Resize(loglikelihood.GetNumRows(), numframes);
 
-            if (samplesInRecurrentStep == 1)
-            {
-                tempmatrix = gammafromlattice.ColumnSlice(ts, numframes);
-            }
+            Microsoft::MSR::CNTK::Matrix<ElemType> loglikelihoodForCurrentParallelUtterance = loglikelihood.ColumnSlice(uttmapi[i] + (uttmapt[i] * samplesInRecurrentStep), ((numframes - 1) * samplesInRecurrentStep) + 1);
+            tempmatrix.CopyColumnsStrided(loglikelihoodForCurrentParallelUtterance, numframes, samplesInRecurrentStep, 1);
+        }
 
-            // copy gamma to tempmatrix
-            if (m_deviceid == CPUDEVICE)
-            {
-                CopyFromSSEMatrixToCNTKMatrix(dengammas, numrows, numframes, tempmatrix, gammafromlattice.GetDeviceId());
-            }
-            else
-                parallellattice.getgamma(tempmatrix);
+        // if (doreferencealign || m_deviceid == CPUDEVICE)
+        {
+            CopyFromCNTKMatrixToSSEMatrix(tempmatrix, numframes, predstripe);
+        }
 
-            // set gamma for multi channel
-            if (samplesInRecurrentStep > 1)
-            {
-                Microsoft::MSR::CNTK::Matrix<ElemType> gammaFromLatticeForCurrentParallelUtterance = gammafromlattice.ColumnSlice(mapi + (validframes[mapi] * samplesInRecurrentStep), ((numframes - 1) * samplesInRecurrentStep) + 1);
-                gammaFromLatticeForCurrentParallelUtterance.CopyColumnsStrided(tempmatrix, numframes, 1, samplesInRecurrentStep);
-            }
+        if (m_deviceid != CPUDEVICE)
+            parallellattice.setloglls(tempmatrix);
+    }
+
+    // lattice forward-backward for utterance [i]; writes only the columns of utterance [i] in dengammas and uids
+    void forwardbackwardutterance(size_t i, const std::vector<std::shared_ptr<const msra::dbn::latticepair>>& lattices, std::vector<size_t>& uids, std::vector<size_t>& boundaries,
+                                  const std::vector<size_t>& uttbegin, bool doreferencealign, std::vector<double>& numavlogps, std::vector<double>& denavlogps)
+    {
+        const size_t numframes = lattices[i]->getnumframes();
+        const size_t ts = uttbegin[i];
+        msra::dbn::matrixstripe predstripe(pred, ts, numframes);           // logLLs for this utterance
+        msra::dbn::matrixstripe dengammasstripe(dengammas, ts, numframes); // denominator gammas
+
+        array_ref<size_t> uidsstripe(&uids[ts], numframes);
+        size_t boundaryframenum = doreferencealign ? numframes : 0;
+        array_ref<size_t> boundariesstripe(&boundaries[ts], boundaryframenum);
+
+        double numavlogp = 0;
+        foreach_column (t, dengammasstripe) // we do not allocate memory for numgamma now, should be the same as numgammasstripe
+        {
+            const size_t s = uidsstripe[t];
+            numavlogp += predstripe(s, t) / amf;
+        }
+        numavlogp /= numframes;
+        numavlogps[i] = numavlogp;
+
+        // auto_timer dengammatimer;
+        denavlogps[i] = lattices[i]->second.forwardbackward(parallellattice,
+                                                           (const msra::math::ssematrixbase&) predstripe, (const msra::asr::simplesenonehmm&) m_hset,
+                                                           (msra::math::ssematrixbase&) dengammasstripe, (msra::math::ssematrixbase&) gammasbuffer /*empty, not used*/,
+                                                           lmf, wp, amf, boostmmifactor, seqsMBRmode, uidsstripe, boundariesstripe);
+    }
+
+    // copy the gammas of utterance [i] into the minibatch, and its reference alignment into the labels
+    void putgammas(size_t i, size_t numrows, Microsoft::MSR::CNTK::Matrix<ElemType>& gammafromlattice, Microsoft::MSR::CNTK::Matrix<ElemType>& labels,
+                   const std::vector<std::shared_ptr<const msra::dbn::latticepair>>& lattices, const std::vector<size_t>& uids,
+                   const std::vector<size_t>& uttbegin, const std::vector<size_t>& uttmapi, const std::vector<size_t>& uttmapt,
+                   size_t samplesInRecurrentStep, bool doreferencealign, Microsoft::MSR::CNTK::Matrix<ElemType>& tempmatrix)
+    {
+        const size_t numframes = lattices[i]->getnumframes();
+        const size_t ts = uttbegin[i];
+        msra::dbn::matrixstripe dengammasstripe(dengammas, ts, numframes); // denominator gammas
+
+        if (samplesInRecurrentStep == 1)
+        {
+            tempmatrix = gammafromlattice.ColumnSlice(ts, numframes);
+        }
+
+        // copy gamma to tempmatrix
+        if (m_deviceid == CPUDEVICE)
+        {
+            CopyFromSSEMatrixToCNTKMatrix(dengammasstripe, numrows, numframes, tempmatrix, gammafromlattice.GetDeviceId());
+        }
+        else
+            parallellattice.getgamma(tempmatrix);
+
+        // set gamma for multi channel
+        if (samplesInRecurrentStep > 1)
+        {
+            Microsoft::MSR::CNTK::Matrix<ElemType> gammaFromLatticeForCurrentParallelUtterance = gammafromlattice.ColumnSlice(uttmapi[i] + (uttmapt[i] * samplesInRecurrentStep), ((numframes - 1) * samplesInRecurrentStep) + 1);
+            gammaFromLatticeForCurrentParallelUtterance.CopyColumnsStrided(tempmatrix, numframes, 1, samplesInRecurrentStep);
+        }
 
-            if (doreferencealign)
+        if (doreferencealign)
+        {
+            for (size_t nframe = 0; nframe < numframes; nframe++)
             {
-                for (size_t nframe = 0; nframe < numframes; nframe++)
-                {
-                    size_t uid = uidsstripe[nframe];
-                    if (samplesInRecurrentStep > 1)
-                        labels(uid, (nframe + validframes[mapi]) * samplesInRecurrentStep + mapi) = 1.0;
-                    else
-                        labels(uid, ts + nframe) = 1.0;
-                }
+                size_t uid = uids[ts + nframe];
+                if (samplesInRecurrentStep > 1)
+                    labels(uid, (nframe + uttmapt[i]) * samplesInRecurrentStep + uttmapi[i]) = 1.0;
+                else
+                    labels(uid, ts + nframe) = 1.0;
             }
-            if (samplesInRecurrentStep > 1)
-                validframes[mapi] += numframes; // advance the cursor within the parallel sequence
-            fprintf(stderr, "dengamma value %f\n", denavlogp);
-            ts += numframes;
         }
-        functionValues.SetValue(objectValue);
     }
 
-private:
     // Helper methods for copying between ssematrix objects and CNTK matrices
     void CopyFromCNTKMatrixToSSEMatrix(const Microsoft::MSR::CNTK::Matrix<ElemType>& src, size_t numCols, msra::math::ssematrixbase& dest)
     {
@@ -317,7 +382,7 @@ private:
 
     // TODO: This function is duplicate of the one in HTLMLFReader.
     // This should be moved to a common utils library and removed from here as well as HTLMLFReader
-    unique_ptr<Microsoft::MSR::CNTK::CUDAPageLockedMemAllocator>& GetCUDAAllocator(int deviceID)
+    std::unique_ptr<Microsoft::MSR::CNTK::CUDAPageLockedMemAllocator>& GetCUDAAllocator(int deviceID)
     {
         if (m_cudaAllocator != nullptr)
         {
@@ -370,7 +435,7 @@ protected:
     float wp;
     float amf;
     msra::dbn::matrix gammasbuffer;
-    vector<size_t> boundary;
+    std::vector<size_t> boundary;
     float boostmmifactor;
     bool seqsMBRmode;
 
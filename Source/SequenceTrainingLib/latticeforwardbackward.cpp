@@ -15,6 +15,10 @@
 #include <unordered_map>
 #include <list>
 #include <stdexcept>
+#include <exception>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
@@ -482,6 +486,132 @@ static bool islogzero(FLOAT v)
     return fwscore;
 }
 
+// ---------------------------------------------------------------------------
+// latticelevels -- lattice nodes grouped into topological levels, for running
+// the lattice-level forward and backward passes on several CPU threads
+//
+// A node's level is one more than the highest level of its predecessors, so the
+// nodes of one level depend only on lower levels (forward pass) or only on
+// higher levels (backward pass), and can be processed concurrently as a wavefront.
+// Each node pulls its incoming edges in ascending and its outgoing edges in
+// descending edge order, i.e. in the order in which the serial edge loops would
+// visit them, so every log-domain sum is accumulated in the same order, and the
+// results are identical to those of the serial loops.
+// If the levels are too narrow to be worth the synchronization, or there is only
+// one thread to run on, the nodes are simply visited in index order.
+// ---------------------------------------------------------------------------
+
+class latticelevels
+{
+    std::vector<size_t> inbegin;          // [i] first incoming edge of node i (edges are sorted by end node), plus end marker
+    std::vector<size_t> outbegin;         // [i] first entry of node i in outedges[], plus end marker
+    std::vector<unsigned int> outedges;   // outgoing edges of each node, in descending order
+    std::vector<unsigned int> levelnodes; // node indices, grouped by level; empty if not parallel
+    std::vector<size_t> levelbegin;       // [l] first entry of level l in levelnodes, plus end marker
+
+public:
+    template <class EDGES>
+    latticelevels(size_t numnodes, const EDGES &edges)
+    {
+        // incoming edges are consecutive; outgoing edges by counting sort by start node
+        inbegin.assign(numnodes + 1, 0);
+        outbegin.assign(numnodes + 1, 0);
+        foreach_index (j, edges)
+        {
+            if (edges[j].E <= edges[j].S || (j > 0 && edges[j].E < edges[j - 1].E))
+                RuntimeError("latticelevels: lattice is not topologically sorted by end node");
+            inbegin[edges[j].E + 1]++;
+            outbegin[edges[j].S + 1]++;
+        }
+        for (size_t i = 0; i < numnodes; i++)
+        {
+            inbegin[i + 1] += inbegin[i];
+            outbegin[i + 1] += outbegin[i];
+        }
+        outedges.resize(edges.size());
+        std::vector<size_t> outcursor(outbegin.begin(), outbegin.end() - 1);
+        for (size_t j = edges.size() - 1; j + 1 > 0; j--)
+            outedges[outcursor[edges[j].S]++] = (unsigned int) j;
+
+        // levels; all edges into a node come before the edges out of it
+        std::vector<size_t> level(numnodes, 0);
+        size_t numlevels = numnodes > 0 ? 1 : 0;
+        foreach_index (j, edges)
+        {
+            level[edges[j].E] = max(level[edges[j].E], level[edges[j].S] + 1);
+            numlevels = max(numlevels, level[edges[j].E] + 1);
+        }
+
+        // each level ends in a barrier, so we want enough edges per level to keep the threads busy in between
+        bool parallel = numlevels > 0 && edges.size() >= 32 * numlevels;
+#ifdef _OPENMP
+        parallel &= omp_get_max_threads() > 1 && !omp_in_parallel(); // (utterances may already be processed in parallel)
+#else
+        parallel = false;
+#endif
+        if (!parallel)
+            return;
+
+        levelbegin.assign(numlevels + 1, 0);
+        for (size_t i = 0; i < numnodes; i++)
+            levelbegin[level[i] + 1]++;
+        for (size_t l = 0; l < numlevels; l++)
+            levelbegin[l + 1] += levelbegin[l];
+        levelnodes.resize(numnodes);
+        std::vector<size_t> levelcursor(levelbegin.begin(), levelbegin.end() - 1);
+        for (size_t i = 0; i < numnodes; i++)
+            levelnodes[levelcursor[level[i]]++] = (unsigned int) i;
+    }
+
+    // call f(i, jbegin, jend) for all nodes i in topological order; node i's incoming edges are edges[jbegin..jend-1]
+    template <typename FUNC>
+    void forward(const FUNC &f) const
+    {
+        const size_t numnodes = inbegin.size() - 1;
+        if (levelnodes.empty())
+        {
+            for (size_t i = 0; i < numnodes; i++)
+                f(i, inbegin[i], inbegin[i + 1]);
+            return;
+        }
+        const long numlevels = (long) levelbegin.size() - 1;
+#pragma omp parallel
+        for (long l = 0; l < numlevels; l++)
+        {
+#pragma omp for schedule(dynamic, 4)
+            for (long k = (long) levelbegin[l]; k < (long) levelbegin[l + 1]; k++)
+            {
+                const size_t i = levelnodes[k];
+                f(i, inbegin[i], inbegin[i + 1]);
+            }
+        }
+    }
+
+    // call f(i, outedges) for all nodes i in reverse topological order; outedges in descending edge order
+    template <typename FUNC>
+    void backward(const FUNC &f) const
+    {
+        const size_t numnodes = outbegin.size() - 1;
+        if (levelnodes.empty())
+        {
+            for (size_t i = numnodes - 1; i + 1 > 0; i--)
+                f(i, const_array_ref<unsigned int>(outedges.data() + outbegin[i], outbegin[i + 1] - outbegin[i]));
+            return;
+        }
+        const long numlevels = (long) levelbegin.size() - 1;
+#pragma omp parallel
+        for (long l = numlevels - 1; l >= 0; l--)
+        {
+#pragma omp for schedule(dynamic, 4)
+            for (long k = (long) levelbegin[l]; k < (long) levelbegin[l + 1]; k++)
+            {
+                const size_t i = levelnodes[k];
+                f(i, const_array_ref<unsigned int>(outedges.data() + outbegin[i], outbegin[i + 1] - outbegin[i]));
+            }
+        }
+    }
+};
+
 // ---------------------------------------------------------------------------
 // forwardbackwardlattice() -- lattice-level forward/backward
 //
@@ -506,7 +636,8 @@ double lattice::forwardbackwardlattice(const std::vector<float> &edgeacscores, p
 
         return totalfwscore;
     }
-    // if we get here, we have no CUDA, and do it the good ol' way
+    // if we get here, we have no CUDA, and do it the good ol' way, with the nodes of each level of the lattice processed in parallel
+    const latticelevels levels(nodes.size(), edges);
 
     // allocate return values
     logpps.resize(edges.size()); // this is our primary return value
@@ -529,27 +660,30 @@ double lattice::forwardbackwardlattice(const std::vector<float> &edgeacscores, p
         std::vector<double> logframescorrectedge(edges.size());  // raw counts of correct frames in each edge
 
         // forward pass
-        foreach_index (j, edges)
-        {
-            if (islogzero(edgeacscores[j])) // indicates that this edge is pruned
-                continue;
-            const auto &e = edges[j];
-            const double inscore = logalphas[e.S];
-            const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf;
-            const double pathscore = inscore + edgescore;
-            logadd(logalphas[e.E], pathscore);
-
-            size_t ts = nodes[e.S].t;
-            size_t te = nodes[e.E].t;
-            size_t framescorrect = 0; // count raw number of correct frames
-            for (size_t t = ts; t < te; t++)
-                framescorrect += (thisedgealignments[j][t - ts] == uids[t]);
-            logframescorrectedge[j] = (framescorrect > 0) ? log((double) framescorrect) : LOGZERO; // remember for backward pass
-            double loginaccs = logaccalphas[e.S] - logalphas[e.S];
-            logadd(loginaccs, logframescorrectedge[j]);
-            double logpathacc = loginaccs + logalphas[e.S] + edgescore;
-            logadd(logaccalphas[e.E], logpathacc);
-        }
+        levels.forward([&](size_t i, size_t jbegin, size_t jend)
+                       {
+                           for (size_t j = jbegin; j < jend; j++)
+                           {
+                               if (islogzero(edgeacscores[j])) // indicates that this edge is pruned
+                                   continue;
+                               const auto &e = edges[j];
+                               const double inscore = logalphas[e.S];
+                               const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf;
+                               const double pathscore = inscore + edgescore;
+                               logadd(logalphas[i], pathscore);
+
+                               size_t ts = nodes[e.S].t;
+                               size_t te = nodes[e.E].t;
+                               size_t framescorrect = 0; // count raw number of correct frames
+                               for (size_t t = ts; t < te; t++)
+                                   framescorrect += (thisedgealignments[j][t - ts] == uids[t]);
+                               logframescorrectedge[j] = (framescorrect > 0) ? log((double) framescorrect) : LOGZERO; // remember for backward pass
+                               double loginaccs = logaccalphas[e.S] - logalphas[e.S];
+                               logadd(loginaccs, logframescorrectedge[j]);
+                               double logpathacc = loginaccs + logalphas[e.S] + edgescore;
+                               logadd(logaccalphas[i], logpathacc);
+                           }
+                       });
         foreach_index (j, logaccalphas)
             logaccalphas[j] -= logalphas[j];
 
@@ -562,33 +696,37 @@ double lattice::forwardbackwardlattice(const std::vector<float> &edgeacscores, p
         }
 
         // backward pass and computation of state-conditioned frames-correct count
-        for (size_t j = edges.size() - 1; j + 1 > 0; j--)
-        {
-            if (islogzero(edgeacscores[j])) // indicates that this edge is pruned
-                continue;
-            const auto &e = edges[j];
-            const double inscore = logbetas[e.E];
-            const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf;
-            const double pathscore = inscore + edgescore;
-            logadd(logbetas[e.S], pathscore);
-
-            double loginaccs = logaccbetas[e.E] - logbetas[e.E];
-            logadd(loginaccs, logframescorrectedge[j]);
-            double logpathacc = loginaccs + logbetas[e.E] + edgescore;
-            logadd(logaccbetas[e.S], logpathacc);
-
-            // sum up to get final expected frames-correct count per state == per edge (since we assume hard state alignment)
-            double logpp = logalphas[e.S] + edgescore + logbetas[e.E] - totalfwscore;
-            if (logpp > 1e-2)
-                fprintf(stderr, "forwardbackward: WARNING: edge J=%d log posterior %.10f > 0\n", (int) j, (float) logpp);
-            if (logpp > 0.0)
-                logpp = 0.0;
-            logpps[j] = logpp;
-            double tmplogeframecorrect = logframescorrectedge[j];
-            logadd(tmplogeframecorrect, logaccalphas[e.S]);
-            logadd(tmplogeframecorrect, logaccbetas[e.E] - logbetas[e.E]);
-            Eframescorrectbuf[j] = exp(tmplogeframecorrect);
-        }
+        levels.backward([&](size_t i, const_array_ref<unsigned int> outedges)
+                        {
+                            foreach_index (k, outedges)
+                            {
+                                const size_t j = outedges[k];
+                                if (islogzero(edgeacscores[j])) // indicates that this edge is pruned
+                                    continue;
+                                const auto &e = edges[j];
+                                const double inscore = logbetas[e.E];
+                                const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf;
+                                const double pathscore = inscore + edgescore;
+                                logadd(logbetas[i], pathscore);
+
+                                double loginaccs = logaccbetas[e.E] - logbetas[e.E];
+                                logadd(loginaccs, logframescorrectedge[j]);
+                                double logpathacc = loginaccs + logbetas[e.E] + edgescore;
+                                logadd(logaccbetas[i], logpathacc);
+
+                                // sum up to get final expected frames-correct count per state == per edge (since we assume hard state alignment)
+                                double logpp = logalphas[e.S] + edgescore + logbetas[e.E] - totalfwscore;
+                                if (logpp > 1e-2)
+                                    fprintf(stderr, "forwardbackward: WARNING: edge J=%d log posterior %.10f > 0\n", (int) j, (float) logpp);
+                                if (logpp > 0.0)
+                                    logpp = 0.0;
+                                logpps[j] = logpp;
+                                double tmplogeframecorrect = logframescorrectedge[j];
+                                logadd(tmplogeframecorrect, logaccalphas[e.S]);
+                                logadd(tmplogeframecorrect, logaccbetas[e.E] - logbetas[e.E]);
+                                Eframescorrectbuf[j] = exp(tmplogeframecorrect);
+                            }
+                        });
         foreach_index (j, logaccbetas)
             logaccbetas[j] -= logbetas[j];
         const double totalbwscore = logbetas.front();
@@ -606,14 +744,17 @@ double lattice::forwardbackwardlattice(const std::vector<float> &edgeacscores, p
     // --- MMI version
 
     // forward pass
-    foreach_index (j, edges)
-    {
-        const auto &e = edges[j];
-        const double inscore = logalphas[e.S];
-        const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf; // note: edgeacscores[j] == LOGZERO if edge was pruned
-        const double pathscore = inscore + edgescore;
-        logadd(logalphas[e.E], pathscore);
-    }
+    levels.forward([&](size_t i, size_t jbegin, size_t jend)
+                   {
+                       for (size_t j = jbegin; j < jend; j++)
+                       {
+                           const auto &e = edges[j];
+                           const double inscore = logalphas[e.S];
+                           const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf; // note: edgeacscores[j] == LOGZERO if edge was pruned
+                           const double pathscore = inscore + edgescore;
+                           logadd(logalphas[i], pathscore);
+                       }
+                   });
     const double totalfwscore = logalphas.back();
     if (islogzero(totalfwscore))
     {
@@ -623,22 +764,26 @@ double lattice::forwardbackwardlattice(const std::vector<float> &edgeacscores, p
 
     // backward pass
     // this also computes the word posteriors on the fly, since we are at it
-    for (size_t j = edges.size() - 1; j + 1 > 0; j--)
-    {
-        const auto &e = edges[j];
-        const double inscore = logbetas[e.E];
-        const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf;
-        const double pathscore = inscore + edgescore;
-        logadd(logbetas[e.S], pathscore);
-
-        // compute lattice posteriors on the fly since we are at it
-        double logpp = logalphas[e.S] + edgescore + logbetas[e.E] - totalfwscore;
-        if (logpp > 1e-2)
-            fprintf(stderr, "forwardbackward: WARNING: edge J=%d log posterior %.10f > 0\n", (int) j, (float) logpp);
-        if (logpp > 0.0)
-            logpp = 0.0;
-        logpps[j] = logpp;
-    }
+    levels.backward([&](size_t i, const_array_ref<unsigned int> outedges)
+                    {
+                        foreach_index (k, outedges)
+                        {
+                            const size_t j = outedges[k];
+                            const auto &e = edges[j];
+                            const double inscore = logbetas[e.E];
+                            const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf;
+                            const double pathscore = inscore + edgescore;
+                            logadd(logbetas[i], pathscore);
+
+                            // compute lattice posteriors on the fly since we are at it
+                            double logpp = logalphas[e.S] + edgescore + logbetas[e.E] - totalfwscore;
+                            if (logpp > 1e-2)
+                                fprintf(stderr, "forwardbackward: WARNING: edge J=%d log posterior %.10f > 0\n", (int) j, (float) logpp);
+                            if (logpp > 0.0)
+                                logpp = 0.0;
+                            logpps[j] = logpp;
+                        }
+                    });
 
     const double totalbwscore = logbetas.front();
     if (fabs(totalfwscore - totalbwscore) / info.numframes > 1e-4)
@@ -675,33 +820,38 @@ double lattice::forwardbackwardlatticesMBR(const std::vector<float> &edgeacscore
     std::vector<int> backpointersformaxcorr(nodes.size(), -2); // keep track of backpointer for the max corr
     backpointersformaxcorr.front() = -1;
 
-    // forward pass
-    foreach_index (j, edges)
-    {
-        if (islogzero(edgeacscores[j])) // indicates that this edge is pruned
-            continue;
-        const auto &e = edges[j];
-        const double inaccs = accalphas[e.S];
-        size_t ts = nodes[e.S].t;
-        size_t te = nodes[e.E].t;
+    const latticelevels levels(nodes.size(), edges);
 
-        size_t framescorrect = 0; // count raw number of correct frames
-        for (size_t t = ts; t < te; t++)
-            framescorrect += (thisedgealignments[j][t - ts] == uids[t]);
-        framescorrectedge[j] = (double) framescorrect; // remember for backward pass
-
-        const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf;
-        // contribution to end node's path acc = start node's plus edge's correct count, weighted by LL, and divided by sum over LLs
-        double pathacc = (inaccs + framescorrectedge[j]) * exp(logalphas[e.S] + edgescore - logalphas[e.E]);
-        accalphas[e.E] += pathacc;
-        // also keep track of max accuracy, so we can find out whether the lattice contains the correct path
-        size_t oracleframescorrect = maxcorrect[e.S] + framescorrect; // keep track of most correct path up to end of this edge
-        if (oracleframescorrect > maxcorrect[e.E])
-        {
-            maxcorrect[e.E] = oracleframescorrect;
-            backpointersformaxcorr[size_t(e.E)] = j;
-        }
-    }
+    // forward pass
+    levels.forward([&](size_t i, size_t jbegin, size_t jend)
+                   {
+                       for (size_t j = jbegin; j < jend; j++)
+                       {
+                           if (islogzero(edgeacscores[j])) // indicates that this edge is pruned
+                               continue;
+                           const auto &e = edges[j];
+                           const double inaccs = accalphas[e.S];
+                           size_t ts = nodes[e.S].t;
+                           size_t te = nodes[e.E].t;
+
+                           size_t framescorrect = 0; // count raw number of correct frames
+                           for (size_t t = ts; t < te; t++)
+                               framescorrect += (thisedgealignments[j][t - ts] == uids[t]);
+                           framescorrectedge[j] = (double) framescorrect; // remember for backward pass
+
+                           const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf;
+                           // contribution to end node's path acc = start node's plus edge's correct count, weighted by LL, and divided by sum over LLs
+                           double pathacc = (inaccs + framescorrectedge[j]) * exp(logalphas[e.S] + edgescore - logalphas[i]);
+                           accalphas[i] += pathacc;
+                           // also keep track of max accuracy, so we can find out whether the lattice contains the correct path
+                           size_t oracleframescorrect = maxcorrect[e.S] + framescorrect; // keep track of most correct path up to end of this edge
+                           if (oracleframescorrect > maxcorrect[i])
+                           {
+                               maxcorrect[i] = oracleframescorrect;
+                               backpointersformaxcorr[i] = (int) j;
+                           }
+                       }
+                   });
     const double totalfwacc = accalphas.back();
 
     hset; // just for reference
@@ -713,19 +863,23 @@ double lattice::forwardbackwardlatticesMBR(const std::vector<float> &edgeacscore
         fprintf(stderr, "forwardbackwardlatticesMBR: ground-truth path missing from lattice (most correct path: %d out of %d frames correct)\n", (unsigned int) oracleframeacc, (int) info.numframes);
 
     // backward pass and computation of state-conditioned frames-correct count
-    for (size_t j = edges.size() - 1; j + 1 > 0; j--)
-    {
-        if (islogzero(edgeacscores[j])) // indicates that this edge is pruned
-            continue;
-        const auto &e = edges[j];
-        const double inaccs = accbetas[e.E];
-        const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf;
-        double pathacc = (inaccs + framescorrectedge[j]) * exp(logbetas[e.E] + edgescore - logbetas[e.S]);
-        accbetas[e.S] += pathacc;
-
-        // sum up to get final expected frames-correct count per state == per edge (since we assume hard state alignment)
-        Eframescorrect[j] = (float) (accalphas[e.S] + accbetas[e.E] + framescorrectedge[j]);
-    }
+    levels.backward([&](size_t i, const_array_ref<unsigned int> outedges)
+                    {
+                        foreach_index (k, outedges)
+                        {
+                            const size_t j = outedges[k];
+                            if (islogzero(edgeacscores[j])) // indicates that this edge is pruned
+                                continue;
+                            const auto &e = edges[j];
+                            const double inaccs = accbetas[e.E];
+                            const double edgescore = (e.l * lmf + wp + edgeacscores[j]) / amf;
+                            double pathacc = (inaccs + framescorrectedge[j]) * exp(logbetas[e.E] + edgescore - logbetas[i]);
+                            accbetas[i] += pathacc;
+
+                            // sum up to get final expected frames-correct count per state == per edge (since we assume hard state alignment)
+                            Eframescorrect[j] = (float) (accalphas[e.S] + accbetas[e.E] + framescorrectedge[j]);
+                        }
+                    });
 
     const double totalbwacc = accbetas.front();
 
@@ -952,50 +1106,64 @@ void lattice::forwardbackwardalign(parallelstate &parallelstate,
             parallelstate.getedgeacscores(edgeacscoresgpu);
             parallelstate.copyalignments(thisedgealignmentsgpu);
         }
-        foreach_index (j, edges)
+        // the edges are independent of each other (each writes only its own gammas, alignment and score), so we align them in parallel
+        thisedgealignments.getalignmentsbuffer(); // (allocates the alignment buffer, which operator[] would do lazily, and not thread-safe)
+        std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic, 16) if (!cpuverification)
+        for (int j = 0; j < (int) edges.size(); j++)
         {
-            const edgeinfowithscores &e = edges[j];
-            const size_t ts = nodes[e.S].t;
-            const size_t te = nodes[e.E].t;
-            if (ts == te) // dummy !NULL edge at end
-                edgeacscores[j] = 0.0f;
-            else
+            try
             {
-                const auto &aligntokens = getaligninfo(j); // get alignment tokens
-                const auto edgeLLs = msra::math::ssematrixstriperef<msra::math::ssematrixbase>(const_cast<msra::math::ssematrixbase &>(logLLs), ts, te - ts);
-                if (minlogpp > LOGZERO && origlogpps[j] < minlogpp)
-                    edgeacscores[j] = LOGZERO; // will kill word level forwardbackward hypothesis
-                else if (softalignstates)
-                    edgeacscores[j] = forwardbackwardedge(aligntokens, hset, edgeLLs, *abcs[j], j);
+                const edgeinfowithscores &e = edges[j];
+                const size_t ts = nodes[e.S].t;
+                const size_t te = nodes[e.E].t;
+                if (ts == te) // dummy !NULL edge at end
+                    edgeacscores[j] = 0.0f;
                 else
-                    edgeacscores[j] = alignedge(aligntokens, hset, edgeLLs, *abcs[j], j, returnsenoneids, thisedgealignments[j]);
-            }
-            if (cpuverification)
-            {
-                const auto &aligntokens = getaligninfo(j); // get alignment tokens
-                bool edgehassil = false;
-                foreach_index (i, aligntokens)
                 {
-                    if (aligntokens[i].unit == silunitid)
-                        edgehassil = true;
+                    const auto &aligntokens = getaligninfo(j); // get alignment tokens
+                    const auto edgeLLs = msra::math::ssematrixstriperef<msra::math::ssematrixbase>(const_cast<msra::math::ssematrixbase &>(logLLs), ts, te - ts);
+                    if (minlogpp > LOGZERO && origlogpps[j] < minlogpp)
+                        edgeacscores[j] = LOGZERO; // will kill word level forwardbackward hypothesis
+                    else if (softalignstates)
+                        edgeacscores[j] = forwardbackwardedge(aligntokens, hset, edgeLLs, *abcs[j], j);
+                    else
+                        edgeacscores[j] = alignedge(aligntokens, hset, edgeLLs, *abcs[j], j, returnsenoneids, thisedgealignments[j]);
                 }
-                if (fabs(edgeacscores[j] - edgeacscoresgpu[j]) > 1e-3)
+                if (cpuverification)
                 {
-                    fprintf(stderr, "edge %d, sil ? %d, edgeacscores / edgeacscoresgpu MISMATCH %f v.s. %f, diff %e\n",
-                            j, edgehassil ? 1 : 0, (float) edgeacscores[j], (float) edgeacscoresgpu[j],
-                            (float) (edgeacscores[j] - edgeacscoresgpu[j]));
-                    fprintf(stderr, "aligntokens: ");
+                    const auto &aligntokens = getaligninfo(j); // get alignment tokens
+                    bool edgehassil = false;
                     foreach_index (i, aligntokens)
-                        fprintf(stderr, "%d %d; ", i, aligntokens[i].unit);
-                    fprintf(stderr, "\n");
-                }
-                for (size_t t = ts; t < te; t++)
-                {
-                    if (thisedgealignments[j][t - ts] != thisedgealignmentsgpu[j][t - ts])
-                        fprintf(stderr, "edge %d, sil ? %d, time %d, alignment / alignmentgpu MISMATCH %d v.s. %d\n", j, edgehassil ? 1 : 0, (int) (t - ts), thisedgealignments[j][t - ts], thisedgealignmentsgpu[j][t - ts]);
+                    {
+                        if (aligntokens[i].unit == silunitid)
+                            edgehassil = true;
+                    }
+                    if (fabs(edgeacscores[j] - edgeacscoresgpu[j]) > 1e-3)
+                    {
+                        fprintf(stderr, "edge %d, sil ? %d, edgeacscores / edgeacscoresgpu MISMATCH %f v.s. %f, diff %e\n",
+                                j, edgehassil ? 1 : 0, (float) edgeacscores[j], (float) edgeacscoresgpu[j],
+                                (float) (edgeacscores[j] - edgeacscoresgpu[j]));
+                        fprintf(stderr, "aligntokens: ");
+                        foreach_index (i, aligntokens)
+                            fprintf(stderr, "%d %d; ", i, aligntokens[i].unit);
+                        fprintf(stderr, "\n");
+                    }
+                    for (size_t t = ts; t < te; t++)
+                    {
+                        if (thisedgealignments[j][t - ts] != thisedgealignmentsgpu[j][t - ts])
+                            fprintf(stderr, "edge %d, sil ? %d, time %d, alignment / alignmentgpu MISMATCH %d v.s. %d\n", j, edgehassil ? 1 : 0, (int) (t - ts), thisedgealignments[j][t - ts], thisedgealignmentsgpu[j][t - ts]);
+                    }
                 }
             }
+            catch (...)
+            {
+#pragma omp critical
+                error = std::current_exception();
+            }
         }
+        if (error)
+            std::rethrow_exception(error);
     }
 }
 
@@ -5,8 +5,58 @@
 #include "Eval.h"
 #include "DataReader.h"
 #include "Config.h"
+#include <thread>
 using namespace Microsoft::MSR::CNTK;
 
+// measure latency and throughput of EvalConcurrent for 1..maxCallers concurrent callers, each evaluating one sample at a time
+template <typename ElemType>
+void DoConcurrentBenchmark(const ConfigParameters& config, const std::wstring& modelPath, const std::wstring& inputName, const std::wstring& outputName)
+{
+    size_t maxCallers = config("concurrentCallers", "64");
+    size_t requestsPerCaller = config("requestsPerCaller", "1000");
+
+    EvalConcurrent<ElemType> eval(config);
+    eval.LoadModel(modelPath);
+    std::map<std::wstring, size_t> dims;
+    dims[inputName] = 0;
+    dims[outputName] = 0;
+    eval.GetNodeDimensions(dims, nodeSpecified);
+    eval.StartEvaluateMinibatchLoop(std::vector<std::wstring>{inputName}, std::vector<std::wstring>{outputName});
+
+    for (size_t numCallers = 1; numCallers <= maxCallers; numCallers *= 2)
+    {
+        std::vector<std::vector<double>> latencies(numCallers);
+        std::vector<std::thread> callers;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t c = 0; c < numCallers; c++)
+        {
+            callers.push_back(std::thread([&, c]
+                                          {
+                                              std::vector<ElemType> input(dims[inputName], (ElemType) c);
+                                              std::vector<ElemType> output(dims[outputName]);
+                                              const ElemType* inputs[] = {input.data()};
+                                              ElemType* outputs[] = {output.data()};
+                                              for (size_t i = 0; i < requestsPerCaller; i++)
+                                              {
+                                                  auto requestStart = std::chrono::steady_clock::now();
+                                                  eval.Evaluate(inputs, outputs, 1);
+                                                  latencies[c].push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - requestStart).count());
+                                              }
+                                          }));
+        }
+        for (auto& caller : callers)
+            caller.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<double> all;
+        for (const auto& l : latencies)
+            all.insert(all.end(), l.begin(), l.end());
+        std::sort(all.begin(), all.end());
+        fprintf(stderr, "callers = %3d: p50 = %.3f ms, p99 = %.3f ms, throughput = %.1f samples/s\n",
+                (int) numCallers, all[all.size() / 2], all[all.size() * 99 / 100], all.size() / seconds);
+    }
+}
+
 // process the command
 template <typename ElemType>
 void DoCommand(const ConfigParameters& configRoot)
@@ -36,6 +86,12 @@ void DoCommand(const ConfigParameters& configRoot)
     std::map<std::wstring, Matrix<ElemType>*> outputMatrices;
     std::wstring inputName = L"features";
     std::wstring outputName = L"CE.BFF.FF.P";
+    if (config.Exists("concurrentCallers"))
+    {
+        DoConcurrentBenchmark<ElemType>(config, modelPath, inputName, outputName);
+        return;
+    }
+
     int deviceId = 0;
     Matrix<ElemType>* matrix = inputMatrices[inputName] = new Matrix<ElemType>(dimFeatures, mbSize, deviceId);
     outputMatrices[outputName] = new Matrix<ElemType>(dimLabels, mbSize, deviceId);
@@ -12,6 +12,7 @@
 #include <vector>
 #include "Matrix.h"
 #include "CPUMatrix.h"
+#include "ConvolutionEngine.h"
 #include "Sequences.h"
 using namespace Microsoft::MSR::CNTK;
 using namespace std;
@@ -435,6 +436,81 @@ void MandSTest(int count, int devId)
     delete[] data3;
 }
 
+// compares the CPU convolution engine against the legacy engine on the CPU
+// Note: Times are wall-clock times, since both engines are multi-threaded.
+template <class ElemType>
+void ConvolutionEngineTest(size_t inW, size_t inH, size_t cmapIn, size_t kW, size_t kH, size_t cmapOut, size_t stride, bool pad, size_t n, bool sparse = false, int count = 10)
+{
+    typedef ConvolutionEngineFactory<ElemType> ConvFact;
+    const DEVICEID_TYPE deviceId = -1; // CPU
+    size_t outW = (inW - (pad ? 1 : kW)) / stride + 1;
+    size_t outH = (inH - (pad ? 1 : kH)) / stride + 1;
+    cout << "Input " << inW << "x" << inH << "x" << cmapIn << ", filter " << kW << "x" << kH << "x" << cmapOut
+         << ", stride " << stride << (pad ? ", padded" : "") << (sparse ? ", sparse" : "") << ", minibatch " << n << endl;
+
+    Matrix<ElemType> in(inW * inH * cmapIn, n, deviceId);
+    randomInitializeMatrix<ElemType>(in, -1, 1);
+    Matrix<ElemType> sparseIn(inW * inH * cmapIn, n, deviceId, MatrixType::SPARSE, matrixFormatSparseCSC);
+    if (sparse) // one-hot pixels, like words in text input
+    {
+        vector<CPUSPARSE_INDEX_TYPE> colStarts(1, 0), rows;
+        in.SetValue(0);
+        for (size_t j = 0; j < n; j++)
+        {
+            for (size_t i = 0; i < inW * inH; i++)
+            {
+                rows.push_back((CPUSPARSE_INDEX_TYPE) (i * cmapIn + rand() % cmapIn));
+                in(rows.back(), j) = 1;
+            }
+            colStarts.push_back((CPUSPARSE_INDEX_TYPE) rows.size());
+        }
+        vector<ElemType> values(rows.size(), 1);
+        sparseIn.SetMatrixFromCSCFormat(colStarts.data(), rows.data(), values.data(), values.size(), inW * inH * cmapIn, n);
+    }
+    Matrix<ElemType> filter(cmapOut, kW * kH * cmapIn, deviceId);
+    randomInitializeMatrix<ElemType>(filter, -1, 1);
+    Matrix<ElemType> srcGrad(outW * outH * cmapOut, n, deviceId);
+    randomInitializeMatrix<ElemType>(srcGrad, -1, 1);
+    Matrix<ElemType> grad(inW * inH * cmapIn, n, deviceId);
+    Matrix<ElemType> out(outW * outH * cmapOut, n, deviceId);
+    Matrix<ElemType> workspace(deviceId);
+
+    for (auto engineType : {ConvFact::EngineType::Legacy, ConvFact::EngineType::Cpu})
+    {
+        auto fact = ConvFact::Create(deviceId, engineType, ImageLayoutKind::HWC);
+        auto eng = fact->CreateConvEngine(deviceId, 0);
+        auto inT = fact->CreateTensor(inW, inH, cmapIn, n);
+        auto filterT = fact->CreateFilter(kW, kH, cmapIn, cmapOut);
+        auto outT = fact->CreateTensor(outW, outH, cmapOut, n);
+        auto convT = fact->CreateConvDescriptor(*inT, *filterT, stride, stride, pad);
+
+        // only the new engine takes sparse input
+        const Matrix<ElemType>& engineIn = sparse && engineType == ConvFact::EngineType::Cpu ? sparseIn : in;
+
+        double forward = 0, backwardData = 0, backwardFilter = 0;
+        for (int i = 0; i <= count; i++) // the first iteration is a warm-up
+        {
+            auto t0 = chrono::steady_clock::now();
+            eng->Forward(*inT, engineIn, *filterT, filter, *convT, *outT, out, workspace);
+            auto t1 = chrono::steady_clock::now();
+            if (!sparse)
+                eng->BackwardData(*outT, srcGrad, *filterT, filter, *convT, *inT, grad, workspace);
+            auto t2 = chrono::steady_clock::now();
+            eng->BackwardFilter(*outT, srcGrad, *inT, engineIn, *convT, *filterT, filter, false, workspace);
+            auto t3 = chrono::steady_clock::now();
+            if (i > 0)
+            {
+                forward += chrono::duration<double>(t1 - t0).count();
+                backwardData += chrono::duration<double>(t2 - t1).count();
+                backwardFilter += chrono::duration<double>(t3 - t2).count();
+            }
+        }
+        cout << (engineType == ConvFact::EngineType::Cpu ? "  CPU engine:    " : "  Legacy engine: ")
+             << "forward " << 1000 * forward / count << " ms, backward data " << 1000 * backwardData / count
+             << " ms, backward filter " << 1000 * backwardFilter / count << " ms" << endl;
+    }
+}
+
 int wmain()
 {
     ColumnSliceMultAndAddTest<float>(2048, 2048, 256, 0);
@@ -443,6 +519,14 @@ int wmain()
 
     TestOldRnnForwardPropSRP<float>();
 
+    ConvolutionEngineTest<float>(32, 32, 64, 1, 1, 64, 1, false, 64);  // 1x1
+    ConvolutionEngineTest<float>(28, 28, 1, 3, 3, 64, 1, true, 64);    // first layer over gray-scale images
+    ConvolutionEngineTest<float>(32, 32, 3, 3, 3, 32, 1, true, 64);    // first layer over color images
+    ConvolutionEngineTest<float>(16, 16, 64, 3, 3, 64, 1, true, 64);   // inner layer
+    ConvolutionEngineTest<float>(32, 32, 32, 5, 5, 32, 2, true, 64);   // strided
+    ConvolutionEngineTest<float>(100, 1, 256, 3, 1, 128, 1, true, 32); // 1-D, over word embeddings
+    ConvolutionEngineTest<float>(100, 1, 5000, 3, 1, 128, 1, true, 32, true); // 1-D, over one-hot words
+
     // MandSTest<float>(100, 2);
 
     /*cout<<endl<<"********************Matrix SquareMultiplyAndWeightedAdd10TimesAvg TEST********************"<<endl;
@@ -4,6 +4,8 @@
 //
 #include "stdafx.h"
 #include "../../../Source/Math/CPUMatrix.h"
+#include <cmath>
+#include <functional>
 
 using namespace Microsoft::MSR::CNTK;
 
@@ -898,6 +900,306 @@ BOOST_FIXTURE_TEST_CASE(CPUMatrixSeedingDouble, RandomSeedFixture)
     BOOST_CHECK(m1.IsEqualTo(m2));
 }
 
+BOOST_FIXTURE_TEST_CASE(CPUMatrixTensorOpMultiThreaded, RandomSeedFixture)
+{
+    // the multi-threaded/SIMD TensorOp must give the same results as the single-threaded one
+    const size_t rows = 517;
+    const size_t cols = 263;
+    const unsigned long seed = 4711;
+    auto a = SMatrix::RandomUniform(rows, cols, -1, 1, seed);
+    auto b = SMatrix::RandomUniform(rows, cols, -1, 1, seed + 1);
+
+    std::array<size_t, 3> offsets3 = {0, 0, 0};
+    std::array<size_t, 2> offsets2 = {0, 0};
+    SmallVector<size_t> elementwiseDims(1, rows * cols);
+    std::array<SmallVector<ptrdiff_t>, 3> elementwiseStrides3 = {SmallVector<ptrdiff_t>(1, 1), SmallVector<ptrdiff_t>(1, 1), SmallVector<ptrdiff_t>(1, 1)};
+    std::array<SmallVector<ptrdiff_t>, 2> elementwiseStrides2 = {SmallVector<ptrdiff_t>(1, 1), SmallVector<ptrdiff_t>(1, 1)};
+    SmallVector<size_t> noReductionDims;
+    std::array<SmallVector<ptrdiff_t>, 3> noReductionStrides3;
+    std::array<SmallVector<ptrdiff_t>, 2> noReductionStrides2;
+    // row sums: regular dim = rows, reducing dim = cols
+    SmallVector<size_t> rowDims(1, rows);
+    SmallVector<size_t> colDims(1, cols);
+    std::array<SmallVector<ptrdiff_t>, 2> rowStrides = {SmallVector<ptrdiff_t>(1, 1), SmallVector<ptrdiff_t>(1, 1)};
+    std::array<SmallVector<ptrdiff_t>, 2> colStrides = {SmallVector<ptrdiff_t>(1, (ptrdiff_t) rows), SmallVector<ptrdiff_t>(1, 0)};
+    // full reduction to a scalar: no regular dim, one reducing dim over all elements
+    SmallVector<size_t> noRegularDims;
+    std::array<SmallVector<ptrdiff_t>, 2> noRegularStrides;
+    std::array<SmallVector<ptrdiff_t>, 2> allStrides = {SmallVector<ptrdiff_t>(1, 1), SmallVector<ptrdiff_t>(1, 0)};
+    // fewer outputs than threads: two outputs, each the sum over half of the columns
+    const size_t halfSize = rows * (cols / 2);
+    SmallVector<size_t> halvesDims(1, 2);
+    SmallVector<size_t> halfDims(1, halfSize);
+    std::array<SmallVector<ptrdiff_t>, 2> halvesStrides = {SmallVector<ptrdiff_t>(1, (ptrdiff_t) halfSize), SmallVector<ptrdiff_t>(1, 1)};
+
+    SMatrix sum[2], sigmoid[2], product[2], rowSum[2], totalSum[2], halfSums[2];
+    for (int pass = 0; pass < 2; pass++)
+    {
+        CPUMatrix<float>::SetNumThreads(pass == 0 ? 1 : 4);
+        sum[pass].Resize(rows, cols);
+        sum[pass].SetValue(1);
+        sum[pass].TensorOp(0.5f, a, b, 0.3f, ElementWiseOperator::opSum, offsets3, elementwiseDims, elementwiseStrides3, noReductionDims, noReductionStrides3);
+        product[pass].Resize(rows, cols);
+        product[pass].TensorOp(0, a, b, 1, ElementWiseOperator::opElementwiseProduct, offsets3, elementwiseDims, elementwiseStrides3, noReductionDims, noReductionStrides3);
+        sigmoid[pass].Resize(rows, cols);
+        sigmoid[pass].TensorOp(0, a, 1, ElementWiseOperator::opSigmoid, offsets2, elementwiseDims, elementwiseStrides2, noReductionDims, noReductionStrides2);
+        rowSum[pass].Resize(rows, 1);
+        rowSum[pass].TensorOp(0, a, 1, ElementWiseOperator::opCopy, offsets2, rowDims, rowStrides, colDims, colStrides);
+        totalSum[pass].Resize(1, 1);
+        totalSum[pass].TensorOp(0, a, 1, ElementWiseOperator::opCopy, offsets2, noRegularDims, noRegularStrides, elementwiseDims, allStrides);
+        halfSums[pass].Resize(2, 1);
+        halfSums[pass].TensorOp(0, a, 1, ElementWiseOperator::opCopy, offsets2, halvesDims, halvesStrides, halfDims, allStrides);
+    }
+    CPUMatrix<float>::SetNumThreads(0);
+
+    BOOST_CHECK(sum[1].IsEqualTo(sum[0], 0));
+    BOOST_CHECK(product[1].IsEqualTo(product[0], 0));
+    BOOST_CHECK(sigmoid[1].IsEqualTo(sigmoid[0], 0));
+    BOOST_CHECK(rowSum[1].IsEqualTo(rowSum[0], 0));
+    // reductions must not depend on the number of threads, not even in the last bit
+    BOOST_CHECK_EQUAL(totalSum[1](0, 0), totalSum[0](0, 0));
+    BOOST_CHECK_EQUAL(halfSums[1](0, 0), halfSums[0](0, 0));
+    BOOST_CHECK_EQUAL(halfSums[1](1, 0), halfSums[0](1, 0));
+    double expectedTotal = 0;
+    for (size_t j = 0; j < cols; j++)
+        for (size_t i = 0; i < rows; i++)
+            expectedTotal += a(i, j);
+    BOOST_CHECK_CLOSE(totalSum[0](0, 0), (float) expectedTotal, 1e-3);
+    BOOST_CHECK_CLOSE(sum[0](3, 5), 0.5f * 1 + 0.3f * (a(3, 5) + b(3, 5)), 1e-4);
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUMatrixLSTMCell, RandomSeedFixture)
+{
+    // compare the fused LSTM cell against finite differences of loss = sum(dh .* h) + sum(dcNext .* c)
+    const size_t H = 3;
+    const size_t S = 2;
+    const unsigned long seed = 4711;
+    auto gatesIn = DMatrix::RandomUniform(4 * H, S, -1, 1, seed);
+    auto peepholes = DMatrix::RandomUniform(H, 3, -1, 1, seed + 1);
+    auto cPrev = DMatrix::RandomUniform(H, S, -1, 1, seed + 2);
+    auto dh = DMatrix::RandomUniform(H, S, -1, 1, seed + 3);
+    auto dcNext = DMatrix::RandomUniform(H, S, -1, 1, seed + 4);
+
+    auto loss = [&](const DMatrix& g0, const DMatrix& p, const DMatrix& cp)
+    {
+        DMatrix gates(g0), c(H, S), h(H, S);
+        DMatrix::LSTMCellForward(gates, p, cp, c, h);
+        double sum = 0;
+        foreach_coord (i, j, h)
+            sum += dh(i, j) * h(i, j) + dcNext(i, j) * c(i, j);
+        return sum;
+    };
+
+    DMatrix gates(gatesIn), c(H, S), h(H, S);
+    DMatrix::LSTMCellForward(gates, peepholes, cPrev, c, h);
+    for (size_t j = 0; j < S; j++)
+        for (size_t r = 0; r < H; r++)
+        {
+            double it = 1 / (1 + std::exp(-(gatesIn(r, j) + peepholes(r, 0) * cPrev(r, j))));
+            double ft = 1 / (1 + std::exp(-(gatesIn(H + r, j) + peepholes(r, 1) * cPrev(r, j))));
+            double ct = ft * cPrev(r, j) + it * std::tanh(gatesIn(2 * H + r, j));
+            double ot = 1 / (1 + std::exp(-(gatesIn(3 * H + r, j) + peepholes(r, 2) * ct)));
+            BOOST_CHECK_CLOSE(c(r, j), ct, 1e-8);
+            BOOST_CHECK_CLOSE(h(r, j), ot * std::tanh(ct), 1e-8);
+        }
+
+    DMatrix dc(dcNext), dGates(4 * H, S), dPeepholes(H, 3);
+    dPeepholes.SetValue(0);
+    DMatrix::LSTMCellBackward(gates, peepholes, cPrev, c, dh, dc, dGates, dPeepholes);
+
+    const double eps = 1e-6;
+    foreach_coord (i, j, gatesIn)
+    {
+        DMatrix plus(gatesIn), minus(gatesIn);
+        plus(i, j) += eps;
+        minus(i, j) -= eps;
+        BOOST_CHECK_CLOSE(dGates(i, j), (loss(plus, peepholes, cPrev) - loss(minus, peepholes, cPrev)) / (2 * eps), 1e-4);
+    }
+    foreach_coord (i, j, cPrev)
+    {
+        DMatrix plus(cPrev), minus(cPrev);
+        plus(i, j) += eps;
+        minus(i, j) -= eps;
+        BOOST_CHECK_CLOSE(dc(i, j), (loss(gatesIn, peepholes, plus) - loss(gatesIn, peepholes, minus)) / (2 * eps), 1e-4);
+    }
+    foreach_coord (i, j, peepholes)
+    {
+        DMatrix plus(peepholes), minus(peepholes);
+        plus(i, j) += eps;
+        minus(i, j) -= eps;
+        BOOST_CHECK_CLOSE(dPeepholes(i, j), (loss(gatesIn, plus, cPrev) - loss(gatesIn, minus, cPrev)) / (2 * eps), 1e-4);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUMatrixGRUCell, RandomSeedFixture)
+{
+    // compare the fused GRU cell against finite differences of loss = sum(dh .* h)
+    const size_t H = 3;
+    const size_t S = 2;
+    const unsigned long seed = 4711;
+    auto gatesIn = DMatrix::RandomUniform(3 * H, S, -1, 1, seed);
+    auto hiddenProj = DMatrix::RandomUniform(3 * H, S, -1, 1, seed + 1);
+    auto hPrev = DMatrix::RandomUniform(H, S, -1, 1, seed + 2);
+    auto dh = DMatrix::RandomUniform(H, S, -1, 1, seed + 3);
+
+    auto loss = [&](const DMatrix& g0, const DMatrix& rh, const DMatrix& hp)
+    {
+        DMatrix gates(g0), h(H, S);
+        DMatrix::GRUCellForward(gates, rh, hp, h);
+        double sum = 0;
+        foreach_coord (i, j, h)
+            sum += dh(i, j) * h(i, j);
+        return sum;
+    };
+
+    DMatrix gates(gatesIn), h(H, S);
+    DMatrix::GRUCellForward(gates, hiddenProj, hPrev, h);
+    for (size_t j = 0; j < S; j++)
+        for (size_t r = 0; r < H; r++)
+        {
+            double zt = 1 / (1 + std::exp(-(gatesIn(r, j) + hiddenProj(r, j))));
+            double rt = 1 / (1 + std::exp(-(gatesIn(H + r, j) + hiddenProj(H + r, j))));
+            double nt = std::tanh(gatesIn(2 * H + r, j) + rt * hiddenProj(2 * H + r, j));
+            BOOST_CHECK_CLOSE(h(r, j), (1 - zt) * nt + zt * hPrev(r, j), 1e-8);
+        }
+
+    DMatrix dGates(3 * H, S), dHiddenProj(3 * H, S), dhPrev(H, S);
+    DMatrix::GRUCellBackward(gates, hiddenProj, hPrev, dh, dGates, dHiddenProj, dhPrev);
+
+    const double eps = 1e-6;
+    foreach_coord (i, j, gatesIn)
+    {
+        DMatrix plus(gatesIn), minus(gatesIn);
+        plus(i, j) += eps;
+        minus(i, j) -= eps;
+        BOOST_CHECK_CLOSE(dGates(i, j), (loss(plus, hiddenProj, hPrev) - loss(minus, hiddenProj, hPrev)) / (2 * eps), 1e-4);
+    }
+    foreach_coord (i, j, hiddenProj)
+    {
+        DMatrix plus(hiddenProj), minus(hiddenProj);
+        plus(i, j) += eps;
+        minus(i, j) -= eps;
+        BOOST_CHECK_CLOSE(dHiddenProj(i, j), (loss(gatesIn, plus, hPrev) - loss(gatesIn, minus, hPrev)) / (2 * eps), 1e-4);
+    }
+    foreach_coord (i, j, hPrev)
+    {
+        DMatrix plus(hPrev), minus(hPrev);
+        plus(i, j) += eps;
+        minus(i, j) -= eps;
+        BOOST_CHECK_CLOSE(dhPrev(i, j), (loss(gatesIn, hiddenProj, plus) - loss(gatesIn, hiddenProj, minus)) / (2 * eps), 1e-4);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUMatrixRCRF, RandomSeedFixture)
+{
+    // two label sequences of 4 and 3 steps, interleaved as in a minibatch of 2 parallel sequences (the last column is a gap);
+    // compare the batched forward-backward, transition gradient and Viterbi decoding against enumerating all paths
+    const size_t N = 3;
+    const size_t S = 2;
+    const size_t T = 4;
+    const unsigned long seed = 4711;
+    const std::vector<RCRFSequence> sequences = {{0, 4, S}, {1, 3, S}};
+    const std::vector<std::vector<size_t>> labels = {{0, 2, 1, 1}, {2, 2, 0}};
+    auto pos = DMatrix::RandomUniform(N, S * T, -1, 1, seed);
+    auto pair = DMatrix::RandomUniform(N, N, -1, 1, seed + 1);
+    DMatrix lbls(N, S * T);
+    lbls.SetValue(0);
+    for (size_t s = 0; s < S; s++)
+        for (size_t t = 0; t < labels[s].size(); t++)
+            lbls(labels[s][t], s + t * S) = 1;
+
+    auto logAdd = [](double x, double y)
+    {
+        return std::max(x, y) + std::log1p(std::exp(-std::fabs(x - y)));
+    };
+    // score of path y of sequence s: the paths start with a transition from the first label of the sequence
+    auto score = [&](const DMatrix& p, size_t s, const std::vector<size_t>& y, bool withStart)
+    {
+        double sum = withStart ? p(y[0], labels[s][0]) : 0;
+        for (size_t t = 0; t < y.size(); t++)
+            sum += pos(y[t], s + t * S) + (t > 0 ? p(y[t], y[t - 1]) : 0);
+        return sum;
+    };
+    auto forAllPaths = [&](size_t len, const std::function<void(const std::vector<size_t>&)>& f)
+    {
+        std::vector<size_t> y(len, 0);
+        for (size_t n = 0; n < (size_t) std::pow(N, len); n++)
+        {
+            for (size_t t = 0, m = n; t < len; t++, m /= N)
+                y[t] = m % N;
+            f(y);
+        }
+    };
+    auto negLogLikelihood = [&](const DMatrix& p)
+    {
+        double sum = 0;
+        for (size_t s = 0; s < S; s++)
+        {
+            double logZ = LZERO;
+            forAllPaths(labels[s].size(), [&](const std::vector<size_t>& y) { logZ = logAdd(logZ, score(p, s, y, true)); });
+            sum += logZ - score(p, s, labels[s], false); // (the labeled path is scored without the start transition)
+        }
+        return sum;
+    };
+
+    DMatrix alpha, beta, postprob;
+    double nll = DMatrix::RCRFForwardBackward(lbls, pos, pair, alpha, beta, postprob, sequences);
+    BOOST_CHECK_CLOSE(nll, negLogLikelihood(pair), 1e-8);
+    for (size_t s = 0; s < S; s++)
+    {
+        DMatrix expected(N, T);
+        expected.SetValue(0);
+        double logZ = LZERO;
+        forAllPaths(labels[s].size(), [&](const std::vector<size_t>& y) { logZ = logAdd(logZ, score(pair, s, y, true)); });
+        forAllPaths(labels[s].size(), [&](const std::vector<size_t>& y)
+        {
+            for (size_t t = 0; t < y.size(); t++)
+                expected(y[t], t) += std::exp(score(pair, s, y, true) - logZ);
+        });
+        for (size_t t = 0; t < labels[s].size(); t++)
+            for (size_t k = 0; k < N; k++)
+                BOOST_CHECK_CLOSE(postprob(k, s + t * S), expected(k, t), 1e-8);
+    }
+
+    // the gradient also counts the start transition of the labeled paths, into their first label
+    DMatrix grd(N, N);
+    grd.SetValue(0);
+    DMatrix::RCRFTransGrdCompute(lbls, alpha, beta, pair, grd, sequences);
+    const double eps = 1e-6;
+    foreach_coord (i, j, pair)
+    {
+        DMatrix plus(pair), minus(pair);
+        plus(i, j) += eps;
+        minus(i, j) -= eps;
+        double expected = (negLogLikelihood(plus) - negLogLikelihood(minus)) / (2 * eps);
+        for (size_t s = 0; s < S; s++)
+            if (i == labels[s][0] && j == labels[s][0])
+                expected -= 1;
+        BOOST_CHECK_CLOSE(grd(i, j), expected, 1e-4);
+    }
+
+    // Viterbi: best path from the first to the last label of each sequence
+    DMatrix decoded;
+    DMatrix::RCRFViterbi(lbls, pos, pair, decoded, sequences);
+    for (size_t s = 0; s < S; s++)
+    {
+        const size_t len = labels[s].size();
+        std::vector<size_t> best;
+        double bestScore = LZERO;
+        forAllPaths(len, [&](const std::vector<size_t>& y)
+        {
+            if (y[0] == labels[s][0] && y[len - 1] == labels[s][len - 1] && score(pair, s, y, false) > bestScore)
+            {
+                bestScore = score(pair, s, y, false);
+                best = y;
+            }
+        });
+        for (size_t t = 0; t < len; t++)
+            for (size_t k = 0; k < N; k++)
+                BOOST_CHECK_EQUAL(decoded(k, s + t * S), k == best[t] ? 1 : 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 }
 } } }
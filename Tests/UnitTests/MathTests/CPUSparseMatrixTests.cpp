@@ -59,6 +59,108 @@ BOOST_FIXTURE_TEST_CASE(CPUSparseMatrixCopyColumnSliceToDense, RandomSeedFixture
     BOOST_CHECK(dm1.IsEqualTo(dm2, c_epsilonFloatE4));
 }
 
+BOOST_FIXTURE_TEST_CASE(CPUSparseMatrixColumnLookup, RandomSeedFixture)
+{
+    const size_t dim = 8;
+    const size_t vocabSize = 30;
+    const size_t wordsPerSample = 2;
+    const size_t numSamples = 12;
+    DenseMatrix table(dim, vocabSize);
+    table.SetUniformRandomValue(-1, 1, IncrementCounter());
+
+    // two words per sample, the first one weighted
+    SparseMatrix indices(MatrixFormat::matrixFormatSparseCSC, vocabSize * wordsPerSample, numSamples, 0);
+    for (size_t j = 0; j < numSamples; j++)
+    {
+        indices.SetValue((j * 7) % vocabSize, j, 0.5);
+        indices.SetValue(vocabSize + (j * 3) % vocabSize, j, 1);
+    }
+
+    DenseMatrix out;
+    SparseMatrix::ColumnLookup(table, indices, out);
+    BOOST_CHECK_EQUAL(out.GetNumRows(), dim * wordsPerSample);
+    BOOST_CHECK_EQUAL(out.GetNumCols(), numSamples);
+    foreach_coord (row, col, out)
+    {
+        double expected = row < dim ? 0.5 * table(row, (col * 7) % vocabSize) : table(row - dim, (col * 3) % vocabSize);
+        BOOST_CHECK_CLOSE(out(row, col), expected, c_epsilonFloatE4);
+    }
+
+    // the gradient accumulates into the same columns, whether dense or block-column
+    DenseMatrix outGrad(dim * wordsPerSample, numSamples);
+    outGrad.SetUniformRandomValue(-1, 1, IncrementCounter());
+    DenseMatrix denseGrad(dim, vocabSize);
+    denseGrad.SetValue(0);
+    SparseMatrix sparseGrad(MatrixFormat::matrixFormatSparseBlockCol, dim, vocabSize, 0);
+    for (size_t i = 0; i < 2; i++)
+    {
+        SparseMatrix::ColumnLookupGradient(outGrad, indices, denseGrad);
+        SparseMatrix::ColumnLookupGradient(outGrad, indices, sparseGrad);
+    }
+
+    DenseMatrix expectedGrad(dim, vocabSize);
+    expectedGrad.SetValue(0);
+    for (size_t j = 0; j < numSamples; j++)
+    {
+        for (size_t h = 0; h < dim; h++)
+        {
+            expectedGrad(h, (j * 7) % vocabSize) += 2 * 0.5 * outGrad(h, j);
+            expectedGrad(h, (j * 3) % vocabSize) += 2 * outGrad(dim + h, j);
+        }
+    }
+    BOOST_CHECK(denseGrad.IsEqualTo(expectedGrad, c_epsilonFloatE4));
+
+    DenseMatrix sparseGradAsDense(dim, vocabSize);
+    sparseGradAsDense.SetValue(0);
+    SparseMatrix::ScaleAndAdd(1, sparseGrad, sparseGradAsDense);
+    BOOST_CHECK(sparseGradAsDense.IsEqualTo(expectedGrad, c_epsilonFloatE4));
+
+    std::vector<size_t> columns;
+    sparseGrad.GetNonZeroColumnIds(columns);
+    BOOST_CHECK_EQUAL(sparseGrad.NzCount(), columns.size() * dim);
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUSparseMatrixNormalGradBlockColumn, RandomSeedFixture)
+{
+    const size_t dim = 6;
+    const size_t numCols = 20;
+    const double learnRatePerSample = 0.1;
+    const double momentum = 0.9;
+
+    for (bool useNesterovMomentum : {false, true})
+    {
+        DenseMatrix outGrad(dim, 4);
+        outGrad.SetUniformRandomValue(-1, 1, IncrementCounter());
+        SparseMatrix indices(MatrixFormat::matrixFormatSparseCSC, numCols, 4, 0);
+        for (size_t j = 0; j < 4; j++)
+            indices.SetValue(3 * j + 1, j, 1);
+        SparseMatrix sparseGrad(MatrixFormat::matrixFormatSparseBlockCol, dim, numCols, 0);
+        SparseMatrix::ColumnLookupGradient(outGrad, indices, sparseGrad);
+        DenseMatrix denseGrad(dim, numCols);
+        denseGrad.SetValue(0);
+        SparseMatrix::ColumnLookupGradient(outGrad, indices, denseGrad);
+
+        DenseMatrix weights(dim, numCols), smoothed(dim, numCols);
+        weights.SetUniformRandomValue(-1, 1, IncrementCounter());
+        smoothed.SetUniformRandomValue(-1, 1, IncrementCounter());
+        DenseMatrix expectedWeights(weights), expectedSmoothed(smoothed);
+
+        sparseGrad.NormalGrad(smoothed, weights, learnRatePerSample, momentum, useNesterovMomentum);
+
+        // dense reference, restricted to the columns that have a gradient
+        foreach_coord (row, col, expectedWeights)
+        {
+            if ((col % 3) != 1 || col > 10)
+                continue;
+            double& v = expectedSmoothed(row, col);
+            v = momentum * v + (1 - momentum) * learnRatePerSample * denseGrad(row, col);
+            expectedWeights(row, col) -= useNesterovMomentum ? momentum * v + (1 - momentum) * learnRatePerSample * denseGrad(row, col) : v;
+        }
+        BOOST_CHECK(smoothed.IsEqualTo(expectedSmoothed, c_epsilonFloatE4));
+        BOOST_CHECK(weights.IsEqualTo(expectedWeights, c_epsilonFloatE4));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 }
 } } }
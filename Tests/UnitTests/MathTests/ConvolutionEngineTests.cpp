@@ -596,6 +596,142 @@ BOOST_AUTO_TEST_CASE(AvgPoolBackward)
     }
 }
 
+// The CPU engine selects a different algorithm depending on the geometry; each must give the same result as the legacy engine.
+BOOST_AUTO_TEST_CASE(CpuConvolutionMatchesLegacy)
+{
+    struct Geometry
+    {
+        int n, cmapIn, inW, inH, kW, kH, sW, sH, cmapOut;
+        bool pad;
+        bool sparse;
+    };
+    const Geometry geometries[] = {
+        {5, 16, 7, 6, 1, 1, 1, 1, 8, false, false},  // matrix product
+        {5, 1, 9, 8, 3, 3, 1, 1, 32, true, false},   // direct
+        {5, 1, 9, 8, 3, 3, 2, 2, 40, false, false},  // direct, strided
+        {5, 3, 9, 8, 3, 3, 1, 1, 8, true, false},    // unpack
+        {5, 8, 9, 8, 3, 3, 1, 2, 6, true, false},    // unpack
+        {1, 8, 9, 8, 3, 3, 1, 1, 6, true, false},    // unpack, fewer samples than threads
+        {3, 4, 11, 10, 5, 5, 2, 1, 5, true, false},  // unpack, strided
+        {6, 1, 20, 1, 5, 1, 1, 1, 32, false, false}, // 1-D, direct
+        {6, 8, 20, 1, 5, 1, 1, 1, 7, false, false},  // 1-D
+        {6, 32, 20, 1, 3, 1, 1, 1, 7, true, true},   // 1-D over sparse input (e.g. one-hot text)
+        {4, 3, 9, 8, 3, 3, 2, 2, 4, true, true},     // sparse
+    };
+
+    const int deviceId = -1;
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::string emsg;
+
+    auto legacyFact = ConvFact::Create(deviceId, ConvFact::EngineType::Legacy, ImageLayoutKind::HWC);
+    auto cpuFact = ConvFact::Create(deviceId, ConvFact::EngineType::Cpu, ImageLayoutKind::HWC);
+    auto legacyEng = legacyFact->CreateConvEngine(deviceId, 0);
+    auto cpuEng = cpuFact->CreateConvEngine(deviceId, 0);
+
+    for (const auto& g : geometries)
+    {
+        int outW = GetNumOut(g.inW, g.kW, g.sW, g.pad);
+        int outH = GetNumOut(g.inH, g.kH, g.sH, g.pad);
+        auto inT = cpuFact->CreateTensor(g.inW, g.inH, g.cmapIn, g.n);
+        auto filtT = cpuFact->CreateFilter(g.kW, g.kH, g.cmapIn, g.cmapOut);
+        auto outT = cpuFact->CreateTensor(outW, outH, g.cmapOut, g.n);
+        auto convT = cpuFact->CreateConvDescriptor(*inT, *filtT, g.sW, g.sH, g.pad);
+
+        int inSize = g.inW * g.inH * g.cmapIn;
+        int outSize = outW * outH * g.cmapOut;
+        vec inBuf(inSize * g.n);
+        for (auto& v : inBuf)
+            v = g.sparse ? (rng() % 8 == 0 ? dist(rng) : 0) : dist(rng);
+        vec filtBuf(g.cmapOut * g.kW * g.kH * g.cmapIn);
+        std::generate(filtBuf.begin(), filtBuf.end(), [&] { return dist(rng); });
+        vec srcGradBuf(outSize * g.n);
+        std::generate(srcGradBuf.begin(), srcGradBuf.end(), [&] { return dist(rng); });
+        SingleMatrix in(inSize, g.n, inBuf.data(), deviceId, matrixFlagNormal);
+        SingleMatrix filt(g.cmapOut, g.kW * g.kH * g.cmapIn, filtBuf.data(), deviceId, matrixFlagNormal);
+        SingleMatrix srcGrad(outSize, g.n, srcGradBuf.data(), deviceId, matrixFlagNormal);
+
+        SingleMatrix cpuIn(inSize, g.n, inBuf.data(), deviceId, matrixFlagNormal);
+        if (g.sparse)
+        {
+            std::vector<CPUSPARSE_INDEX_TYPE> colStarts(1, 0), rows;
+            vec values;
+            for (int j = 0; j < g.n; j++)
+            {
+                for (int i = 0; i < inSize; i++)
+                {
+                    if (inBuf[j * inSize + i] != 0)
+                    {
+                        rows.push_back(i);
+                        values.push_back(inBuf[j * inSize + i]);
+                    }
+                }
+                colStarts.push_back((CPUSPARSE_INDEX_TYPE) rows.size());
+            }
+            cpuIn.SwitchToMatrixType(MatrixType::SPARSE, matrixFormatSparseCSC, false);
+            cpuIn.SetMatrixFromCSCFormat(colStarts.data(), rows.data(), values.data(), values.size(), inSize, g.n);
+        }
+
+        std::stringstream msg;
+        msg << " (" << g.inW << "x" << g.inH << "x" << g.cmapIn << " * " << g.kW << "x" << g.kH << "x" << g.cmapOut
+            << ", stride " << g.sW << "x" << g.sH << (g.pad ? ", pad" : "") << (g.sparse ? ", sparse" : "") << ")";
+
+        SingleMatrix workspace(deviceId);
+        SingleMatrix outExp(outSize, g.n, deviceId);
+        SingleMatrix out(outSize, g.n, deviceId);
+        legacyEng->Forward(*inT, in, *filtT, filt, *convT, *outT, outExp, workspace);
+        cpuEng->Forward(*inT, cpuIn, *filtT, filt, *convT, *outT, out, workspace);
+        BOOST_REQUIRE_MESSAGE(CheckEqual(out, outExp, emsg, Err<float>::Rel * 16, Err<float>::Abs * 16), "Forward" << msg.str() << ". " << emsg);
+
+        if (!g.sparse)
+        {
+            // the gradient is accumulated
+            SingleMatrix gradExp(inSize, g.n, inBuf.data(), deviceId, matrixFlagNormal);
+            SingleMatrix grad(inSize, g.n, inBuf.data(), deviceId, matrixFlagNormal);
+            legacyEng->BackwardData(*outT, srcGrad, *filtT, filt, *convT, *inT, gradExp, workspace);
+            cpuEng->BackwardData(*outT, srcGrad, *filtT, filt, *convT, *inT, grad, workspace);
+            BOOST_REQUIRE_MESSAGE(CheckEqual(grad, gradExp, emsg, Err<float>::Rel * 16, Err<float>::Abs * 16), "BackwardData" << msg.str() << ". " << emsg);
+        }
+
+        SingleMatrix filtGradExp(g.cmapOut, g.kW * g.kH * g.cmapIn, filtBuf.data(), deviceId, matrixFlagNormal);
+        SingleMatrix filtGrad(g.cmapOut, g.kW * g.kH * g.cmapIn, filtBuf.data(), deviceId, matrixFlagNormal);
+        legacyEng->BackwardFilter(*outT, srcGrad, *inT, in, *convT, *filtT, filtGradExp, false, workspace);
+        cpuEng->BackwardFilter(*outT, srcGrad, *inT, cpuIn, *convT, *filtT, filtGrad, false, workspace);
+        BOOST_REQUIRE_MESSAGE(CheckEqual(filtGrad, filtGradExp, emsg, Err<float>::Rel * 64, Err<float>::Abs * 64), "BackwardFilter" << msg.str() << ". " << emsg);
+    }
+}
+
+// An empty minibatch adds nothing to the filter gradient, even if the engine's workspaces still hold the results of a previous call.
+BOOST_AUTO_TEST_CASE(CpuConvolutionBackwardFilterEmptyBatch)
+{
+    const int deviceId = -1;
+    const int cmapIn = 3, inW = 9, inH = 8, kW = 3, kH = 3, cmapOut = 8;
+    auto fact = ConvFact::Create(deviceId, ConvFact::EngineType::Cpu, ImageLayoutKind::HWC);
+    auto eng = fact->CreateConvEngine(deviceId, 0);
+    auto filtT = fact->CreateFilter(kW, kH, cmapIn, cmapOut);
+    SingleMatrix filtGrad = SingleMatrix::RandomUniform(cmapOut, kW * kH * cmapIn, deviceId, -1, 1, 1);
+    SingleMatrix workspace(deviceId);
+
+    for (int n : {5, 0})
+    {
+        auto inT = fact->CreateTensor(inW, inH, cmapIn, n);
+        auto outT = fact->CreateTensor(inW, inH, cmapOut, n);
+        auto convT = fact->CreateConvDescriptor(*inT, *filtT, 1, 1, true);
+        SingleMatrix in(inW * inH * cmapIn, n, deviceId);
+        SingleMatrix srcGrad(inW * inH * cmapOut, n, deviceId);
+        if (n > 0)
+        {
+            in.SetUniformRandomValue(-1, 1, 2);
+            srcGrad.SetUniformRandomValue(-1, 1, 3);
+        }
+        SingleMatrix filtGradBefore(deviceId);
+        filtGradBefore.SetValue(filtGrad);
+        eng->BackwardFilter(*outT, srcGrad, *inT, in, *convT, *filtT, filtGrad, false, workspace);
+        if (n == 0)
+            BOOST_CHECK(filtGrad.IsEqualTo(filtGradBefore, 0));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 // Batch normalization unit tests.
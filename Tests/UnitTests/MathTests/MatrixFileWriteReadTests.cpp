@@ -37,6 +37,90 @@ BOOST_FIXTURE_TEST_CASE(CPUMatrixFileWriteRead, RandomSeedFixture)
     BOOST_CHECK(matrixCpuCopy.IsEqualTo(matrixCpuRead, c_epsilonFloatE5));
 }
 
+BOOST_FIXTURE_TEST_CASE(CPUMatrixFileWriteReadMappable, RandomSeedFixture)
+{
+    CPUMatrix<float> matrixCpu = CPUMatrix<float>::RandomUniform(43, 10, -26.3f, 30.2f, IncrementCounter());
+    CPUMatrix<float> matrixCpuCopy = matrixCpu;
+
+    std::wstring fileNameCpu(L"MCPU.bin");
+    {
+        File fileCpu(fileNameCpu, fileOptionsBinary | fileOptionsWrite | fileOptionsMappable);
+        fileCpu << 'x'; // so that the blob does not start aligned
+        matrixCpu.WriteMappable(fileCpu);
+        fileCpu << 'y';
+    }
+
+    // read into a copy
+    {
+        File fileCpu(fileNameCpu, fileOptionsBinary | fileOptionsRead);
+        char c;
+        fileCpu >> c;
+        CPUMatrix<float> matrixCpuRead;
+        matrixCpuRead.ReadMappable(fileCpu);
+        fileCpu >> c;
+
+        BOOST_CHECK_EQUAL('y', c);
+        BOOST_CHECK(matrixCpuRead.OwnBuffer());
+        BOOST_CHECK(matrixCpuCopy.IsEqualTo(matrixCpuRead, c_epsilonFloatE5));
+    }
+
+    // refer to the mapped file in place; the matrix keeps the mapping alive after the file is closed
+    CPUMatrix<float> matrixCpuMapped(2, 2);
+    {
+        File fileCpu(fileNameCpu, fileOptionsBinary | fileOptionsRead);
+        fileCpu.Map();
+        char c;
+        fileCpu >> c;
+        matrixCpuMapped.ReadMappable(fileCpu);
+        fileCpu >> c;
+
+        BOOST_CHECK_EQUAL('y', c);
+    }
+    BOOST_CHECK(matrixCpuMapped.IsMapped());
+    BOOST_CHECK(!matrixCpuMapped.OwnBuffer());
+    BOOST_CHECK_EQUAL(0, ((size_t) matrixCpuMapped.BufferPointer()) % 64);
+    BOOST_CHECK(matrixCpuCopy.IsEqualTo(matrixCpuMapped, c_epsilonFloatE5));
+
+    // copies own their values, moves take the mapping along
+    CPUMatrix<float> matrixCpuDeepCopy(matrixCpuMapped);
+    BOOST_CHECK(!matrixCpuDeepCopy.IsMapped());
+    BOOST_CHECK(matrixCpuDeepCopy.OwnBuffer());
+    CPUMatrix<float> matrixCpuMoved(std::move(matrixCpuMapped));
+    BOOST_CHECK(matrixCpuMoved.IsMapped());
+    BOOST_CHECK(!matrixCpuMapped.IsMapped());
+
+    // the mapping is read-only: the first write copies the values, and changes do not go to the file
+    const float* mappedData = matrixCpuMoved.BufferPointer();
+    matrixCpuMoved.MakeWritable();
+    BOOST_CHECK(!matrixCpuMoved.IsMapped());
+    BOOST_CHECK(matrixCpuMoved.OwnBuffer());
+    BOOST_CHECK(matrixCpuMoved.BufferPointer() != mappedData);
+    BOOST_CHECK(matrixCpuCopy.IsEqualTo(matrixCpuMoved, c_epsilonFloatE5));
+    matrixCpuMoved(0, 0) += 1;
+
+    // functions that replace all values do not write to the mapping either
+    CPUMatrix<float> matrixCpuOverwritten;
+    {
+        File fileCpu(fileNameCpu, fileOptionsBinary | fileOptionsRead);
+        fileCpu.Map();
+        char c;
+        fileCpu >> c;
+        matrixCpuOverwritten.ReadMappable(fileCpu);
+    }
+    matrixCpuOverwritten.SetValue(0);
+    BOOST_CHECK(!matrixCpuOverwritten.IsMapped());
+    BOOST_CHECK_EQUAL(0, matrixCpuOverwritten(42, 9));
+
+    {
+        File fileCpu(fileNameCpu, fileOptionsBinary | fileOptionsRead);
+        char c;
+        fileCpu >> c;
+        CPUMatrix<float> matrixCpuRead;
+        matrixCpuRead.ReadMappable(fileCpu);
+        BOOST_CHECK(matrixCpuCopy.IsEqualTo(matrixCpuRead, c_epsilonFloatE5));
+    }
+}
+
 BOOST_FIXTURE_TEST_CASE(MatrixFileWriteRead, RandomSeedFixture)
 {
     // Test Matrix in Dense mode
@@ -5,11 +5,13 @@
 #include "stdafx.h"
 #include "File.h"
 #include <memory>
+#include <random>
 #include <io.h>
 
 #include "../../../Source/Math/MatrixQuantizerImpl.h"
 #include "../../../Source/Math/CUDAPageLockedMemAllocator.h"
 #include "../../../Source/Math/ValueQuantizer.h"
+#include "../../../Source/Math/ColumnQuantizer.h"
 
 using namespace Microsoft::MSR::CNTK;
 
@@ -392,6 +394,44 @@ static void TestQuantization(int deviceId, size_t numRows, size_t numCols, float
     }
 }
 
+// The contiguous CPU kernels must produce exactly the bits, residuals and values of the interleaved ones
+template <typename ElemType>
+static void TestContiguousQuantizationLayout(size_t numRows, size_t numCols, int seed)
+{
+    typedef typename ValueQuantizer<ElemType>::QWord QWord;
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<ElemType> dist(-1, 1);
+    std::vector<ElemType> inMatrix(numRows * numCols), residual(numRows * numCols);
+    for (size_t i = 0; i < inMatrix.size(); i++)
+    {
+        inMatrix[i] = dist(rng);
+        residual[i] = dist(rng) / 10;
+    }
+
+    for (size_t numBits = 1; numBits < 8 * sizeof(ElemType); numBits = numBits * 2)
+    {
+        std::vector<ElemType> interleavedResidual = residual, contiguousResidual = residual;
+        std::vector<ElemType> interleavedOut(inMatrix.size(), 1), contiguousOut(inMatrix.size(), 1);
+        for (size_t j = 0; j < numCols; j++)
+        {
+            ElemType lower, upper;
+            ColumnQuantizer<ElemType>::template ComputeRangeStatColj<false>(inMatrix.data(), residual.data(), (long) numRows, j, numBits, lower, upper);
+            ColumnQuantizer<ElemType> q(ValueQuantizer<ElemType>::ld(numBits), lower, upper);
+
+            std::vector<QWord> interleavedBits(q.QWordsPerCol(numRows)), contiguousBits(q.QWordsPerCol(numRows));
+            q.template Quantize<false>(inMatrix.data(), interleavedResidual.data(), (long) numRows, j, interleavedBits.data(), interleavedResidual.data());
+            q.template QuantizeContiguous<false>(inMatrix.data(), contiguousResidual.data(), (long) numRows, j, contiguousBits.data(), contiguousResidual.data());
+            BOOST_CHECK(interleavedBits == contiguousBits);
+
+            q.Unquantize(interleavedOut.data(), (long) numRows, j, interleavedBits.data(), true);
+            q.UnquantizeContiguous(contiguousOut.data(), (long) numRows, j, contiguousBits.data(), true);
+        }
+        BOOST_CHECK(interleavedResidual == contiguousResidual);
+        BOOST_CHECK(interleavedOut == contiguousOut);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE(GPUMatrixSuite)
 
 BOOST_FIXTURE_TEST_CASE(GPUMatrix1BitQuantizeFloat, RandomSeedFixture)
@@ -462,6 +502,15 @@ BOOST_FIXTURE_TEST_CASE(CPUMatrix1BitQuantizeDouble, RandomSeedFixture)
     TestQuantization<double>(CPUDEVICE, 100, 50, -0.5f, +0.5f, 2915, 5);
 }
 
+BOOST_FIXTURE_TEST_CASE(CPUMatrixQuantizeContiguousLayout, RandomSeedFixture)
+{
+    TestContiguousQuantizationLayout<float>(1, 3, 3015);
+    TestContiguousQuantizationLayout<float>(33, 7, 3115);
+    TestContiguousQuantizationLayout<float>(1025, 3, 3215);
+    TestContiguousQuantizationLayout<double>(65, 7, 3315);
+    TestContiguousQuantizationLayout<double>(1025, 3, 3415);
+}
+
 /*
         Original test cases were using these parameter:
 
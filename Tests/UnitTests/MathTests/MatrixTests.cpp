@@ -1101,6 +1101,89 @@ BOOST_FIXTURE_TEST_CASE(MatrixAssignNumOfDiff, RandomSeedFixture)
         BOOST_CHECK_EQUAL(expectedDiff, actual.Get00Element());
     }
 }
+
+// The fused recurrent cells on the GPU must compute the same as on the CPU. The sizes are not multiples of the
+// block sizes of the kernels.
+static void CheckCpuGpuEqual(const SingleMatrix& cpu, const SingleMatrix& gpu)
+{
+    BOOST_REQUIRE_EQUAL(cpu.GetNumRows(), gpu.GetNumRows());
+    BOOST_REQUIRE_EQUAL(cpu.GetNumCols(), gpu.GetNumCols());
+    std::unique_ptr<float[]> gpuValues(gpu.CopyToArray());
+    foreach_coord (i, j, cpu)
+    {
+        BOOST_CHECK_LT(fabs(cpu(i, j) - gpuValues[IDX2C(i, j, cpu.GetNumRows())]), c_epsilonFloatE4);
+    }
+}
+
+// the same random values on both devices
+static void RandomUniformOnCpuAndGpu(size_t rows, size_t cols, unsigned long seed, SingleMatrix& cpu, SingleMatrix& gpu)
+{
+    CPUMatrix<float> values = CPUMatrix<float>::RandomUniform(rows, cols, -1, 1, seed);
+    cpu.SetValue(rows, cols, CPUDEVICE, values.GetArray(), matrixFlagNormal);
+    gpu.SetValue(rows, cols, c_deviceIdZero, values.GetArray(), matrixFlagNormal);
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixLSTMCellCpuGpu, RandomSeedFixture)
+{
+    const size_t H = 37;
+    const size_t S = 13;
+    SingleMatrix gates[2] = {SingleMatrix(CPUDEVICE), SingleMatrix(c_deviceIdZero)};
+    SingleMatrix peepholes[2] = {SingleMatrix(CPUDEVICE), SingleMatrix(c_deviceIdZero)};
+    SingleMatrix cPrev[2] = {SingleMatrix(CPUDEVICE), SingleMatrix(c_deviceIdZero)};
+    SingleMatrix dh[2] = {SingleMatrix(CPUDEVICE), SingleMatrix(c_deviceIdZero)};
+    SingleMatrix dc[2] = {SingleMatrix(CPUDEVICE), SingleMatrix(c_deviceIdZero)};
+    RandomUniformOnCpuAndGpu(4 * H, S, IncrementCounter(), gates[0], gates[1]);
+    RandomUniformOnCpuAndGpu(H, 3, IncrementCounter(), peepholes[0], peepholes[1]);
+    RandomUniformOnCpuAndGpu(H, S, IncrementCounter(), cPrev[0], cPrev[1]);
+    RandomUniformOnCpuAndGpu(H, S, IncrementCounter(), dh[0], dh[1]);
+    RandomUniformOnCpuAndGpu(H, S, IncrementCounter(), dc[0], dc[1]);
+
+    SingleMatrix c[2] = {SingleMatrix(H, S, CPUDEVICE), SingleMatrix(H, S, c_deviceIdZero)};
+    SingleMatrix h[2] = {SingleMatrix(H, S, CPUDEVICE), SingleMatrix(H, S, c_deviceIdZero)};
+    SingleMatrix dGates[2] = {SingleMatrix(4 * H, S, CPUDEVICE), SingleMatrix(4 * H, S, c_deviceIdZero)};
+    SingleMatrix dPeepholes[2] = {SingleMatrix::Zeros(H, 3, CPUDEVICE), SingleMatrix::Zeros(H, 3, c_deviceIdZero)};
+    for (size_t d = 0; d < 2; d++)
+    {
+        SingleMatrix::LSTMCellForward(gates[d], peepholes[d], cPrev[d], c[d], h[d]);
+        SingleMatrix::LSTMCellBackward(gates[d], peepholes[d], cPrev[d], c[d], dh[d], dc[d], dGates[d], dPeepholes[d]);
+    }
+    CheckCpuGpuEqual(gates[0], gates[1]);
+    CheckCpuGpuEqual(c[0], c[1]);
+    CheckCpuGpuEqual(h[0], h[1]);
+    CheckCpuGpuEqual(dc[0], dc[1]);
+    CheckCpuGpuEqual(dGates[0], dGates[1]);
+    CheckCpuGpuEqual(dPeepholes[0], dPeepholes[1]);
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixGRUCellCpuGpu, RandomSeedFixture)
+{
+    const size_t H = 37;
+    const size_t S = 13;
+    SingleMatrix gates[2] = {SingleMatrix(CPUDEVICE), SingleMatrix(c_deviceIdZero)};
+    SingleMatrix hiddenProj[2] = {SingleMatrix(CPUDEVICE), SingleMatrix(c_deviceIdZero)};
+    SingleMatrix hPrev[2] = {SingleMatrix(CPUDEVICE), SingleMatrix(c_deviceIdZero)};
+    SingleMatrix dh[2] = {SingleMatrix(CPUDEVICE), SingleMatrix(c_deviceIdZero)};
+    RandomUniformOnCpuAndGpu(3 * H, S, IncrementCounter(), gates[0], gates[1]);
+    RandomUniformOnCpuAndGpu(3 * H, S, IncrementCounter(), hiddenProj[0], hiddenProj[1]);
+    RandomUniformOnCpuAndGpu(H, S, IncrementCounter(), hPrev[0], hPrev[1]);
+    RandomUniformOnCpuAndGpu(H, S, IncrementCounter(), dh[0], dh[1]);
+
+    SingleMatrix h[2] = {SingleMatrix(H, S, CPUDEVICE), SingleMatrix(H, S, c_deviceIdZero)};
+    SingleMatrix dGates[2] = {SingleMatrix(3 * H, S, CPUDEVICE), SingleMatrix(3 * H, S, c_deviceIdZero)};
+    SingleMatrix dHiddenProj[2] = {SingleMatrix(3 * H, S, CPUDEVICE), SingleMatrix(3 * H, S, c_deviceIdZero)};
+    SingleMatrix dhPrev[2] = {SingleMatrix(H, S, CPUDEVICE), SingleMatrix(H, S, c_deviceIdZero)};
+    for (size_t d = 0; d < 2; d++)
+    {
+        SingleMatrix::GRUCellForward(gates[d], hiddenProj[d], hPrev[d], h[d]);
+        SingleMatrix::GRUCellBackward(gates[d], hiddenProj[d], hPrev[d], dh[d], dGates[d], dHiddenProj[d], dhPrev[d]);
+    }
+    CheckCpuGpuEqual(gates[0], gates[1]);
+    CheckCpuGpuEqual(h[0], h[1]);
+    CheckCpuGpuEqual(dGates[0], dGates[1]);
+    CheckCpuGpuEqual(dHiddenProj[0], dHiddenProj[1]);
+    CheckCpuGpuEqual(dhPrev[0], dhPrev[1]);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 }
 } } }
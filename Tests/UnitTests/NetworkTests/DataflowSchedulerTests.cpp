@@ -0,0 +1,280 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <random>
+#include "../../../Source/ComputationNetworkLib/DataflowScheduler.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetwork.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetworkBuilder.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(DataflowSchedulerSuite)
+
+// (Boost.Test may only be used on the main thread, so the tasks count their failures, which are checked afterwards.)
+
+// Each task must start after all of its predecessors have completed, and run once; onTaskReady() is called once per task,
+// on the calling thread, once the predecessors have completed. Several passes over the same scheduler and graph.
+BOOST_AUTO_TEST_CASE(DependencyOrder)
+{
+    const size_t numTasks = 300;
+    std::mt19937 rng(11);
+    DataflowGraph graph;
+    graph.Resize(numTasks);
+    for (size_t i = 1; i < numTasks; i++)
+    {
+        size_t numPredecessors = rng() % 4;
+        for (size_t k = 0; k < numPredecessors; k++)
+            graph.AddEdge(rng() % i, i);
+    }
+    std::vector<std::vector<size_t>> predecessors(numTasks);
+    for (size_t i = 0; i < numTasks; i++)
+        for (auto j : graph.m_successors[i])
+            predecessors[j].push_back(i);
+
+    DataflowScheduler scheduler(4);
+    const std::thread::id callingThread = std::this_thread::get_id();
+    for (int pass = 0; pass < 20; pass++)
+    {
+        std::unique_ptr<std::atomic<int>[]> numRuns(new std::atomic<int>[numTasks]);
+        std::unique_ptr<std::atomic<bool>[]> completed(new std::atomic<bool>[numTasks]);
+        for (size_t i = 0; i < numTasks; i++)
+        {
+            numRuns[i] = 0;
+            completed[i] = false;
+        }
+        std::atomic<int> numOrderViolations(0);
+        std::vector<int> numReadyCalls(numTasks, 0);
+        int numReadyViolations = 0;
+        scheduler.Run(graph, [&](size_t i)
+                      {
+                          for (auto j : predecessors[i])
+                              if (!completed[j])
+                                  numOrderViolations++;
+                          numRuns[i]++;
+                          completed[i] = true;
+                      },
+                      [&](size_t i)
+                      {
+                          numReadyCalls[i]++;
+                          if (std::this_thread::get_id() != callingThread)
+                              numReadyViolations++;
+                          for (auto j : predecessors[i])
+                              if (!completed[j])
+                                  numReadyViolations++;
+                      });
+        BOOST_CHECK_EQUAL(numOrderViolations, 0);
+        BOOST_CHECK_EQUAL(numReadyViolations, 0);
+        for (size_t i = 0; i < numTasks; i++)
+        {
+            BOOST_CHECK_EQUAL(numRuns[i], 1);
+            BOOST_CHECK_EQUAL(numReadyCalls[i], 1);
+        }
+    }
+}
+
+// The threads sleep between passes and while no task is ready. Here, tasks that only become ready once a single task
+// has completed must wake up all threads: the tasks after it wait for each other, so they complete only if all threads
+// run one of them at the same time.
+BOOST_AUTO_TEST_CASE(ThreadsWakeUp)
+{
+    const size_t numThreads = 4;
+    DataflowGraph graph;
+    graph.Resize(2 + numThreads);
+    for (size_t i = 0; i < numThreads; i++)
+    {
+        graph.AddEdge(0, 1 + i);
+        graph.AddEdge(1 + i, 1 + numThreads);
+    }
+
+    DataflowScheduler scheduler(numThreads);
+    BOOST_CHECK_EQUAL(scheduler.GetNumThreads(), numThreads);
+    for (int pass = 0; pass < 20; pass++)
+    {
+        std::mutex mutex;
+        std::condition_variable allStarted;
+        size_t numStarted = 0;
+        int numTimeouts = 0;
+        bool lastTaskRan = false;
+        scheduler.Run(graph, [&](size_t i)
+                      {
+                          if (i == 0)
+                              std::this_thread::sleep_for(std::chrono::milliseconds(pass % 3)); // (let the threads go to sleep)
+                          else if (i <= numThreads)
+                          {
+                              std::unique_lock<std::mutex> lock(mutex);
+                              numStarted++;
+                              allStarted.notify_all();
+                              if (!allStarted.wait_for(lock, std::chrono::seconds(10), [&]()
+                                                       {
+                                                           return numStarted == numThreads;
+                                                       }))
+                                  numTimeouts++;
+                          }
+                          else
+                              lastTaskRan = true;
+                      });
+        BOOST_REQUIRE_EQUAL(numTimeouts, 0);
+        BOOST_CHECK_EQUAL(numStarted, numThreads);
+        BOOST_CHECK(lastTaskRan);
+    }
+}
+
+// The first exception of a task is rethrown by Run(), and the scheduler can be used again afterwards.
+BOOST_AUTO_TEST_CASE(TaskErrorIsRethrown)
+{
+    const size_t numTasks = 100;
+    DataflowGraph graph;
+    graph.Resize(numTasks);
+    for (size_t i = 1; i < numTasks; i++)
+    {
+        graph.AddEdge(i / 2, i);
+        graph.AddEdge(i - 1, i);
+    }
+
+    DataflowScheduler scheduler(3);
+    BOOST_CHECK_THROW(scheduler.Run(graph, [](size_t i)
+                                    {
+                                        if (i == 40)
+                                            RuntimeError("task %d failed", (int) i);
+                                    }),
+                      std::runtime_error);
+
+    // (the edges i-1 -> i leave only one possible order)
+    std::vector<size_t> order;
+    std::mutex mutex;
+    scheduler.Run(graph, [&](size_t i)
+                  {
+                      std::lock_guard<std::mutex> lock(mutex);
+                      order.push_back(i);
+                  });
+    BOOST_REQUIRE_EQUAL(order.size(), numTasks);
+    for (size_t i = 0; i < numTasks; i++)
+        BOOST_CHECK_EQUAL(order[i], i);
+}
+
+// ---------------------------------------------------------------------------
+// concurrent execution of a network gives the same results as sequential
+// ---------------------------------------------------------------------------
+
+const size_t D = 5; // input dimension
+const size_t H = 6; // hidden dimension per direction
+const size_t C = 4; // number of classes
+const size_t S = 3; // parallel sequences
+const size_t T = 7; // steps per minibatch
+
+typedef shared_ptr<ComputationNode<float>> FloatNodePtr;
+
+// one direction of a recurrent layer: h = Tanh(W in + R h[t-1]) for the past, h[t+1] for the future
+static FloatNodePtr CreateDirection(ComputationNetworkPtr net, ComputationNetworkBuilder<float>& builder, FloatNodePtr in, size_t inDim, const wstring& name, int direction, unsigned long seed)
+{
+    auto W = builder.CreateLearnableParameter(L"W" + name, H, inDim);
+    auto R = builder.CreateLearnableParameter(L"R" + name, H, H);
+    net->InitLearnableParameters<float>(W, true, seed, 1);
+    net->InitLearnableParameters<float>(R, true, seed + 1, 1);
+    FloatNodePtr hPrev = direction < 0 ? builder.PastValue(nullptr, 0.1f, H, 1, L"hPrev" + name) : builder.FutureValue(nullptr, 0.1f, H, 1, L"hPrev" + name);
+    auto h = builder.Tanh(builder.Plus(builder.Times(W, in), builder.Times(R, hPrev)), L"h" + name);
+    hPrev->AttachInputs(ComputationNodeBasePtr(h));
+    return h;
+}
+
+// x [D] -> 2 bidirectional recurrent layers [2 H] -> ce = CrossEntropyWithSoftmax(labels [C], O h)
+// The two directions of a layer are independent loops, which run concurrently if numThreads > 1.
+static ComputationNetworkPtr CreateBidirectional(size_t numThreads)
+{
+    auto net = make_shared<ComputationNetwork>(CPUDEVICE);
+    ComputationNetworkBuilder<float> builder(*net);
+    auto x = builder.CreateInputNode(L"x", D);
+    auto labels = builder.CreateInputNode(L"labels", C);
+    FloatNodePtr h = x;
+    size_t dim = D;
+    for (unsigned long layer = 1; layer <= 2; layer++)
+    {
+        auto forward = CreateDirection(net, builder, h, dim, msra::strfun::wstrprintf(L"Fwd%d", (int) layer), -1, 4 * layer);
+        auto backward = CreateDirection(net, builder, h, dim, msra::strfun::wstrprintf(L"Bwd%d", (int) layer), +1, 4 * layer + 2);
+        h = builder.RowStack({forward, backward});
+        dim = 2 * H;
+    }
+    auto O = builder.CreateLearnableParameter(L"O", C, dim);
+    net->InitLearnableParameters<float>(O, true, 10, 1);
+    ComputationNodeBasePtr ce = builder.CrossEntropyWithSoftmax(labels, builder.Times(O, h, L"out"), L"ce");
+    net->FeatureNodes().push_back(x);
+    net->LabelNodes().push_back(labels);
+    net->FinalCriterionNodes().push_back(ce);
+    net->CompileNetwork();
+    net->SetNumNodeExecutionThreads(numThreads);
+    net->AllocateAllMatrices({}, {}, ce);
+    net->StartEvaluateMinibatchLoop(ce);
+    return net;
+}
+
+static Matrix<float>& ValueOf(ComputationNetworkPtr net, const wstring& name)
+{
+    return net->GetNodeFromName(name)->As<ComputationNode<float>>()->Value();
+}
+
+// forward and backward pass over a minibatch of sequences of different lengths; returns the number of gradient callbacks,
+// and the output as it is after the forward pass (its matrix may be reused for gradients)
+static size_t TrainMinibatch(ComputationNetworkPtr net, int index, Matrix<float>& output)
+{
+    auto layout = net->GetMBLayoutPtr();
+    layout->Init(S, T);
+    for (size_t s = 0; s < S; s++)
+    {
+        size_t length = T - (s * 2 + index) % 4;
+        layout->AddSequence(s, s, 0, length);
+        if (length < T)
+            layout->AddGap(s, length, T);
+    }
+    Matrix<float> x = Matrix<float>::RandomUniform(D, S * T, CPUDEVICE, -1, 1, 100 + index);
+    Matrix<float> labels(C, S * T, CPUDEVICE);
+    labels.SetValue(0);
+    for (size_t j = 0; j < S * T; j++)
+        labels((j * 3 + index) % C, j) = 1;
+    ValueOf(net, L"x").SetValue(x);
+    ValueOf(net, L"labels").SetValue(labels);
+    for (const auto& name : {L"x", L"labels"})
+    {
+        net->GetNodeFromName(name)->NotifyFunctionValuesMBSizeModified();
+        net->GetNodeFromName(name)->BumpEvalTimeStamp();
+    }
+
+    auto ce = net->GetNodeFromName(L"ce");
+    net->ForwardProp(ce);
+    output.SetValue(ValueOf(net, L"out"));
+    size_t numCallbacks = 0;
+    net->Backprop(ce, [&](const ComputationNodeBasePtr&)
+                  {
+                      numCallbacks++;
+                  });
+    return numCallbacks;
+}
+
+// Gradients of a node with several consumers are summed in the same order, so the results are bit-identical.
+BOOST_AUTO_TEST_CASE(ConcurrentNetworkMatchesSequential)
+{
+    auto sequential = CreateBidirectional(1);
+    auto concurrent = CreateBidirectional(3);
+    BOOST_CHECK_EQUAL(sequential->GetNumNodeExecutionThreads(), 1);
+    BOOST_CHECK_EQUAL(concurrent->GetNumNodeExecutionThreads(), 3);
+    for (int index = 0; index < 3; index++)
+    {
+        Matrix<float> output(CPUDEVICE), concurrentOutput(CPUDEVICE);
+        BOOST_CHECK_EQUAL(TrainMinibatch(concurrent, index, concurrentOutput), TrainMinibatch(sequential, index, output));
+        BOOST_CHECK_MESSAGE(concurrentOutput.IsEqualTo(output, 0), "output differs in minibatch " << index);
+        BOOST_CHECK_MESSAGE(ValueOf(concurrent, L"ce").IsEqualTo(ValueOf(sequential, L"ce"), 0), "criterion differs in minibatch " << index);
+        for (const auto& node : sequential->LearnableParameterNodes(sequential->GetNodeFromName(L"ce")))
+        {
+            const auto& gradient = node->As<ComputationNode<float>>()->Gradient();
+            const auto& concurrentGradient = concurrent->GetNodeFromName(node->NodeName())->As<ComputationNode<float>>()->Gradient();
+            BOOST_CHECK_MESSAGE(concurrentGradient.IsEqualTo(gradient, 0), "gradient of " << msra::strfun::utf8(node->NodeName()) << " differs in minibatch " << index);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
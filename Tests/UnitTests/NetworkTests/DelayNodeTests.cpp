@@ -0,0 +1,154 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetwork.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetworkBuilder.h"
+#include "../../../Source/ComputationNetworkLib/RecurrentNodes.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(DelayNodeSuite)
+
+const size_t D = 2; // input dimension
+const size_t S = 2; // parallel sequences
+const size_t T = 4; // steps per minibatch
+const float initialValue = 0.5f;
+
+// x [D] -> y = PastValue(x) or FutureValue(x) with a given time step
+static ComputationNetworkPtr CreateDelay(int direction, size_t timeStep)
+{
+    auto net = make_shared<ComputationNetwork>(CPUDEVICE);
+    ComputationNetworkBuilder<float> builder(*net);
+    auto x = builder.CreateInputNode(L"x", D);
+    ComputationNodeBasePtr y = direction < 0 ? builder.PastValue(x, initialValue, D, timeStep, L"y") : builder.FutureValue(x, initialValue, D, timeStep, L"y");
+    net->FeatureNodes().push_back(x);
+    net->OutputNodes().push_back(y);
+    net->CompileNetwork();
+    net->AllocateAllMatrices({y}, {}, nullptr);
+    net->StartEvaluateMinibatchLoop(y);
+    return net;
+}
+
+// the input value of parallel sequence s at time t counted from the start of the first minibatch
+static float InputValue(size_t s, ptrdiff_t t, size_t i)
+{
+    return (float) (1000 * s + 10 * t + i);
+}
+
+// A minibatch: its index in the stream of minibatches, and the sequences (with gaps) of its parallel sequences.
+struct DelayMinibatch
+{
+    size_t index;
+    std::vector<MBLayout::SequenceInfo> sequences;
+};
+
+static const Matrix<float>& ForwardProp(ComputationNetworkPtr net, const DelayMinibatch& minibatch)
+{
+    auto layout = net->GetMBLayoutPtr();
+    layout->Init(S, T);
+    for (const auto& seq : minibatch.sequences)
+    {
+        if (seq.seqId == GAP_SEQUENCE_ID)
+            layout->AddGap(seq.s, seq.tBegin, seq.tEnd);
+        else
+            layout->AddSequence(seq);
+    }
+    Matrix<float> x(D, S * T, CPUDEVICE);
+    for (size_t t = 0; t < T; t++)
+        for (size_t s = 0; s < S; s++)
+            for (size_t i = 0; i < D; i++)
+                x(i, t * S + s) = InputValue(s, minibatch.index * T + t, i);
+    auto input = net->GetNodeFromName(L"x");
+    input->As<ComputationNode<float>>()->Value().SetValue(x);
+    input->NotifyFunctionValuesMBSizeModified();
+    input->BumpEvalTimeStamp();
+
+    auto y = net->GetNodeFromName(L"y");
+    net->ForwardProp(y);
+    return y->As<ComputationNode<float>>()->Value();
+}
+
+// Check the output of a minibatch. Inside a sequence, a delayed frame before the beginning (past) or beyond the end
+// (future) of the minibatch is read from the last or first frames of the previous minibatch. Outside of a sequence,
+// it is the initial value.
+static void CheckDelay(ComputationNetworkPtr net, int direction, size_t timeStep, const DelayMinibatch& minibatch)
+{
+    const auto& y = ForwardProp(net, minibatch);
+    for (const auto& seq : minibatch.sequences)
+    {
+        if (seq.seqId == GAP_SEQUENCE_ID)
+            continue;
+        for (ptrdiff_t t = max(seq.tBegin, (ptrdiff_t) 0); t < (ptrdiff_t) min(seq.tEnd, T); t++)
+        {
+            ptrdiff_t delayed = t + direction * (ptrdiff_t) timeStep;
+            ptrdiff_t time = minibatch.index * T + (delayed < (ptrdiff_t) T ? delayed : delayed - 2 * (ptrdiff_t) T);
+            bool boundary = delayed < seq.tBegin || delayed >= (ptrdiff_t) seq.tEnd;
+            for (size_t i = 0; i < D; i++)
+            {
+                float expected = boundary ? initialValue : InputValue(seq.s, time, i);
+                BOOST_CHECK_MESSAGE(y(i, t * S + seq.s) == expected,
+                                    "minibatch " << minibatch.index << ", sequence " << seq.s << ", time " << t << ": " << y(i, t * S + seq.s) << " instead of " << expected);
+            }
+        }
+    }
+}
+
+// Run a few minibatches with sequences crossing their boundaries, then export the state before the last one,
+// and run the last one again after importing it: the outputs are the same.
+static void CheckDelayCarryOver(int direction, size_t timeStep, const std::vector<DelayMinibatch>& minibatches)
+{
+    auto net = CreateDelay(direction, timeStep);
+    auto y = net->GetNodeFromName(L"y");
+    for (size_t k = 0; k + 1 < minibatches.size(); k++)
+        CheckDelay(net, direction, timeStep, minibatches[k]);
+    auto state = y->As<IStatefulNode>()->ExportState();
+    CheckDelay(net, direction, timeStep, minibatches.back());
+    Matrix<float> output(CPUDEVICE);
+    output.SetValue(y->As<ComputationNode<float>>()->Value());
+
+    CheckDelay(net, direction, timeStep, minibatches.front()); // (overwrite the state)
+    y->As<IStatefulNode>()->ImportState(state);
+    CheckDelay(net, direction, timeStep, minibatches.back());
+    BOOST_CHECK(y->As<ComputationNode<float>>()->Value().IsEqualTo(output, 0));
+}
+
+// Sequence 0 of the first minibatch continues into the second one and ends there; sequence 2 starts there and
+// continues into the third one. Sequence 3 crosses from the second into the third one, where it is followed by a gap.
+static const std::vector<DelayMinibatch> pastMinibatches = {
+    {0, {{0, 0, 0, 6}, {1, 1, 0, 4}}},
+    {1, {{0, 0, -4, 2}, {2, 0, 2, 6}, {3, 1, 0, 7}}},
+    {2, {{2, 0, -2, 4}, {3, 1, -4, 3}, {GAP_SEQUENCE_ID, 1, 3, 4}}}};
+
+// The future direction carries over the first frames, for minibatches that are fed in reverse time order: a sequence
+// reaching beyond the end of one minibatch continues at the beginning of the previous one (sequences 0 and 1 of the
+// second minibatch, and 3 of the third one).
+static const std::vector<DelayMinibatch> futureMinibatches = {
+    {0, {{0, 0, -4, 2}, {GAP_SEQUENCE_ID, 0, 2, 4}, {1, 1, -3, 4}}},
+    {1, {{0, 0, 0, 6}, {3, 1, -2, 1}, {1, 1, 1, 8}}},
+    {2, {{4, 0, 0, 4}, {GAP_SEQUENCE_ID, 1, 0, 2}, {3, 1, 2, 5}}}};
+
+BOOST_AUTO_TEST_CASE(PastValueCarryOver)
+{
+    CheckDelayCarryOver(-1, 1, pastMinibatches);
+}
+
+BOOST_AUTO_TEST_CASE(PastValueCarryOverTimeStep2)
+{
+    CheckDelayCarryOver(-1, 2, pastMinibatches);
+}
+
+BOOST_AUTO_TEST_CASE(FutureValueCarryOver)
+{
+    CheckDelayCarryOver(+1, 1, futureMinibatches);
+}
+
+BOOST_AUTO_TEST_CASE(FutureValueCarryOverTimeStep2)
+{
+    CheckDelayCarryOver(+1, 2, futureMinibatches);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
@@ -0,0 +1,217 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "MPITestHelper.h"
+#include "Matrix.h"
+#include "../../../Source/SGDLib/SimpleDistGradAggregator.h"
+#include "../../../Source/SGDLib/QuantizedDistGradAggregator.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+// gradient element k (counted across all gradient matrices) of the given worker in the given minibatch;
+// small integers, so that all summation orders are exact
+static float GradientValue(size_t minibatch, size_t worker, size_t k)
+{
+    return (float) ((int) ((minibatch * 3 + worker * 11 + k * 5) % 13) - 6);
+}
+
+// the same with values that do not survive quantization
+static float SmoothGradientValue(size_t minibatch, size_t worker, size_t k)
+{
+    return (float) sin(0.7 * minibatch + 1.3 * worker + 0.37 * k);
+}
+
+// worker 0 has no samples in the second minibatch, e.g. at the end of the data
+static size_t NumSamples(size_t minibatch, size_t worker)
+{
+    return (minibatch == 1 && worker == 0) ? 0 : worker + minibatch + 1;
+}
+
+struct GradientsFixture
+{
+    GradientsFixture()
+        : m_header(DistGradHeader::Create(1))
+    {
+        for (const auto& shape : std::vector<std::pair<size_t, size_t>>{{4, 3}, {10, 1}, {30, 7}})
+        {
+            m_matrices.push_back(std::unique_ptr<Matrix<float>>(new Matrix<float>(shape.first, shape.second, CPUDEVICE)));
+            m_gradients.push_back(m_matrices.back().get());
+        }
+    }
+    ~GradientsFixture()
+    {
+        DistGradHeader::Destroy(m_header);
+    }
+
+    // Fill this worker's gradients and header of the given minibatch and report the gradients complete in backprop
+    // order, as SGD does. A worker without samples runs no backprop; its gradients hold stale values.
+    template <class ValueFunction>
+    void Backprop(IDistGradAggregator<float>& aggregator, size_t minibatch, size_t worker, ValueFunction value)
+    {
+        size_t numSamples = NumSamples(minibatch, worker);
+        m_header->numSamples = m_header->numSamplesWithLabel = numSamples;
+        m_header->criterion = 0.5 * numSamples;
+        m_header->evalErrors[0] = 0.25 * numSamples;
+
+        size_t offset = 0;
+        for (auto* gradient : m_gradients)
+        {
+            for (size_t i = 0; i < gradient->GetNumElements(); i++)
+                gradient->BufferPointer()[i] = numSamples > 0 ? value(minibatch, worker, offset + i) : 99;
+            offset += gradient->GetNumElements();
+        }
+        if (numSamples > 0)
+        {
+            for (auto iter = m_gradients.rbegin(); iter != m_gradients.rend(); iter++)
+                aggregator.OnGradientComputed(*iter);
+        }
+    }
+
+    size_t NumElements() const
+    {
+        size_t numElements = 0;
+        for (auto* gradient : m_gradients)
+            numElements += gradient->GetNumElements();
+        return numElements;
+    }
+
+    // all gradients, concatenated
+    std::vector<float> Gradients() const
+    {
+        std::vector<float> values;
+        for (auto* gradient : m_gradients)
+            values.insert(values.end(), gradient->BufferPointer(), gradient->BufferPointer() + gradient->GetNumElements());
+        return values;
+    }
+
+    // the sum of the gradients of all workers in the given minibatch
+    template <class ValueFunction>
+    std::vector<float> ExpectedGradients(size_t minibatch, size_t numWorkers, ValueFunction value) const
+    {
+        return ExpectedSum<float>(numWorkers, NumElements(), [&](size_t w, size_t k)
+                                  {
+                                      return NumSamples(minibatch, w) > 0 ? value(minibatch, w, k) : 0;
+                                  });
+    }
+
+    void CheckAggregateHeader(size_t minibatch, size_t numWorkers)
+    {
+        size_t numSamples = 0;
+        for (size_t w = 0; w < numWorkers; w++)
+            numSamples += NumSamples(minibatch, w);
+        BOOST_CHECK_EQUAL(m_header->numSamples, numSamples);
+        BOOST_CHECK_EQUAL(m_header->numSamplesWithLabel, numSamples);
+        BOOST_CHECK_EQUAL(m_header->criterion, 0.5 * numSamples);
+        BOOST_CHECK_EQUAL(m_header->evalErrors[0], 0.25 * numSamples);
+    }
+
+    std::vector<std::unique_ptr<Matrix<float>>> m_matrices;
+    std::vector<Matrix<float>*> m_gradients;
+    DistGradHeader* m_header;
+};
+
+BOOST_FIXTURE_TEST_SUITE(SimpleDistGradAggregatorSuite, GradientsFixture)
+
+// The aggregated gradients and headers must be the sums over all workers, whatever the bucketing, the allreduce
+// algorithm, and whether a bucket is reduced during backprop or in AggregateGradients().
+BOOST_AUTO_TEST_CASE(BucketedAggregationMatchesSum)
+{
+    auto mpi = TestMPIWrapper();
+    for (auto algorithm : {AllReduceAlgorithm::MPI, AllReduceAlgorithm::Ring, AllReduceAlgorithm::RecursiveHalvingDoubling})
+    {
+        // one bucket per gradient, one element per bucket, buckets that split gradients, and one bucket for all
+        for (size_t bucketSizeInBytes : {(size_t) 0, sizeof(float), 25 * sizeof(float), (size_t) 1024 * 1024})
+        {
+            SimpleDistGradAggregator<float> aggregator(mpi, /*useAsyncAggregation=*/false, /*syncStatsTrace=*/0, bucketSizeInBytes, algorithm);
+            for (size_t minibatch = 0; minibatch < 3; minibatch++)
+            {
+                Backprop(aggregator, minibatch, mpi->CurrentNodeRank(), GradientValue);
+                bool anySamples = aggregator.AggregateGradients(m_gradients, m_header, /*epochNumber=*/0);
+                BOOST_CHECK_EQUAL(anySamples, m_header->numSamples != 0);
+                BOOST_CHECK(Gradients() == ExpectedGradients(minibatch, mpi->NumNodesInUse(), GradientValue));
+                CheckAggregateHeader(minibatch, mpi->NumNodesInUse());
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(QuantizedDistGradAggregatorSuite, GradientsFixture)
+
+static float MaxAbsDifference(const std::vector<float>& a, const std::vector<float>& b)
+{
+    float maxDifference = 0;
+    for (size_t k = 0; k < a.size(); k++)
+        maxDifference = std::max(maxDifference, fabs(a[k] - b[k]));
+    return maxDifference;
+}
+
+// Each aggregate must be the sum of the workers' gradients up to the quantization error, and identical on all
+// workers. Thanks to the error feedback, the aggregates summed over all minibatches plus the residuals that
+// are still to be fed back must equal the sum of all gradients, i.e. no error accumulates over time.
+BOOST_AUTO_TEST_CASE(QuantizedAggregationTracksSum)
+{
+    auto mpi = TestMPIWrapper();
+    const size_t numWorkers = mpi->NumNodesInUse();
+    const size_t numMinibatches = 10;
+    for (int numBits : {1, 2, 4, 8})
+    {
+        QuantizedDistGradAggregator<float> aggregator(mpi, numBits, /*zeroThresholdFor1Bit=*/false, /*traceLevel=*/0, /*syncStatsTrace=*/0);
+        // (each of the numWorkers + 1 quantizations of an element errs by up to about a quantization step in either direction,
+        // where the values lie within [-1, 1] but the quantized ones include the fed-back residuals)
+        const float maxQuantizationError = (numWorkers + 1) * (numBits == 1 ? 4.0f : 8.0f / ((1 << numBits) - 1));
+        std::vector<float> aggregateSum(NumElements(), 0), expectedSum(NumElements(), 0);
+        for (size_t minibatch = 0; minibatch < numMinibatches; minibatch++)
+        {
+            Backprop(aggregator, minibatch, mpi->CurrentNodeRank(), SmoothGradientValue);
+            aggregator.AggregateGradients(m_gradients, m_header, /*epochNumber=*/0);
+            CheckAggregateHeader(minibatch, numWorkers);
+
+            auto aggregate = Gradients();
+            auto expected = ExpectedGradients(minibatch, numWorkers, SmoothGradientValue);
+            BOOST_CHECK_LE(MaxAbsDifference(aggregate, expected), maxQuantizationError);
+            if (numBits == 8)
+                BOOST_CHECK_LE(MaxAbsDifference(aggregate, expected), 0.05f * numWorkers);
+
+            std::vector<float> maxOverWorkers(aggregate), minOverWorkers(aggregate);
+            MPI_Allreduce(MPI_IN_PLACE, maxOverWorkers.data(), (int) aggregate.size(), MPI_FLOAT, MPI_MAX, mpi->Communicator()) || MpiFail("MPI_Allreduce");
+            MPI_Allreduce(MPI_IN_PLACE, minOverWorkers.data(), (int) aggregate.size(), MPI_FLOAT, MPI_MIN, mpi->Communicator()) || MpiFail("MPI_Allreduce");
+            BOOST_CHECK(maxOverWorkers == minOverWorkers);
+
+            for (size_t k = 0; k < aggregate.size(); k++)
+            {
+                aggregateSum[k] += aggregate[k];
+                expectedSum[k] += expected[k];
+            }
+        }
+
+        // the residuals of all workers, concatenated like the gradients
+        std::vector<float> residualSum;
+        for (size_t i = 0; i < m_gradients.size(); i++)
+        {
+            Matrix<float> localResidual(CPUDEVICE), aggregateResidual(CPUDEVICE);
+            aggregator.GetResiduals(i, localResidual, aggregateResidual);
+            BOOST_CHECK_EQUAL(localResidual.GetNumElements(), m_gradients[i]->GetNumElements());
+            localResidual += aggregateResidual;
+            residualSum.insert(residualSum.end(), localResidual.BufferPointer(), localResidual.BufferPointer() + localResidual.GetNumElements());
+        }
+        MPI_Allreduce(MPI_IN_PLACE, residualSum.data(), (int) residualSum.size(), MPI_FLOAT, MPI_SUM, mpi->Communicator()) || MpiFail("MPI_Allreduce");
+
+        BOOST_CHECK_LE(MaxAbsDifference(aggregateSum, expectedSum), maxQuantizationError);
+        for (size_t k = 0; k < residualSum.size(); k++)
+            aggregateSum[k] += residualSum[k];
+        BOOST_CHECK_SMALL(MaxAbsDifference(aggregateSum, expectedSum), 1e-4f * numMinibatches * numWorkers);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(RejectsInvalidNumberOfBits)
+{
+    BOOST_CHECK_THROW(QuantizedDistGradAggregator<float>(TestMPIWrapper(), 3, false, 0, 0), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
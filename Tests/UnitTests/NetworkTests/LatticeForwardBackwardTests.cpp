@@ -0,0 +1,263 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include "MPITestHelper.h"
+#include "CPUMatrix.h"
+#include "gammacalculation.h"
+
+using namespace msra::lattices;
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(LatticeForwardBackwardSuite)
+
+const size_t width = 10; // nodes per layer of the test lattices
+
+// 1-state /sil/ and /sp/ and 2-state a, b and c, each state with its own senone
+// (loaded in place: the HMMs point into the object's own transition matrices)
+static void LoadHMMs(msra::asr::simplesenonehmm& hset)
+{
+    const std::wstring statesPath = WorkerFileName(L"LatticeForwardBackward.states");
+    const std::wstring transPPath = WorkerFileName(L"LatticeForwardBackward.transP");
+    const std::wstring tyingPath = WorkerFileName(L"LatticeForwardBackward.tying");
+    {
+        auto_file_ptr f(fopenOrDie(statesPath, L"wb"));
+        fprintfOrDie(f, "sil_s2\nsp_s2\na_s2\na_s3\nb_s2\nb_s3\nc_s2\nc_s3\n");
+    }
+    {
+        auto_file_ptr f(fopenOrDie(transPPath, L"wb"));
+        fprintfOrDie(f, "T1 1 1 0 0.6 0.4\nT2 2 1 0 0 0.5 0.5 0 0 0.7 0.3\n");
+    }
+    {
+        auto_file_ptr f(fopenOrDie(tyingPath, L"wb"));
+        fprintfOrDie(f, "sil T1 sil_s2\nsp T1 sp_s2\na T2 a_s2 a_s3\nb T2 b_s2 b_s3\nc T2 c_s2 c_s3\n");
+    }
+    hset.loadfromfile(tyingPath, statesPath, transPPath);
+    for (const auto& path : {statesPath, transPPath, tyingPath})
+        unlinkOrDie(path);
+}
+
+// the units of an edge of the given duration; a, b and c need at least one frame per state
+static void WriteAlignment(std::ostream& os, std::mt19937& rng, size_t frames)
+{
+    static const char* const units[] = {"sil", "sp", "a", "b", "c"};
+    os << "d=:";
+    while (frames > 0)
+    {
+        size_t unit = frames == 1 ? rng() % 2 : rng() % 5;
+        size_t minDuration = unit < 2 ? 1 : 2;
+        size_t duration = minDuration + rng() % (std::min(frames, minDuration + 2) - minDuration + 1);
+        os << units[unit] << "," << duration * 0.01 << ":";
+        frames -= duration;
+    }
+}
+
+// Read an HTK lattice that is wide enough for the lattice-level wavefront: a start node, numLayers layers of
+// 'width' nodes, and an end node, 4 frames apart. Each node is connected to all nodes of the next layer and
+// to some of the layer after that.
+static std::shared_ptr<const msra::dbn::latticepair> ReadLattice(std::mt19937& rng, size_t numLayers, const msra::asr::simplesenonehmm& hset)
+{
+    const size_t numNodes = numLayers * width + 2;
+    auto layer = [&](size_t i)
+    {
+        return i == 0 ? 0 : i == numNodes - 1 ? numLayers + 1 : (i - 1) / width + 1;
+    };
+    std::ostringstream edges;
+    size_t numEdges = 0;
+    for (size_t E = 1; E < numNodes; E++)
+    {
+        for (size_t S = 0; S < E; S++)
+        {
+            size_t distance = layer(E) - layer(S);
+            if (distance == 1 || (distance == 2 && layer(E) <= numLayers && rng() % 3 == 0))
+            {
+                edges << "J=" << numEdges++ << " S=" << S << " E=" << E << " a=0 l=" << -(double) (rng() % 100) / 10 << " ";
+                WriteAlignment(edges, rng, 4 * distance);
+                edges << "\n";
+            }
+        }
+    }
+    const std::wstring path = WorkerFileName(L"LatticeForwardBackward.lat");
+    {
+        auto_file_ptr f(fopenOrDie(path, L"wb"));
+        fprintfOrDie(f, "N=%d L=%d\n", (int) numNodes, (int) numEdges);
+        for (size_t i = 0; i < numNodes; i++)
+            fprintfOrDie(f, "I=%d t=%.2f\n", (int) i, layer(i) * 0.04);
+        fprintfOrDie(f, "%s", edges.str().c_str());
+    }
+    auto pair = std::make_shared<msra::dbn::latticepair>();
+    pair->second.fromhtklattice(path, hset.getsymmap());
+    unlinkOrDie(path);
+    return pair;
+}
+
+static msra::dbn::matrix RandomLogLLs(std::mt19937& rng, size_t numSenones, size_t numFrames)
+{
+    msra::dbn::matrix logLLs(numSenones, numFrames);
+    for (size_t t = 0; t < numFrames; t++)
+        for (size_t s = 0; s < numSenones; s++)
+            logLLs(s, t) = -1.0f - (float) (rng() % 1000) / 100;
+    return logLLs;
+}
+
+static std::vector<float> ToVector(const msra::math::ssematrixbase& m)
+{
+    std::vector<float> values;
+    for (size_t t = 0; t < m.cols(); t++)
+        for (size_t s = 0; s < m.rows(); s++)
+            values.push_back(m(s, t));
+    return values;
+}
+
+const float lmf = 14, wp = 0, amf = 14;
+
+// lattice-level forward-backward of a single utterance with the given number of threads
+static double ForwardBackward(const lattice& L, const msra::math::ssematrixbase& logLLs, const msra::asr::simplesenonehmm& hset,
+                              std::vector<size_t>& uids, bool sMBRmode, int numThreads, std::vector<float>& result)
+{
+    int previousNumThreads = CPUMatrix<float>::SetNumThreadsOfCallingThread(numThreads);
+    lattice::parallelstate parallelstate;
+    msra::dbn::matrix resultMatrix(logLLs.rows(), logLLs.cols()), errorsignalbuf;
+    double value = L.forwardbackward(parallelstate, logLLs, hset, resultMatrix, errorsignalbuf, lmf, wp, amf, /*boostingfactor=*/0, sMBRmode,
+                                     array_ref<size_t>(uids.data(), uids.size()));
+    CPUMatrix<float>::SetNumThreadsOfCallingThread(previousNumThreads);
+    result = ToVector(resultMatrix);
+    return value;
+}
+
+// The wavefront over the levels of a wide lattice must give the same state posteriors (MMI) and error signal (sMBR),
+// bit for bit, as visiting the nodes one by one.
+BOOST_AUTO_TEST_CASE(ParallelMatchesSerial)
+{
+    msra::asr::simplesenonehmm hset;
+    LoadHMMs(hset);
+    std::mt19937 rng(1);
+    auto lattices = ReadLattice(rng, 5, hset);
+    const lattice& L = lattices->second;
+    BOOST_REQUIRE_GE(L.getnumedges(), 32 * 7); // (enough edges per level to be processed in parallel)
+    const size_t numFrames = L.getnumframes();
+    const size_t numSenones = hset.getnumsenone();
+    auto logLLs = RandomLogLLs(rng, numSenones, numFrames);
+    std::vector<size_t> uids(numFrames);
+    for (auto& uid : uids)
+        uid = rng() % numSenones;
+
+    for (bool sMBRmode : {false, true})
+    {
+        std::vector<float> serialResult, parallelResult;
+        double serialValue = ForwardBackward(L, logLLs, hset, uids, sMBRmode, 1, serialResult);
+        double parallelValue = ForwardBackward(L, logLLs, hset, uids, sMBRmode, 4, parallelResult);
+        BOOST_CHECK_EQUAL(parallelValue, serialValue);
+        BOOST_CHECK(parallelResult == serialResult);
+
+        if (!sMBRmode) // the posteriors of each frame sum up to 1
+        {
+            for (size_t t = 0; t < numFrames; t++)
+                BOOST_CHECK_CLOSE(std::accumulate(serialResult.begin() + t * numSenones, serialResult.begin() + (t + 1) * numSenones, 0.0), 1.0, 1e-3);
+        }
+    }
+}
+
+// Each utterance of a minibatch must get the gammas of running forward-backward on it alone, in its own columns,
+// with one or several utterances per parallel sequence and with the utterances processed serially or in parallel.
+BOOST_AUTO_TEST_CASE(GammasMatchSingleUtterances)
+{
+    msra::asr::simplesenonehmm hset;
+    LoadHMMs(hset);
+    const size_t numSenones = hset.getnumsenone();
+    std::mt19937 rng(2);
+    std::vector<std::shared_ptr<const msra::dbn::latticepair>> lattices;
+    std::vector<msra::dbn::matrix> logLLs;
+    std::vector<size_t> uids; // (of all utterances, concatenated)
+    for (size_t numLayers : {3, 5, 4})
+    {
+        lattices.push_back(ReadLattice(rng, numLayers, hset));
+        logLLs.push_back(RandomLogLLs(rng, numSenones, lattices.back()->getnumframes()));
+        for (size_t t = 0; t < lattices.back()->getnumframes(); t++)
+            uids.push_back(rng() % numSenones);
+    }
+
+    for (bool sMBRmode : {false, true})
+    {
+        SeqGammarCalParam params;
+        params.lmf = lmf;
+        params.wp = wp;
+        params.amf = amf;
+        params.sMBRmode = sMBRmode;
+
+        // expected gammas and objective, one utterance at a time
+        std::vector<std::vector<float>> expectedGammas(lattices.size());
+        double expectedObjective = 0;
+        for (size_t i = 0, ts = 0; i < lattices.size(); ts += lattices[i]->getnumframes(), i++)
+        {
+            std::vector<size_t> utteranceUids(uids.begin() + ts, uids.begin() + ts + lattices[i]->getnumframes());
+            double denavlogp = ForwardBackward(lattices[i]->second, logLLs[i], hset, utteranceUids, sMBRmode, 1, expectedGammas[i]);
+            double numavlogp = 0;
+            for (size_t t = 0; t < utteranceUids.size(); t++)
+                numavlogp += logLLs[i](utteranceUids[t], t) / amf;
+            expectedObjective += numavlogp - denavlogp * utteranceUids.size();
+        }
+
+        // utterances 0 and 2 share a parallel sequence if there are two
+        for (size_t numParallelSequences : {1, 2})
+        {
+            std::vector<size_t> extrauttmap, begin;
+            std::vector<size_t> cursor(numParallelSequences, 0);
+            for (size_t i = 0; i < lattices.size(); i++)
+            {
+                extrauttmap.push_back(i % numParallelSequences);
+                begin.push_back(cursor[extrauttmap[i]]);
+                cursor[extrauttmap[i]] += lattices[i]->getnumframes();
+            }
+            const size_t T = *std::max_element(cursor.begin(), cursor.end());
+            auto pMBLayout = make_shared<MBLayout>();
+            pMBLayout->Init(numParallelSequences, T);
+            for (size_t i = 0; i < lattices.size(); i++)
+                pMBLayout->AddSequence(i, extrauttmap[i], begin[i], begin[i] + lattices[i]->getnumframes());
+            for (size_t s = 0; s < numParallelSequences; s++)
+                pMBLayout->AddGap(s, cursor[s], T);
+
+            Matrix<float> loglikelihood = Matrix<float>::Zeros(numSenones, T * numParallelSequences, CPUDEVICE);
+            for (size_t i = 0; i < lattices.size(); i++)
+                for (size_t t = 0; t < lattices[i]->getnumframes(); t++)
+                    for (size_t s = 0; s < numSenones; s++)
+                        loglikelihood(s, (begin[i] + t) * numParallelSequences + extrauttmap[i]) = logLLs[i](s, t);
+
+            for (int numThreads : {1, 4})
+            {
+                int previousNumThreads = CPUMatrix<float>::SetNumThreadsOfCallingThread(numThreads);
+                GammaCalculation<float> gammaCalculation;
+                gammaCalculation.init(hset, CPUDEVICE);
+                gammaCalculation.SetGammarCalculationParams(params);
+                Matrix<float> objective(1, 1, CPUDEVICE);
+                Matrix<float> labels = Matrix<float>::Zeros(numSenones, T * numParallelSequences, CPUDEVICE);
+                Matrix<float> gammas = Matrix<float>::Zeros(numSenones, T * numParallelSequences, CPUDEVICE);
+                std::vector<size_t> minibatchUids(uids), boundaries(uids.size(), 0);
+                gammaCalculation.calgammaformb(objective, lattices, loglikelihood, labels, gammas, minibatchUids, boundaries,
+                                               numParallelSequences, pMBLayout, extrauttmap, /*doreferencealign=*/false);
+                CPUMatrix<float>::SetNumThreadsOfCallingThread(previousNumThreads);
+
+                for (size_t i = 0; i < lattices.size(); i++)
+                {
+                    std::vector<float> utteranceGammas;
+                    for (size_t t = 0; t < lattices[i]->getnumframes(); t++)
+                        for (size_t s = 0; s < numSenones; s++)
+                            utteranceGammas.push_back(gammas(s, (begin[i] + t) * numParallelSequences + extrauttmap[i]));
+                    BOOST_CHECK_MESSAGE(utteranceGammas == expectedGammas[i], "utterance " << i << " with " << numParallelSequences
+                                                                                           << " parallel sequences and " << numThreads << " threads");
+                }
+                BOOST_CHECK_CLOSE(objective(0, 0), expectedObjective, 1e-3);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
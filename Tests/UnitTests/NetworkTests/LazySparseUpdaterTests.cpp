@@ -0,0 +1,107 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "../../../Source/SGDLib/LazySparseUpdater.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(LazySparseUpdaterSuite)
+
+const size_t D = 5;  // embedding dimension
+const size_t V = 40; // vocabulary size
+const size_t N = 3;  // samples per minibatch
+const size_t numSteps = 12;
+
+// one word per sample: a one-hot sparse input that selects a few of the columns, different ones in each step
+static void SetInput(Matrix<float>& input, size_t step)
+{
+    std::vector<CPUSPARSE_INDEX_TYPE> colStarts, rows;
+    std::vector<float> values;
+    for (size_t j = 0; j < N; j++)
+    {
+        colStarts.push_back((CPUSPARSE_INDEX_TYPE) j);
+        rows.push_back((CPUSPARSE_INDEX_TYPE) ((step * 7 + j * 13) % (V / 2) + (step % 2) * j)); // (some columns are never used)
+        values.push_back(1);
+    }
+    colStarts.push_back((CPUSPARSE_INDEX_TYPE) N);
+    input.SetMatrixFromCSCFormat(colStarts.data(), rows.data(), values.data(), N, V, N);
+}
+
+// Runs the lazy update with a block-column gradient and the dense update with the same gradient as a dense matrix side by
+// side. Before each step, the columns that forward prop reads must match the dense weights; after Flush(), all must.
+template <class Update>
+static void CompareWithDenseUpdate(bool useNesterovMomentum, bool startFromZero, Update update)
+{
+    Matrix<float> lazyWeights = Matrix<float>::RandomUniform(D, V, CPUDEVICE, -1, 1, 1);
+    Matrix<float> lazySmoothed = startFromZero ? Matrix<float>::Zeros(D, V, CPUDEVICE) : Matrix<float>::RandomUniform(D, V, CPUDEVICE, -1, 1, 2);
+    Matrix<float> denseWeights(CPUDEVICE), denseSmoothed(CPUDEVICE);
+    denseWeights.SetValue(lazyWeights);
+    denseSmoothed.SetValue(lazySmoothed);
+
+    Matrix<float> input(V, N, CPUDEVICE, SPARSE, matrixFormatSparseCSC);
+    LazySparseUpdater<float> updater(lazyWeights, lazySmoothed, {&input}, /*readsAllColumns=*/false, useNesterovMomentum);
+    std::vector<size_t> readColumns;
+    for (size_t step = 0; step < numSteps; step++)
+    {
+        SetInput(input, step);
+        updater.CatchUpReadColumns();
+        input.GetNonZeroRowIds(readColumns);
+        for (auto col : readColumns)
+            BOOST_CHECK_MESSAGE(lazyWeights.ColumnSlice(col, 1).IsEqualTo(denseWeights.ColumnSlice(col, 1), 1e-5f), "column " << col << " in step " << step);
+
+        Matrix<float> outputGradient = Matrix<float>::RandomUniform(D, N, CPUDEVICE, -1, 1, 100 + step);
+        Matrix<float> sparseGradient(D, V, CPUDEVICE, SPARSE, matrixFormatSparseBlockCol);
+        Matrix<float> denseGradient = Matrix<float>::Zeros(D, V, CPUDEVICE);
+        Matrix<float>::SparseColumnLookupGradient(outputGradient, input, sparseGradient);
+        Matrix<float>::SparseColumnLookupGradient(outputGradient, input, denseGradient);
+
+        update(updater, sparseGradient, lazyWeights, denseGradient, denseSmoothed, denseWeights, step);
+    }
+
+    updater.Flush();
+    BOOST_CHECK(lazyWeights.IsEqualTo(denseWeights, 1e-5f));
+    BOOST_CHECK(lazySmoothed.IsEqualTo(denseSmoothed, 1e-5f));
+}
+
+// momentum per step, including one that ends a segment of the updater's momentum history
+static float Momentum(size_t step)
+{
+    return step == 5 ? 0.0f : 0.9f - 0.02f * (step % 3);
+}
+
+BOOST_AUTO_TEST_CASE(MomentumMatchesDenseUpdate)
+{
+    for (bool useNesterovMomentum : {false, true})
+    {
+        CompareWithDenseUpdate(useNesterovMomentum, /*startFromZero=*/false,
+                               [&](LazySparseUpdater<float>& updater, Matrix<float>& sparseGradient, Matrix<float>& /*lazyWeights*/,
+                                   Matrix<float>& denseGradient, Matrix<float>& denseSmoothed, Matrix<float>& denseWeights, size_t step)
+                               {
+                                   const float learnRatePerSample = 0.1f;
+                                   updater.NormalGrad(sparseGradient, learnRatePerSample, Momentum(step));
+                                   denseSmoothed.NormalGrad(denseGradient, denseWeights, learnRatePerSample, Momentum(step), useNesterovMomentum);
+                               });
+    }
+}
+
+// as SGD does it: the weights move by the gradient scaled with the learning rate over the average multiplier
+BOOST_AUTO_TEST_CASE(AdaGradMatchesDenseUpdate)
+{
+    CompareWithDenseUpdate(/*useNesterovMomentum=*/false, /*startFromZero=*/true,
+                           [](LazySparseUpdater<float>& updater, Matrix<float>& sparseGradient, Matrix<float>& lazyWeights,
+                              Matrix<float>& denseGradient, Matrix<float>& denseSmoothed, Matrix<float>& denseWeights, size_t /*step*/)
+                           {
+                               const float learnRatePerSample = 0.05f;
+                               float lazyMultiplier = updater.Adagrad(sparseGradient, /*needAveMultiplier=*/true);
+                               float denseMultiplier = denseSmoothed.Adagrad(denseGradient, /*needAveMultiplier=*/true);
+                               BOOST_CHECK_CLOSE(lazyMultiplier, denseMultiplier, 1e-3f);
+                               Matrix<float>::ScaleAndAdd(-learnRatePerSample / lazyMultiplier, sparseGradient, lazyWeights);
+                               Matrix<float>::ScaleAndAdd(-learnRatePerSample / denseMultiplier, denseGradient, denseWeights);
+                           });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
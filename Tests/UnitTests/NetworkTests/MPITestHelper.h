@@ -0,0 +1,47 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// MPITestHelper.h -- MPI setup shared by the tests of the distributed training components
+//
+// Run the test executable under mpiexec (e.g. mpiexec -n 3 NetworkTests) to test with several workers;
+// otherwise there is a single worker and all reductions are trivial. Every worker runs the same test
+// cases in the same order, so the collective operations inside them match up.
+
+#pragma once
+
+#include "Basics.h"
+#include "MPIWrapper.h"
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+// MPIWrapper is a singleton; it is created by the first test that needs it and finalizes MPI at exit.
+inline MPIWrapper* TestMPIWrapper()
+{
+    static MPIWrapper mpi;
+    return &mpi;
+}
+
+// Workers of an mpiexec run share the working directory, so a test that writes files gives them names of its own.
+inline std::wstring WorkerFileName(const std::wstring& name)
+{
+    auto mpi = TestMPIWrapper();
+    return mpi->NumNodesInUse() > 1 ? name + L"." + std::to_wstring(mpi->CurrentNodeRank()) : name;
+}
+
+// The expected result of a reduction: the sum of the values that all numWorkers workers contribute.
+// value(worker, i) must be computable on every worker.
+template <class ElemType, class ValueFunction>
+std::vector<ElemType> ExpectedSum(size_t numWorkers, size_t numElements, ValueFunction value)
+{
+    std::vector<double> sum(numElements, 0);
+    for (size_t worker = 0; worker < numWorkers; worker++)
+    {
+        for (size_t i = 0; i < numElements; i++)
+            sum[i] += value(worker, i);
+    }
+    return std::vector<ElemType>(sum.begin(), sum.end());
+}
+} } } }
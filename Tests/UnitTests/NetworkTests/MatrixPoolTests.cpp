@@ -0,0 +1,105 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetwork.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetworkBuilder.h"
+#include "../../../Source/ComputationNetworkLib/MatrixPool.h"
+
+extern bool g_shareNodeValueMatrices;
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(MatrixPoolSuite)
+
+BOOST_AUTO_TEST_CASE(MatrixPoolBestFit)
+{
+    MatrixPool pool;
+    auto large = pool.Request<float>(CPUDEVICE, 100);
+    auto small = pool.Request<float>(CPUDEVICE, 10);
+    pool.Release<float>(large);
+    pool.Release<float>(small);
+
+    // the smallest released matrix that fits
+    BOOST_CHECK(pool.Request<float>(CPUDEVICE, 50) == large);
+    BOOST_CHECK(pool.Request<float>(CPUDEVICE, 5) == small);
+    BOOST_CHECK_EQUAL(pool.GetNumPlannedMatrices<float>(), 2);
+    BOOST_CHECK_EQUAL(pool.GetNumPlannedBytesPerColumn<float>(), 110 * sizeof(float));
+    BOOST_CHECK_EQUAL(pool.GetNumRequestedBytesPerColumn<float>(), 165 * sizeof(float));
+
+    // none fits: the largest one is grown
+    pool.Release<float>(large);
+    pool.Release<float>(small);
+    BOOST_CHECK(pool.Request<float>(CPUDEVICE, 200) == large);
+    BOOST_CHECK_EQUAL(pool.GetNumPlannedBytesPerColumn<float>(), 210 * sizeof(float));
+    BOOST_CHECK(pool.HasSharedMatrices());
+}
+
+BOOST_AUTO_TEST_CASE(MatrixPoolReset)
+{
+    MatrixPool pool;
+    auto first = pool.Request<float>(CPUDEVICE, 100);
+    pool.Release<float>(first);
+    pool.Request<float>(CPUDEVICE, 100);
+    BOOST_CHECK(pool.HasSharedMatrices());
+
+    // a new plan starts empty, but remembers that the matrices of the previous one are shared
+    pool.ResetPlan();
+    BOOST_CHECK_EQUAL(pool.GetNumPlannedMatrices<float>(), 0);
+    BOOST_CHECK_EQUAL(pool.GetNumPlannedBytesPerColumn<float>(), 0);
+    BOOST_CHECK(pool.HasSharedMatrices());
+    BOOST_CHECK(pool.Request<float>(CPUDEVICE, 100) != first);
+
+    pool.Clear();
+    BOOST_CHECK(!pool.HasSharedMatrices());
+}
+
+// x [100] -> z = W x [50] -> CrossEntropyWithSoftmax(labels [50], z)
+static ComputationNetworkPtr CreateSoftmaxRegression(ComputationNodeBasePtr& criterion)
+{
+    auto net = make_shared<ComputationNetwork>(CPUDEVICE);
+    ComputationNetworkBuilder<float> builder(*net);
+    auto x = builder.CreateInputNode(L"x", 100);
+    auto labels = builder.CreateInputNode(L"labels", 50);
+    auto W = builder.CreateLearnableParameter(L"W", 50, 100);
+    auto z = builder.Times(W, x, L"z");
+    criterion = builder.CrossEntropyWithSoftmax(labels, z, L"ce");
+    net->FeatureNodes().push_back(x);
+    net->LabelNodes().push_back(labels);
+    net->FinalCriterionNodes().push_back(criterion);
+    net->CompileNetwork();
+    return net;
+}
+
+BOOST_AUTO_TEST_CASE(NetworkPeakPoolSize)
+{
+    bool shareNodeValueMatrices = g_shareNodeValueMatrices;
+    g_shareNodeValueMatrices = true;
+
+    // evaluation only: z [50], ce [1], and the criterion's softmax and log softmax, which have the dimension of z, not of ce
+    ComputationNodeBasePtr criterion;
+    auto net = CreateSoftmaxRegression(criterion);
+    net->AllocateAllMatrices({criterion}, {}, nullptr);
+    const MatrixPool& evalPool = net->GetMatrixPool();
+    BOOST_CHECK_EQUAL(evalPool.GetNumRequestedBytesPerColumn<float>(), (50 + 1 + 50 + 50) * sizeof(float));
+    BOOST_CHECK_EQUAL(evalPool.GetNumPlannedBytesPerColumn<float>(), (50 + 1 + 50 + 50) * sizeof(float));
+
+    // training adds the gradients of ce [1], z [50], and W [50 x 100]; all of them are alive at the same time
+    auto trainNet = CreateSoftmaxRegression(criterion);
+    trainNet->AllocateAllMatrices({}, {}, criterion);
+    const MatrixPool& trainPool = trainNet->GetMatrixPool();
+    BOOST_CHECK_EQUAL(trainPool.GetNumRequestedBytesPerColumn<float>(), (50 + 1 + 50 + 50 + 1 + 50 + 5000) * sizeof(float));
+    BOOST_CHECK_EQUAL(trainPool.GetNumPlannedBytesPerColumn<float>(), (50 + 1 + 50 + 50 + 1 + 50 + 5000) * sizeof(float));
+
+    // planning again starts from scratch instead of adding to the previous plan; all matrices exist already
+    trainNet->AllocateAllMatrices({}, {}, criterion);
+    BOOST_CHECK_EQUAL(trainPool.GetNumRequestedBytesPerColumn<float>(), 0);
+    BOOST_CHECK_EQUAL(trainPool.GetNumPlannedBytesPerColumn<float>(), 0);
+
+    g_shareNodeValueMatrices = shareNodeValueMatrices;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
@@ -0,0 +1,86 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "MPITestHelper.h"
+#include "../../../Source/SGDLib/ModelAverager.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(ModelAveragerSuite)
+
+// parameter k of worker w in sync round 'round'; small integers, so only the scaling by the factor rounds
+static float ModelValue(size_t round, size_t w, size_t k)
+{
+    return (float) ((int) ((round * 5 + w * 7 + k * 3) % 11) - 5);
+}
+
+// the factor of worker w: its share of the samples, with worker w having processed w + 1 units
+static float Factor(size_t w, size_t numWorkers)
+{
+    return (float) (w + 1) / (numWorkers * (numWorkers + 1) / 2);
+}
+
+// Average() must leave every worker with sum_w factor_w * model_w, whatever the bucketing and the
+// allreduce algorithm, and the bucket layout must be reusable across syncs.
+BOOST_AUTO_TEST_CASE(AveragesLikeAllReduce)
+{
+    auto mpi = TestMPIWrapper();
+    const size_t numWorkers = mpi->NumNodesInUse();
+    const size_t rank = mpi->CurrentNodeRank();
+    const std::vector<std::pair<size_t, size_t>> shapes = {{3, 5}, {7, 1}, {50, 4}};
+
+    for (auto algorithm : {AllReduceAlgorithm::MPI, AllReduceAlgorithm::Ring, AllReduceAlgorithm::RecursiveHalvingDoubling})
+    {
+        // one element per bucket, buckets that split matrices and one bucket for everything
+        for (size_t bucketSizeInBytes : {(size_t) 1, 10 * sizeof(float), (size_t) 1024 * 1024})
+        {
+            std::vector<std::unique_ptr<Matrix<float>>> matrices;
+            std::vector<Matrix<float>*> models;
+            for (const auto& shape : shapes)
+            {
+                matrices.push_back(std::unique_ptr<Matrix<float>>(new Matrix<float>(shape.first, shape.second, CPUDEVICE)));
+                models.push_back(matrices.back().get());
+            }
+
+            ModelAverager<float> averager(mpi, bucketSizeInBytes, algorithm);
+            for (size_t round = 0; round < 2; round++)
+            {
+                size_t offset = 0;
+                for (auto* model : models)
+                {
+                    for (size_t i = 0; i < model->GetNumElements(); i++)
+                        model->BufferPointer()[i] = ModelValue(round, rank, offset + i);
+                    offset += model->GetNumElements();
+                }
+
+                averager.Average(models, Factor(rank, numWorkers));
+
+                auto expected = ExpectedSum<float>(numWorkers, offset, [&](size_t w, size_t k)
+                                                   {
+                                                       return (double) Factor(w, numWorkers) * ModelValue(round, w, k);
+                                                   });
+                float maxError = 0;
+                offset = 0;
+                for (auto* model : models)
+                {
+                    for (size_t i = 0; i < model->GetNumElements(); i++, offset++)
+                        maxError = std::max(maxError, fabs(model->BufferPointer()[i] - expected[offset]));
+                }
+                BOOST_CHECK_SMALL(maxError, 1e-5f);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(RejectsSparseModels)
+{
+    Matrix<float> sparse(4, 4, CPUDEVICE, SPARSE, matrixFormatSparseCSC);
+    ModelAverager<float> averager(TestMPIWrapper(), 1024);
+    BOOST_CHECK_THROW(averager.Average({&sparse}, 1.0f), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
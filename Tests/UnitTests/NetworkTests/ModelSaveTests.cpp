@@ -0,0 +1,121 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "MPITestHelper.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetwork.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetworkBuilder.h"
+#include "../../../Source/SGDLib/AsyncCheckpointWriter.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(ModelSaveSuite)
+
+// x [10] -> z = Sigmoid(W x + b) [5]
+static ComputationNetworkPtr CreateLayer()
+{
+    auto net = make_shared<ComputationNetwork>(CPUDEVICE);
+    ComputationNetworkBuilder<float> builder(*net);
+    auto x = builder.CreateInputNode(L"x", 10);
+    auto W = builder.CreateLearnableParameter(L"W", 5, 10);
+    auto b = builder.CreateLearnableParameter(L"b", 5, 1);
+    auto z = builder.Sigmoid(builder.Plus(builder.Times(W, x, L"Wx"), b, L"Wxb"), L"z");
+    net->InitLearnableParameters<float>(W, true, 1, 1);
+    net->InitLearnableParameters<float>(b, true, 2, 1);
+    net->FeatureNodes().push_back(x);
+    net->OutputNodes().push_back(z);
+    net->CompileNetwork();
+    return net;
+}
+
+static Matrix<float>& ValueOf(ComputationNetworkPtr net, const wchar_t* name)
+{
+    return net->GetNodeFromName(name)->As<ComputationNode<float>>()->Value();
+}
+
+static std::string ReadBytes(const std::wstring& fileName)
+{
+    File file(fileName, fileOptionsBinary | fileOptionsRead);
+    std::string bytes;
+    file.ReadChars(bytes, file.Size());
+    return bytes;
+}
+
+// SaveToBuffer() yields the bytes of the model file, also in the mappable format, whose blob offsets depend on the
+// positions within the file
+BOOST_AUTO_TEST_CASE(SaveToBufferMatchesSave)
+{
+    auto net = CreateLayer();
+    for (auto fileFormat : {fileOptionsBinary, (FileOptions) (fileOptionsBinary | fileOptionsMappable)})
+    {
+        const std::wstring path = WorkerFileName(L"SaveToBufferMatchesSave.dnn");
+        net->Save(path, fileFormat);
+        std::vector<char> buffer = net->SaveToBuffer(fileFormat);
+        BOOST_CHECK(std::string(buffer.begin(), buffer.end()) == ReadBytes(path));
+    }
+}
+
+// The model is serialized on the training thread and written out in the background while training keeps changing
+// the parameters, as SGD does with asyncCheckpointing.
+BOOST_AUTO_TEST_CASE(AsyncSave)
+{
+    auto net = CreateLayer();
+    const std::wstring syncPath = WorkerFileName(L"AsyncSave.sync.dnn");
+    const std::wstring asyncPath = WorkerFileName(L"AsyncSave.async.dnn");
+    net->Save(syncPath);
+    Matrix<float> W(CPUDEVICE), b(CPUDEVICE);
+    W.SetValue(ValueOf(net, L"W"));
+    b.SetValue(ValueOf(net, L"b"));
+
+    auto model = make_shared<std::vector<char>>(net->SaveToBuffer());
+    AsyncCheckpointWriter writer;
+    writer.Start([=]()
+    {
+        AsyncCheckpointWriter::WriteFile(asyncPath, *model);
+    });
+    for (int i = 0; i < 100; i++)
+    {
+        ValueOf(net, L"W") += 1;
+        ValueOf(net, L"b") *= 2;
+    }
+    writer.Wait();
+
+    // the file is the one a synchronous save at the time of serialization writes...
+    BOOST_CHECK(ReadBytes(asyncPath) == ReadBytes(syncPath));
+
+    // ...and loads the parameters of that time
+    auto loaded = ComputationNetwork::CreateFromFile<float>(CPUDEVICE, asyncPath);
+    BOOST_CHECK(ValueOf(loaded, L"W").IsEqualTo(W, 0));
+    BOOST_CHECK(ValueOf(loaded, L"b").IsEqualTo(b, 0));
+    BOOST_CHECK(!ValueOf(net, L"W").IsEqualTo(W, 0));
+}
+
+BOOST_AUTO_TEST_CASE(AsyncWriteErrorIsRethrown)
+{
+    AsyncCheckpointWriter writer;
+    writer.Start([]()
+    {
+        RuntimeError("disk full");
+    });
+    BOOST_CHECK_THROW(writer.Wait(), std::runtime_error);
+    writer.Wait(); // reported once
+}
+
+BOOST_AUTO_TEST_CASE(InMemoryFileIsForWritingBinaryData)
+{
+    BOOST_CHECK_THROW(File(fileOptionsText | fileOptionsWrite), std::runtime_error);
+    BOOST_CHECK_THROW(File(fileOptionsBinary | fileOptionsRead), std::runtime_error);
+
+    File fstream(fileOptionsBinary | fileOptionsWrite);
+    BOOST_CHECK(fstream.GetBuffer().empty());
+    fstream << (int) 1 << std::wstring(L"abc");
+    size_t size = fstream.GetBuffer().size();
+    BOOST_CHECK_EQUAL(size, fstream.GetPosition());
+    fstream << (int) 2;
+    BOOST_CHECK_EQUAL(fstream.GetBuffer().size(), size + sizeof(int));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
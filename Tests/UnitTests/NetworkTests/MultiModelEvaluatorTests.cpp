@@ -0,0 +1,150 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetwork.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetworkBuilder.h"
+#include "../../../Source/SGDLib/MultiModelEvaluator.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(MultiModelEvaluatorSuite)
+
+const size_t D = 6; // feature dimension
+const size_t C = 4; // number of classes
+
+// features [D] -> z = W features + b [C] -> CrossEntropyWithSoftmax(labels, z), ErrorPrediction(labels, z)
+static ComputationNetworkPtr CreateModel(unsigned long seed, const wchar_t* labelName = L"labels")
+{
+    auto net = make_shared<ComputationNetwork>(CPUDEVICE);
+    ComputationNetworkBuilder<float> builder(*net);
+    auto features = builder.CreateInputNode(L"features", D);
+    auto labels = builder.CreateInputNode(labelName, C);
+    auto W = builder.CreateLearnableParameter(L"W", C, D);
+    auto b = builder.CreateLearnableParameter(L"b", C, 1);
+    auto z = builder.Plus(builder.Times(W, features, L"Wx"), b, L"z");
+    ComputationNodeBasePtr ce = builder.CrossEntropyWithSoftmax(labels, z, L"ce");
+    ComputationNodeBasePtr err = builder.ErrorPrediction(labels, z, L"err");
+    net->InitLearnableParameters<float>(W, true, seed, 1);
+    net->InitLearnableParameters<float>(b, true, seed + 1000, 1);
+    net->FeatureNodes().push_back(features);
+    net->LabelNodes().push_back(labels);
+    net->FinalCriterionNodes().push_back(ce);
+    net->EvaluationNodes().push_back(err);
+    net->CompileNetwork();
+    return net;
+}
+
+// minibatches of random features and one-hot labels, of different sizes, in frame mode
+class MemoryReader : public IDataReader<float>
+{
+public:
+    MemoryReader()
+        : m_next(0), m_numSamples(0)
+    {
+        const std::vector<size_t> minibatchSizes = {7, 5, 9, 1, 8};
+        for (size_t i = 0; i < minibatchSizes.size(); i++)
+        {
+            size_t n = minibatchSizes[i];
+            m_features.push_back(Matrix<float>::RandomUniform(D, n, CPUDEVICE, -1, 1, 10 + i));
+            m_labels.push_back(Matrix<float>::Zeros(C, n, CPUDEVICE));
+            for (size_t j = 0; j < n; j++)
+                m_labels.back()((i * 3 + j * 5) % C, j) = 1;
+        }
+    }
+
+    virtual void Init(const ConfigParameters&) override
+    {
+    }
+    virtual void Init(const ScriptableObjects::IConfigRecord&) override
+    {
+    }
+    virtual void Destroy() override
+    {
+    }
+    virtual void StartMinibatchLoop(size_t, size_t, size_t) override
+    {
+        m_next = 0;
+    }
+    virtual bool GetMinibatch(std::map<std::wstring, Matrix<float>*>& matrices) override
+    {
+        if (m_next == m_features.size())
+            return false;
+        matrices[L"features"]->SetValue(m_features[m_next]);
+        matrices[L"labels"]->SetValue(m_labels[m_next]);
+        m_numSamples = m_features[m_next].GetNumCols();
+        m_next++;
+        return true;
+    }
+    virtual size_t GetNumParallelSequences() override
+    {
+        return m_numSamples;
+    }
+    virtual bool DataEnd() override
+    {
+        return true;
+    }
+    virtual void CopyMBLayoutTo(MBLayoutPtr layout) override
+    {
+        layout->InitAsFrameMode(m_numSamples);
+    }
+
+private:
+    std::vector<Matrix<float>> m_features, m_labels;
+    size_t m_next;
+    size_t m_numSamples;
+};
+
+// Each model's results of a joint pass must be those of evaluating the model on its own, whatever the number of threads.
+BOOST_AUTO_TEST_CASE(MatchesSimpleEvaluator)
+{
+    const size_t numModels = 5;
+    const std::vector<std::wstring> evalNodeNames = {L"ce", L"err"};
+    MemoryReader reader;
+
+    std::vector<std::vector<double>> expected;
+    for (size_t k = 0; k < numModels; k++)
+    {
+        SimpleEvaluator<float> eval(CreateModel(k + 1));
+        expected.push_back(eval.Evaluate(&reader, evalNodeNames, 10));
+        BOOST_REQUIRE_EQUAL(expected.back().size(), evalNodeNames.size());
+    }
+    BOOST_REQUIRE(expected[0] != expected[1]); // (the models differ)
+
+    for (size_t numThreads : {1, 2, 0})
+    {
+        std::vector<ComputationNetworkPtr> nets;
+        for (size_t k = 0; k < numModels; k++)
+            nets.push_back(CreateModel(k + 1));
+        MultiModelEvaluator<float> eval(nets, 100, 0, numThreads);
+        auto results = eval.Evaluate(&reader, evalNodeNames, 10);
+        BOOST_REQUIRE_EQUAL(results.size(), numModels);
+        for (size_t k = 0; k < numModels; k++)
+        {
+            BOOST_REQUIRE_EQUAL(results[k].size(), evalNodeNames.size());
+            for (size_t i = 0; i < evalNodeNames.size(); i++)
+                BOOST_CHECK_CLOSE(results[k][i], expected[k][i], 1e-4);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(RejectsModelsWithDifferentInputs)
+{
+    MemoryReader reader;
+    MultiModelEvaluator<float> eval({CreateModel(1), CreateModel(2, L"otherLabels")});
+    BOOST_CHECK_THROW(eval.Evaluate(&reader, {L"ce"}, 10), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(NumThreadsIsBounded)
+{
+    BOOST_CHECK_EQUAL(MultiModelEvaluator<float>::DetermineNumThreads(CPUDEVICE, 10, 3), 3);
+    BOOST_CHECK_EQUAL(MultiModelEvaluator<float>::DetermineNumThreads(CPUDEVICE, 2, 3), 2);
+    size_t numThreads = MultiModelEvaluator<float>::DetermineNumThreads(CPUDEVICE, 1000, 0);
+    BOOST_CHECK(numThreads >= 1 && numThreads < 1000);
+    BOOST_CHECK_EQUAL(MultiModelEvaluator<float>::DetermineNumThreads(0, 10, 3), 1); // GPU
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
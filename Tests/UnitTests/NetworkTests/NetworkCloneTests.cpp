@@ -0,0 +1,98 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "MPITestHelper.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetwork.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetworkBuilder.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(NetworkCloneSuite)
+
+// x [10] -> z = Sigmoid(W x + b) [5]
+static ComputationNetworkPtr CreateLayer()
+{
+    auto net = make_shared<ComputationNetwork>(CPUDEVICE);
+    ComputationNetworkBuilder<float> builder(*net);
+    auto x = builder.CreateInputNode(L"x", 10);
+    auto W = builder.CreateLearnableParameter(L"W", 5, 10);
+    auto b = builder.CreateLearnableParameter(L"b", 5, 1);
+    auto z = builder.Sigmoid(builder.Plus(builder.Times(W, x, L"Wx"), b, L"Wxb"), L"z");
+    net->InitLearnableParameters<float>(W, true, 1, 1);
+    net->InitLearnableParameters<float>(b, true, 2, 1);
+    net->FeatureNodes().push_back(x);
+    net->OutputNodes().push_back(z);
+    net->CompileNetwork();
+    return net;
+}
+
+static Matrix<float> Evaluate(ComputationNetworkPtr net, const Matrix<float>& input)
+{
+    auto z = net->GetNodeFromName(L"z");
+    net->AllocateAllMatrices({}, {z}, nullptr);
+    net->StartEvaluateMinibatchLoop(z);
+
+    auto x = net->GetNodeFromName(L"x");
+    x->As<ComputationNode<float>>()->Value().SetValue(input);
+    net->GetMBLayoutPtr()->InitAsFrameMode(input.GetNumCols());
+    x->NotifyFunctionValuesMBSizeModified();
+    x->BumpEvalTimeStamp();
+    net->ForwardProp(z);
+
+    Matrix<float> output(CPUDEVICE);
+    output.SetValue(z->As<ComputationNode<float>>()->Value());
+    return output;
+}
+
+BOOST_AUTO_TEST_CASE(CloneSharingParameters)
+{
+    auto net = CreateLayer();
+    auto clone = net->CloneSharingParameters<float>();
+
+    // the parameters exist only once, everything else is separate
+    for (const auto& name : {L"W", L"b"})
+        BOOST_CHECK(&clone->GetNodeFromName(name)->As<ComputationNode<float>>()->Value() == &net->GetNodeFromName(name)->As<ComputationNode<float>>()->Value());
+    for (const auto& name : {L"x", L"Wx", L"Wxb", L"z"})
+        BOOST_CHECK(clone->GetNodeFromName(name) != net->GetNodeFromName(name));
+    BOOST_CHECK_EQUAL(clone->FeatureNodes().size(), 1);
+    BOOST_CHECK(clone->FeatureNodes()[0] == clone->GetNodeFromName(L"x"));
+    BOOST_CHECK(clone->OutputNodes()[0] == clone->GetNodeFromName(L"z"));
+    BOOST_CHECK(clone->GetNodeFromName(L"Wx")->GetInputs()[0] == clone->GetNodeFromName(L"W"));
+
+    // the clone computes the same outputs, and evaluating it does not change those of the original
+    Matrix<float> input1 = Matrix<float>::RandomUniform(10, 7, CPUDEVICE, -1, 1, 3);
+    Matrix<float> input2 = Matrix<float>::RandomUniform(10, 4, CPUDEVICE, -1, 1, 4);
+    Matrix<float> output = Evaluate(net, input1);
+    Matrix<float> cloneOutput = Evaluate(clone, input1);
+    BOOST_CHECK(cloneOutput.IsEqualTo(output, 0));
+    Evaluate(clone, input2);
+    BOOST_CHECK(net->GetNodeFromName(L"z")->As<ComputationNode<float>>()->Value().IsEqualTo(output, 0));
+}
+
+BOOST_AUTO_TEST_CASE(CloneOfMappedModel)
+{
+    auto net = CreateLayer();
+    Matrix<float> input = Matrix<float>::RandomUniform(10, 7, CPUDEVICE, -1, 1, 5);
+    Matrix<float> output = Evaluate(net, input);
+    const std::wstring modelPath = WorkerFileName(L"CloneOfMappedModel.dnn");
+    net->Save(modelPath, (FileOptions) (fileOptionsBinary | fileOptionsMappable));
+
+    // the parameters refer to the mapped model file, and keep it mapped when the network that loaded it is gone
+    auto loaded = ComputationNetwork::CreateFromFile<float>(CPUDEVICE, modelPath);
+    auto clone = loaded->CloneSharingParameters<float>();
+    loaded.reset();
+    BOOST_CHECK(Evaluate(clone, input).IsEqualTo(output, 0));
+
+    // the mapping is read-only; once made writable, the parameters can be changed in place without changing the file
+    clone->MakeValuesWritable<float>();
+    clone->GetNodeFromName(L"b")->As<ComputationNode<float>>()->Value() += 1;
+    BOOST_CHECK(!Evaluate(clone, input).IsEqualTo(output, 0));
+    auto reloaded = ComputationNetwork::CreateFromFile<float>(CPUDEVICE, modelPath);
+    BOOST_CHECK(Evaluate(reloaded, input).IsEqualTo(output, 0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
@@ -0,0 +1,142 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetwork.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetworkBuilder.h"
+#include "../../../Source/ComputationNetworkLib/NodeProfiler.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(NodeProfilerSuite)
+
+const size_t D = 200; // input dimension
+const size_t H = 100; // output dimension
+const size_t N = 64;  // samples per minibatch
+
+// x [D] -> z = Sigmoid(W x + b) [H] -> ce = SquareError(labels, z)
+static ComputationNetworkPtr CreateLayer()
+{
+    auto net = make_shared<ComputationNetwork>(CPUDEVICE);
+    ComputationNetworkBuilder<float> builder(*net);
+    auto x = builder.CreateInputNode(L"x", D);
+    auto labels = builder.CreateInputNode(L"labels", H);
+    auto W = builder.CreateLearnableParameter(L"W", H, D);
+    auto b = builder.CreateLearnableParameter(L"b", H, 1);
+    auto z = builder.Sigmoid(builder.Plus(builder.Times(W, x, L"Wx"), b, L"Wxb"), L"z");
+    ComputationNodeBasePtr ce = builder.SquareError(labels, z, L"ce");
+    net->InitLearnableParameters<float>(W, true, 1, 1);
+    net->InitLearnableParameters<float>(b, true, 2, 1);
+    net->FeatureNodes().push_back(x);
+    net->LabelNodes().push_back(labels);
+    net->FinalCriterionNodes().push_back(ce);
+    net->CompileNetwork();
+    net->AllocateAllMatrices({}, {}, ce);
+    net->StartEvaluateMinibatchLoop(ce);
+    return net;
+}
+
+static void TrainMinibatch(ComputationNetworkPtr net, int index)
+{
+    net->GetMBLayoutPtr()->InitAsFrameMode(N);
+    for (const auto& name : {L"x", L"labels"})
+    {
+        auto node = net->GetNodeFromName(name);
+        auto& value = node->As<ComputationNode<float>>()->Value();
+        value.SetValue(Matrix<float>::RandomUniform(node->GetSampleMatrixNumRows(), N, CPUDEVICE, 0, 1, 10 * index + (name[0] == L'x')));
+        node->NotifyFunctionValuesMBSizeModified();
+        node->BumpEvalTimeStamp();
+    }
+    auto ce = net->GetNodeFromName(L"ce");
+    net->ForwardProp(ce);
+    net->Backprop(ce);
+}
+
+static NodeProfiler::NodeStats StatsOf(ComputationNetworkPtr net, const wchar_t* name)
+{
+    NodeProfiler::NodeStats stats;
+    BOOST_REQUIRE_MESSAGE(NodeProfiler::GetNodeStats(*net->GetNodeFromName(name), stats), "node " << msra::strfun::utf8(name) << " was not profiled");
+    return stats;
+}
+
+// Every forward and backward call of a node is counted and timed; matrix products are counted with 2 * m * n * k
+// operations (twice that backward, for the gradients of both inputs), the other nodes with one per output element and input.
+BOOST_AUTO_TEST_CASE(ProfilesEachNode)
+{
+    auto net = CreateLayer();
+    NodeProfiler::Enable(true);
+    NodeProfiler::Reset();
+    const int numMinibatches = 3;
+    for (int index = 0; index < numMinibatches; index++)
+        TrainMinibatch(net, index);
+
+    for (const auto& name : {L"Wx", L"Wxb", L"z", L"ce"})
+    {
+        auto stats = StatsOf(net, name);
+        BOOST_CHECK(stats.m_nodeName == name);
+        BOOST_CHECK_EQUAL(stats.m_numForwardCalls, numMinibatches);
+        BOOST_CHECK_EQUAL(stats.m_numBackwardCalls, numMinibatches);
+        BOOST_CHECK_GE(stats.m_forwardSeconds, 0);
+        BOOST_CHECK_GE(stats.m_backwardSeconds, 0);
+    }
+    auto times = StatsOf(net, L"Wx");
+    BOOST_CHECK(times.m_operationName == L"Times");
+    BOOST_CHECK_GT(times.m_forwardSeconds, 0);
+    BOOST_CHECK_GT(times.m_backwardSeconds, 0);
+    BOOST_CHECK_EQUAL(times.m_flops, numMinibatches * (1 + 2) * 2.0 * H * N * D);
+    BOOST_CHECK_EQUAL(StatsOf(net, L"Wxb").m_flops, numMinibatches * 2 * 2.0 * H * N);
+
+    NodeProfiler::Reset();
+    NodeProfiler::NodeStats stats;
+    BOOST_CHECK(!NodeProfiler::GetNodeStats(*net->GetNodeFromName(L"Wx"), stats));
+    NodeProfiler::Enable(false);
+    TrainMinibatch(net, numMinibatches);
+    BOOST_CHECK(!NodeProfiler::GetNodeStats(*net->GetNodeFromName(L"Wx"), stats));
+}
+
+// A node's bytes are those of its value and gradient; in the total, a matrix that several nodes share
+// (see MatrixPool) is counted once.
+BOOST_AUTO_TEST_CASE(CountsSharedMatricesOnce)
+{
+    auto net = CreateLayer();
+    NodeProfiler::Enable(true);
+    NodeProfiler::Reset();
+    TrainMinibatch(net, 0);
+    TrainMinibatch(net, 1);
+    NodeProfiler::Enable(false);
+
+    std::map<const void*, size_t> buffers;
+    size_t sumOfNodes = 0, numProfiledNodes = 0;
+    std::vector<std::pair<const void*, size_t>> nodeBuffers;
+    for (const auto& node : net->GetAllNodes())
+    {
+        NodeProfiler::NodeStats stats;
+        if (!NodeProfiler::GetNodeStats(*node, stats))
+            continue;
+        numProfiledNodes++;
+        node->GetValueAndGradientBuffers(nodeBuffers);
+        size_t numBytes = 0;
+        for (const auto& buffer : nodeBuffers)
+        {
+            numBytes += buffer.second;
+            buffers[buffer.first] = buffer.second;
+        }
+        BOOST_CHECK_MESSAGE(stats.m_maxNumBytes == numBytes, "node " << msra::strfun::utf8(node->NodeName()) << ": " << stats.m_maxNumBytes << " instead of " << numBytes << " bytes");
+        sumOfNodes += numBytes;
+    }
+    BOOST_CHECK_GE(numProfiledNodes, 4);
+    BOOST_CHECK_GE(StatsOf(net, L"Wx").m_maxNumBytes, 2 * H * N * sizeof(float));
+
+    size_t numSharedBytes = 0;
+    for (const auto& buffer : buffers)
+        numSharedBytes += buffer.second;
+    BOOST_CHECK_LT(numSharedBytes, sumOfNodes); // (the training plan shares some gradients)
+    size_t numMatrices;
+    BOOST_CHECK_EQUAL(NodeProfiler::GetNumValueAndGradientBytes(numMatrices), numSharedBytes);
+    BOOST_CHECK_EQUAL(numMatrices, buffers.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
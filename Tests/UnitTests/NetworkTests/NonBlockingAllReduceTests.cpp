@@ -0,0 +1,157 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "MPITestHelper.h"
+#include "../../../Source/SGDLib/NonBlockingAllReduce.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(NonBlockingAllReduceSuite)
+
+// element i of the buffer of the worker with the given rank; small integers, so that all summation orders are exact
+template <class ElemType>
+static ElemType Contribution(size_t rank, size_t i, size_t seed)
+{
+    return (ElemType) ((int) ((rank * 13 + i * 7 + seed) % 17) - 8);
+}
+
+// Calls f(comm) for communicators of every size from 1 to the number of workers, made of the lowest ranks,
+// so that one mpiexec run covers odd and non-power-of-two worker counts. Workers outside the communicator skip f.
+template <class F>
+static void ForEachCommunicatorSize(F f)
+{
+    auto mpi = TestMPIWrapper();
+    for (size_t size = 1; size <= mpi->NumNodesInUse(); size++)
+    {
+        MPI_Comm comm;
+        bool isMember = mpi->CurrentNodeRank() < size;
+        MPI_Comm_split(mpi->Communicator(), isMember ? 0 : MPI_UNDEFINED, (int) mpi->CurrentNodeRank(), &comm) || MpiFail("MPI_Comm_split");
+        if (isMember)
+        {
+            f(comm, size);
+            MPI_Comm_free(&comm) || MpiFail("MPI_Comm_free");
+        }
+        MPI_Barrier(mpi->Communicator()) || MpiFail("MPI_Barrier");
+    }
+}
+
+template <class ElemType>
+static void TestAgainstMPIAllreduce(AllReduceAlgorithm algorithm, bool useTest)
+{
+    ForEachCommunicatorSize([&](MPI_Comm comm, size_t size)
+    {
+        int rank;
+        MPI_Comm_rank(comm, &rank) || MpiFail("MPI_Comm_rank");
+
+        // empty buffers, buffers with fewer elements than workers, and sizes that do not divide evenly
+        for (size_t numElements : {(size_t) 0, (size_t) 1, size - 1, size, size + 1, 2 * size + 3, (size_t) 1000, (size_t) 1021})
+        {
+            std::vector<ElemType> data(numElements), expected(numElements);
+            for (size_t i = 0; i < numElements; i++)
+                data[i] = expected[i] = Contribution<ElemType>(rank, i, numElements);
+            if (numElements > 0)
+                MPI_Allreduce(MPI_IN_PLACE, expected.data(), (int) numElements, MPIWrapper::GetDataType(expected.data()), MPI_SUM, comm) || MpiFail("MPI_Allreduce");
+
+            NonBlockingAllReduce<ElemType> reduction;
+            reduction.Start(data.data(), numElements, algorithm, comm, /*tag=*/7);
+            if (useTest)
+            {
+                while (!reduction.Test())
+                    ;
+            }
+            else
+                reduction.Wait();
+
+            BOOST_CHECK_MESSAGE(data == expected, "mismatch with " << size << " workers and " << numElements << " elements");
+            BOOST_CHECK(reduction.Test()); // stays done
+        }
+    });
+}
+
+BOOST_AUTO_TEST_CASE(MPIMatchesMPIAllreduce)
+{
+    TestAgainstMPIAllreduce<float>(AllReduceAlgorithm::MPI, /*useTest=*/true);
+    TestAgainstMPIAllreduce<double>(AllReduceAlgorithm::MPI, /*useTest=*/false);
+}
+
+BOOST_AUTO_TEST_CASE(RingMatchesMPIAllreduce)
+{
+    TestAgainstMPIAllreduce<float>(AllReduceAlgorithm::Ring, /*useTest=*/true);
+    TestAgainstMPIAllreduce<double>(AllReduceAlgorithm::Ring, /*useTest=*/false);
+}
+
+// (with a worker count that is not a power of two this falls back to the ring)
+BOOST_AUTO_TEST_CASE(RecursiveHalvingDoublingMatchesMPIAllreduce)
+{
+    TestAgainstMPIAllreduce<float>(AllReduceAlgorithm::RecursiveHalvingDoubling, /*useTest=*/true);
+    TestAgainstMPIAllreduce<double>(AllReduceAlgorithm::RecursiveHalvingDoubling, /*useTest=*/false);
+}
+
+// Several reductions with different tags in flight at once, progressed in an interleaved fashion, as the
+// aggregators do with their buckets; the same objects are then reused for another round.
+BOOST_AUTO_TEST_CASE(InterleavedReductions)
+{
+    ForEachCommunicatorSize([&](MPI_Comm comm, size_t size)
+    {
+        int rank;
+        MPI_Comm_rank(comm, &rank) || MpiFail("MPI_Comm_rank");
+
+        const AllReduceAlgorithm algorithms[] = {AllReduceAlgorithm::Ring, AllReduceAlgorithm::RecursiveHalvingDoubling, AllReduceAlgorithm::MPI, AllReduceAlgorithm::Ring};
+        const size_t numElements[] = {size / 2, 333, 64, 5};
+        const size_t numReductions = 4;
+        std::vector<std::vector<float>> data(numReductions), expected(numReductions);
+        std::vector<NonBlockingAllReduce<float>> reductions(numReductions);
+        for (size_t round = 0; round < 2; round++)
+        {
+            for (size_t k = 0; k < numReductions; k++)
+            {
+                data[k].resize(numElements[k]);
+                expected[k].assign(numElements[k], 0);
+                for (size_t i = 0; i < numElements[k]; i++)
+                {
+                    data[k][i] = Contribution<float>(rank, i, 10 * round + k);
+                    for (size_t w = 0; w < size; w++)
+                        expected[k][i] += Contribution<float>(w, i, 10 * round + k);
+                }
+                reductions[k].Start(data[k].data(), numElements[k], algorithms[k], comm, /*tag=*/(int) k);
+            }
+
+            // progress the later reductions first, then wait for them in the opposite order
+            for (size_t k = numReductions; k-- > 0;)
+                reductions[k].Test();
+            for (size_t k = numReductions; k-- > 0;)
+                reductions[k].Wait();
+
+            for (size_t k = 0; k < numReductions; k++)
+                BOOST_CHECK_MESSAGE(data[k] == expected[k], "mismatch of reduction " << k << " with " << size << " workers");
+        }
+    });
+}
+
+BOOST_AUTO_TEST_CASE(RejectsStartWhileInFlight)
+{
+    auto mpi = TestMPIWrapper();
+    if (mpi->NumNodesInUse() < 2) // with one worker a reduction completes immediately
+        return;
+
+    std::vector<float> data(100, 1.0f);
+    NonBlockingAllReduce<float> reduction;
+    reduction.Start(data.data(), data.size(), AllReduceAlgorithm::Ring, mpi->Communicator(), /*tag=*/0);
+    BOOST_CHECK_THROW(reduction.Start(data.data(), data.size(), AllReduceAlgorithm::Ring, mpi->Communicator(), /*tag=*/0), std::logic_error);
+    reduction.Wait();
+    BOOST_CHECK(data == std::vector<float>(100, (float) mpi->NumNodesInUse()));
+}
+
+BOOST_AUTO_TEST_CASE(ParsesAlgorithmNames)
+{
+    BOOST_CHECK(ParseAllReduceAlgorithm(L"MPI") == AllReduceAlgorithm::MPI);
+    BOOST_CHECK(ParseAllReduceAlgorithm(L"ring") == AllReduceAlgorithm::Ring);
+    BOOST_CHECK(ParseAllReduceAlgorithm(L"recursiveHalvingDoubling") == AllReduceAlgorithm::RecursiveHalvingDoubling);
+    BOOST_CHECK_THROW(ParseAllReduceAlgorithm(L"tree"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
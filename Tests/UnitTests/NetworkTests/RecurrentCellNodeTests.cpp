@@ -0,0 +1,177 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetwork.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetworkBuilder.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(RecurrentCellNodeSuite)
+
+const size_t D = 2; // input dimension
+const size_t H = 3; // hidden dimension
+
+// x [D] -> h = LSTM(x) or GRU(x) [H] -> loss = Sum(dh .* h), where the input dh is the output gradient
+static ComputationNetworkPtr CreateRecurrentCell(bool lstm)
+{
+    auto net = make_shared<ComputationNetwork>(CPUDEVICE);
+    ComputationNetworkBuilder<double> builder(*net);
+    auto x = builder.CreateInputNode(L"x", D);
+    auto dh = builder.CreateInputNode(L"dh", H);
+    const size_t numGates = lstm ? 4 : 3;
+    auto W = builder.CreateLearnableParameter(L"W", numGates * H, D);
+    auto R = builder.CreateLearnableParameter(L"R", numGates * H, H);
+    auto b = builder.CreateLearnableParameter(L"b", H, numGates);
+    shared_ptr<ComputationNode<double>> h;
+    if (lstm)
+    {
+        auto p = builder.CreateLearnableParameter(L"p", H, 3);
+        net->InitLearnableParameters<double>(p, true, 4, 1);
+        h = builder.LSTM(x, W, R, b, p, 0.1f, L"h");
+    }
+    else
+        h = builder.GRU(x, W, R, b, 0.1f, L"h");
+    ComputationNodeBasePtr loss = builder.Sum(builder.ElementTimes(dh, h), L"loss");
+    net->InitLearnableParameters<double>(W, true, 1, 1);
+    net->InitLearnableParameters<double>(R, true, 2, 1);
+    net->InitLearnableParameters<double>(b, true, 3, 1);
+    net->FeatureNodes().push_back(x);
+    net->FeatureNodes().push_back(dh);
+    net->FinalCriterionNodes().push_back(loss);
+    net->CompileNetwork();
+    net->AllocateAllMatrices({}, {}, loss);
+    net->StartEvaluateMinibatchLoop(loss);
+    return net;
+}
+
+static Matrix<double>& ValueOf(ComputationNetworkPtr net, const wchar_t* name)
+{
+    return net->GetNodeFromName(name)->As<ComputationNode<double>>()->Value();
+}
+
+// A minibatch: sequences (with gaps) of S parallel sequences and T steps, and random input and output gradient.
+struct RecurrentMinibatch
+{
+    size_t S, T;
+    std::vector<MBLayout::SequenceInfo> sequences;
+    Matrix<double> x, dh;
+
+    RecurrentMinibatch(size_t S, size_t T, const std::vector<MBLayout::SequenceInfo>& sequences, unsigned long seed)
+        : S(S), T(T), sequences(sequences),
+          x(Matrix<double>::RandomUniform(D, S * T, CPUDEVICE, -1, 1, seed)),
+          dh(Matrix<double>::RandomUniform(H, S * T, CPUDEVICE, -1, 1, seed + 1))
+    {
+    }
+};
+
+static double ForwardProp(ComputationNetworkPtr net, const RecurrentMinibatch& minibatch)
+{
+    auto layout = net->GetMBLayoutPtr();
+    layout->Init(minibatch.S, minibatch.T);
+    for (const auto& seq : minibatch.sequences)
+    {
+        if (seq.seqId == GAP_SEQUENCE_ID)
+            layout->AddGap(seq.s, seq.tBegin, seq.tEnd);
+        else
+            layout->AddSequence(seq);
+    }
+    for (const auto& name : {L"x", L"dh"})
+    {
+        auto input = net->GetNodeFromName(name);
+        ValueOf(net, name).SetValue(name == std::wstring(L"x") ? minibatch.x : minibatch.dh);
+        input->NotifyFunctionValuesMBSizeModified();
+        input->BumpEvalTimeStamp();
+    }
+    for (const auto& name : {L"W", L"R", L"b", L"p"})
+        if (net->NodeNameExists(name))
+            net->GetNodeFromName(name)->BumpEvalTimeStamp();
+
+    auto loss = net->GetNodeFromName(L"loss");
+    net->ForwardProp(loss);
+    return ValueOf(net, L"loss")(0, 0);
+}
+
+static void CheckRecurrentCell(bool lstm)
+{
+    auto net = CreateRecurrentCell(lstm);
+
+    // The first minibatch leaves a sequence (id 3) to be continued in parallel sequence 2 of the second one.
+    RecurrentMinibatch first(3, 4, {{0, 0, 0, 4}, {GAP_SEQUENCE_ID, 1, 0, 1}, {1, 1, 1, 4}, {3, 2, 0, 6}}, 10);
+
+    // The second one has a sequence that starts and continues into the next minibatch (0), a gap between two
+    // sequences (1), and the carried-over sequence followed by a gap (2). It exercises all kinds of columns.
+    RecurrentMinibatch second(3, 5, {{4, 0, 0, 7}, {5, 1, 0, 2}, {GAP_SEQUENCE_ID, 1, 2, 3}, {6, 1, 3, 5}, {3, 2, -4, 2}, {GAP_SEQUENCE_ID, 2, 2, 5}}, 20);
+
+    ForwardProp(net, first);
+    Matrix<double> firstOutput(CPUDEVICE);
+    firstOutput.SetValue(ValueOf(net, L"h"));
+    ForwardProp(net, second);
+    Matrix<double> secondOutput(CPUDEVICE);
+    secondOutput.SetValue(ValueOf(net, L"h"));
+
+    // the carried-over state continues the sequence exactly as if it had not been split
+    RecurrentMinibatch whole(1, 6, {{7, 0, 0, 6}}, 30);
+    for (size_t t = 0; t < 6; t++)
+        whole.x.ColumnSlice(t, 1).SetValue(t < 4 ? first.x.ColumnSlice(t * 3 + 2, 1) : second.x.ColumnSlice((t - 4) * 3 + 2, 1));
+    ForwardProp(net, whole);
+    const auto& wholeOutput = ValueOf(net, L"h");
+    for (size_t t = 0; t < 6; t++)
+    {
+        const auto& output = t < 4 ? firstOutput : secondOutput;
+        size_t column = t < 4 ? t * 3 + 2 : (t - 4) * 3 + 2;
+        for (size_t i = 0; i < H; i++)
+            BOOST_CHECK_CLOSE(output(i, column), wholeOutput(i, t), 1e-10);
+    }
+
+    // Gradients of the second minibatch, against finite differences. The state carried over from the first
+    // minibatch is a constant (truncated BPTT), so the first minibatch is run with the unperturbed parameters.
+    ForwardProp(net, first);
+    ForwardProp(net, second);
+    auto loss = net->GetNodeFromName(L"loss");
+    for (const auto& name : {L"W", L"R", L"b", L"p"})
+        if (net->NodeNameExists(name))
+            net->GetNodeFromName(name)->As<ComputationNode<double>>()->Gradient().SetValue(0);
+    net->Backprop(loss);
+
+    auto secondLoss = [&](const wchar_t* name, size_t i, size_t j, double delta)
+    {
+        auto& value = ValueOf(net, name);
+        double original = value(i, j);
+        ForwardProp(net, first);
+        value(i, j) = original + delta;
+        double result = ForwardProp(net, second);
+        value(i, j) = original;
+        return result;
+    };
+    const double eps = 1e-6;
+    for (const auto& name : {L"W", L"R", L"b", L"p"})
+    {
+        if (!net->NodeNameExists(name))
+            continue;
+        Matrix<double> gradient(CPUDEVICE);
+        gradient.SetValue(net->GetNodeFromName(name)->As<ComputationNode<double>>()->Gradient());
+        for (size_t j = 0; j < gradient.GetNumCols(); j++)
+            for (size_t i = 0; i < gradient.GetNumRows(); i++)
+            {
+                double expected = (secondLoss(name, i, j, eps) - secondLoss(name, i, j, -eps)) / (2 * eps);
+                BOOST_CHECK_MESSAGE(fabs(gradient(i, j) - expected) < 1e-6 * max(1.0, fabs(expected)),
+                                    "gradient of " << msra::strfun::utf8(name) << "(" << i << ", " << j << "): " << gradient(i, j) << " instead of " << expected);
+            }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(LSTMNodeGapsAndCarryOver)
+{
+    CheckRecurrentCell(true);
+}
+
+BOOST_AUTO_TEST_CASE(GRUNodeGapsAndCarryOver)
+{
+    CheckRecurrentCell(false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
@@ -0,0 +1,168 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#include "stdafx.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetwork.h"
+#include "../../../Source/ComputationNetworkLib/ComputationNetworkBuilder.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(TrainingNodeSuite)
+
+const size_t D = 3; // input dimension
+const size_t H = 4; // hidden dimension
+const size_t C = 3; // number of classes
+const size_t classBegin[C + 1] = {0, 2, 5, 7}; // words of class c are [classBegin[c], classBegin[c + 1])
+
+// x [D] -> h = Wh x [H], cls = Wc x [C] -> ClassCrossEntropyWithSoftmax(labels [4], h, E [H x V], cls)
+static ComputationNetworkPtr CreateClassBasedCrossEntropy()
+{
+    auto net = make_shared<ComputationNetwork>(CPUDEVICE);
+    ComputationNetworkBuilder<double> builder(*net);
+    auto x = builder.CreateInputNode(L"x", D);
+    auto labels = builder.CreateInputNode(L"labels", 4);
+    auto Wh = builder.CreateLearnableParameter(L"Wh", H, D);
+    auto Wc = builder.CreateLearnableParameter(L"Wc", C, D);
+    auto E = builder.CreateLearnableParameter(L"E", H, classBegin[C]);
+    auto h = builder.Times(Wh, x, L"h");
+    auto cls = builder.Times(Wc, x, L"cls");
+    ComputationNodeBasePtr ce = builder.ClassCrossEntropyWithSoftmax(labels, h, E, cls, L"ce");
+    net->InitLearnableParameters<double>(Wh, true, 1, 1);
+    net->InitLearnableParameters<double>(Wc, true, 2, 1);
+    net->InitLearnableParameters<double>(E, true, 3, 1);
+    net->FeatureNodes().push_back(x);
+    net->LabelNodes().push_back(labels);
+    net->FinalCriterionNodes().push_back(ce);
+    net->CompileNetwork();
+    net->AllocateAllMatrices({}, {}, ce);
+    net->StartEvaluateMinibatchLoop(ce);
+    return net;
+}
+
+static Matrix<double>& ValueOf(ComputationNetworkPtr net, const wchar_t* name)
+{
+    return net->GetNodeFromName(name)->As<ComputationNode<double>>()->Value();
+}
+
+// 2 parallel sequences of 5 steps, the second one ending early; the frames' classes are interleaved
+const size_t S = 2, T = 5;
+const size_t words[S * T] = {3, 0, 6, 2, 1, 4, 5, 1, 4, SIZE_MAX}; // column t * S + s
+
+static double ForwardProp(ComputationNetworkPtr net, const Matrix<double>& x)
+{
+    auto layout = net->GetMBLayoutPtr();
+    layout->Init(S, T);
+    layout->AddSequence(0, 0, 0, T);
+    layout->AddSequence(1, 1, 0, T - 1);
+    layout->AddGap(1, T - 1, T);
+
+    Matrix<double> labels(4, S * T, CPUDEVICE);
+    labels.SetValue(0);
+    for (size_t j = 0; j < S * T; j++)
+    {
+        if (words[j] == SIZE_MAX)
+            continue;
+        size_t c = 0;
+        while (words[j] >= classBegin[c + 1])
+            c++;
+        labels(0, j) = (double) words[j];
+        labels(1, j) = (double) c;
+        labels(2, j) = (double) classBegin[c];
+        labels(3, j) = (double) classBegin[c + 1];
+    }
+    ValueOf(net, L"x").SetValue(x);
+    ValueOf(net, L"labels").SetValue(labels);
+    for (const auto& name : {L"x", L"labels"})
+    {
+        net->GetNodeFromName(name)->NotifyFunctionValuesMBSizeModified();
+        net->GetNodeFromName(name)->BumpEvalTimeStamp();
+    }
+    for (const auto& name : {L"Wh", L"Wc", L"E"})
+        net->GetNodeFromName(name)->BumpEvalTimeStamp();
+
+    auto ce = net->GetNodeFromName(L"ce");
+    net->ForwardProp(ce);
+    return ValueOf(net, L"ce")(0, 0);
+}
+
+// the objective computed frame by frame, as the node did before it grouped the frames by class
+static double UngroupedObjective(ComputationNetworkPtr net, const Matrix<double>& x)
+{
+    const auto& Wh = ValueOf(net, L"Wh");
+    const auto& Wc = ValueOf(net, L"Wc");
+    const auto& E = ValueOf(net, L"E");
+    double objective = 0;
+    for (size_t j = 0; j < S * T; j++)
+    {
+        if (words[j] == SIZE_MAX)
+            continue;
+        std::vector<double> h(H, 0), cls(C, 0);
+        for (size_t k = 0; k < D; k++)
+        {
+            for (size_t i = 0; i < H; i++)
+                h[i] += Wh(i, k) * x(k, j);
+            for (size_t i = 0; i < C; i++)
+                cls[i] += Wc(i, k) * x(k, j);
+        }
+        size_t c = 0;
+        while (words[j] >= classBegin[c + 1])
+            c++;
+        double logSumCls = 0;
+        for (size_t i = 0; i < C; i++)
+            logSumCls += exp(cls[i]);
+        double logSumWords = 0, targetWord = 0;
+        for (size_t w = classBegin[c]; w < classBegin[c + 1]; w++)
+        {
+            double z = 0;
+            for (size_t i = 0; i < H; i++)
+                z += E(i, w) * h[i];
+            logSumWords += exp(z);
+            if (w == words[j])
+                targetWord = z;
+        }
+        objective -= targetWord - log(logSumWords) + cls[c] - log(logSumCls);
+    }
+    return objective;
+}
+
+BOOST_AUTO_TEST_CASE(ClassBasedCrossEntropyWithSoftmaxGroupedGradients)
+{
+    auto net = CreateClassBasedCrossEntropy();
+    Matrix<double> x = Matrix<double>::RandomUniform(D, S * T, CPUDEVICE, -1, 1, 10);
+
+    // the grouped objective equals the frame-by-frame one
+    double objective = ForwardProp(net, x);
+    BOOST_CHECK_CLOSE(objective, UngroupedObjective(net, x), 1e-10);
+
+    // the gradients w.r.t. all three inputs (through Wh, E, and Wc) match finite differences of that objective
+    auto ce = net->GetNodeFromName(L"ce");
+    for (const auto& name : {L"Wh", L"Wc", L"E"})
+        net->GetNodeFromName(name)->As<ComputationNode<double>>()->Gradient().SetValue(0);
+    net->Backprop(ce);
+
+    const double eps = 1e-6;
+    for (const auto& name : {L"Wh", L"Wc", L"E"})
+    {
+        Matrix<double> gradient(CPUDEVICE);
+        gradient.SetValue(net->GetNodeFromName(name)->As<ComputationNode<double>>()->Gradient());
+        auto& value = ValueOf(net, name);
+        for (size_t j = 0; j < gradient.GetNumCols(); j++)
+            for (size_t i = 0; i < gradient.GetNumRows(); i++)
+            {
+                double original = value(i, j);
+                value(i, j) = original + eps;
+                double plus = UngroupedObjective(net, x);
+                value(i, j) = original - eps;
+                double minus = UngroupedObjective(net, x);
+                value(i, j) = original;
+                double expected = (plus - minus) / (2 * eps);
+                BOOST_CHECK_MESSAGE(fabs(gradient(i, j) - expected) < 1e-6 * max(1.0, fabs(expected)),
+                                    "gradient of " << msra::strfun::utf8(name) << "(" << i << ", " << j << "): " << gradient(i, j) << " instead of " << expected);
+            }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
@@ -0,0 +1,14 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// stdafx.cpp : source file that includes just the standard includes
+//
+#define BOOST_TEST_MODULE NetworkTests
+#include "stdafx.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK { class MPIWrapper; } } }
+
+// globals that the CNTK executable defines (CNTK.cpp)
+bool g_shareNodeValueMatrices = false;
+Microsoft::MSR::CNTK::MPIWrapper* g_mpi = nullptr;
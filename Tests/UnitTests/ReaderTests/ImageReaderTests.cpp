@@ -0,0 +1,108 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#include "stdafx.h"
+#include <random>
+#include <sstream>
+
+#include "DataReader.h"
+
+using namespace Microsoft::MSR::CNTK;
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(ImageReaderTests)
+
+static const size_t numImages = 12;
+static const size_t minibatchSize = 5;
+static const int width = 8, height = 6, channels = 3;
+
+// Write images of different sizes with random pixels (as binary PPM, which OpenCV always reads), their map file, and
+// a mean image of the scaled size in the format of OpenCV's FileStorage.
+static void WriteImages(const std::string& directory)
+{
+    boost::filesystem::create_directories(directory);
+    std::mt19937 rng(5);
+    std::ofstream mapFile(directory + "/map.txt");
+    for (size_t i = 0; i < numImages; i++)
+    {
+        int rows = 10 + rng() % 15, cols = 10 + rng() % 15;
+        std::string path = directory + "/image" + std::to_string(i) + ".ppm";
+        std::ofstream image(path, std::ios::binary);
+        image << "P6\n" << cols << " " << rows << "\n255\n";
+        for (int k = 0; k < rows * cols * channels; k++)
+            image.put(static_cast<char>(rng() % 256));
+        mapFile << path << "\t" << i % 3 << "\n";
+    }
+
+    std::ofstream mean(directory + "/mean.xml");
+    mean << "<?xml version=\"1.0\"?>\n<opencv_storage>\n<Channel>" << channels << "</Channel>\n<Row>" << height << "</Row>\n<Col>" << width << "</Col>\n"
+         << "<MeanImg type_id=\"opencv-matrix\">\n  <rows>1</rows>\n  <cols>" << width * height * channels << "</cols>\n  <dt>f</dt>\n  <data>\n";
+    for (int k = 0; k < width * height * channels; k++)
+        mean << " " << (rng() % 2560) / 10.0;
+    mean << "</data></MeanImg>\n</opencv_storage>\n";
+}
+
+// all minibatches of an epoch, features and labels
+static std::vector<Matrix<float>> ReadEpoch(const std::string& directory, const std::string& mbFormat, bool mean, bool fuseTransforms)
+{
+    std::ostringstream features;
+    features << "features=[width=" << width << ";height=" << height << ";channels=" << channels << ";mbFormat=" << mbFormat
+             << ";cropType=Random;cropRatio=0.6:0.9;jitterType=UniRatio;hflip=1;interpolations=linear:cubic:nearest";
+    if (mean)
+        features << ";meanFile=" << directory << "/mean.xml";
+    features << "]";
+
+    ConfigParameters config;
+    config.Insert("readerType", "ImageReader");
+    config.Insert("file", directory + "/map.txt");
+    config.Insert("randomize", "none");
+    config.Insert("seed", "3");
+    // (the generators are pooled, so which image gets which one depends on the scheduling of threads)
+    config.Insert("numCPUThreads", "1");
+    config.Insert("fuseTransforms", fuseTransforms ? "true" : "false");
+    config.Insert(features.str());
+    config.Insert("labels=[labelDim=3]");
+    DataReader<float> reader(config);
+
+    Matrix<float> featureMatrix(CPUDEVICE), labelMatrix(CPUDEVICE);
+    std::map<std::wstring, Matrix<float>*> matrices = {{L"features", &featureMatrix}, {L"labels", &labelMatrix}};
+    std::vector<Matrix<float>> result;
+    reader.StartMinibatchLoop(minibatchSize, 0, numImages);
+    while (reader.GetMinibatch(matrices))
+    {
+        for (const auto& matrix : {&featureMatrix, &labelMatrix})
+        {
+            result.push_back(Matrix<float>(CPUDEVICE));
+            result.back().SetValue(*matrix);
+        }
+    }
+    return result;
+}
+
+// The fused stage draws the same crops, flips and interpolations as the separate transformers for a given seed,
+// and produces the same images, in both layouts, with and without mean subtraction.
+BOOST_AUTO_TEST_CASE(FusedTransformsMatchSeparateOnes)
+{
+    const std::string directory = "ImageReaderFused";
+    WriteImages(directory);
+    for (const auto& mbFormat : {"nchw", "nhwc"})
+    {
+        for (bool mean : {true, false})
+        {
+            auto separate = ReadEpoch(directory, mbFormat, mean, false);
+            auto fused = ReadEpoch(directory, mbFormat, mean, true);
+            BOOST_REQUIRE_EQUAL(fused.size(), separate.size());
+            BOOST_CHECK_EQUAL(separate.size(), 2 * ((numImages + minibatchSize - 1) / minibatchSize));
+            for (size_t i = 0; i < separate.size(); i++)
+                BOOST_CHECK_MESSAGE(fused[i].IsEqualTo(separate[i], 0), "matrix " << i << " differs for " << mbFormat << (mean ? " with" : " without") << " mean");
+        }
+    }
+    boost::filesystem::remove_all(directory);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
@@ -0,0 +1,138 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#include "stdafx.h"
+#include <random>
+#include <sstream>
+
+#include "Basics.h"
+#include "fileutil.h"
+#include "latticearchive.h"
+
+using namespace msra::lattices;
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+BOOST_AUTO_TEST_SUITE(LatticeArchiveTests)
+
+static const char* const latticeUnits[] = {"sil", "sp", "a", "b", "c"};
+
+// Write an HTK lattice of nodes 1 to 3 frames apart, each one reached from its 1 to 3 predecessors. Each edge is
+// aligned to a few units; most of the word edges end in /sp/, so that the archive stores some of it implied.
+static void WriteHTKLattice(const std::wstring& path, std::mt19937& rng, size_t numNodes)
+{
+    std::vector<size_t> t(1, 0);
+    while (t.size() < numNodes)
+        t.push_back(t.back() + 1 + rng() % 3);
+    std::ostringstream edges;
+    size_t numEdges = 0;
+    for (size_t E = 1; E < numNodes; E++)
+    {
+        for (size_t S = E >= 3 ? E - 3 : 0; S < E; S++)
+        {
+            edges << "J=" << numEdges++ << " S=" << S << " E=" << E << " a=" << -(double) (rng() % 1000) / 10 << " l=" << -(double) (rng() % 100) / 10 << " d=:";
+            size_t frames = t[E] - t[S];
+            bool sp = frames > 1 && rng() % 4 != 0;
+            if (sp)
+                frames--;
+            while (frames > 0)
+            {
+                size_t duration = std::min(frames, (size_t) 1 + rng() % 3);
+                edges << latticeUnits[rng() % 2 ? 0 : 2 + rng() % 3] << "," << duration * 0.01 << ":";
+                frames -= duration;
+            }
+            if (sp)
+                edges << "sp,0.01:";
+            edges << "\n";
+        }
+    }
+    auto_file_ptr f(fopenOrDie(path, L"wb"));
+    fprintfOrDie(f, "N=%d L=%d\n", (int) numNodes, (int) numEdges);
+    for (size_t i = 0; i < numNodes; i++)
+        fprintfOrDie(f, "I=%d t=%.2f\n", (int) i, t[i] * 0.01);
+    fprintfOrDie(f, "%s", edges.str().c_str());
+}
+
+// the lattice in HTK-like text format, with the unit names of a symbol table
+static std::string DumpLattice(const lattice& L, const std::unordered_map<std::string, size_t>& symMap)
+{
+    std::vector<const char*> names(symMap.size());
+    for (const auto& unit : symMap)
+        names[unit.second] = unit.first.c_str();
+    const std::wstring path = L"LatticeArchive.dump";
+    {
+        auto_file_ptr f(fopenOrDie(path, L"wb"));
+        L.dump(f, [&](size_t unit)
+               {
+                   return names[unit];
+               });
+    }
+    std::ifstream file("LatticeArchive.dump", std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    std::remove("LatticeArchive.dump");
+    return text;
+}
+
+// V2 archive and TOC (as archive::build() writes them), converted to a mapped archive; both must give the same lattices
+BOOST_AUTO_TEST_CASE(MappedLatticeArchiveRoundTrip)
+{
+    const std::unordered_map<std::string, size_t> symMap = {{"sil", 0}, {"sp", 1}, {"a", 2}, {"b", 3}, {"c", 4}};
+    const size_t numLattices = 20;
+    std::vector<std::wstring> keys;
+    {
+        // the TOC refers to the archive by a relative path, which is resolved with prefixPathInToc
+        std::mt19937 rng(7);
+        msra::files::make_intermediate_dirs(L"LatticeArchive/lattices.lats");
+        auto_file_ptr f(fopenOrDie(L"LatticeArchive/lattices.lats", L"wb"));
+        auto_file_ptr toc(fopenOrDie(L"LatticeArchive.toc", L"wb"));
+        for (size_t i = 0; i < numLattices; i++)
+        {
+            keys.push_back(msra::strfun::wstrprintf(L"utt%03d", (int) (numLattices - 1 - i))); // (not in key order)
+            WriteHTKLattice(L"LatticeArchive.lat", rng, 20 + rng() % 30);
+            lattice L;
+            L.fromhtklattice(L"LatticeArchive.lat", symMap);
+            uint64_t offset = fgetpos(f);
+            L.fwrite(f);
+            fprintfOrDie(toc, "%s=%s[%llu]\n", msra::strfun::utf8(keys.back()).c_str(), i == 0 ? "lattices.lats" : "", (unsigned long long) offset);
+        }
+        auto_file_ptr symList(fopenOrDie(L"LatticeArchive/lattices.lats.symlist", L"wb"));
+        fprintfOrDie(symList, "sil\nsp\na\nb\nc\n");
+    }
+    std::remove("LatticeArchive.lat");
+    const std::vector<std::wstring> tocPaths(1, L"LatticeArchive.toc");
+    const std::vector<std::wstring> mappedPaths(1, L"LatticeArchive.latx");
+    archive::writemapped(tocPaths, mappedPaths[0], symMap, L"LatticeArchive");
+    BOOST_CHECK(!fexists(L"LatticeArchive.latx.tmp"));
+
+    // also with a model whose symbol table has another order, for which the units are mapped when reading
+    const std::unordered_map<std::string, size_t> otherSymMap = {{"c", 0}, {"b", 1}, {"sil", 2}, {"sp", 3}, {"a", 4}};
+    for (const auto& modelSymMap : {symMap, otherSymMap})
+    {
+        archive fromToc(tocPaths, modelSymMap, L"LatticeArchive");
+        archive fromMapped(mappedPaths, modelSymMap);
+        BOOST_CHECK_EQUAL(fromMapped.numlattices(), numLattices);
+        BOOST_CHECK(!fromMapped.haslattice(L"utt999"));
+        for (const auto& key : keys)
+        {
+            BOOST_REQUIRE(fromMapped.haslattice(key));
+            lattice expected, L;
+            fromToc.getlattice(key, expected);
+            fromMapped.getlattice(key, L, expected.getnumframes());
+            BOOST_CHECK_EQUAL(L.getnumframes(), expected.getnumframes());
+            BOOST_CHECK_EQUAL(L.getnumnodes(), expected.getnumnodes());
+            BOOST_CHECK_EQUAL(L.getnumedges(), expected.getnumedges());
+            BOOST_CHECK(DumpLattice(L, modelSymMap) == DumpLattice(expected, modelSymMap));
+        }
+    }
+
+    boost::filesystem::remove_all("LatticeArchive");
+    for (const char* path : {"LatticeArchive.toc", "LatticeArchive.latx", "LatticeArchive.latx.symlist"})
+        std::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
@@ -4,9 +4,21 @@
 //
 
 #include "stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <set>
+#include <thread>
 
 #include "BlockRandomizer.h"
+#include "ChunkedBinaryDeserializer.h"
 #include "DataDeserializer.h"
+#include "ImagePackFile.h"
+#include "ReaderShim.h"
+#include "SequencePacker.h"
+#include "HeapMemoryProvider.h"
 
 using namespace Microsoft::MSR::CNTK;
 
@@ -44,6 +56,1079 @@ BOOST_AUTO_TEST_CASE(BlockRandomizerInstantiate)
     auto randomizer = std::make_shared<BlockRandomizer>(0, SIZE_MAX, mockDeserializer);
 }
 
+// Reader that returns numMinibatches minibatches of minibatchSize samples, each filled with the index of its minibatch.
+// Like the packers, it reuses its buffer, so the data is only valid until the next ReadMinibatch() call.
+class MockReader : public Reader
+{
+public:
+    static const size_t numMinibatches = 10;
+    static const size_t minibatchSize = 3;
+    static const size_t sampleDim = 2;
+
+    MockReader()
+        : m_buffer(minibatchSize * sampleDim), m_layout(std::make_shared<MBLayout>()), m_next(0)
+    {
+        auto stream = std::make_shared<StreamDescription>();
+        stream->m_name = L"features";
+        stream->m_id = 0;
+        stream->m_storageType = StorageType::dense;
+        stream->m_elementType = ElementType::tfloat;
+        stream->m_sampleLayout = std::make_shared<TensorShape>(sampleDim);
+        m_streams.push_back(stream);
+    }
+
+    std::vector<StreamDescriptionPtr> GetStreamDescriptions() override
+    {
+        return m_streams;
+    }
+
+    void StartEpoch(const EpochConfiguration&) override
+    {
+        m_next = 0;
+    }
+
+    Minibatch ReadMinibatch() override
+    {
+        Minibatch minibatch;
+        minibatch.m_endOfEpoch = m_next + 1 >= numMinibatches;
+        if (m_next >= numMinibatches)
+        {
+            return minibatch;
+        }
+
+        std::fill(m_buffer.begin(), m_buffer.end(), (float) m_next++);
+        m_layout->InitAsFrameMode(minibatchSize);
+        auto stream = std::make_shared<StreamMinibatch>();
+        stream->m_data = m_buffer.data();
+        stream->m_dataSize = m_buffer.size() * sizeof(float);
+        stream->m_layout = m_layout;
+        minibatch.m_data.push_back(stream);
+        return minibatch;
+    }
+
+private:
+    std::vector<StreamDescriptionPtr> m_streams;
+    std::vector<float> m_buffer;
+    MBLayoutPtr m_layout;
+    size_t m_next;
+};
+
+static ReaderPtr CreateMockReader(const ConfigParameters&)
+{
+    return std::make_shared<MockReader>();
+}
+
+BOOST_AUTO_TEST_CASE(ReaderShimPrefetch)
+{
+    const size_t numMinibatches = MockReader::numMinibatches;
+    const size_t minibatchSize = MockReader::minibatchSize;
+    const size_t sampleDim = MockReader::sampleDim;
+
+    for (size_t prefetchDepth : {0, 1, 4})
+    {
+        ConfigParameters config;
+        config.Insert("prefetch", prefetchDepth > 0 ? "true" : "false");
+        config.Insert("prefetchDepth", std::to_string(prefetchDepth));
+
+        // ReaderShim is destroyed through Destroy()
+        auto reader = new ReaderShim<float>(CreateMockReader);
+        reader->Init(config);
+
+        Matrix<float> features(CPUDEVICE);
+        std::map<std::wstring, Matrix<float>*> matrices;
+        matrices[L"features"] = &features;
+
+        // second epoch is cut short, which must discard the minibatches read ahead
+        for (size_t epoch = 0; epoch < 3; epoch++)
+        {
+            reader->StartMinibatchLoop(minibatchSize, epoch, requestDataSize);
+            size_t numMinibatchesToRead = epoch == 1 ? 2 : numMinibatches;
+            for (size_t i = 0; i < numMinibatchesToRead; i++)
+            {
+                BOOST_REQUIRE(reader->GetMinibatch(matrices));
+                BOOST_REQUIRE_EQUAL(features.GetNumRows(), sampleDim);
+                BOOST_REQUIRE_EQUAL(features.GetNumCols(), minibatchSize);
+                for (size_t j = 0; j < features.GetNumCols(); j++)
+                {
+                    BOOST_CHECK_EQUAL(features(0, j), (float) i);
+                    BOOST_CHECK_EQUAL(features(1, j), (float) i);
+                }
+                BOOST_CHECK_EQUAL(reader->GetNumParallelSequences(), minibatchSize);
+            }
+            if (epoch != 1)
+            {
+                BOOST_CHECK(!reader->GetMinibatch(matrices));
+                BOOST_CHECK_EQUAL(reader->GetPrefetchStatistics().m_numMinibatches, numMinibatches);
+            }
+        }
+        reader->Destroy();
+    }
+}
+
+// Transformer that returns sequences of the given lengths, with a dense stream of dimension 1 and a sparse stream of
+// dimension sparseDim. Sample k of sequence i has the value i * 100 + k, which the sparse stream stores in row k % sparseDim.
+// The buffers are reused, so the data is only valid until the next GetNextSequences() call.
+class MockSequenceTransformer : public Transformer
+{
+public:
+    static const size_t sparseDim = 4;
+
+    MockSequenceTransformer(const std::vector<size_t>& sequenceLengths)
+        : m_sequenceLengths(sequenceLengths), m_next(0)
+    {
+        auto dense = std::make_shared<StreamDescription>();
+        dense->m_name = L"features";
+        dense->m_id = 0;
+        dense->m_storageType = StorageType::dense;
+        dense->m_elementType = ElementType::tfloat;
+        dense->m_sampleLayout = std::make_shared<TensorShape>(1);
+        m_streams.push_back(dense);
+
+        auto sparse = std::make_shared<StreamDescription>(*dense);
+        sparse->m_name = L"labels";
+        sparse->m_id = 1;
+        sparse->m_storageType = StorageType::sparse_csc;
+        sparse->m_sampleLayout = std::make_shared<TensorShape>(sparseDim);
+        m_streams.push_back(sparse);
+    }
+
+    void Initialize(TransformerPtr, const ConfigParameters&) override
+    {
+    }
+
+    std::vector<StreamDescriptionPtr> GetStreamDescriptions() const override
+    {
+        return m_streams;
+    }
+
+    void StartEpoch(const EpochConfiguration&) override
+    {
+        m_next = 0;
+    }
+
+    // whole sequences up to sampleCount samples, but at least one
+    Sequences GetNextSequences(size_t sampleCount) override
+    {
+        Sequences result;
+        size_t numSamples = 0;
+        size_t end = m_next;
+        while (end < m_sequenceLengths.size() && (end == m_next || numSamples + m_sequenceLengths[end] <= sampleCount))
+        {
+            numSamples += m_sequenceLengths[end++];
+        }
+
+        m_values.assign(numSamples, 0);
+        m_values.shrink_to_fit();
+        float* values = m_values.data();
+        for (; m_next < end; m_next++)
+        {
+            size_t length = m_sequenceLengths[m_next];
+            auto dense = std::make_shared<DenseSequenceData>();
+            auto sparse = std::make_shared<SparseSequenceData>();
+            dense->m_data = sparse->m_data = values;
+            dense->m_numberOfSamples = length;
+            dense->m_sampleLayout = m_streams[0]->m_sampleLayout;
+            for (size_t k = 0; k < length; k++)
+            {
+                *values++ = (float) (m_next * 100 + k);
+                sparse->m_indices.push_back(std::vector<size_t>(1, k % sparseDim));
+            }
+            result.m_data.push_back(std::vector<SequenceDataPtr>{ dense, sparse });
+        }
+        result.m_endOfEpoch = m_next == m_sequenceLengths.size();
+        return result;
+    }
+
+private:
+    std::vector<StreamDescriptionPtr> m_streams;
+    std::vector<size_t> m_sequenceLengths;
+    std::vector<float> m_values;
+    size_t m_next;
+};
+
+// Checks the packed streams of a minibatch of MockSequenceTransformer sequences against its layout;
+// returns the number of samples of each sequence found in it.
+static std::map<size_t, size_t> CheckPackedSequences(const Minibatch& minibatch)
+{
+    const size_t sparseDim = MockSequenceTransformer::sparseDim;
+    BOOST_REQUIRE_EQUAL(minibatch.m_data.size(), 2);
+    const auto& layout = minibatch.m_data[0]->m_layout;
+    const size_t numParallelSequences = layout->GetNumParallelSequences();
+    const size_t numCols = layout->GetNumCols();
+    BOOST_REQUIRE_EQUAL(minibatch.m_data[0]->m_dataSize, numCols * sizeof(float));
+
+    // sparse stream: values, row indices and column starts
+    const size_t sparseSize = minibatch.m_data[1]->m_dataSize;
+    const size_t numNonZeros = (sparseSize - (numCols + 1) * sizeof(int32_t)) / (sizeof(float) + sizeof(int32_t));
+    BOOST_REQUIRE_EQUAL(numNonZeros * (sizeof(float) + sizeof(int32_t)) + (numCols + 1) * sizeof(int32_t), sparseSize);
+    const float* dense = reinterpret_cast<const float*>(minibatch.m_data[0]->m_data);
+    const float* sparseValues = reinterpret_cast<const float*>(minibatch.m_data[1]->m_data);
+    const int32_t* rowIndices = reinterpret_cast<const int32_t*>(sparseValues + numNonZeros);
+    const int32_t* columnStarts = rowIndices + numNonZeros;
+    BOOST_CHECK_EQUAL(columnStarts[0], 0);
+    BOOST_CHECK_EQUAL(columnStarts[numCols], (int32_t) numNonZeros);
+
+    std::vector<bool> isData(numCols, false);
+    std::map<size_t, size_t> numSamples;
+    for (const auto& sequence : layout->GetAllSequences())
+    {
+        if (sequence.seqId == GAP_SEQUENCE_ID)
+        {
+            continue;
+        }
+        size_t tBegin = (size_t) std::max(sequence.tBegin, (ptrdiff_t) 0);
+        size_t tEnd = std::min(sequence.tEnd, layout->GetNumTimeSteps());
+        for (size_t t = tBegin; t < tEnd; t++)
+        {
+            size_t column = t * numParallelSequences + sequence.s;
+            size_t sampleIndex = t - sequence.tBegin;
+            float expected = (float) (sequence.seqId * 100 + sampleIndex);
+            BOOST_CHECK_EQUAL(dense[column], expected);
+            BOOST_REQUIRE_EQUAL(columnStarts[column + 1] - columnStarts[column], 1);
+            BOOST_CHECK_EQUAL(sparseValues[columnStarts[column]], expected);
+            BOOST_CHECK_EQUAL(rowIndices[columnStarts[column]], (int32_t) (sampleIndex % sparseDim));
+            isData[column] = true;
+        }
+        numSamples[sequence.seqId] += tEnd - tBegin;
+    }
+
+    for (size_t column = 0; column < numCols; column++)
+    {
+        if (!isData[column])
+        {
+            BOOST_CHECK_EQUAL(dense[column], 0.0f);
+            BOOST_CHECK_EQUAL(columnStarts[column + 1], columnStarts[column]);
+        }
+    }
+    return numSamples;
+}
+
+BOOST_AUTO_TEST_CASE(SequencePackerWholeSequences)
+{
+    std::vector<size_t> lengths = { 5, 3, 2, 4, 1, 7, 6 };
+    auto transformer = std::make_shared<MockSequenceTransformer>(lengths);
+    SequencePacker packer(std::make_shared<HeapMemoryProvider>(), transformer, 15, transformer->GetStreamDescriptions());
+
+    // the first 5 sequences (15 samples) fit into 3 parallel sequences of the length of the longest one, without gaps
+    auto minibatch = packer.ReadMinibatch();
+    BOOST_CHECK(!minibatch.m_endOfEpoch);
+    BOOST_REQUIRE_EQUAL(minibatch.m_data.size(), 2);
+    BOOST_CHECK_EQUAL(minibatch.m_data[0]->m_layout->GetNumTimeSteps(), 5);
+    BOOST_CHECK_EQUAL(minibatch.m_data[0]->m_layout->GetNumParallelSequences(), 3);
+    auto numSamples = CheckPackedSequences(minibatch);
+    BOOST_CHECK_EQUAL(numSamples.size(), 5);
+    for (const auto& sequence : numSamples)
+    {
+        BOOST_CHECK_EQUAL(sequence.second, lengths[sequence.first]);
+    }
+    BOOST_CHECK_EQUAL(packer.GetStatistics().m_numGapFrames, 0);
+
+    // the rest do not fit into one parallel sequence
+    minibatch = packer.ReadMinibatch();
+    BOOST_CHECK(minibatch.m_endOfEpoch);
+    BOOST_CHECK_EQUAL(minibatch.m_data[0]->m_layout->GetNumTimeSteps(), 7);
+    BOOST_CHECK_EQUAL(minibatch.m_data[0]->m_layout->GetNumParallelSequences(), 2);
+    numSamples = CheckPackedSequences(minibatch);
+    BOOST_CHECK_EQUAL(numSamples.size(), 2);
+    BOOST_CHECK_EQUAL(numSamples[5], 7);
+    BOOST_CHECK_EQUAL(numSamples[6], 6);
+
+    const auto& statistics = packer.GetStatistics();
+    BOOST_CHECK_EQUAL(statistics.m_numMinibatches, 2);
+    BOOST_CHECK_EQUAL(statistics.m_numSamples, 28);
+    BOOST_CHECK_EQUAL(statistics.m_numGapFrames, 1);
+}
+
+BOOST_AUTO_TEST_CASE(SequencePackerWholeSequencesLimited)
+{
+    std::vector<size_t> lengths = { 5, 3, 2, 4, 1, 7, 6 };
+    auto transformer = std::make_shared<MockSequenceTransformer>(lengths);
+    SequencePacker packer(std::make_shared<HeapMemoryProvider>(), transformer, 15, transformer->GetStreamDescriptions(), 0, 2);
+
+    // with at most 2 parallel sequences, 5 | 4 + 3 leaves no room for 2 and 1 within 7 time steps
+    auto minibatch = packer.ReadMinibatch();
+    BOOST_CHECK_EQUAL(minibatch.m_data[0]->m_layout->GetNumParallelSequences(), 2);
+    BOOST_CHECK_EQUAL(minibatch.m_data[0]->m_layout->GetNumTimeSteps(), 8);
+    auto numSamples = CheckPackedSequences(minibatch);
+    BOOST_CHECK_EQUAL(numSamples.size(), 5);
+    for (const auto& sequence : numSamples)
+    {
+        BOOST_CHECK_EQUAL(sequence.second, lengths[sequence.first]);
+    }
+    BOOST_CHECK_EQUAL(packer.GetStatistics().m_numGapFrames, 1);
+
+    minibatch = packer.ReadMinibatch();
+    BOOST_CHECK(minibatch.m_endOfEpoch);
+    BOOST_CHECK_EQUAL(minibatch.m_data[0]->m_layout->GetNumParallelSequences(), 2);
+    BOOST_CHECK_EQUAL(CheckPackedSequences(minibatch).size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(SequencePackerTruncated)
+{
+    std::vector<size_t> lengths = { 5, 3, 2, 4, 1, 7, 6, 9 };
+    const size_t totalSamples = 37;
+    const size_t truncationLength = 4;
+    const size_t numParallelSequences = 3;
+
+    auto transformer = std::make_shared<MockSequenceTransformer>(lengths);
+    SequencePacker packer(std::make_shared<HeapMemoryProvider>(), transformer, 0, transformer->GetStreamDescriptions(),
+                          truncationLength, numParallelSequences);
+
+    // every sample must be returned exactly once, in order within its sequence
+    std::map<size_t, size_t> numSamples;
+    for (size_t i = 0; i < 100; i++)
+    {
+        auto minibatch = packer.ReadMinibatch();
+        if (!minibatch.m_data.empty())
+        {
+            const auto& layout = minibatch.m_data[0]->m_layout;
+            BOOST_CHECK_EQUAL(layout->GetNumTimeSteps(), truncationLength);
+            BOOST_CHECK_EQUAL(layout->GetNumParallelSequences(), numParallelSequences);
+            for (const auto& sequence : layout->GetAllSequences())
+            {
+                if (sequence.seqId != GAP_SEQUENCE_ID)
+                {
+                    BOOST_CHECK_EQUAL(sequence.tBegin + (ptrdiff_t) numSamples[sequence.seqId], std::max(sequence.tBegin, (ptrdiff_t) 0));
+                    BOOST_CHECK_EQUAL(sequence.tEnd - sequence.tBegin, lengths[sequence.seqId]);
+                }
+            }
+            for (const auto& sequence : CheckPackedSequences(minibatch))
+            {
+                numSamples[sequence.first] += sequence.second;
+            }
+        }
+        if (minibatch.m_endOfEpoch)
+        {
+            break;
+        }
+    }
+
+    BOOST_CHECK_EQUAL(numSamples.size(), lengths.size());
+    for (const auto& sequence : numSamples)
+    {
+        BOOST_CHECK_EQUAL(sequence.second, lengths[sequence.first]);
+    }
+    BOOST_CHECK_EQUAL(packer.GetStatistics().m_numSamples, totalSamples);
+    BOOST_CHECK(packer.GetStatistics().GetEfficiency() > 0.75);
+}
+
+// Deserializer with sequences of the given lengths, sequencesPerChunk per chunk. It counts the chunks it loads, and
+// fails to load failingChunkId. The data of a sequence points to its description.
+class MockSequenceDeserializer : public IDataDeserializer
+{
+public:
+    MockSequenceDeserializer(const std::vector<size_t>& sequenceLengths, size_t sequencesPerChunk = 1, size_t failingChunkId = SIZE_MAX)
+        : m_descriptions(sequenceLengths.size()), m_failingChunkId(failingChunkId), m_numChunkLoads(0)
+    {
+        for (size_t i = 0; i < sequenceLengths.size(); i++)
+        {
+            m_descriptions[i] = SequenceDescription{ i, sequenceLengths[i], i / sequencesPerChunk, true };
+            m_sequenceDescriptions.push_back(&m_descriptions[i]);
+        }
+    }
+
+    std::vector<StreamDescriptionPtr> GetStreamDescriptions() const override
+    {
+        return std::vector<StreamDescriptionPtr>();
+    }
+
+    const SequenceDescriptions& GetSequenceDescriptions() const override
+    {
+        return m_sequenceDescriptions;
+    }
+
+    virtual ChunkPtr GetChunk(size_t chunkId) override
+    {
+        if (chunkId == m_failingChunkId)
+        {
+            RuntimeError("MockSequenceDeserializer: Chunk %d cannot be loaded.", (int) chunkId);
+        }
+        m_numChunkLoads++;
+        return std::make_shared<MockChunk>(m_descriptions, chunkId);
+    }
+
+    size_t GetNumChunkLoads() const
+    {
+        return m_numChunkLoads;
+    }
+
+private:
+    class MockChunk : public Chunk
+    {
+    public:
+        MockChunk(std::vector<SequenceDescription>& descriptions, size_t chunkId)
+            : m_descriptions(descriptions), m_chunkId(chunkId)
+        {
+        }
+
+        std::vector<SequenceDataPtr> GetSequence(const size_t& sequenceId) override
+        {
+            BOOST_REQUIRE_EQUAL(m_descriptions[sequenceId].m_chunkId, m_chunkId);
+            auto data = std::make_shared<DenseSequenceData>();
+            data->m_numberOfSamples = m_descriptions[sequenceId].m_numberOfSamples;
+            data->m_data = &m_descriptions[sequenceId];
+            return std::vector<SequenceDataPtr>(1, data);
+        }
+
+    private:
+        std::vector<SequenceDescription>& m_descriptions;
+        size_t m_chunkId;
+    };
+
+    std::vector<SequenceDescription> m_descriptions;
+    SequenceDescriptions m_sequenceDescriptions;
+    size_t m_failingChunkId;
+    std::atomic<size_t> m_numChunkLoads;
+};
+
+// Deserializer with sequences of the given lengths in chunks of sequencesPerChunk sequences, and a dense stream of
+// dimension 1: sample k of sequence i has the value i * 100 + k.
+class MockSequenceDataDeserializer : public IDataDeserializer
+{
+public:
+    MockSequenceDataDeserializer(const std::vector<size_t>& sequenceLengths, size_t sequencesPerChunk)
+        : m_descriptions(sequenceLengths.size())
+    {
+        auto stream = std::make_shared<StreamDescription>();
+        stream->m_name = L"features";
+        stream->m_id = 0;
+        stream->m_storageType = StorageType::dense;
+        stream->m_elementType = ElementType::tfloat;
+        stream->m_sampleLayout = std::make_shared<TensorShape>(1);
+        m_streams.push_back(stream);
+
+        for (size_t i = 0; i < sequenceLengths.size(); i++)
+        {
+            m_descriptions[i] = SequenceDescription{ i, sequenceLengths[i], i / sequencesPerChunk, true };
+            m_sequenceDescriptions.push_back(&m_descriptions[i]);
+        }
+    }
+
+    std::vector<StreamDescriptionPtr> GetStreamDescriptions() const override
+    {
+        return m_streams;
+    }
+
+    const SequenceDescriptions& GetSequenceDescriptions() const override
+    {
+        return m_sequenceDescriptions;
+    }
+
+    virtual ChunkPtr GetChunk(size_t chunkId) override
+    {
+        return std::make_shared<MockChunk>(m_descriptions, chunkId, m_streams[0]->m_sampleLayout);
+    }
+
+private:
+    class MockChunk : public Chunk, public std::enable_shared_from_this<MockChunk>
+    {
+    public:
+        MockChunk(const std::vector<SequenceDescription>& descriptions, size_t chunkId, const TensorShapePtr& sampleLayout)
+            : m_sampleLayout(sampleLayout)
+        {
+            for (const auto& description : descriptions)
+            {
+                if (description.m_chunkId == chunkId)
+                {
+                    auto& values = m_values[description.m_id];
+                    for (size_t k = 0; k < description.m_numberOfSamples; k++)
+                    {
+                        values.push_back((float) (description.m_id * 100 + k));
+                    }
+                }
+            }
+        }
+
+        std::vector<SequenceDataPtr> GetSequence(const size_t& sequenceId) override
+        {
+            BOOST_REQUIRE(m_values.find(sequenceId) != m_values.end());
+            auto data = std::make_shared<DenseSequenceData>();
+            data->m_numberOfSamples = m_values[sequenceId].size();
+            data->m_data = m_values[sequenceId].data();
+            data->m_sampleLayout = m_sampleLayout;
+            data->m_chunk = shared_from_this();
+            return std::vector<SequenceDataPtr>(1, data);
+        }
+
+    private:
+        std::map<size_t, std::vector<float>> m_values;
+        TensorShapePtr m_sampleLayout;
+    };
+
+    std::vector<StreamDescriptionPtr> m_streams;
+    std::vector<SequenceDescription> m_descriptions;
+    SequenceDescriptions m_sequenceDescriptions;
+};
+
+// Truncated BPTT from the deserializer through the randomizer to the packer: each sequence must continue in the same
+// parallel sequence of the next minibatch, until all of its samples have been returned in order.
+BOOST_AUTO_TEST_CASE(SequencePackerTruncatedEndToEnd)
+{
+    std::vector<size_t> lengths = { 5, 3, 2, 4, 1, 7, 6, 9, 2, 8, 11, 3 };
+    const size_t totalSamples = 61;
+    const size_t truncationLength = 4;
+    const size_t numParallelSequences = 3;
+
+    auto randomizer = std::make_shared<BlockRandomizer>(0, SIZE_MAX, std::make_shared<MockSequenceDataDeserializer>(lengths, 2));
+    EpochConfiguration config;
+    config.m_numberOfWorkers = 1;
+    config.m_workerRank = 0;
+    config.m_minibatchSizeInSamples = truncationLength * numParallelSequences;
+    config.m_totalEpochSizeInSamples = requestDataSize;
+    config.m_epochIndex = 0;
+    randomizer->StartEpoch(config);
+    SequencePacker packer(std::make_shared<HeapMemoryProvider>(), randomizer, 0, randomizer->GetStreamDescriptions(),
+                          truncationLength, numParallelSequences);
+
+    std::map<size_t, size_t> numReturned;     // original sequence id -> samples returned so far
+    std::map<size_t, size_t> parallelSequence; // original sequence id -> where it continues
+    bool endOfEpoch = false;
+    for (size_t m = 0; m < 100 && !endOfEpoch; m++)
+    {
+        auto minibatch = packer.ReadMinibatch();
+        endOfEpoch = minibatch.m_endOfEpoch;
+        BOOST_REQUIRE(!minibatch.m_data.empty());
+        const auto& layout = minibatch.m_data[0]->m_layout;
+        BOOST_REQUIRE_EQUAL(layout->GetNumTimeSteps(), truncationLength);
+        BOOST_REQUIRE_EQUAL(layout->GetNumParallelSequences(), numParallelSequences);
+        const float* values = reinterpret_cast<const float*>(minibatch.m_data[0]->m_data);
+
+        for (const auto& sequence : layout->GetAllSequences())
+        {
+            if (sequence.seqId == GAP_SEQUENCE_ID)
+            {
+                continue;
+            }
+            size_t tBegin = (size_t) std::max(sequence.tBegin, (ptrdiff_t) 0);
+            size_t tEnd = std::min(sequence.tEnd, layout->GetNumTimeSteps());
+            size_t id = (size_t) values[tBegin * numParallelSequences + sequence.s] / 100;
+            BOOST_REQUIRE(id < lengths.size());
+            BOOST_CHECK_EQUAL(sequence.tEnd - sequence.tBegin, lengths[id]);
+
+            // a sequence that started earlier continues where it stopped, in the same parallel sequence
+            BOOST_CHECK_EQUAL((ptrdiff_t) tBegin - sequence.tBegin, (ptrdiff_t) numReturned[id]);
+            if (numReturned[id] > 0)
+            {
+                BOOST_CHECK_EQUAL(parallelSequence[id], sequence.s);
+            }
+            for (size_t t = tBegin; t < tEnd; t++)
+            {
+                BOOST_CHECK_EQUAL(values[t * numParallelSequences + sequence.s], (float) (id * 100 + numReturned[id]));
+                numReturned[id]++;
+            }
+            parallelSequence[id] = sequence.s;
+        }
+    }
+
+    BOOST_CHECK(endOfEpoch);
+    BOOST_CHECK_EQUAL(numReturned.size(), lengths.size());
+    for (const auto& sequence : numReturned)
+    {
+        BOOST_CHECK_EQUAL(sequence.second, lengths[sequence.first]);
+    }
+    BOOST_CHECK_EQUAL(packer.GetStatistics().m_numSamples, totalSamples);
+}
+
+BOOST_AUTO_TEST_CASE(BlockRandomizerSequenceMode)
+{
+    std::vector<size_t> lengths = { 5, 3, 2, 4, 1, 7, 6, 9 };
+    const size_t totalSamples = 37;
+    auto randomizer = std::make_shared<BlockRandomizer>(0, SIZE_MAX, std::make_shared<MockSequenceDeserializer>(lengths));
+
+    EpochConfiguration config;
+    config.m_numberOfWorkers = 1;
+    config.m_workerRank = 0;
+    config.m_minibatchSizeInSamples = 8;
+    config.m_totalEpochSizeInSamples = requestDataSize;
+    config.m_epochIndex = 0;
+    randomizer->StartEpoch(config);
+
+    // whole sequences, up to 8 samples unless a single sequence is longer
+    size_t numSamples = 0;
+    for (size_t i = 0; i < lengths.size(); i++)
+    {
+        auto sequences = randomizer->GetNextSequences(8);
+        BOOST_REQUIRE(!sequences.m_data.empty());
+        size_t minibatchSamples = 0;
+        for (const auto& sequence : sequences.m_data)
+        {
+            minibatchSamples += static_cast<const DenseSequenceData&>(*sequence[0]).m_numberOfSamples;
+        }
+        BOOST_CHECK(minibatchSamples <= 8 || sequences.m_data.size() == 1);
+        numSamples += minibatchSamples;
+        if (sequences.m_endOfEpoch)
+        {
+            break;
+        }
+    }
+    BOOST_CHECK_EQUAL(numSamples, totalSamples);
+}
+
+BOOST_AUTO_TEST_CASE(BlockRandomizerChunkCache)
+{
+    const size_t numSequences = 60;
+    const size_t sequencesPerChunk = 6;
+    const size_t numChunks = numSequences / sequencesPerChunk;
+    const size_t minibatchSize = 5;
+
+    for (size_t chunkCacheSize : {32, 1})
+    {
+        auto deserializer = std::make_shared<MockSequenceDeserializer>(std::vector<size_t>(numSequences, 1), sequencesPerChunk);
+        auto randomizer = std::make_shared<BlockRandomizer>(0, 4 * sequencesPerChunk, deserializer);
+
+        ConfigParameters config;
+        config.Insert("chunkCacheSize", std::to_string(chunkCacheSize));
+        config.Insert("chunkPrefetch", chunkCacheSize > 1 ? "true" : "false");
+        randomizer->Initialize(nullptr, config);
+
+        EpochConfiguration epochConfig;
+        epochConfig.m_numberOfWorkers = 1;
+        epochConfig.m_workerRank = 0;
+        epochConfig.m_minibatchSizeInSamples = minibatchSize;
+        epochConfig.m_totalEpochSizeInSamples = requestDataSize;
+        epochConfig.m_epochIndex = 0;
+        randomizer->StartEpoch(epochConfig);
+
+        // every sequence exactly once
+        std::vector<size_t> numReturned(numSequences, 0);
+        for (size_t i = 0; i < numSequences / minibatchSize; i++)
+        {
+            auto sequences = randomizer->GetNextSequences(minibatchSize);
+            BOOST_CHECK_EQUAL(sequences.m_data.size(), minibatchSize);
+            for (const auto& sequence : sequences.m_data)
+            {
+                numReturned[static_cast<const SequenceDescription*>(sequence[0]->m_data)->m_id]++;
+            }
+            BOOST_CHECK_EQUAL(sequences.m_endOfEpoch, i + 1 == numSequences / minibatchSize);
+        }
+        BOOST_CHECK(std::all_of(numReturned.begin(), numReturned.end(), [](size_t n) { return n == 1; }));
+
+        const auto& statistics = randomizer->GetChunkCacheStatistics();
+        BOOST_CHECK_EQUAL(statistics.m_numMisses + statistics.m_numPrefetches, deserializer->GetNumChunkLoads());
+        if (chunkCacheSize == 32)
+        {
+            // chunks are kept as long as the randomization window needs them
+            BOOST_CHECK_EQUAL(deserializer->GetNumChunkLoads(), numChunks);
+            BOOST_CHECK(statistics.m_numHits > statistics.m_numMisses);
+        }
+        else
+        {
+            // the chunks of the current minibatch, plus at most chunkCacheSize others
+            BOOST_CHECK_EQUAL(statistics.m_numPrefetches, 0);
+            BOOST_CHECK(statistics.m_maxNumCachedChunks <= chunkCacheSize + minibatchSize);
+        }
+    }
+}
+
+static std::shared_ptr<BlockRandomizer> CreateChunkCacheRandomizer(IDataDeserializerPtr deserializer, size_t randomizationRange, bool prefetch, size_t minibatchSize)
+{
+    auto randomizer = std::make_shared<BlockRandomizer>(0, randomizationRange, deserializer);
+
+    ConfigParameters config;
+    config.Insert("chunkCacheSize", "32");
+    config.Insert("chunkPrefetch", prefetch ? "true" : "false");
+    randomizer->Initialize(nullptr, config);
+
+    EpochConfiguration epochConfig;
+    epochConfig.m_numberOfWorkers = 1;
+    epochConfig.m_workerRank = 0;
+    epochConfig.m_minibatchSizeInSamples = minibatchSize;
+    epochConfig.m_totalEpochSizeInSamples = requestDataSize;
+    epochConfig.m_epochIndex = 0;
+    randomizer->StartEpoch(epochConfig);
+    return randomizer;
+}
+
+BOOST_AUTO_TEST_CASE(BlockRandomizerChunkPrefetch)
+{
+    const size_t numSequences = 60;
+    const size_t sequencesPerChunk = 6;
+    const size_t minibatchSize = 5;
+
+    // the chunks of each minibatch; the randomization does not depend on the cache
+    std::vector<std::set<size_t>> minibatchChunks;
+    {
+        auto deserializer = std::make_shared<MockSequenceDeserializer>(std::vector<size_t>(numSequences, 1), sequencesPerChunk);
+        auto randomizer = CreateChunkCacheRandomizer(deserializer, 4 * sequencesPerChunk, false, minibatchSize);
+        for (size_t i = 0; i < numSequences / minibatchSize; i++)
+        {
+            minibatchChunks.push_back(std::set<size_t>());
+            for (const auto& sequence : randomizer->GetNextSequences(minibatchSize).m_data)
+            {
+                minibatchChunks.back().insert(static_cast<const SequenceDescription*>(sequence[0]->m_data)->m_chunkId);
+            }
+        }
+    }
+
+    // the chunks of the next minibatch are loaded while the caller is busy elsewhere
+    {
+        auto deserializer = std::make_shared<MockSequenceDeserializer>(std::vector<size_t>(numSequences, 1), sequencesPerChunk);
+        auto randomizer = CreateChunkCacheRandomizer(deserializer, 4 * sequencesPerChunk, true, minibatchSize);
+        const auto& statistics = randomizer->GetChunkCacheStatistics();
+        for (size_t i = 0; i < numSequences / minibatchSize; i++)
+        {
+            randomizer->GetNextSequences(minibatchSize);
+
+            // outside of the randomizer, wait until the prefetch thread has loaded all requested chunks
+            for (size_t j = 0; j < 10000 && deserializer->GetNumChunkLoads() < statistics.m_numMisses + statistics.m_numPrefetches; j++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            BOOST_REQUIRE_EQUAL(deserializer->GetNumChunkLoads(), statistics.m_numMisses + statistics.m_numPrefetches);
+        }
+        // so no minibatch had to wait for them
+        BOOST_CHECK(statistics.m_numPrefetches > 0);
+        BOOST_CHECK_EQUAL(statistics.m_numWaits, 0);
+    }
+
+    // a chunk that is only prefetched fails to load: the error reaches the minibatch that needs it
+    size_t failingMinibatch = 1;
+    std::set<size_t> previousChunks(minibatchChunks[0]);
+    while (failingMinibatch < minibatchChunks.size() &&
+           std::includes(previousChunks.begin(), previousChunks.end(), minibatchChunks[failingMinibatch].begin(), minibatchChunks[failingMinibatch].end()))
+    {
+        previousChunks.insert(minibatchChunks[failingMinibatch].begin(), minibatchChunks[failingMinibatch].end());
+        failingMinibatch++;
+    }
+    BOOST_REQUIRE(failingMinibatch < minibatchChunks.size());
+    std::vector<size_t> newChunks;
+    std::set_difference(minibatchChunks[failingMinibatch].begin(), minibatchChunks[failingMinibatch].end(),
+                        previousChunks.begin(), previousChunks.end(), std::back_inserter(newChunks));
+    {
+        auto deserializer = std::make_shared<MockSequenceDeserializer>(std::vector<size_t>(numSequences, 1), sequencesPerChunk, newChunks[0]);
+        auto randomizer = CreateChunkCacheRandomizer(deserializer, 4 * sequencesPerChunk, true, minibatchSize);
+        for (size_t i = 0; i < failingMinibatch; i++)
+        {
+            randomizer->GetNextSequences(minibatchSize);
+        }
+        BOOST_CHECK_THROW(randomizer->GetNextSequences(minibatchSize), std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ChunkedBinaryRoundTrip)
+{
+    const std::wstring path = L"ChunkedBinaryRoundTrip.bin";
+    const size_t numSamples = 10;
+    const size_t denseDim = 3;
+    const size_t sparseDim = 5;
+
+    auto dense = std::make_shared<StreamDescription>();
+    dense->m_name = L"features";
+    dense->m_id = 0;
+    dense->m_storageType = StorageType::dense;
+    dense->m_elementType = ElementType::tfloat;
+    dense->m_sampleLayout = std::make_shared<TensorShape>(denseDim);
+    auto sparse = std::make_shared<StreamDescription>();
+    sparse->m_name = L"labels";
+    sparse->m_id = 1;
+    sparse->m_storageType = StorageType::sparse_csc;
+    sparse->m_elementType = ElementType::tfloat;
+    sparse->m_sampleLayout = std::make_shared<TensorShape>(sparseDim);
+
+    // dense: i * 10 + k; sparse: i at row i % 5, and -i at row (i + 2) % 5 for even i (added out of order)
+    {
+        ChunkedBinaryWriter writer(path, std::vector<StreamDescriptionPtr>{ dense, sparse }, 4);
+        for (size_t i = 0; i < numSamples; i++)
+        {
+            for (size_t k = 0; k < denseDim; k++)
+            {
+                writer.AddValue(0, k, (double) (i * 10 + k));
+            }
+            if (i % 2 == 0)
+            {
+                writer.AddValue(1, (i + 2) % sparseDim, -(double) i);
+            }
+            writer.AddValue(1, i % sparseDim, (double) i);
+            writer.EndSample();
+        }
+        writer.Close();
+        BOOST_CHECK_EQUAL(writer.GetNumSamples(), numSamples);
+    }
+
+    {
+        auto deserializer = std::make_shared<ChunkedBinaryDeserializer>(path);
+        auto streams = deserializer->GetStreamDescriptions();
+        BOOST_REQUIRE_EQUAL(streams.size(), 2);
+        BOOST_CHECK(streams[0]->m_name == L"features");
+        BOOST_CHECK(streams[0]->m_storageType == StorageType::dense);
+        BOOST_CHECK_EQUAL(streams[0]->m_sampleLayout->GetNumElements(), denseDim);
+        BOOST_CHECK(streams[1]->m_name == L"labels");
+        BOOST_CHECK(streams[1]->m_storageType == StorageType::sparse_csc);
+        BOOST_CHECK_EQUAL(streams[1]->m_sampleLayout->GetNumElements(), sparseDim);
+
+        const auto& descriptions = deserializer->GetSequenceDescriptions();
+        BOOST_REQUIRE_EQUAL(descriptions.size(), numSamples);
+        for (const auto* description : descriptions)
+        {
+            size_t i = description->m_id;
+            BOOST_CHECK_EQUAL(description->m_chunkId, i / 4);
+            auto data = deserializer->GetChunk(description->m_chunkId)->GetSequence(i);
+            BOOST_REQUIRE_EQUAL(data.size(), 2);
+
+            const float* denseValues = reinterpret_cast<const float*>(data[0]->m_data);
+            for (size_t k = 0; k < denseDim; k++)
+            {
+                BOOST_CHECK_EQUAL(denseValues[k], (float) (i * 10 + k));
+            }
+
+            // sparse values are sorted by row
+            const auto& sparseData = static_cast<const SparseSequenceData&>(*data[1]);
+            const float* sparseValues = reinterpret_cast<const float*>(sparseData.m_data);
+            BOOST_REQUIRE_EQUAL(sparseData.m_indices.size(), 1);
+            std::map<size_t, float> expected = { { i % sparseDim, (float) i } };
+            if (i % 2 == 0)
+            {
+                expected[(i + 2) % sparseDim] = -(float) i;
+            }
+            BOOST_REQUIRE_EQUAL(sparseData.m_indices[0].size(), expected.size());
+            size_t j = 0;
+            for (const auto& value : expected)
+            {
+                BOOST_CHECK_EQUAL(sparseData.m_indices[0][j], value.first);
+                BOOST_CHECK_EQUAL(sparseValues[j], value.second);
+                j++;
+            }
+        }
+
+        // through the randomizer and the packer: every sample exactly once
+        auto randomizer = std::make_shared<BlockRandomizer>(0, SIZE_MAX, deserializer);
+        EpochConfiguration config;
+        config.m_numberOfWorkers = 1;
+        config.m_workerRank = 0;
+        config.m_minibatchSizeInSamples = 4;
+        config.m_totalEpochSizeInSamples = requestDataSize;
+        config.m_epochIndex = 0;
+        randomizer->StartEpoch(config);
+        SequencePacker packer(std::make_shared<HeapMemoryProvider>(), randomizer, 4, streams);
+
+        std::vector<size_t> numReturned(numSamples, 0);
+        for (size_t m = 0; m < numSamples; m++)
+        {
+            auto minibatch = packer.ReadMinibatch();
+            if (minibatch.m_data.empty())
+            {
+                break;
+            }
+            const auto& layout = minibatch.m_data[0]->m_layout;
+            const float* values = reinterpret_cast<const float*>(minibatch.m_data[0]->m_data);
+            for (size_t column = 0; column < layout->GetNumCols(); column++)
+            {
+                size_t i = (size_t) values[column * denseDim] / 10;
+                BOOST_REQUIRE(i < numSamples);
+                BOOST_CHECK_EQUAL(values[column * denseDim + 2], (float) (i * 10 + 2));
+                numReturned[i]++;
+            }
+            if (minibatch.m_endOfEpoch)
+            {
+                break;
+            }
+        }
+        BOOST_CHECK(std::all_of(numReturned.begin(), numReturned.end(), [](size_t n) { return n == 1; }));
+    }
+    std::remove("ChunkedBinaryRoundTrip.bin");
+}
+
+BOOST_AUTO_TEST_CASE(ChunkedBinaryCorrupted)
+{
+    const std::wstring path = L"ChunkedBinaryCorrupted.bin";
+    auto dense = std::make_shared<StreamDescription>();
+    dense->m_name = L"features";
+    dense->m_id = 0;
+    dense->m_storageType = StorageType::dense;
+    dense->m_elementType = ElementType::tfloat;
+    dense->m_sampleLayout = std::make_shared<TensorShape>(2);
+    auto sparse = std::make_shared<StreamDescription>();
+    sparse->m_name = L"labels";
+    sparse->m_id = 1;
+    sparse->m_storageType = StorageType::sparse_csc;
+    sparse->m_elementType = ElementType::tfloat;
+    sparse->m_sampleLayout = std::make_shared<TensorShape>(3);
+    {
+        ChunkedBinaryWriter writer(path, std::vector<StreamDescriptionPtr>{ dense, sparse }, 2);
+        for (size_t i = 0; i < 4; i++)
+        {
+            writer.AddValue(0, 0, (double) i);
+            writer.AddValue(1, i % 3, 1.0);
+            writer.EndSample();
+        }
+    }
+    std::vector<char> original;
+    {
+        std::ifstream file("ChunkedBinaryCorrupted.bin", std::ios::binary);
+        original.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    BOOST_REQUIRE(original.size() > sizeof(ChunkedBinaryHeader));
+    ChunkedBinaryHeader header;
+    memcpy(&header, original.data(), sizeof(header));
+
+    // loads chunk 0 of a modified copy of the file
+    auto loadCorrupted = [&](std::function<void(std::vector<char>&)> corrupt)
+    {
+        std::vector<char> data(original);
+        corrupt(data);
+        {
+            std::ofstream file("ChunkedBinaryCorrupted.bin", std::ios::binary | std::ios::trunc);
+            file.write(data.data(), data.size());
+        }
+        ChunkedBinaryDeserializer deserializer(path);
+        deserializer.GetChunk(0);
+    };
+    auto setUInt64 = [](std::vector<char>& data, size_t offset, uint64_t value)
+    {
+        memcpy(data.data() + offset, &value, sizeof(value));
+    };
+    const size_t chunkIndexEntry0 = (size_t) header.m_chunkIndexOffset; // first sample, samples, then offset and nnz per stream
+
+    BOOST_CHECK_NO_THROW(loadCorrupted([](std::vector<char>&) {}));
+    BOOST_CHECK_THROW(loadCorrupted([](std::vector<char>& data) { data.resize(data.size() - 8); }), std::runtime_error);
+    BOOST_CHECK_THROW(loadCorrupted([](std::vector<char>& data)
+    {
+        uint32_t numStreams = 1000;
+        memcpy(data.data() + offsetof(ChunkedBinaryHeader, m_numStreams), &numStreams, sizeof(numStreams));
+    }), std::runtime_error);
+    BOOST_CHECK_THROW(loadCorrupted([&](std::vector<char>& data) { setUInt64(data, offsetof(ChunkedBinaryHeader, m_numChunks), (uint64_t) 1 << 60); }), std::runtime_error);
+    BOOST_CHECK_THROW(loadCorrupted([&](std::vector<char>& data) { setUInt64(data, chunkIndexEntry0 + 8, 3); }), std::runtime_error);
+    BOOST_CHECK_THROW(loadCorrupted([&](std::vector<char>& data) { setUInt64(data, chunkIndexEntry0 + 16, header.m_chunkIndexOffset); }), std::runtime_error);
+    BOOST_CHECK_THROW(loadCorrupted([&](std::vector<char>& data) { setUInt64(data, chunkIndexEntry0 + 40, 1000); }), std::runtime_error);
+
+    // a row index out of range
+    BOOST_CHECK_THROW(loadCorrupted([&](std::vector<char>& data)
+    {
+        uint64_t sparseOffset;
+        memcpy(&sparseOffset, data.data() + chunkIndexEntry0 + 32, sizeof(sparseOffset));
+        int32_t rowIndex = 3;
+        memcpy(data.data() + sparseOffset + ChunkedBinaryAlignment, &rowIndex, sizeof(rowIndex));
+    }), std::runtime_error);
+    std::remove("ChunkedBinaryCorrupted.bin");
+}
+
+// image i: 'i' repeated 10 + 7 * (i % 3) times, of class 100 + i % 4
+static std::vector<char> PackedImage(size_t i)
+{
+    return std::vector<char>(10 + 7 * (i % 3), (char) i);
+}
+
+static void WriteImagePack(const std::wstring& path, size_t numImages, size_t imagesPerChunk)
+{
+    ImagePackWriter writer(path, imagesPerChunk);
+    for (size_t i = 0; i < numImages; i++)
+    {
+        auto image = PackedImage(i);
+        writer.AddImage(image.data(), image.size(), 100 + i % 4);
+    }
+    writer.Close();
+    BOOST_CHECK_EQUAL(writer.GetNumImages(), numImages);
+}
+
+BOOST_AUTO_TEST_CASE(ImagePackRoundTrip)
+{
+    const std::wstring path = L"ImagePackRoundTrip.bin";
+    const size_t numImages = 11;
+    const size_t imagesPerChunk = 3; // (the last chunk is partial)
+    WriteImagePack(path, numImages, imagesPerChunk);
+
+    BOOST_CHECK(ImagePackFile::IsImagePack(path));
+    BOOST_CHECK(!ImagePackFile::IsImagePack(L"ImagePackRoundTrip.missing"));
+
+    ImagePackFile pack(path);
+    BOOST_REQUIRE_EQUAL(pack.GetNumImages(), numImages);
+    BOOST_REQUIRE_EQUAL(pack.GetNumChunks(), 4);
+
+    uint64_t offset = sizeof(ImagePackHeader);
+    for (size_t i = 0; i < numImages; i++)
+    {
+        const auto& entry = pack.GetImage(i);
+        BOOST_CHECK_EQUAL(entry.m_offset, offset);
+        BOOST_CHECK_EQUAL(entry.m_size, PackedImage(i).size());
+        BOOST_CHECK_EQUAL(entry.m_classId, 100 + i % 4);
+        offset += entry.m_size;
+    }
+
+    std::vector<char> buffer;
+    size_t numRead = 0;
+    for (size_t chunkId = 0; chunkId < pack.GetNumChunks(); chunkId++)
+    {
+        BOOST_CHECK_EQUAL(pack.GetFirstImage(chunkId), chunkId * imagesPerChunk);
+        BOOST_CHECK_EQUAL(pack.GetNumImages(chunkId), std::min(imagesPerChunk, numImages - chunkId * imagesPerChunk));
+        BOOST_CHECK_EQUAL(pack.GetChunkOffset(chunkId), pack.GetImage(pack.GetFirstImage(chunkId)).m_offset);
+
+        pack.ReadChunk(chunkId, buffer);
+        size_t chunkSize = 0;
+        for (size_t i = pack.GetFirstImage(chunkId); i < pack.GetFirstImage(chunkId) + pack.GetNumImages(chunkId); i++)
+        {
+            const auto& entry = pack.GetImage(i);
+            auto expected = PackedImage(i);
+            size_t begin = (size_t) (entry.m_offset - pack.GetChunkOffset(chunkId));
+            BOOST_REQUIRE_LE(begin + entry.m_size, buffer.size());
+            BOOST_CHECK(std::equal(expected.begin(), expected.end(), buffer.begin() + begin));
+            chunkSize += entry.m_size;
+            numRead++;
+        }
+        BOOST_CHECK_EQUAL(buffer.size(), chunkSize);
+    }
+    BOOST_CHECK_EQUAL(numRead, numImages);
+    std::remove("ImagePackRoundTrip.bin");
+
+    // an empty pack has no chunks
+    WriteImagePack(path, 0, imagesPerChunk);
+    BOOST_CHECK_EQUAL(ImagePackFile(path).GetNumImages(), 0);
+    BOOST_CHECK_EQUAL(ImagePackFile(path).GetNumChunks(), 0);
+    std::remove("ImagePackRoundTrip.bin");
+}
+
+BOOST_AUTO_TEST_CASE(ImagePackCorrupted)
+{
+    const std::wstring path = L"ImagePackCorrupted.bin";
+    BOOST_CHECK_THROW(ImagePackWriter(path, 0), std::invalid_argument);
+    {
+        ImagePackWriter writer(path, 2);
+        BOOST_CHECK_THROW(writer.AddImage("", 0, 0), std::runtime_error);
+    }
+
+    WriteImagePack(path, 5, 2);
+    std::vector<char> original;
+    {
+        std::ifstream file("ImagePackCorrupted.bin", std::ios::binary);
+        original.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    BOOST_REQUIRE(original.size() > sizeof(ImagePackHeader));
+    ImagePackHeader header;
+    memcpy(&header, original.data(), sizeof(header));
+
+    // opens a modified copy of the file
+    auto openCorrupted = [&](std::function<void(std::vector<char>&)> corrupt)
+    {
+        std::vector<char> data(original);
+        corrupt(data);
+        {
+            std::ofstream file("ImagePackCorrupted.bin", std::ios::binary | std::ios::trunc);
+            file.write(data.data(), data.size());
+        }
+        ImagePackFile pack(path);
+    };
+    auto setUInt64 = [](std::vector<char>& data, size_t offset, uint64_t value)
+    {
+        memcpy(data.data() + offset, &value, sizeof(value));
+    };
+    const size_t imageIndexEntry1 = (size_t) header.m_imageIndexOffset + sizeof(ImagePackEntry);
+
+    BOOST_CHECK_NO_THROW(openCorrupted([](std::vector<char>&) {}));
+    BOOST_CHECK_THROW(openCorrupted([](std::vector<char>& data) { data.resize(data.size() - 8); }), std::runtime_error);
+    BOOST_CHECK_THROW(openCorrupted([](std::vector<char>& data) { data.resize(sizeof(ImagePackHeader) / 2); }), std::runtime_error);
+    BOOST_CHECK_THROW(openCorrupted([](std::vector<char>& data) { data[0] = 'X'; }), std::runtime_error);
+    BOOST_CHECK_THROW(openCorrupted([](std::vector<char>& data) { data[offsetof(ImagePackHeader, m_version)] = 2; }), std::runtime_error);
+    BOOST_CHECK_THROW(openCorrupted([&](std::vector<char>& data) { setUInt64(data, offsetof(ImagePackHeader, m_numImages), (uint64_t) 1 << 60); }), std::runtime_error);
+    BOOST_CHECK_THROW(openCorrupted([&](std::vector<char>& data) { setUInt64(data, offsetof(ImagePackHeader, m_numChunks), (uint64_t) 1 << 60); }), std::runtime_error);
+    BOOST_CHECK_THROW(openCorrupted([&](std::vector<char>& data) { setUInt64(data, offsetof(ImagePackHeader, m_imageIndexOffset), 0); }), std::runtime_error);
+    // an image that overlaps its predecessor, and one whose size reaches into the image index
+    BOOST_CHECK_THROW(openCorrupted([&](std::vector<char>& data) { setUInt64(data, imageIndexEntry1 + offsetof(ImagePackEntry, m_offset), sizeof(ImagePackHeader)); }), std::runtime_error);
+    BOOST_CHECK_THROW(openCorrupted([&](std::vector<char>& data) { data[imageIndexEntry1 + offsetof(ImagePackEntry, m_size)] += 1; }), std::runtime_error);
+    // a chunk index that does not cover all images
+    BOOST_CHECK_THROW(openCorrupted([&](std::vector<char>& data) { setUInt64(data, (size_t) header.m_chunkIndexOffset + header.m_numChunks * sizeof(uint64_t), 4); }), std::runtime_error);
+    BOOST_CHECK_THROW(openCorrupted([&](std::vector<char>& data) { setUInt64(data, (size_t) header.m_chunkIndexOffset, 1); }), std::runtime_error);
+    std::remove("ImagePackCorrupted.bin");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } } } }